@@ -0,0 +1,9 @@
+#
+# Links the project with link time optimization (used by the release environments)
+#
+# The project sources are compiled with "-flto" by build_src_flags, then optimized together here
+# The framework is left out of it, so that "--wrap=HAL_UART_ErrorCallback" still catches the calls from the HAL
+#
+Import("env")
+
+env.Append(LINKFLAGS=["-flto", "-Os"])
@@ -0,0 +1,51 @@
+#
+# Reports the RAM used by the firmware after it is linked (used by every hardware environment)
+#
+# Everything in the firmware is allocated statically (the timers are constructed in place), so .data and .bss are the whole of the fixed RAM
+# What is left over is shared by the stack and the short lived Strings of the replies
+# The largest variables are listed too, so that it is easy to see where the RAM went before adding a buffer
+#
+Import("env")
+
+import subprocess
+
+# Variables to list, largest first
+RAM_REPORT_SYMBOLS = 12
+
+# Sections that are placed in RAM
+RAM_SECTIONS = (".data", ".bss", "._user_heap_stack")
+
+
+def ram_report(source, target, env):
+    elf = str(target[0])
+    total = env.BoardConfig().get("upload.maximum_ram_size", 0)
+
+    # Sizes of the RAM sections
+    sizes = {}
+    output = subprocess.check_output([env.subst("$SIZETOOL"), "-A", elf]).decode()
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] in RAM_SECTIONS:
+            sizes[fields[0]] = int(fields[1])
+    static = sizes.get(".data", 0) + sizes.get(".bss", 0)
+
+    # Largest variables (b, d are .bss and .data, both local and global)
+    nm = env.subst("$CC").replace("gcc", "nm")
+    symbols = []
+    output = subprocess.check_output([nm, "--size-sort", "--reverse-sort", "--demangle", "-S", elf]).decode()
+    for line in output.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) == 4 and fields[2] in "bBdD":
+            symbols.append((int(fields[1], 16), fields[3]))
+
+    print("RAM report")
+    print("  .data:  %6d bytes" % sizes.get(".data", 0))
+    print("  .bss:   %6d bytes" % sizes.get(".bss", 0))
+    if total > 0:
+        print("  Static: %6d of %d bytes (%.1f%%), %d left for the stack and the replies" % (static, total, 100.0 * static / total, total - static))
+    print("  Largest variables:")
+    for size, name in symbols[:RAM_REPORT_SYMBOLS]:
+        print("    %6d  %s" % (size, name))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", ram_report)
@@ -6,12 +6,53 @@
 #include "config.h"
 #include "Arduino.h"
 #include "oled.h"
+#include "configCommit.h"
+#include "ringBuffer.h"
 
 // Variable definitions
 // Boolean for storing if the dip switches were installed the wrong way
 bool dipInverted = false;
 uint32_t lastButtonClickTime = 0;
 
+// Set by the dip switch interrupt when any of the switches move, cleared once the change has been applied
+volatile bool dipsChanged = true;
+
+// The last time that a dip switch moved (used for debouncing)
+volatile uint32_t lastDipChangeTime = 0;
+
+// The state of the dips that was last applied (DIP_STATE_UNKNOWN forces the first read to be applied)
+uint8_t appliedDipState = DIP_STATE_UNKNOWN;
+
+// Buttons scanned from the SysTick
+#if defined(ENABLE_OLED) && defined(ENABLE_BUTTON_SCANNER)
+
+// The buttons, in the order that the polling checks them
+typedef enum {
+    BUTTON_SELECT,
+    BUTTON_DOWN,
+    BUTTON_BACK,
+    BUTTON_COUNT
+} BUTTON_ID;
+static const PinName buttonPins[BUTTON_COUNT] = { SELECT_BUTTON_PIN, DOWN_BUTTON_PIN, BACK_BUTTON_PIN };
+
+// A click, with the time that it was found
+typedef struct {
+    uint8_t button;
+    uint32_t time;
+} buttonEvent;
+
+// Clicks waiting for the UI task (the SysTick pushes, the UI task pops)
+static RingBuffer<buttonEvent, BUTTON_EVENT_QUEUE_SIZE> buttonEvents;
+
+// If the pins have been set up, the scan leaves them alone until then
+static volatile bool buttonsScanning = false;
+
+// Debounced state of each button, the scans that it has read differently for, and the time that it has been held since the last click
+static bool buttonPressed[BUTTON_COUNT] = {};
+static uint8_t buttonChangeTime[BUTTON_COUNT] = {};
+static uint16_t buttonHeldTime[BUTTON_COUNT] = {};
+#endif
+
 // Initialize the button pins as inputs
 void initButtons() {
 
@@ -26,7 +67,17 @@ void initButtons() {
 
     // Back pin (opens menu and also backs out of menus)
     pinMode(BACK_BUTTON_PIN, INPUT_PULLUP);
+
+    // Start scanning them
+    #ifdef ENABLE_BUTTON_SCANNER
+      buttonsScanning = true;
+    #endif
   #endif
+}
+
+
+// Initialize the dip switch pins as inputs, watching them for changes
+void initDips() {
 
   // All of the dip switches
   pinMode(DIP_1_PIN, INPUT_PULLUP);
@@ -34,13 +85,95 @@ void initButtons() {
   pinMode(DIP_3_PIN, INPUT_PULLUP);
   pinMode(DIP_4_PIN, INPUT_PULLUP);
 
-  // Read the microstepping of the dip switches
-  readDipMicrostepping();
+  // Flag any change of the switches, so that the dip task only has to do work when a switch actually moves
+  // EXTI lines 15, 3, 11, and 10. The down button shares line 3, but it is polled (or scanned) so it doesn't need it
+  attachInterrupt(DIP_1_PIN, dipChangeHandler, CHANGE);
+  attachInterrupt(DIP_2_PIN, dipChangeHandler, CHANGE);
+  attachInterrupt(DIP_3_PIN, dipChangeHandler, CHANGE);
+  attachInterrupt(DIP_4_PIN, dipChangeHandler, CHANGE);
+
+  // Apply the initial settings of the dip switches on the first check
+  dipsChanged = true;
+}
+
+
+// Handles a change of any of the dip switches
+void dipChangeHandler() {
+  dipsChanged = true;
+  lastDipChangeTime = millis();
 }
 
 // Only include button code if using the OLED panel
 #ifdef ENABLE_OLED
 
+// Buttons scanned from the SysTick
+#ifdef ENABLE_BUTTON_SCANNER
+// Debounces the buttons once a ms, queueing a click as a button settles down and each BUTTON_REPEAT_INTERVAL that it is held (the core's SysTick calls this)
+extern "C" void HAL_SYSTICK_Callback(void) {
+  if (!buttonsScanning) {
+    return;
+  }
+
+  for (uint8_t button = 0; button < BUTTON_COUNT; button++) {
+
+    // Pins are pulled high by default
+    bool pressed = (GPIO_READ(buttonPins[button]) == LOW);
+
+    // The button has to hold a new state for the debounce time before it counts
+    if (pressed != buttonPressed[button]) {
+      if (++buttonChangeTime[button] >= BUTTON_DEBOUNCE_TIME) {
+        buttonPressed[button] = pressed;
+        buttonChangeTime[button] = 0;
+        buttonHeldTime[button] = 0;
+        if (pressed) {
+          buttonEvents.push({ button, millis() });
+        }
+      }
+      continue;
+    }
+    buttonChangeTime[button] = 0;
+
+    // Repeat the click while the button is held
+    if (pressed && ++buttonHeldTime[button] >= BUTTON_REPEAT_INTERVAL) {
+      buttonHeldTime[button] = 0;
+      buttonEvents.push({ button, millis() });
+    }
+  }
+}
+
+
+// Handles the clicks that were queued by the scan
+void checkButtons(bool updateScreen, bool onlyAllowSelect) {
+  buttonEvent event;
+  while (buttonEvents.pop(event)) {
+
+    // Clicks that waited too long (ex. while calibrating) would do something the user no longer expects
+    if ((millis() - event.time) > BUTTON_EVENT_MAX_AGE) {
+      continue;
+    }
+
+    switch (event.button) {
+      case BUTTON_SELECT:
+        selectMenuItem();
+        break;
+
+      case BUTTON_DOWN:
+        if (!onlyAllowSelect) {
+          moveCursor();
+        }
+        break;
+
+      case BUTTON_BACK:
+        if (!onlyAllowSelect) {
+          exitCurrentMenu();
+        }
+        break;
+    }
+  }
+}
+
+#else // ! ENABLE_BUTTON_SCANNER
+
 // Scan each of the buttons
 void checkButtons(bool updateScreen, bool onlyAllowSelect) {
 
@@ -112,94 +245,115 @@ bool checkButtonState(PinName buttonPin) {
     return false;
   }
 }
+#endif // ! ENABLE_BUTTON_SCANNER
 #endif // ! ENABLE_OLED
 
+// Reads the dip switches into a bitmask (bit 0 is DIP_1), a set bit means that the switch is on
+uint8_t readDipState() {
+
+  // The switches pull the pins low when on
+  return ((!GPIO_READ(DIP_1_PIN) ? DIP_1_ON : 0) |
+          (!GPIO_READ(DIP_2_PIN) ? DIP_2_ON : 0) |
+          (!GPIO_READ(DIP_3_PIN) ? DIP_3_ON : 0) |
+          (!GPIO_READ(DIP_4_PIN) ? DIP_4_ON : 0));
+}
+
+
 // Function for reading the microstepping set via the dip switches
 void readDipMicrostepping() {
+  applyDipMicrostepping(readDipState());
+}
 
-    // Check if the dip switches are inverted
-    if (dipInverted) {
 
-        // If they were installed incorrectly, they have to be read opposite
-        if (!GPIO_READ(DIP_4_PIN) && !GPIO_READ(DIP_3_PIN)) {
+// Sets the microstepping from a state of the dip switches
+void applyDipMicrostepping(uint8_t dipState) {
 
-            // Set the microstepping to 1/32 if both dips are on
-            motor.setMicrostepping(32);
-        }
-        else if (GPIO_READ(DIP_4_PIN) && !GPIO_READ(DIP_3_PIN)) {
+    // If they were installed incorrectly, they have to be read opposite
+    bool microstep1 = (dipState & (dipInverted ? DIP_4_ON : DIP_1_ON));
+    bool microstep2 = (dipState & (dipInverted ? DIP_3_ON : DIP_2_ON));
 
-            // Set the microstepping to 1/16 if the left dip is off and the right is on
-            motor.setMicrostepping(16);
-        }
-        else if (!GPIO_READ(DIP_4_PIN) && GPIO_READ(DIP_3_PIN)) {
+    uint16_t microstepping;
+    if (microstep1 && microstep2) {
 
-            // Set the microstepping to 1/8 if the right dip is off and the left on
-            motor.setMicrostepping(8);
-        }
-        else {
-            // Both are off, just revert to using full stepping
-            motor.setMicrostepping(1);
-        }
+        // Set the microstepping to 1/32 if both dips are on
+        microstepping = 32;
     }
-    else {
-        // Dips are not inverted, they are installed correctly
-        if (!GPIO_READ(DIP_1_PIN) && !GPIO_READ(DIP_2_PIN)) {
+    else if (!microstep1 && microstep2) {
 
-            // Set the microstepping to 1/32 if both dips are on
-            motor.setMicrostepping(32);
-        }
-        else if (GPIO_READ(DIP_1_PIN) && !GPIO_READ(DIP_2_PIN)) {
-
-            // Set the microstepping to 1/16 if the left dip is off and the right is on
-            motor.setMicrostepping(16);
-        }
-        else if (!GPIO_READ(DIP_1_PIN) && GPIO_READ(DIP_2_PIN)) {
+        // Set the microstepping to 1/16 if the left dip is off and the right is on
+        microstepping = 16;
+    }
+    else if (microstep1 && !microstep2) {
 
-            // Set the microstepping to 1/8 if the right dip is off and the left on
-            motor.setMicrostepping(8);
-        }
-        else {
-            // Both are off, just revert to using full stepping
-            motor.setMicrostepping(1);
-        }
+        // Set the microstepping to 1/8 if the right dip is off and the left on
+        microstepping = 8;
+    }
+    else {
+        // Both are off, just revert to using full stepping
+        microstepping = 1;
     }
 
-    // Update the timer based on the new microstepping
-    updateCorrectionTimer();
+    // Set the microstepping at the next tick, or set it right away, then update the timer based on the new microstepping
+    #ifdef ENABLE_CONFIG_COMMIT
+        editConfig() -> microstepping = microstepping;
+        commitConfig();
+    #else
+        motor.setMicrostepping(microstepping);
+        updateCorrectionTimer();
+    #endif
 }
 
 
 // Check all of the dip switches
+// Only does anything once a switch has moved and settled, so the counters and timers are left alone otherwise
 void checkDips() {
 
-  // Read the microstepping
-  readDipMicrostepping();
+  // Nothing has moved since the last check
+  if (!dipsChanged) {
+    return;
+  }
+
+  // Wait for the switches to stop bouncing
+  if (millis() - lastDipChangeTime < DIP_DEBOUNCE_TIME) {
+    return;
+  }
 
-  // Adjust based on if inverted
-  if (dipInverted) {
+  // Clear the flag before reading, so a change during the read is caught on the next check
+  dipsChanged = false;
+  uint8_t dipState = readDipState();
 
-    // Check open/closed loop
-    if (!GPIO_READ(DIP_2_PIN)) {
-      enableStepCorrection();
-    }
-    else {
-      disableStepCorrection();
-    }
+  // The switches bounced back to where they were
+  if (dipState == appliedDipState) {
+    return;
+  }
+
+  // Set the microstepping if those switches changed (or if this is the first read)
+  uint8_t microstepMask = (dipInverted ? (DIP_3_ON | DIP_4_ON) : (DIP_1_ON | DIP_2_ON));
+  if ((appliedDipState == DIP_STATE_UNKNOWN) || ((dipState ^ appliedDipState) & microstepMask)) {
+    applyDipMicrostepping(dipState);
+  }
+
+  // Check open/closed loop (adjust based on if inverted)
+  if (dipState & (dipInverted ? DIP_2_ON : DIP_3_ON)) {
+    enableStepCorrection();
   }
   else {
-    // Check open/closed loop
-    if (!GPIO_READ(DIP_3_PIN)) {
-      enableStepCorrection();
-    }
-    else {
-      disableStepCorrection();
-    }
+    disableStepCorrection();
   }
+
+  // Save the state that was applied
+  appliedDipState = dipState;
 }
 
 
 // Function for setting if the dip switches should be inverted
 void setDipInverted(bool inverted) {
+
+    // The switches mean something different now, so they have to be applied again
+    if (inverted != dipInverted) {
+        appliedDipState = DIP_STATE_UNKNOWN;
+        dipsChanged = true;
+    }
     dipInverted = inverted;
 }
 
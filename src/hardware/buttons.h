@@ -10,8 +10,19 @@
 // Boolean for storing if the dip switches were installed the wrong way
 extern bool dipInverted;
 
+// Bits of the dip switch state (set when the switch is on)
+#define DIP_1_ON          (1 << 0)
+#define DIP_2_ON          (1 << 1)
+#define DIP_3_ON          (1 << 2)
+#define DIP_4_ON          (1 << 3)
+#define DIP_STATE_UNKNOWN 0xFF
+
 // Function definitions
 void initButtons();
+void initDips();
+void dipChangeHandler();
+uint8_t readDipState();
+void applyDipMicrostepping(uint8_t dipState);
 void checkButtons(bool updateScreen, bool onlyAllowSelect = false);
 bool checkButtonState(PinName buttonPin);
 void readDipMicrostepping();
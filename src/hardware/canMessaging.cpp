@@ -6,18 +6,61 @@
 
 // The local header file
 #include "canMessaging.h"
-
-// A string for storing the command to be processed (not all commands can be sent with a single CAN packet)
-String CANCommandString;
-
-// CAN ID buffer
-int id;
-
-// CAN filter buffer
-int filterIDx;
-
-// CAN receieve buffer
-uint8_t receiveBuffer[8];
+#include "profiler.h"
+#include "probe.h"
+#include "ringBuffer.h"
+#include "timers.h"
+#include "clock.h"
+
+#ifdef ENABLE_CAN_PDO
+#include "canProtocol.h"
+#endif
+#ifdef ENABLE_CAN_GEARING
+#include "canGearing.h"
+#endif
+
+// The receive interrupts have to stay masked by disableInterrupts() (the protocol relies on it when holding the targets)
+static_assert(CAN_RX_IRQ_PRIO > CRITICAL_SECTION_IRQ_PRIO, "CAN_RX_IRQ_PRIO must be less urgent (higher) than CRITICAL_SECTION_IRQ_PRIO");
+
+// Frames waiting to be assembled (the receive interrupt pushes, the main loop pops)
+static RingBuffer<canFrame, CAN_RX_QUEUE_SIZE> rxQueue;
+static volatile uint32_t droppedFrames = 0;
+
+// Motion frames have their own FIFO and queue, so that they never wait behind the text and parameter traffic
+#ifdef ENABLE_CAN_PDO
+static RingBuffer<canFrame, CAN_RX_QUEUE_SIZE> rxMotionQueue;
+#endif
+
+// Frames waiting for a mailbox (the main loop pushes, the transmit interrupt pops while the main loop has it masked)
+static RingBuffer<canFrame, CAN_TX_QUEUE_SIZE> txQueue;
+static volatile uint32_t droppedTxFrames = 0;
+
+// Error statistics of the bus (the overruns are counted by the receive interrupts, the rest by the main loop)
+static volatile uint32_t fifoOverruns[2] = { 0, 0 };
+static uint32_t busOffEvents = 0;
+static uint32_t errorPassiveEvents = 0;
+static uint32_t protocolErrors = 0;
+static uint32_t lastErrorStatus = 0;
+
+// Bits of the error status register
+#define CAN_ERROR_WARNING   (1UL << 0)
+#define CAN_ERROR_PASSIVE   (1UL << 1)
+#define CAN_ERROR_BUS_OFF   (1UL << 2)
+#define CAN_ERROR_CODE(esr) (((esr) >> 4) & 7)
+#define CAN_ERROR_TEC(esr)  (((esr) >> 16) & 0xFF)
+#define CAN_ERROR_REC(esr)  (((esr) >> 24) & 0xFF)
+
+// A command being assembled from the frames sent to one ID
+typedef struct {
+    uint16_t id;
+    bool receiving;
+    uint16_t length;
+    uint32_t lastFrameTime;
+    char buffer[CAN_COMMAND_BUFFER_SIZE + 1];
+} canAssembly;
+
+// The commands being assembled, one slot for each ID that is sending (frames from different IDs can be interleaved)
+static canAssembly assemblies[CAN_ASSEMBLY_SLOTS];
 
 // CAN ID of the motor driver
 AXIS_CAN_ID canID = DEFAULT_CAN_ID;
@@ -25,49 +68,134 @@ AXIS_CAN_ID canID = DEFAULT_CAN_ID;
 // The main can object for the file
 eXoCAN can;
 
+// Sets the IDs that the hardware lets through
+// Each bank holds a list of four IDs. Banks 0 and 1 go to FIFO 0 (text commands and parameters), bank 2 goes to FIFO 1 (SYNCs, targets, trajectory points, and the gearing's frames)
+static void setCANFilters() {
+
+    // The board's own ID, its group, and the broadcast (unused slots repeat the board's ID)
+    int groupID = getCANGroup(canID);
+    if (groupID == CAN_GROUP_NONE) {
+        groupID = canID;
+    }
+
+    // Text commands, parameters, and polls
+    #ifdef ENABLE_CAN_PDO
+        can.filterList16Init(0, canID, groupID, CAN_BROADCAST_ID, CAN_FRAME_ID(CAN_FUNCTION_PARAM_REQUEST, canID));
+        can.filterList16Init(1, CAN_FRAME_ID(CAN_FUNCTION_PARAM_REQUEST, groupID), CAN_FRAME_ID(CAN_FUNCTION_PARAM_REQUEST, CAN_BROADCAST_ID),
+                                CAN_FRAME_ID(CAN_FUNCTION_POLL_REQUEST, canID), CAN_FRAME_ID(CAN_FUNCTION_POLL_REQUEST, CAN_BROADCAST_ID));
+    #else
+        can.filterList16Init(0, canID, groupID, CAN_BROADCAST_ID, canID);
+    #endif
+
+    // Motion, only the board's own targets and trajectory points (each board has different ones), and the position of the master being followed
+    #ifdef ENABLE_CAN_PDO
+        #ifdef ENABLE_CAN_GEARING
+            int gearID = (getGearMaster() != NONE ? CAN_FRAME_ID(CAN_FUNCTION_GEAR, getGearMaster()) : CAN_FRAME_ID(CAN_FUNCTION_TARGET, canID));
+        #else
+            int gearID = CAN_FRAME_ID(CAN_FUNCTION_TARGET, canID);
+        #endif
+        #ifdef ENABLE_PVT_TRAJECTORY
+            int pvtID = CAN_FRAME_ID(CAN_FUNCTION_PVT, canID);
+        #else
+            int pvtID = CAN_FRAME_ID(CAN_FUNCTION_TARGET, canID);
+        #endif
+        #ifdef ENABLE_CAN_SYNC
+            can.filterList16Init(2, CAN_SYNC_ID, CAN_FRAME_ID(CAN_FUNCTION_TARGET, canID), gearID, pvtID);
+        #else
+            can.filterList16Init(2, CAN_FRAME_ID(CAN_FUNCTION_TARGET, canID), gearID, pvtID, CAN_FRAME_ID(CAN_FUNCTION_TARGET, canID));
+        #endif
+        can.setFilterFifo(2, 1);
+    #endif
+}
+
+
 // Function for initializing the CAN interface
 void initCAN() {
 
     // Initialize the CAN interface
-    can.begin(STD_ID_LEN, CAN_BITRATE, PORTA_11_12_XCVR);
+    // The library's timing assumes a 36 MHz APB1, so it is replaced with one found from the actual clock
+    can.begin(STD_ID_LEN, BR125K, PORTA_11_12_XCVR);
+    can.setBitTiming(getCANBitTiming(CAN_BITRATE));
 
     // Set the listening IDs
-    can.filterList16Init(0, canID);
+    setCANFilters();
 
-    // Attach the receive interrupt
-    can.attachInterrupt(rxCANFrame);
+    // Enable the receive interrupt (its handler is in the normal vector table, shared with the USB, which isn't used)
+    HAL_NVIC_SetPriority(USB_LP_CAN1_RX0_IRQn, CAN_RX_IRQ_PRIO, CAN_RX_IRQ_SUBPRIO);
+    can.enableInterrupt();
 
-    // Clear the command string
-    CANCommandString = String();
+    // Motion frames are received by their own interrupt, at the same priority so the two never overlap
+    #ifdef ENABLE_CAN_PDO
+        HAL_NVIC_SetPriority(CAN1_RX1_IRQn, CAN_RX_IRQ_PRIO, CAN_RX_IRQ_SUBPRIO);
+        can.enableFifo1Interrupt();
+    #endif
+
+    // Enable the transmit interrupt, it refills the mailboxes from the queue
+    HAL_NVIC_SetPriority(USB_HP_CAN1_TX_IRQn, CAN_TX_IRQ_PRIO, CAN_TX_IRQ_SUBPRIO);
+    HAL_NVIC_EnableIRQ(USB_HP_CAN1_TX_IRQn);
 }
 
-// Send a String over the CAN bus. Strings will have a "<" to start and a ">" to end
-void txCANString(int ID, String string) {
 
-    // Make sure that the ID is valid
-    if (ID != -1) {
+// Moves queued frames into the mailboxes until they are all full or the queue is empty
+static void fillTxMailboxes() {
+    canFrame frame;
+    while (can.txMailboxFree() && txQueue.pop(frame)) {
+        can.transmit(frame.id, frame.data, frame.length);
+    }
 
-        // Add the beginning character to the string
-        string = STRING_START_MARKER + string;
+    // Only interrupt as the mailboxes empty if there's more to send
+    can.enableTxInterrupt(!txQueue.isEmpty());
+}
 
-        // Loop through forever, only exiting on sending the last string
-        while (true) {
 
-            // Check the length of the string (need an extra character for the ">" (ending character))
-            if ((string.length() + 1) > 8) {
+// Refills the mailboxes as they empty
+extern "C" void USB_HP_CAN1_TX_IRQHandler(void) {
+    can.clearTxComplete();
+    fillTxMailboxes();
+}
 
-                // Send the message over the CAN bus
-                can.transmit(ID, string.substring(0, 7).c_str(), 8);
 
-                // Remove the data sent with this packet
-                string.remove(0, 8);
-            }
-            else {
-                // Send the last CAN message, with a > appended to the end
-                can.transmit(ID, string.c_str() + STRING_END_MARKER, string.length());
+// Queues a frame to be sent, without waiting
+bool txCANFrame(uint16_t ID, const uint8_t* data, uint8_t length) {
+
+    // Copy the frame into the queue
+    canFrame frame;
+    frame.id = ID;
+    frame.length = min(length, (uint8_t)8);
+    memset(frame.data, 0, sizeof(frame.data));
+    memcpy(frame.data, data, frame.length);
+    if (!txQueue.push(frame)) {
+        return false;
+    }
+
+    // Load the mailboxes right away if they are free, with the transmit interrupt masked so the queue only has one reader at a time
+    can.enableTxInterrupt(false);
+    fillTxMailboxes();
+    return true;
+}
+
+// Send a String over the CAN bus. Strings will have a "<" to start and a ">" to end
+// The string is split into 8 byte frames, waiting for room in the queue for up to CAN_TX_TIMEOUT
+void txCANString(int ID, String string) {
+
+    // Make sure that the ID is valid
+    if (ID == -1) {
+        return;
+    }
 
-                // Break the loop after finishing
-                break;
+    // Add the markers around the string
+    string = STRING_START_MARKER + string + STRING_END_MARKER;
+
+    // Queue the frames in order
+    uint32_t startTime = millis();
+    for (uint16_t start = 0; start < string.length(); start += 8) {
+        uint8_t length = min((uint16_t)(string.length() - start), (uint16_t)8);
+        while (!txCANFrame(ID, (const uint8_t*)&string.c_str()[start], length)) {
+
+            // Give up on the rest of the message if the bus doesn't free up
+            if ((millis() - startTime) > CAN_TX_TIMEOUT) {
+                droppedTxFrames += ((string.length() - start) + 7) / 8;
+                return;
             }
         }
     }
@@ -78,31 +206,257 @@ void txCANString(AXIS_CAN_ID ID, String string) {
     txCANString((int)ID, string);
 }
 
-// Receive a message over the CAN bus (only uses characters)
+// Moves the received frames out of a hardware FIFO into a queue
+// Nothing is parsed or allocated here, the frames are only copied (other than the SYNCs, and the motion frames with the fast path)
+static void drainFIFO(int fifo, RingBuffer<canFrame, CAN_RX_QUEUE_SIZE> &queue) {
+
+    // Empty the FIFO, it can hold up to three frames
+    volatile int frameID;
+    volatile int filterIndex;
+    volatile uint8_t frameData[8];
+    int frameLength;
+    while ((frameLength = can.receive(frameID, filterIndex, frameData, fifo)) > -1) {
+
+        // SYNCs are handled right away, their timing is what matters
+        #ifdef ENABLE_CAN_SYNC
+        if (frameID == CAN_SYNC_ID) {
+            handleCANSync();
+            continue;
+        }
+        #endif
+
+        // Copy the frame out of the FIFO
+        canFrame frame;
+        frame.id = frameID;
+        frame.length = min(frameLength, 8);
+        for (uint8_t index = 0; index < 8; index++) {
+            frame.data[index] = frameData[index];
+        }
+
+        // Motion frames are decoded right away, instead of waiting for the main loop
+        #ifdef ENABLE_CAN_MOTION_FAST_PATH
+        if (fifo == 1 && handleCANMotionFrame(frame)) {
+            continue;
+        }
+        #endif
+
+        // Queue the rest, counting the frame if there wasn't room
+        if (!queue.push(frame)) {
+            droppedFrames++;
+        }
+    }
+
+    // Count the frames that were lost because the FIFO filled up before it was emptied
+    if (can.getRxFifoOverrun(fifo)) {
+        can.clearRxFifoOverrun(fifo);
+        fifoOverruns[fifo]++;
+    }
+}
+
+
+// Moves the received frames out of the hardware FIFO into the receive queue
 void rxCANFrame() {
+    PROFILE_SCOPE(PROFILE_CAN_RX);
+    PROBE_SCOPE(PROBE_CAN_RX);
+    drainFIFO(0, rxQueue);
+}
+
+
+// The FIFO 0 receive interrupt
+extern "C" void USB_LP_CAN1_RX0_IRQHandler(void) {
+    rxCANFrame();
+}
+
+
+// Moves the received motion frames into their queue (the FIFO 1 interrupt)
+#ifdef ENABLE_CAN_PDO
+extern "C" void CAN1_RX1_IRQHandler(void) {
+    PROFILE_SCOPE(PROFILE_CAN_RX);
+    PROBE_SCOPE(PROBE_CAN_RX);
+    drainFIFO(1, rxMotionQueue);
+}
+#endif
 
-    // Read the CAN buffer into the command buffer, see if it contains anything of value
-    if (can.receive(id, filterIDx, receiveBuffer) > -1) {
 
-        // We have valid data, continue with reading it
-        CANCommandString.concat(reinterpret_cast<char*>(receiveBuffer));
+// Finds the slot that is assembling the command for an ID, taking over the free or the least recently used slot if there isn't one
+static canAssembly& getAssembly(uint16_t id) {
+
+    // Look for the ID, keeping track of the slot to take over
+    canAssembly* oldest = &assemblies[0];
+    for (uint8_t slot = 0; slot < CAN_ASSEMBLY_SLOTS; slot++) {
+        if (assemblies[slot].receiving && assemblies[slot].id == id) {
+            return assemblies[slot];
+        }
+        if (!assemblies[slot].receiving) {
+            oldest = &assemblies[slot];
+        }
+        else if (oldest -> receiving && (int32_t)(assemblies[slot].lastFrameTime - oldest -> lastFrameTime) < 0) {
+            oldest = &assemblies[slot];
+        }
     }
+
+    // Start a new command in the slot (anything that it was assembling is dropped)
+    oldest -> id = id;
+    oldest -> receiving = false;
+    oldest -> length = 0;
+    return *oldest;
 }
 
-// Check to see if an entire message has arrived over the CAN bus
+
+// Assembles the queued frames into commands, parsing each one once its end marker arrives
 void checkCANCmd() {
 
-    // Check to see if the command buffer is full ('>' is the termanator)
-    if (CANCommandString.indexOf(STRING_END_MARKER) != -1) {
+    // Motion frames go first, after the replies to the ones that the receive interrupt already handled
+    canFrame frame;
+    #ifdef ENABLE_CAN_MOTION_FAST_PATH
+    sendCANMotionReplies();
+    #endif
+    #ifdef ENABLE_CAN_PDO
+    while (rxMotionQueue.pop(frame)) {
+        handleCANProtocolFrame(frame);
+    }
+    #endif
+
+    // Sample the error state of the bus
+    updateCANErrors();
+
+    // Then work through all of the other frames that have arrived
+    while (rxQueue.pop(frame)) {
+
+        // Binary frames are handled as they are
+        #ifdef ENABLE_CAN_PDO
+        if (handleCANProtocolFrame(frame)) {
+            continue;
+        }
+        #endif
+
+        // Add the frame's characters to the command from its ID
+        canAssembly &assembly = getAssembly(frame.id);
+        assembly.lastFrameTime = millis();
+        for (uint8_t index = 0; index < frame.length; index++) {
+            char readChar = frame.data[index];
+
+            // A start marker always begins a new command (anything assembled before it was cut off)
+            if (readChar == STRING_START_MARKER) {
+                assembly.receiving = true;
+                assembly.length = 0;
+            }
+
+            // Characters outside of a command are ignored
+            else if (!assembly.receiving) {
+                continue;
+            }
 
-        // Parse the command
-        parseCommand(CANCommandString.substring(0, CANCommandString.indexOf(STRING_END_MARKER)));
+            // The command is complete, parse it (the rest of the frame can start the next command)
+            else if (readChar == STRING_END_MARKER) {
+                assembly.receiving = false;
+                assembly.buffer[assembly.length] = '\0';
+                parseCommand(assembly.buffer, assembly.length);
+            }
 
-        // Empty the buffer
-        CANCommandString = "";
+            // Add the character to the command, dropping the command if it is too long to be valid
+            else if (assembly.length < CAN_COMMAND_BUFFER_SIZE) {
+                assembly.buffer[assembly.length++] = readChar;
+            }
+            else {
+                assembly.receiving = false;
+            }
+        }
     }
 }
 
+
+// Number of frames that were dropped because the receive queue was full
+uint32_t getCANDroppedFrames() {
+    return droppedFrames;
+}
+
+
+// Number of frames that couldn't be sent because the transmit queue stayed full
+uint32_t getCANDroppedTxFrames() {
+    return droppedTxFrames;
+}
+
+
+// Samples the error state of the controller, counting the bus-off and error passive events and the protocol errors
+void updateCANErrors() {
+    uint32_t errorStatus = can.getErrorStatus();
+
+    // Count each time that the controller enters a state, not the time spent in it
+    uint32_t enteredStates = (errorStatus & ~lastErrorStatus);
+    if (enteredStates & CAN_ERROR_BUS_OFF) {
+        busOffEvents++;
+    }
+    if (enteredStates & CAN_ERROR_PASSIVE) {
+        errorPassiveEvents++;
+    }
+
+    // The last error code is only updated on an error, so it is reset to find the next one (errors between samples are counted once)
+    uint32_t errorCode = CAN_ERROR_CODE(errorStatus);
+    if (errorCode != 0 && errorCode != 7) {
+        protocolErrors++;
+        can.resetLastErrorCode();
+    }
+    lastErrorStatus = errorStatus;
+}
+
+
+// Gets the error statistics of the bus
+String getCANStats() {
+    uint32_t errorStatus = can.getErrorStatus();
+
+    // Find the state of the controller, worst first
+    String state;
+    if (errorStatus & CAN_ERROR_BUS_OFF) {
+        state = F("Bus-off");
+    }
+    else if (errorStatus & CAN_ERROR_PASSIVE) {
+        state = F("Passive");
+    }
+    else if (errorStatus & CAN_ERROR_WARNING) {
+        state = F("Warning");
+    }
+    else {
+        state = F("Active");
+    }
+
+    return ("CAN: " + state + F(" | TEC: ") + String(CAN_ERROR_TEC(errorStatus)) + F(" | REC: ") + String(CAN_ERROR_REC(errorStatus)) +
+            F(" | Bus-off: ") + String(busOffEvents) + F(" | Passive: ") + String(errorPassiveEvents) + F(" | Errors: ") + String(protocolErrors) +
+            F(" | RX drops: ") + String(droppedFrames) + F(" | TX drops: ") + String(droppedTxFrames) +
+            F(" | Overruns: ") + String(fifoOverruns[0]) + "/" + String(fifoOverruns[1]));
+}
+
+
+// Clears the error statistics of the bus
+void clearCANStats() {
+    busOffEvents = 0;
+    errorPassiveEvents = 0;
+    protocolErrors = 0;
+    droppedFrames = 0;
+    droppedTxFrames = 0;
+    fifoOverruns[0] = 0;
+    fifoOverruns[1] = 0;
+}
+
+
+// Gets the transmit error counter of the controller
+uint8_t getCANTxErrorCounter() {
+    return CAN_ERROR_TEC(can.getErrorStatus());
+}
+
+
+// Gets the receive error counter of the controller
+uint8_t getCANRxErrorCounter() {
+    return CAN_ERROR_REC(can.getErrorStatus());
+}
+
+
+// Gets the total of the errors that were counted
+uint32_t getCANErrorCount() {
+    return (busOffEvents + errorPassiveEvents + protocolErrors + droppedFrames + droppedTxFrames + fifoOverruns[0] + fifoOverruns[1]);
+}
+
+
 // Sets the CAN ID of the board
 void setCANID(AXIS_CAN_ID newCANID) {
 
@@ -110,7 +464,7 @@ void setCANID(AXIS_CAN_ID newCANID) {
     canID = newCANID;
 
     // Set the value in the filter
-    can.filterList16Init(0, (int)newCANID);
+    setCANFilters();
 }
 
 // Gets the CAN ID of the board
@@ -118,4 +472,27 @@ AXIS_CAN_ID getCANID() {
     return canID;
 }
 
+// Reloads the IDs that the hardware lets through
+void updateCANFilters() {
+    setCANFilters();
+}
+
+
+// Gets the group that a board belongs to
+CAN_GROUP_ID getCANGroup(AXIS_CAN_ID ID) {
+    if (ID >= X && ID <= X5) {
+        return CAN_GROUP_X;
+    }
+    else if (ID >= Y && ID <= Y5) {
+        return CAN_GROUP_Y;
+    }
+    else if (ID >= Z && ID <= Z5) {
+        return CAN_GROUP_Z;
+    }
+    else if (ID >= E && ID <= E7) {
+        return CAN_GROUP_E;
+    }
+    return CAN_GROUP_NONE;
+}
+
 #endif // ! ENABLE_CAN
\ No newline at end of file
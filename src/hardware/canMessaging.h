@@ -20,25 +20,84 @@ typedef enum {
     E, E2, E3, E4, E5, E6, E7
 } AXIS_CAN_ID;
 
+// IDs that several boards listen to at once (text commands use them bare, the binary protocol adds its function code)
+#define CAN_BROADCAST_ID 0x7F // Every board
+typedef enum {
+    CAN_GROUP_NONE = -1,
+    CAN_GROUP_X = 0x70, // X to X5
+    CAN_GROUP_Y,        // Y to Y5
+    CAN_GROUP_Z,        // Z to Z5
+    CAN_GROUP_E         // E to E7
+} CAN_GROUP_ID;
+
+// Priority of the receive interrupts (lower numbers are more urgent, see timers.h)
+// They only copy frames and start the SYNCed targets, so they wait behind the step and correction interrupts
+// Being less urgent than CRITICAL_SECTION_IRQ_PRIO also lets disableInterrupts() hold them off
+#define CAN_RX_IRQ_PRIO    8
+#define CAN_RX_IRQ_SUBPRIO 0
+
+// Priority of the transmit interrupt (only refills the mailboxes, so it can wait behind the motor)
+#define CAN_TX_IRQ_PRIO    10
+#define CAN_TX_IRQ_SUBPRIO 1
+
+// A single frame, as it was received or as it will be sent
+typedef struct {
+    uint16_t id;
+    uint8_t length;
+    uint8_t data[8];
+} canFrame;
+
 // Initialize the CAN bus
 void initCAN();
 
+// Queues a frame to be sent, without waiting (returns false if the queue was full)
+// Frames are sent in the order that they were queued
+bool txCANFrame(uint16_t ID, const uint8_t* data, uint8_t length);
+
 // Sends a CAN string (raw int)
 void txCANString(int ID, String string);
 
 // Sends a CAN string (using an AXIS_CAN_ID)
 void txCANString(AXIS_CAN_ID ID, String string);
 
-// Reads out the CAN buffer to the CAN command buffer
+// Moves the received frames out of the hardware FIFO into the receive queue (called by the CAN receive interrupt)
 void rxCANFrame();
 
-// Checks to see if there is a full message in the CAN command buffer
+// Assembles the queued frames into commands, parsing each one once its end marker arrives (a main loop task)
 void checkCANCmd();
 
+// Number of frames that were dropped because the receive queue was full
+uint32_t getCANDroppedFrames();
+
+// Number of frames that couldn't be sent because the transmit queue stayed full
+uint32_t getCANDroppedTxFrames();
+
+// Samples the error state of the controller, counting the bus-off and error passive events and the protocol errors (a main loop task, run by checkCANCmd())
+void updateCANErrors();
+
+// Gets the error statistics of the bus (error counters, state, bus-off and error passive events, protocol errors, drops, and FIFO overruns)
+String getCANStats();
+
+// Clears the error statistics of the bus (the error counters belong to the controller, so they are kept)
+void clearCANStats();
+
+// Gets the transmit and receive error counters of the controller (TEC and REC)
+uint8_t getCANTxErrorCounter();
+uint8_t getCANRxErrorCounter();
+
+// Gets the total of the errors that were counted (drops, overruns, bus-off events, and protocol errors)
+uint32_t getCANErrorCount();
+
 // Sets the CAN ID of the board
 void setCANID(AXIS_CAN_ID canID);
 
 // Gets the CAN ID of the board
 AXIS_CAN_ID getCANID();
 
+// Reloads the IDs that the hardware lets through (after the master of the gearing changes)
+void updateCANFilters();
+
+// Gets the group that a board belongs to (CAN_GROUP_NONE for the mainboard and the host)
+CAN_GROUP_ID getCANGroup(AXIS_CAN_ID ID);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,160 @@
+// Import the header file
+#include "clock.h"
+#include "cube.h"
+
+// If the selected clock setup didn't start
+static bool clockFallback = false;
+
+
+// Configures the system clock from SYSCLK_FREQ and SYSCLK_SRC_*
+void initClock() {
+
+    // Start the selected setup
+    bool started;
+    #if defined(SYSCLK_SRC_HSE_16)
+        started = SystemClock_Config_HSE_16M_SYSCLK_72M();
+    #elif defined(SYSCLK_SRC_HSE_8) && (SYSCLK_FREQ == 72)
+        started = SystemClock_Config_HSE_8M_SYSCLK_72M();
+    #elif defined(SYSCLK_SRC_HSE_8) && (SYSCLK_FREQ == 128)
+        started = SystemClock_Config_HSE_8M_SYSCLK_128M();
+    #else
+        started = SystemClock_Config_HSI_8M_SYSCLK_64M();
+    #endif
+
+    // The oscillator or the PLL didn't lock, go back to the reset clock (HSI), then run from the internal oscillator instead
+    if (!started) {
+        SystemInit();
+        SystemClock_Config_HSI_8M_SYSCLK_64M();
+        clockFallback = true;
+    }
+}
+
+
+// Returns if the selected clock setup failed to start
+bool isClockFallback() {
+    return clockFallback;
+}
+
+
+// Gets the SPI prescaler that runs a bus on APB2 as fast as possible, without going over maxFreq
+uint32_t getSPIPrescaler(uint32_t maxFreq) {
+
+    // The prescalers are powers of 2 from 2 to 256, each one is a step of SPI_BAUDRATEPRESCALER_4 in the register
+    uint32_t busFreq = HAL_RCC_GetPCLK2Freq();
+    uint32_t prescalerPower = 0;
+    while ((prescalerPower < 7) && ((busFreq >> (prescalerPower + 1)) > maxFreq)) {
+        prescalerPower++;
+    }
+    return (prescalerPower * SPI_BAUDRATEPRESCALER_4);
+}
+
+
+// Finds the CAN bit timing of a bitrate from the clock of APB1
+uint32_t getCANBitTiming(uint32_t bitrate) {
+
+    // Try each length of a bit (in time quanta), from the longest that can still sample at 80% down to the shortest allowed
+    uint32_t busFreq = HAL_RCC_GetPCLK1Freq();
+    uint32_t bestTiming = 0;
+    uint32_t bestError = UINT32_MAX;
+    for (uint32_t quanta = 20; quanta >= 8; quanta--) {
+
+        // Find the closest prescaler (1 to 1024)
+        uint32_t prescaler = constrain((busFreq + ((bitrate * quanta) / 2)) / (bitrate * quanta), (uint32_t)1, (uint32_t)1024);
+        uint32_t actualBitrate = (busFreq / (prescaler * quanta));
+        uint32_t error = (actualBitrate > bitrate ? actualBitrate - bitrate : bitrate - actualBitrate);
+
+        // Only a closer bitrate replaces a longer bit, the longer bits can place their sample point more finely
+        if (error < bestError) {
+
+            // A bit is the sync quantum, then segment 1 (up to 16 quanta), then the sample point, then segment 2 (up to 8 quanta)
+            uint32_t segment1 = (((quanta * 4) + 2) / 5) - 1;
+            uint32_t segment2 = (quanta - 1 - segment1);
+            bestTiming = ((segment2 - 1) << 20) | ((segment1 - 1) << 16) | (prescaler - 1);
+            bestError = error;
+        }
+    }
+    return bestTiming;
+}
+
+
+// Gets the SPI clock of the encoder's bus, as set in SPI1 (Hz)
+uint32_t getEncoderSPIFreq() {
+    return (HAL_RCC_GetPCLK2Freq() >> (((SPI1 -> CR1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos) + 1));
+}
+
+
+// Gets the bitrate of the CAN bus (bit/s)
+#ifdef ENABLE_CAN
+static uint32_t getCANFreq() {
+    uint32_t timing = CAN1 -> BTR;
+    uint32_t quanta = 1 + (((timing >> 16) & 0xF) + 1) + (((timing >> 20) & 0x7) + 1);
+    return (HAL_RCC_GetPCLK1Freq() / (((timing & 0x3FF) + 1) * quanta));
+}
+#endif
+
+
+// Gets the clock of the timers on APB1 (TIM2, TIM3, and TIM4)
+uint32_t getAPB1TimerFreq() {
+
+    // The timers' clock is doubled whenever APB1 is divided down
+    uint32_t timerFreq = HAL_RCC_GetPCLK1Freq();
+    if ((RCC -> CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        timerFreq *= 2;
+    }
+    return timerFreq;
+}
+
+
+// Gets the frequency of the coils' PWM (Hz)
+static uint32_t getPWMFreq() {
+
+    // TIM3 is on APB1
+    return (getAPB1TimerFreq() / ((TIM3 -> PSC + 1) * (TIM3 -> ARR + 1)));
+}
+
+
+// Checks the clocks that the peripherals are actually running at against their limits
+bool checkClocks() {
+
+    // The encoder can't be read faster than its max SPI clock
+    bool valid = (getEncoderSPIFreq() <= ENCODER_SPI_MAX_FREQ);
+
+    // The CAN nodes on the bus have to agree on the bitrate
+    #ifdef ENABLE_CAN
+        uint32_t canFreq = getCANFreq();
+        uint32_t canError = (canFreq > CAN_BITRATE ? canFreq - CAN_BITRATE : CAN_BITRATE - canFreq);
+        valid &= ((canError * 1000) <= (CAN_BITRATE * CAN_BITRATE_TOLERANCE));
+    #endif
+
+    // The setup that was picked has to have started
+    return (valid && !clockFallback);
+}
+
+
+// Gets a summary of the clocks
+String getClockStatus() {
+    String status = "Clock: SYSCLK: " + String(HAL_RCC_GetSysClockFreq() / 1000000) + F(" MHz") +
+                    (clockFallback ? F(" (fallback to HSI, the selected setup didn't start)") : F("")) +
+                    " | APB1: " + String(HAL_RCC_GetPCLK1Freq() / 1000000) + F(" MHz | APB2: ") + String(HAL_RCC_GetPCLK2Freq() / 1000000) + F(" MHz");
+
+    // Encoder
+    uint32_t spiFreq = getEncoderSPIFreq();
+    status += " | Encoder SPI: " + String(spiFreq / 1000) + F(" kHz");
+    if (spiFreq > ENCODER_SPI_MAX_FREQ) {
+        status += F(" (over the max!)");
+    }
+
+    // CAN
+    #ifdef ENABLE_CAN
+        uint32_t canFreq = getCANFreq();
+        status += " | CAN: " + String(canFreq) + F(" bit/s");
+        uint32_t canError = (canFreq > CAN_BITRATE ? canFreq - CAN_BITRATE : CAN_BITRATE - canFreq);
+        if ((canError * 1000) > (CAN_BITRATE * CAN_BITRATE_TOLERANCE)) {
+            status += " (should be " + String(CAN_BITRATE) + F("!)");
+        }
+    #endif
+
+    // PWM
+    status += " | PWM: " + String(getPWMFreq()) + F(" Hz");
+    return status;
+}
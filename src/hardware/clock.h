@@ -0,0 +1,40 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+// Include main config
+#include "config.h"
+
+// Include Arduino library
+#include "Arduino.h"
+
+// The system clock is set once from SYSCLK_FREQ and SYSCLK_SRC_* (config.h), then the dividers of the peripherals are found from the bus clocks
+// This way the encoder's SPI clock, the CAN bitrate, and the PWM frequency stay the same for any of the clock setups (including the 128 MHz overclock)
+
+// Configures the system clock from SYSCLK_FREQ and SYSCLK_SRC_*
+// Falls back to the internal oscillator (64 MHz) if the oscillator or the PLL doesn't start, check isClockFallback()
+void initClock();
+
+// Returns if the selected clock setup failed to start, and the board is running from the internal oscillator instead
+bool isClockFallback();
+
+// Gets the SPI prescaler (SPI_BAUDRATEPRESCALER_x) that runs a bus on APB2 as fast as possible, without going over maxFreq (Hz)
+uint32_t getSPIPrescaler(uint32_t maxFreq);
+
+// Gets the SPI clock of the encoder's bus, as set in SPI1 (Hz)
+uint32_t getEncoderSPIFreq();
+
+// Gets the clock of the timers on APB1 (TIM2, TIM3, and TIM4, Hz)
+uint32_t getAPB1TimerFreq();
+
+// Finds the CAN bit timing of a bitrate (bit/s) from the clock of APB1, returning the value for the BTR register
+// The timing with the closest bitrate is picked, with its sample point as close as possible to 80%
+uint32_t getCANBitTiming(uint32_t bitrate);
+
+// Checks the clocks that the peripherals are actually running at against their limits (run once they are all started)
+// Returns false if one is out of them (getClockStatus() explains which)
+bool checkClocks();
+
+// Gets a summary of the clocks (system and bus clocks, the encoder's SPI clock, the CAN bitrate, and the PWM frequency), along with any limits they're out of
+String getClockStatus();
+
+#endif // ! __CLOCK_H__
@@ -3,6 +3,13 @@
 // Include timers.h here so there isn't a linking circle
 #include "timers.h"
 
+// SPI prescaler from the bus clock
+#include "clock.h"
+#include "probe.h"
+
+// CRC8 of the safety word
+#include "crc.h"
+
 // A map of the known registers
 uint16_t regMap[MAX_NUM_REG];              //!< Register map */
 
@@ -55,7 +62,7 @@ const BitField_t bitFields[] = {
 	{REG_ACCESS_RES, REG_MOD_1,   0x8,    3,  0x00,  6},       //!< 38 bits 3:3 Reserved1
 	{REG_ACCESS_RW,  REG_MOD_1,   0x10,   4,  0x00,  6},       //!< 39 bits 4:4 CLKSEL switch to external clock at start-up only
 	{REG_ACCESS_RES, REG_MOD_1,   0x3FE0, 5,  0x00,  6},       //!< 40 bits 13:5 Reserved2
-	{REG_ACCESS_RW,  REG_MOD_1,   0x6000, 13, 0x00,  6},       //!< 41 bits 15:14 FIRMD Update Rate Setting
+	{REG_ACCESS_RW,  REG_MOD_1,   0xC000, 14, 0x00,  6},       //!< 41 bits 15:14 FIRMD Update Rate Setting
 
 	{REG_ACCESS_RW,  REG_SIL,     0x7,    0,  0x00,  7},       //!< 42 bits 2:0 ADCTVX Test vector X
 	{REG_ACCESS_RW,  REG_SIL,     0x38,   3,  0x00,  7},       //!< 43 bits 5:3 ADCTVY Test vector Y
@@ -120,6 +127,15 @@ const BitField_t bitFields[] = {
 };
 
 
+// Update period of the encoder for each FIR_MD setting (tenths of a us)
+static const uint16_t sensorUpdatePeriods[4] = { 213, 427, 853, 1706 };
+
+// Scale from the speed register to deg/s for each FIR_MD setting (Q16)
+// The register is the change in angle over two updates, 360 / 2^15 degrees per increment
+#define ENCODER_SPEED_SCALE(period) ((int32_t)(((1000000.0 * 0.5 * (360.0 / POW_2_15) * 10.0) / (period)) * 65536.0 + 0.5))
+static const int32_t speedScales[4] = { ENCODER_SPEED_SCALE(213), ENCODER_SPEED_SCALE(427), ENCODER_SPEED_SCALE(853), ENCODER_SPEED_SCALE(1706) };
+
+
 // Constructor for the encoder
 Encoder::Encoder() {
 
@@ -142,7 +158,7 @@ Encoder::Encoder() {
     spiConfig.Init.CLKPolarity = SPI_POLARITY_LOW;
     spiConfig.Init.CLKPhase = SPI_PHASE_2EDGE;
     spiConfig.Init.NSS = SPI_NSS_SOFT;
-    spiConfig.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_8;
+    spiConfig.Init.BaudRatePrescaler = getSPIPrescaler(ENCODER_SPI_MAX_FREQ);
     spiConfig.Init.FirstBit = SPI_FIRSTBIT_MSB;
     spiConfig.Init.CRCPolynomial = 7;
 
@@ -158,16 +174,14 @@ Encoder::Encoder() {
     // Reset the encoder's firmware
     //writeToEncoderRegister(ENCODER_ACT_STATUS_REG, 0x401);
 
-    // Setup the moving average calculations
-    speedAvg.begin(RPM_AVG_READINGS);
-    rawSpeedAvg.begin(SPEED_AVG_READINGS);
-    accelAvg.begin(ACCEL_AVG_READINGS);
-    incrementAvg.begin(ANGLE_AVG_READINGS);
-    absAngleAvg.begin(ANGLE_AVG_READINGS);
-    rawTempAvg.begin(TEMP_AVG_READINGS);
+    // Write the settings of the encoder, then read the update rate that they left it at
+    profileMismatches = applyProfile(ENCODER_PROFILE);
+    readUpdateRate();
 
-    // Set the last raw revolution value (used to detect revolution change)
-    lastRawRev = getRawRev();
+    // Find the delay inside of the encoder for the latency compensation
+    #ifdef ENABLE_LATENCY_COMPENSATION
+        initLatencyCompensation();
+    #endif
 
     // Populate the average angle reading table
     for (uint8_t index = 0; index < ANGLE_AVG_READINGS; index++) {
@@ -175,8 +189,7 @@ Encoder::Encoder() {
     }
 
     // Set the offsets
-    startupAngleOffset = getRawAngleAvg();
-    startupRevOffset = getRawRev();
+    zero();
 
     // Set the correct starting values for the estimation if using estimation
     #ifdef ENCODER_SPEED_ESTIMATION
@@ -191,10 +204,24 @@ Encoder::Encoder() {
 }
 
 
+// Finds the SPI prescaler again from the clock of APB2
+void Encoder::updateSPIClock() {
+
+    // The prescaler can only be changed while the bus is stopped
+    lockBus();
+    __HAL_SPI_DISABLE(&spiConfig);
+    spiConfig.Init.BaudRatePrescaler = getSPIPrescaler(ENCODER_SPI_MAX_FREQ);
+    MODIFY_REG(SPI1 -> CR1, SPI_CR1_BR, spiConfig.Init.BaudRatePrescaler);
+    __HAL_SPI_ENABLE(&spiConfig);
+    unlockBus();
+}
+
+
 // Read the value of a register
 errorTypes Encoder::readRegister(uint16_t registerAddress, uint16_t &data) {
 
-    // Disable interrupts
+    // Claim the bus, then disable interrupts
+    lockBus();
     disableInterrupts();
 
     // Create an accumulator for error checking
@@ -216,9 +243,7 @@ errorTypes Encoder::readRegister(uint16_t registerAddress, uint16_t &data) {
     HAL_SPI_TransmitReceive(&spiConfig, txbuf, rx1buf, 2, 10);
 
     // Set the MOSI pin to open drain
-    GPIO_InitStructure.Pin = GPIO_PIN_7;
-    GPIO_InitStructure.Mode = GPIO_MODE_AF_OD;
-    HAL_GPIO_Init(GPIOA, &GPIO_InitStructure);
+    setMOSIOpenDrain();
 
     // Send 0xFFFF (like BTT code), this returns the wanted value
     txbuf[0] = 0xFF, txbuf[1] = 0xFF;
@@ -232,8 +257,7 @@ errorTypes Encoder::readRegister(uint16_t registerAddress, uint16_t &data) {
     //error = checkSafety(combinedRX1Buf, registerAddress, &combinedRX2Buf, 1);
 
     // Set MOSI back to Push/Pull
-    GPIO_InitStructure.Mode = GPIO_MODE_AF_PP;
-    HAL_GPIO_Init(GPIOA, &GPIO_InitStructure);
+    setMOSIPushPull();
 
     // Deselect encoder
     GPIO_WRITE(ENCODER_CS_PIN, HIGH);
@@ -249,8 +273,9 @@ errorTypes Encoder::readRegister(uint16_t registerAddress, uint16_t &data) {
         data = 0;
     }
 
-    // All done, we can re-enable interrupts
+    // All done, we can re-enable interrupts and release the bus
     enableInterrupts();
+    unlockBus();
 
     // Return error
     return error;
@@ -260,24 +285,24 @@ errorTypes Encoder::readRegister(uint16_t registerAddress, uint16_t &data) {
 // Read multiple registers
 void Encoder::readMultipleRegisters(uint16_t registerAddress, uint16_t* data, uint16_t dataLength) {
 
-    // Disable interrupts
+    // Claim the bus, then disable interrupts
+    lockBus();
     disableInterrupts();
 
     // Pull CS low to select encoder
     GPIO_WRITE(ENCODER_CS_PIN, LOW);
 
-    // Setup TX and RX buffers
+    // Setup TX and RX buffers, sized for the longest burst so that the stack use is fixed
+    dataLength = min(dataLength, (uint16_t)ENCODER_MAX_BURST_WORDS);
     registerAddress |= ENCODER_READ_COMMAND + dataLength;
-    uint8_t txbuf[dataLength * 2] = { uint8_t(registerAddress >> 8), uint8_t(registerAddress) };
-    uint8_t rxbuf[dataLength * 2];
+    uint8_t txbuf[ENCODER_MAX_BURST_WORDS * 2] = { uint8_t(registerAddress >> 8), uint8_t(registerAddress) };
+    uint8_t rxbuf[ENCODER_MAX_BURST_WORDS * 2];
 
     // Send address we want to read, response seems to be equal to request
     HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, 2, 10);
 
     // Set the MOSI pin to open drain
-    GPIO_InitStructure.Pin = GPIO_PIN_7;
-    GPIO_InitStructure.Mode = GPIO_MODE_AF_OD;
-    HAL_GPIO_Init(GPIOA, &GPIO_InitStructure);
+    setMOSIOpenDrain();
 
     // Send 0xFFFF (like BTT code), this returns the wanted value
     // Array length is doubled as we're using 8 bit values instead of 16
@@ -292,14 +317,112 @@ void Encoder::readMultipleRegisters(uint16_t registerAddress, uint16_t* data, ui
     }
 
     // Set MOSI back to Push/Pull
-    GPIO_InitStructure.Mode = GPIO_MODE_AF_PP;
-    HAL_GPIO_Init(GPIOA, &GPIO_InitStructure);
+    setMOSIPushPull();
+
+    // Deselect encoder
+    GPIO_WRITE(ENCODER_CS_PIN, HIGH);
+
+    // Enable interrupts and release the bus
+    enableInterrupts();
+    unlockBus();
+}
+
+
+// Reads consecutive registers in a single burst, checking the safety word (and CRC) once for all of them
+errorTypes Encoder::readRegisterBurst(uint16_t registerAddress, uint16_t* data, uint8_t dataLength) {
+
+    // The length has to fit in the command
+    dataLength = constrain(dataLength, 1, ENCODER_MAX_BURST_WORDS);
+
+    // Claim the bus, then disable interrupts
+    lockBus();
+    disableInterrupts();
+
+    // Pull CS low to select encoder
+    GPIO_WRITE(ENCODER_CS_PIN, LOW);
+
+    // Send the burst read command, response seems to be equal to request
+    uint16_t command = (ENCODER_READ_COMMAND | registerAddress | dataLength);
+    uint8_t txbuf[(ENCODER_MAX_BURST_WORDS + 1) * 2] = { uint8_t(command >> 8), uint8_t(command) };
+    uint8_t rxbuf[(ENCODER_MAX_BURST_WORDS + 1) * 2];
+    HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, 2, 10);
+
+    // Set the MOSI pin to open drain
+    setMOSIOpenDrain();
+
+    // Send 0xFFFF for each of the data words and the safety word
+    uint8_t burstBytes = ((dataLength + 1) * 2);
+    for (uint8_t i = 0; i < burstBytes; i++) {
+        txbuf[i] = 0xFF;
+    }
+    HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, burstBytes, 10);
+
+    // Set MOSI back to Push/Pull
+    setMOSIPushPull();
 
     // Deselect encoder
     GPIO_WRITE(ENCODER_CS_PIN, HIGH);
 
-    // Enable interrupts
+    // All done, we can re-enable interrupts and release the bus
     enableInterrupts();
+    unlockBus();
+
+    // Combine the data words, then check the whole burst at once
+    for (uint8_t i = 0; i < dataLength; i++) {
+        data[i] = (rxbuf[i * 2] << 8 | rxbuf[i * 2 + 1]);
+    }
+    uint16_t safety = (rxbuf[burstBytes - 2] << 8 | rxbuf[burstBytes - 1]);
+    return checkSafety(safety, command, data, dataLength);
+}
+
+
+// Names of the registers (in the order of addrFields)
+static const char* const registerNames[MAX_NUM_REG] = {
+    "STAT", "ACSTAT", "AVAL", "ASPD", "AREV", "FSYNC", "MOD_1", "SIL", "MOD_2", "MOD_3", "OFFX",
+    "OFFY", "SYNCH", "IFAB", "MOD_4", "TCO_Y", "ADC_X", "ADC_Y", "D_MAG", "T_RAW", "IIF_CNT", "T25O"
+};
+
+
+// Snapshot of every register into the register map, in as few bursts as the addresses allow
+// The registers aren't all consecutive, so a burst covers as many as fit in ENCODER_MAX_BURST_WORDS from its first (the gaps are read and dropped)
+errorTypes Encoder::readRegisterMap() {
+    errorTypes firstError = NO_ERROR;
+    uint8_t index = 0;
+    while (index < MAX_NUM_REG) {
+
+        // Find the registers that fit in a burst from this one (the addresses are in the upper bits, a register apart is 0x10)
+        uint16_t startAddress = addrFields[index].regAddress;
+        uint8_t endIndex = index;
+        while (((endIndex + 1) < MAX_NUM_REG) && (((addrFields[endIndex + 1].regAddress - startAddress) >> 4) < ENCODER_MAX_BURST_WORDS)) {
+            endIndex++;
+        }
+
+        // Read the burst, only updating the map if it was valid
+        uint16_t burstData[ENCODER_MAX_BURST_WORDS];
+        errorTypes error = readRegisterBurst(startAddress, burstData, ((addrFields[endIndex].regAddress - startAddress) >> 4) + 1);
+        if (error == NO_ERROR) {
+            for (uint8_t mapIndex = index; mapIndex <= endIndex; mapIndex++) {
+                regMap[mapIndex] = burstData[(addrFields[mapIndex].regAddress - startAddress) >> 4];
+            }
+        }
+        else if (firstError == NO_ERROR) {
+            firstError = error;
+        }
+        index = endIndex + 1;
+    }
+    return firstError;
+}
+
+
+// Gets a register of the map
+uint16_t Encoder::getMappedRegister(uint8_t index) const {
+    return regMap[(index < MAX_NUM_REG) ? index : (MAX_NUM_REG - 1)];
+}
+
+
+// Gets the name of a register of the map
+const char* Encoder::getRegisterName(uint8_t index) const {
+    return registerNames[(index < MAX_NUM_REG) ? index : (MAX_NUM_REG - 1)];
 }
 
 
@@ -307,7 +430,8 @@ void Encoder::readMultipleRegisters(uint16_t registerAddress, uint16_t* data, ui
 // ! Untested
 void Encoder::writeToRegister(uint16_t registerAddress, uint16_t data) {
 
-    // Disable the motor timers
+    // Claim the bus, then disable the motor timers
+    lockBus();
     disableInterrupts();
 
     // Pull CS low to select encoder
@@ -322,23 +446,21 @@ void Encoder::writeToRegister(uint16_t registerAddress, uint16_t data) {
     HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, 2, 10);
 
     // Set the MOSI pin to open drain
-    GPIO_InitStructure.Pin = GPIO_PIN_7;
-    GPIO_InitStructure.Mode = GPIO_MODE_AF_OD;
-    HAL_GPIO_Init(GPIOA, &GPIO_InitStructure);
+    setMOSIOpenDrain();
 
     // Send the data to be written
     txbuf[0] = uint8_t(data >> 8), txbuf[1] = uint8_t(data);
     HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, 2, 10);
 
     // Set MOSI back to Push/Pull
-    GPIO_InitStructure.Mode = GPIO_MODE_AF_PP;
-    HAL_GPIO_Init(GPIOA, &GPIO_InitStructure);
+    setMOSIPushPull();
 
     // Deselect encoder
     GPIO_WRITE(ENCODER_CS_PIN, HIGH);
 
-    // Re-enable the motor timers
+    // Re-enable the motor timers and release the bus
     enableInterrupts();
+    unlockBus();
 }
 
 
@@ -369,32 +491,35 @@ errorTypes Encoder::checkSafety(uint16_t safety, uint16_t command, uint16_t* rea
     // If there have been no errors so far, then check the CRC
     else {
 
-        // Check the length of the message, then create the buffer needed to hold it
-		uint16_t lengthOfTemp = length * 2 + 2;
-		uint8_t temp[lengthOfTemp];
-
-        // Read out command to the first two bytes of the message
-		temp[0] = (uint8_t)(command >> 8);
-		temp[1] = (uint8_t)(command);
-
-		for (uint16_t index = 0; index < length; index++) {
-			temp[2 + 2 * index] =     (uint8_t)(readreg[index] >> 8); // Reads the first byte of the 16 bit message
-			temp[2 + 2 * index + 1] = (uint8_t)(readreg[index]);      // Reads the second byte
-		}
+        // Stream the command into the CRC, followed by each of the 16 bit words
+        uint8_t crc = CRC8_SEED;
+        crc = crc8Update(crc, (uint8_t)(command >> 8));
+        crc = crc8Update(crc, (uint8_t)(command));
+        for (uint16_t index = 0; index < length; index++) {
+            crc = crc8Update(crc, (uint8_t)(readreg[index] >> 8)); // Reads the first byte of the 16 bit message
+            crc = crc8Update(crc, (uint8_t)(readreg[index]));      // Reads the second byte
+        }
 
-		uint8_t crcReceivedFinal = (uint8_t)(safety); // Checks the second byte of the safety
-		uint8_t crc = calcCRC(temp, lengthOfTemp);
+        // Finish the CRC, then read the sent CRC from the second byte of the safety
+        crc = ~crc;
+        uint8_t crcReceivedFinal = (uint8_t)(safety);
 
         // Make sure that the calculated CRC is equal to the sent CRC
 		if (crc != crcReceivedFinal) {
+
+            // The data was corrupted on the way (the encoder itself is fine), so its status doesn't need reset
 			error = CRC_ERROR;
-            resetSafety();
 		}
         else {
 			error = NO_ERROR;
 		}
 	}
 
+    // Keep track of the errors for the health check
+    if (error != NO_ERROR) {
+        countReadError(error == CRC_ERROR);
+    }
+
     // Return the error that was found (if any)
 	return (error);
 }
@@ -402,31 +527,7 @@ errorTypes Encoder::checkSafety(uint16_t safety, uint16_t command, uint16_t* rea
 
 // Calculates the CRC of an array of 8 bit messages
 uint8_t Encoder::calcCRC(uint8_t *data, uint8_t length) {
-
-    // Create an accumulator for the CRC
-	uint32_t crc;
-
-    // Set the CRC to the seed
-	crc = CRC_SEED;
-
-    // Loop through the message, marking in the CRC if there are any errors
-	for (uint16_t i = 0; i < length; i++)
-	{
-		crc ^= data[i];
-		for (uint8_t bit = 0; bit < 8; bit++)
-		{
-			if ((crc & 0x80) != 0)
-			{
-				crc <<= 1;
-				crc ^= CRC_POLYNOMIAL;
-			}else{
-				crc <<= 1;
-			}
-		}
-	}
-
-    // Check if the CRC has changed at all from the original seeding
-	return ((~crc) & CRC_SEED);
+    return crc8(data, length);
 }
 
 
@@ -434,7 +535,8 @@ uint8_t Encoder::calcCRC(uint8_t *data, uint8_t length) {
 // Warning: this function cannot be interrupted, so make sure that it is called in a function that disables interrupts
 void Encoder::resetSafety() {
 
-    // Disable the motor timers
+    // Claim the bus, then disable the motor timers
+    lockBus();
     disableInterrupts();
 
     // Build the command
@@ -454,373 +556,1146 @@ void Encoder::resetSafety() {
     HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, 2, 10);
     HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, 2, 10);
 
-    // Re-enable the motor timers
+    // Re-enable the motor timers and release the bus
     enableInterrupts();
+    unlockBus();
 }
 
 
-// Get a bit field from a register
-uint16_t Encoder::getBitField(BitField_t bitField) {
+// Reads the angle, speed, revolution, and temperature registers in a single burst, storing them as the newest sample
+errorTypes Encoder::sample() {
+    PROBE_SCOPE(PROBE_ENCODER_READ);
 
-    // Check to make sure that the value can be read
-	if ((REG_ACCESS_R & bitField.regAccess) == REG_ACCESS_R) {
-		if ((REG_ACCESS_U & bitField.regAccess) == REG_ACCESS_U) {
-			// ! p->sBus->triggerUpdate();
-		}
+    // Claim the bus, then disable interrupts
+    lockBus();
+    disableInterrupts();
 
-        // Return the value at the address (if the read was successful)
-        if (readRegister(addrFields[bitField.posMap].regAddress, regMap[bitField.posMap]) == NO_ERROR) {
-            return ((regMap[bitField.posMap] & bitField.mask) >> bitField.position);
-        }
+    // Time the read (it can be called from the main loop or the correction, but only ever with the interrupts masked)
+    #ifdef ENABLE_PROFILING
+        uint32_t profileStartCycles = getCycleCount();
+    #endif
+
+    // Pull CS low to select encoder
+    GPIO_WRITE(ENCODER_CS_PIN, LOW);
+
+    // Setup TX and RX buffers
+    uint16_t command = ENCODER_SAMPLE_COMMAND;
+    uint8_t txbuf[ENCODER_SAMPLE_BYTES] = { uint8_t(command >> 8), uint8_t(command) };
+    uint8_t rxbuf[ENCODER_SAMPLE_BYTES];
+
+    // Send the burst read command, response seems to be equal to request
+    HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, 2, 10);
+
+    // Set the MOSI pin to open drain
+    setMOSIOpenDrain();
+
+    // Send 0xFFFF for each of the data words and the safety word
+    for (uint8_t i = 0; i < ENCODER_SAMPLE_BYTES; i++) {
+        txbuf[i] = 0xFF;
     }
+    HAL_SPI_TransmitReceive(&spiConfig, txbuf, rxbuf, ENCODER_SAMPLE_BYTES, 10);
 
-    // Not able to read that address, just return a -1
-    return -1;
-}
+    // Set MOSI back to Push/Pull
+    setMOSIPushPull();
 
+    // Deselect encoder
+    GPIO_WRITE(ENCODER_CS_PIN, HIGH);
 
-// Write out a bit field to the register
-void Encoder::setBitField(BitField_t bitField, uint16_t bitFNewValue) {
+    // Combine the data words and the safety word
+    uint16_t data[ENCODER_SAMPLE_WORDS];
+    for (uint8_t i = 0; i < ENCODER_SAMPLE_WORDS; i++) {
+        data[i] = (rxbuf[i * 2] << 8 | rxbuf[i * 2 + 1]);
+    }
+    uint16_t safety = (rxbuf[ENCODER_SAMPLE_BYTES - 2] << 8 | rxbuf[ENCODER_SAMPLE_BYTES - 1]);
 
-    // Write the correct value
-	if ((REG_ACCESS_W & bitField.regAccess) == REG_ACCESS_W) {
-		regMap[bitField.posMap] = (regMap[bitField.posMap] & ~bitField.mask) | ((bitFNewValue << bitField.position) & bitField.mask);
-		writeToRegister(addrFields[bitField.posMap].regAddress, regMap[bitField.posMap]);
-	}
+    // Check the whole burst at once, only publishing it if it was valid
+    errorTypes error = checkSafety(safety, command, data, ENCODER_SAMPLE_WORDS);
+    if (error == NO_ERROR) {
+        publishSample(rxbuf);
+    }
+
+    // Record the read while the interrupts are still masked
+    #ifdef ENABLE_PROFILING
+        addProfileCycles(PROFILE_ENCODER_READ, getCycleCount() - profileStartCycles);
+    #endif
+
+    // All done, we can re-enable interrupts and release the bus
+    enableInterrupts();
+    unlockBus();
+
+    // Return error
+    return error;
 }
 
 
-// Reads the raw momentary value from the angle register of the encoder (unadjusted)
-uint16_t Encoder::getRawIncrements() {
+// Settings of each profile (the chip's defaults aren't written)
+typedef struct {
+    uint8_t firMD;       // Update rate (0 to 3, 21.3 us to 170.6 us)
+    uint8_t predict;     // Prediction of the angle by an update
+    uint8_t autocal;     // Autocalibration mode (0 is off)
+    uint8_t spikeFilter; // Filter of the spikes on the SPI pads
+    uint8_t hysteresis;  // Hysteresis of the angle (0 to 3, 0 to 0.70 degrees)
+} encoderProfileSettings;
 
-    // Create an accumulator for the raw data
-    uint16_t rawData;
+static const encoderProfileSettings profileSettings[] = {
+    { 0, 0, 0, 0, 0 },  // ENCODER_PROFILE_CHIP_DEFAULT (unused)
+    { 0, 1, 0, 0, 0 },  // ENCODER_PROFILE_LOW_LATENCY
+    { 2, 0, 1, 1, 1 }   // ENCODER_PROFILE_LOW_NOISE
+};
+
+
+// Writes the settings of a profile to the encoder, reading each back (returns the number of fields that didn't match)
+uint8_t Encoder::applyProfile(ENCODER_PROFILE_TYPE profile) {
 
-    // Loop until a valid reading
-    while (readRegister(ENCODER_ANGLE_REG, rawData) != NO_ERROR);
+    // The chip's defaults are left as they are
+    if (profile == ENCODER_PROFILE_CHIP_DEFAULT) {
+        return 0;
+    }
 
-    // Delete the first bit, saving the last 15
-    return rawData & DELETE_BIT_15;
+    // Each field is read first, so that the rest of its register is written back as it was
+    const encoderProfileSettings &settings = profileSettings[profile];
+    const BitField_t *fields[] = { &bitFields[REG_MOD_1_FIRMD], &bitFields[REG_MOD_2_PREDICT], &bitFields[REG_MOD_2_AUTOCAL], &bitFields[REG_MOD_3_SPIKEF], &bitFields[REG_IFAB_IFADHYST] };
+    const uint8_t values[] = { settings.firMD, settings.predict, settings.autocal, settings.spikeFilter, settings.hysteresis };
+    uint8_t mismatches = 0;
+    for (uint8_t index = 0; index < (sizeof(values) / sizeof(values[0])); index++) {
+        if (getBitField(*fields[index]) != values[index]) {
+            setBitField(*fields[index], values[index]);
+            if (getBitField(*fields[index]) != values[index]) {
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
 }
 
 
-// Reads the raw average value from the angle register of the encoder (unadjusted)
-uint16_t Encoder::getRawIncrementsAvg() {
+// Returns the newest sample (a new one is taken unless a background sample is fresh)
+EncoderSample Encoder::getSample() {
 
-    // Read the momentary rawData
-    uint16_t rawData = getRawIncrements();
+    // Reuse the sample of this tick if there already is one
+    #ifdef ENABLE_ENCODER_TICK_CACHE
+    if (tickActive && (tickSampleEpoch == tickEpoch)) {
+        return tickSample;
+    }
+    #endif
 
-    // Add the value to the filter
-    incrementAvg.add(rawData);
+    // Take a new sample if the background reads aren't keeping it up to date
+    bool readFailed = false;
+    #ifdef ENABLE_ENCODER_DMA
+    if (!acquisitionFresh())
+    #endif
+    {
+        // Retry a few times, then give up (a hung encoder or a noisy cable can't hold up the control loop)
+        uint8_t attempt = 0;
+        while ((sample() != NO_ERROR) && (++attempt < ENCODER_READ_ATTEMPTS));
+        readFailed = (attempt >= ENCODER_READ_ATTEMPTS);
+    }
 
-    // Return the average
-    return incrementAvg.get();
-}
+    // Copy out the newest sample
+    const volatile EncoderSample &newest = samples[sampleIndex];
+    EncoderSample currentSample = { newest.rawAngle, newest.rawSpeed, newest.rawRev, newest.rawTemp, newest.time };
 
+    // Stand in for a failed read with a prediction from the last good sample, until too many have been missed in a row
+    if (readFailed) {
+        currentSample = predictSample(currentSample);
+        predictedReads++;
+        if (++missedReads > ENCODER_MAX_MISSED_READS) {
+            healthFault = true;
+        }
+    }
+    else {
+        missedReads = 0;
+    }
 
-// Reads the raw momentary value from the angle of the encoder (unadjusted ???)
-double Encoder::getRawAngle() {
+    // Save the sample for the rest of the tick
+    #ifdef ENABLE_ENCODER_TICK_CACHE
+    if (tickActive) {
+        tickSample = currentSample;
+        tickSampleEpoch = tickEpoch;
+    }
+    #endif
 
-    // Create an accumulator for the raw data
-    uint16_t rawData = getRawIncrements();
+    // Return the sample
+    return currentSample;
+}
 
-    // Calc the value (equation from TLE5012 library)
-    return ((360.0 / POW_2_15) * (double)rawData) - encoderStepOffset;
+
+// Returns the newest sample if it was taken in the last maxAge us, otherwise takes a new one
+EncoderSample Encoder::getRecentSample(uint32_t maxAge) {
+
+    // Copy out the newest sample, it's good enough if the control loop (or the background reads) took it recently
+    const volatile EncoderSample &newest = samples[sampleIndex];
+    EncoderSample currentSample = { newest.rawAngle, newest.rawSpeed, newest.rawRev, newest.rawTemp, newest.time };
+    if ((micros() - currentSample.time) <= maxAge) {
+        return currentSample;
+    }
+    return getSample();
 }
 
 
-// Reads the raw average value from the angle of the encoder (unadjusted ???)
-double Encoder::getRawAngleAvg() {
+// Moves a sample forward to now with the observer's velocity (or holds it, if there isn't an observer)
+EncoderSample Encoder::predictSample(const EncoderSample &lastSample) {
 
-    // Read the raw average Steps
-    uint16_t rawData = getRawIncrementsAvg();
+    // Find the increments moved since the sample was taken
+    EncoderSample predicted = lastSample;
+    uint32_t now = micros();
+    #ifdef ENABLE_ENCODER_OBSERVER
+        int32_t position = lastSample.rawAngle + (int32_t)(((int64_t)getObserverVelocity() * (int32_t)(now - lastSample.time)) / 1000000);
 
-    // Calc the value (equation from TLE5012 library)
-    return 360.0 / POW_2_15 * (double)rawData - encoderStepOffset;
+        // Carry the whole revolutions into the revolution counter (9 bit, signed)
+        predicted.rawAngle = (position & DELETE_BIT_15);
+        predicted.rawRev = (int16_t)((uint16_t)(lastSample.rawRev + (position >> 15)) << 7) >> 7;
+    #endif
+    predicted.time = now;
+    return predicted;
 }
 
 
-// Returns a smoothed value of angle of the encoder
-// More expensive than getAngle(), but transitions between 0 and 360 are smoother
-double Encoder::getSmoothAngle() {
+// Counts a read that failed its checks, raising the health fault if they come faster than ENCODER_MAX_ERROR_RATE
+void Encoder::countReadError(bool crcError) {
 
-    // Get the absolute angle, then take the mod of 360 to find the shaft rotation (without revolutions)
-    return (fmod(getAbsoluteAngleAvg(), 360.0));
-}
+    // Count the error
+    readErrors++;
+    if (crcError) {
+        crcErrors++;
+    }
 
+    // Start a new window each second
+    uint32_t now = millis();
+    if ((now - errorWindowStart) >= 1000) {
+        errorWindowStart = now;
+        windowErrors = 0;
+    }
 
-// Reads the momentary value for the angle of the encoder (ranges from 0-360)
-double Encoder::getAngle() {
-    return (getRawAngle() - startupAngleOffset);
+    // Check the rate of the errors
+    windowErrors++;
+    if (windowErrors > peakErrorRate) {
+        peakErrorRate = windowErrors;
+    }
+    if (windowErrors > ENCODER_MAX_ERROR_RATE) {
+        healthFault = true;
+    }
 }
 
 
-// Reads the average value for the angle of the encoder (ranges from 0-360)
-double Encoder::getAngleAvg() {
-    return (getRawAngleAvg() - startupAngleOffset);
+// Returns if the encoder has been marked as unhealthy
+bool Encoder::hasHealthFault() const {
+    return healthFault;
 }
 
 
-// For average velocity calculations instead of hardware readings from the TLE5012
-// Returns the speed of the encoder in deg/s
-// ! Needs fixed yet, readings are off
-double Encoder::getEstimSpeed() {
+// Clears the health fault (the motor is being enabled again)
+void Encoder::clearHealthFault() {
+    healthFault = false;
+    missedReads = 0;
+    errorWindowStart = millis();
+    windowErrors = 0;
+}
 
-    // Get the newest angle
-    double newAngle = getAbsoluteAngleAvg();
 
-    // Sample time
-    uint32_t currentTime = micros();
+// Gets a summary of the encoder's health
+String Encoder::getHealthStats() const {
+    return ("Encoder: Errors: " + String(readErrors) + F(" (CRC: ") + String(crcErrors) + F(") | This second: ") +
+            String(((millis() - errorWindowStart) < 1000) ? windowErrors : 0) + F(" | Peak: ") + String(peakErrorRate) +
+            F("/s | Predicted reads: ") + String(predictedReads) + F(" | Turn corrections: ") + String(revCorrections) +
+            F(" | Profile mismatches: ") + String(profileMismatches) + F(" | Fault: ") + (healthFault ? F("yes") : F("no")));
+}
 
-    // Compute the average velocity
-    double avgVelocity = 1000000.0 * (newAngle - lastEncoderAngle) / (currentTime - lastAngleSampleTime);
 
-    // Correct the last angle and sample time
-    lastEncoderAngle = newAngle;
-    lastAngleSampleTime = currentTime;
+// Clears the error statistics (the fault is left as it is)
+void Encoder::clearHealthStats() {
+    readErrors = 0;
+    crcErrors = 0;
+    peakErrorRate = 0;
+    predictedReads = 0;
+    revCorrections = 0;
+}
 
-    // Add the value to the averaging list
-    speedAvg.add(avgVelocity);
 
-    // Return the averaged velocity in deg/s
-    return speedAvg.get();
+#ifdef ENABLE_ENCODER_TICK_CACHE
+// Starts a new tick, invalidating the cache of the last one
+void Encoder::beginTick() {
+    tickEpoch++;
+    tickActive = true;
 }
 
 
-#ifdef ENCODER_SPEED_ESTIMATION
-// Returns true if the encoder's minimum speed sample interval has been exceeded
-bool Encoder::sampleTimeExceeded() {
-    return (micros() - lastAngleSampleTime > SPD_EST_MIN_INTERVAL);
+// Ends the tick, so that reads outside of it take new samples
+void Encoder::endTick() {
+    tickActive = false;
 }
-#endif
+#endif // ! ENABLE_ENCODER_TICK_CACHE
 
-int16_t Encoder::getRawSpeed() {
 
-    // Prepare the variables to store data in
-	int16_t rawData;
+// Decodes a received burst, then publishes it as the newest sample
+void Encoder::publishSample(uint8_t* buffer) {
 
-    // Read the encoder
-    while (readRegister(ENCODER_SPEED_REG, (uint16_t &)rawData) != NO_ERROR);
+    // Write into the unused buffer so that the newest sample is never partially updated
+    volatile EncoderSample &nextSample = samples[sampleIndex ^ 1];
 
-    // Delete everything before the 14 LSB's
-    rawData <<= 1;
+    // Delete the first bit of the angle, saving the last 15
+    nextSample.rawAngle = (buffer[0] << 8 | buffer[1]) & DELETE_BIT_15;
 
-    // If bit 14 is set, the value is negative
-    // Propagate sign of integer
-    rawData >>= 1;
+    // Propagate the sign of the 15 bit speed
+    nextSample.rawSpeed = (int16_t)((buffer[2] << 8 | buffer[3]) << 1) >> 1;
 
-    return rawData;
+    // Propagate the sign of the 9 bit revolutions and temperature
+    nextSample.rawRev = (int16_t)((buffer[4] << 8 | buffer[5]) << 7) >> 7;
+    nextSample.rawTemp = (int16_t)((buffer[6] << 8 | buffer[7]) << 7) >> 7;
+
+    // Mark the time (the trigger is when the encoder was read), then swap the buffers
+    #ifdef ENABLE_ENCODER_TRIGGERED_READS
+        nextSample.time = (acqTriggered ? acqTriggerTime : micros());
+    #else
+        nextSample.time = micros();
+    #endif
+    sampleIndex ^= 1;
+    sampleValid = true;
 }
 
-// Reads the speed of the encoder in deg/s
-double Encoder::getSpeed() {
 
-    // Prepare the variables to store data in
-	uint16_t rawData[4];
+// Releases the MOSI pin (open drain), letting the encoder drive the data line
+// Only the CNF0 bit differs between AF push pull and AF open drain, so a single register write is much faster than HAL_GPIO_Init()
+void Encoder::setMOSIOpenDrain() {
+    GPIOA -> CRL |= ENCODER_MOSI_CNF_OD;
+}
 
-    // Read the encoder, modifying the array
-    readMultipleRegisters(ENCODER_SPEED_REG, rawData, sizeof(rawData) / sizeof(uint16_t));
 
-	// Get raw speed reading
-	int16_t rawSpeed = rawData[0];
+// Drives the MOSI pin again (push pull)
+void Encoder::setMOSIPushPull() {
+    GPIOA -> CRL &= ~ENCODER_MOSI_CNF_OD;
+}
 
-        // Delete everything before the 14 LSB's
-        rawSpeed <<= 1;
 
-        // If bit 14 is set, the value is negative
-        // Propagate sign of integer
-        rawSpeed >>= 1;
+// Claims the SPI bus for a blocking transaction
+// Must not be called from an interrupt that can block the DMA interrupt (the step interrupt or higher)
+void Encoder::lockBus() {
 
-	// Get FIR_MD from bits 15 and 16 of register 0x06
-	uint16_t firMD = rawData[3] >> 14;
+    // Prevent any new background reads from starting
+    busLocks++;
 
-	// Determine sensor update rate from FIR_MD
-	double firMDVal;
-    switch (firMD) {
-        case 0:
-            firMDVal = 21.3;
-            break;
-        case 1:
-            firMDVal = 42.7;
-            break;
-        case 2:
-            firMDVal = 85.3;
-            break;
-        case 3:
-            firMDVal = 170.6;
-            break;
-        default:
-            firMDVal = 0.0; // ??? zero division
-            break;
-    }
+    // Wait for a running background read to finish (only a couple of microseconds)
+    #ifdef ENABLE_ENCODER_DMA
+    while (acqPhase != ACQ_IDLE);
+    #endif
+}
 
-    // Calculate and average angle speed in degree per second
-	rawSpeedAvg.add(rawSpeed);
 
-    // Return the result in deg/s
-    return (1000000.0 * 0.5 * (360.0 / POW_2_15) * rawSpeedAvg.getDouble() / firMDVal);
+// Releases the SPI bus, allowing background reads to start again
+void Encoder::unlockBus() {
+    busLocks--;
 }
 
 
-// Calculates the angular acceleration. Done by looking at position over time^2
-double Encoder::getAccel() {
+#ifdef ENABLE_ENCODER_DMA
+// Sets up the DMA channels of the SPI bus for background reads
+void Encoder::beginAcquisition() {
 
-    // Get the newest angle
-    double newAngle = getAbsoluteAngleAvg();
+    // Enable the clock for the DMA controller
+    __HAL_RCC_DMA1_CLK_ENABLE();
 
-    // Sample time
-    uint32_t currentTime = micros();
+    // SPI1 RX is on channel 2, interrupting once the transfer is complete
+    DMA1_Channel2 -> CCR = 0;
+    DMA1_Channel2 -> CPAR = (uint32_t)&(SPI1 -> DR);
+    DMA1_Channel2 -> CMAR = (uint32_t)acqRXBuffer;
+    DMA1_Channel2 -> CCR = DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_PL_1;
 
-    // Compute the average velocity (extra pow at beginning is needed to convert microseconds to seconds)
-    double avgAccel = (newAngle - lastEncoderAngle) / pow(1000000 * (currentTime - lastAngleSampleTime), 2);
+    // SPI1 TX is on channel 3 (memory to peripheral)
+    DMA1_Channel3 -> CCR = 0;
+    DMA1_Channel3 -> CPAR = (uint32_t)&(SPI1 -> DR);
+    DMA1_Channel3 -> CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_PL_1;
 
-    // Correct the last angle and sample time
-    lastEncoderAngle = newAngle;
-    lastAngleSampleTime = currentTime;
+    // The correction timer's trigger is on channel 6, writing the SPI's control word to turn its DMA requests on (halfwords, memory to peripheral)
+    #ifdef ENABLE_ENCODER_TRIGGERED_READS
+        DMA1_Channel6 -> CCR = 0;
+        DMA1_Channel6 -> CPAR = (uint32_t)&(SPI1 -> CR2);
+        DMA1_Channel6 -> CMAR = (uint32_t)&acqStartCR2;
+        DMA1_Channel6 -> CCR = DMA_CCR_DIR | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0 | DMA_CCR_PL_1;
+    #endif
 
-    // Add the value to the averaging list
-    accelAvg.add(avgAccel);
+    // Make sure that the SPI peripheral is running (HAL only enables it on the first transaction)
+    __HAL_SPI_ENABLE(&spiConfig);
 
-    // Return the averaged velocity
-    return accelAvg.get();
+    // Enable the RX complete interrupt
+    HAL_NVIC_SetPriority(DMA1_Channel2_IRQn, ENCODER_DMA_IRQ_PRIO, ENCODER_DMA_IRQ_SUBPRIO);
+    HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
 }
 
 
-// Reads the raw momentary temperature of the encoder
-int16_t Encoder::getRawTemp() {
-
-    // Create an accumulator for the raw data
-    int16_t rawData;
+// Starts a background sample of the encoder (returns immediately)
+void Encoder::startAcquisition() {
 
-    // Loop until a valid reading
-    while (readRegister(ENCODER_TEMP_REG, (uint16_t &)rawData) != NO_ERROR);
+    // Skip this sample if a blocking transaction or another background read is using the bus
+    if (busLocks != 0 || acqPhase != ACQ_IDLE) {
+        return;
+    }
 
-    // Delete everything before the 9 LSB's
-    rawData <<= 7;
+    // Clear out any data left in the receive register
+    (void)SPI1 -> DR;
 
-    // If bit 9 is set, the value is negative
-    // Propagate sign of integer
-    rawData >>= 7;
+    // Pull CS low to select encoder
+    GPIO_WRITE(ENCODER_CS_PIN, LOW);
 
-    // Return the raw momentary value
-    return rawData;
+    // Send the burst read command
+    acqPhase = ACQ_COMMAND;
+    #ifdef ENABLE_ENCODER_TRIGGERED_READS
+        acqTriggered = false;
+    #endif
+    startTransfer(acqCommand, 2);
 }
 
 
-// Reads the temperature of the encoder
-double Encoder::getTemp() {
+// Sets up a background read for the correction timer's compare event to start (returns false if the bus is in use)
+// Everything but the SPI's DMA requests is ready, the trigger turns them on with a single DMA write, so the read starts without an interrupt
+#ifdef ENABLE_ENCODER_TRIGGERED_READS
+bool Encoder::armAcquisition(uint32_t triggerTime) {
 
-    // Get the momentary temperature
-    int16_t rawTemp = getRawTemp();
+    // Skip this sample if a blocking transaction or another background read is using the bus
+    if (busLocks != 0 || acqPhase != ACQ_IDLE) {
+        return false;
+    }
 
-    // Add to MovingAverage filter
-    rawTempAvg.add(rawTemp);
+    // Clear out any data left in the receive register, then select the encoder (it only starts clocking at the trigger)
+    (void)SPI1 -> DR;
+    GPIO_WRITE(ENCODER_CS_PIN, LOW);
 
-    // Calculate the new temperature (equation from TLE5012 library)
-    double temp = (rawTempAvg.getDouble() + TEMP_OFFSET) / TEMP_DIV;
+    // Load the burst read command, the bus counts as busy from here so the blocking reads wait for it
+    acqPhase = ACQ_COMMAND;
+    acqTriggered = true;
+    acqTriggerTime = triggerTime;
+    loadTransfer(acqCommand, 2);
+
+    // Reload the trigger's write (it has to be disabled to be reloaded)
+    acqStartCR2 = (SPI1 -> CR2) | SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+    DMA1_Channel6 -> CCR &= ~DMA_CCR_EN;
+    DMA1_Channel6 -> CNDTR = 1;
+    DMA1_Channel6 -> CCR |= DMA_CCR_EN;
+    return true;
+}
+#endif // ! ENABLE_ENCODER_TRIGGERED_READS
 
-    // Only compile if overtemp protection is enabled
-    #ifdef ENABLE_OVERTEMP_PROTECTION
 
-    // Check to see if there was a overtemp disable
-    if (motor.getState() == MOTOR_STATE::OVERTEMP) {
+// Advances the background read to the next phase (called by the DMA interrupt)
+void Encoder::acquisitionHandler() {
+    PROFILE_SCOPE(PROFILE_ENCODER_DMA);
 
-        // There was an overtemp previously, check if it should be cleared
-        if (temp < OVERTEMP_SHUTDOWN_CLEAR_TEMP) {
-            motor.setState(DISABLED, true);
-        }
-    }
+    // Clear the interrupt flags, then stop both channels (they need to be disabled to be reloaded)
+    DMA1 -> IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+    DMA1_Channel2 -> CCR &= ~DMA_CCR_EN;
+    DMA1_Channel3 -> CCR &= ~DMA_CCR_EN;
 
-    // If overtemp protection is enabled, we should check it now
-    else if (temp >= OVERTEMP_THRESHOLD_TEMP) {
+    // Decide what to do based on the phase that just finished
+    if (acqPhase == ACQ_COMMAND) {
 
-        // Check if the motor needs to be overtemp disabled
-        if (temp >= OVERTEMP_SHUTDOWN_TEMP) {
+        // Set the MOSI pin to open drain
+        setMOSIOpenDrain();
 
-            // Disable the motor with an overtemp
-            motor.setState(OVERTEMP);
-        }
+        // Clock in the data and safety words
+        acqPhase = ACQ_DATA;
+        startTransfer(acqDummy, ENCODER_SAMPLE_BYTES);
+    }
+    #ifdef ENABLE_ENCODER_POLLING
+    else if (acqPhase == ACQ_POLL_COMMAND) {
 
-        // Value is too high, we might need to reduce it
-        // Make sure that the last time increment is far enough behind
-        else if (sec() - lastOvertempTime >= OVERTEMP_INTERVAL) {
+        // Set the MOSI pin to open drain
+        setMOSIOpenDrain();
 
-            // We're good to go, it hasn't been too long
-            motor.setRMSCurrent(motor.getRMSCurrent() - OVERTEMP_INCREMENT);
+        // Clock in the register and safety words
+        acqPhase = ACQ_POLL_DATA;
+        startTransfer(acqDummy, ENCODER_POLL_BYTES);
+    }
+    #endif
+    else {
 
-            // Fix the last overtemp time
-            lastOvertempTime = sec();
+        // Deselect encoder, then set MOSI back to push/pull
+        GPIO_WRITE(ENCODER_CS_PIN, HIGH);
+        setMOSIPushPull();
+
+        // Give the bus back to the blocking functions
+        SPI1 -> CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+
+        // Save a finished register read of the poller
+        #ifdef ENABLE_ENCODER_POLLING
+        if (acqPhase == ACQ_POLL_DATA) {
+
+            // Only keep the value if the safety word is good
+            if (transferValid(pollCommand, ENCODER_POLL_BYTES)) {
+                uint16_t value = (acqRXBuffer[0] << 8 | acqRXBuffer[1]);
+                if (pollSlot == POLL_STAT) {
+                    polledStatus = value;
+                }
+                else {
+                    polledActStatus = value;
+                }
+            }
+
+            // Move on to the next slot
+            pollSlot = (POLL_SLOT)((pollSlot + 1) % POLL_SLOT_COUNT);
+            acqPhase = ACQ_IDLE;
+            return;
+        }
+        #endif
+
+        // Only publish the sample if the status bits are good and the CRC matches
+        // (the safety isn't reset here, as that would need a blocking transaction)
+        if (transferValid(acqCommand, ENCODER_SAMPLE_BYTES)) {
+            publishSample(acqRXBuffer);
+        }
+        else {
+            countReadError(false);
         }
-    }
 
-    #endif // ENABLE_OVERTEMP_PROTECTION
+        // Update a slow value every couple of samples (the time spent checking the sample is more than the CS off time needed)
+        #ifdef ENABLE_ENCODER_POLLING
+        if (--pollCountdown == 0) {
+            pollCountdown = ENCODER_POLL_INTERVAL;
+            if (startPoll()) {
+                return;
+            }
+        }
+        #endif
 
-    // Return the temperature
-    return temp;
+        // The bus is free again
+        acqPhase = ACQ_IDLE;
+    }
 }
 
 
-// Gets the raw revolutions from the motor in range [-258 ... +257]
-int16_t Encoder::getRawRev() {
+// Checks the safety word of a finished background read (status bits and CRC)
+bool Encoder::transferValid(const uint8_t* command, uint8_t length) const {
 
-    // Create an accumulator for the raw data and converted data
-    int16_t rawData;
+    // Combine the received safety word
+    uint16_t safety = (acqRXBuffer[length - 2] << 8 | acqRXBuffer[length - 1]);
 
-    // Loop continuously until there is no error
-    while (readRegister(ENCODER_ANGLE_REV_REG, (uint16_t &)rawData) != NO_ERROR);
+    // Stream the command and the data words into the CRC
+    uint8_t crc = crc8Update(crc8Update(CRC8_SEED, command[0]), command[1]);
+    for (uint8_t i = 0; i < length - 2; i++) {
+        crc = crc8Update(crc, acqRXBuffer[i]);
+    }
 
-    // Delete the first 7 bits, they are not needed
-    // Delete everything before the 9 LSB's
-    rawData <<= 7;
+    // The status bits must all be set and the CRC must match
+    uint16_t statusMask = ENCODER_SYSTEM_ERROR_MASK | ENCODER_INTERFACE_ERROR_MASK | ENCODER_INV_ANGLE_ERROR_MASK;
+    return (((safety & statusMask) == statusMask) && ((uint8_t)~crc == (uint8_t)safety));
+}
 
-    // If bit 8 is set, the value is negative
-    // Propagate sign of integer
-    rawData >>= 7;
 
-    // Return the angle measurement
-    return rawData;
+// Returns if the latest background sample is recent enough to be used
+bool Encoder::acquisitionFresh() const {
+    return (sampleValid && (micros() - samples[sampleIndex].time < ENCODER_DMA_SAMPLE_TIMEOUT));
 }
 
 
-// Gets the revolutions of the motor
-int32_t Encoder::getRev() {
+// Background poller
+#ifdef ENABLE_ENCODER_POLLING
 
-    // Get the raw value
-    int16_t rawRevNow = getRawRev();
-    if ((lastRawRev > 0) && (rawRevNow < 0)) // overflow
-        revolutions++;
-    else if ((lastRawRev < 0) && (rawRevNow > 0)) // borrow
-        revolutions--;
-    lastRawRev = rawRevNow;
-    return (revolutions * 512 + rawRevNow - startupRevOffset);
-}
+// Moves on to the next slow value, starting a register read if one is needed (returns if the bus is in use)
+bool Encoder::startPoll() {
 
+    // The temperature is part of every sample, it only needs to be averaged
+    if (pollSlot == POLL_TEMP) {
 
-// Gets the absolute angle of the motor
-double Encoder::getAbsoluteAngleAvg() {
+        // Add the newest temperature to the average (converted once something shows it)
+        rawTempAvg.add(samples[sampleIndex].rawTemp);
+        polledRawTemp = rawTempAvg.get();
+
+        // Move the step offset along with it
+        #ifdef ENABLE_ENCODER_TEMP_COMP
+            updateTempCompensation();
+        #endif
+
+        // Move on to the status registers next time
+        pollSlot = POLL_STAT;
+        return false;
+    }
+
+    // Build the read command for the status register of this slot (one word)
+    uint16_t command = ENCODER_READ_COMMAND | (pollSlot == POLL_STAT ? ENCODER_STATUS_REG : ENCODER_ACT_STATUS_REG) | 1;
+    pollCommand[0] = uint8_t(command >> 8);
+    pollCommand[1] = uint8_t(command);
+
+    // Select the encoder again, then send the command
+    GPIO_WRITE(ENCODER_CS_PIN, LOW);
+    acqPhase = ACQ_POLL_COMMAND;
+    startTransfer(pollCommand, 2);
+    return true;
+}
+
+
+// Returns the latest STAT register value
+uint16_t Encoder::getPolledStatus() const {
+    return polledStatus;
+}
+
+
+// Returns the latest ACSTAT register value
+uint16_t Encoder::getPolledActStatus() const {
+    return polledActStatus;
+}
+
+#endif // ! ENABLE_ENCODER_POLLING
+
+
+// Loads and enables both DMA channels for a transfer of the specified length (it starts once the SPI's DMA requests are turned on)
+void Encoder::loadTransfer(uint8_t* txBuffer, uint8_t length) {
+
+    // Load the buffers and lengths
+    DMA1_Channel2 -> CMAR = (uint32_t)acqRXBuffer;
+    DMA1_Channel2 -> CNDTR = length;
+    DMA1_Channel3 -> CMAR = (uint32_t)txBuffer;
+    DMA1_Channel3 -> CNDTR = length;
+
+    // Enable the RX channel first so that no bytes are missed
+    DMA1_Channel2 -> CCR |= DMA_CCR_EN;
+    DMA1_Channel3 -> CCR |= DMA_CCR_EN;
+}
+
+
+// Starts both DMA channels for a transfer of the specified length
+void Encoder::startTransfer(uint8_t* txBuffer, uint8_t length) {
+
+    // Load the channels, then let the TX channel start the transfer
+    loadTransfer(txBuffer, length);
+    SPI1 -> CR2 |= SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+}
+
+
+// DMA interrupt for the SPI1 RX channel
+extern "C" void DMA1_Channel2_IRQHandler(void) {
+    motor.encoder.acquisitionHandler();
+}
+#endif // ! ENABLE_ENCODER_DMA
 
-    // Add a new value to the average
-    absAngleAvg.add((float)((getRev() * 360) + getAngle()));
+
+// Get a bit field from a register
+uint16_t Encoder::getBitField(BitField_t bitField) {
+
+    // Check to make sure that the value can be read
+	if ((REG_ACCESS_R & bitField.regAccess) == REG_ACCESS_R) {
+		if ((REG_ACCESS_U & bitField.regAccess) == REG_ACCESS_U) {
+			// ! p->sBus->triggerUpdate();
+		}
+
+        // Return the value at the address (if the read was successful)
+        if (readRegister(addrFields[bitField.posMap].regAddress, regMap[bitField.posMap]) == NO_ERROR) {
+            return ((regMap[bitField.posMap] & bitField.mask) >> bitField.position);
+        }
+    }
+
+    // Not able to read that address, just return a -1
+    return -1;
+}
+
+
+// Write out a bit field to the register
+void Encoder::setBitField(BitField_t bitField, uint16_t bitFNewValue) {
+
+    // Write the correct value
+	if ((REG_ACCESS_W & bitField.regAccess) == REG_ACCESS_W) {
+		regMap[bitField.posMap] = (regMap[bitField.posMap] & ~bitField.mask) | ((bitFNewValue << bitField.position) & bitField.mask);
+		writeToRegister(addrFields[bitField.posMap].regAddress, regMap[bitField.posMap]);
+
+        // The scale of the speed depends on the update rate
+        if ((bitField.posMap == bitFields[REG_MOD_1_FIRMD].posMap) && (bitField.mask == bitFields[REG_MOD_1_FIRMD].mask)) {
+            readUpdateRate();
+        }
+	}
+}
+
+
+// Reads the raw momentary value from the angle register of the encoder (unadjusted)
+uint16_t Encoder::getRawIncrements() {
+
+    // Return the angle from the newest sample (already has the first bit deleted)
+    return getSample().rawAngle;
+}
+
+
+// Reads the raw average value from the angle register of the encoder (unadjusted)
+// The average is wrap-aware, so readings on both sides of 0 don't average out to half a turn
+uint16_t Encoder::getRawIncrementsAvg() {
+
+    // Read the momentary rawData
+    uint16_t rawData = getRawIncrements();
+
+    // Add the value to the filter
+    incrementAvg.add(rawData);
 
     // Return the average
-    return absAngleAvg.getDouble();
+    return incrementAvg.get();
+}
+
+
+// Reads the raw momentary value from the angle of the encoder (unadjusted ???)
+double Encoder::getRawAngle() {
+
+    // Create an accumulator for the raw data
+    uint16_t rawData = getRawIncrements();
+
+    // Calc the value (equation from TLE5012 library)
+    return ((360.0 / POW_2_15) * (double)rawData) - encoderStepOffset;
+}
+
+
+// Reads the raw average value from the angle of the encoder (unadjusted ???)
+double Encoder::getRawAngleAvg() {
+
+    // Read the raw average Steps
+    uint16_t rawData = getRawIncrementsAvg();
+
+    // Calc the value (equation from TLE5012 library)
+    return 360.0 / POW_2_15 * (double)rawData - encoderStepOffset;
+}
+
+
+// Returns a smoothed value of angle of the encoder
+// More expensive than getAngle(), but transitions between 0 and 360 are smoother
+double Encoder::getSmoothAngle() {
+
+    // Get the absolute counts, then mask off the revolutions to find the shaft rotation (a turn is a power of 2, so no fmod is needed)
+    return ((360.0 / POW_2_15) * (getAbsoluteCountsAvg() & (ENCODER_COUNTS_PER_REV - 1)));
+}
+
+
+// Reads the momentary value for the angle of the encoder (ranges from 0-360)
+double Encoder::getAngle() {
+    return (getRawAngle() - startupAngleOffset);
+}
+
+
+// Calculates the angle of the encoder from a sample (ranges from 0-360)
+double Encoder::getAngle(const EncoderSample &currentSample) {
+    #ifdef ENABLE_ENCODER_LINEARIZATION
+        return ((360.0 / POW_2_15) * (double)linearize(currentSample.rawAngle)) - encoderStepOffset - startupAngleOffset;
+    #else
+        return ((360.0 / POW_2_15) * (double)currentSample.rawAngle) - encoderStepOffset - startupAngleOffset;
+    #endif
+}
+
+
+// Reads the average value for the angle of the encoder (ranges from 0-360)
+double Encoder::getAngleAvg() {
+    return (getRawAngleAvg() - startupAngleOffset);
+}
+
+
+// For average velocity calculations instead of hardware readings from the TLE5012
+// Returns the speed of the encoder in deg/s
+// ! Needs fixed yet, readings are off
+double Encoder::getEstimSpeed() {
+
+    // The observer already has the speed, no need to read the encoder
+    #ifdef ENABLE_ENCODER_OBSERVER
+
+        // Only used to limit how often the speed is displayed
+        lastAngleSampleTime = micros();
+
+        // Return the estimated velocity in deg/s
+        return ((360.0 / POW_2_15) * getObserverVelocity());
+
+    #else // ! ENABLE_ENCODER_OBSERVER
+
+        // Get the newest angle
+        double newAngle = getAbsoluteAngleAvg();
+
+        // Sample time
+        uint32_t currentTime = micros();
+
+        // Compute the average velocity
+        double avgVelocity = 1000000.0 * (newAngle - lastEncoderAngle) / (currentTime - lastAngleSampleTime);
+
+        // Correct the last angle and sample time
+        lastEncoderAngle = newAngle;
+        lastAngleSampleTime = currentTime;
+
+        // Add the value to the averaging list
+        speedAvg.add(avgVelocity);
+
+        // Return the averaged velocity in deg/s
+        return speedAvg.get();
+    #endif // ! ENABLE_ENCODER_OBSERVER
+}
+
+
+#ifdef ENCODER_SPEED_ESTIMATION
+// Returns true if the encoder's minimum speed sample interval has been exceeded
+bool Encoder::sampleTimeExceeded() {
+    return (micros() - lastAngleSampleTime > SPD_EST_MIN_INTERVAL);
+}
+#endif
+
+int16_t Encoder::getRawSpeed() {
+
+    // Return the speed from the newest sample (sign already propagated)
+    return getSample().rawSpeed;
+}
+
+// Reads the speed of the encoder in deg/s
+// The speed register is already in the sample, so the read is shared with the angle (and scaled by an integer multiply)
+double Encoder::getSpeed() {
+
+    // Average the speed of the newest sample
+    rawSpeedAvg.add(getSample().rawSpeed);
+
+    // Scale it to deg/s with the factor of the update rate (Q16)
+    return (double)(((int64_t)rawSpeedAvg.get() * speedScale) >> 16);
+}
+
+
+// Reads the update rate of the encoder (FIR_MD), finding the scale of the speed from it
+// Called at boot, then whenever the update rate is written
+void Encoder::readUpdateRate() {
+    uint16_t field = getBitField(bitFields[REG_MOD_1_FIRMD]);
+    if (field <= 0b11) {
+        firMD = field;
+    }
+    speedScale = speedScales[firMD];
+}
+
+
+// Calculates the angular acceleration. Done by looking at position over time^2
+double Encoder::getAccel() {
+
+    // The observer already has the acceleration, no need to read the encoder
+    #ifdef ENABLE_ENCODER_OBSERVER
+
+        // Return the estimated acceleration in deg/s/s
+        return ((360.0 / POW_2_15) * getObserverAccel());
+
+    #else // ! ENABLE_ENCODER_OBSERVER
+
+        // Get the newest angle
+        double newAngle = getAbsoluteAngleAvg();
+
+        // Sample time
+        uint32_t currentTime = micros();
+
+        // Compute the average velocity (extra pow at beginning is needed to convert microseconds to seconds)
+        double avgAccel = (newAngle - lastEncoderAngle) / pow(1000000 * (currentTime - lastAngleSampleTime), 2);
+
+        // Correct the last angle and sample time
+        lastEncoderAngle = newAngle;
+        lastAngleSampleTime = currentTime;
+
+        // Add the value to the averaging list
+        accelAvg.add(avgAccel);
+
+        // Return the averaged velocity
+        return accelAvg.get();
+    #endif // ! ENABLE_ENCODER_OBSERVER
+}
+
+
+// Reads the raw momentary temperature of the encoder
+int16_t Encoder::getRawTemp() {
+
+    // Return the temperature from the newest sample (sign already propagated)
+    return getSample().rawTemp;
+}
+
+
+// Averages the newest temperature sample, in the raw units of the encoder
+int16_t Encoder::getRawTempAvg() {
+
+    // The poller keeps the average up to date in the background
+    #ifdef ENABLE_ENCODER_POLLING
+        return polledRawTemp;
+    #else
+        rawTempAvg.add(getRawTemp());
+        return rawTempAvg.get();
+    #endif
+}
+
+
+// Reads the temperature of the encoder
+double Encoder::getTemp() {
+
+    // Calculate the temperature from the average (equation from TLE5012 library)
+    return ((getRawTempAvg() + TEMP_OFFSET) / TEMP_DIV);
+}
+
+
+// Converts the newest temperature sample to tenths of a degree C with integer math only
+int16_t Encoder::getTempTenths() {
+    return getTempTenths(getSample());
+}
+
+
+// Converts the temperature of a sample to tenths of a degree C with integer math only
+int16_t Encoder::getTempTenths(const EncoderSample &currentSample) {
+
+    // No filtering, this is only the one sample
+    return rawTempToTenths(currentSample.rawTemp);
+}
+
+
+// Converts a raw temperature to tenths of a degree C with integer math only
+int16_t Encoder::rawTempToTenths(int16_t rawTemp) const {
+
+    // Same equation as getTemp(), with the constants scaled up to integers
+    static constexpr int32_t offset = (int32_t)TEMP_OFFSET;
+    static constexpr int32_t divisor = (int32_t)(TEMP_DIV * 1000);
+    static_assert((TEMP_OFFSET == offset), "TEMP_OFFSET must be a whole number for rawTempToTenths()");
+    return (int16_t)(((rawTemp + offset) * 10000) / divisor);
+}
+
+
+// Lowers the current or disables the motor if the temperature is too high
+#ifdef ENABLE_OVERTEMP_PROTECTION
+
+// Converts a temperature (C) to the raw units of the encoder when compiling, the inverse of getTemp()
+// Rounded up, so that comparing the whole raw values gives the same result as comparing the temperatures
+static constexpr int16_t tempToRaw(double temp) {
+    return (((int16_t)((temp * TEMP_DIV) - TEMP_OFFSET)) < ((temp * TEMP_DIV) - TEMP_OFFSET)) ?
+           ((int16_t)((temp * TEMP_DIV) - TEMP_OFFSET) + 1) : (int16_t)((temp * TEMP_DIV) - TEMP_OFFSET);
+}
+static constexpr int16_t overtempThresholdRaw = tempToRaw(OVERTEMP_THRESHOLD_TEMP);
+static constexpr int16_t overtempShutdownRaw = tempToRaw(OVERTEMP_SHUTDOWN_TEMP);
+static constexpr int16_t overtempClearRaw = tempToRaw(OVERTEMP_SHUTDOWN_CLEAR_TEMP);
+
+
+// Checks the averaged raw temperature against the limits (integer compares only)
+void Encoder::checkOvertemp(int16_t rawTemp) {
+
+    // Check to see if there was a overtemp disable
+    if (motor.getState() == MOTOR_STATE::OVERTEMP) {
+
+        // There was an overtemp previously, check if it should be cleared
+        if (rawTemp < overtempClearRaw) {
+            motor.setState(DISABLED, true);
+        }
+    }
+
+    // If overtemp protection is enabled, we should check it now
+    else if (rawTemp >= overtempThresholdRaw) {
+
+        // Check if the motor needs to be overtemp disabled
+        if (rawTemp >= overtempShutdownRaw) {
+
+            // Disable the motor with an overtemp
+            motor.setState(OVERTEMP);
+        }
+
+        // Value is too high, we might need to reduce it (the thermal model lowers the current smoothly instead)
+        // Make sure that the last time increment is far enough behind
+        #ifndef ENABLE_THERMAL_MODEL
+        else if (sec() - lastOvertempTime >= OVERTEMP_INTERVAL) {
+
+            // We're good to go, it hasn't been too long
+            motor.setRMSCurrent(motor.getRMSCurrent() - OVERTEMP_INCREMENT);
+
+            // Fix the last overtemp time
+            lastOvertempTime = sec();
+        }
+        #endif
+    }
+}
+#endif // ! ENABLE_OVERTEMP_PROTECTION
+
+
+// Gets the raw revolutions from the motor in range [-258 ... +257]
+int16_t Encoder::getRawRev() {
+
+    // Return the revolutions from the newest sample (sign already propagated)
+    return getSample().rawRev;
+}
+
+
+// Gets the revolutions of the motor
+int32_t Encoder::getRev() {
+    return getRev(getSample());
+}
+
+
+// Gets the revolutions of the motor from a sample
+int32_t Encoder::getRev(const EncoderSample &currentSample) {
+    return (trackRevolutions(currentSample) - startupRevOffset);
+}
+
+
+// Adds the change in angle of a sample to the tracked turns (returns the whole turns)
+// The change is wrapped to half a turn either way, so a sample that is repeated or a little out of order doesn't move the position
+int32_t Encoder::trackRevolutions(const EncoderSample &currentSample) {
+
+    // Both the correction and the main loop take samples, the position and the last angle have to be updated together
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // The first sample starts the tracking (the revolution counter gives the starting turn)
+    if (!trackingStarted) {
+        trackedIncrements = ((int32_t)currentSample.rawRev * ENCODER_COUNTS_PER_REV) + currentSample.rawAngle;
+        lastRawRev = currentSample.rawRev;
+        lastCheckRev = currentSample.rawRev;
+        trackingStarted = true;
+    }
+    else {
+        // Sign extend the 15 bit change in angle
+        trackedIncrements += (int16_t)((uint16_t)(currentSample.rawAngle - lastTrackedAngle) << 1) >> 1;
+    }
+    lastTrackedAngle = currentSample.rawAngle;
+
+    // Check the turns against the revolution counter every so often (only new samples count)
+    // Close to the wrap the counter and the angle may disagree for a sample, so the check waits for the angle to be away from it
+    int32_t turns = (trackedIncrements >> ENCODER_COUNTS_POWER);
+    if (currentSample.time != lastTrackedTime) {
+        lastTrackedTime = currentSample.time;
+        samplesSinceRevCheck++;
+    }
+    if ((samplesSinceRevCheck >= ENCODER_REV_CHECK_INTERVAL) && (currentSample.rawAngle > (ENCODER_COUNTS_PER_REV / 4)) && (currentSample.rawAngle < (3 * ENCODER_COUNTS_PER_REV / 4))) {
+
+        // The counter is 9 bits, so the turns since the last check are compared modulo 512
+        int16_t missedTurns = (int16_t)((uint16_t)((currentSample.rawRev - lastRawRev) - (turns - lastCheckRev)) << 7) >> 7;
+        if (missedTurns != 0) {
+            trackedIncrements += (missedTurns * ENCODER_COUNTS_PER_REV);
+            turns += missedTurns;
+            revCorrections++;
+        }
+        lastRawRev = currentSample.rawRev;
+        lastCheckRev = turns;
+        samplesSinceRevCheck = 0;
+    }
+
+    __set_PRIMASK(primask);
+    return turns;
+}
+
+
+// Gets the absolute angle of the motor
+double Encoder::getAbsoluteAngleAvg() {
+
+    // Convert the averaged counts to degrees
+    return ((360.0 / POW_2_15) * getAbsoluteCountsAvg());
 }
 
 
 // Gets the absolute angle of the motor, just returns a float
 float Encoder::getAbsoluteAngleAvgFloat() {
 
-    // Add a new value to the average
-    absAngleAvg.add((float)((getRev() * 360) + getAngle()));
+    // Convert the averaged counts to degrees
+    return ((360.0f / (float)POW_2_15) * getAbsoluteCountsAvg());
+}
+
+
+// Gets the absolute position of a sample in counts (2^15 per revolution)
+int32_t Encoder::getAbsoluteCounts(const EncoderSample &currentSample) {
+    #ifdef ENABLE_ENCODER_LINEARIZATION
+        return (getRev(currentSample) * ENCODER_COUNTS_PER_REV) + linearize(currentSample.rawAngle) - stepCountOffset - startupCountOffset;
+    #else
+        return (getRev(currentSample) * ENCODER_COUNTS_PER_REV) + currentSample.rawAngle - stepCountOffset - startupCountOffset;
+    #endif
+}
+
+
+// Gets the averaged absolute position in counts (2^15 per revolution)
+int32_t Encoder::getAbsoluteCountsAvg() {
+
+    // Only advance the average once per tick
+    #ifdef ENABLE_ENCODER_TICK_CACHE
+    if (tickActive && (tickAbsCountsEpoch == tickEpoch)) {
+        return tickAbsCounts;
+    }
+    #endif
+
+    // Take a single sample for both the revolutions and the angle, then add it to the average
+    absCountAvg.add(getAbsoluteCounts(getSample()));
+    int32_t averageCounts = absCountAvg.get();
+
+    // Save the average for the rest of the tick
+    #ifdef ENABLE_ENCODER_TICK_CACHE
+    if (tickActive) {
+        tickAbsCounts = averageCounts;
+        tickAbsCountsEpoch = tickEpoch;
+    }
+    #endif
 
     // Return the average
-    return absAngleAvg.get();
+    return averageCounts;
 }
 
 
 // Sets the encoder's step offset (used for calibration)
 void Encoder::setStepOffset(double offset) {
     encoderStepOffset = offset;
+    #ifdef ENABLE_ENCODER_TEMP_COMP
+        // The poller moves the offset from the calibrated one (its DMA interrupt is more urgent than disableInterrupts() masks)
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        calibratedCountOffset = round(offset * (POW_2_15 / 360.0));
+        stepCountOffset = calibratedCountOffset + tempOffsetCounts;
+        __set_PRIMASK(primask);
+    #else
+        stepCountOffset = round(offset * (POW_2_15 / 360.0));
+    #endif
+}
+
+
+// Temperature compensation of the step offset
+#ifdef ENABLE_ENCODER_TEMP_COMP
+
+// Sets the temperature that the step offset was calibrated at (raw) and how far it drifts (increments per raw unit of temperature)
+void Encoder::setTempCompensation(int16_t calibrationRawTemp, float slope) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tempCompRawTemp = calibrationRawTemp;
+    tempCompSlope = slope;
+    tempCompSlopeQ16 = (int32_t)round(slope * 65536);
+
+    // Start from the calibrated offset, the poller moves it to the temperature from there
+    tempOffsetCounts = 0;
+    stepCountOffset = calibratedCountOffset;
+    __set_PRIMASK(primask);
+}
+
+
+// Gets the temperature that the step offset was calibrated at (raw)
+int16_t Encoder::getTempCompRawTemp() const {
+    return tempCompRawTemp;
+}
+
+
+// Gets how far the step offset drifts (increments per raw unit of temperature)
+float Encoder::getTempCompSlope() const {
+    return tempCompSlope;
+}
+
+
+// Increments that the offset has moved since it was calibrated
+int32_t Encoder::getTempOffsetCounts() const {
+    return tempOffsetCounts;
+}
+
+
+// Moves the step offset with the polled temperature (integer math only, it runs from the DMA interrupt)
+// The offset is a single word, so the correction sees either the old one or the new one
+void Encoder::updateTempCompensation() {
+
+    // Slew toward the drift at the temperature a count at a time, so the first poll after a boot or a calibration doesn't jump the position
+    int32_t targetCounts = (int32_t)(((int64_t)tempCompSlopeQ16 * (polledRawTemp - tempCompRawTemp)) >> 16);
+    tempOffsetCounts += constrain(targetCounts - tempOffsetCounts, (int32_t)-1, (int32_t)1);
+    stepCountOffset = calibratedCountOffset + tempOffsetCounts;
+}
+
+#endif // ! ENABLE_ENCODER_TEMP_COMP
+
+
+// Gets the increments of the latest sample from the calibrated step offset (0 to 2^15 - 1)
+// The startup offset is skipped here, the coil phase only depends on where the shaft was when the coils were calibrated
+uint16_t Encoder::getCalibratedIncrements() {
+    return calibrateIncrements(getSample().rawAngle);
+}
+
+
+// Increments of a raw reading from the calibrated step offset (0 to 2^15 - 1)
+uint16_t Encoder::calibrateIncrements(uint16_t rawIncrements) const {
+
+    // Find the counts from the calibrated step offset
+    #ifdef ENABLE_ENCODER_LINEARIZATION
+        int32_t counts = linearize(rawIncrements) - stepCountOffset;
+    #else
+        int32_t counts = (int32_t)rawIncrements - stepCountOffset;
+    #endif
+
+    // Wrap it into a single revolution
+    return (uint16_t)(counts & (ENCODER_COUNTS_PER_REV - 1));
 }
 
 
@@ -828,6 +1703,287 @@ void Encoder::setStepOffset(double offset) {
 void Encoder::zero() {
 
     // Fix offsets
-    startupAngleOffset = getRawAngleAvg();
-    startupRevOffset = getRawRev();
-}
\ No newline at end of file
+    startupIncrements = getRawIncrementsAvg();
+    startupRevOffset = trackRevolutions(getSample());
+    updateStartupOffsets();
+
+    // The position jumped, the observer needs to start over
+    #ifdef ENABLE_ENCODER_OBSERVER
+        resetObserver();
+    #endif
+}
+
+
+// Power loss position retention
+#ifdef ENABLE_POWER_LOSS_SAVE
+// Gets the raw increments of the zero, then the turns and raw increments of a single sample
+void Encoder::capturePosition(uint16_t &zeroIncrements, int32_t &turns, uint16_t &increments) {
+    EncoderSample currentSample = getSample();
+    zeroIncrements = startupIncrements;
+    turns = getRev(currentSample);
+    increments = currentSample.rawAngle;
+}
+
+
+// Zeroes the encoder where it was zeroed before the power was lost
+void Encoder::restorePosition(uint16_t zeroIncrements, int32_t turns, uint16_t increments) {
+
+    // Find the turns now from how far the angle moved since the capture (the 15 bit change is sign extended, so it is the shortest way around)
+    EncoderSample currentSample = getSample();
+    int32_t movedIncrements = (int32_t)increments + ((int16_t)((uint16_t)(currentSample.rawAngle - increments) << 1) >> 1);
+    if (movedIncrements < 0) {
+        turns--;
+    }
+    else if (movedIncrements >= ENCODER_COUNTS_PER_REV) {
+        turns++;
+    }
+
+    // Use the old zero, offsetting the turns of this boot to match
+    startupIncrements = zeroIncrements;
+    startupRevOffset = trackRevolutions(currentSample) - turns;
+    updateStartupOffsets();
+
+    // The position jumped, the observer needs to start over
+    #ifdef ENABLE_ENCODER_OBSERVER
+        resetObserver();
+    #endif
+}
+#endif // ! ENABLE_POWER_LOSS_SAVE
+
+
+// Tracking observer
+#ifdef ENABLE_ENCODER_OBSERVER
+
+// Advances the observer with the current sample (called once every correction)
+// The state is in counts per tick, so the update is only multiplies and shifts
+void Encoder::updateObserver() {
+
+    // Get the measured position of this tick
+    EncoderSample currentSample = getSample();
+    int32_t measured = getAbsoluteCounts(currentSample);
+
+    // The estimate is of where the motor was when the sample was taken
+    #ifdef ENABLE_LATENCY_COMPENSATION
+        obsSampleTime = currentSample.time;
+    #endif
+
+    // Start from the measurement if the observer hasn't been set yet
+    if (!obsInitialized) {
+        obsPosition = (int64_t)measured << OBSERVER_Q_POWER;
+        obsVelocity = 0;
+        obsAccel = 0;
+        obsPositionCounts = measured;
+        obsInitialized = true;
+        #ifdef ENABLE_FAST_COMMUTATION
+            obsVelocityPerUs = 0;
+        #endif
+        return;
+    }
+
+    // Predict where the motor should be this tick
+    int64_t predictedPosition = obsPosition + obsVelocity + (obsAccel >> 1);
+    int32_t predictedVelocity = obsVelocity + obsAccel;
+
+    // Find the difference to the measurement (limited to prevent overflowing the gains)
+    int64_t residual = ((int64_t)measured << OBSERVER_Q_POWER) - predictedPosition;
+    residual = constrain(residual, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+
+    // Correct the prediction with the difference
+    obsPosition = predictedPosition + ((residual * OBSERVER_ALPHA_Q) >> OBSERVER_Q_POWER);
+    obsVelocity = predictedVelocity + (int32_t)((residual * OBSERVER_BETA_Q) >> OBSERVER_Q_POWER);
+    obsAccel = obsAccel + (int32_t)((residual * OBSERVER_GAMMA_Q) >> OBSERVER_Q_POWER);
+    obsPositionCounts = (int32_t)(obsPosition >> OBSERVER_Q_POWER);
+
+    // Scale the velocity for the inner commutation once here, instead of dividing in every one of its interrupts
+    #ifdef ENABLE_FAST_COMMUTATION
+        obsVelocityPerUs = (int32_t)(((int64_t)getObserverVelocity() << 16) / 1000000);
+    #endif
+}
+
+
+// Sets the rate that the observer is updated at (Hz)
+void Encoder::setObserverRate(uint32_t rate) {
+
+    // The state is per tick, so it needs to start over with a new tick length
+    if (rate != obsRate) {
+        obsRate = rate;
+        resetObserver();
+    }
+}
+
+
+// Restarts the observer from the next sample
+void Encoder::resetObserver() {
+    obsInitialized = false;
+}
+
+
+// Returns the estimated position (counts)
+int32_t Encoder::getObserverPosition() const {
+    return obsPositionCounts;
+}
+
+
+// Returns the estimated velocity (counts/s)
+int32_t Encoder::getObserverVelocity() const {
+    return (int32_t)(((int64_t)obsVelocity * obsRate) >> OBSERVER_Q_POWER);
+}
+
+
+// Returns the estimated acceleration (counts/s/s)
+int32_t Encoder::getObserverAccel() const {
+    return (int32_t)(((int64_t)obsAccel * obsRate * obsRate) >> OBSERVER_Q_POWER);
+}
+
+
+// Inner commutation
+#ifdef ENABLE_FAST_COMMUTATION
+// Returns the calibrated increments of the newest sample, moved forward to now with the observer's velocity (0 to 2^15 - 1)
+// The background reads (or the correction) keep the sample up to date, it is only read here
+uint16_t Encoder::getInterpolatedIncrements() {
+
+    // Copy out the newest sample (the other one of the pair is the one that gets written)
+    const volatile EncoderSample &newest = samples[sampleIndex];
+    uint16_t rawAngle = newest.rawAngle;
+    uint32_t age = micros() - newest.time;
+
+    // Move it forward by the time since it was taken, but not past the limit (a stale sample is held instead of run away with)
+    age = min(age, (uint32_t)FAST_COMMUTATION_MAX_AGE);
+    int32_t movedIncrements = (int32_t)(((int64_t)obsVelocityPerUs * (int32_t)age) >> 16);
+
+    // Find the counts from the calibrated step offset, then wrap them into a single revolution
+    #ifdef ENABLE_ENCODER_LINEARIZATION
+        int32_t counts = linearize(rawAngle) + movedIncrements - stepCountOffset;
+    #else
+        int32_t counts = (int32_t)rawAngle + movedIncrements - stepCountOffset;
+    #endif
+    return (uint16_t)(counts & (ENCODER_COUNTS_PER_REV - 1));
+}
+#endif // ! ENABLE_FAST_COMMUTATION
+
+#endif // ! ENABLE_ENCODER_OBSERVER
+
+
+// Latency compensation of the position feedback
+#ifdef ENABLE_LATENCY_COMPENSATION
+
+
+// Reads the update rate of the encoder, turning on its prediction if specified
+void Encoder::initLatencyCompensation() {
+
+    // The prediction extrapolates the angle by an update, the register is read first so the other bits are kept
+    uint16_t predict = getBitField(bitFields[REG_MOD_2_PREDICT]);
+    #ifdef LATENCY_SENSOR_PREDICTION
+        if (predict != 1) {
+            setBitField(bitFields[REG_MOD_2_PREDICT], 1);
+            predict = getBitField(bitFields[REG_MOD_2_PREDICT]);
+        }
+    #endif
+
+    // The angle is half an update old on average, plus a full update of filtering (unless the encoder predicts it)
+    uint16_t updatePeriod = sensorUpdatePeriods[firMD];
+    sensorDelay = (updatePeriod / 2) + ((predict == 1) ? 0 : updatePeriod);
+}
+
+
+// Turns the compensation on or off
+void Encoder::setLatencyCompensation(bool enabled) {
+    latencyCompensation = enabled;
+}
+
+
+// Returns if the compensation is on
+bool Encoder::getLatencyCompensation() const {
+    return latencyCompensation;
+}
+
+
+// Gets the age of the observer's position right now (us)
+uint32_t Encoder::getLatency() const {
+    return (micros() - obsSampleTime) + (sensorDelay / 10) + LATENCY_EXTRA_DELAY;
+}
+
+
+// Gets the part of the delay inside of the encoder (tenths of a us)
+uint16_t Encoder::getSensorDelay() const {
+    return sensorDelay;
+}
+
+
+// Returns the observer's position moved forward to now, even with the compensation off (counts)
+int32_t Encoder::getPredictedPosition() const {
+    return getObserverPosition() + (int32_t)(((int64_t)getObserverVelocity() * getLatency()) / 1000000);
+}
+
+
+// Returns the observer's position for the feedback, moved forward to now if the compensation is on (counts)
+int32_t Encoder::getCompensatedPosition() const {
+    return (latencyCompensation ? getPredictedPosition() : getObserverPosition());
+}
+
+
+// Returns the averaged position for the feedback, moved forward to now (with the lag of the average) if the compensation is on (counts)
+int32_t Encoder::getCompensatedCountsAvg() {
+
+    // A moving average lags by half of its readings, each a tick of the observer apart
+    int32_t averageCounts = getAbsoluteCountsAvg();
+    if (!latencyCompensation) {
+        return averageCounts;
+    }
+    uint32_t averageLag = ((uint32_t)(ANGLE_AVG_READINGS - 1) * 1000000) / (2 * obsRate);
+    return averageCounts + (int32_t)(((int64_t)getObserverVelocity() * (getLatency() + averageLag)) / 1000000);
+}
+
+#endif // ! ENABLE_LATENCY_COMPENSATION
+
+
+// Recomputes the startup offsets from the increments saved when zeroing
+void Encoder::updateStartupOffsets() {
+
+    // Correct the startup increments if a table is loaded
+    #ifdef ENABLE_ENCODER_LINEARIZATION
+        int32_t correctedIncrements = linearize(startupIncrements);
+    #else
+        int32_t correctedIncrements = startupIncrements;
+    #endif
+
+    // Set the angle and count offsets
+    startupAngleOffset = (360.0 / POW_2_15 * (double)correctedIncrements) - encoderStepOffset;
+    startupCountOffset = correctedIncrements - stepCountOffset;
+}
+
+
+// Encoder linearization
+#ifdef ENABLE_ENCODER_LINEARIZATION
+
+// Loads a correction table (ENCODER_LINEAR_TABLE_SIZE entries, in increments)
+void Encoder::setLinearizationTable(const int16_t *table) {
+
+    // Copy the table into RAM (faster to access than flash)
+    memcpy(linearTable, table, sizeof(linearTable));
+    linearTableValid = true;
+
+    // The startup position needs to be corrected with the new table
+    updateStartupOffsets();
+}
+
+
+// Returns the corrected increments of a raw reading (not wrapped, can be slightly outside of 0 to 2^15)
+int32_t Encoder::linearize(uint16_t rawIncrements) const {
+
+    // Nothing to correct without a table
+    if (!linearTableValid) {
+        return rawIncrements;
+    }
+
+    // Find the bin of the reading and how far into the bin it is
+    uint16_t bin = rawIncrements >> ENCODER_LINEAR_BIN_POWER;
+    int32_t fraction = rawIncrements & (ENCODER_LINEAR_BIN_SIZE - 1);
+
+    // Interpolate between the corrections of this bin and the next (the last bin wraps to the first)
+    int32_t lowerCorrection = linearTable[bin];
+    int32_t upperCorrection = linearTable[(bin + 1) & (ENCODER_LINEAR_TABLE_SIZE - 1)];
+    return rawIncrements + lowerCorrection + (((upperCorrection - lowerCorrection) * fraction) >> ENCODER_LINEAR_BIN_POWER);
+}
+
+#endif // ! ENABLE_ENCODER_LINEARIZATION
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include "Arduino.h"
 #include "config.h"
 #include <MovingAverage.h>
+#include <CircularAverage.h>
+#include <filters.h>
 
 // Register locations (reading)
 #define ENCODER_READ_COMMAND    0x8000 // 8000
@@ -18,11 +20,33 @@
 #define ENCODER_WRITE_COMMAND   0x5000    // 5000
 #define ENCODER_ACT_STATUS_REG (0x0010U)  // Activation status
 
+// Fixed point position (counts)
+// Absolute counts = revolutions * ENCODER_COUNTS_PER_REV + increments
+#define ENCODER_COUNTS_POWER        15
+#define ENCODER_COUNTS_PER_REV      ((int32_t)1 << ENCODER_COUNTS_POWER)
+
+// Linearization table (one correction per bin of 2^ENCODER_LINEAR_BIN_POWER increments, interpolated between bins)
+#ifdef ENABLE_ENCODER_LINEARIZATION
+    #define ENCODER_LINEAR_TABLE_POWER  8
+    #define ENCODER_LINEAR_TABLE_SIZE   (1 << ENCODER_LINEAR_TABLE_POWER)
+    #define ENCODER_LINEAR_BIN_POWER    (ENCODER_COUNTS_POWER - ENCODER_LINEAR_TABLE_POWER)
+    #define ENCODER_LINEAR_BIN_SIZE     (1 << ENCODER_LINEAR_BIN_POWER)
+#endif
+
+// Tracking observer fixed point (the state is kept in 2^OBSERVER_Q_POWER fractions of a count, per correction tick)
+#ifdef ENABLE_ENCODER_OBSERVER
+    #define OBSERVER_Q_POWER  16
+    #define OBSERVER_ALPHA_Q  ((int32_t)(OBSERVER_ALPHA * (1 << OBSERVER_Q_POWER)))
+    #define OBSERVER_BETA_Q   ((int32_t)(OBSERVER_BETA  * (1 << OBSERVER_Q_POWER)))
+    #define OBSERVER_GAMMA_Q  ((int32_t)(2 * OBSERVER_GAMMA * (1 << OBSERVER_Q_POWER)))
+#endif
+
 // Calculation constants
 #define POW_2_16                    65536.0   // 2^16
 #define POW_2_15                    32768.0   // 2^15
 #define POW_2_7                     128.0     // 2^7
 #define DELETE_BIT_15               0x7FFF    // Used to delete everything except the first 15 bits
+#define INCREMENT_DELTA(from, to)   ((int16_t)((uint16_t)((to) - (from)) << 1) >> 1) // Signed difference between two 15 bit readings (handles the wrap from 2^15 to 0)
 #define CHANGE_UINT_TO_INT_15       0x8000    // Used to change unsigned 16 bit integer into signed
 #define CHECK_BIT_14                0x4000    // Used to check the 14th bit
 #define GET_BIT_14_4                0x7FF0    // Used to check the 14th bit?
@@ -41,9 +65,43 @@
 #define ENCODER_INTERFACE_ERROR_MASK        0x2000    //!< \brief Interface error masks for safety words
 #define ENCODER_INV_ANGLE_ERROR_MASK        0x1000    //!< \brief Angle error masks for safety words
 
-// CRC calculation values
-#define CRC_POLYNOMIAL  0x1D
-#define CRC_SEED        0xFF
+// Sample settings (a sample is a burst read of AVAL, ASPD, AREV and FSYNC, followed by the safety word)
+#define ENCODER_SAMPLE_WORDS    4
+#define ENCODER_SAMPLE_COMMAND  (ENCODER_READ_COMMAND | ENCODER_ANGLE_REG | ENCODER_SAMPLE_WORDS)
+#define ENCODER_SAMPLE_BYTES    ((ENCODER_SAMPLE_WORDS + 1) * 2)
+
+// CNF0 bit of PA7 (MOSI) in GPIOA -> CRL (set = AF open drain, cleared = AF push pull)
+#define ENCODER_MOSI_CNF_OD  (0x1U << 30)
+
+// Background read settings
+#ifdef ENABLE_ENCODER_DMA
+    #define ENCODER_DMA_IRQ_PRIO 6 // Same preemption as the step pin, so neither interrupts the other
+    #define ENCODER_DMA_IRQ_SUBPRIO 1
+
+    // Phases of a background read
+    typedef enum {
+        ACQ_IDLE,
+        ACQ_COMMAND,
+        ACQ_DATA
+        #ifdef ENABLE_ENCODER_POLLING
+        , ACQ_POLL_COMMAND
+        , ACQ_POLL_DATA
+        #endif
+    } ACQ_PHASE;
+
+    // Slow values that are round-robined by the background poller
+    #ifdef ENABLE_ENCODER_POLLING
+        typedef enum {
+            POLL_TEMP,
+            POLL_STAT,
+            POLL_ACSTAT,
+            POLL_SLOT_COUNT
+        } POLL_SLOT;
+
+        // Bytes clocked in for a single register read (data and safety words)
+        #define ENCODER_POLL_BYTES 4
+    #endif
+#endif
 
 /**
  * @brief Error types from safety word
@@ -57,6 +115,15 @@ enum errorTypes {
 	CRC_ERROR              = 0xFF   //!< \brief CRC_ERROR = Cyclic Redundancy Check (CRC), which includes the STAT and RESP bits wrong
 };
 
+// Snapshot of the encoder's readings, all taken in a single transaction
+typedef struct {
+    uint16_t rawAngle; // Angle increments (15 bit, unsigned)
+    int16_t  rawSpeed; // Angle speed (15 bit, signed)
+    int16_t  rawRev;   // Revolution counter (9 bit, signed)
+    int16_t  rawTemp;  // Temperature from the FSYNC register (9 bit, signed)
+    uint32_t time;     // Time that the sample was taken (us)
+} EncoderSample;
+
 // Main address fields
 enum Addr_t {
     REG_STAT         = (0x0000U),    //!< \brief STAT status register
@@ -140,6 +207,9 @@ static const AddressField_t addrFields[] =
 
 #define MAX_NUM_REG 0x16      //!< \brief defines the value for temporary data to read all readable registers
 
+// Most words that a single burst read can return (the 4 bit ND field of the command)
+#define ENCODER_MAX_BURST_WORDS 15
+
 
 // Bit fields
 enum BitFieldReg_t
@@ -255,6 +325,13 @@ enum BitFieldReg_t
     REG_T25O_RESERVED1,
 };
 
+// Settings of the encoder that can be written at boot (see ENCODER_PROFILE)
+typedef enum {
+    ENCODER_PROFILE_CHIP_DEFAULT,
+    ENCODER_PROFILE_LOW_LATENCY,
+    ENCODER_PROFILE_LOW_NOISE
+} ENCODER_PROFILE_TYPE;
+
 // Encoder class
 class Encoder {
 
@@ -266,17 +343,69 @@ class Encoder {
         // Low level reading functions
         errorTypes readRegister(uint16_t registerAddress, uint16_t &data);
         void readMultipleRegisters(uint16_t registerAddress, uint16_t* data, uint16_t dataLength);
+
+        // Reads consecutive registers in a single burst, checking the safety word (and CRC) once for all of them
+        errorTypes readRegisterBurst(uint16_t registerAddress, uint16_t* data, uint8_t dataLength);
+
+        // Snapshot of every register into the register map, in as few bursts as the addresses allow (returns the first error)
+        // Each register is only updated if its burst was valid
+        errorTypes readRegisterMap();
+
+        // Gets a register of the map (from the last snapshot or bit field access), along with its name
+        uint16_t getMappedRegister(uint8_t index) const;
+        const char* getRegisterName(uint8_t index) const;
         uint16_t getBitField(BitField_t bitField);
 
         // Low level writing functions
         void writeToRegister(uint16_t registerAddress, uint16_t data);
         void setBitField(BitField_t bitfield, uint16_t bitFNewValue);
 
+        // Finds the SPI prescaler again from the clock of APB2 (needed after the system clock is changed)
+        void updateSPIClock();
+
+        // Writes the settings of a profile to the encoder, reading each back (returns the number of fields that didn't match)
+        uint8_t applyProfile(ENCODER_PROFILE_TYPE profile);
+
         // Error checking
         errorTypes checkSafety(uint16_t safety, uint16_t command, uint16_t* readreg, uint16_t length);
         uint8_t calcCRC(uint8_t *data, uint8_t length);
         void resetSafety();
 
+        // Reads the angle, speed, revolution, and temperature registers in a single burst, storing them as the newest sample
+        errorTypes sample();
+
+        // Returns the newest sample (a new one is taken unless a background sample is fresh)
+        EncoderSample getSample();
+
+        // Returns the newest sample if it was taken in the last maxAge us (ex. by the control loop), otherwise takes a new one
+        EncoderSample getRecentSample(uint32_t maxAge);
+
+        // Health of the encoder
+        // A read that fails each of its ENCODER_READ_ATTEMPTS is replaced by a prediction from the last good sample
+        // The encoder is marked as unhealthy once more than ENCODER_MAX_MISSED_READS are missed in a row, or once errors come faster than ENCODER_MAX_ERROR_RATE
+
+        // Returns if the encoder has been marked as unhealthy (stays set until it is cleared)
+        bool hasHealthFault() const;
+
+        // Clears the health fault (the motor is being enabled again)
+        void clearHealthFault();
+
+        // Gets a summary of the encoder's health (errors, the most in a second, the predicted reads, the turns corrected by the revolution counter, the boot profile's mismatches, and the fault)
+        String getHealthStats() const;
+
+        // Clears the error statistics (the fault is left as it is)
+        void clearHealthStats();
+
+        // Per-tick cache (every read between beginTick() and endTick() shares a single sample)
+        #ifdef ENABLE_ENCODER_TICK_CACHE
+
+            // Starts a new tick, invalidating the cache of the last one
+            void beginTick();
+
+            // Ends the tick, so that reads outside of it take new samples
+            void endTick();
+        #endif
+
         // Fast functions
         uint16_t getRawIncrements();
         uint16_t getRawIncrementsAvg();
@@ -295,6 +424,9 @@ class Encoder {
         // Reads the momentary value for the angle of the encoder (ranges from 0-360)
         double getAngle();
 
+        // Calculates the angle of the encoder from a sample (ranges from 0-360)
+        double getAngle(const EncoderSample &currentSample);
+
         // Reads the average value for the angle of the encoder (ranges from 0-360)
         double getAngleAvg();
         double getEstimSpeed();
@@ -302,14 +434,114 @@ class Encoder {
         double getSpeed();
         double getAccel();
         int16_t getRawTemp();
+
+        // Averages the newest temperature sample (or returns the background average, if it is polled), in the raw units of the encoder
+        int16_t getRawTempAvg();
+
+        // Converts the averaged temperature to degrees C (only needed to show it, the overtemp protection compares the raw values)
         double getTemp();
+
+        // Converts the newest temperature sample (or the one given) to tenths of a degree C with integer math only
+        int16_t getTempTenths();
+        int16_t getTempTenths(const EncoderSample &currentSample);
+        int16_t rawTempToTenths(int16_t rawTemp) const;
         int16_t getRawRev();
         int32_t getRev();
+        int32_t getRev(const EncoderSample &currentSample);
         double getAbsoluteAngleAvg();
         float getAbsoluteAngleAvgFloat();
+
+        // Fixed point absolute position (in counts, 2^15 per revolution)
+        int32_t getAbsoluteCounts(const EncoderSample &currentSample);
+        int32_t getAbsoluteCountsAvg();
         void setStepOffset(double offset);
         void zero();
 
+        // Power loss position retention
+        #ifdef ENABLE_POWER_LOSS_SAVE
+            // Gets what restorePosition() needs to pick the position back up (the raw increments of the zero, then the turns and raw increments of a single sample)
+            void capturePosition(uint16_t &zeroIncrements, int32_t &turns, uint16_t &increments);
+
+            // Zeroes the encoder where it was zeroed before the power was lost, finding the turns from the change of the angle since the capture
+            // The shaft has to have moved less than half of a turn for the turns to be right
+            void restorePosition(uint16_t zeroIncrements, int32_t turns, uint16_t increments);
+        #endif
+
+        // Increments of the latest sample from the calibrated step offset (0 to 2^15 - 1, used to find the electrical phase of the rotor)
+        uint16_t getCalibratedIncrements();
+
+        // Increments of a raw reading from the calibrated step offset (0 to 2^15 - 1)
+        uint16_t calibrateIncrements(uint16_t rawIncrements) const;
+
+        // Temperature compensation of the step offset
+        #ifdef ENABLE_ENCODER_TEMP_COMP
+
+            // Sets the temperature that the step offset was calibrated at (raw) and how far it drifts (increments per raw unit of temperature)
+            void setTempCompensation(int16_t calibrationRawTemp, float slope);
+            int16_t getTempCompRawTemp() const;
+            float getTempCompSlope() const;
+
+            // Increments that the offset has moved since it was calibrated (updated with the polled temperature)
+            int32_t getTempOffsetCounts() const;
+        #endif
+
+        // Tracking observer
+        #ifdef ENABLE_ENCODER_OBSERVER
+
+            // Advances the observer with the current sample (called once every correction)
+            void updateObserver();
+
+            // Sets the rate that the observer is updated at (Hz)
+            void setObserverRate(uint32_t rate);
+
+            // Restarts the observer from the next sample
+            void resetObserver();
+
+            // Estimated position (counts), velocity (counts/s), and acceleration (counts/s/s)
+            int32_t getObserverPosition() const;
+            int32_t getObserverVelocity() const;
+            int32_t getObserverAccel() const;
+
+            // Gets the calibrated increments of the newest sample, moved forward to now with the observer's velocity (0 to 2^15 - 1)
+            // Never reads the encoder, so the inner commutation can call it from its interrupt
+            #ifdef ENABLE_FAST_COMMUTATION
+                uint16_t getInterpolatedIncrements();
+            #endif
+        #endif
+
+        // Latency compensation of the position feedback
+        #ifdef ENABLE_LATENCY_COMPENSATION
+
+            // Reads the update rate of the encoder, turning on its prediction if specified
+            void initLatencyCompensation();
+
+            // Turns the compensation on or off (off returns the positions as they were measured)
+            void setLatencyCompensation(bool enabled);
+            bool getLatencyCompensation() const;
+
+            // Observer's position moved forward to now, even with the compensation off (counts)
+            int32_t getPredictedPosition() const;
+
+            // Positions for the feedback, moved forward to now if the compensation is on (counts)
+            // The averaged position is also moved forward by the lag of the average
+            int32_t getCompensatedPosition() const;
+            int32_t getCompensatedCountsAvg();
+
+            // Gets the age of the observer's position right now (us), and the part of it inside of the encoder (tenths of a us)
+            uint32_t getLatency() const;
+            uint16_t getSensorDelay() const;
+        #endif
+
+        // Encoder linearization
+        #ifdef ENABLE_ENCODER_LINEARIZATION
+
+            // Loads a correction table (ENCODER_LINEAR_TABLE_SIZE entries, in increments)
+            void setLinearizationTable(const int16_t *table);
+
+            // Returns the corrected increments of a raw reading (not wrapped, can be slightly outside of 0 to 2^15)
+            int32_t linearize(uint16_t rawIncrements) const;
+        #endif
+
         // Encoder estimation
         #ifdef ENCODER_SPEED_ESTIMATION
 
@@ -317,37 +549,252 @@ class Encoder {
             bool sampleTimeExceeded();
         #endif
 
+        // Background (DMA) angle reads
+        #ifdef ENABLE_ENCODER_DMA
+
+            // Sets up the DMA channels of the SPI bus for background reads
+            void beginAcquisition();
+
+            // Starts a background read of the angle register (returns immediately)
+            void startAcquisition();
+
+            // Sets up a background read for the correction timer's compare event to start, at the trigger time (us, from micros())
+            // Must be called with the interrupts masked, returns false if the bus is in use
+            #ifdef ENABLE_ENCODER_TRIGGERED_READS
+                bool armAcquisition(uint32_t triggerTime);
+            #endif
+
+            // Advances the background read to the next phase (called by the DMA interrupt)
+            void acquisitionHandler();
+
+            // Returns if the latest background sample is recent enough to be used
+            bool acquisitionFresh() const;
+        #endif
+
+        // Cached slow values from the background poller (never touch the bus)
+        #ifdef ENABLE_ENCODER_POLLING
+
+            // The latest STAT and ACSTAT register values
+            uint16_t getPolledStatus() const;
+            uint16_t getPolledActStatus() const;
+        #endif
+
+        // Lowers the current or disables the motor if the temperature is too high
+        #ifdef ENABLE_OVERTEMP_PROTECTION
+            void checkOvertemp(int16_t rawTemp);
+        #endif
+
     private:
+        // Decodes a received burst, then publishes it as the newest sample
+        void publishSample(uint8_t* buffer);
+
+        // Releases the MOSI pin (open drain), letting the encoder drive the data line
+        void setMOSIOpenDrain();
+
+        // Drives the MOSI pin again (push pull)
+        void setMOSIPushPull();
+
+        // Recomputes the startup offsets from the increments saved when zeroing
+        void updateStartupOffsets();
+
+        // Reads the update rate of the encoder (FIR_MD), finding the scale of the speed from it
+        void readUpdateRate();
+
+        // Adds the change in angle of a sample to the tracked turns (returns the whole turns)
+        int32_t trackRevolutions(const EncoderSample &currentSample);
+
+        // Moves a sample forward to now with the observer's velocity (or holds it, if there isn't an observer)
+        EncoderSample predictSample(const EncoderSample &lastSample);
+
+        // Counts a read that failed its checks
+        void countReadError(bool crcError);
+
+        // Claims the SPI bus for a blocking transaction (waits for any background read to finish)
+        void lockBus();
+
+        // Releases the SPI bus, allowing background reads again
+        void unlockBus();
+
+        // Moves the step offset with the polled temperature (called by the poller)
+        #ifdef ENABLE_ENCODER_TEMP_COMP
+            void updateTempCompensation();
+        #endif
+
         // Variables
         uint32_t lastAngleSampleTime;
         double lastEncoderAngle = 0;
 
-        // Last state of getRawRev()
-        int16_t lastRawRev = 0;
+        // Fields of the boot profile that didn't read back as they were written
+        uint8_t profileMismatches = 0;
+
+        // Update rate of the encoder (FIR_MD, read at boot and when it is written), and the scale of the speed register to deg/s (Q16)
+        uint8_t firMD = 1;
+        int32_t speedScale = 0;
 
-        // Revolutions extender variable
-        // Total revolutions = (revolutions * 512) + getRawRev()
-        int32_t revolutions = 0;
+        // Multi-turn tracking, the shaft position in raw increments is built up from the change in angle of each new sample
+        int32_t trackedIncrements = 0;
+        uint16_t lastTrackedAngle = 0;
+        uint32_t lastTrackedTime = 0;
+        bool trackingStarted = false;
 
-        // Moving average instances
-        MovingAverage <float> speedAvg;
-        MovingAverage <int16_t> rawSpeedAvg;
-        MovingAverage <float> accelAvg;
-        MovingAverage <uint16_t> incrementAvg;
-        MovingAverage <float> absAngleAvg;
-        MovingAverage <int16_t> rawTempAvg;
+        // Cross-check of the tracked turns against the revolution counter (AREV)
+        int16_t lastRawRev = 0;
+        int32_t lastCheckRev = 0;
+        uint32_t samplesSinceRevCheck = 0;
+        volatile uint32_t revCorrections = 0;
+
+        // Health of the encoder (the reads missed in a row, and whether it is faulted)
+        uint32_t missedReads = 0;
+        volatile bool healthFault = false;
+
+        // Error statistics, along with the errors in the current second (errorWindowStart is in ms)
+        volatile uint32_t readErrors = 0;
+        volatile uint32_t crcErrors = 0;
+        volatile uint32_t predictedReads = 0;
+        volatile uint32_t windowErrors = 0;
+        volatile uint32_t errorWindowStart = 0;
+        volatile uint32_t peakErrorRate = 0;
+
+        // Filter instances (picked in config.h)
+        RPM_FILTER speedAvg;
+        RAW_SPEED_FILTER rawSpeedAvg;
+        ACCEL_FILTER accelAvg;
+        CircularAverage <ANGLE_AVG_READINGS, 15> incrementAvg;
+        ABS_COUNT_FILTER absCountAvg;
+        RAW_TEMP_FILTER rawTempAvg;
 
         // The startup angle and rev offsets
         double startupAngleOffset = 0;
         int32_t startupRevOffset = 0;
         double encoderStepOffset = 0;
 
+        // The startup and step offsets, in counts
+        int32_t startupCountOffset = 0;
+        int32_t stepCountOffset = 0;
+
+        // Temperature compensation, the step offset is the calibrated offset moved by the drift since the calibration
+        #ifdef ENABLE_ENCODER_TEMP_COMP
+            int32_t calibratedCountOffset = 0;
+            int16_t tempCompRawTemp = 0;
+            float tempCompSlope = 0;
+            int32_t tempCompSlopeQ16 = 0;
+            volatile int32_t tempOffsetCounts = 0;
+        #endif
+
+        // Tracking observer state
+        #ifdef ENABLE_ENCODER_OBSERVER
+
+            // Position (only used inside of the update), velocity, and acceleration (per tick, in fixed point)
+            int64_t obsPosition = 0;
+            volatile int32_t obsVelocity = 0;
+            volatile int32_t obsAccel = 0;
+
+            // Position in whole counts (can be read atomically)
+            volatile int32_t obsPositionCounts = 0;
+
+            // The update rate (Hz) and if the state has been set from a sample
+            volatile uint32_t obsRate = 1;
+            volatile bool obsInitialized = false;
+
+            // Velocity in counts per us (Q16), so moving a sample forward is only a multiply
+            #ifdef ENABLE_FAST_COMMUTATION
+                volatile int32_t obsVelocityPerUs = 0;
+            #endif
+        #endif
+
+        // Latency compensation state (the time is of the sample that the observer last used)
+        #ifdef ENABLE_LATENCY_COMPENSATION
+            volatile uint32_t obsSampleTime = 0;
+            uint16_t sensorDelay = 0;
+            bool latencyCompensation = true;
+        #endif
+
+        // The averaged increments when the encoder was last zeroed
+        uint16_t startupIncrements = 0;
+
+        // The linearization table, along with if it has been loaded
+        #ifdef ENABLE_ENCODER_LINEARIZATION
+            int16_t linearTable[ENCODER_LINEAR_TABLE_SIZE];
+            bool linearTableValid = false;
+        #endif
+
         // SPI init structure
         SPI_HandleTypeDef spiConfig;
 
         // Main initialization structure
         GPIO_InitTypeDef GPIO_InitStructure;
 
+        // Background read variables
+        #ifdef ENABLE_ENCODER_DMA
+
+            // Loads and enables both DMA channels for a transfer of the specified length (it starts once the SPI's DMA requests are turned on)
+            void loadTransfer(uint8_t* txBuffer, uint8_t length);
+
+            // Starts both DMA channels for a transfer of the specified length
+            void startTransfer(uint8_t* txBuffer, uint8_t length);
+
+            // The command and dummy buffers to transmit, as well as the buffer to receive into
+            uint8_t acqCommand[2] = { uint8_t(ENCODER_SAMPLE_COMMAND >> 8), uint8_t(ENCODER_SAMPLE_COMMAND) };
+            uint8_t acqDummy[ENCODER_SAMPLE_BYTES] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+            uint8_t acqRXBuffer[ENCODER_SAMPLE_BYTES];
+
+            // The current phase of the background read
+            volatile ACQ_PHASE acqPhase = ACQ_IDLE;
+
+            // The SPI control word that the trigger writes (turning the DMA requests on), and the time of the trigger if it started the read
+            #ifdef ENABLE_ENCODER_TRIGGERED_READS
+                uint16_t acqStartCR2 = 0;
+                uint32_t acqTriggerTime = 0;
+                bool acqTriggered = false;
+            #endif
+
+            // Checks the safety word of a finished background read (status bits and CRC)
+            bool transferValid(const uint8_t* command, uint8_t length) const;
+        #endif
+
+        // Background poller variables
+        #ifdef ENABLE_ENCODER_POLLING
+
+            // Moves on to the next slow value, starting a register read if one is needed (returns if the bus is in use)
+            bool startPoll();
+
+            // The command of the current register read
+            uint8_t pollCommand[2];
+
+            // Samples left till the next slow value, and the next slow value to update
+            uint16_t pollCountdown = ENCODER_POLL_INTERVAL;
+            POLL_SLOT pollSlot = POLL_TEMP;
+
+            // Cached slow values
+            volatile uint16_t polledStatus = 0;
+            volatile uint16_t polledActStatus = 0;
+            volatile int16_t polledRawTemp = 0;
+        #endif
+
+        // Double buffer of validated samples (the index points to the newest)
+        volatile EncoderSample samples[2];
+        volatile uint8_t sampleIndex = 0;
+
+        // If there has been a valid sample at all
+        volatile bool sampleValid = false;
+
+        // Per-tick cache variables
+        #ifdef ENABLE_ENCODER_TICK_CACHE
+
+            // If a tick is running and the epoch of the current tick
+            bool tickActive = false;
+            uint32_t tickEpoch = 0;
+
+            // The sample and absolute position of the current tick, along with the epochs that they were taken in
+            EncoderSample tickSample;
+            uint32_t tickSampleEpoch = 0;
+            int32_t tickAbsCounts = 0;
+            uint32_t tickAbsCountsEpoch = 0;
+        #endif
+
+        // Number of blocking transactions currently using the SPI bus
+        volatile uint8_t busLocks = 0;
+
         // Storage for the last overtemp time
         #ifdef ENABLE_OVERTEMP_PROTECTION
             uint32_t lastOvertempTime = 0;
@@ -1,4 +1,9 @@
 #include "flash.h"
+#include "serial.h"
+#include "crc.h"
+#include "controlMode.h"
+#include "parameters.h"
+#include "canGearing.h"
 
 // Raw read function. Reads raw bits into a set type
 uint16_t readFlashAddress(uint32_t address) {
@@ -19,65 +24,226 @@ uint16_t readFlashAddress(uint32_t address) {
 }
 
 
-// Based on the readFlashAddress function, reads a uint16_t at a parameter index
-uint16_t readFlashU16(uint32_t parameterIndex) {
+// Layout of the parameter log
+// Each page starts with a header (state, then generation), followed by the records
+#define PARAMETER_RECORD_SIZE       8
+#define PARAMETER_RECORDS_PER_PAGE  ((PARAMETER_PAGE_SIZE / PARAMETER_RECORD_SIZE) - 1)
+#define PARAMETER_PAGE_ACTIVE       0x0000 // Holds the newest values (0 can be written over the receiving state without an erase)
+#define PARAMETER_PAGE_RECEIVING    0xEEEE // Being filled by a compaction, not used until it is marked active
+static_assert(FLASH_PARAM_COUNT < PARAMETER_RECORDS_PER_PAGE, "There must be room for every parameter's record in a page");
+
+// One value in the log (the key is written last, so that a record that was cut off by a reset fails its CRC)
+typedef struct {
+    uint16_t key;
+    uint16_t value[2];
+    uint16_t crc;
+} parameterRecord;
+
+// The pages of the log
+static const uint32_t parameterPages[2] = { PARAMETER_PAGE_0_ADDR, PARAMETER_PAGE_1_ADDR };
+
+// State of the log, loaded on the first access
+static bool parameterLogLoaded = false;
+static bool parameterLogActive = false;
+static uint8_t activePage = 0;
+static uint16_t activeGeneration = 0;
+static uint16_t nextRecord = 0;
+
+// Newest value of each key (0xFFFFFFFF if it has never been written, the same as erased flash)
+static uint32_t parameterValues[FLASH_PARAM_COUNT];
+static bool parameterWritten[FLASH_PARAM_COUNT];
+
 
-    // Just a basic read
-    return readFlashAddress(DATA_START_ADDR + (parameterIndex * 4));
+// Gets a record of a page of the log
+static const parameterRecord* getParameterRecord(uint8_t page, uint16_t index) {
+    return (const parameterRecord*)(parameterPages[page] + ((index + 1) * PARAMETER_RECORD_SIZE));
 }
 
 
-// Based on the readFlashAddress function, reads a uint32_t at a parameter index
-uint32_t readFlashU32(uint32_t parameterIndex) {
+// Computes the CRC of a record (covers the key and the value)
+static uint16_t getParameterRecordCRC(uint16_t key, uint32_t value) {
+    uint8_t data[6];
+    memcpy(&data[0], &key, 2);
+    memcpy(&data[2], &value, 4);
+    return crc16(data, sizeof(data));
+}
 
-    // Create a blank array to store the values in
-    uint16_t intData[2];
 
-    // Pull the values at the specified addresses
-    intData[0] = readFlashAddress(DATA_START_ADDR + (parameterIndex * 4));
-    intData[1] = readFlashAddress(DATA_START_ADDR + (parameterIndex * 4) + 2);
+// Erases a page of flash
+void eraseFlashPage(uint32_t address) {
 
-    // Create a variable to store the data in
-    uint32_t data;
+    // Disable the motor timers
+    disableInterrupts();
 
-    // Copy the 4 bytes of the data over (all of it)
-    memcpy(&data, &intData, 4);
+    // Unlock the flash
+    HAL_FLASH_Unlock();
 
-    // Return the data
-    return data;
+    // Configure the erase type
+    FLASH_EraseInitTypeDef eraseStruct;
+    eraseStruct.TypeErase = FLASH_TYPEERASE_PAGES;
+    eraseStruct.PageAddress = address;
+    eraseStruct.NbPages = 1;
+
+    // Erase the the entire page
+    uint32_t pageError = 0;
+    HAL_FLASHEx_Erase(&eraseStruct, &pageError);
+
+    // Good to go, lock the flash again (the address write has it's own locks and unlocks)
+    HAL_FLASH_Lock();
+
+    // Re-enable the motor timers
+    enableInterrupts();
 }
 
 
-// Based on the readFlashAddress function, reads a bool at a parameter index
-bool readFlashBool(uint32_t parameterIndex) {
+// Finds the active page of the log, then reads the newest value of each key out of it
+static void loadParameterLog() {
 
-    // Return the data stored at the address, converted from native 16 bit int to bool
-    if (readFlashAddress(DATA_START_ADDR + (parameterIndex * 4)) == 1) {
-        return true;
+    // Start with every key unwritten
+    for (uint16_t key = 0; key < FLASH_PARAM_COUNT; key++) {
+        parameterValues[key] = 0xFFFFFFFF;
+        parameterWritten[key] = false;
     }
-    else {
-        return false;
+    parameterLogLoaded = true;
+    parameterLogActive = false;
+    nextRecord = 0;
+
+    // Wait once for the flash to be free, then the whole log can be read straight out of it
+    FLASH_WaitForLastOperation(10);
+
+    // Use the active page, the newer one if a compaction was cut off before the old page was erased
+    for (uint8_t page = 0; page < 2; page++) {
+        const uint16_t* header = (const uint16_t*)parameterPages[page];
+        if (header[0] == PARAMETER_PAGE_ACTIVE && (!parameterLogActive || (int16_t)(header[1] - activeGeneration) > 0)) {
+            parameterLogActive = true;
+            activePage = page;
+            activeGeneration = header[1];
+        }
+    }
+
+    // Nothing has been saved yet
+    if (!parameterLogActive) {
+        return;
+    }
+
+    // Replay the records in order, until the first empty slot
+    for (; nextRecord < PARAMETER_RECORDS_PER_PAGE; nextRecord++) {
+        const parameterRecord* record = getParameterRecord(activePage, nextRecord);
+        if (record -> key == 0xFFFF && record -> value[0] == 0xFFFF && record -> value[1] == 0xFFFF && record -> crc == 0xFFFF) {
+            break;
+        }
+
+        // Skip records that were cut off or are for keys that no longer exist
+        uint32_t value = (record -> value[0] | ((uint32_t)(record -> value[1]) << 16));
+        if (record -> key < FLASH_PARAM_COUNT && record -> crc == getParameterRecordCRC(record -> key, value)) {
+            parameterValues[record -> key] = value;
+            parameterWritten[record -> key] = true;
+        }
     }
 }
 
 
-// Based on the readFlashAddress function, reads a uint32_t at a parameter index
-float readFlashFloat(uint32_t parameterIndex) {
+// Writes a record into the next slot of a page
+static void writeParameterRecord(uint8_t page, uint16_t index, uint16_t key, uint32_t value) {
+    uint32_t address = (uint32_t)getParameterRecord(page, index);
+    writeToFlashAddress(address + 2, (uint16_t)value);
+    writeToFlashAddress(address + 4, (uint16_t)(value >> 16));
+    writeToFlashAddress(address + 6, getParameterRecordCRC(key, value));
+    writeToFlashAddress(address, key);
+}
 
-    // Create a blank array to store the values in
-    uint16_t intData[2];
 
-    // Pull the values at the specified addresses
-    intData[0] = readFlashAddress(DATA_START_ADDR + (parameterIndex * 4));
-    intData[1] = readFlashAddress(DATA_START_ADDR + (parameterIndex * 4) + 2);
+// Copies the newest value of each key into the other page, then erases the old one
+static void compactParameterLog() {
 
-    // Create a variable to store the data in
-    float data;
+    // Start the new page, it isn't used until every value has been copied
+    uint8_t newPage = (parameterLogActive ? (1 - activePage) : 0);
+    uint16_t newGeneration = (activeGeneration + 1);
+    eraseFlashPage(parameterPages[newPage]);
+    writeToFlashAddress(parameterPages[newPage], PARAMETER_PAGE_RECEIVING);
+    writeToFlashAddress(parameterPages[newPage] + 2, newGeneration);
 
-    // Copy the 4 bytes of the data over (all of it)
-    memcpy(&data, &intData, 4);
+    // Copy the values
+    uint16_t index = 0;
+    for (uint16_t key = 0; key < FLASH_PARAM_COUNT; key++) {
+        if (parameterWritten[key]) {
+            writeParameterRecord(newPage, index++, key, parameterValues[key]);
+        }
+    }
 
-    // Return the data
+    // Switch over to the new page, then erase the old one
+    writeToFlashAddress(parameterPages[newPage], PARAMETER_PAGE_ACTIVE);
+    if (parameterLogActive) {
+        eraseFlashPage(parameterPages[activePage]);
+    }
+    parameterLogActive = true;
+    activePage = newPage;
+    activeGeneration = newGeneration;
+    nextRecord = index;
+}
+
+
+// Gets the newest value of a key
+static uint32_t readParameter(uint32_t parameterIndex) {
+    if (!parameterLogLoaded) {
+        loadParameterLog();
+    }
+    if (parameterIndex >= FLASH_PARAM_COUNT) {
+        return 0xFFFFFFFF;
+    }
+    return parameterValues[parameterIndex];
+}
+
+
+// Appends a record for a key, if its value changed
+static void writeParameter(uint32_t parameterIndex, uint32_t value) {
+    if (!parameterLogLoaded) {
+        loadParameterLog();
+    }
+    if (parameterIndex >= FLASH_PARAM_COUNT || (parameterWritten[parameterIndex] && parameterValues[parameterIndex] == value)) {
+        return;
+    }
+
+    // Save the value first, so that a compaction copies it over
+    parameterValues[parameterIndex] = value;
+    parameterWritten[parameterIndex] = true;
+
+    // Make room if the page is full (the compaction already writes every value)
+    if (!parameterLogActive || nextRecord >= PARAMETER_RECORDS_PER_PAGE) {
+        compactParameterLog();
+        return;
+    }
+    writeParameterRecord(activePage, nextRecord++, (uint16_t)parameterIndex, value);
+}
+
+
+// Reads a uint16_t at a parameter index
+uint16_t readFlashU16(uint32_t parameterIndex) {
+    return (uint16_t)readParameter(parameterIndex);
+}
+
+
+// Reads a uint32_t at a parameter index
+uint32_t readFlashU32(uint32_t parameterIndex) {
+    return readParameter(parameterIndex);
+}
+
+
+// Reads a bool at a parameter index
+bool readFlashBool(uint32_t parameterIndex) {
+
+    // Return the data stored at the index, converted from native 16 bit int to bool
+    return (readFlashU16(parameterIndex) == 1);
+}
+
+
+// Reads a float at a parameter index
+float readFlashFloat(uint32_t parameterIndex) {
+
+    // Copy the 4 bytes of the data over (all of it)
+    uint32_t rawData = readParameter(parameterIndex);
+    float data;
+    memcpy(&data, &rawData, 4);
     return data;
 }
 
@@ -105,98 +271,97 @@ void writeToFlashAddress(uint32_t address, uint16_t data) {
 }
 
 
-// Built on the address function, writes to a parameter index instead
+// Writes a uint16_t to a parameter index
 void writeFlash(uint32_t parameterIndex, uint16_t data) {
-
-    // Address is the start address plus 4 bytes for every parameter after
-    writeToFlashAddress(DATA_START_ADDR + (parameterIndex * 4), data);
+    writeParameter(parameterIndex, data);
 }
 
 
-// Built on the address function, writes unsigned 32 bit ints instead
+// Writes a uint32_t to a parameter index
 void writeFlash(uint32_t parameterIndex, uint32_t data) {
-
-    // Create array for the uint16_ts
-    uint16_t intData[2];
-
-    // Copy the raw data over (4 bytes of information)
-    memcpy(intData, &data, 4);
-
-    // Now send each of the parts to flash
-    writeToFlashAddress(DATA_START_ADDR + (parameterIndex * 4),     intData[0]);
-    writeToFlashAddress(DATA_START_ADDR + (parameterIndex * 4) + 2, intData[1]);
+    writeParameter(parameterIndex, data);
 }
 
 
-// Built on the address function, writes a bool instead
+// Writes a bool to a parameter index
 void writeFlash(uint32_t parameterIndex, bool data) {
 
     // Convert the bool to a 16 bit unsigned int (natural flash unit) and write it
-    if (data) {
-        writeToFlashAddress(DATA_START_ADDR + (parameterIndex * 4), 1U);
-    }
-    else {
-        writeToFlashAddress(DATA_START_ADDR + (parameterIndex * 4), 0U);
-    }
+    writeParameter(parameterIndex, (data ? 1U : 0U));
 }
 
 
-// Built on the address function, writes a float instead
+// Writes a float to a parameter index
 void writeFlash(uint32_t parameterIndex, float data) {
 
-    // Create array for the uint16_ts
-    uint16_t intData[2];
-
     // Copy the raw data over
-    memcpy(intData, &data, 4);
-
-    // Now send each of the parts to flash
-    writeToFlashAddress(DATA_START_ADDR + (parameterIndex * 4),     intData[0]);
-    writeToFlashAddress(DATA_START_ADDR + (parameterIndex * 4) + 2, intData[1]);
+    uint32_t rawData;
+    memcpy(&rawData, &data, 4);
+    writeParameter(parameterIndex, rawData);
 }
 
 
-// Erases all data that is saved in the parameters page
+// Erases all of the saved parameters (moves to a fresh page of the log with only the version in it)
 void eraseParameters() {
 
-    // Disable the motor timers
-    disableInterrupts();
+    // Forget every value, then start a new page without them
+    if (!parameterLogLoaded) {
+        loadParameterLog();
+    }
+    for (uint16_t key = 0; key < FLASH_PARAM_COUNT; key++) {
+        parameterValues[key] = 0xFFFFFFFF;
+        parameterWritten[key] = false;
+    }
+    compactParameterLog();
 
-    // Unlock the flash
-    HAL_FLASH_Unlock();
+    // Write the version to flash
+    writeFlash(FLASH_CONTENTS_VERSION_INDEX, FLASH_CONTENTS_VERSION);
+}
 
-    // Configure the erase type
-    FLASH_EraseInitTypeDef eraseStruct;
-    eraseStruct.TypeErase = FLASH_TYPEERASE_PAGES;
-    eraseStruct.PageAddress = DATA_START_ADDR;
-    eraseStruct.NbPages = 1;
 
-    // Erase the the entire page (all possible addresses for parameters to be stored)
-    uint32_t pageError = 0;
-    HAL_FLASHEx_Erase(&eraseStruct, &pageError);
+// Encoder linearization table storage
+#ifdef ENABLE_ENCODER_LINEARIZATION
 
-    // Good to go, lock the flash again (writeFlash has it's own locks and unlocks)
-    HAL_FLASH_Lock();
+// Writes out the encoder linearization table into its own page
+void writeLinearizationTable(const int16_t *table) {
 
-    // Write the major, minor, and patch numbers to flash
-    writeFlash(FLASH_CONTENTS_MAJOR_VERSION_INDEX, MAJOR_VERSION);
-    writeFlash(FLASH_CONTENTS_MINOR_VERSION_INDEX, MINOR_VERSION);
-    writeFlash(FLASH_CONTENTS_PATCH_VERSION_INDEX, PATCH_VERSION);
+    // Erase the page of the table
+    eraseFlashPage(LINEARIZATION_START_ADDR);
 
-    // Re-enable the motor timers
-    enableInterrupts();
+    // Write out the table after the marker
+    for (uint16_t index = 0; index < ENCODER_LINEAR_TABLE_SIZE; index++) {
+        writeToFlashAddress(LINEARIZATION_START_ADDR + 2 + (index * 2), (uint16_t)table[index]);
+    }
+
+    // Mark the table as valid last (an interrupted write is never loaded)
+    writeToFlashAddress(LINEARIZATION_START_ADDR, LINEARIZATION_VALID_MARK);
 }
 
 
+// Returns the saved encoder linearization table, NULL if there isn't one
+const int16_t* readLinearizationTable() {
+
+    // Check for the marker
+    if (readFlashAddress(LINEARIZATION_START_ADDR) != LINEARIZATION_VALID_MARK) {
+        return NULL;
+    }
+
+    // The table can be read straight out of flash
+    return (const int16_t*)(LINEARIZATION_START_ADDR + 2);
+}
+
+#endif // ! ENABLE_ENCODER_LINEARIZATION
+
+
 // Writes the currently saved parameters to flash memory for long term storage
 void saveParameters() {
 
-    // Check to see if the module was calibrated previously
+    // Check to see if the module was calibrated previously (before the version is updated)
     bool calibrated = isCalibrated();
 
-    // Erase the current flash data if old data exists (needed to write new data, flash will not allow
-    // writing 0s in place of 1s for whatever reason).
-    eraseParameters();
+    // Write the version to flash
+    // Only the values that changed are appended to the log, so there is no need to erase the old ones first
+    writeFlash(FLASH_CONTENTS_VERSION_INDEX, FLASH_CONTENTS_VERSION);
 
     // Write that the data is valid
     writeFlash(VALID_FLASH_CONTENTS, true);
@@ -216,31 +381,26 @@ void saveParameters() {
         writeFlash(CURRENT_INDEX_2, motor.getRMSCurrent());
     #endif
 
-    // Motor stepping angle
-    writeFlash(FULL_STEP_ANGLE_INDEX, motor.getFullStepAngle());
-
-    // Microstepping divisor
-    writeFlash(MICROSTEPPING_INDEX, motor.getMicrostepping());
-
-    // Motor Direction Reversed
-    writeFlash(MOTOR_REVERSED_INDEX, motor.getReversed());
-
-    // Motor Enable Inverted
-    writeFlash(ENABLE_INVERSION_INDEX, motor.getEnableInversion());
+    // The settings of the parameter registry (the stepping, the PID gains, and the soft limits)
+    saveRegisteredParameters();
 
-    // Microstep multiplier
-    writeFlash(MICROSTEP_MULTIPLIER_INDEX, motor.getMicrostepMultiplier());
+    // Current boost table, each point is packed into a parameter
+    #ifdef ENABLE_SPEED_CURRENT_BOOST
+    for (uint8_t index = 0; index < CURRENT_BOOST_POINTS; index++) {
+        currentBoostPoint point = motor.getCurrentBoostPoint(index);
+        writeFlash(CURRENT_BOOST_START_INDEX + index, (uint32_t)(point.rpm | ((uint32_t)point.percent << 16)));
+    }
+    #endif
 
-    // Write the PID values if specified
+    // Gain schedule, each point is packed into 2 parameters
     #ifdef ENABLE_PID
-        // P term of PID
-        writeFlash(P_TERM_INDEX, (float)pid.getP());
-
-        // I term of PID
-        writeFlash(I_TERM_INDEX, (float)pid.getI());
-
-        // D term of PID
-        writeFlash(D_TERM_INDEX, (float)pid.getD());
+        #ifdef ENABLE_GAIN_SCHEDULING
+        for (uint8_t index = 0; index < GAIN_SCHEDULE_POINTS; index++) {
+            gainSchedulePoint point = pid.getSchedulePoint(index);
+            writeFlash(GAIN_SCHEDULE_START_INDEX + (2 * index),     (uint32_t)(point.rpm | ((uint32_t)point.pScale << 16)));
+            writeFlash(GAIN_SCHEDULE_START_INDEX + (2 * index) + 1, (uint32_t)(point.iScale | ((uint32_t)point.dScale << 16)));
+        }
+        #endif
     #endif
 
     // CAN ID of the motor controller
@@ -252,6 +412,28 @@ void saveParameters() {
 
     // If the dip switches were installed incorrectly
     writeFlash(INVERTED_DIPS_INDEX, getDipInverted());
+
+    // Baud rate of the serial bus
+    #ifdef ENABLE_SERIAL
+        writeFlash(SERIAL_BAUD_INDEX, getSerialBaud());
+    #endif
+
+    // Boot without the splash screens
+    writeFlash(FAST_BOOT_INDEX, getFastBoot());
+
+    // Closed loop control mode
+    #ifdef ENABLE_CONTROL_MODES
+        writeFlash(CONTROL_MODE_INDEX, (uint16_t)getCorrectionMode());
+    #endif
+
+    // Electronic gearing (the master, the numerator, and the offset are signed)
+    #ifdef ENABLE_CAN_GEARING
+        writeFlash(GEAR_MASTER_INDEX, (uint32_t)getGearMaster());
+        writeFlash(GEAR_NUMERATOR_INDEX, (uint32_t)getGearNumerator());
+        writeFlash(GEAR_DENOMINATOR_INDEX, (uint32_t)getGearDenominator());
+        writeFlash(GEAR_OFFSET_INDEX, (uint32_t)getGearOffset());
+        writeFlash(GEAR_BROADCAST_INDEX, getGearBroadcast());
+    #endif
 }
 
 
@@ -264,37 +446,15 @@ bool isCalibrated() {
 
 
 // Reads the version number from flash
-// Returns true if the version matches, false if it doesn't
+// Returns true if the version (and layout) matches, false if it doesn't
 bool checkVersionMatch() {
 
     // If the flash version should be ignored
     #ifndef IGNORE_FLASH_VERSION
-
-    // Read the major version number
-    if (readFlashU16(FLASH_CONTENTS_MAJOR_VERSION_INDEX) != MAJOR_VERSION) {
-
-        // Major version doesn't match
-        return false;
-    }
-
-    // Read the minor version number
-    if (readFlashU16(FLASH_CONTENTS_MINOR_VERSION_INDEX) != MINOR_VERSION) {
-
-        // Minor version doesn't match
-        return false;
-    }
-
-    // Read the patch version number
-    if (readFlashU16(FLASH_CONTENTS_PATCH_VERSION_INDEX) != PATCH_VERSION) {
-
-        // Patch version doesn't match
-        return false;
-    }
-
+        return (readFlashU32(FLASH_CONTENTS_VERSION_INDEX) == FLASH_CONTENTS_VERSION);
+    #else
+        return true;
     #endif // ! IGNORE_FLASH_VERSION
-
-    // If we made it this far, return true
-    return true;
 }
 
 
@@ -304,6 +464,45 @@ String loadParameters() {
     // Create a storage for the output message
     String outputMessage;
 
+    // Load the calibration, it is saved on its own (the rest of the parameters may never have been saved)
+    if (isCalibrated()) {
+
+        // Load the calibration offset
+        motor.encoder.setStepOffset(readFlashFloat(STEP_OFFSET_INDEX));
+
+        // Load the drift of the offset with temperature (none until a second calibration finds it)
+        #ifdef ENABLE_ENCODER_TEMP_COMP
+            float tempSlope = readFlashFloat(STEP_OFFSET_SLOPE_INDEX);
+            motor.encoder.setTempCompensation((int16_t)readFlashU32(STEP_OFFSET_TEMP_INDEX), (isnan(tempSlope) ? 0 : tempSlope));
+        #endif
+
+        // Load the shape of the waveform (a sine until a calibration fits one)
+        #ifdef ENABLE_WAVEFORM_SHAPING
+            float thirdHarmonic = readFlashFloat(WAVEFORM_THIRD_INDEX);
+            float coilBalance = readFlashFloat(WAVEFORM_BALANCE_INDEX);
+            motor.setWaveformShape((isnan(thirdHarmonic) ? 0 : thirdHarmonic), (isnan(coilBalance) ? 0 : coilBalance));
+        #endif
+
+        // Load the encoder linearization table if one was calibrated
+        #ifdef ENABLE_ENCODER_LINEARIZATION
+            const int16_t *linearizationTable = readLinearizationTable();
+            if (linearizationTable != NULL) {
+                motor.encoder.setLinearizationTable(linearizationTable);
+            }
+        #endif
+    }
+
+    // Load the detent table if one was learned, it is saved on its own like the calibration
+    #ifdef ENABLE_DETENT_COMPENSATION
+    if (readFlashBool(DETENT_LEARNED_INDEX) && checkVersionMatch()) {
+        for (uint8_t index = 0; index < (DETENT_TABLE_SIZE / 2); index++) {
+            uint32_t offsets = readFlashU32(DETENT_TABLE_START_INDEX + index);
+            motor.setDetentOffset(2 * index, (int16_t)offsets);
+            motor.setDetentOffset((2 * index) + 1, (int16_t)(offsets >> 16));
+        }
+    }
+    #endif
+
     // Check to see if the data is valid
     if (readFlashBool(VALID_FLASH_CONTENTS)) {
 
@@ -312,9 +511,6 @@ String loadParameters() {
             return FLASH_LOAD_INVALID_VERSION;
         }
 
-        // Load the calibration offset
-        motor.encoder.setStepOffset(readFlashFloat(STEP_OFFSET_INDEX));
-
         // Set the motor current
         #ifdef ENABLE_DYNAMIC_CURRENT
             motor.setDynamicAccelCurrent(readFlashU16(DYNAMIC_ACCEL_CURRENT_INDEX));
@@ -325,31 +521,26 @@ String loadParameters() {
             motor.setRMSCurrent(readFlashU16(CURRENT_INDEX_1));
         #endif
 
-        // Motor stepping angle
-        motor.setFullStepAngle(readFlashFloat(FULL_STEP_ANGLE_INDEX));
-
-        // Microstepping divisor
-        motor.setMicrostepping(readFlashU16(MICROSTEPPING_INDEX));
-
-        // Motor Direction Reversed
-        motor.setReversed(readFlashBool(MOTOR_REVERSED_INDEX));
+        // The settings of the parameter registry, set together as one batch
+        loadRegisteredParameters();
 
-        // Motor Enable Inverted
-        motor.setEnableInversion(readFlashBool(ENABLE_INVERSION_INDEX));
-
-        // Motor microstepping multiplier
-        motor.setMicrostepMultiplier(readFlashFloat(MICROSTEP_MULTIPLIER_INDEX));
+        // Current boost table
+        #ifdef ENABLE_SPEED_CURRENT_BOOST
+        for (uint8_t index = 0; index < CURRENT_BOOST_POINTS; index++) {
+            uint32_t speedAndBoost = readFlashU32(CURRENT_BOOST_START_INDEX + index);
+            motor.setCurrentBoostPoint(index, { (uint16_t)speedAndBoost, (uint16_t)(speedAndBoost >> 16) });
+        }
+        #endif
 
-        // Only load PID values if PID is enabled
+        // Gain schedule, each point is packed into 2 parameters
         #ifdef ENABLE_PID
-            // P term of PID
-            pid.setP(readFlashFloat(P_TERM_INDEX));
-
-            // I term of PID
-            pid.setI(readFlashFloat(I_TERM_INDEX));
-
-            // D term of PID
-            pid.setD(readFlashFloat(D_TERM_INDEX));
+            #ifdef ENABLE_GAIN_SCHEDULING
+            for (uint8_t index = 0; index < GAIN_SCHEDULE_POINTS; index++) {
+                uint32_t speedAndP = readFlashU32(GAIN_SCHEDULE_START_INDEX + (2 * index));
+                uint32_t iAndD = readFlashU32(GAIN_SCHEDULE_START_INDEX + (2 * index) + 1);
+                pid.setSchedulePoint(index, { (uint16_t)speedAndP, (uint16_t)(speedAndP >> 16), (uint16_t)iAndD, (uint16_t)(iAndD >> 16) });
+            }
+            #endif
         #endif
 
         // The CAN ID of the motor
@@ -360,6 +551,27 @@ String loadParameters() {
         // If the dip switches were installed incorrectly
         setDipInverted(readFlashBool(INVERTED_DIPS_INDEX));
 
+        // Baud rate of the serial bus (the host has to switch to it as well)
+        #ifdef ENABLE_SERIAL
+            setSerialBaud(readFlashU32(SERIAL_BAUD_INDEX));
+        #endif
+
+        // Boot without the splash screens
+        setFastBoot(readFlashBool(FAST_BOOT_INDEX));
+
+        // Closed loop control mode (the DIP switch picks if it runs)
+        #ifdef ENABLE_CONTROL_MODES
+            loadCorrectionMode((CONTROL_MODE)readFlashU16(CONTROL_MODE_INDEX));
+        #endif
+
+        // Electronic gearing (the follower lines up with its master where both axes are once its frames arrive)
+        #ifdef ENABLE_CAN_GEARING
+            setGearRatio((int32_t)readFlashU32(GEAR_NUMERATOR_INDEX), (int32_t)readFlashU32(GEAR_DENOMINATOR_INDEX));
+            setGearOffset((int32_t)readFlashU32(GEAR_OFFSET_INDEX));
+            setGearBroadcast(readFlashBool(GEAR_BROADCAST_INDEX));
+            setGearMaster((AXIS_CAN_ID)(int32_t)readFlashU32(GEAR_MASTER_INDEX));
+        #endif
+
         // If we made it this far, we can set the message to "ok" and move on
         outputMessage = FLASH_LOAD_SUCCESSFUL;
     }
@@ -7,10 +7,26 @@
 #include "timers.h"
 #include "stm32f1xx_hal_flash.h"
 
-// Where the parameters are saved
-// This is 1024 bits behind the end of flash
-// This allows 32 32-bit values to be stored
-#define DATA_START_ADDR      0x0801FC00
+// Where the parameters are saved, as a log of key/value records across two pages
+// Each write appends a record for the key (only if its value changed), so a save doesn't need an erase
+// Once the active page fills, the newest value of each key is copied to the other page and the full one is erased
+#define PARAMETER_PAGE_0_ADDR 0x0801FC00
+#define PARAMETER_PAGE_1_ADDR 0x0801F400
+#define PARAMETER_PAGE_SIZE   1024
+
+// Where the encoder linearization table is saved (the page before the parameters)
+// The first halfword is a marker, the table follows it
+#ifdef ENABLE_ENCODER_LINEARIZATION
+    #define LINEARIZATION_START_ADDR  0x0801F800
+    #define LINEARIZATION_VALID_MARK  0xA55A
+#endif
+
+// Where the position is saved as the power is lost (the page before the parameters' second page)
+// The page is kept erased, so that a save only has to program halfwords
+#ifdef ENABLE_POWER_LOSS_SAVE
+    #define POSITION_SAVE_PAGE_ADDR  0x0801F000
+    #define POSITION_SAVE_PAGE_SIZE  1024
+#endif
 
 // Messages for successful and unsuccessful flash reads
 #define FLASH_LOAD_SUCCESSFUL      F("Flash data loaded")
@@ -23,15 +39,25 @@ typedef enum {
     // Valid flash contents marker (bool)
     VALID_FLASH_CONTENTS = 0,
 
-    // Stores the firmware version that was used
-    FLASH_CONTENTS_MAJOR_VERSION_INDEX,
-    FLASH_CONTENTS_MINOR_VERSION_INDEX,
-    FLASH_CONTENTS_PATCH_VERSION_INDEX,
+    // Stores the firmware version and layout that was used (FLASH_CONTENTS_VERSION)
+    FLASH_CONTENTS_VERSION_INDEX,
 
     // Calibrated marker
     CALIBRATED_INDEX,
     STEP_OFFSET_INDEX,
 
+    // Temperature of the calibration (raw) and the drift of the step offset with temperature (increments per raw unit)
+    #ifdef ENABLE_ENCODER_TEMP_COMP
+    STEP_OFFSET_TEMP_INDEX,
+    STEP_OFFSET_SLOPE_INDEX,
+    #endif
+
+    // Shape of the coil waveform found by the calibration (fractions of the sine)
+    #ifdef ENABLE_WAVEFORM_SHAPING
+    WAVEFORM_THIRD_INDEX,
+    WAVEFORM_BALANCE_INDEX,
+    #endif
+
     // Dynamic current settings
     #ifdef ENABLE_DYNAMIC_CURRENT
     DYNAMIC_ACCEL_CURRENT_INDEX,
@@ -50,6 +76,7 @@ typedef enum {
     MOTOR_REVERSED_INDEX,
     ENABLE_INVERSION_INDEX,
     MICROSTEP_MULTIPLIER_INDEX,
+    STEP_FILTER_INDEX,
 
     // PID values
     P_TERM_INDEX,
@@ -60,14 +87,67 @@ typedef enum {
     CAN_ID_INDEX,
 
     // Inverted dips
-    INVERTED_DIPS_INDEX
+    INVERTED_DIPS_INDEX,
+
+    // Baud rate of the serial bus
+    #ifdef ENABLE_SERIAL
+    SERIAL_BAUD_INDEX,
+    #endif
+
+    // Boot without the splash screens
+    FAST_BOOT_INDEX,
+
+    // Closed loop control mode (CONTROL_MODE)
+    #ifdef ENABLE_CONTROL_MODES
+    CONTROL_MODE_INDEX,
+    #endif
+
+    // Gain schedule (2 parameters per point)
+    #ifdef ENABLE_GAIN_SCHEDULING
+    GAIN_SCHEDULE_START_INDEX,
+    GAIN_SCHEDULE_END_INDEX = (GAIN_SCHEDULE_START_INDEX + (2 * GAIN_SCHEDULE_POINTS) - 1),
+    #endif
+
+    // Current boost table (1 parameter per point)
+    #ifdef ENABLE_SPEED_CURRENT_BOOST
+    CURRENT_BOOST_START_INDEX,
+    CURRENT_BOOST_END_INDEX = (CURRENT_BOOST_START_INDEX + CURRENT_BOOST_POINTS - 1),
+    #endif
+
+    // Detent torque table, saved by the learning pass (2 points per parameter)
+    #ifdef ENABLE_DETENT_COMPENSATION
+    DETENT_LEARNED_INDEX,
+    DETENT_TABLE_START_INDEX,
+    DETENT_TABLE_END_INDEX = (DETENT_TABLE_START_INDEX + (DETENT_TABLE_SIZE / 2) - 1),
+    #endif
+
+    // Soft limits
+    #ifdef ENABLE_SOFT_LIMITS
+    SOFT_LIMITS_ENABLED_INDEX,
+    SOFT_LIMIT_MIN_INDEX,
+    SOFT_LIMIT_MAX_INDEX,
+    MAX_VELOCITY_INDEX,
+    MAX_ACCEL_INDEX,
+    #endif
+
+    // Electronic gearing
+    #ifdef ENABLE_CAN_GEARING
+    GEAR_MASTER_INDEX,
+    GEAR_NUMERATOR_INDEX,
+    GEAR_DENOMINATOR_INDEX,
+    GEAR_OFFSET_INDEX,
+    GEAR_BROADCAST_INDEX,
+    #endif
+
+    // The number of parameters (must be last)
+    // Each index is the key of its records, a page holds (PARAMETER_PAGE_SIZE / 8) - 1 records, so there must be fewer keys than that
+    FLASH_PARAM_COUNT
 
 } FLASH_PARAM_INDEXES;
 
-// The max index of the flash parameters (must be manually updated)
-// Note that the flash CANNOT store more than 32 parameters
-// It would overflow the page the data is stored in
-#define MAX_FLASH_PARAM_INDEX 19
+// Version and layout of the saved parameters, checked with a single comparison when they are loaded
+// The number of parameters changes with the enabled features, so a build with a different layout doesn't read the wrong values
+#define FLASH_CONTENTS_VERSION (((uint32_t)MAJOR_VERSION << 24) | ((uint32_t)MINOR_VERSION << 16) | ((uint32_t)PATCH_VERSION << 8) | (uint32_t)FLASH_PARAM_COUNT)
 
 // Functions
 bool isCalibrated();
@@ -80,7 +160,8 @@ bool     readFlashBool(uint32_t parameterIndex);
 float    readFlashFloat(uint32_t parameterIndex);
 
 // Writing to flash
-void writeToAddress(uint32_t address, uint16_t data);
+void writeToFlashAddress(uint32_t address, uint16_t data);
+void eraseFlashPage(uint32_t address);
 void writeFlash(uint32_t parameterIndex, uint16_t data);
 void writeFlash(uint32_t parameterIndex, uint32_t data);
 void writeFlash(uint32_t parameterIndex, bool data);
@@ -89,6 +170,12 @@ void writeFlash(uint32_t parameterIndex, float data);
 // Erase all of the parameters in flash
 void eraseParameters();
 
+// Encoder linearization table storage
+#ifdef ENABLE_ENCODER_LINEARIZATION
+void writeLinearizationTable(const int16_t *table);
+const int16_t* readLinearizationTable();
+#endif
+
 // Load/saving values to flash
 void saveParameters();
 bool checkVersionMatch();
@@ -3,10 +3,137 @@
 // These imports must be here to prevent linking circles
 #include "oled.h"
 #include "flash.h"
+#include "profiler.h"
+#include "timers.h"
+#include "vectorTable.h"
+#include "fixedFormat.h"
+#include "clock.h"
 
 // Optimize for speed
 #pragma GCC optimize ("-Ofast")
 
+// Direct coil outputs
+#ifdef ENABLE_DIRECT_COIL_OUTPUT
+
+// All four direction pins are set with a single write, so they must be on the same port
+static_assert((STM_PORT(COIL_A_DIR_1_PIN) == STM_PORT(COIL_A_DIR_2_PIN)) && (STM_PORT(COIL_A_DIR_1_PIN) == STM_PORT(COIL_B_DIR_1_PIN)) && (STM_PORT(COIL_A_DIR_1_PIN) == STM_PORT(COIL_B_DIR_2_PIN)),
+              "The coil direction pins must all be on the same port");
+
+// Builds the BSRR value for a direction pin (set bits are in the lower half, reset bits are in the upper half)
+#define DIR_PIN_BSRR(pin, state) ((state) ? (uint32_t)STM_GPIO_PIN(pin) : ((uint32_t)STM_GPIO_PIN(pin) << 16))
+#define COIL_BSRR(pin1, pin2, state1, state2) (DIR_PIN_BSRR(pin1, state1) | DIR_PIN_BSRR(pin2, state2))
+
+// BSRR values for the direction pins of each coil, indexed by COIL_STATE
+static const uint32_t coilABSRR[] = {
+    0,                                                         // COIL_NOT_SET
+    COIL_BSRR(COIL_A_DIR_1_PIN, COIL_A_DIR_2_PIN, HIGH, LOW),  // FORWARD
+    COIL_BSRR(COIL_A_DIR_1_PIN, COIL_A_DIR_2_PIN, LOW,  HIGH), // BACKWARD
+    COIL_BSRR(COIL_A_DIR_1_PIN, COIL_A_DIR_2_PIN, HIGH, HIGH), // BRAKE
+    COIL_BSRR(COIL_A_DIR_1_PIN, COIL_A_DIR_2_PIN, LOW,  LOW)   // COAST
+};
+static const uint32_t coilBBSRR[] = {
+    0,                                                         // COIL_NOT_SET
+    COIL_BSRR(COIL_B_DIR_1_PIN, COIL_B_DIR_2_PIN, HIGH, LOW),  // FORWARD
+    COIL_BSRR(COIL_B_DIR_1_PIN, COIL_B_DIR_2_PIN, LOW,  HIGH), // BACKWARD
+    COIL_BSRR(COIL_B_DIR_1_PIN, COIL_B_DIR_2_PIN, HIGH, HIGH), // BRAKE
+    COIL_BSRR(COIL_B_DIR_1_PIN, COIL_B_DIR_2_PIN, LOW,  LOW)   // COAST
+};
+
+// Coil outputs latched at TIM3's update event
+// The compare registers are preloaded, so a new current takes effect at the start of the next PWM period
+// A coil that changes direction is turned off for the rest of the period, then the update interrupt switches its pins and loads its current for the period after
+#ifdef ENABLE_PWM_SYNC_OUTPUT
+
+// Coils that are waiting for the update event, and the direction pins and compare values to apply then (written with the interrupts masked)
+static volatile uint8_t pendingCoils = 0;
+static volatile uint32_t pendingCoilBSRR[2] = { 0, 0 };
+static volatile uint32_t pendingCoilCompare[2] = { 0, 0 };
+
+// The registers that the update interrupt writes
+static TIM_TypeDef *syncTimer;
+static GPIO_TypeDef *syncDirectionPort;
+static __IO uint32_t *syncCCR[2];
+
+
+// Latches the state and compare value of a coil (0 is A, 1 is B) for the next PWM period
+static void RAMFUNC latchCoilOutput(uint8_t coil, COIL_STATE &previousState, COIL_STATE state, uint32_t compare, const uint32_t table[]) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (state != previousState) {
+
+        // Off until the update event, then the pins switch and the current is loaded for the period after
+        // (the flag is cleared first, so an update from an earlier period can't switch the pins while the old current is still flowing)
+        *syncCCR[coil] = 0;
+        pendingCoilBSRR[coil] = table[state];
+        pendingCoilCompare[coil] = compare;
+        pendingCoils |= (1 << coil);
+        previousState = state;
+        if (!(syncTimer -> DIER & TIM_DIER_UIE)) {
+            syncTimer -> SR = ~TIM_SR_UIF;
+            syncTimer -> DIER |= TIM_DIER_UIE;
+        }
+    }
+    else if (pendingCoils & (1 << coil)) {
+
+        // Still waiting for the pins to switch, the current is loaded with them
+        pendingCoilCompare[coil] = compare;
+    }
+    else {
+        // Taken in by the preload at the next update event
+        *syncCCR[coil] = compare;
+    }
+    __set_PRIMASK(primask);
+}
+
+
+// Switches the direction pins of the coils that changed, then loads their currents for the next period
+// The update event just latched their compare values of 0, so the pins switch with the coils off
+static void RAMFUNC pwmUpdateHandler() {
+    uint8_t coils = pendingCoils;
+    uint32_t directionBSRR = 0;
+    for (uint8_t coil = 0; coil < 2; coil++) {
+        if (coils & (1 << coil)) {
+            directionBSRR |= pendingCoilBSRR[coil];
+        }
+    }
+    syncDirectionPort -> BSRR = directionBSRR;
+    for (uint8_t coil = 0; coil < 2; coil++) {
+        if (coils & (1 << coil)) {
+            *syncCCR[coil] = pendingCoilCompare[coil];
+        }
+    }
+
+    // Nothing else to do until the next direction change
+    pendingCoils = 0;
+    syncTimer -> DIER &= ~TIM_DIER_UIE;
+}
+
+
+// TIM3's interrupt, straight from the SRAM vector table (the HardwareTimer dispatch runs from flash)
+#ifdef ENABLE_MOTION_SAFE_FLASH
+static void RAMFUNC pwmUpdateIRQHandler() {
+    if ((syncTimer -> SR & TIM_SR_UIF) && (syncTimer -> DIER & TIM_DIER_UIE)) {
+        syncTimer -> SR = ~TIM_SR_UIF;
+        pwmUpdateHandler();
+    }
+}
+#endif
+#endif // ! ENABLE_PWM_SYNC_OUTPUT
+
+#endif // ! ENABLE_DIRECT_COIL_OUTPUT
+
+// Inner commutation, the motor that TIM3's update interrupt commutates
+#ifdef ENABLE_FAST_COMMUTATION
+static_assert((FAST_COMMUTATION_FREQ > CONTROL_LOOP_FREQ) && (FAST_COMMUTATION_FREQ <= MOTOR_PWM_FREQ), "FAST_COMMUTATION_FREQ must be faster than CONTROL_LOOP_FREQ and at most MOTOR_PWM_FREQ");
+static StepperMotor *fastCommutationMotor;
+
+
+// TIM3's update interrupt, the motor only commutates on every Nth one
+static void fastCommutationHandler() {
+    fastCommutationMotor -> fastCommutate();
+}
+#endif // ! ENABLE_FAST_COMMUTATION
+
 // Main constructor
 StepperMotor::StepperMotor() {
 
@@ -15,6 +142,9 @@ StepperMotor::StepperMotor() {
     pinMode(DIRECTION_PIN, INPUT);
     pinMode(ENABLE_PIN, INPUT);
 
+    // Save the port of the direction pin, so that the step interrupt doesn't have to look it up
+    this -> directionPinPort = get_GPIO_Port(STM_PORT(DIRECTION_PIN));
+
     // Setup TIM2 (the base)
     tim2Config.Instance = TIM2;
     tim2Config.Init.Prescaler = 0;
@@ -25,7 +155,7 @@ StepperMotor::StepperMotor() {
     HAL_TIM_Base_Init(&tim2Config);
 
     // Set that the step pin should be an external trigger for the timer to count
-    tim2ClkConfig.ClockFilter = 7;
+    tim2ClkConfig.ClockFilter = (this -> stepFilter);
     tim2ClkConfig.ClockPolarity = TIM_CLOCKPOLARITY_INVERTED;
     tim2ClkConfig.ClockPrescaler = TIM_CLOCKPRESCALER_DIV1;
     tim2ClkConfig.ClockSource = TIM_CLOCKSOURCE_ETRMODE2;
@@ -49,9 +179,14 @@ StepperMotor::StepperMotor() {
 
     // Attach the overflow interrupt (has to use HardwareTimer
     // because HardwareTimer library holds all callbacks)
-    tim2HWTim -> setInterruptPriority(5, 0);
+    tim2HWTim -> setInterruptPriority(STEP_OVERFLOW_IRQ_PRIO, 0);
     tim2HWTim -> attachInterrupt(overflowHandler);
 
+    // Take the overflow from SRAM, so that it keeps running while the flash is busy
+    #ifdef ENABLE_MOTION_SAFE_FLASH
+        setRAMVector(TIM2_IRQn, stepOverflowIRQHandler);
+    #endif
+
     // Setup the pins as outputs
     pinMode(COIL_A_POWER_OUTPUT_PIN, OUTPUT);
     pinMode(COIL_B_POWER_OUTPUT_PIN, OUTPUT);
@@ -66,6 +201,63 @@ StepperMotor::StepperMotor() {
     this -> PWMCurrentPinInfoA = analogSetup(COIL_A_POWER_OUTPUT_PIN, MOTOR_PWM_FREQ, 0);
     this -> PWMCurrentPinInfoB = analogSetup(COIL_B_POWER_OUTPUT_PIN, MOTOR_PWM_FREQ, 0);
 
+    // Save the port of the direction pins for direct writes
+    #ifdef ENABLE_DIRECT_COIL_OUTPUT
+        this -> coilDirectionPort = get_GPIO_Port(STM_PORT(COIL_A_DIR_1_PIN));
+    #endif
+
+    // Latch the coil outputs at TIM3's update event (the compare and period preloads), with the update interrupt switching the direction pins
+    #ifdef ENABLE_PWM_SYNC_OUTPUT
+        syncTimer = (this -> PWMCurrentPinInfoA.instance);
+        syncDirectionPort = (this -> coilDirectionPort);
+        syncCCR[0] = (this -> PWMCurrentPinInfoA.CCR);
+        syncCCR[1] = (this -> PWMCurrentPinInfoB.CCR);
+        syncTimer -> CCMR1 |= (TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE);
+        syncTimer -> CCMR2 |= (TIM_CCMR2_OC3PE | TIM_CCMR2_OC4PE);
+        syncTimer -> CR1 |= TIM_CR1_ARPE;
+
+        // The interrupt is only enabled while a direction change is waiting
+        this -> PWMCurrentPinInfoA.HTPointer -> setInterruptPriority(PWM_UPDATE_IRQ_PRIO, 0);
+        this -> PWMCurrentPinInfoA.HTPointer -> attachInterrupt(pwmUpdateHandler);
+        syncTimer -> DIER &= ~TIM_DIER_UIE;
+        #ifdef ENABLE_MOTION_SAFE_FLASH
+            setRAMVector(TIM3_IRQn, pwmUpdateIRQHandler);
+        #endif
+    #endif
+
+    // Buffer the period of the PWM, so a change of mode can't cut a period short, then start in the smooth mode
+    #ifdef ENABLE_ADAPTIVE_PWM
+        this -> PWMCurrentPinInfoA.instance -> CR1 |= TIM_CR1_ARPE;
+        updatePWMFreq();
+    #endif
+
+    // Run the inner commutation from TIM3's update interrupt (on all of the time, it only drives the coils while the correction is setting them)
+    #ifdef ENABLE_FAST_COMMUTATION
+        fastCommutationMotor = this;
+        updateFastCommutationRate();
+        this -> PWMCurrentPinInfoA.HTPointer -> setInterruptPriority(FAST_COMMUTATION_IRQ_PRIO, 0);
+        this -> PWMCurrentPinInfoA.HTPointer -> attachInterrupt(fastCommutationHandler);
+    #endif
+
+    // Compute the coil drive table for the starting current
+    #ifdef ENABLE_COIL_LUT
+        buildCoilTable();
+    #endif
+
+    // Load the default current boost table
+    #ifdef ENABLE_SPEED_CURRENT_BOOST
+        const uint16_t defaultBoostSpeeds[CURRENT_BOOST_POINTS] = DEFAULT_CURRENT_BOOST_RPM;
+        const uint16_t defaultBoosts[CURRENT_BOOST_POINTS] = DEFAULT_CURRENT_BOOST;
+        for (uint8_t index = 0; index < CURRENT_BOOST_POINTS; index++) {
+            setCurrentBoostPoint(index, { defaultBoostSpeeds[index], defaultBoosts[index] });
+        }
+    #endif
+
+    // Compute the phase moved by each step (already constants when fixed)
+    #ifndef ENABLE_FIXED_MOTOR_CONFIG
+        updateStepPhases();
+    #endif
+
     // Disable the motor
     setState(DISABLED, true);
 }
@@ -90,11 +282,12 @@ float StepperMotor::getEstimRPM() {
 #ifdef ENABLE_STEPPING_VELOCITY
 // Compute the stepping interface velocity in deg/s
 float StepperMotor::getDegreesPS() {
-    calc:
-    while (isStepping)
-    float velocity = 1000000.0 * angleChange / (nowStepingSampleTime - prevStepingSampleTime);
-    if (isStepping)
-        goto calc;
+
+    // Compute it again if a step changed the values part way through
+    float velocity;
+    do {
+        velocity = 1000000.0 * angleChange / (nowStepingSampleTime - prevStepingSampleTime);
+    } while (isStepping);
     return velocity;
 }
 
@@ -108,13 +301,17 @@ float  StepperMotor::getSteppingRPM() {
 
 // Returns the angular deviation of the motor from the desired angle
 float StepperMotor::getAngleError() {
-    return (encoder.getAbsoluteAngleAvg() - (this -> desiredAngle));
+    return (encoder.getAbsoluteAngleAvg() - getDesiredAngle());
 }
 
 
 // Returns the step deviation of the motor from the desired step
 int32_t StepperMotor::getStepError() {
-    return (round(encoder.getAbsoluteAngleAvg() / (this -> microstepAngle)) - getHardStepCNT());
+
+    // Convert the encoder counts to microsteps (counts * microsteps per rotation / counts per rotation), rounding to the nearest step
+    // Done with integer math, as there is no FPU
+    int64_t scaledCounts = (int64_t)encoder.getAbsoluteCountsAvg() * (this -> microstepsPerRotation);
+    return ((int32_t)((scaledCounts + (ENCODER_COUNTS_PER_REV / 2)) >> ENCODER_COUNTS_POWER) - getHardStepCNT());
 }
 
 
@@ -124,9 +321,24 @@ int32_t StepperMotor::getStepPhase() {
 }
 
 
+// Returns the electrical phase of the coils
+uint32_t StepperMotor::getCoilPhase() const {
+    return (this -> coilPhase);
+}
+
+
 // Returns the desired angle of the motor
+// Computed from the desired step (and leftover fraction), so it never drifts
 float StepperMotor::getDesiredAngle() {
-    return (this -> desiredAngle);
+    return ((this -> softStepCNT) + (float)(this -> stepFraction) / (1UL << MULTIPLIER_Q_POWER)) * (this -> microstepAngle);
+}
+
+
+// Returns the desired position of the motor in encoder counts (2^15 per revolution)
+// The fraction of a microstep is included so fractional multipliers stay smooth
+int32_t StepperMotor::getDesiredCounts() {
+    int64_t desiredCounts = ((((int64_t)(this -> softStepCNT) << MULTIPLIER_Q_POWER) + (this -> stepFraction)) << ENCODER_COUNTS_POWER) / (this -> microstepsPerRotation);
+    return (int32_t)(desiredCounts >> MULTIPLIER_Q_POWER);
 }
 
 
@@ -143,39 +355,67 @@ void StepperMotor::setSoftStepCNT(int32_t newStepCNT) {
 
 
 // Returns the count value of the timer-based step counter
-int32_t StepperMotor::getHardStepCNT() const {
-    return ((TIM2 -> CNT) + stepOverflowOffset);
+// Lock-free, the offset and counter are re-read if the overflow handler ran (or an overflow happened) part way through
+// An overflow that hasn't been handled yet (update flag still set) is accounted for here, so the result is never off by 65536
+int32_t RAMFUNC StepperMotor::getHardStepCNT() const {
+
+    int32_t offset;
+    uint16_t count;
+    uint32_t sequence;
+    uint32_t pendingOverflow;
+    do {
+        // Sample the sequence and update flag on both sides of the counter read
+        sequence = stepOverflowSequence;
+        offset = stepOverflowOffset;
+        pendingOverflow = (TIM2 -> SR & TIM_SR_UIF);
+        count = TIM2 -> CNT;
+
+        // Account for the overflow that hasn't been handled yet
+        if (pendingOverflow) {
+            offset += overflowDirection(count);
+        }
+    } while ((sequence != stepOverflowSequence) || (pendingOverflow != (TIM2 -> SR & TIM_SR_UIF)));
+
+    // Combine the halves
+    return (offset + count);
 }
 
 
 // Sets the count value of the timer-based step counter
 void StepperMotor::setHardStepCNT(int32_t newCNT) {
 
-    // Find the remainder for the counter to use
-    uint32_t newClockCNT = (newCNT % 65536);
-
-    // Set the new overflow count
-    stepOverflowOffset = (newCNT - newClockCNT);
+    // Split the count into the counter and its overflow offset (masked, so negative counts are split correctly too)
+    int32_t newOffset;
+    uint16_t newClockCNT = splitHardStepCount(newCNT, newOffset);
 
-    // Set the counter
-    __HAL_TIM_SET_COUNTER(&tim2Config, (uint16_t)newClockCNT);
+    // Set the new overflow count and counter, then tell readers that the offset changed
+    stepOverflowOffset = newOffset;
+    __HAL_TIM_SET_COUNTER(&tim2Config, newClockCNT);
+    stepOverflowSequence++;
 }
 
 
 // Fixes the step overflow count
-void overflowHandler() {
+void RAMFUNC overflowHandler() {
+    PROFILE_SCOPE(PROFILE_STEP_OVERFLOW);
 
-    // Check which direction the overflow was in
-    if (TIM2 -> CNT < (TIM_MAX_VALUE / 2)) {
+    // Move the offset by a full counter period in the direction of the overflow
+    motor.stepOverflowOffset += overflowDirection(TIM2 -> CNT);
 
-        // Overflow
-        motor.stepOverflowOffset += 65536;
-    }
-    else {
-        // Underflow
-        motor.stepOverflowOffset -= 65536;
+    // Tell any readers that were interrupted to read again
+    motor.stepOverflowSequence++;
+}
+
+
+// TIM2's interrupt, straight from the SRAM vector table (the HardwareTimer dispatch runs from flash)
+#ifdef ENABLE_MOTION_SAFE_FLASH
+void RAMFUNC stepOverflowIRQHandler() {
+    if ((TIM2 -> SR & TIM_SR_UIF) && (TIM2 -> DIER & TIM_DIER_UIE)) {
+        TIM2 -> SR = ~TIM_SR_UIF;
+        overflowHandler();
     }
 }
+#endif
 
 
 #ifdef ENABLE_DYNAMIC_CURRENT
@@ -222,6 +462,21 @@ void StepperMotor::setDynamicMaxCurrent(uint16_t newMaxCurrent) {
     }
 }
 
+
+// Computes the dynamic current setpoint from the acceleration of the motor (called every correction, outside of the step interrupt)
+void StepperMotor::updateDynamicCurrent() {
+
+    // Get the current acceleration (or the commanded one, if it is larger, so that the current is there before the rotor falls behind)
+    double angAccel = abs(encoder.getAccel());
+    #ifdef ENABLE_STEP_FEED_FORWARD
+        angAccel = max(angAccel, (double)abs(this -> feedAccel) * (this -> microstepAngle));
+    #endif
+
+    // Compute the peak coil current, keeping it under the max current
+    double current = ((angAccel * (this -> dynamicAccelCurrent)) + (this -> dynamicIdleCurrent)) * 1.414;
+    this -> dynamicCurrent = min(current, (this -> dynamicMaxCurrent) * 1.414);
+}
+
 #else // ! ENABLE_DYNAMIC_CURRENT
 
 // Gets the RMS current of the motor (in mA)
@@ -247,6 +502,11 @@ void StepperMotor::setRMSCurrent(uint16_t rmsCurrent) {
 
         // Also set the peak current
         this -> peakCurrent = constrain((uint16_t)(rmsCurrent * 1.414), 0, MAX_PEAK_BOARD_CURRENT);
+
+        // The coil drive table depends on the current
+        #ifdef ENABLE_COIL_LUT
+            buildCoilTable();
+        #endif
     }
 }
 
@@ -262,10 +522,189 @@ void StepperMotor::setPeakCurrent(uint16_t peakCurrent) {
 
         // Also set the RMS current
         this -> rmsCurrent = constrain((uint16_t)(peakCurrent * 0.707), 0, MAX_RMS_BOARD_CURRENT);
+
+        // The coil drive table depends on the current
+        #ifdef ENABLE_COIL_LUT
+            buildCoilTable();
+        #endif
     }
 }
 #endif // ! ENABLE_DYNAMIC_CURRENT
 
+
+// Idle current reduction
+#ifdef ENABLE_IDLE_CURRENT
+// Lowers the current once the motor has been idle, restoring it when the error grows (called every correction)
+void RAMFUNC StepperMotor::updateIdleCurrent(int32_t stepError) {
+
+    // Any commanded motion, or an error that needs the full torque to correct, restarts the idle timer
+    // The steps themselves already restored the full current, this only catches an error without them
+    if ((this -> softStepCNT) != (this -> lastIdleStep) || abs(stepError) > IDLE_CURRENT_MAX_ERROR) {
+        this -> lastIdleStep = (this -> softStepCNT);
+        this -> idleTicks = 0;
+        if ((this -> currentScale) != CURRENT_SCALE_FULL) {
+
+            // The step pin isn't held off by disableInterrupts(), so every interrupt is masked (a step can't move the phase before the drive)
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            this -> currentScale = CURRENT_SCALE_FULL;
+            driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+            __set_PRIMASK(primask);
+        }
+        return;
+    }
+
+    // Wait until the motor has been still for long enough
+    if ((this -> idleTicks) < (this -> idleCurrentDelayTicks)) {
+        this -> idleTicks++;
+        return;
+    }
+
+    // Ramp toward the holding current, then stop once it is reached
+    uint32_t scale = (this -> currentScale);
+    if (scale <= (this -> idleCurrentScale)) {
+        return;
+    }
+    scale = max(scale - (this -> idleCurrentRampStep), (this -> idleCurrentScale));
+
+    // The coils aren't moving, so they have to be driven again to apply the new current
+    // Every interrupt is masked so that a step can't land between the check and the drive, it is skipped if one already did
+    // (the step restored the full current)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if ((this -> softStepCNT) == (this -> lastIdleStep)) {
+        this -> currentScale = scale;
+        driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+    }
+    __set_PRIMASK(primask);
+}
+
+
+// Restores the full current without driving the coils, and restarts the idle timer (used when the motor is disabled)
+void StepperMotor::resetIdleCurrent() {
+    this -> currentScale = CURRENT_SCALE_FULL;
+    this -> idleTicks = 0;
+    this -> lastIdleStep = (this -> softStepCNT);
+}
+
+
+// Gets the holding current, as a percent of the running current
+uint8_t StepperMotor::getIdleCurrentPercent() const {
+    return (this -> idleCurrentPercent);
+}
+
+
+// Sets the holding current, as a percent of the running current (1 to 100)
+void StepperMotor::setIdleCurrentPercent(uint8_t percent) {
+
+    // Keep some current, otherwise the motor is free to move while it is idle
+    this -> idleCurrentPercent = constrain(percent, 1, 100);
+    this -> idleCurrentScale = (CURRENT_SCALE_FULL * (this -> idleCurrentPercent)) / 100;
+
+    // The ramp keeps the same length for any holding current
+    this -> idleCurrentRampStep = (CURRENT_SCALE_FULL - (this -> idleCurrentScale)) / IDLE_CURRENT_RAMP_TICKS;
+}
+
+
+// Gets the time without motion before the current is lowered (ms)
+uint32_t StepperMotor::getIdleCurrentDelay() const {
+    return ((this -> idleCurrentDelayTicks) * 1000) / CONTROL_LOOP_FREQ;
+}
+
+
+// Sets the time without motion before the current is lowered (ms)
+void StepperMotor::setIdleCurrentDelay(uint32_t delay) {
+    this -> idleCurrentDelayTicks = (delay * CONTROL_LOOP_FREQ) / 1000;
+}
+#endif // ! ENABLE_IDLE_CURRENT
+
+
+// Current on demand
+#ifdef ENABLE_CURRENT_ON_DEMAND
+// Raises the current with the error and its growth, decaying back to the base once it settles (called every correction)
+void RAMFUNC StepperMotor::updateDemandCurrent(int32_t stepError) {
+
+    // Only the size of the error matters, and the growth is only counted while the error is getting worse
+    int32_t error = abs(stepError);
+    int32_t growth = max(error - (this -> lastDemandError), (int32_t)0);
+    this -> lastDemandError = error;
+
+    // Find the current that the error is asking for (the deadband keeps the encoder's noise at the base current)
+    uint32_t target = (this -> demandBaseScale) + (uint32_t)max(error - DEMAND_ERROR_DEADBAND, (int32_t)0) * (this -> demandErrorGain) + (uint32_t)growth * (this -> demandGrowthGain);
+    target = min(target, (uint32_t)CURRENT_SCALE_FULL);
+
+    // Rise right away to catch a sudden load, but decay slowly so that the current doesn't chatter with the error
+    uint32_t scale = (this -> demandScale);
+    if (target > scale) {
+        scale = target;
+    }
+    else if (scale > target) {
+        scale = max((scale > (this -> demandDecayStep) ? scale - (this -> demandDecayStep) : (uint32_t)0), target);
+    }
+    else {
+        return;
+    }
+
+    // The motor might not be moving, so the coils have to be driven again to apply the new current
+    // Every interrupt is masked, as disableInterrupts() doesn't hold off the step pin (a step can't move the phase before the drive)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    this -> demandScale = scale;
+    driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+    __set_PRIMASK(primask);
+}
+
+
+// Gets the base current (% of the set current)
+uint8_t StepperMotor::getDemandBaseCurrent() const {
+    return (this -> demandBasePercent);
+}
+
+
+// Sets the base current (% of the set current, 1 to 100)
+void StepperMotor::setDemandBaseCurrent(uint8_t percent) {
+
+    // Keep some current, otherwise the motor is free to move without any error
+    this -> demandBasePercent = constrain(percent, 1, 100);
+    this -> demandBaseScale = (CURRENT_SCALE_FULL * (this -> demandBasePercent)) / 100;
+
+    // The decay keeps the same length for any base current
+    this -> demandDecayStep = (CURRENT_SCALE_FULL - (this -> demandBaseScale)) / DEMAND_DECAY_TICKS;
+}
+
+
+// Gets the current added per microstep of error (% of the set current)
+uint16_t StepperMotor::getDemandErrorGain() const {
+    return (this -> demandErrorPercent);
+}
+
+
+// Sets the current added per microstep of error (% of the set current)
+void StepperMotor::setDemandErrorGain(uint16_t percent) {
+    this -> demandErrorPercent = percent;
+    this -> demandErrorGain = (CURRENT_SCALE_FULL * percent) / 100;
+}
+
+
+// Gets the current added per microstep that the error grew by (% of the set current)
+uint16_t StepperMotor::getDemandGrowthGain() const {
+    return (this -> demandGrowthPercent);
+}
+
+
+// Sets the current added per microstep that the error grew by (% of the set current)
+void StepperMotor::setDemandGrowthGain(uint16_t percent) {
+    this -> demandGrowthPercent = percent;
+    this -> demandGrowthGain = (CURRENT_SCALE_FULL * percent) / 100;
+}
+
+
+// Gets the current that is being applied (% of the set current)
+uint16_t StepperMotor::getDemandCurrent() const {
+    return (((this -> demandScale) * 100) >> MULTIPLIER_Q_POWER);
+}
+#endif // ! ENABLE_CURRENT_ON_DEMAND
+
 // Get the microstepping divisor of the motor
 uint16_t StepperMotor::getMicrostepping() const {
     return (this -> microstepDivisor);
@@ -275,14 +714,26 @@ uint16_t StepperMotor::getMicrostepping() const {
 // Set the microstepping divisor of the motor
 void StepperMotor::setMicrostepping(uint16_t setMicrostepping) {
 
+    // The settings can't be changed once they're fixed when compiling
+    #ifndef ENABLE_FIXED_MOTOR_CONFIG
+
     // Make sure that the new value isn't a -1 (all functions that fail should return a -1)
-    if (setMicrostepping != -1) {
+    // Nothing needs to be rescaled if the microstepping isn't changing (prevents rounding drift of the counters)
+    if (setMicrostepping != -1 && setMicrostepping != this -> microstepDivisor) {
 
         // Scale the hardware step counter
-        setHardStepCNT(getHardStepCNT() * (setMicrostepping / this -> microstepDivisor));
+        setHardStepCNT(rescaleStepCount(getHardStepCNT(), setMicrostepping, this -> microstepDivisor));
+
+        // The scaled count isn't new pulses, so it shouldn't be followed
+        #ifdef ENABLE_HARDWARE_STEP_COUNTING
+            this -> lastHardStepCNT = getHardStepCNT();
+        #endif
 
         // Scale the software step counter
-        setSoftStepCNT(getSoftStepCNT() * (setMicrostepping / this -> microstepDivisor));
+        setSoftStepCNT(rescaleStepCount(getSoftStepCNT(), setMicrostepping, this -> microstepDivisor));
+
+        // Scale the coil step, so the coils stay at the same electrical phase
+        this -> currentStep = rescaleStepCount(this -> currentStep, setMicrostepping, this -> microstepDivisor);
 
         // Set the microstepping divisor
         this -> microstepDivisor = setMicrostepping;
@@ -292,13 +743,20 @@ void StepperMotor::setMicrostepping(uint16_t setMicrostepping) {
 
         // Fix the microsteps per rotation
         this -> microstepsPerRotation = round(360.0 / microstepAngle);
+
+        // Fix the phase moved by each step
+        updateStepPhases();
     }
+    #endif // ! ENABLE_FIXED_MOTOR_CONFIG
 }
 
 
 // Set the full step angle of the motor (in degrees)
 void StepperMotor::setFullStepAngle(float newStepAngle) {
 
+    // The settings can't be changed once they're fixed when compiling
+    #ifndef ENABLE_FIXED_MOTOR_CONFIG
+
     // Make sure that the new value isn't a -1 (all functions that fail should return a -1)
     if (newStepAngle != -1) {
 
@@ -314,8 +772,12 @@ void StepperMotor::setFullStepAngle(float newStepAngle) {
 
             // Fix the microsteps per rotation
             this -> microstepsPerRotation = round(360.0 / microstepAngle);
+
+            // Fix the electrical phase per encoder count (there are 4 full steps per electrical cycle)
+            this -> countPhaseScale = round(360.0 / (4 * (this -> fullStepAngle))) * (PHASE_PER_CYCLE / ENCODER_COUNTS_PER_REV);
         }
     }
+    #endif // ! ENABLE_FIXED_MOTOR_CONFIG
 }
 
 
@@ -340,17 +802,20 @@ int32_t StepperMotor::getMicrostepsPerRotation() const {
 // Set if the motor direction should be reversed or not
 void StepperMotor::setReversed(bool reversed) {
 
+    // The settings can't be changed once they're fixed when compiling
+    #ifndef ENABLE_FIXED_MOTOR_CONFIG
     if (reversed)
         // Set if the motor should be reversed
         this -> reversed = -1;
     else
         this -> reversed = 1;
+    #endif
 }
 
 
 // Get if the motor direction is reversed
 bool StepperMotor::getReversed() const {
-    return (this -> reversed > 0 ? 1 : 0);
+    return (this -> reversed < 0 ? 1 : 0);
 }
 
 
@@ -370,13 +835,91 @@ bool StepperMotor::getEnableInversion() const {
 }
 
 
+// Sets the digital filter of TIM2's step input
+bool StepperMotor::setStepFilter(uint8_t filter) {
+
+    // Only 4 bits
+    if (filter > 15) {
+        return false;
+    }
+
+    // Write the filter of the external trigger (takes effect right away, the counter keeps running)
+    this -> stepFilter = filter;
+    TIM2 -> SMCR = (TIM2 -> SMCR & ~TIM_SMCR_ETF) | ((uint32_t)filter << TIM_SMCR_ETF_Pos);
+    return true;
+}
+
+
+// Gets the digital filter of TIM2's step input
+uint8_t StepperMotor::getStepFilter() const {
+    return (this -> stepFilter);
+}
+
+
+// Statistics of the step input
+#ifdef ENABLE_STEP_GLITCH_STATS
+// Compares the pulses of the step pin with TIM2's count once the window has passed
+// The running difference is compared, so a pulse that lands between the two reads is only off until the next window
+void StepperMotor::updateStepGlitchStats() {
+
+    // Wait for the end of the window
+    if (++(this -> glitchWindowTicks) < ((uint32_t)STEP_GLITCH_WINDOW * CONTROL_LOOP_FREQ) / 1000) {
+        return;
+    }
+    this -> glitchWindowTicks = 0;
+
+    // Find how far the step pin and TIM2 drifted apart during the window (TIM2 counts with the raw direction pin)
+    int32_t hardCount = getHardStepCNT();
+    int32_t mismatch = ((this -> stepPinCount) * (this -> reversed)) - hardCount;
+    uint32_t windowGlitches = abs(mismatch - (this -> glitchLastMismatch));
+    uint32_t rate = ((uint32_t)abs(hardCount - (this -> glitchLastHardCount)) * 1000) / STEP_GLITCH_WINDOW;
+    this -> glitchLastMismatch = mismatch;
+    this -> glitchLastHardCount = hardCount;
+
+    // Keep track of the rates that are clean and the ones that aren't
+    if (windowGlitches > 0) {
+        this -> glitches += windowGlitches;
+        this -> glitchWindows++;
+        this -> minGlitchRate = min(this -> minGlitchRate, rate);
+    }
+    else {
+        this -> maxCleanRate = max(this -> maxCleanRate, rate);
+    }
+}
+
+
+// Gets a summary of the glitches, and the fastest rate without any
+String StepperMotor::getStepGlitchStats() const {
+    return ("Glitches: " + String(this -> glitches) + F(" (in ") + String(this -> glitchWindows) + F(" windows) | Fastest clean rate: ") +
+            String(this -> maxCleanRate) + F(" steps/s | Slowest glitched rate: ") +
+            ((this -> minGlitchRate == UINT32_MAX) ? String(F("none")) : (String(this -> minGlitchRate) + F(" steps/s"))));
+}
+
+
+// Clears the statistics
+void StepperMotor::resetStepGlitchStats() {
+    this -> glitches = 0;
+    this -> glitchWindows = 0;
+    this -> maxCleanRate = 0;
+    this -> minGlitchRate = UINT32_MAX;
+}
+#endif // ! ENABLE_STEP_GLITCH_STATS
+
+
 // Set the microstep multiplier
 void StepperMotor::setMicrostepMultiplier(float newMultiplier) {
 
-    // Set the object's value if it is valid
-    if (newMultiplier != -1) {
-        (this -> microstepMultiplier) = newMultiplier;
+    // The settings can't be changed once they're fixed when compiling
+    #ifndef ENABLE_FIXED_MOTOR_CONFIG
+
+    // Set the object's value if it is valid (stored in Q16 fixed point, so fractional multipliers work)
+    if (newMultiplier > 0) {
+        (this -> microstepMultiplier) = (uint32_t)(newMultiplier * (1UL << MULTIPLIER_Q_POWER) + 0.5);
+
+        // The phase moved by each step pulse needs recomputed
+        updateStepPhases();
     }
+    #endif // ! ENABLE_FIXED_MOTOR_CONFIG
 }
 
 
@@ -384,22 +927,20 @@ void StepperMotor::setMicrostepMultiplier(float newMultiplier) {
 float StepperMotor::getMicrostepMultiplier() const {
 
     // Return the object's value
-    return (this -> microstepMultiplier);
+    return ((float)(this -> microstepMultiplier) / (1UL << MULTIPLIER_Q_POWER));
 }
 
 
 void StepperMotor::simpleStep() {
 
     // Only moving one step in the specified direction
-    this -> currentStep += DIRECTION(GPIO_READ(DIRECTION_PIN)) * (this -> reversed) * (this -> microstepMultiplier);
-
-    // Drive the coils to their destination
-    this -> driveCoils(this -> currentStep);
+    this -> step(PIN, true, false);
 }
 
 
 // Computes the coil values for the next step position and increments the set angle
-void StepperMotor::step(STEP_DIR dir, bool useMultiplier, bool updateDesiredPos) {
+// Everything is tracked in Q16 fixed point, so fractional multipliers move the exact distance without any float math
+void RAMFUNC StepperMotor::step(STEP_DIR dir, bool useMultiplier, bool updateDesiredPos) {
 
     #ifdef ENABLE_STEPPING_VELOCITY
         isStepping = true;
@@ -407,226 +948,1284 @@ void StepperMotor::step(STEP_DIR dir, bool useMultiplier, bool updateDesiredPos)
         // Sample times
         prevStepingSampleTime = nowStepingSampleTime;
         nowStepingSampleTime = micros();
-
-    #else // ! ENABLE_STEPPING_VELOCITY
-        float angleChange;
     #endif
 
-    // Main angle change (any inversions * angle of microstep)
-    angleChange = this -> microstepAngle;
-    int32_t stepChange = 1;
-
-    // Factor in the multiplier if specified
-    if (useMultiplier) {
-        angleChange *= (this -> microstepMultiplier);
-        stepChange *= (this -> microstepMultiplier);
-    }
-
-    // Invert the change based on the direction
+    // Decide the direction of the step (counter clockwise is positive)
+    bool positive;
     if (dir == PIN) {
 
         // Use the DIR_PIN state
-        angleChange *= DIRECTION(GPIO_READ(DIRECTION_PIN)) * (this -> reversed);
+        positive = ((DIRECTION(LL_GPIO_IsInputPinSet(this -> directionPinPort, STM_LL_GPIO_PIN(DIRECTION_PIN))) * (this -> reversed)) > 0);
+
+        // Count the pulse for the comparison with TIM2
+        #ifdef ENABLE_STEP_GLITCH_STATS
+            this -> stepPinCount += (positive ? 1 : -1);
+        #endif
+
+        // The step input is ignored while a soft limit is faulted
+        #ifdef ENABLE_SOFT_LIMITS
+        if (this -> stepInputBlocked) {
+            return;
+        }
+        #endif
+    }
+    else {
+        positive = (dir == COUNTER_CLOCKWISE);
     }
-    //else if (dir == COUNTER_CLOCKWISE) {
-        // Nothing to do here, the value is already positive
-    //}
-    else if (dir == CLOCKWISE) {
-        // Make the angle change in the negative direction
-        angleChange = -angleChange;
+
+    // Pick the distance of the step (one microstep, or the multiplier's worth of microsteps)
+    int32_t fractionChange;
+    uint32_t phaseChange;
+    if (useMultiplier) {
+        fractionChange = (this -> microstepMultiplier);
+        phaseChange = (this -> multipliedStepPhase);
+    }
+    else {
+        fractionChange = (1 << MULTIPLIER_Q_POWER);
+        phaseChange = (this -> microstepPhase);
     }
 
+    // Add the step to the leftover fraction, the whole microsteps are moved and the rest is kept for the next step
+    // The shift floors, so the fraction always stays positive (even when moving backwards)
+    int32_t totalFraction = (int32_t)(this -> stepFraction) + (positive ? fractionChange : -fractionChange);
+    int32_t stepChange = (totalFraction >> MULTIPLIER_Q_POWER);
+    this -> stepFraction = (totalFraction & ((1 << MULTIPLIER_Q_POWER) - 1));
+
     #ifdef ENABLE_STEPPING_VELOCITY
+        angleChange = stepChange * (this -> microstepAngle);
         isStepping = false;
     #endif
 
-    // Fix the step change's sign
-    stepChange *= getSign(angleChange);
-
-    // Update the desired angle if specified
+    // Update the desired step if specified
     if (updateDesiredPos) {
-
-        // Angles are basically just added to desired, not really much to do here
-        this -> desiredAngle += angleChange;
         this -> softStepCNT += stepChange;
     }
 
-    // Motor's current angle must always be updated to correctly move the coils
-    this -> currentAngle += angleChange;
-    this -> currentStep += stepChange; // Only moving one step in the specified direction
-
-    // Drive the coils to their destination
-    this -> driveCoils(currentStep);
-}
+    // Motor's current step must always be updated to correctly move the coils
+    this -> currentStep += stepChange;
 
+    // Move the electrical phase (wraps around naturally every electrical cycle)
+    if (positive) {
+        this -> coilPhase += phaseChange;
+    }
+    else {
+        this -> coilPhase -= phaseChange;
+    }
 
-// Sets the coils of the motor based on the step count
-void StepperMotor::driveCoils(int32_t steps) {
+    // Any motion needs the full current (restored right away, the correction ramps it down again once idle)
+    #ifdef ENABLE_IDLE_CURRENT
+        this -> currentScale = CURRENT_SCALE_FULL;
+    #endif
 
-    // Correct the steps so that they're within the valid range
-    //steps %= (4 * (this -> microstepDivisor));
+    // Leave the pulses of the step pin to the correction, which spreads them over their interval
+    // Everything else moves the coils right away, ending the interpolation
+    #ifdef ENABLE_STEP_INTERPOLATION
+        if (dir == PIN) {
+            uint32_t stepCycles = getCycleCount();
+            uint32_t interval = stepCycles - (this -> lastInterpStepCycles);
+            this -> lastInterpStepCycles = stepCycles;
+            if (interval < (STEP_INTERP_MAX_INTERVAL * (SystemCoreClock / 1000000))) {
+
+                // Start from the phase that the coils were at if they had caught up
+                if (!(this -> interpolating)) {
+                    this -> drivenPhase = (positive ? (this -> coilPhase) - phaseChange : (this -> coilPhase) + phaseChange);
+                }
+                this -> interpStepPhase = phaseChange;
+                this -> interpStepInterval = interval;
+                this -> interpolating = true;
+                return;
+            }
+        }
+        this -> interpolating = false;
+    #endif
 
-    // Calculate the sine and cosine of the angle
-    uint16_t arrayIndex = steps & (SINE_VAL_COUNT - 1);
+    // Drive the coils to their destination (the field oriented mode commutates from the encoder instead, as does the torque mode while it runs)
+    #ifdef ENABLE_TORQUE_MODE
+        if (!(this -> torqueModeActive)) {
+            this -> driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+        }
+    #elif !defined(ENABLE_FOC)
+        this -> driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+    #endif
+}
 
-    // Calculate the coil settings
-    int16_t coilAPercent = fastSin(arrayIndex);
-    int16_t coilBPercent = fastCos(arrayIndex);
 
-    // Equation comes out to be (effort * -1 to 1) depending on the sine/cosine of the phase angle
-    #ifdef ENABLE_DYNAMIC_CURRENT
+// Moves the coils by a number of microsteps at once, without changing the desired position (counter clockwise is positive)
+// The same as that many calls of step(dir, false, false), but the coils are only driven once
+#if defined(ENABLE_CATCH_UP_CORRECTION) || defined(ENABLE_CONCURRENT_CORRECTION)
+void RAMFUNC StepperMotor::moveCoils(int32_t microsteps) {
 
-        // Get the current acceleration
-        double angAccel = abs(motor.encoder.getAccel());
+    // Move the step and the electrical phase (wraps around naturally every electrical cycle)
+    this -> currentStep += microsteps;
+    this -> coilPhase += (uint32_t)(microsteps * (int32_t)(this -> microstepPhase));
 
-        // Compute the coil power
-        int16_t coilAPower = ((int16_t)(((angAccel * (this -> dynamicAccelCurrent)) + (this -> dynamicIdleCurrent)) * 1.414) * coilAPercent) >> SINE_POWER;
-        int16_t coilBPower = ((int16_t)(((angAccel * (this -> dynamicAccelCurrent)) + (this -> dynamicIdleCurrent)) * 1.414) * coilBPercent) >> SINE_POWER;
-    #else
-        // Just use static current multipiers
-        int16_t coilAPower = ((int16_t)(this -> peakCurrent) * coilAPercent) >> SINE_POWER; // i.e. / SINE_MAX
-        int16_t coilBPower = ((int16_t)(this -> peakCurrent) * coilBPercent) >> SINE_POWER; // i.e. / SINE_MAX
+    // Any motion needs the full current
+    #ifdef ENABLE_IDLE_CURRENT
+        this -> currentScale = CURRENT_SCALE_FULL;
     #endif
 
-    // Check the if the coil should be energized to move backward or forward
-    if (coilAPower > 0) {
+    // Drive the coils to their destination
+    this -> driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+}
+#endif
 
-        // Set first channel for forward movement
-        setCoilA(COIL_STATE::FORWARD, coilAPower);
-    }
-    else if (coilAPower < 0) {
 
-        // Set first channel for backward movement
-        setCoilA(COIL_STATE::BACKWARD, -coilAPower);
-    }
-    else {
-        setCoilA(BRAKE);
-    }
+// Moves the desired position and the coils by a number of microsteps at once (counter clockwise is positive)
+#if defined(ENABLE_CAN_GEARING) || defined(ENABLE_PVT_TRAJECTORY)
+void RAMFUNC StepperMotor::followMicrosteps(int32_t microsteps) {
 
+    // Update the desired and current steps, then move the electrical phase (wraps around naturally every electrical cycle)
+    this -> softStepCNT += microsteps;
+    this -> currentStep += microsteps;
+    this -> coilPhase += (uint32_t)(microsteps * (int32_t)(this -> microstepPhase));
 
-    // Check the if the coil should be energized to move backward or forward
-    if (coilBPower > 0) {
+    // Any motion needs the full current
+    #ifdef ENABLE_IDLE_CURRENT
+        this -> currentScale = CURRENT_SCALE_FULL;
+    #endif
 
-        // Set first channel for forward movement
-        setCoilB(COIL_STATE::FORWARD, coilBPower);
-    }
-    else if (coilBPower < 0) {
+    // Drive the coils to their destination (the field oriented mode commutates from the encoder instead, as does the torque mode while it runs)
+    #ifdef ENABLE_TORQUE_MODE
+        if (!(this -> torqueModeActive)) {
+            this -> driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+        }
+    #elif !defined(ENABLE_FOC)
+        this -> driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+    #endif
+}
+#endif
 
-        // Set first channel for backward movement
-        setCoilB(BACKWARD, -coilBPower);
-    }
-    else {
-        setCoilB(BRAKE);
-    }
+
+// Ignores the step input (the pin and TIM2's count) while a soft limit is faulted
+#ifdef ENABLE_SOFT_LIMITS
+void StepperMotor::setStepInputBlocked(bool blocked) {
+    this -> stepInputBlocked = blocked;
 }
 
 
-// Sets the coils of the motor based on the angle (angle should be in degrees)
-void StepperMotor::driveCoilsAngle(float degAngle) {
+// If the step input is being ignored
+bool StepperMotor::isStepInputBlocked() const {
+    return (this -> stepInputBlocked);
+}
+#endif
 
-    // Should be a faster way of constraining the degAngle back into 0-360
-    if (degAngle < 0) {
-        degAngle += round(abs(degAngle) / 360) * 360;
-    }
-    else if ( degAngle > 360) {
-        degAngle -= round(degAngle / 360) * 360;
-    }
 
-    // Constrain the set angle to between 0 and 360
-    while (degAngle < 0 || degAngle > 360) {
+// Moves the motor by the pulses that TIM2 has counted since the last call (used instead of the step interrupt)
+#ifdef ENABLE_HARDWARE_STEP_COUNTING
+void RAMFUNC StepperMotor::followHardStepCNT() {
 
-        // The angle is less than 0, add 360
-        if (degAngle < 0) {
-            degAngle += 360;
-        }
-        else {
-            // The angle must be greater than 360, reduce the angle by 360
-            degAngle -= 360;
-        }
-    }
+    // Find the pulses since the last update (TIM2 counts with the DIR pin, so only the reversal needs applied)
+    int32_t hardStepCNT = getHardStepCNT();
+    int32_t pulses = (hardStepCNT - (this -> lastHardStepCNT)) * (this -> reversed);
+    this -> lastHardStepCNT = hardStepCNT;
 
-    // Convert the angle to microstep values (formula uses degAngle * full steps for rotation * microsteps)
-    float microstepAngle = (degAngle / this -> fullStepAngle) * (this -> microstepDivisor);
+    // Nothing to do if there weren't any steps
+    if (pulses != 0) {
+        movePulses(pulses);
+    }
+}
+#endif // ! ENABLE_HARDWARE_STEP_COUNTING
 
-    // Round the microstep angle, it has to be a whole value of the number of microsteps available
-    // Also ensures that the coils are being driven to the major step positions (increases torque)
-    uint16_t roundedMicrosteps = round(microstepAngle);
 
-    // Drive the coils to the found microstep
-    driveCoils(roundedMicrosteps);
+// Injects pulses into TIM2's count like the step pin would, moving the coils with them (used by the replay of the step stream)
+// With the hardware step counting, the correction's followHardStepCNT() moves the coils to them instead
+#ifdef ENABLE_STEP_STREAM
+void RAMFUNC StepperMotor::replayStepPulses(int32_t pulses) {
+    setHardStepCNT(getHardStepCNT() + pulses);
+    #ifndef ENABLE_HARDWARE_STEP_COUNTING
+        movePulses(pulses * (this -> reversed));
+    #endif
 }
+#endif
 
 
-// Function for setting the A coil state and current
-void StepperMotor::setCoilA(COIL_STATE desiredState, uint16_t current) {
+// Moves the desired position and the coils by a number of pulses of the step input (the reversal already applied)
+#if defined(ENABLE_HARDWARE_STEP_COUNTING) || defined(ENABLE_STEP_STREAM)
+void RAMFUNC StepperMotor::movePulses(int32_t pulses) {
+
+    // The pulses are dropped while a soft limit is faulted
+    #ifdef ENABLE_SOFT_LIMITS
+    if (this -> stepInputBlocked) {
+        return;
+    }
+    #endif
 
-    // Check if the desired coil state is different from the previous, if so, we need to set the output pins
-    if (desiredState != previousCoilStateA) {
+    // Move by the multiplier's worth of microsteps for every pulse, keeping the leftover fraction like step() does
+    int64_t totalFraction = (int64_t)(this -> stepFraction) + ((int64_t)pulses * (this -> microstepMultiplier));
+    int32_t stepChange = (int32_t)(totalFraction >> MULTIPLIER_Q_POWER);
+    this -> stepFraction = (uint32_t)(totalFraction & ((1 << MULTIPLIER_Q_POWER) - 1));
 
-        // Disable the coil
-        analogSet(&PWMCurrentPinInfoA, 0);
+    // Update the desired and current steps
+    this -> softStepCNT += stepChange;
+    this -> currentStep += stepChange;
 
-        // Decide the state of the direction pins
-        if (desiredState == FORWARD) {
-            GPIO_WRITE(COIL_A_DIR_1_PIN, HIGH);
-            GPIO_WRITE(COIL_A_DIR_2_PIN, LOW);
-        }
-        else if (desiredState == BACKWARD) {
-            GPIO_WRITE(COIL_A_DIR_1_PIN, LOW);
-            GPIO_WRITE(COIL_A_DIR_2_PIN, HIGH);
-        }
-        else if (desiredState == BRAKE) {
-            GPIO_WRITE(COIL_A_DIR_1_PIN, HIGH);
-            GPIO_WRITE(COIL_A_DIR_2_PIN, HIGH);
-        }
-        else if (desiredState == COAST) {
-            GPIO_WRITE(COIL_A_DIR_1_PIN, LOW);
-            GPIO_WRITE(COIL_A_DIR_2_PIN, LOW);
-        }
+    // Move the electrical phase (the multiply wraps the same way as repeated adds)
+    this -> coilPhase += (uint32_t)pulses * (this -> multipliedStepPhase);
 
-        // Update the previous state of the coil with the new one
-        previousCoilStateA = desiredState;
-    }
+    // Any motion needs the full current (restored right away, the correction ramps it down again once idle)
+    #ifdef ENABLE_IDLE_CURRENT
+        this -> currentScale = CURRENT_SCALE_FULL;
+    #endif
 
-    // Update the output pin with the correct current
-    analogSet(&PWMCurrentPinInfoA, currentToPWM(current));
+    // Drive the coils to their destination (the field oriented mode commutates from the encoder instead, as does the torque mode while it runs)
+    #ifdef ENABLE_TORQUE_MODE
+        if (!(this -> torqueModeActive)) {
+            this -> driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+        }
+    #elif !defined(ENABLE_FOC)
+        this -> driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+    #endif
 }
+#endif
 
 
-// Function for setting the B coil state and current
-void StepperMotor::setCoilB(COIL_STATE desiredState, uint16_t current) {
+// Interpolation of the step input
+#ifdef ENABLE_STEP_INTERPOLATION
 
-    // Check if the desired coil state is different from the previous, if so, we need to set the output pins
-    if (desiredState != previousCoilStateB) {
+// Phase of a 1/256 microstep (the grid that the coils are moved on between the pulses)
+#define STEP_INTERP_GRID_PHASE (PHASE_PER_FULL_STEP / 256)
 
-        // Disable the coil
-        analogSet(&PWMCurrentPinInfoB, 0);
+// Moves the coils toward the last step pin pulse by its share of the interval
+// A pulse's phase is spread over the interval before it, the rate that the host is stepping at, so a steady rate gives a steady motion
+void RAMFUNC StepperMotor::updateStepInterpolation() {
 
-        // Decide the state of the direction pins
-        if (desiredState == FORWARD) {
-            GPIO_WRITE(COIL_B_DIR_1_PIN, HIGH);
-            GPIO_WRITE(COIL_B_DIR_2_PIN, LOW);
-        }
-        else if (desiredState == BACKWARD) {
-            GPIO_WRITE(COIL_B_DIR_1_PIN, LOW);
-            GPIO_WRITE(COIL_B_DIR_2_PIN, HIGH);
-        }
-        else if (desiredState == BRAKE) {
-            GPIO_WRITE(COIL_B_DIR_1_PIN, HIGH);
-            GPIO_WRITE(COIL_B_DIR_2_PIN, HIGH);
-        }
-        else if (desiredState == COAST) {
-            GPIO_WRITE(COIL_B_DIR_1_PIN, LOW);
-            GPIO_WRITE(COIL_B_DIR_2_PIN, LOW);
+    // Nothing to do once the coils have caught up (or while the torque mode commutates)
+    if (!(this -> interpolating)) {
+        return;
+    }
+    #ifdef ENABLE_TORQUE_MODE
+        if (this -> torqueModeActive) {
+            return;
         }
+    #endif
+
+    // The step interrupt can move the target at any time, so it is read once
+    uint32_t target = (this -> coilPhase);
+    uint32_t stepPhase = (this -> interpStepPhase);
+    int32_t remaining = (int32_t)(target - (this -> drivenPhase));
+
+    // Keep within a pulse of the target, the pulses are coming in faster than the last one was spread over
+    if (remaining > (int32_t)stepPhase) {
+        remaining = stepPhase;
+    }
+    else if (remaining < -(int32_t)stepPhase) {
+        remaining = -(int32_t)stepPhase;
+    }
+
+    // Move by the pulse's phase over a correction period, landing exactly on the target
+    uint32_t tickPhase = (uint32_t)(((uint64_t)stepPhase * (SystemCoreClock / CONTROL_LOOP_FREQ)) / (this -> interpStepInterval));
+    uint16_t phase;
+    if ((uint32_t)abs(remaining) <= tickPhase) {
+        this -> drivenPhase = target;
+        phase = (target >> MULTIPLIER_Q_POWER);
+    }
+    else {
+        this -> drivenPhase = target - remaining + (remaining > 0 ? (int32_t)tickPhase : -(int32_t)tickPhase);
+        phase = ((this -> drivenPhase) >> MULTIPLIER_Q_POWER) & ~(uint16_t)(STEP_INTERP_GRID_PHASE - 1);
+    }
+    this -> driveCoilsPhase(phase);
+
+    // Done once the target is reached, unless a pulse came in since it was read
+    if ((this -> drivenPhase) == target) {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        if ((this -> coilPhase) == target) {
+            this -> interpolating = false;
+        }
+        __set_PRIMASK(primask);
+    }
+}
+#endif // ! ENABLE_STEP_INTERPOLATION
+
+
+// Feed forward of the step input
+#ifdef ENABLE_STEP_FEED_FORWARD
+// Updates the commanded velocity and acceleration from TIM2's count, then the lead of the coils
+// The velocity is a moving average of the pulses in each correction (a box FIR), so a pulse train at a constant rate gives a steady value
+void RAMFUNC StepperMotor::updateStepFeedForward() {
+
+    // Find the pulses since the last correction (TIM2 counts with the DIR pin, so only the reversal needs applied)
+    int32_t count = getHardStepCNT();
+    int32_t delta = constrain((count - (this -> feedLastCount)) * (this -> reversed), INT16_MIN, INT16_MAX);
+    this -> feedLastCount = count;
+
+    // Swap the oldest delta for the new one
+    this -> feedSum += delta - (this -> feedDeltas[this -> feedIndex]);
+    this -> feedDeltas[this -> feedIndex] = delta;
+    this -> feedIndex = ((this -> feedIndex) + 1) & ((1 << STEP_FF_TAPS_POWER) - 1);
+
+    // Convert the average to microsteps/s (each pulse moves the multiplier's worth of microsteps)
+    int32_t lastVelocity = (this -> feedVelocity);
+    int64_t pulseRate = ((int64_t)(this -> feedSum) * CONTROL_LOOP_FREQ) >> STEP_FF_TAPS_POWER;
+
+    // The captured interval measures the rate much more finely than the count, use it while the input is moving
+    #ifdef ENABLE_STEP_CAPTURE
+        uint32_t capturedRate = getCapturedStepRate();
+        if ((capturedRate != 0) && ((this -> feedSum) != 0)) {
+            pulseRate = ((this -> feedSum) > 0 ? (int64_t)capturedRate : -(int64_t)capturedRate);
+        }
+    #endif
+    this -> feedVelocity = (int32_t)((pulseRate * (this -> microstepMultiplier)) >> MULTIPLIER_Q_POWER);
+
+    // The acceleration is the change of the velocity, filtered since the velocity only moves in whole pulses
+    int32_t rawAccel = ((this -> feedVelocity) - lastVelocity) * (int32_t)CONTROL_LOOP_FREQ;
+    this -> feedAccel += (rawAccel - (this -> feedAccel)) >> STEP_FF_ACCEL_FILTER_POWER;
+
+    // Lead the coils by the phase moved in the lead time, at most half of a full step so the lead can't pass the peak of the torque
+    int64_t lead = ((int64_t)(this -> feedVelocity) * (this -> microstepPhase) * STEP_FF_LEAD_TIME) / (1000000LL << MULTIPLIER_Q_POWER);
+    this -> leadPhase = (int16_t)constrain(lead, -(int32_t)(PHASE_PER_FULL_STEP / 2), (int32_t)(PHASE_PER_FULL_STEP / 2));
+}
+
+
+// Clears the history and the lead (the step input was paused)
+void StepperMotor::resetStepFeedForward() {
+    this -> feedLastCount = getHardStepCNT();
+    memset(this -> feedDeltas, 0, sizeof(this -> feedDeltas));
+    this -> feedSum = 0;
+    this -> feedVelocity = 0;
+    this -> feedAccel = 0;
+    this -> leadPhase = 0;
+}
+
+
+// Gets the commanded velocity of the step input (microsteps/s)
+int32_t StepperMotor::getStepVelocity() const {
+    return (this -> feedVelocity);
+}
+
+
+// Gets the commanded acceleration of the step input (microsteps/s/s)
+int32_t StepperMotor::getStepAccel() const {
+    return (this -> feedAccel);
+}
+#endif // ! ENABLE_STEP_FEED_FORWARD
+
+
+// Thermal model of the coils
+#ifdef ENABLE_THERMAL_MODEL
+// Sums the square of the coil current, updating the model and the derating every THERMAL_TICKS
+void StepperMotor::updateThermalModel() {
+
+    // Find the peak current that the coils are being driven with (the heat of the two coils only depends on the peak, sin^2 + cos^2 = 1)
+    // The motor is only heated while it is being driven
+    uint32_t current = 0;
+    if ((this -> state) == ENABLED || (this -> state) == FORCED_ENABLED) {
+        current = (this -> peakCurrent);
+        #ifdef ENABLE_IDLE_CURRENT
+            current = (current * (this -> currentScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+        #ifdef ENABLE_CURRENT_ON_DEMAND
+            current = (current * (this -> demandScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+        #ifdef ENABLE_SPEED_CURRENT_BOOST
+            current = min((current * (this -> boostScale)) >> MULTIPLIER_Q_POWER, (uint32_t)MAX_PEAK_BOARD_CURRENT);
+        #endif
+        current = (current * (this -> thermalScale)) >> MULTIPLIER_Q_POWER;
+
+        // The torque mode drives its own current (already derated)
+        #ifdef ENABLE_TORQUE_MODE
+            if (this -> torqueModeActive) {
+                current = abs(this -> torqueCurrent);
+            }
+        #endif
+    }
+    this -> thermalCurrentSum += (current * current);
+
+    // Wait for the rest of the update
+    if (++(this -> thermalTicks) < THERMAL_TICKS) {
+        return;
+    }
+
+    // Move the rise toward where it would settle at the average of the squared current
+    int64_t settledRise = (int64_t)((((this -> thermalCurrentSum) / THERMAL_TICKS) * (THERMAL_RATED_RISE * 10)) / ((uint32_t)THERMAL_RATED_CURRENT * THERMAL_RATED_CURRENT)) << 16;
+    this -> thermalRise += (((settledRise - (this -> thermalRise)) * THERMAL_ALPHA_Q) >> 32);
+    this -> thermalCurrentSum = 0;
+    this -> thermalTicks = 0;
+
+    // Lower the current across the band below the limit, reaching the least current at the limit
+    int32_t margin = ((THERMAL_LIMIT_TEMP * 10) - getCoilTemp());
+    uint32_t scale = CURRENT_SCALE_FULL;
+    if (margin <= 0) {
+        scale = ((CURRENT_SCALE_FULL * THERMAL_MIN_CURRENT) / 100);
+    }
+    else if (margin < (THERMAL_DERATE_BAND * 10)) {
+        uint32_t minScale = ((CURRENT_SCALE_FULL * THERMAL_MIN_CURRENT) / 100);
+        scale = minScale + (((CURRENT_SCALE_FULL - minScale) * (uint32_t)margin) / (THERMAL_DERATE_BAND * 10));
+    }
+
+    // The coils might not be moving, so they have to be driven again to apply the new current
+    // Every interrupt is masked, as disableInterrupts() doesn't hold off the step pin (a step can't move the phase before the drive)
+    if (scale != (this -> thermalScale)) {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        this -> thermalScale = scale;
+        if ((this -> state) == ENABLED || (this -> state) == FORCED_ENABLED) {
+            driveCoilsPhase((this -> coilPhase) >> MULTIPLIER_Q_POWER);
+        }
+        __set_PRIMASK(primask);
+    }
+}
+
+
+// Sets the temperature of the encoder that the coils heat up from (tenths of a degree C)
+void StepperMotor::setThermalAmbient(int16_t tempTenths) {
+    this -> thermalAmbient = tempTenths;
+}
+
+
+// Gets the estimated temperature of the coils (tenths of a degree C)
+int16_t StepperMotor::getCoilTemp() const {
+    return (this -> thermalAmbient) + (int16_t)((this -> thermalRise) >> 16);
+}
+
+
+// Gets the current that is allowed by the model (%)
+uint16_t StepperMotor::getThermalDerating() const {
+    return (((this -> thermalScale) * 100) >> MULTIPLIER_Q_POWER);
+}
+
+
+// Gets a summary of the model
+String StepperMotor::getThermalStatus() const {
+    return ("Coils: " + fixedString(getCoilTemp(), 1) + F(" C | Encoder: ") + fixedString(this -> thermalAmbient, 1) +
+            F(" C | Current: ") + String(getThermalDerating()) + F("%"));
+}
+#endif // ! ENABLE_THERMAL_MODEL
+
+
+// Current boost at speed
+#ifdef ENABLE_SPEED_CURRENT_BOOST
+// Finds the boost of the current at the observer's speed, interpolating between the points on either side
+void StepperMotor::updateCurrentBoost() {
+
+    // Find the gap that the speed is in (clamped to the first and last points)
+    uint32_t rpm = ((uint32_t)abs(encoder.getObserverVelocity()) * 60) / ENCODER_COUNTS_PER_REV;
+    uint8_t gap = 0;
+    while ((gap < (CURRENT_BOOST_POINTS - 1)) && (rpm >= (this -> boostTable[gap + 1].rpm))) {
+        gap++;
+    }
+
+    // Blend the points on each side (past either end, or in a gap that isn't increasing, the point's boost is used)
+    uint32_t percent = (this -> boostTable[gap].percent);
+    if ((gap < (CURRENT_BOOST_POINTS - 1)) && (rpm > (this -> boostTable[gap].rpm)) && ((this -> boostTable[gap + 1].rpm) > (this -> boostTable[gap].rpm))) {
+        int32_t start = (this -> boostTable[gap].percent);
+        int32_t end = (this -> boostTable[gap + 1].percent);
+        percent = start + (((end - start) * (int32_t)(rpm - (this -> boostTable[gap].rpm))) / (int32_t)((this -> boostTable[gap + 1].rpm) - (this -> boostTable[gap].rpm)));
+    }
+    uint32_t scale = ((percent << MULTIPLIER_Q_POWER) / 100);
+
+    // Keep the boosted peak current under the board's limit
+    #ifdef ENABLE_DYNAMIC_CURRENT
+        uint32_t setCurrent = max((uint32_t)(this -> dynamicCurrent), (uint32_t)1);
+    #else
+        uint32_t setCurrent = max((uint32_t)(this -> peakCurrent), (uint32_t)1);
+    #endif
+    this -> boostScale = min(scale, ((uint32_t)MAX_PEAK_BOARD_CURRENT << MULTIPLIER_Q_POWER) / setCurrent);
+}
+
+
+// Sets a point of the current boost table
+bool StepperMotor::setCurrentBoostPoint(uint8_t index, currentBoostPoint point) {
+
+    // Make sure the point exists
+    if (index >= CURRENT_BOOST_POINTS) {
+        return false;
+    }
+    this -> boostTable[index] = point;
+    return true;
+}
+
+
+// Gets a point of the current boost table
+currentBoostPoint StepperMotor::getCurrentBoostPoint(uint8_t index) const {
+    return this -> boostTable[(index < CURRENT_BOOST_POINTS) ? index : (CURRENT_BOOST_POINTS - 1)];
+}
+
+
+// Gets the boost that is being applied (%)
+uint16_t StepperMotor::getCurrentBoost() const {
+    return (((this -> boostScale) * 100) >> MULTIPLIER_Q_POWER);
+}
+#endif // ! ENABLE_SPEED_CURRENT_BOOST
+
+
+// Damping of the mid-band resonance
+#ifdef ENABLE_RESONANCE_DAMPING
+// Band-passes the observer's velocity, then holds back the coils against the ringing
+// The difference of the two filters keeps only the ringing, the slow one follows the commanded motion and the fast one drops the noise
+void RAMFUNC StepperMotor::updateResonanceDamping() {
+
+    // Filter the velocity (Q4, so the slow filter keeps moving at low speeds)
+    int32_t velocity = (encoder.getObserverVelocity() << 4);
+    this -> resonanceSlow += (velocity - (this -> resonanceSlow)) >> RESONANCE_SLOW_POWER;
+    this -> resonanceFast += (velocity - (this -> resonanceFast)) >> RESONANCE_FAST_POWER;
+    int32_t ringing = ((this -> resonanceFast) - (this -> resonanceSlow)) >> 4;
+
+    // Only damp the band of speeds that rings, the rest of the range doesn't need it
+    uint32_t speed = (uint32_t)abs((this -> resonanceSlow) >> 4);
+    int32_t damping = 0;
+    if ((speed >= (uint32_t)(RESONANCE_MIN_SPEED * ENCODER_COUNTS_PER_REV)) && (speed <= (uint32_t)(RESONANCE_MAX_SPEED * ENCODER_COUNTS_PER_REV))) {
+
+        // Hold the coils back by the phase moved at the ringing velocity in the damping time (at most a quarter of a full step)
+        int64_t phase = ((int64_t)ringing * (this -> countPhaseScale) * (this -> resonanceDampingTime)) / 1000000;
+        damping = constrain(-phase, -(int32_t)(PHASE_PER_FULL_STEP / 4), (int32_t)(PHASE_PER_FULL_STEP / 4));
+    }
+    bool changed = (damping != (this -> dampingPhase));
+    this -> dampingPhase = (int16_t)damping;
+
+    // Drive the coils again, so the damping keeps working between the steps
+    // The step interrupt can land part way through, so the coils are driven until a step doesn't (its drive would have been overwritten)
+    // With the encoder commutation, the correction drives the coils every tick anyway
+    #ifndef ENABLE_ENCODER_COMMUTATION
+    if (changed && (this -> state == ENABLED || this -> state == FORCED_ENABLED)) {
+        uint32_t phaseBefore;
+        do {
+            phaseBefore = (this -> coilPhase);
+            driveCoilsPhase(phaseBefore >> MULTIPLIER_Q_POWER);
+        } while (phaseBefore != (this -> coilPhase));
+    }
+    #endif
+}
+
+
+// Starts the filters over from the current velocity (the correction was paused)
+void StepperMotor::resetResonanceDamping() {
+    this -> resonanceSlow = (encoder.getObserverVelocity() << 4);
+    this -> resonanceFast = (this -> resonanceSlow);
+    this -> dampingPhase = 0;
+}
+
+
+// Sets the gain of the damping (us, 0 is off)
+void StepperMotor::setResonanceDamping(uint16_t time) {
+    this -> resonanceDampingTime = time;
+}
+
+
+// Gets the gain of the damping (us)
+uint16_t StepperMotor::getResonanceDamping() const {
+    return (this -> resonanceDampingTime);
+}
+#endif // ! ENABLE_RESONANCE_DAMPING
+
+
+// Recomputes the electrical phase moved by a microstep and by a multiplied step pulse
+#ifndef ENABLE_FIXED_MOTOR_CONFIG
+void StepperMotor::updateStepPhases() {
+
+    // A microstep is PHASE_PER_FULL_STEP / divisor, kept in Q16 so that the multiplier's fraction survives
+    this -> microstepPhase = microstepPhaseFor(this -> microstepDivisor);
+    this -> multipliedStepPhase = multipliedStepPhaseFor(this -> microstepMultiplier, this -> microstepDivisor);
+
+    // Mask that drops the phase within a microstep
+    this -> microstepPhaseMask = microstepPhaseMaskFor(this -> microstepDivisor);
+}
+#endif // ! ENABLE_FIXED_MOTOR_CONFIG
+
+
+// Sets the coils of the motor based on the step count
+void RAMFUNC StepperMotor::driveCoils(int32_t steps) {
+
+    // Convert the microsteps to an electrical phase within a cycle (4 full steps), then drive the coils to it
+    // The step accumulator is moved to the same phase, so the next step continues from here
+    uint16_t phase = stepCountPhase(steps, this -> microstepDivisor);
+    this -> coilPhase = ((uint32_t)phase << MULTIPLIER_Q_POWER);
+    driveCoilsPhase(phase);
+}
 
-        // Update the previous state of the coil with the new one
-        previousCoilStateB = desiredState;
+
+// Sets the coils to hold the motor at the desired electrical phase (PHASE_PER_CYCLE is 4 full steps)
+void RAMFUNC StepperMotor::driveCoilsPhase(uint16_t phase) {
+
+    // Drive the coils past the detent torque, by the offset between the two points of the table around the phase
+    #ifdef ENABLE_DETENT_COMPENSATION
+        uint16_t detentPoint = (phase >> DETENT_POINT_POWER);
+        int32_t detentStart = (this -> detentTable[detentPoint]);
+        int32_t detentEnd = (this -> detentTable[(detentPoint + 1) & (DETENT_TABLE_SIZE - 1)]);
+        phase += (int16_t)(detentStart + (((detentEnd - detentStart) * (int32_t)(phase & ((1 << DETENT_POINT_POWER) - 1))) >> DETENT_POINT_POWER));
+    #endif
+
+    // Lead the coils ahead of the commanded phase, by the distance that the rotor lags at the commanded velocity
+    #ifdef ENABLE_STEP_FEED_FORWARD
+        phase += (this -> leadPhase);
+    #endif
+
+    // Hold the coils back against the ringing of the rotor
+    #ifdef ENABLE_RESONANCE_DAMPING
+        phase += (this -> dampingPhase);
+    #endif
+
+    // Everything is already computed, just look up the entries for the phase of each coil (B is a quarter cycle ahead)
+    #ifdef ENABLE_COIL_LUT
+        uint16_t phaseB = coilPhaseB(phase);
+        uint16_t compareA = coilCompareTable[coilTableIndex(phase)];
+        #ifdef ENABLE_WAVEFORM_SHAPING
+            uint16_t compareB = coilCompareTableB[coilTableIndex(phaseB)];
+        #else
+            uint16_t compareB = coilCompareTable[coilTableIndex(phaseB)];
+        #endif
+
+        // The compare values are proportional to the current, so the idle reduction just scales them
+        #ifdef ENABLE_IDLE_CURRENT
+            compareA = ((uint32_t)compareA * (this -> currentScale)) >> MULTIPLIER_Q_POWER;
+            compareB = ((uint32_t)compareB * (this -> currentScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+
+        // Run at the current that the error is asking for
+        #ifdef ENABLE_CURRENT_ON_DEMAND
+            compareA = ((uint32_t)compareA * (this -> demandScale)) >> MULTIPLIER_Q_POWER;
+            compareB = ((uint32_t)compareB * (this -> demandScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+
+        // Raise the current at speed (the boost is already limited to the board's peak current)
+        #ifdef ENABLE_SPEED_CURRENT_BOOST
+            compareA = min(((uint32_t)compareA * (this -> boostScale)) >> MULTIPLIER_Q_POWER, (uint32_t)(this -> maxCompare));
+            compareB = min(((uint32_t)compareB * (this -> boostScale)) >> MULTIPLIER_Q_POWER, (uint32_t)(this -> maxCompare));
+        #endif
+
+        // Lower the current to keep the coils under their temperature limit
+        #ifdef ENABLE_THERMAL_MODEL
+            compareA = ((uint32_t)compareA * (this -> thermalScale)) >> MULTIPLIER_Q_POWER;
+            compareB = ((uint32_t)compareB * (this -> thermalScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+
+        // The second half of each wave moves backward, and a coil brakes when there isn't any current
+        COIL_STATE stateA = (compareA == 0 ? BRAKE : (coilPhaseBackward(phase) ? BACKWARD : FORWARD));
+        COIL_STATE stateB = (compareB == 0 ? BRAKE : (coilPhaseBackward(phaseB) ? BACKWARD : FORWARD));
+        setCoilOutputs(stateA, compareA, stateB, compareB);
+
+    #else // ! ENABLE_COIL_LUT
+
+        // Pick the peak current of the coils
+        #ifdef ENABLE_DYNAMIC_CURRENT
+
+            // Use the setpoint computed by the correction loop (the step interrupt never touches the encoder)
+            uint16_t current = (this -> dynamicCurrent);
+        #else
+            // Just use static current multipiers
+            uint16_t current = (this -> peakCurrent);
+        #endif
+
+        // Lower the current while the motor is idle
+        #ifdef ENABLE_IDLE_CURRENT
+            current = ((uint32_t)current * (this -> currentScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+
+        // Run at the current that the error is asking for
+        #ifdef ENABLE_CURRENT_ON_DEMAND
+            current = ((uint32_t)current * (this -> demandScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+
+        // Raise the current at speed, never past the board's peak current
+        #ifdef ENABLE_SPEED_CURRENT_BOOST
+            current = min(((uint32_t)current * (this -> boostScale)) >> MULTIPLIER_Q_POWER, (uint32_t)MAX_PEAK_BOARD_CURRENT);
+        #endif
+
+        // Lower the current to keep the coils under their temperature limit
+        #ifdef ENABLE_THERMAL_MODEL
+            current = ((uint32_t)current * (this -> thermalScale)) >> MULTIPLIER_Q_POWER;
+        #endif
+
+        // Drive the coils with the current
+        driveCoilsVector(phase, current);
+    #endif // ! ENABLE_COIL_LUT
+}
+
+
+// Sets the coils to a current vector at the electrical phase, with a peak current (in mA)
+void StepperMotor::driveCoilsVector(uint16_t phase, uint16_t current) {
+
+    // Calculate the coil settings
+    int16_t coilAPercent = fastSinPhase(phase);
+    int16_t coilBPercent = fastCosPhase(phase);
+
+    // Equation comes out to be (effort * -1 to 1) depending on the sine/cosine of the phase angle
+    int16_t coilAPower = ((int32_t)current * coilAPercent) >> SINE_POWER; // i.e. / SINE_MAX
+    int16_t coilBPower = ((int32_t)current * coilBPercent) >> SINE_POWER; // i.e. / SINE_MAX
+
+    // Check the if the coil should be energized to move backward or forward
+    if (coilAPower > 0) {
+
+        // Set first channel for forward movement
+        setCoilA(COIL_STATE::FORWARD, coilAPower);
+    }
+    else if (coilAPower < 0) {
+
+        // Set first channel for backward movement
+        setCoilA(COIL_STATE::BACKWARD, -coilAPower);
+    }
+    else {
+        #ifdef ENABLE_ADAPTIVE_PWM
+            setCoilA(this -> zeroCurrentState);
+        #else
+            setCoilA(BRAKE);
+        #endif
     }
 
-    // Update the output pin with the correct current
-    analogSet(&PWMCurrentPinInfoB, currentToPWM(current));
+
+    // Check the if the coil should be energized to move backward or forward
+    if (coilBPower > 0) {
+
+        // Set first channel for forward movement
+        setCoilB(COIL_STATE::FORWARD, coilBPower);
+    }
+    else if (coilBPower < 0) {
+
+        // Set first channel for backward movement
+        setCoilB(BACKWARD, -coilBPower);
+    }
+    else {
+        #ifdef ENABLE_ADAPTIVE_PWM
+            setCoilB(this -> zeroCurrentState);
+        #else
+            setCoilB(BRAKE);
+        #endif
+    }
+}
+
+// Encoder commutation
+#ifdef ENABLE_ENCODER_COMMUTATION
+// Drives the coils from the rotor's angle toward the desired position, at most a full step ahead of or behind it
+// Within a full step this lands on the desired position, past it the coils pull with the most torque instead of slipping around the cycle
+void RAMFUNC StepperMotor::commutateEncoder(int32_t stepError) {
+
+    // Electrical phase of the rotor (from the calibrated step offset, so it lines up with the coils)
+    uint16_t rotorPhase = encoder.getCalibratedIncrements() * (this -> countPhaseScale);
+
+    // Phase from the rotor to the desired position (the error is positive when the rotor is ahead)
+    int32_t phaseError = -(int32_t)(((int64_t)stepError * (this -> microstepPhase)) >> MULTIPLIER_Q_POWER);
+    phaseError = constrain(phaseError, -(int32_t)PHASE_PER_FULL_STEP, (int32_t)PHASE_PER_FULL_STEP);
+
+    // Round the phase to the nearest microstep, keeping the coils on the microstep positions
+    uint16_t phase = rotorPhase + phaseError;
+    phase = (phase + ((uint16_t)~(this -> microstepPhaseMask) >> 1)) & (this -> microstepPhaseMask);
+
+    // Drive the coils to the phase, moving the step accumulator with it so that steps continue from here
+    this -> coilPhase = ((uint32_t)phase << MULTIPLIER_Q_POWER);
+    driveCoilsPhase(phase);
 }
+#endif // ! ENABLE_ENCODER_COMMUTATION
+
+
+// Field oriented commutation
+#ifdef ENABLE_FOC
+// Drives the current vector a quarter of an electrical cycle ahead of or behind the rotor, with the current set by the position error
+void StepperMotor::commutateFOC() {
+
+    // Electrical phase of the rotor (there are 4 full steps per electrical cycle)
+    uint16_t rotorPhase = encoder.getCalibratedIncrements() * (this -> countPhaseScale);
+
+    // Keep the current within the limits of the motor
+    #ifdef ENABLE_DYNAMIC_CURRENT
+        int32_t maxCurrent = (this -> dynamicMaxCurrent) * 1.414;
+    #else
+        int32_t maxCurrent = (this -> peakCurrent);
+    #endif
+
+    #ifdef ENABLE_CASCADED_CONTROL
+        // Position, then velocity, then current
+        int32_t current = computeCascadedCurrent(maxCurrent - FOC_MIN_CURRENT);
+    #else
+        // Position error in counts
+        #ifdef ENABLE_LATENCY_COMPENSATION
+            int32_t countError = getDesiredCounts() - encoder.getCompensatedPosition();
+        #else
+            int32_t countError = getDesiredCounts() - encoder.getObserverPosition();
+        #endif
+
+        // PD controller, the velocity damps the motion
+        int32_t current = (int32_t)((((int64_t)FOC_P_GAIN_Q * countError) - ((int64_t)FOC_D_GAIN_Q * encoder.getObserverVelocity())) >> MULTIPLIER_Q_POWER);
+    #endif
+
+    // Lead the rotor in the direction of the error (90 electrical degrees gives the most torque for the current)
+    uint16_t phase;
+    if (current >= 0) {
+        phase = rotorPhase + PHASE_PER_FULL_STEP;
+    }
+    else {
+        phase = rotorPhase - PHASE_PER_FULL_STEP;
+        current = -current;
+    }
+
+    // Limit the current, then drive the coils
+    current = constrain(current + FOC_MIN_CURRENT, FOC_MIN_CURRENT, maxCurrent);
+    driveCoilsVector(phase, current);
+
+    // Hand the vector to the inner commutation, which keeps it on the rotor until the next correction
+    #ifdef ENABLE_FAST_COMMUTATION
+        this -> fastCurrent = current;
+        this -> fastLead = (int16_t)(phase - rotorPhase);
+        this -> fastHold = (this -> fastHoldTicks);
+    #endif
+}
+
+
+// Inner commutation loop
+#ifdef ENABLE_FAST_COMMUTATION
+// Moves the current vector of the last correction with the rotor, from the latest encoder sample and the observer's velocity
+// The position loop stays in the correction, this only keeps the lead angle right as the rotor turns between them
+void StepperMotor::fastCommutate() {
+
+    // Only every Nth update of the PWM
+    if (--(this -> fastCountdown) > 0) {
+        return;
+    }
+    this -> fastCountdown = (this -> fastDivider);
+
+    // Leave the coils alone once the correction stops setting the vector (ex. the motor was disabled, or the torque mode took over)
+    if ((this -> fastHold) == 0 || ((this -> state) != ENABLED && (this -> state) != FORCED_ENABLED)) {
+        return;
+    }
+    this -> fastHold--;
+
+    // Lead the rotor where it is now, by the same angle and with the same current as the correction
+    uint16_t rotorPhase = encoder.getInterpolatedIncrements() * (this -> countPhaseScale);
+    driveCoilsVector(rotorPhase + (this -> fastLead), this -> fastCurrent);
+}
+
+
+// Finds the updates of TIM3 per commutation from the PWM's period, as close to FAST_COMMUTATION_FREQ as they can get without going over
+void StepperMotor::updateFastCommutationRate() {
+
+    // TIM3 is on APB1 (the period is read back from the preload, so a new one is used straight away)
+    TIM_TypeDef *timer = (this -> PWMCurrentPinInfoA.instance);
+    uint32_t pwmFreq = getAPB1TimerFreq() / ((timer -> PSC + 1) * (timer -> ARR + 1));
+    uint32_t divider = constrain((pwmFreq + FAST_COMMUTATION_FREQ - 1) / FAST_COMMUTATION_FREQ, (uint32_t)1, (uint32_t)UINT8_MAX);
+
+    // Hold each vector for the commutations of a few corrections
+    uint32_t commutationsPerCorrection = ((pwmFreq / divider) + CONTROL_LOOP_FREQ - 1) / CONTROL_LOOP_FREQ;
+    this -> fastDivider = divider;
+    this -> fastHoldTicks = min(commutationsPerCorrection * FAST_COMMUTATION_HOLD, (uint32_t)UINT8_MAX);
+}
+#endif // ! ENABLE_FAST_COMMUTATION
+
+
+// Cascaded position, velocity, and current controller
+#ifdef ENABLE_CASCADED_CONTROL
+// Computes the signed current (mA) from an outer position P loop and an inner velocity PI loop
+// The commanded velocity and acceleration are fed forward from the change of the desired position (the step stream)
+int32_t StepperMotor::computeCascadedCurrent(int32_t maxCurrent) {
+
+    // Find the commanded velocity from the step stream, filtered because the steps come in whole counts (counts/s)
+    int32_t desiredCounts = getDesiredCounts();
+    int32_t commandVelocity = (desiredCounts - (this -> lastDesiredCounts)) * (int32_t)CONTROL_LOOP_FREQ;
+    this -> lastDesiredCounts = desiredCounts;
+    int32_t lastFeedVelocity = (this -> feedVelocity);
+    this -> feedVelocity += (commandVelocity - (this -> feedVelocity)) >> CASCADE_FEED_FILTER_POWER;
+
+    // The commanded acceleration is the change of the filtered velocity (counts/s/s)
+    int32_t feedAccel = ((this -> feedVelocity) - lastFeedVelocity) * (int32_t)CONTROL_LOOP_FREQ;
+
+    // Outer position loop, the velocity it asks for is added to the commanded velocity
+    #ifdef ENABLE_LATENCY_COMPENSATION
+        int32_t positionError = desiredCounts - encoder.getCompensatedPosition();
+    #else
+        int32_t positionError = desiredCounts - encoder.getObserverPosition();
+    #endif
+    int32_t velocitySetpoint = (int32_t)(((int64_t)CASCADE_POSITION_GAIN_Q * positionError) >> MULTIPLIER_Q_POWER) + (this -> feedVelocity);
+    velocitySetpoint = constrain(velocitySetpoint, -CASCADE_MAX_VELOCITY, CASCADE_MAX_VELOCITY);
+
+    // Inner velocity loop (PI), plus the acceleration feed forward
+    int32_t velocityError = velocitySetpoint - encoder.getObserverVelocity();
+    int64_t proportional = (int64_t)CASCADE_VELOCITY_P_Q * velocityError;
+    int64_t accelFeed = (int64_t)CASCADE_ACCEL_FEED_Q * feedAccel;
+    int64_t nextIntegral = (this -> velocityIntegral) + ((int64_t)CASCADE_VELOCITY_I_Q * velocityError) / (int32_t)CONTROL_LOOP_FREQ;
+
+    // Only integrate while the output isn't saturated (anti-windup), and keep the integral itself within the current limit
+    int64_t maxOutput = ((int64_t)maxCurrent << MULTIPLIER_Q_POWER);
+    int64_t output = proportional + accelFeed + nextIntegral;
+    if ((output < maxOutput) && (output > -maxOutput)) {
+        this -> velocityIntegral = constrain(nextIntegral, -maxOutput, maxOutput);
+    }
+    else {
+        output = proportional + accelFeed + (this -> velocityIntegral);
+    }
+
+    // Return the current (the caller does the limiting)
+    return (int32_t)(constrain(output, -maxOutput, maxOutput) >> MULTIPLIER_Q_POWER);
+}
+#endif // ! ENABLE_CASCADED_CONTROL
+#endif // ! ENABLE_FOC
+
+
+// Torque mode
+#ifdef ENABLE_TORQUE_MODE
+// Drives the current vector a quarter of an electrical cycle ahead of or behind the rotor at the commanded current
+// Past the speed limit (in the direction of the torque) the current is cut back over the band, then reversed into a brake over the band after that
+void RAMFUNC StepperMotor::commutateTorque() {
+
+    // The inner commutation would keep pushing the last position loop's vector
+    #ifdef ENABLE_FAST_COMMUTATION
+        this -> fastHold = 0;
+    #endif
+
+    // Electrical phase of the rotor (there are 4 full steps per electrical cycle)
+    uint16_t rotorPhase = encoder.getCalibratedIncrements() * (this -> countPhaseScale);
+
+    // Keep the current within the limits of the motor
+    #ifdef ENABLE_DYNAMIC_CURRENT
+        int32_t maxCurrent = (this -> dynamicMaxCurrent) * 1.414;
+    #else
+        int32_t maxCurrent = (this -> peakCurrent);
+    #endif
+    int32_t current = constrain((int32_t)(this -> torqueTarget), -maxCurrent, maxCurrent);
+
+    // Cut the current back once the motor is running away in the direction of the torque (fits in 32 bits, the band is well under 2^19 counts/s)
+    int32_t velocity = encoder.getObserverVelocity();
+    int32_t overspeed = (current >= 0 ? velocity : -velocity) - (this -> torqueSpeedLimit);
+    if (overspeed > 0) {
+        int32_t scale = max((int32_t)TORQUE_SPEED_BAND_COUNTS - overspeed, -(int32_t)TORQUE_SPEED_BAND_COUNTS);
+        current = (current * scale) / (int32_t)TORQUE_SPEED_BAND_COUNTS;
+    }
+
+    // Lower the current to keep the coils under their temperature limit
+    #ifdef ENABLE_THERMAL_MODEL
+        current = (current * (int32_t)(this -> thermalScale)) / (int32_t)CURRENT_SCALE_FULL;
+    #endif
+    this -> torqueCurrent = current;
+
+    // Lead the rotor in the direction of the torque (90 electrical degrees gives the most torque for the current)
+    if (current >= 0) {
+        driveCoilsVector(rotorPhase + PHASE_PER_FULL_STEP, current);
+    }
+    else {
+        driveCoilsVector(rotorPhase - PHASE_PER_FULL_STEP, -current);
+    }
+}
+
+
+// Starts the torque mode, or changes the current if it is already running (returns false if a direct move is running)
+bool StepperMotor::setTorqueMode(int16_t current) {
+
+    // The moves pause the correction, so the torque wouldn't be held
+    #ifdef ENABLE_DIRECT_STEPPING
+        if (isDirectMoveRunning()) {
+            return false;
+        }
+    #endif
+
+    // Set the current before the mode, so the first correction pushes with it
+    this -> torqueTarget = current;
+    this -> torqueModeActive = true;
+    return true;
+}
+
+
+// Leaves the torque mode, moving the desired and counted steps to the rotor so that the correction doesn't pull it back to where the mode started
+// The step input's position is shifted by the distance that the motor was pushed
+void StepperMotor::exitTorqueMode() {
+
+    // Nothing to do if the mode isn't running
+    if (!(this -> torqueModeActive)) {
+        return;
+    }
+
+    // The correction can't run between the counts and the coils
+    disableInterrupts();
+
+    // Read the rotor first, the encoder can't be read with every interrupt masked
+    int32_t rotorStep = getStepError() + getHardStepCNT();
+    uint16_t rotorIncrements = encoder.getCalibratedIncrements();
+
+    // The step pin isn't held off by disableInterrupts(), and step() moves the same counts and coils
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int32_t stepError = rotorStep - getHardStepCNT();
+    setHardStepCNT(getHardStepCNT() + stepError);
+    this -> softStepCNT += stepError;
+    this -> currentStep += stepError;
+    #ifdef ENABLE_HARDWARE_STEP_COUNTING
+        this -> lastHardStepCNT += stepError;
+    #endif
+
+    // Hold the coils at the rotor (if they're being driven, enabling the motor does the same), then give them back to the steps
+    if ((this -> state) == ENABLED || (this -> state) == FORCED_ENABLED) {
+        driveCoilsCounts(rotorIncrements);
+    }
+    this -> torqueCurrent = 0;
+    this -> torqueModeActive = false;
+    __set_PRIMASK(primask);
+    enableInterrupts();
+}
+
+
+// Gets if the torque mode is running
+bool StepperMotor::isTorqueModeActive() const {
+    return (this -> torqueModeActive);
+}
+
+
+// Gets the commanded current (mA)
+int16_t StepperMotor::getTorqueTarget() const {
+    return (this -> torqueTarget);
+}
+
+
+// Gets the current driven by the last correction, after the speed limit and the thermal derating (mA)
+int16_t StepperMotor::getTorqueCurrent() const {
+    return (this -> torqueCurrent);
+}
+
+
+// Sets the speed that the torque starts being cut back at (RPM)
+void StepperMotor::setTorqueSpeedLimit(uint16_t rpm) {
+    this -> torqueSpeedLimit = ((int32_t)rpm * ENCODER_COUNTS_PER_REV) / 60;
+}
+
+
+// Gets the speed that the torque starts being cut back at (RPM)
+uint16_t StepperMotor::getTorqueSpeedLimit() const {
+    return (((this -> torqueSpeedLimit) * 60) / ENCODER_COUNTS_PER_REV);
+}
+#endif // ! ENABLE_TORQUE_MODE
+
+
+// Rebuilds the coil drive table with the current peak current
+#ifdef ENABLE_COIL_LUT
+void StepperMotor::buildCoilTable() {
+
+    // Compute the output of a coil at every entry of the quarter sine table (the sign is added when driving)
+    for (uint16_t index = 0; index <= SINE_QUARTER_COUNT; index++) {
+        #ifdef ENABLE_WAVEFORM_SHAPING
+
+            // Add the third harmonic to the wave
+            uint32_t coilPower = coilTableShapedCurrent(index, this -> peakCurrent, this -> waveformThirdHarmonic);
+
+            // Split the balance between the coils, never driving either past the board's peak current
+            coilCompareTable[index] = currentToCompare(min((uint32_t)(coilPower * (1 + (this -> waveformBalance))), (uint32_t)MAX_PEAK_BOARD_CURRENT));
+            coilCompareTableB[index] = currentToCompare(min((uint32_t)(coilPower * (1 - (this -> waveformBalance))), (uint32_t)MAX_PEAK_BOARD_CURRENT));
+        #else
+            coilCompareTable[index] = currentToCompare(coilTableCurrent(index, this -> peakCurrent));
+        #endif
+    }
+
+    // The current boost can't raise a coil past the board's peak current
+    #ifdef ENABLE_SPEED_CURRENT_BOOST
+        this -> maxCompare = currentToCompare(MAX_PEAK_BOARD_CURRENT);
+    #endif
+}
+#endif
+
+
+// Sets the coils of the motor to the shaft position (counts should be from the calibrated step offset, like getCalibratedIncrements())
+// The electrical phase is a single multiply, the cast wraps it into an electrical cycle
+void StepperMotor::driveCoilsCounts(uint16_t counts) {
+
+    // Convert the counts to an electrical phase
+    uint16_t phase = counts * (this -> countPhaseScale);
+
+    // Round the phase to the nearest microstep, keeping the coils on the microstep positions
+    phase = (phase + ((uint16_t)~(this -> microstepPhaseMask) >> 1)) & (this -> microstepPhaseMask);
+
+    // Drive the coils to the phase, moving the step accumulator with it so that steps continue from here
+    this -> coilPhase = ((uint32_t)phase << MULTIPLIER_Q_POWER);
+    driveCoilsPhase(phase);
+}
+
+
+// Sets the PWM frequency of the coils again from the timer's clock
+void StepperMotor::updatePWMFreq() {
+
+    // Both of the coils are on TIM3, so setting one sets both
+    analogSetFreq(&(this -> PWMCurrentPinInfoA), MOTOR_PWM_FREQ);
+
+    // Find the periods of both modes for the new clock, then load the current mode's
+    #ifdef ENABLE_ADAPTIVE_PWM
+        this -> smoothPWMPeriod = analogGetPeriod(&(this -> PWMCurrentPinInfoA), PWM_SMOOTH_FREQ);
+        this -> fastPWMPeriod = analogGetPeriod(&(this -> PWMCurrentPinInfoA), MOTOR_PWM_FREQ);
+        setPWMMode(this -> pwmMode);
+
+    // The commutations are counted in updates of the PWM (the mode does it with the period)
+    #elif defined(ENABLE_FAST_COMMUTATION)
+        updateFastCommutationRate();
+    #endif
+}
+
+
+// Adaptive PWM
+#ifdef ENABLE_ADAPTIVE_PWM
+// Switches the mode of the PWM from the speed of the motor, with hysteresis on either side of the switch speed
+void StepperMotor::updatePWMMode() {
+    uint32_t speed = abs(encoder.getObserverVelocity());
+    if ((this -> pwmMode) == PWM_MODE_SMOOTH && speed > (uint32_t)((PWM_SWITCH_SPEED + PWM_SWITCH_HYSTERESIS) * ENCODER_COUNTS_PER_REV)) {
+        setPWMMode(PWM_MODE_FAST);
+    }
+    else if ((this -> pwmMode) == PWM_MODE_FAST && speed < (uint32_t)((PWM_SWITCH_SPEED - PWM_SWITCH_HYSTERESIS) * ENCODER_COUNTS_PER_REV)) {
+        setPWMMode(PWM_MODE_SMOOTH);
+    }
+}
+
+
+// Sets the mode of the PWM, loading its period and driving the coils again for it
+// TIM3 buffers both the period and the compare values, so the coils switch over at the same update event (no short or long period)
+void StepperMotor::setPWMMode(PWM_MODE mode) {
+
+    // Load the period of the mode, then find the ticks per mA for it (the same scaling as currentToPWM(), at the full resolution)
+    uint32_t period = (mode == PWM_MODE_FAST ? (this -> fastPWMPeriod) : (this -> smoothPWMPeriod));
+    this -> pwmMode = mode;
+    analogSetPeriod(&(this -> PWMCurrentPinInfoA), period);
+    this -> compareScale = (uint32_t)((CURRENT_SENSE_RESISTOR * period * 65536.0) / (BOARD_VOLTAGE * 100));
+
+    // Fast decay at speed, so the current can keep up with the back-EMF
+    this -> zeroCurrentState = (mode == PWM_MODE_FAST ? COAST : BRAKE);
+
+    // Keep the inner commutation at its rate with the new period
+    #ifdef ENABLE_FAST_COMMUTATION
+        updateFastCommutationRate();
+    #endif
+
+    // Drive the coils again with the new scaling, until a step doesn't land part way through (the field oriented mode drives them every correction)
+    #ifndef ENABLE_FOC
+    if (this -> state == ENABLED || this -> state == FORCED_ENABLED) {
+        uint32_t phaseBefore;
+        do {
+            phaseBefore = (this -> coilPhase);
+            driveCoilsPhase(phaseBefore >> MULTIPLIER_Q_POWER);
+        } while (phaseBefore != (this -> coilPhase));
+    }
+    #endif
+}
+
+
+// Gets the mode of the PWM
+PWM_MODE StepperMotor::getPWMMode() const {
+    return (this -> pwmMode);
+}
+#endif // ! ENABLE_ADAPTIVE_PWM
+
+
+// Function for setting the A coil state and current
+void StepperMotor::setCoilA(COIL_STATE desiredState, uint16_t current) {
+
+    // Convert the current, then set the coil
+    setCoilAOutput(desiredState, currentToCompare(current));
+}
+
+
+// Sets the state and output value of the A coil
+void StepperMotor::setCoilAOutput(COIL_STATE desiredState, uint32_t compareValue) {
+
+    // Write the registers directly
+    #ifdef ENABLE_DIRECT_COIL_OUTPUT
+
+        // Latch the coil for the next PWM period
+        #ifdef ENABLE_PWM_SYNC_OUTPUT
+            latchCoilOutput(0, previousCoilStateA, desiredState, compareValue, coilABSRR);
+        #else
+
+        // Only set the direction pins if the state changed (disabling the coil first)
+        if (desiredState != previousCoilStateA) {
+            analogSetTicks(&PWMCurrentPinInfoA, 0);
+            coilDirectionPort -> BSRR = coilABSRR[desiredState];
+            previousCoilStateA = desiredState;
+        }
+
+        // Update the compare register with the correct current
+        analogSetTicks(&PWMCurrentPinInfoA, compareValue);
+        #endif
+
+    #else // ! ENABLE_DIRECT_COIL_OUTPUT
+
+        // Check if the desired coil state is different from the previous, if so, we need to set the output pins
+        if (desiredState != previousCoilStateA) {
+
+            // Disable the coil
+            analogSet(&PWMCurrentPinInfoA, 0);
+
+            // Decide the state of the direction pins
+            if (desiredState == FORWARD) {
+                GPIO_WRITE(COIL_A_DIR_1_PIN, HIGH);
+                GPIO_WRITE(COIL_A_DIR_2_PIN, LOW);
+            }
+            else if (desiredState == BACKWARD) {
+                GPIO_WRITE(COIL_A_DIR_1_PIN, LOW);
+                GPIO_WRITE(COIL_A_DIR_2_PIN, HIGH);
+            }
+            else if (desiredState == BRAKE) {
+                GPIO_WRITE(COIL_A_DIR_1_PIN, HIGH);
+                GPIO_WRITE(COIL_A_DIR_2_PIN, HIGH);
+            }
+            else if (desiredState == COAST) {
+                GPIO_WRITE(COIL_A_DIR_1_PIN, LOW);
+                GPIO_WRITE(COIL_A_DIR_2_PIN, LOW);
+            }
+
+            // Update the previous state of the coil with the new one
+            previousCoilStateA = desiredState;
+        }
+
+        // Update the output pin with the correct current
+        analogSet(&PWMCurrentPinInfoA, compareValue);
+    #endif // ! ENABLE_DIRECT_COIL_OUTPUT
+}
+
+
+
+// Function for setting the B coil state and current
+void StepperMotor::setCoilB(COIL_STATE desiredState, uint16_t current) {
+
+    // Convert the current, then set the coil
+    setCoilBOutput(desiredState, currentToCompare(current));
+}
+
+
+// Sets the state and output value of the B coil
+void StepperMotor::setCoilBOutput(COIL_STATE desiredState, uint32_t compareValue) {
+
+    // Write the registers directly
+    #ifdef ENABLE_DIRECT_COIL_OUTPUT
+
+        // Latch the coil for the next PWM period
+        #ifdef ENABLE_PWM_SYNC_OUTPUT
+            latchCoilOutput(1, previousCoilStateB, desiredState, compareValue, coilBBSRR);
+        #else
+
+        // Only set the direction pins if the state changed (disabling the coil first)
+        if (desiredState != previousCoilStateB) {
+            analogSetTicks(&PWMCurrentPinInfoB, 0);
+            coilDirectionPort -> BSRR = coilBBSRR[desiredState];
+            previousCoilStateB = desiredState;
+        }
+
+        // Update the compare register with the correct current
+        analogSetTicks(&PWMCurrentPinInfoB, compareValue);
+        #endif
+
+    #else // ! ENABLE_DIRECT_COIL_OUTPUT
+
+        // Check if the desired coil state is different from the previous, if so, we need to set the output pins
+        if (desiredState != previousCoilStateB) {
+
+            // Disable the coil
+            analogSet(&PWMCurrentPinInfoB, 0);
+
+            // Decide the state of the direction pins
+            if (desiredState == FORWARD) {
+                GPIO_WRITE(COIL_B_DIR_1_PIN, HIGH);
+                GPIO_WRITE(COIL_B_DIR_2_PIN, LOW);
+            }
+            else if (desiredState == BACKWARD) {
+                GPIO_WRITE(COIL_B_DIR_1_PIN, LOW);
+                GPIO_WRITE(COIL_B_DIR_2_PIN, HIGH);
+            }
+            else if (desiredState == BRAKE) {
+                GPIO_WRITE(COIL_B_DIR_1_PIN, HIGH);
+                GPIO_WRITE(COIL_B_DIR_2_PIN, HIGH);
+            }
+            else if (desiredState == COAST) {
+                GPIO_WRITE(COIL_B_DIR_1_PIN, LOW);
+                GPIO_WRITE(COIL_B_DIR_2_PIN, LOW);
+            }
+
+            // Update the previous state of the coil with the new one
+            previousCoilStateB = desiredState;
+        }
+
+        // Update the output pin with the correct current
+        analogSet(&PWMCurrentPinInfoB, compareValue);
+    #endif // ! ENABLE_DIRECT_COIL_OUTPUT
+}
+
 
 
 // Calculates the current of each of the coils (with mapping)(current in mA)
@@ -640,6 +2239,59 @@ uint32_t StepperMotor::currentToPWM(uint16_t current) const {
 }
 
 
+// Calculates the output value of a coil for an input current (timer ticks with direct outputs, otherwise the PWM setting)
+uint32_t StepperMotor::currentToCompare(uint16_t current) const {
+    #if defined(ENABLE_ADAPTIVE_PWM)
+        // Straight to ticks at the period of the mode, without the rounding to the PWM setting
+        return min(((uint32_t)current * (this -> compareScale)) >> 16, (uint32_t)(PWMCurrentPinInfoA.instance -> ARR));
+    #elif defined(ENABLE_DIRECT_COIL_OUTPUT)
+        return analogToTicks(&PWMCurrentPinInfoA, currentToPWM(current));
+    #else
+        return currentToPWM(current);
+    #endif
+}
+
+
+// Sets the states and output values of both coils at once
+void RAMFUNC StepperMotor::setCoilOutputs(COIL_STATE stateA, uint32_t compareA, COIL_STATE stateB, uint32_t compareB) {
+
+    // Latch both coils for the next PWM period
+    #if defined(ENABLE_PWM_SYNC_OUTPUT)
+        latchCoilOutput(0, previousCoilStateA, stateA, compareA, coilABSRR);
+        latchCoilOutput(1, previousCoilStateB, stateB, compareB, coilBBSRR);
+
+    // Write the registers directly
+    #elif defined(ENABLE_DIRECT_COIL_OUTPUT)
+
+        // Collect the direction pin changes of both coils (disabling the coils that change first)
+        uint32_t directionBSRR = 0;
+        if (stateA != previousCoilStateA) {
+            analogSetTicks(&PWMCurrentPinInfoA, 0);
+            directionBSRR |= coilABSRR[stateA];
+            previousCoilStateA = stateA;
+        }
+        if (stateB != previousCoilStateB) {
+            analogSetTicks(&PWMCurrentPinInfoB, 0);
+            directionBSRR |= coilBBSRR[stateB];
+            previousCoilStateB = stateB;
+        }
+
+        // Set all of the changed direction pins at once
+        if (directionBSRR != 0) {
+            coilDirectionPort -> BSRR = directionBSRR;
+        }
+
+        // Update the compare registers with the correct currents
+        analogSetTicks(&PWMCurrentPinInfoA, compareA);
+        analogSetTicks(&PWMCurrentPinInfoB, compareB);
+
+    #else // ! ENABLE_DIRECT_COIL_OUTPUT
+        setCoilAOutput(stateA, compareA);
+        setCoilBOutput(stateB, compareB);
+    #endif // ! ENABLE_DIRECT_COIL_OUTPUT
+}
+
+
 // Sets a new motor state
 void StepperMotor::setState(MOTOR_STATE newState, bool clearErrors) {
 
@@ -653,22 +2305,18 @@ void StepperMotor::setState(MOTOR_STATE newState, bool clearErrors) {
                 // Need to clear the disabled state and start the coils
                 case ENABLED:
 
-                    // Drive the coils the current angle of the shaft (just locks the output in place)
-                    driveCoilsAngle(encoder.getRawAngleAvg());
-
-                    // The motor's current angle needs corrected
-                    currentAngle = encoder.getRawAngleAvg();
+                    // Give the encoder another chance, then drive the coils the current angle of the shaft (just locks the output in place)
+                    encoder.clearHealthFault();
+                    driveCoilsCounts(encoder.getCalibratedIncrements());
                     this -> state = ENABLED;
                     break;
 
                 // Same as enabled, just forced
                 case FORCED_ENABLED:
 
-                    // Drive the coils the current angle of the shaft (just locks the output in place)
-                    driveCoilsAngle(encoder.getRawAngleAvg());
-
-                    // The motor's current angle needs corrected
-                    currentAngle = encoder.getRawAngleAvg();
+                    // Give the encoder another chance, then drive the coils the current angle of the shaft (just locks the output in place)
+                    encoder.clearHealthFault();
+                    driveCoilsCounts(encoder.getCalibratedIncrements());
                     this -> state = FORCED_ENABLED;
                     break;
 
@@ -691,10 +2339,7 @@ void StepperMotor::setState(MOTOR_STATE newState, bool clearErrors) {
                     case ENABLED:
 
                         // Drive the coils the current angle of the shaft (just locks the output in place)
-                        driveCoilsAngle(encoder.getRawAngleAvg());
-
-                        // The motor's current angle needs corrected
-                        currentAngle = encoder.getRawAngleAvg();
+                        driveCoilsCounts(encoder.getCalibratedIncrements());
                         this -> state = ENABLED;
                         break;
 
@@ -717,67 +2362,174 @@ MOTOR_STATE StepperMotor::getState() const {
 }
 
 
-// Calibrates the encoder and the PID loop
-void StepperMotor::calibrate() {
+// Measures the averaged increments of the encoder (averaged relative to the reference, so it is safe across the wrap)
+uint16_t StepperMotor::measureIncrements() {
 
-    // Only include if specified
-    #ifdef ENABLE_OLED
+    // Use the first reading as the reference
+    uint16_t reference = encoder.getRawIncrements();
+    int32_t deltaTotal = 0;
 
-        // Display that calibration is coming soon
-        clearOLED();
-        writeOLEDString(0, 0,               F("Starting"), false);
-        writeOLEDString(0, LINE_HEIGHT * 1, F("Do not move"), false);
-        writeOLEDString(0, LINE_HEIGHT * 2, F("motor shaft"), true);
+    // Sum the differences of the following readings
+    for (uint8_t readings = 0; readings < ANGLE_AVG_READINGS; readings++) {
+        deltaTotal += INCREMENT_DELTA(reference, encoder.getRawIncrements());
+    }
+
+    // Apply the average difference to the reference
+    return (reference + (deltaTotal / ANGLE_AVG_READINGS)) & DELETE_BIT_15;
+}
+
+
+// Detent torque compensation
+#ifdef ENABLE_DETENT_COMPENSATION
+// Measures the averaged electrical phase of the rotor (from the calibrated step offset, the phase that the coils would hold it at)
+uint16_t StepperMotor::measureRotorPhase() {
+    return (encoder.calibrateIncrements(measureIncrements()) * (this -> countPhaseScale));
+}
+
+
+// Sets the offset of a point of the detent table (phase)
+void StepperMotor::setDetentOffset(uint8_t point, int16_t offset) {
+    this -> detentTable[point & (DETENT_TABLE_SIZE - 1)] = offset;
+}
+
+
+// Gets the offset of a point of the detent table (phase)
+int16_t StepperMotor::getDetentOffset(uint8_t point) const {
+    return (this -> detentTable[point & (DETENT_TABLE_SIZE - 1)]);
+}
+#endif
+
+
+// Waveform shaping
+#ifdef ENABLE_WAVEFORM_SHAPING
+// Sets the shape of the waveform (fractions of the sine), rebuilding the coil drive table with it
+void StepperMotor::setWaveformShape(float thirdHarmonic, float coilBalance) {
+    this -> waveformThirdHarmonic = constrain(thirdHarmonic, -WAVEFORM_MAX_SHAPE, WAVEFORM_MAX_SHAPE);
+    this -> waveformBalance = constrain(coilBalance, -WAVEFORM_MAX_SHAPE, WAVEFORM_MAX_SHAPE);
+    buildCoilTable();
+}
+
+
+// Gets the third harmonic of the waveform (fraction of the sine)
+float StepperMotor::getWaveformThirdHarmonic() const {
+    return (this -> waveformThirdHarmonic);
+}
+
+
+// Gets the balance of coil A over coil B (fraction of the sine, B is lowered by as much as A is raised)
+float StepperMotor::getWaveformBalance() const {
+    return (this -> waveformBalance);
+}
+#endif
 
+
+// Starts the position over from where the shaft is now (both the desired and encoder positions are zeroed)
+void StepperMotor::resetPosition() {
+
+    // Zero the encoder, then the step counts to match
+    encoder.zero();
+    setHardStepCNT(0);
+    this -> softStepCNT = 0;
+    #ifdef ENABLE_HARDWARE_STEP_COUNTING
+        this -> lastHardStepCNT = 0;
     #endif
+}
 
-    // Wait for the user to take their hands away
-    delay(3000);
 
-    // Disable the motor timers (the motor needs to be left alone during calibration)
-    disableMotorTimers();
+// Sets the desired and the counted steps to where they were before the power was lost
+#ifdef ENABLE_POWER_LOSS_SAVE
+void StepperMotor::restoreStepCounts(int32_t softStepCNT, int32_t hardStepCNT) {
+    setHardStepCNT(hardStepCNT);
+    this -> softStepCNT = softStepCNT;
+    #ifdef ENABLE_HARDWARE_STEP_COUNTING
+        this -> lastHardStepCNT = hardStepCNT;
+    #endif
+}
+#endif
 
-    // Set the coils of the motor to move to step 0 (meaning the separation between full steps)
-    driveCoils(0);
 
-    // Delay three seconds, giving the motor time to settle
-    delay(3000);
+// Encoder linearization
+#ifdef ENABLE_ENCODER_LINEARIZATION
 
-    // Force the encoder to be read a couple of times, wiping the previous position out of the average
-    // (this reading needs to be as precise as possible)
-    for (uint8_t readings = 0; readings < (ANGLE_AVG_READINGS * 2); readings++) {
+// Builds a table that corrects the encoder's increments from the increments measured at each full step of a rotation
+// The table is indexed by the raw increments and each entry is the offset to the ideal increments at that point
+void StepperMotor::buildLinearizationTable(const uint16_t *stepIncrements, int32_t fullSteps, int16_t *table) {
 
-        // Get the angle, then wait for 10ms to allow encoder to update
-        encoder.getRawAngleAvg();
-    }
+    // The starting point is step 0
+    uint16_t startIncrements = stepIncrements[0];
+    uint16_t lastIncrements = startIncrements;
 
-    // Measure encoder offset
-    float stepOffset = encoder.getRawAngleAvg();
+    // Unwrapped distance from the starting point (measured and ideal) of the last step
+    int32_t lastMeasured = 0;
+    int32_t lastIdeal = 0;
 
-    // Add/subtract the full step angle till the rawStepOffset is within the range of a full step
-    while (stepOffset < 0) {
-        stepOffset += (this -> fullStepAngle);
-    }
-    while (stepOffset > (this -> fullStepAngle)) {
-        stepOffset -= (this -> fullStepAngle);
-    }
+    // The direction that the encoder moves when stepping forward (found on the first step)
+    int8_t direction = 0;
+
+    // The next table bin to fill and its unwrapped distance from the starting point
+    int32_t nextBin = 0;
+    int32_t nextBinDistance = 0;
+    uint16_t filledBins = 0;
+
+    // Move through each full step, with the last step landing back on the starting point
+    for (int32_t step = 1; step <= fullSteps; step++) {
+
+        // Find how far the step moved from the last one
+        uint16_t currentIncrements = stepIncrements[step % fullSteps];
+        int16_t incrementChange = INCREMENT_DELTA(lastIncrements, currentIncrements);
+        lastIncrements = currentIncrements;
+
+        // The first step sets the direction, then the first bin at or after the start in that direction
+        if (direction == 0) {
+            direction = (incrementChange < 0 ? -1 : 1);
+            if (direction > 0) {
+                nextBin = ((startIncrements + ENCODER_LINEAR_BIN_SIZE - 1) >> ENCODER_LINEAR_BIN_POWER) & (ENCODER_LINEAR_TABLE_SIZE - 1);
+                nextBinDistance = ((nextBin << ENCODER_LINEAR_BIN_POWER) - startIncrements) & DELETE_BIT_15;
+            }
+            else {
+                nextBin = startIncrements >> ENCODER_LINEAR_BIN_POWER;
+                nextBinDistance = (startIncrements - (nextBin << ENCODER_LINEAR_BIN_POWER)) & DELETE_BIT_15;
+            }
+        }
+
+        // Unwrapped measured and ideal distances of this step
+        int32_t measured = lastMeasured + (direction * incrementChange);
+        int32_t ideal = (step * ENCODER_COUNTS_PER_REV) / fullSteps;
+
+        // Skip the step if the motor didn't move forward from the last one
+        if (measured <= lastMeasured) {
+            continue;
+        }
 
-    // Calibrate PID loop
+        // Fill all of the bins before this step (the last step fills the rest of the table)
+        while ((filledBins < ENCODER_LINEAR_TABLE_SIZE) && ((nextBinDistance < measured) || (step == fullSteps))) {
 
-    // Erase all of the written parameters
-    // ! Just a quick fix, needs a better fix later
-    eraseParameters();
+            // Interpolate the ideal distance of the bin between the two steps
+            int32_t binIdeal = lastIdeal + (((nextBinDistance - lastMeasured) * (ideal - lastIdeal)) / (measured - lastMeasured));
 
-    // Write the step offset into the flash
-    writeFlash(STEP_OFFSET_INDEX, stepOffset);
+            // Save the correction (the difference from the ideal), then move to the next bin
+            table[nextBin] = constrain(direction * (binIdeal - nextBinDistance), INT16_MIN, INT16_MAX);
+            nextBin = (nextBin + direction) & (ENCODER_LINEAR_TABLE_SIZE - 1);
+            nextBinDistance += ENCODER_LINEAR_BIN_SIZE;
+            filledBins++;
+        }
 
-    // Write that the module is configured
-    writeFlash(CALIBRATED_INDEX, true);
+        // Move on from this step
+        lastMeasured = measured;
+        lastIdeal = ideal;
+    }
 
-    // Reboot the chip
-    NVIC_SystemReset();
+    // Fill any bins that couldn't be measured (motor didn't move) with no correction
+    if (filledBins < ENCODER_LINEAR_TABLE_SIZE) {
+        for (uint16_t bin = 0; bin < ENCODER_LINEAR_TABLE_SIZE; bin++) {
+            table[bin] = 0;
+        }
+    }
 }
 
+#endif // ! ENABLE_ENCODER_LINEARIZATION
+
+
 // Returns -1 if the number is less than 0, 1 otherwise
 int32_t StepperMotor::getSign(float num) {
     if (num < 0) {
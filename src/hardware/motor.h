@@ -4,6 +4,10 @@
 
 #include "Arduino.h"
 #include "HardwareTimer.h"
+
+// Placement new (the timers are constructed in static storage)
+#include <new>
+
 #include "encoder.h"
 #include "fastAnalogWrite.h"
 #include "stm32f1xx_hal_tim.h"
@@ -13,12 +17,63 @@
 //#include <math.h>
 #include "fastSine.h"
 
+// Math of the coil drive table
+#include "coilTable.h"
+
 // Import the pin mapping
 #include "config.h"
 
 // Maximum value for timer counters
 #define TIM_MAX_VALUE (uint16_t)65535
 
+// Fixed point format of the microstep multiplier and the step phase accumulator, along with the math of the steps
+#include "stepMath.h"
+
+// Step settings (changeable, or fixed when compiling)
+#include "motorConfig.h"
+
+// Full scale of the idle current reduction and the current boost (Q16)
+#if defined(ENABLE_IDLE_CURRENT) || defined(ENABLE_CURRENT_ON_DEMAND) || defined(ENABLE_SPEED_CURRENT_BOOST) || defined(ENABLE_THERMAL_MODEL)
+    #define CURRENT_SCALE_FULL (1UL << MULTIPLIER_Q_POWER)
+#endif
+
+// Thermal model fixed point (the rise is in tenths of a degree, Q16, and moves by 2^-32 of the gap each update, per 1 / (update rate * time constant))
+#ifdef ENABLE_THERMAL_MODEL
+    #define THERMAL_TICKS   (CONTROL_LOOP_FREQ / THERMAL_UPDATE_FREQ)
+    #define THERMAL_ALPHA_Q ((int64_t)((4294967296.0 / ((double)THERMAL_UPDATE_FREQ * THERMAL_TIME_CONSTANT)) + 0.5))
+#endif
+#ifdef ENABLE_CURRENT_ON_DEMAND
+    #define DEMAND_DECAY_TICKS max(((uint32_t)DEMAND_DECAY_TIME * CONTROL_LOOP_FREQ) / 1000, (uint32_t)1)
+#endif
+#ifdef ENABLE_IDLE_CURRENT
+    #define IDLE_CURRENT_RAMP_TICKS max(((uint32_t)IDLE_CURRENT_RAMP_TIME * CONTROL_LOOP_FREQ) / 1000, (uint32_t)1)
+#endif
+
+// Band of the torque mode's speed limit (counts/s)
+#ifdef ENABLE_TORQUE_MODE
+    #define TORQUE_SPEED_BAND_COUNTS (((int32_t)TORQUE_SPEED_LIMIT_BAND * ENCODER_COUNTS_PER_REV) / 60)
+#endif
+
+// Field oriented controller gains (Q16)
+#ifdef ENABLE_FOC
+    #define FOC_P_GAIN_Q ((int32_t)((FOC_P_GAIN) * (1UL << MULTIPLIER_Q_POWER)))
+    #define FOC_D_GAIN_Q ((int32_t)((FOC_D_GAIN) * (1UL << MULTIPLIER_Q_POWER)))
+#endif
+
+// Cascaded controller gains (Q16)
+#ifdef ENABLE_CASCADED_CONTROL
+    #define CASCADE_POSITION_GAIN_Q ((int32_t)((CASCADE_POSITION_GAIN) * (1UL << MULTIPLIER_Q_POWER)))
+    #define CASCADE_VELOCITY_P_Q    ((int32_t)((CASCADE_VELOCITY_P) * (1UL << MULTIPLIER_Q_POWER)))
+    #define CASCADE_VELOCITY_I_Q    ((int32_t)((CASCADE_VELOCITY_I) * (1UL << MULTIPLIER_Q_POWER)))
+    #define CASCADE_ACCEL_FEED_Q    ((int32_t)((CASCADE_ACCEL_FEED) * (1UL << MULTIPLIER_Q_POWER)))
+#endif
+
+// Points of the detent table, and the phase between them
+#ifdef ENABLE_DETENT_COMPENSATION
+    #define DETENT_TABLE_SIZE   (1 << DETENT_TABLE_POWER)
+    #define DETENT_POINT_POWER  (PHASE_POWER - DETENT_TABLE_POWER)
+#endif
+
 // Enumeration for coil states
 typedef enum {
     COIL_NOT_SET,
@@ -28,6 +83,20 @@ typedef enum {
     COAST
 } COIL_STATE;
 
+// A point of the current boost table, the current at a speed as a percentage of the set current (packed into a flash parameter)
+#ifdef ENABLE_SPEED_CURRENT_BOOST
+typedef struct {
+    uint16_t rpm;
+    uint16_t percent;
+} currentBoostPoint;
+#endif
+
+// Modes of the PWM (ENABLE_ADAPTIVE_PWM)
+typedef enum {
+    PWM_MODE_SMOOTH,  // Low speeds, the full resolution of a slower PWM, and the coils brake as they cross zero (slow decay)
+    PWM_MODE_FAST     // High speeds, MOTOR_PWM_FREQ, and the coils coast as they cross zero (fast decay)
+} PWM_MODE;
+
 // Enumeration for stepping direction
 typedef enum {
     PIN,
@@ -46,10 +115,14 @@ typedef enum {
     #ifdef ENABLE_OVERTEMP_PROTECTION
     , OVERTEMP
     #endif
+
+    // The encoder is unhealthy (too many missed reads or errors, see ENCODER_MAX_MISSED_READS), the coils are released until the motor is enabled again (M17)
+    , ENCODER_FAULT
 } MOTOR_STATE;
 
 // Stepper motor class (defined to make life a bit easier when dealing with the motor)
-class StepperMotor {
+// The step settings come from MotorStepConfig, which is made of constants with ENABLE_FIXED_MOTOR_CONFIG
+class StepperMotor : private MotorStepConfig {
 
     // Everything is public, with the expection of some private variables
     public:
@@ -80,9 +153,15 @@ class StepperMotor {
         // Returns the current phase setting of the motor
         int32_t getStepPhase();
 
+        // Returns the electrical phase of the coils (Q16, moved by every step)
+        uint32_t getCoilPhase() const;
+
         // Returns the desired angle of the motor
         float getDesiredAngle();
 
+        // Returns the desired position of the motor in encoder counts (2^15 per revolution)
+        int32_t getDesiredCounts();
+
         // Returns the desired step of the motor
         int32_t getSoftStepCNT();
 
@@ -116,6 +195,9 @@ class StepperMotor {
         // Sets the max current factor for dynamic current
         void setDynamicMaxCurrent(uint16_t newMaxCurrent);
 
+        // Computes the dynamic current setpoint from the acceleration (called every correction, the step interrupt only reads it)
+        void updateDynamicCurrent();
+
         #else // ! ENABLE_DYNAMIC_CURRENT
 
         // Gets the RMS current of the motor (in mA)
@@ -131,6 +213,44 @@ class StepperMotor {
         void setPeakCurrent(uint16_t peakCurrent);
         #endif
 
+        #ifdef ENABLE_IDLE_CURRENT
+        // Lowers the current once the motor has been idle, restoring it when the error grows (called every correction)
+        void updateIdleCurrent(int32_t stepError);
+
+        // Restores the full current without driving the coils, and restarts the idle timer (used when the motor is disabled)
+        void resetIdleCurrent();
+
+        // Gets the holding current, as a percent of the running current
+        uint8_t getIdleCurrentPercent() const;
+
+        // Sets the holding current, as a percent of the running current (1 to 100)
+        void setIdleCurrentPercent(uint8_t percent);
+
+        // Gets the time without motion before the current is lowered (ms)
+        uint32_t getIdleCurrentDelay() const;
+
+        // Sets the time without motion before the current is lowered (ms)
+        void setIdleCurrentDelay(uint32_t delay);
+        #endif
+
+        #ifdef ENABLE_CURRENT_ON_DEMAND
+        // Raises the current with the error and its growth, decaying back to the base once it settles (called every correction)
+        void updateDemandCurrent(int32_t stepError);
+
+        // Gets or sets the base current (% of the set current, 1 to 100)
+        uint8_t getDemandBaseCurrent() const;
+        void setDemandBaseCurrent(uint8_t percent);
+
+        // Gets or sets the current added per microstep of error, and per microstep of growth since the last correction (% of the set current)
+        uint16_t getDemandErrorGain() const;
+        void setDemandErrorGain(uint16_t percent);
+        uint16_t getDemandGrowthGain() const;
+        void setDemandGrowthGain(uint16_t percent);
+
+        // Gets the current that is being applied (% of the set current)
+        uint16_t getDemandCurrent() const;
+        #endif
+
 
         // Gets the microstepping mode of the motor
         uint16_t getMicrostepping() const;
@@ -163,6 +283,24 @@ class StepperMotor {
         // Get if the motor enable pin is inverted
         bool getEnableInversion() const;
 
+        // Sets the digital filter of TIM2's step input (0 to 15, see DEFAULT_STEP_FILTER), returning false if it is out of range
+        bool setStepFilter(uint8_t filter);
+
+        // Gets the digital filter of TIM2's step input
+        uint8_t getStepFilter() const;
+
+        // Statistics of the step input
+        #ifdef ENABLE_STEP_GLITCH_STATS
+            // Compares the pulses of the step pin with TIM2's count once the window has passed (called every correction)
+            void updateStepGlitchStats();
+
+            // Gets a summary of the glitches (the pulses that TIM2 and the step pin don't agree on), and the fastest rate without any
+            String getStepGlitchStats() const;
+
+            // Clears the statistics
+            void resetStepGlitchStats();
+        #endif
+
         // Set the microstep multiplier
         void setMicrostepMultiplier(float newMultiplier);
 
@@ -175,11 +313,165 @@ class StepperMotor {
         // Calculates the coil values for the motor and updates the set angle.
         void step(STEP_DIR dir = PIN, bool useMultiplier = true, bool updateDesiredPos = true);
 
+        // Moves the coils by a number of microsteps at once, without changing the desired position (counter clockwise is positive)
+        #if defined(ENABLE_CATCH_UP_CORRECTION) || defined(ENABLE_CONCURRENT_CORRECTION)
+            void moveCoils(int32_t microsteps);
+        #endif
+
+        // Moves the motor by the pulses that TIM2 has counted since the last call (called every correction)
+        #ifdef ENABLE_HARDWARE_STEP_COUNTING
+            void followHardStepCNT();
+        #endif
+
+        // Injects pulses into TIM2's count like the step pin would, moving the coils with them (used by the replay of the step stream)
+        #ifdef ENABLE_STEP_STREAM
+            void replayStepPulses(int32_t pulses);
+        #endif
+
+        // Moves the desired position and the coils by a number of microsteps at once (counter clockwise is positive, used by the gearing and the trajectories)
+        #if defined(ENABLE_CAN_GEARING) || defined(ENABLE_PVT_TRAJECTORY)
+            void followMicrosteps(int32_t microsteps);
+        #endif
+
+        // Ignores the step input (the pin and TIM2's count) while a soft limit is faulted
+        #ifdef ENABLE_SOFT_LIMITS
+            void setStepInputBlocked(bool blocked);
+            bool isStepInputBlocked() const;
+        #endif
+
+        // Interpolation of the step input
+        #ifdef ENABLE_STEP_INTERPOLATION
+            // Moves the coils toward the last step pin pulse by its share of the interval (called every correction)
+            void updateStepInterpolation();
+        #endif
+
+        // Feed forward of the step input
+        #ifdef ENABLE_STEP_FEED_FORWARD
+            // Updates the commanded velocity and acceleration from TIM2's count, then the lead of the coils (called every correction)
+            void updateStepFeedForward();
+
+            // Clears the history and the lead (the step input was paused)
+            void resetStepFeedForward();
+
+            // Gets the commanded velocity (microsteps/s) and acceleration (microsteps/s/s) of the step input
+            int32_t getStepVelocity() const;
+            int32_t getStepAccel() const;
+        #endif
+
+        // Thermal model of the coils
+        #ifdef ENABLE_THERMAL_MODEL
+            // Sums the square of the coil current, updating the model and the derating every THERMAL_TICKS (called every correction)
+            void updateThermalModel();
+
+            // Sets the temperature of the encoder that the coils heat up from (tenths of a degree C, from the temperature task)
+            void setThermalAmbient(int16_t tempTenths);
+
+            // Gets the estimated temperature of the coils (tenths of a degree C), and the current that is allowed (%)
+            int16_t getCoilTemp() const;
+            uint16_t getThermalDerating() const;
+
+            // Gets a summary of the model (the coils, the encoder, and the derating)
+            String getThermalStatus() const;
+        #endif
+
+        // Current boost at speed
+        #ifdef ENABLE_SPEED_CURRENT_BOOST
+            // Finds the boost of the current at the observer's speed (called every correction)
+            void updateCurrentBoost();
+
+            // Sets or gets a point of the table (returns false if the point doesn't exist)
+            bool setCurrentBoostPoint(uint8_t index, currentBoostPoint point);
+            currentBoostPoint getCurrentBoostPoint(uint8_t index) const;
+
+            // Gets the boost that is being applied (%)
+            uint16_t getCurrentBoost() const;
+        #endif
+
+        // Damping of the mid-band resonance
+        #ifdef ENABLE_RESONANCE_DAMPING
+            // Band-passes the observer's velocity, then holds back the coils against the ringing (called every correction)
+            void updateResonanceDamping();
+
+            // Starts the filters over from the current velocity (the correction was paused)
+            void resetResonanceDamping();
+
+            // Sets or gets the gain of the damping (us, 0 is off)
+            void setResonanceDamping(uint16_t time);
+            uint16_t getResonanceDamping() const;
+        #endif
+
         // Sets the coils to hold the motor at the desired step number
         void driveCoils(int32_t steps);
 
-        // Sets the coils to hold the motor at the desired phase angle
-        void driveCoilsAngle(float angle);
+        // Sets the coils to hold the motor at the desired electrical phase (PHASE_PER_CYCLE is 4 full steps)
+        void driveCoilsPhase(uint16_t phase);
+
+        // Sets the coils to a current vector at the electrical phase, with a peak current (in mA)
+        void driveCoilsVector(uint16_t phase, uint16_t current);
+
+        // Sets the coils to hold the motor at a shaft position, in encoder counts from the calibrated step offset
+        void driveCoilsCounts(uint16_t counts);
+
+        // Drives the coils from the rotor's angle toward the desired position, at most a full step ahead of or behind it (called every correction)
+        #ifdef ENABLE_ENCODER_COMMUTATION
+            void commutateEncoder(int32_t stepError);
+        #endif
+
+        // Drives the current vector ahead of or behind the rotor, with the current set by the position error (called every correction)
+        #ifdef ENABLE_FOC
+            void commutateFOC();
+        #endif
+
+        // Inner commutation loop
+        #ifdef ENABLE_FAST_COMMUTATION
+            // Moves the current vector of the last correction with the rotor (called from every update of TIM3, commutates on every Nth)
+            void fastCommutate();
+
+            // Finds the updates of TIM3 per commutation from the PWM's period (called whenever the period changes)
+            void updateFastCommutationRate();
+        #endif
+
+        // Torque mode
+        #ifdef ENABLE_TORQUE_MODE
+            // Drives the current vector ahead of or behind the rotor at the commanded current, cut back past the speed limit (called every correction)
+            void commutateTorque();
+
+            // Starts the mode (or changes the current), positive currents push the way that positive steps move (mA)
+            // Returns false if a direct move is running (the moves pause the correction)
+            bool setTorqueMode(int16_t current);
+
+            // Leaves the mode, taking up the step error so the motor holds where it is
+            void exitTorqueMode();
+
+            // Gets if the mode is running, the commanded current (mA), and the current that is being driven after the speed limit (mA, signed)
+            bool isTorqueModeActive() const;
+            int16_t getTorqueTarget() const;
+            int16_t getTorqueCurrent() const;
+
+            // Sets or gets the speed that the torque starts being cut back at (RPM)
+            void setTorqueSpeedLimit(uint16_t rpm);
+            uint16_t getTorqueSpeedLimit() const;
+        #endif
+
+        // Computes the signed current (mA) from the cascaded position and velocity loops (limited to the max current)
+        #ifdef ENABLE_CASCADED_CONTROL
+            int32_t computeCascadedCurrent(int32_t maxCurrent);
+        #endif
+
+        // Sets the PWM frequency of the coils again from the timer's clock (needed after the system clock is changed)
+        void updatePWMFreq();
+
+        // Adaptive PWM
+        #ifdef ENABLE_ADAPTIVE_PWM
+            // Switches the mode of the PWM from the speed of the motor (called every correction)
+            void updatePWMMode();
+
+            // Sets the mode of the PWM, loading its period and driving the coils again for it (both take effect at TIM3's next update)
+            void setPWMMode(PWM_MODE mode);
+
+            // Gets the mode of the PWM
+            PWM_MODE getPWMMode() const;
+        #endif
 
         // Sets the state of the A coil
         void setCoilA(COIL_STATE desiredState, uint16_t current = 0);
@@ -187,9 +479,19 @@ class StepperMotor {
         // Sets the state of the B coil
         void setCoilB(COIL_STATE desiredState, uint16_t current = 0);
 
+        // Sets the state and output value of each coil (in the units of currentToCompare())
+        void setCoilAOutput(COIL_STATE desiredState, uint32_t compareValue);
+        void setCoilBOutput(COIL_STATE desiredState, uint32_t compareValue);
+
+        // Sets the states and output values of both coils at once
+        void setCoilOutputs(COIL_STATE stateA, uint32_t compareA, COIL_STATE stateB, uint32_t compareB);
+
         // Calculates the correct PWM setting based on an input current
         uint32_t currentToPWM(uint16_t current) const;
 
+        // Calculates the output value of a coil for an input current (timer ticks with direct outputs, otherwise the PWM setting)
+        uint32_t currentToCompare(uint16_t current) const;
+
         // Sets the current state of the motor
         void setState(MOTOR_STATE newState, bool clearErrors = false);
 
@@ -199,14 +501,48 @@ class StepperMotor {
         // Computes the next speed of the motor
         float compute(float feedback);
 
-        // Calibrates the encoder and PID loop
-        void calibrate();
+        // Measures the averaged increments of the encoder, safe across the wrap from 2^15 to 0
+        uint16_t measureIncrements();
+
+        // Detent torque compensation
+        #ifdef ENABLE_DETENT_COMPENSATION
+
+            // Measures the averaged electrical phase of the rotor (from the calibrated step offset, the phase that the coils would hold it at)
+            uint16_t measureRotorPhase();
+
+            // Sets or gets the offset of a point of the detent table (phase, the coils are driven ahead by it at the point)
+            void setDetentOffset(uint8_t point, int16_t offset);
+            int16_t getDetentOffset(uint8_t point) const;
+        #endif
+
+        // Waveform shaping, the third harmonic and the balance of coil A over coil B (fractions of the sine, the coil drive table is rebuilt with them)
+        #ifdef ENABLE_WAVEFORM_SHAPING
+            void setWaveformShape(float thirdHarmonic, float coilBalance);
+            float getWaveformThirdHarmonic() const;
+            float getWaveformBalance() const;
+        #endif
+
+        // Starts the position over from where the shaft is now (the desired and encoder positions are both zeroed)
+        void resetPosition();
+
+        // Sets the desired and the counted steps to where they were before the power was lost (the encoder is restored separately)
+        #ifdef ENABLE_POWER_LOSS_SAVE
+        void restoreStepCounts(int32_t softStepCNT, int32_t hardStepCNT);
+        #endif
+
+        // Builds the encoder's correction table from the increments measured at each full step of a rotation (used by the calibration)
+        #ifdef ENABLE_ENCODER_LINEARIZATION
+            void buildLinearizationTable(const uint16_t *stepIncrements, int32_t fullSteps, int16_t *table);
+        #endif
 
         // Encoder object
         Encoder encoder;
 
         // Counter for number of overflows (needs to be public for the interrupt)
-        int32_t stepOverflowOffset = 0;
+        volatile int32_t stepOverflowOffset = 0;
+
+        // Incremented every time the offset changes, so readers can tell that they were interrupted
+        volatile uint32_t stepOverflowSequence = 0;
 
 
     // Things that shouldn't be accessed by the outside
@@ -215,25 +551,113 @@ class StepperMotor {
         // Function for getting the sign of the number (returns -1 if number is less than 0, 1 if 0 or above)
         int32_t getSign(float num);
 
-        // Keeps the desired angle of the motor
-        float desiredAngle = 0;
+        // Recomputes the electrical phase moved by a microstep and by a multiplied step pulse
+        #ifndef ENABLE_FIXED_MOTOR_CONFIG
+            void updateStepPhases();
+        #endif
 
-        // Keeps the desired step of the motor
-        int32_t softStepCNT = 0;
+        // Moves the desired position and the coils by a number of pulses of the step input (the reversal already applied)
+        #if defined(ENABLE_HARDWARE_STEP_COUNTING) || defined(ENABLE_STEP_STREAM)
+            void movePulses(int32_t pulses);
+        #endif
 
-        // Keeps the current angle of the motor
-        float currentAngle = 0;
+        // Keeps the desired step of the motor (the desired angle is computed from it)
+        int32_t softStepCNT = 0;
 
         // Keeps the current steps of the motor
         int32_t currentStep = 0;
 
+        // The hardware step count when the coils were last moved to it
+        #ifdef ENABLE_HARDWARE_STEP_COUNTING
+            int32_t lastHardStepCNT = 0;
+        #endif
+
+        // If the step input is being ignored (a soft limit faulted)
+        #ifdef ENABLE_SOFT_LIMITS
+            volatile bool stepInputBlocked = false;
+        #endif
+
+        // Leftover fraction of a microstep from fractional multipliers (Q16, always positive)
+        uint32_t stepFraction = 0;
+
+        // Electrical phase of the coils (Q16, the upper half is the phase passed to driveCoilsPhase())
+        uint32_t coilPhase = 0;
+
+        // Step interpolation state, the step interrupt moves the target (coilPhase) and the correction moves the driven phase toward it
+        #ifdef ENABLE_STEP_INTERPOLATION
+            volatile bool interpolating = false;                // If the coils are still being moved toward the last pulse
+            uint32_t drivenPhase = 0;                           // Electrical phase that the coils are driven at (Q16, like coilPhase)
+            volatile uint32_t interpStepPhase = 0;              // Phase of the last pulse (Q16)
+            volatile uint32_t interpStepInterval = 1;           // Interval before the last pulse (cycles)
+            uint32_t lastInterpStepCycles = 0;                  // Cycle count at the last pulse
+        #endif
+
+        // Feed forward state
+        #ifdef ENABLE_STEP_FEED_FORWARD
+            int32_t feedLastCount = 0;                          // TIM2's count at the last correction
+            int16_t feedDeltas[1 << STEP_FF_TAPS_POWER] = {};   // Pulses counted in each of the last corrections
+            uint8_t feedIndex = 0;                              // Next slot of the deltas
+            int32_t feedSum = 0;                                // Sum of the deltas
+            int32_t feedVelocity = 0;                           // Commanded velocity (microsteps/s)
+            int32_t feedAccel = 0;                              // Filtered commanded acceleration (microsteps/s/s)
+            volatile int16_t leadPhase = 0;                     // Electrical phase that the coils are led ahead by, shared with the step interrupt
+        #endif
+
+        // Thermal model state
+        #ifdef ENABLE_THERMAL_MODEL
+            uint64_t thermalCurrentSum = 0;                        // Sum of the squared current since the last update (mA^2)
+            uint32_t thermalTicks = 0;                             // Corrections since the last update
+            int64_t thermalRise = 0;                               // Rise of the coils above the encoder (tenths of a degree, Q16)
+            volatile int16_t thermalAmbient = 250;                 // Temperature of the encoder (tenths of a degree)
+            volatile uint32_t thermalScale = CURRENT_SCALE_FULL;   // Scale applied to the coil current (Q16), shared with the step interrupt
+        #endif
+
+        // Torque mode state
+        #ifdef ENABLE_TORQUE_MODE
+            volatile bool torqueModeActive = false;             // Read by the step interrupt, which leaves the coils alone in the mode
+            volatile int16_t torqueTarget = 0;                  // Commanded current (mA, signed)
+            volatile int16_t torqueCurrent = 0;                 // Current driven by the last correction (mA, signed)
+            int32_t torqueSpeedLimit = ((int32_t)DEFAULT_TORQUE_SPEED_LIMIT * ENCODER_COUNTS_PER_REV) / 60; // counts/s
+        #endif
+
+        // Current boost state
+        #ifdef ENABLE_SPEED_CURRENT_BOOST
+            currentBoostPoint boostTable[CURRENT_BOOST_POINTS];
+            volatile uint32_t boostScale = CURRENT_SCALE_FULL;  // Scale applied to the coil current (Q16), shared with the step interrupt
+        #endif
+
+        // Resonance damping state (the filters are in counts/s, Q4)
+        #ifdef ENABLE_RESONANCE_DAMPING
+            int32_t resonanceSlow = 0;                          // Slow filter of the velocity (the commanded motion)
+            int32_t resonanceFast = 0;                          // Fast filter of the velocity (the ringing and the commanded motion)
+            uint16_t resonanceDampingTime = RESONANCE_DAMPING_TIME;
+            volatile int16_t dampingPhase = 0;                  // Electrical phase that the coils are held back by, shared with the step interrupt
+        #endif
+
+        // Inner commutation state, only written by the correction and TIM3's update interrupt (they share a priority)
+        #ifdef ENABLE_FAST_COMMUTATION
+            uint8_t fastDivider = 1;     // Updates of TIM3 per commutation
+            uint8_t fastCountdown = 1;   // Updates left until the next commutation
+            uint8_t fastHoldTicks = 1;   // Commutations that a current vector is held for (FAST_COMMUTATION_HOLD corrections)
+            uint8_t fastHold = 0;        // Commutations left of the current vector
+            uint16_t fastCurrent = 0;    // Current of the vector (mA)
+            int16_t fastLead = 0;        // Electrical phase that the vector leads the rotor by
+        #endif
+
+        // Cascaded controller state
+        #ifdef ENABLE_CASCADED_CONTROL
+            int32_t lastDesiredCounts = 0;  // Desired position of the last loop (counts)
+            int32_t feedVelocity = 0;       // Filtered commanded velocity (counts/s)
+            int64_t velocityIntegral = 0;   // Velocity loop integral (mA, Q16)
+        #endif
+
         #ifdef ENABLE_STEPPING_VELOCITY
             // variables to calculate the stepping interface velocity
             float angleChange = 0.0;
             uint32_t prevStepingSampleTime = 0; // micros()
             uint32_t nowStepingSampleTime = 0; // micros()
             // isStepping == true mean that three variables above can be changed
-            bool isStepping = false;
+            volatile bool isStepping = false;
         #endif
 
         // Motor characteristics
@@ -242,6 +666,9 @@ class StepperMotor {
             uint16_t dynamicAccelCurrent = DYNAMIC_ACCEL_CURRENT;
             uint16_t dynamicIdleCurrent = DYNAMIC_IDLE_CURRENT;
             uint16_t dynamicMaxCurrent = DYNAMIC_MAX_CURRENT;
+
+            // Peak current setpoint used when driving the coils (in mA)
+            volatile uint16_t dynamicCurrent = (DYNAMIC_IDLE_CURRENT * 1.414);
         #else
             // RMS Current (in mA)
             uint16_t rmsCurrent = (uint16_t)STATIC_RMS_CURRENT;
@@ -249,50 +676,139 @@ class StepperMotor {
             uint16_t peakCurrent = (rmsCurrent * 1.414);
         #endif
 
-        // Microstepping divisor
-        uint16_t microstepDivisor = 1;
+        // Idle current reduction state
+        #ifdef ENABLE_IDLE_CURRENT
+            // Scale applied to the coil current (Q16, full scale is the running current), shared with the step interrupt
+            volatile uint32_t currentScale = CURRENT_SCALE_FULL;
+
+            // Holding current scale (Q16), and the amount that the scale drops each correction while ramping
+            uint32_t idleCurrentScale = ((CURRENT_SCALE_FULL * IDLE_CURRENT_PERCENT) / 100);
+            uint32_t idleCurrentRampStep = (CURRENT_SCALE_FULL - ((CURRENT_SCALE_FULL * IDLE_CURRENT_PERCENT) / 100)) / IDLE_CURRENT_RAMP_TICKS;
+            uint8_t idleCurrentPercent = IDLE_CURRENT_PERCENT;
+
+            // Corrections without motion needed before ramping, and the count so far
+            uint32_t idleCurrentDelayTicks = ((uint32_t)IDLE_CURRENT_DELAY * CONTROL_LOOP_FREQ) / 1000;
+            uint32_t idleTicks = 0;
+
+            // Desired step at the last correction (any change counts as commanded motion)
+            int32_t lastIdleStep = 0;
+        #endif
+
+        // Current on demand state
+        #ifdef ENABLE_CURRENT_ON_DEMAND
+            // Scale applied to the coil current (Q16, full scale is the set current), shared with the step interrupt
+            volatile uint32_t demandScale = ((CURRENT_SCALE_FULL * DEMAND_BASE_CURRENT) / 100);
 
-        // Angle of a full step
-        float fullStepAngle = 1.8;
+            // Base scale, and the amount that the scale drops each correction while decaying (Q16)
+            uint32_t demandBaseScale = ((CURRENT_SCALE_FULL * DEMAND_BASE_CURRENT) / 100);
+            uint32_t demandDecayStep = (CURRENT_SCALE_FULL - ((CURRENT_SCALE_FULL * DEMAND_BASE_CURRENT) / 100)) / DEMAND_DECAY_TICKS;
+            uint8_t demandBasePercent = DEMAND_BASE_CURRENT;
 
-        // Microstep angle (full step / microstepping divisor)
-        float microstepAngle = getFullStepAngle() / getMicrostepping();
+            // Scale added per microstep of error and of growth (Q16)
+            uint16_t demandErrorPercent = DEMAND_ERROR_GAIN;
+            uint16_t demandGrowthPercent = DEMAND_GROWTH_GAIN;
+            uint32_t demandErrorGain = ((CURRENT_SCALE_FULL * DEMAND_ERROR_GAIN) / 100);
+            uint32_t demandGrowthGain = ((CURRENT_SCALE_FULL * DEMAND_GROWTH_GAIN) / 100);
 
-        // Microstep count in a full rotation
-        int32_t microstepsPerRotation = (360.0 / getMicrostepAngle());
+            // Size of the error at the last correction (microsteps)
+            int32_t lastDemandError = 0;
+        #endif
 
         // If the motor is enabled or not (saves time so that the enable and disable pins are only set once)
         MOTOR_STATE state = MOTOR_NOT_SET;
 
-        // reversed is a multiplier for steps and angles
-        // 1 - If the motor direction is normal
-        // -1 - If the motor direction is inverted
-        int8_t reversed = 1;
-
         // If the motor enable is inverted
         bool enableInverted = false;
 
-        // Microstep multiplier (used to move a custom number of microsteps per step pulse)
-        uint32_t microstepMultiplier = MICROSTEP_MULTIPLIER;
+        // Digital filter of TIM2's step input
+        uint8_t stepFilter = DEFAULT_STEP_FILTER;
+
+        // Statistics of the step input
+        #ifdef ENABLE_STEP_GLITCH_STATS
+            volatile int32_t stepPinCount = 0;  // Pulses of the step pin's interrupt, signed by the direction pin (with the reversal)
+            uint32_t glitchWindowTicks = 0;     // Corrections since the start of the window
+            int32_t glitchLastMismatch = 0;     // Difference between the step pin and TIM2 at the start of the window
+            int32_t glitchLastHardCount = 0;    // TIM2's count at the start of the window
+            uint32_t glitches = 0;              // Pulses that TIM2 and the step pin didn't agree on
+            uint32_t glitchWindows = 0;         // Windows with a glitch
+            uint32_t maxCleanRate = 0;          // Fastest rate of a window without any glitches (pulses/s)
+            uint32_t minGlitchRate = UINT32_MAX; // Slowest rate of a window with a glitch (pulses/s)
+        #endif
 
         // Analog info structures for PWM current pins
         analogInfo PWMCurrentPinInfoA;
         analogInfo PWMCurrentPinInfoB;
 
+        // Adaptive PWM state
+        #ifdef ENABLE_ADAPTIVE_PWM
+            PWM_MODE pwmMode = PWM_MODE_SMOOTH;
+            uint32_t smoothPWMPeriod = 1;           // Periods of each mode (TIM3 ticks)
+            uint32_t fastPWMPeriod = 1;
+            uint32_t compareScale = 0;              // TIM3 ticks per mA at the mode's period (Q16)
+            COIL_STATE zeroCurrentState = BRAKE;    // State of a coil without any current (the decay)
+        #endif
+
         // Last coil states (used to save time by not setting the pins unless necessary)
         COIL_STATE previousCoilStateA = COIL_NOT_SET;
         COIL_STATE previousCoilStateB = COIL_NOT_SET;
 
+        // The port of the direction input pin
+        GPIO_TypeDef *directionPinPort;
+
+        // The port of the direction pins (all four are set with a single write)
+        #ifdef ENABLE_DIRECT_COIL_OUTPUT
+            GPIO_TypeDef *coilDirectionPort;
+        #endif
+
+        // Phase offset of the coils at each point of the electrical cycle, against the detent torque
+        #ifdef ENABLE_DETENT_COMPENSATION
+            int16_t detentTable[DETENT_TABLE_SIZE] = { 0 };
+        #endif
+
+        // Coil drive table, the output value of a coil at each entry of the quarter sine table
+        #ifdef ENABLE_COIL_LUT
+
+            // Rebuilds the table with the current peak current
+            void buildCoilTable();
+
+            uint16_t coilCompareTable[SINE_QUARTER_COUNT + 1];
+
+            // The shape of the waveform, coil B gets a table of its own (the balance moves the coils apart)
+            #ifdef ENABLE_WAVEFORM_SHAPING
+                uint16_t coilCompareTableB[SINE_QUARTER_COUNT + 1];
+                float waveformThirdHarmonic = 0;
+                float waveformBalance = 0;
+            #endif
+
+            // Output value of the board's peak current, the most that the current boost can raise a coil to
+            #ifdef ENABLE_SPEED_CURRENT_BOOST
+                uint16_t maxCompare = 0;
+            #endif
+        #endif
+
         // Configuration for TIM2
         TIM_HandleTypeDef tim2Config;
         TIM_ClockConfigTypeDef tim2ClkConfig;
         TIM_MasterConfigTypeDef tim2MSConfig;
 
-        // HardwareTimer (required to assign interrupt)
-        HardwareTimer *tim2HWTim = new HardwareTimer(TIM2);
+        // HardwareTimer (required to assign interrupt), constructed in place so that it stays off the heap
+        alignas(HardwareTimer) uint8_t tim2HWTimStorage[sizeof(HardwareTimer)];
+        HardwareTimer *tim2HWTim = new (tim2HWTimStorage) HardwareTimer(TIM2);
 };
 
 // Overflow handler
 void overflowHandler();
 
+// TIM2's interrupt, taken from the SRAM vector table
+#ifdef ENABLE_MOTION_SAFE_FLASH
+void stepOverflowIRQHandler();
+#endif
+
+// Finds the change in the overflow offset from the counter's value just after an update event
+// The counter only moves a few counts before the interrupt runs, so it is still near the end that it wrapped to
+// (near 0 after an overflow, near the top after an underflow). This holds through direction changes, unlike TIM2's DIR bit
+inline int32_t overflowDirection(uint16_t count) {
+    return ((count < (TIM_MAX_VALUE / 2)) ? 65536 : -65536);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef __MOTOR_CONFIG_H__
+#define __MOTOR_CONFIG_H__
+
+// Import the config
+#include "config.h"
+
+// Phase of the coils and counts of the encoder
+#include "fastSine.h"
+#include "encoder.h"
+
+// Phases moved by the steps
+#include "stepMath.h"
+
+// Step settings of the motor, the StepperMotor class is built on one of these (included by motor.h)
+// The step math reads each value the same way, so it doesn't need to know which one it is using
+
+// Settings that can be changed while running (by the dips, the menu, and the commands)
+struct RuntimeMotorConfig {
+
+    // Microstepping divisor
+    uint16_t microstepDivisor = 1;
+
+    // Angle of a full step
+    float fullStepAngle = 1.8;
+
+    // Microstep angle (full step / microstepping divisor)
+    float microstepAngle = fullStepAngle / microstepDivisor;
+
+    // Microstep count in a full rotation
+    int32_t microstepsPerRotation = (360.0 / microstepAngle);
+
+    // Electrical phase per encoder count (electrical cycles, meaning 4 full steps, in a rotation * phase per cycle / counts per rotation)
+    uint16_t countPhaseScale = (uint16_t)(360.0 / (4 * fullStepAngle)) * (PHASE_PER_CYCLE / ENCODER_COUNTS_PER_REV);
+
+    // reversed is a multiplier for steps and angles
+    // 1 - If the motor direction is normal
+    // -1 - If the motor direction is inverted
+    int8_t reversed = 1;
+
+    // Microstep multiplier (used to move a custom number of microsteps per step pulse, Q16 fixed point)
+    uint32_t microstepMultiplier = (uint32_t)(MICROSTEP_MULTIPLIER * (1UL << MULTIPLIER_Q_POWER));
+
+    // Electrical phase moved by a single microstep and by a multiplied step pulse (Q16, set by updateStepPhases())
+    uint32_t microstepPhase = 0;
+    uint32_t multipliedStepPhase = 0;
+
+    // Mask that drops the phase within a microstep (used to round the phase to a microstep)
+    uint16_t microstepPhaseMask = 0xFFFF;
+};
+
+
+// Settings fixed when compiling (ENABLE_FIXED_MOTOR_CONFIG)
+// Every value is a constant, so the divisions and multiplies of the step math fold into shifts and immediates
+template <uint16_t MICROSTEPS, uint16_t FULL_STEPS, bool REVERSED, uint32_t MULTIPLIER_Q>
+struct FixedMotorConfig {
+
+    // Only the settings that the runtime version accepts
+    static_assert((MICROSTEPS >= MIN_MICROSTEP_DIVISOR) && (MICROSTEPS <= MAX_MICROSTEP_DIVISOR) && ((MICROSTEPS & (MICROSTEPS - 1)) == 0),
+                  "The fixed microstepping must be a power of 2 within MIN_MICROSTEP_DIVISOR and MAX_MICROSTEP_DIVISOR");
+    static_assert((FULL_STEPS == 200) || (FULL_STEPS == 400), "The fixed motor must have 200 (1.8°) or 400 (0.9°) full steps per rotation");
+    static_assert(MULTIPLIER_Q > 0, "The fixed microstep multiplier must be positive");
+
+    // The same values as RuntimeMotorConfig
+    static constexpr uint16_t microstepDivisor = MICROSTEPS;
+    static constexpr float fullStepAngle = (360.0f / FULL_STEPS);
+    static constexpr float microstepAngle = (fullStepAngle / MICROSTEPS);
+    static constexpr int32_t microstepsPerRotation = ((int32_t)FULL_STEPS * MICROSTEPS);
+    static constexpr uint16_t countPhaseScale = ((FULL_STEPS / 4) * (PHASE_PER_CYCLE / ENCODER_COUNTS_PER_REV));
+    static constexpr int8_t reversed = (REVERSED ? -1 : 1);
+    static constexpr uint32_t microstepMultiplier = MULTIPLIER_Q;
+    static constexpr uint32_t microstepPhase = microstepPhaseFor(MICROSTEPS);
+    static constexpr uint32_t multipliedStepPhase = multipliedStepPhaseFor(MULTIPLIER_Q, MICROSTEPS);
+    static constexpr uint16_t microstepPhaseMask = microstepPhaseMaskFor(MICROSTEPS);
+};
+
+
+// The settings that the motor is built on
+#ifdef ENABLE_FIXED_MOTOR_CONFIG
+    typedef FixedMotorConfig<FIXED_MICROSTEPPING, FIXED_FULL_STEPS, FIXED_REVERSED, (uint32_t)(MICROSTEP_MULTIPLIER * (1UL << MULTIPLIER_Q_POWER))> MotorStepConfig;
+#else
+    typedef RuntimeMotorConfig MotorStepConfig;
+#endif
+
+#endif // ! __MOTOR_CONFIG_H__
@@ -6,12 +6,51 @@
 
 // Import libraries
 #include "oled.h"
+#include "oledTransport.h"
+#include "fixedFormat.h"
+#include "calibration.h"
+#include "crc.h"
+#include "parameters.h"
 #include "cstring"
 
+#ifdef ENABLE_OLED_PAGE_STREAMING
+// Instead of a buffer of the screen, the screen is kept as a list of what was drawn on it (characters and filled boxes)
+// Each of the pages is composed from the list into a line buffer when the screen is written
+// Every item paints all of the pixels of its box, so an item hides anything drawn entirely under it (those are dropped from the list)
+typedef enum {
+    OLED_ITEM_FILL,     // A box of a color, from x, y to x2, y2
+    OLED_ITEM_CHAR_12,  // A character of the 12 pixel font at x, y
+    OLED_ITEM_CHAR_16   // A character of the 16 pixel font at x, y
+} OLED_ITEM_KIND;
+
+// Packed into a single word
+typedef struct {
+    uint32_t x     : 7;
+    uint32_t y     : 6;
+    uint32_t kind  : 2;
+    uint32_t color : 1;
+    uint32_t x2    : 7; // Index of the character in the font for characters
+    uint32_t y2    : 6;
+} oledItem;
+
+static oledItem oledItems[OLED_STREAM_ITEMS];
+static uint8_t oledItemCount = 0;
+
+// The page being sent (the transport may still be reading it in the background)
+static uint8_t oledLine[128];
+
+// CRC of each page as it was last sent, only the pages that changed are sent again
+static uint16_t pageCRC[OLED_PAGE_COUNT];
+#else
 // Screen data is stored in an array. Each set of 8 pixels is written one by one
 // Each set of 8 is stored as an integer. The panel is written to horizontally, then vertically
-// Array stores the values in width - height format with bits stored along vertical rows
-uint8_t OLEDBuffer[128][8];
+// Array stores the values in page - column format with bits stored along vertical rows, so each page can be sent as one run
+uint8_t OLEDBuffer[OLED_PAGE_COUNT][128];
+
+// The span of columns of each page that changed since it was last written (a page is clean when its start is past its end)
+static uint8_t dirtyStart[OLED_PAGE_COUNT];
+static uint8_t dirtyEnd[OLED_PAGE_COUNT];
+#endif // ! ENABLE_OLED_PAGE_STREAMING
 char outBuffer[OB_SIZE];
 
 // The index of the current top level menu item
@@ -210,37 +249,74 @@ void displayMotorData() {
         clearOLED();
     }
 
-    // RPM of the motor (RPM is capped at 2 decimal places)
-    #ifdef ENCODER_SPEED_ESTIMATION
-
-    // Check if the motor RPM can be updated. The update rate of the speed must be limited while using encoder speed estimation
-    if (motor.encoder.sampleTimeExceeded()) {
-        snprintf(outBuffer, OB_SIZE, "RPM:% 11.3f", motor.getEstimRPM());
-        writeOLEDString(0, 0, outBuffer, false);
+    // Reuse the newest sample of the control loop instead of reading the encoder again (all four lines come from the same sample)
+    EncoderSample sample = motor.encoder.getRecentSample(DISPLAY_SAMPLE_MAX_AGE);
+    int32_t counts = motor.encoder.getAbsoluteCounts(sample);
+
+    // RPM of the motor from the counts moved since the last frame (thousandths of an RPM)
+    static int32_t lastCounts = 0;
+    static uint32_t lastTime = 0;
+    uint32_t elapsed = (sample.time - lastTime);
+    int32_t rpm = 0;
+    if (lastTime != 0 && elapsed != 0) {
+        rpm = (int32_t)(((int64_t)(counts - lastCounts) * 60 * 1000 * 1000000) / ((int64_t)ENCODER_COUNTS_PER_REV * elapsed));
     }
-
-    #else // ! ENCODER_SPEED_ESTIMATION
-
-    // No need to check, just sample it
-    snprintf(outBuffer, OB_SIZE, "RPM:%11.3f", motor.getEncoderRPM());
+    lastCounts = counts;
+    lastTime = sample.time;
+    formatFixed(outBuffer + 4, OB_SIZE - 4, rpm, 3, 11);
+    memcpy(outBuffer, "RPM:", 4);
     writeOLEDString(0, 0, outBuffer, false);
 
-    #endif // ! ENCODER_SPEED_ESTIMATION
-
-    // Angle error
-    snprintf(outBuffer, OB_SIZE, "Err: % 10.2f", motor.getAngleError());
+    // Angle error (hundredths of a degree)
+    int32_t error = (int32_t)(((int64_t)(counts - motor.getDesiredCounts()) * 36000) / ENCODER_COUNTS_PER_REV);
+    formatFixed(outBuffer + 5, OB_SIZE - 5, error, 2, 10, FORMAT_SIGN_SPACE);
+    memcpy(outBuffer, "Err: ", 5);
     writeOLEDString(0, LINE_HEIGHT, outBuffer, false);
 
-    // Current angle of the motor
-    snprintf(outBuffer, OB_SIZE, "Deg: % 010.2f", motor.encoder.getAbsoluteAngleAvg());
+    // Current angle of the motor (hundredths of a degree)
+    int32_t angle = (int32_t)(((int64_t)counts * 36000) / ENCODER_COUNTS_PER_REV);
+    formatFixed(outBuffer + 5, OB_SIZE - 5, angle, 2, 10, FORMAT_SIGN_SPACE | FORMAT_ZERO_PAD);
+    memcpy(outBuffer, "Deg: ", 5);
     writeOLEDString(0, LINE_HEIGHT * 2, outBuffer, false);
 
-    // Temp of the encoder (close to the motor temp)
-    snprintf(outBuffer, OB_SIZE, "Temp:%8.1f C", motor.encoder.getTemp());
+    // Temp of the encoder (close to the motor temp, tenths of a degree)
+    uint8_t length = formatFixed(outBuffer + 5, OB_SIZE - 7, motor.encoder.getTempTenths(sample), 1, 8);
+    memcpy(outBuffer, "Temp:", 5);
+    memcpy(outBuffer + 5 + length, " C", 3);
     writeOLEDString(0, LINE_HEIGHT * 3, outBuffer, true);
 }
 
 
+// Shows the progress of the calibration (or its result once it is done)
+void displayCalibration() {
+    clearOLED();
+    switch (getCalibrationState()) {
+        case CALIBRATION_DONE:
+            writeOLEDString(0, 0,               F("Calibration"), false);
+            writeOLEDString(0, LINE_HEIGHT * 1, F("done!"), false);
+            break;
+
+        case CALIBRATION_FAILED:
+            writeOLEDString(0, 0,               F("Calibration"), false);
+            writeOLEDString(0, LINE_HEIGHT * 1, F("failed!"), false);
+            writeOLEDString(0, LINE_HEIGHT * 2, F("Check power"), false);
+            break;
+
+        default:
+            writeOLEDString(0, 0,               F("Calibrating"), false);
+            writeOLEDString(0, LINE_HEIGHT * 1, F("Do not move"), false);
+            writeOLEDString(0, LINE_HEIGHT * 2, F("motor shaft"), false);
+            snprintf(outBuffer, OB_SIZE, "%u%%", (unsigned int)getCalibrationProgress());
+            writeOLEDString(0, LINE_HEIGHT * 3, outBuffer, false);
+            break;
+    }
+    writeOLEDBuffer();
+
+    // The motor data has to clear the calibration off of the display once it is shown again
+    lastMenuDepth = WARNING;
+}
+
+
 // Display an error message
 void displayWarning(String firstLine, String secondLine, String thirdLine, bool updateScreen) {
     clearOLED();
@@ -274,10 +350,9 @@ void selectMenuItem() {
         switch(submenu % submenuCount) {
 
             case CALIBRATION:
-                // Nothing to see here, just moving into the calibration
-                motor.calibrate();
-
-                // Board is restarted, so no need to do anything here
+                // Nothing to set up, the confirmation is shown
+                menuDepth = SUBMENUS;
+                break;
 
             case CURRENT:
                 // Motor mAs. Need to get the current motor mAs, then convert that to a cursor value
@@ -346,7 +421,9 @@ void selectMenuItem() {
         switch(submenu % submenuCount) {
 
             case CALIBRATION:
-                // Nothing to see here, everything is handled on the initial press.
+                // Confirmed, start the calibration in the background, its progress is shown in place of the motor data
+                startCalibration();
+                menuDepth = MOTOR_DATA;
                 break;
 
             case CURRENT: {
@@ -393,7 +470,7 @@ void selectMenuItem() {
                 }
                 else {
                     // Set the value
-                    motor.setMicrostepping(microstepSetting);
+                    setParameter(PARAMETER_MICROSTEPPING, microstepSetting);
 
                     // Exit the menu
                     menuDepth = MENU_RETURN_LEVEL;
@@ -408,11 +485,11 @@ void selectMenuItem() {
                 if (currentCursorIndex % 2 == 0) {
 
                     // The index is even, the logic is inverted
-                    motor.setEnableInversion(true);
+                    setParameter(PARAMETER_ENABLE_INVERSION, 1);
                 }
                 else {
                     // Index is odd, the logic is normal
-                    motor.setEnableInversion(false);
+                    setParameter(PARAMETER_ENABLE_INVERSION, 0);
                 }
 
                 // Exit the menu
@@ -424,11 +501,11 @@ void selectMenuItem() {
                 if (currentCursorIndex % 2 == 0) {
 
                     // The index is even, the direction is inverted
-                    motor.setReversed(true);
+                    setParameter(PARAMETER_REVERSED, 1);
                 }
                 else {
                     // Index is odd, the direction is normal
-                    motor.setReversed(false);
+                    setParameter(PARAMETER_REVERSED, 0);
                 }
 
                 // Exit the menu
@@ -477,7 +554,7 @@ void selectMenuItem() {
             case MICROSTEP:
 
                 // Set the value
-                motor.setMicrostepping(pow(2, currentCursorIndex));
+                setParameter(PARAMETER_MICROSTEPPING, pow(2, currentCursorIndex));
 
             default:
                 // Nothing to do here, just move on
@@ -558,21 +635,9 @@ void initOLED() {
     submenu = CALIBRATION;
     currentCursorIndex = 0;
 
-    // Enable the A and B GPIO clocks
-    __HAL_RCC_GPIOA_CLK_ENABLE();
-    __HAL_RCC_GPIOB_CLK_ENABLE();
-
-    // Clear the state of pin A8 (pin states are 15, 14, 13, 12, 11, 10, 9, and 8 in groups of 4)
-    GPIOA -> CRH &= 0b11111111111111111111111111110000;
-
-    // Set that pin A8 should be a general purpose output
-    GPIOA -> CRH |= 0b0011;
-
-    // Clear the settings of pins B12-15
-  	GPIOB -> CRH &= 0b1111111111111111;
-
-    // Write that pins B12-15 should be general purpose outputs
-  	GPIOB -> CRH |= 0b00110011001100110000000000000000;
+    // Set up the reset pin, then the pins (or bus) that carry the data
+    pinMode(pinNametoDigitalPin(OLED_RST_PIN), OUTPUT);
+    initOLEDTransport();
 
 	GPIO_WRITE(OLED_RST_PIN, HIGH);
 	writeOLEDByte(0xAE, COMMAND);//
@@ -604,44 +669,20 @@ void initOLED() {
 	writeOLEDByte(0xA6, COMMAND);//;bit0:1,;0,
 	writeOLEDByte(0xAF, COMMAND);//
 	delay(100);
-	clearOLED();
+
+    // The panel holds whatever it powered up with, so every page has to be written once
+#ifdef ENABLE_OLED_PAGE_STREAMING
+    oledItemCount = 0;
+#else
+	memset(OLEDBuffer, 0X00, sizeof(OLEDBuffer));
+#endif
+	writeOLEDBuffer(true);
 }
 
 
 // Write a single byte to the LCD panel
 void writeOLEDByte(uint8_t data, OLED_MODE mode) {
-
-    // Write the current mode and enable the screen's communcation
-	GPIO_WRITE(OLED_RS_PIN, (uint8_t)mode);
-	GPIO_WRITE(OLED_CS_PIN, LOW);
-
-    // Write each bit of the byte
-	for(uint8_t i = 0; i < 8; i++) {
-
-        // Prevent the screen from reading the data in
-        GPIO_WRITE(OLED_SCLK_PIN, LOW);
-
-        // If the bit is 1 (true)
-		if(data & 0x80) {
-
-            // Write true
-            GPIO_WRITE(OLED_SDIN_PIN, HIGH);
-        }
-		else {
-            // Write false
-            GPIO_WRITE(OLED_SDIN_PIN, LOW);
-        }
-
-        // Signal that the data needs to be sampled again
-		GPIO_WRITE(OLED_SCLK_PIN, HIGH);
-
-        // Shift all of the bits so the next will be read
-		data <<= 1;
-	}
-
-    // Disable the screen's communication
-    GPIO_WRITE(OLED_CS_PIN, HIGH);
-    GPIO_WRITE(OLED_RS_PIN, HIGH);
+    writeOLEDTransportByte(data, (mode == DATA));
 }
 
 
@@ -661,30 +702,237 @@ void writeOLEDOff() {
 }
 
 
-// Write the entire OLED buffer to the screen
-void writeOLEDBuffer() {
+#ifdef ENABLE_OLED_PAGE_STREAMING
+// Finds the box covered by an item (the last column and row are included, and may be off of the screen)
+static void getOLEDItemBounds(const oledItem &item, uint8_t &x2, uint8_t &y2) {
+    switch (item.kind) {
+        case OLED_ITEM_CHAR_12:
+            x2 = item.x + 5;
+            y2 = item.y + 11;
+            break;
+        case OLED_ITEM_CHAR_16:
+            x2 = item.x + 7;
+            y2 = item.y + 15;
+            break;
+        default:
+            x2 = item.x2;
+            y2 = item.y2;
+            break;
+    }
+}
+
+
+// Adds an item to the top of the list, dropping the items that it hides
+static void addOLEDItem(oledItem item) {
+
+    // Remove anything that the new item covers completely (they can't be seen anymore)
+    uint8_t x2, y2;
+    getOLEDItemBounds(item, x2, y2);
+    uint8_t keptCount = 0;
+    for (uint8_t itemIndex = 0; itemIndex < oledItemCount; itemIndex++) {
+        uint8_t oldX2, oldY2;
+        getOLEDItemBounds(oledItems[itemIndex], oldX2, oldY2);
+        bool hidden = (oledItems[itemIndex].x >= item.x && oldX2 <= x2 && oledItems[itemIndex].y >= item.y && oldY2 <= y2);
+        if (!hidden) {
+            oledItems[keptCount] = oledItems[itemIndex];
+            keptCount++;
+        }
+    }
+    oledItemCount = keptCount;
+
+    // If the list is still full, the oldest item goes (it is the most likely to have been drawn over)
+    if (oledItemCount == OLED_STREAM_ITEMS) {
+        memmove(&oledItems[0], &oledItems[1], sizeof(oledItem) * (OLED_STREAM_ITEMS - 1));
+        oledItemCount--;
+    }
+
+    // Draw the new item over the rest
+    oledItems[oledItemCount] = item;
+    oledItemCount++;
+}
+
+
+// Picks the 8 rows from a column of bits (the top row in the highest bit) that start at an offset from the column's top
+static inline uint8_t getPageBits(uint32_t bits, int8_t offset) {
+    return (uint8_t)((offset >= 0 ? (bits << offset) : (bits >> -offset)) >> 24);
+}
+
+
+// Composes a page from the list into the line buffer
+// The buffer's pages are counted from the bottom of the screen, with the top row of each page in the highest bit
+static void composeOLEDPage(uint8_t page) {
 
-    // Loop through each of the vertical lines
-	for(uint8_t vertIndex = 0; vertIndex < 8; vertIndex++) {
+    // Start from a blank line
+    memset(oledLine, 0, sizeof(oledLine));
+    const uint8_t pageTop = (7 - page) * 8;
 
-		// Specify the line that is being written to
-        writeOLEDByte(0xb0 + vertIndex, COMMAND);
-		writeOLEDByte(0x00, COMMAND);
-		writeOLEDByte(0x10, COMMAND); // DCDC OFF
+    // Paint the items from the bottom of the list up
+    for (uint8_t itemIndex = 0; itemIndex < oledItemCount; itemIndex++) {
+        const oledItem &item = oledItems[itemIndex];
+        uint8_t x2, y2;
+        getOLEDItemBounds(item, x2, y2);
 
-        // Loop through the horizontal lines
-		for(uint8_t horzIndex = 0; horzIndex < 128; horzIndex++) {
-		    writeOLEDByte(OLEDBuffer[horzIndex][vertIndex], DATA);
+        // Skip the items that aren't on this page
+        if (item.y > (pageTop + 7) || y2 < pageTop) {
+            continue;
+        }
+        x2 = min(x2, (uint8_t)127);
+
+        // The rows of the page that the item covers
+        if (item.kind == OLED_ITEM_FILL) {
+            uint8_t mask = (0xFF >> (max((uint8_t)item.y, pageTop) - pageTop)) & (uint8_t)(0xFF << (7 - (min(y2, (uint8_t)(pageTop + 7)) - pageTop)));
+            uint8_t data = (item.color ? mask : 0);
+            for (uint8_t x = item.x; x <= x2; x++) {
+                oledLine[x] = ((oledLine[x] & ~mask) | data);
+            }
         }
+        else {
+            // The fonts are stored column by column, with a byte per 8 rows (top row in the highest bit)
+            const uint8_t fontSize = (item.kind == OLED_ITEM_CHAR_12 ? 12 : 16);
+            const unsigned char* glyph = (item.kind == OLED_ITEM_CHAR_12 ? OLED_1206_Font[item.x2] : OLED_1608_Font[item.x2]);
+            const uint32_t cellMask = (0xFFFFFFFF << (32 - fontSize));
+            const uint32_t invert = (item.color ? 0 : cellMask);
+            const int8_t offset = (int8_t)(pageTop - item.y);
+            const uint8_t mask = getPageBits(cellMask, offset);
+
+            // Shift each column of the character to the rows of the page
+            for (uint8_t column = 0; (item.x + column) <= x2; column++) {
+                uint32_t bits = (((uint32_t)glyph[column * 2] << 24) | ((uint32_t)glyph[(column * 2) + 1] << 16));
+                uint8_t data = getPageBits((bits & cellMask) ^ invert, offset);
+                oledLine[item.x + column] = ((oledLine[item.x + column] & ~mask) | data);
+            }
+        }
+    }
+}
+
+
+// Composes each of the pages of the screen and sends the ones that changed (or all of them)
+void writeOLEDBuffer(bool fullFrame) {
+	for(uint8_t vertIndex = 0; vertIndex < OLED_PAGE_COUNT; vertIndex++) {
+
+        // The last page may still be being sent from the line buffer
+        while (isOLEDTransportBusy());
+        composeOLEDPage(vertIndex);
+
+        // Only send the page if it isn't what's already on the panel
+        uint16_t crc = crc16(oledLine, sizeof(oledLine));
+        if (!fullFrame && crc == pageCRC[vertIndex]) {
+            continue;
+        }
+        pageCRC[vertIndex] = crc;
+
+        // Send the page (in the background, if the transport can)
+        oledPageRun run;
+        run.data = oledLine;
+        run.page = vertIndex;
+        run.column = 0;
+        run.length = sizeof(oledLine);
+        writeOLEDTransportPages(&run, 1);
 	}
 }
 
 
+// Wipes the screen, then writes the blank pages to the screen
+void clearOLED() {
+
+    // An empty list is a blank screen
+    oledItemCount = 0;
+
+    // Push the values to the display
+	writeOLEDBuffer();
+}
+
+
+// Writes a point on the buffer
+void setOLEDPixel(uint8_t x, uint8_t y, OLED_COLOR color) {
+    fillOLED(x, y, x, y, color, false);
+}
+
+
+// Fill an area of pixels, starting at x1 or y1 to x2 or y2
+void fillOLED(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, OLED_COLOR color, bool updateScreen) {
+
+    // Exit if the box is entirely off of the screen, otherwise clip it to the screen
+	if (x1 > 127 || y1 > 63 || x1 > x2 || y1 > y2) {
+        return;
+    }
+    oledItem item = {};
+    item.x = x1;
+    item.y = y1;
+    item.kind = OLED_ITEM_FILL;
+    item.color = color;
+    item.x2 = min(x2, (uint8_t)127);
+    item.y2 = min(y2, (uint8_t)63);
+    addOLEDItem(item);
+
+    // Write the buffer to the screen if specified
+    if (updateScreen) {
+	    writeOLEDBuffer();
+    }
+}
+
+
+// Writes a characer to the display
+void writeOLEDChar(uint8_t x, uint8_t y, uint8_t chr, uint8_t fontSize, OLED_COLOR color, bool updateScreen) {
+
+    // Characters that start off of the screen can't be seen
+    if (x <= 127 && y <= 63) {
+        oledItem item = {};
+        item.x = x;
+        item.y = y;
+        item.kind = (fontSize == 12 ? OLED_ITEM_CHAR_12 : OLED_ITEM_CHAR_16);
+        item.color = color;
+        item.x2 = (chr - ' ');
+        addOLEDItem(item);
+    }
+
+    // Update the screen if desired
+    if (updateScreen) {
+        writeOLEDBuffer();
+    }
+}
+#else
+// Write the changed parts of the OLED buffer to the screen (or all of it)
+void writeOLEDBuffer(bool fullFrame) {
+
+    // Collect the columns to send from each of the vertical lines, skipping the lines that haven't changed
+    oledPageRun runs[OLED_PAGE_COUNT];
+    uint8_t runCount = 0;
+	for(uint8_t vertIndex = 0; vertIndex < OLED_PAGE_COUNT; vertIndex++) {
+        uint8_t startIndex = (fullFrame ? 0 : dirtyStart[vertIndex]);
+        uint8_t endIndex = (fullFrame ? 127 : dirtyEnd[vertIndex]);
+        if (startIndex > endIndex) {
+            continue;
+        }
+        runs[runCount].data = &OLEDBuffer[vertIndex][startIndex];
+        runs[runCount].page = vertIndex;
+        runs[runCount].column = startIndex;
+        runs[runCount].length = (endIndex - startIndex) + 1;
+        runCount++;
+
+        // The line will match the buffer (anything drawn while it is being sent marks it again)
+        dirtyStart[vertIndex] = 127;
+        dirtyEnd[vertIndex] = 0;
+	}
+
+    // Send them (in the background, if the transport can)
+    writeOLEDTransportPages(runs, runCount);
+}
+
+
 // Wipes the output buffer, then writes the zeroed array to the screen
 void clearOLED() {
 
-    // Set all of the values in the buffer to 0
-	memset(OLEDBuffer, 0X00, sizeof(OLEDBuffer));
+    // Set all of the values in the buffer to 0, keeping track of the ones that were lit (only they need to be sent)
+    for (uint8_t vertIndex = 0; vertIndex < OLED_PAGE_COUNT; vertIndex++) {
+        for (uint8_t horzIndex = 0; horzIndex < 128; horzIndex++) {
+            if (OLEDBuffer[vertIndex][horzIndex] != 0) {
+                OLEDBuffer[vertIndex][horzIndex] = 0;
+                dirtyStart[vertIndex] = min(dirtyStart[vertIndex], horzIndex);
+                dirtyEnd[vertIndex] = max(dirtyEnd[vertIndex], horzIndex);
+            }
+        }
+    }
 
     // Push the values to the display
 	writeOLEDBuffer();
@@ -706,13 +954,20 @@ void setOLEDPixel(uint8_t x, uint8_t y, OLED_COLOR color) {
 	yPos = 7 - (y / 8);
 
     // Write white pixels if the point isn't inverted
+	uint8_t oldData = OLEDBuffer[yPos][x];
 	if(color) {
-        OLEDBuffer[x][yPos] |= (1<<(7-(y%8)));
+        OLEDBuffer[yPos][x] |= (1<<(7-(y%8)));
     }
 
     // Otherwise, write black pixels to the point
 	else {
-        OLEDBuffer[x][yPos] &= ~(1<<(7-(y%8)));
+        OLEDBuffer[yPos][x] &= ~(1<<(7-(y%8)));
+    }
+
+    // Widen the line's span if the pixel changed (rewriting the same text leaves the screen alone)
+    if (OLEDBuffer[yPos][x] != oldData) {
+        dirtyStart[yPos] = min(dirtyStart[yPos], x);
+        dirtyEnd[yPos] = max(dirtyEnd[yPos], x);
     }
 }
 
@@ -736,6 +991,18 @@ void fillOLED(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, OLED_COLOR color,
 }
 
 
+// Merges the masked bits of a byte into a column of a page, widening the page's span if it changed
+static inline void writeOLEDColumn(uint8_t page, uint8_t x, uint8_t data, uint8_t mask) {
+    uint8_t oldData = OLEDBuffer[page][x];
+    uint8_t newData = ((oldData & ~mask) | (data & mask));
+    if (newData != oldData) {
+        OLEDBuffer[page][x] = newData;
+        dirtyStart[page] = min(dirtyStart[page], x);
+        dirtyEnd[page] = max(dirtyEnd[page], x);
+    }
+}
+
+
 // Writes a characer to the display
 void writeOLEDChar(uint8_t x, uint8_t y, uint8_t chr, uint8_t fontSize, OLED_COLOR color, bool updateScreen) {
 
@@ -746,41 +1013,58 @@ void writeOLEDChar(uint8_t x, uint8_t y, uint8_t chr, uint8_t fontSize, OLED_COL
     // Correct the character index
 	chr = chr - ' ';
 
-    // Loop through the data of each of the pixels of the character
-    for (uint8_t pixelIndex = 0; pixelIndex < fontSize; pixelIndex++) {
+    // Pick the font's data for the character
+    const unsigned char* glyph = (fontSize == 12 ? OLED_1206_Font[chr] : OLED_1608_Font[chr]);
 
-        // Use the appropriate font data
-		if (fontSize == 12) {
-            pixelData = OLED_1206_Font[chr][pixelIndex];
-        }
-		else {
-            pixelData = OLED_1608_Font[chr][pixelIndex];
-        }
+    // Page aligned characters can be copied straight into the buffer
+    // The fonts are stored column by column, with a byte per 8 rows (top row in the highest bit), the same way that the buffer stores each page
+    if ((y % 8) == 0 && y <= 63) {
 
-        // Loop through the bits, setting them on the buffer array
-        for(uint8_t bitIndex = 0; bitIndex < 8; bitIndex++) {
+        // Each column is a byte for every (started) 8 rows, the last one masked to the rows of the font
+        const uint8_t bytesPerColumn = ((fontSize + 7) / 8);
+        const uint8_t lastMask = (uint8_t)(0xFF << ((bytesPerColumn * 8) - fontSize));
+        const uint8_t invert = (color ? 0x00 : 0xFF);
+        const uint8_t columns = (fontSize / bytesPerColumn);
 
-            // Check if the pixel should be inverted (as compared to what was set)
-			if (pixelData & 0x80) {
-                setOLEDPixel(x, y, color);
-            }
-			else {
-                setOLEDPixel(x, y, OLED_COLOR(!color));
+        // Copy the columns that are on the screen (the buffer's pages are counted from the bottom of the screen)
+        for (uint8_t column = 0; column < columns && (x + column) <= 127; column++) {
+            for (uint8_t row = 0; row < bytesPerColumn && (y / 8) + row <= 7; row++) {
+                writeOLEDColumn(7 - ((y / 8) + row), x + column, (glyph[(column * bytesPerColumn) + row] ^ invert), (row == (bytesPerColumn - 1) ? lastMask : 0xFF));
             }
+        }
+    }
+    else {
+        // Loop through the data of each of the pixels of the character
+        for (uint8_t pixelIndex = 0; pixelIndex < fontSize; pixelIndex++) {
 
-            // Shift all of the bits to the left, bringing the next bit in for the next cycle
-			pixelData <<= 1;
+            // Use the appropriate font data
+            pixelData = glyph[pixelIndex];
 
-            // Move down in the y direction so two pixels don't overwrite eachother
-			y++;
+            // Loop through the bits, setting them on the buffer array
+            for(uint8_t bitIndex = 0; bitIndex < 8; bitIndex++) {
 
-            // When the character vertical's vertical column is filled, move to the next one
-			if((y-y0) == fontSize) {
-				y = y0;
-				x++;
-				break;
-			}
-		}
+                // Check if the pixel should be inverted (as compared to what was set)
+                if (pixelData & 0x80) {
+                    setOLEDPixel(x, y, color);
+                }
+                else {
+                    setOLEDPixel(x, y, OLED_COLOR(!color));
+                }
+
+                // Shift all of the bits to the left, bringing the next bit in for the next cycle
+                pixelData <<= 1;
+
+                // Move down in the y direction so two pixels don't overwrite eachother
+                y++;
+
+                // When the character vertical's vertical column is filled, move to the next one
+                if((y-y0) == fontSize) {
+                    y = y0;
+                    x++;
+                    break;
+                }
+            }
+        }
     }
 
     // Update the screen if desired
@@ -789,6 +1073,7 @@ void writeOLEDChar(uint8_t x, uint8_t y, uint8_t chr, uint8_t fontSize, OLED_COL
     }
 
 }
+#endif // ! ENABLE_OLED_PAGE_STREAMING
 
 
 // Writes a number to the OLED display
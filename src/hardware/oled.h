@@ -38,6 +38,7 @@ class StepperMotor;
 void showBootscreen();
 void updateDisplay();
 void displayMotorData();
+void displayCalibration();
 void displayWarning(String firstLine, String secondLine, String thirdLine, bool updateScreen = true);
 void selectMenuItem();
 void moveCursor();
@@ -68,7 +69,8 @@ void initOLED();
 void writeOLEDByte(uint8_t data, OLED_MODE mode);
 void writeOLEDOn();
 void writeOLEDOff();
-void writeOLEDBuffer();
+// Writes the columns of each page that changed since the last write, or the whole buffer with fullFrame
+void writeOLEDBuffer(bool fullFrame = false);
 void setOLEDPixel(uint8_t x, uint8_t y, OLED_COLOR color);
 void fillOLED(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, OLED_COLOR color, bool updateScreen = true);
 void writeOLEDChar(uint8_t x, uint8_t y, uint8_t chr, uint8_t fontSize, OLED_COLOR color, bool updateScreen = true);
@@ -0,0 +1,240 @@
+// Import the config
+#include "config.h"
+
+// Only build if needed
+#ifdef ENABLE_OLED
+
+// Import the header file
+#include "oledTransport.h"
+
+// Masks of the pins, used to set or clear them with a single write to the port's BSRR
+static constexpr uint32_t csMask   = STM_GPIO_PIN(OLED_CS_PIN);
+static constexpr uint32_t rsMask   = STM_GPIO_PIN(OLED_RS_PIN);
+static constexpr uint32_t sclkMask = STM_GPIO_PIN(OLED_SCLK_PIN);
+static constexpr uint32_t sdinMask = STM_GPIO_PIN(OLED_SDIN_PIN);
+
+// Ports of the pins (looked up once in initOLEDTransport())
+static GPIO_TypeDef* csPort;
+static GPIO_TypeDef* rsPort;
+static GPIO_TypeDef* dataPort;
+
+// The clock and the data have to share a port, so each bit can be a pair of writes
+static_assert(STM_PORT(OLED_SCLK_PIN) == STM_PORT(OLED_SDIN_PIN), "OLED_SCLK_PIN and OLED_SDIN_PIN must be on the same port");
+
+// Only SPI2's pins can be driven by the SPI bus (it has no remap)
+#if (OLED_TRANSPORT == OLED_TRANSPORT_SPI2_DMA)
+static_assert(OLED_SCLK_PIN == PB_13 && OLED_SDIN_PIN == PB_15, "OLED_TRANSPORT_SPI2_DMA needs OLED_SCLK_PIN on PB_13 and OLED_SDIN_PIN on PB_15");
+#endif
+
+
+// Selects the panel, in command or data mode
+static inline void selectOLED(bool isData) {
+    rsPort -> BSRR = (isData ? rsMask : (rsMask << 16));
+    csPort -> BSRR = (csMask << 16);
+}
+
+
+// Releases the panel
+static inline void deselectOLED() {
+    csPort -> BSRR = csMask;
+    rsPort -> BSRR = rsMask;
+}
+
+
+// Bit-banged transport
+#if (OLED_TRANSPORT == OLED_TRANSPORT_BITBANG)
+
+// Sends one bit, the clock falls as the data is set, then rises for the panel to sample it
+#define OLED_SHIFT_BIT(data, bit) \
+    dataPort -> BSRR = (((data) & (1 << (bit))) ? sdinMask : (sdinMask << 16)) | (sclkMask << 16); \
+    __NOP(); \
+    dataPort -> BSRR = sclkMask;
+
+// Sends a byte, most significant bit first (unrolled, so each bit is only the two port writes)
+static inline void shiftOLEDByte(uint8_t data) {
+    OLED_SHIFT_BIT(data, 7);
+    OLED_SHIFT_BIT(data, 6);
+    OLED_SHIFT_BIT(data, 5);
+    OLED_SHIFT_BIT(data, 4);
+    OLED_SHIFT_BIT(data, 3);
+    OLED_SHIFT_BIT(data, 2);
+    OLED_SHIFT_BIT(data, 1);
+    OLED_SHIFT_BIT(data, 0);
+}
+
+
+// Sets up the pins that talk to the panel
+void initOLEDTransport() {
+    pinMode(pinNametoDigitalPin(OLED_CS_PIN), OUTPUT);
+    pinMode(pinNametoDigitalPin(OLED_RS_PIN), OUTPUT);
+    pinMode(pinNametoDigitalPin(OLED_SCLK_PIN), OUTPUT);
+    pinMode(pinNametoDigitalPin(OLED_SDIN_PIN), OUTPUT);
+    csPort = get_GPIO_Port(STM_PORT(OLED_CS_PIN));
+    rsPort = get_GPIO_Port(STM_PORT(OLED_RS_PIN));
+    dataPort = get_GPIO_Port(STM_PORT(OLED_SCLK_PIN));
+    deselectOLED();
+}
+
+
+// Sends a single command or data byte
+void writeOLEDTransportByte(uint8_t data, bool isData) {
+    selectOLED(isData);
+    shiftOLEDByte(data);
+    deselectOLED();
+}
+
+
+// Sends runs of data to the pages of the panel
+void writeOLEDTransportPages(const oledPageRun runs[], uint8_t count) {
+    for (uint8_t runIndex = 0; runIndex < count; runIndex++) {
+
+        // Move to the page and column
+        selectOLED(false);
+        shiftOLEDByte(0xB0 + runs[runIndex].page);
+        shiftOLEDByte(0x00 | (runs[runIndex].column & 0x0F)); // Lower nibble of the column
+        shiftOLEDByte(0x10 | (runs[runIndex].column >> 4));   // Upper nibble of the column
+
+        // Send the data without releasing the panel between the bytes
+        rsPort -> BSRR = rsMask;
+        for (uint8_t byteIndex = 0; byteIndex < runs[runIndex].length; byteIndex++) {
+            shiftOLEDByte(runs[runIndex].data[byteIndex]);
+        }
+        deselectOLED();
+    }
+}
+
+
+// Checks if runs are still being sent (never, they're sent before returning)
+bool isOLEDTransportBusy() {
+    return false;
+}
+
+
+// SPI2 and DMA transport
+#elif (OLED_TRANSPORT == OLED_TRANSPORT_SPI2_DMA)
+
+// The runs being sent, the DMA interrupt works through them
+static oledPageRun pendingRuns[OLED_PAGE_COUNT];
+static volatile uint8_t runCount = 0;
+static volatile uint8_t runIndex = 0;
+static volatile bool transferActive = false;
+
+
+// Queues a byte on the bus
+static inline void writeSPIByte(uint8_t data) {
+    while (!(SPI2 -> SR & SPI_SR_TXE));
+    SPI2 -> DR = data;
+}
+
+
+// Waits for the bus to finish shifting out the last byte (needed before the mode pin can change)
+static inline void waitForSPI() {
+    while (!(SPI2 -> SR & SPI_SR_TXE));
+    while (SPI2 -> SR & SPI_SR_BSY);
+}
+
+
+// Moves to the page of the next run and starts its data, or releases the panel once all of them are sent
+static void startNextRun() {
+    waitForSPI();
+    if (runIndex >= runCount) {
+        deselectOLED();
+        transferActive = false;
+        return;
+    }
+    const oledPageRun &run = pendingRuns[runIndex++];
+
+    // Move to the page and column (only three bytes, not worth a transfer)
+    selectOLED(false);
+    writeSPIByte(0xB0 + run.page);
+    writeSPIByte(0x00 | (run.column & 0x0F)); // Lower nibble of the column
+    writeSPIByte(0x10 | (run.column >> 4));   // Upper nibble of the column
+    waitForSPI();
+
+    // Let the DMA send the data
+    rsPort -> BSRR = rsMask;
+    DMA1_Channel5 -> CMAR = (uint32_t)run.data;
+    DMA1_Channel5 -> CNDTR = run.length;
+    DMA1_Channel5 -> CCR |= DMA_CCR_EN;
+}
+
+
+// Moves on to the next run once the DMA has handed the last byte of a run to the bus
+extern "C" void DMA1_Channel5_IRQHandler(void) {
+    DMA1 -> IFCR = DMA_IFCR_CGIF5;
+    DMA1_Channel5 -> CCR &= ~DMA_CCR_EN;
+    startNextRun();
+}
+
+
+// Sets up the pins, SPI2, and DMA1 channel 5
+void initOLEDTransport() {
+
+    // The mode and select pins are toggled by hand, the clock and data belong to SPI2
+    pinMode(pinNametoDigitalPin(OLED_CS_PIN), OUTPUT);
+    pinMode(pinNametoDigitalPin(OLED_RS_PIN), OUTPUT);
+    csPort = get_GPIO_Port(STM_PORT(OLED_CS_PIN));
+    rsPort = get_GPIO_Port(STM_PORT(OLED_RS_PIN));
+    dataPort = get_GPIO_Port(STM_PORT(OLED_SCLK_PIN));
+    deselectOLED();
+    GPIO_InitTypeDef pinConfig;
+    pinConfig.Pin = sclkMask | sdinMask;
+    pinConfig.Mode = GPIO_MODE_AF_PP;
+    pinConfig.Pull = GPIO_NOPULL;
+    pinConfig.Speed = GPIO_SPEED_FREQ_HIGH;
+    HAL_GPIO_Init(dataPort, &pinConfig);
+
+    // Transmit only master, mode 3 (the panel samples on the rising edge), 36 MHz / 4 = 9 MHz (the panel's limit is 10 MHz)
+    __HAL_RCC_SPI2_CLK_ENABLE();
+    SPI2 -> CR1 = 0;
+    SPI2 -> CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_CPOL | SPI_CR1_CPHA | (1 << SPI_CR1_BR_Pos);
+    SPI2 -> CR2 = SPI_CR2_TXDMAEN;
+    SPI2 -> CR1 |= SPI_CR1_SPE;
+
+    // SPI2 TX is on channel 5 (memory to peripheral), interrupting once each run is handed over
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    DMA1_Channel5 -> CCR = 0;
+    DMA1_Channel5 -> CPAR = (uint32_t)&(SPI2 -> DR);
+    DMA1_Channel5 -> CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE;
+    HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, OLED_DMA_IRQ_PRIO, OLED_DMA_IRQ_SUBPRIO);
+    HAL_NVIC_EnableIRQ(DMA1_Channel5_IRQn);
+}
+
+
+// Sends a single command or data byte, after anything that is still being sent
+void writeOLEDTransportByte(uint8_t data, bool isData) {
+    while (transferActive);
+    selectOLED(isData);
+    writeSPIByte(data);
+    waitForSPI();
+    deselectOLED();
+}
+
+
+// Sends runs of data to the pages of the panel in the background
+void writeOLEDTransportPages(const oledPageRun runs[], uint8_t count) {
+
+    // Let the last frame finish first
+    while (transferActive);
+    if (count == 0) {
+        return;
+    }
+
+    // Copy the runs, then start the first one (the interrupt starts the rest)
+    count = min(count, (uint8_t)OLED_PAGE_COUNT);
+    memcpy(pendingRuns, runs, count * sizeof(oledPageRun));
+    runCount = count;
+    runIndex = 0;
+    transferActive = true;
+    startNextRun();
+}
+
+
+// Checks if runs are still being sent
+bool isOLEDTransportBusy() {
+    return transferActive;
+}
+
+#endif // ! OLED_TRANSPORT
+
+#endif // ! ENABLE_OLED
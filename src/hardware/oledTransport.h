@@ -0,0 +1,44 @@
+#ifndef __OLED_TRANSPORT_H__
+#define __OLED_TRANSPORT_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the OLED is enabled
+#ifdef ENABLE_OLED
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Number of pages (rows of 8 pixels) on the panel
+#define OLED_PAGE_COUNT 8
+
+// A run of data bytes for one page of the panel, starting at a column
+typedef struct {
+    const uint8_t* data;    // The bytes, one column each (must stay valid until the transport is done with them)
+    uint8_t page;           // Page to write to
+    uint8_t column;         // First column to write to (the panel advances it with each byte)
+    uint8_t length;         // Number of bytes
+} oledPageRun;
+
+// Priority of the transmit DMA interrupt (only starts the next page, so it can wait behind the motor)
+#if (OLED_TRANSPORT == OLED_TRANSPORT_SPI2_DMA)
+    #define OLED_DMA_IRQ_PRIO    10
+    #define OLED_DMA_IRQ_SUBPRIO 2
+#endif
+
+// Sets up the pins (and the SPI bus and DMA channel, if used) that talk to the panel
+void initOLEDTransport();
+
+// Sends a single command or data byte, after anything that is still being sent
+void writeOLEDTransportByte(uint8_t data, bool isData);
+
+// Sends runs of data to the pages of the panel
+// With DMA, the runs are sent in the background and this returns right away (the runs themselves are copied)
+void writeOLEDTransportPages(const oledPageRun runs[], uint8_t count);
+
+// Checks if runs are still being sent
+bool isOLEDTransportBusy();
+
+#endif // ! ENABLE_OLED
+#endif // ! __OLED_TRANSPORT_H__
@@ -5,6 +5,8 @@
 //
 //
 //:12*6
+// Each character is stored column by column, with a byte for every 8 rows (top row in the highest bit)
+// This is the same layout as the pages of the OLED's buffer, so page aligned characters are copied without being rotated
 const unsigned char OLED_1206_Font[95][12]={
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},/*" ",0*/
 {0x00,0x00,0x00,0x00,0x3F,0x40,0x00,0x00,0x00,0x00,0x00,0x00},/*"!",1*/
@@ -0,0 +1,179 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_POWER_LOSS_SAVE
+
+// Import the header file
+#include "powerLoss.h"
+#include "flash.h"
+#include "crc.h"
+#include "timers.h"
+
+// Same preemption as the correction, so the save never cuts into a read of the encoder that the correction started
+// (the critical sections of the main loop hold it off the same way)
+#define POWER_LOSS_IRQ_PRIO CORRECTION_IRQ_PRIO
+
+// Layout of the saves, the mark is written last so that a save that was cut off is never used
+#define POSITION_RECORD_HALFWORDS  10
+#define POSITION_RECORD_SIZE       (POSITION_RECORD_HALFWORDS * 2)
+#define POSITION_RECORDS_PER_PAGE  (POSITION_SAVE_PAGE_SIZE / POSITION_RECORD_SIZE)
+#define POSITION_RECORD_VALID      0x5AA5 // Saved at a power loss
+#define POSITION_RECORD_USED       0x0000 // Picked back up at a boot (can be written over the valid mark without an erase)
+#define POSITION_RECORD_ERASED     0xFFFF
+
+// One save (the halfwords are written in order)
+typedef struct {
+    uint16_t zeroIncrements;
+    uint16_t increments;
+    uint16_t turns[2];
+    uint16_t softStepCNT[2];
+    uint16_t hardStepCNT[2];
+    uint16_t crc;
+    uint16_t mark;
+} positionRecord;
+static_assert((sizeof(positionRecord) == POSITION_RECORD_SIZE), "The position record must be packed into halfwords");
+static_assert(((POSITION_SAVE_PAGE_ADDR + POSITION_SAVE_PAGE_SIZE) <= PARAMETER_PAGE_1_ADDR), "The position save page can't overlap the parameters");
+
+// Next free slot of the page, and if the save has already been made (the supply can only be lost once)
+static uint16_t nextRecord = 0;
+static volatile bool positionSaved = false;
+static bool positionRestored = false;
+
+
+// Gets the address of a slot of the page
+static uint32_t getRecordAddress(uint16_t index) {
+    return (POSITION_SAVE_PAGE_ADDR + ((uint32_t)index * POSITION_RECORD_SIZE));
+}
+
+
+// Computes the CRC of a save (everything before the CRC)
+static uint16_t getRecordCRC(const positionRecord &record) {
+    return crc16((const uint8_t*)&record, offsetof(positionRecord, crc));
+}
+
+
+// If a slot hasn't been written since the page was erased
+static bool isRecordErased(uint16_t index) {
+    const uint16_t *halfwords = (const uint16_t *)getRecordAddress(index);
+    for (uint8_t halfword = 0; halfword < POSITION_RECORD_HALFWORDS; halfword++) {
+        if (halfwords[halfword] != POSITION_RECORD_ERASED) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Saves the position into the next free slot (called by the supply monitor)
+static void savePosition() {
+
+    // Take a single sample for the turns and the increments, the same as the position of the motor
+    uint16_t zeroIncrements;
+    int32_t turns;
+    uint16_t increments;
+    motor.encoder.capturePosition(zeroIncrements, turns, increments);
+
+    // Build the save
+    positionRecord record;
+    int32_t softStepCNT = motor.getSoftStepCNT();
+    int32_t hardStepCNT = motor.getHardStepCNT();
+    record.zeroIncrements = zeroIncrements;
+    record.increments = increments;
+    memcpy(record.turns, &turns, 4);
+    memcpy(record.softStepCNT, &softStepCNT, 4);
+    memcpy(record.hardStepCNT, &hardStepCNT, 4);
+    record.crc = getRecordCRC(record);
+    record.mark = POSITION_RECORD_VALID;
+
+    // Program it a halfword at a time, the mark goes last
+    const uint16_t *halfwords = (const uint16_t *)&record;
+    uint32_t address = getRecordAddress(nextRecord);
+    for (uint8_t halfword = 0; halfword < POSITION_RECORD_HALFWORDS; halfword++) {
+        writeToFlashAddress(address + (halfword * 2), halfwords[halfword]);
+    }
+}
+
+
+// Runs as the supply drops below the threshold
+extern "C" void PVD_IRQHandler(void) {
+
+    // Clear the flag, the supply monitor is on line 16 of the EXTI
+    EXTI -> PR = EXTI_PR_PR16;
+    if (positionSaved) {
+        return;
+    }
+    positionSaved = true;
+
+    // Stop driving the motor first, the coils are what drain the supply
+    disableMotorTimers();
+    motor.setState(FORCED_DISABLED, true);
+
+    // Keep the position
+    savePosition();
+
+    // If the supply comes back instead of dying, the board has to start over to pick the save back up
+    while (PWR -> CSR & PWR_CSR_PVDO);
+    NVIC_SystemReset();
+}
+
+
+// Picks the position back up from the newest save, then starts the supply monitor
+bool initPowerLossSave(bool restore) {
+
+    // Find the first free slot (a save that was cut off still uses its slot)
+    nextRecord = 0;
+    while (nextRecord < POSITION_RECORDS_PER_PAGE && !isRecordErased(nextRecord)) {
+        nextRecord++;
+    }
+
+    // The newest save is the one before the free slot, it has to be whole and not picked up already
+    if (nextRecord > 0) {
+        const positionRecord *record = (const positionRecord *)getRecordAddress(nextRecord - 1);
+        if (record -> mark == POSITION_RECORD_VALID && record -> crc == getRecordCRC(*record)) {
+
+            // Restore the encoder, then the step counts (only if the calibration is the one that the save was made with)
+            if (restore) {
+                int32_t turns;
+                int32_t softStepCNT;
+                int32_t hardStepCNT;
+                memcpy(&turns, record -> turns, 4);
+                memcpy(&softStepCNT, record -> softStepCNT, 4);
+                memcpy(&hardStepCNT, record -> hardStepCNT, 4);
+                motor.encoder.restorePosition(record -> zeroIncrements, turns, record -> increments);
+                motor.restoreStepCounts(softStepCNT, hardStepCNT);
+                positionRestored = true;
+            }
+
+            // A save can only be picked up once
+            writeToFlashAddress(getRecordAddress(nextRecord - 1) + offsetof(positionRecord, mark), POSITION_RECORD_USED);
+        }
+    }
+
+    // There always has to be a free slot for the next power loss, the erase can only be done while the supply is good
+    if (nextRecord >= POSITION_RECORDS_PER_PAGE) {
+        eraseFlashPage(POSITION_SAVE_PAGE_ADDR);
+        nextRecord = 0;
+    }
+
+    // Start the supply monitor, interrupting as the supply falls below the threshold (rising edge of the PVD output)
+    __HAL_RCC_PWR_CLK_ENABLE();
+    PWR -> CR = (PWR -> CR & ~PWR_CR_PLS) | ((uint32_t)POWER_LOSS_PVD_LEVEL << PWR_CR_PLS_Pos) | PWR_CR_PVDE;
+    EXTI -> RTSR |= EXTI_RTSR_TR16;
+    EXTI -> FTSR &= ~EXTI_FTSR_TR16;
+    EXTI -> PR = EXTI_PR_PR16;
+    EXTI -> IMR |= EXTI_IMR_MR16;
+    HAL_NVIC_SetPriority(PVD_IRQn, POWER_LOSS_IRQ_PRIO, 0);
+    HAL_NVIC_EnableIRQ(PVD_IRQn);
+
+    // Return if the position was picked back up
+    return positionRestored;
+}
+
+
+// If the position was restored at boot
+bool wasPositionRestored() {
+    return positionRestored;
+}
+
+#endif // ! ENABLE_POWER_LOSS_SAVE
@@ -0,0 +1,31 @@
+#ifndef __POWER_LOSS_H__
+#define __POWER_LOSS_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the position is kept across power loss
+#ifdef ENABLE_POWER_LOSS_SAVE
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Position retention across power loss
+// The supply monitor (PVD) interrupts as the supply drops below POWER_LOSS_PVD_LEVEL. The coils are released to save the charge
+// that is left, then the position (the turns and increments of the encoder, the increments of its zero, and both step counts) is
+// appended to a pre-erased flash page. Only halfwords are programmed, so the save doesn't need the time of an erase.
+// At boot, the newest save is picked back up and marked as used, so a reset without a power loss starts from zero like before
+
+// Picks the position back up from the newest save (if restore is set and there is one), then starts the supply monitor
+// Called once the parameters are loaded, as the step counts are in the saved microstepping
+// Returns true if the position was restored
+bool initPowerLossSave(bool restore);
+
+// If the position was restored at boot (the machine doesn't need to home again)
+bool wasPositionRestored();
+
+#endif // ! ENABLE_POWER_LOSS_SAVE
+#endif // ! __POWER_LOSS_H__
@@ -7,77 +7,330 @@
 // Import the header file
 #include "serial.h"
 
-// The buffer for serial data between serial reads
-String serialBuffer;
+#ifdef ENABLE_BINARY_PROTOCOL
+#include "binaryProtocol.h"
+#endif
+
+// The command being assembled, kept between reads so that a command can arrive over several loops
+static char commandBuffer[SERIAL_COMMAND_BUFFER_SIZE + 1];
+static uint16_t commandLength = 0;
+static bool receivingCommand = false;
+
+// The binary frame being assembled (still COBS encoded, so the zero delimiters can't show up in it)
+#ifdef ENABLE_BINARY_PROTOCOL
+static uint8_t binaryFrame[BINARY_MAX_ENCODED_SIZE];
+static uint16_t binaryFrameLength = 0;
+static bool receivingBinary = false;
+static bool binaryFrameOverflowed = false;
+#endif
+
+
+// Error statistics of the bus (the line errors are counted by the USART interrupt, the drops by the main loop)
+static volatile uint32_t overrunErrors = 0;
+static volatile uint32_t framingErrors = 0;
+static volatile uint32_t noiseErrors = 0;
+static volatile uint32_t parityErrors = 0;
+static uint32_t droppedCommands = 0;
+static uint32_t droppedBinaryFrames = 0;
+
+// Baud rate of the serial bus
+static uint32_t serialBaud = SERIAL_BAUD;
+
+// Background transmission
+#ifdef ENABLE_SERIAL_DMA
+// Arena that the queued bytes wait in, the main loop writes the head and the DMA interrupt moves the tail
+static uint8_t txArena[SERIAL_TX_ARENA_SIZE];
+static volatile uint16_t txHead = 0;
+static volatile uint16_t txTail = 0;
+
+// Length of the transfer that the DMA is running (0 when it is idle)
+static volatile uint16_t txLength = 0;
+
+
+// Starts sending the next contiguous block of the arena (only called when the DMA is idle)
+static void startTransmit() {
+
+    // Stop if everything has been sent
+    uint16_t head = txHead;
+    uint16_t tail = txTail;
+    if (head == tail) {
+        txLength = 0;
+        return;
+    }
+
+    // Send up to the head, or up to the end of the arena if the queue wraps (the rest goes in the next block)
+    uint16_t length = (head > tail ? head - tail : SERIAL_TX_ARENA_SIZE - tail);
+    txLength = length;
+    DMA1_Channel4 -> CMAR = (uint32_t)&txArena[tail];
+    DMA1_Channel4 -> CNDTR = length;
+    DMA1_Channel4 -> CCR |= DMA_CCR_EN;
+}
+
+
+// Sets up USART1 TX to be fed by DMA
+static void beginTransmitDMA() {
+
+    // Enable the clock for the DMA controller
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    // USART1 TX is on channel 4 (memory to peripheral), interrupting once each block is sent
+    DMA1_Channel4 -> CCR = 0;
+    DMA1_Channel4 -> CPAR = (uint32_t)&(USART1 -> DR);
+    DMA1_Channel4 -> CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE;
+
+    // Let the USART request bytes from the DMA (the core's interrupt driven writes aren't used anymore)
+    USART1 -> CR3 |= USART_CR3_DMAT;
+
+    // Enable the transfer complete interrupt
+    HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, SERIAL_TX_DMA_IRQ_PRIO, SERIAL_TX_DMA_IRQ_SUBPRIO);
+    HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+}
+
+
+// Frees the block that was just sent, then starts the next one
+extern "C" void DMA1_Channel4_IRQHandler(void) {
+    DMA1 -> IFCR = DMA_IFCR_CGIF4;
+    DMA1_Channel4 -> CCR &= ~DMA_CCR_EN;
+    txTail = ((txTail + txLength) & (SERIAL_TX_ARENA_SIZE - 1));
+    startTransmit();
+}
+#endif // ! ENABLE_SERIAL_DMA
+
+
+// Counts the line errors of the USART, then lets the core recover from them
+// The core's error callback isn't weak, so the linker routes the HAL's calls through here (-Wl,--wrap=HAL_UART_ErrorCallback)
+// Only the linker refers to it, so it is marked as used to keep link time optimization from dropping it
+extern "C" void __real_HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+extern "C" __attribute__((used)) void __wrap_HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    if (huart -> Instance == USART1) {
+        uint32_t errors = huart -> ErrorCode;
+        if (errors & HAL_UART_ERROR_ORE) {
+            overrunErrors++;
+        }
+        if (errors & HAL_UART_ERROR_FE) {
+            framingErrors++;
+        }
+        if (errors & HAL_UART_ERROR_NE) {
+            noiseErrors++;
+        }
+        if (errors & HAL_UART_ERROR_PE) {
+            parityErrors++;
+        }
+    }
+    __real_HAL_UART_ErrorCallback(huart);
+}
 
 
 // Initializes serial bus
 void initSerial() {
     Serial.setTx(USART1_TX);
     Serial.setRx(USART1_RX);
-    Serial.begin(SERIAL_BAUD);
+    Serial.begin(serialBaud);
+
+    // Send through the arena instead of the core's buffer
+    #ifdef ENABLE_SERIAL_DMA
+        beginTransmitDMA();
+    #endif
 }
 
 
 // Sends a string to the host
 void sendSerialMessage(String message) {
-    Serial.write(message.c_str());
+    sendSerialData((const uint8_t*)message.c_str(), message.length());
 }
 
 
-// Reads the string in the buffer
-String readSerialBuffer() {
+// Sends raw bytes to the host (queued behind any messages that are still being sent)
+void sendSerialData(const uint8_t* data, uint16_t length) {
 
-    // Local variables for storing relevant information
-    String receivedString;
-    char readChar;
+    #ifdef ENABLE_SERIAL_DMA
 
-    // Check if there is serial data available to read
-    if (Serial.available() > 0) {
+        // Copy the data into the arena, as much as fits at a time
+        while (length > 0) {
 
-        // Read the first character. If the first is the string start indicator, then we can continue with the read
-        if (Serial.read() == STRING_START_MARKER) {
+            // Space left in the arena (one byte is kept empty to tell a full arena apart from an empty one)
+            uint16_t head = txHead;
+            uint16_t space = ((txTail - head - 1) & (SERIAL_TX_ARENA_SIZE - 1));
 
-            // Loop forever, until the entire string is read
-            while (Serial.available() > 0) {
+            // Copy up to the end of the arena, the rest wraps around on the next pass
+            uint16_t chunk = min(min(length, space), (uint16_t)(SERIAL_TX_ARENA_SIZE - head));
+            memcpy(&txArena[head], data, chunk);
+            data += chunk;
+            length -= chunk;
 
-                // Read the character out of the buffer
-                readChar = Serial.read();
+            // Publish the bytes, then start the DMA if it ran out of data (the head has to be written first)
+            txHead = ((head + chunk) & (SERIAL_TX_ARENA_SIZE - 1));
+            if (txLength == 0) {
+                startTransmit();
+            }
+        }
 
-                // If the character isn't the end, add it to the received characters
-                if (readChar != STRING_END_MARKER) {
+    #else
+        Serial.write(data, length);
+    #endif
+}
 
-                    // Add it to the character list
-                    receivedString.concat(readChar);
-                }
-                else {
 
-                    // End character reached, terminate the string and return
-                    return receivedString;
-                }
+// Waits until everything queued has been sent
+void flushSerial() {
+
+    // Wait for the arena to drain
+    #ifdef ENABLE_SERIAL_DMA
+        while (txLength != 0);
+
+        // Then for the last byte to leave the shift register
+        while (!(USART1 -> SR & USART_SR_TC));
+    #else
+        Serial.flush();
+    #endif
+}
+
 
-                // Delay to allow next serial character to come in (1 second / time to send 1 character) (baud rate is bits/s, a character is 8 bits)
-                delay(1000/(SERIAL_BAUD/8));
+// Gets the number of bytes that can be queued without waiting
+uint16_t getSerialTxSpace() {
+    #ifdef ENABLE_SERIAL_DMA
+        return ((txTail - txHead - 1) & (SERIAL_TX_ARENA_SIZE - 1));
+    #else
+        return Serial.availableForWrite();
+    #endif
+}
+
+
+// Gets the baud rate of the serial bus
+uint32_t getSerialBaud() {
+    return serialBaud;
+}
+
+
+// Sets the baud rate of the serial bus (after everything queued has been sent), returning false if it is out of range
+bool setSerialBaud(uint32_t baud) {
+
+    // Make sure that the USART can run at the rate
+    if (baud < MIN_SERIAL_BAUD || baud > MAX_SERIAL_BAUD) {
+        return false;
+    }
+
+    // Nothing to do if the rate isn't changing
+    if (baud == serialBaud) {
+        return true;
+    }
+
+    // Finish sending at the old rate, then restart the bus at the new one
+    flushSerial();
+    serialBaud = baud;
+    Serial.end();
+    initSerial();
+    return true;
+}
+
+
+// Moves the received characters into the command being assembled, never waiting for more to arrive
+const char* readSerialCommand() {
+
+    // Take everything that the USART interrupt has buffered so far
+    while (Serial.available() > 0) {
+        char readChar = Serial.read();
+
+        // Binary frames start and end with a zero, and everything between them is the encoded frame
+        #ifdef ENABLE_BINARY_PROTOCOL
+        if (receivingBinary) {
+            if (readChar == 0) {
+
+                // A zero right after the start is just another delimiter, otherwise the frame is complete
+                if (binaryFrameLength > 0) {
+                    if (binaryFrameOverflowed || !handleBinaryFrame(binaryFrame, binaryFrameLength)) {
+                        droppedBinaryFrames++;
+                    }
+                    receivingBinary = false;
+                }
+            }
+            else if (binaryFrameLength < BINARY_MAX_ENCODED_SIZE) {
+                binaryFrame[binaryFrameLength++] = readChar;
             }
+            else {
+                // The frame is too long to be valid, drop it once its end arrives
+                binaryFrameOverflowed = true;
+            }
+            continue;
+        }
+
+        // A zero can't be part of a text command, so it always begins a binary frame (anything assembled before it was cut off)
+        if (readChar == 0) {
+            receivingBinary = true;
+            receivingCommand = false;
+            binaryFrameLength = 0;
+            binaryFrameOverflowed = false;
+            continue;
+        }
+        #endif // ! ENABLE_BINARY_PROTOCOL
+
+        // A start marker always begins a new command (anything assembled before it was cut off)
+        if (readChar == STRING_START_MARKER) {
+            receivingCommand = true;
+            commandLength = 0;
+        }
+
+        // Characters outside of a command are ignored
+        else if (!receivingCommand) {
+            continue;
+        }
+
+        // The command is complete, terminate it and hand it over (the rest of the characters are left for the next call)
+        else if (readChar == STRING_END_MARKER) {
+            receivingCommand = false;
+            commandBuffer[commandLength] = '\0';
+            return commandBuffer;
+        }
+
+        // Add the character to the command, dropping the command if it is too long to be valid
+        else if (commandLength < SERIAL_COMMAND_BUFFER_SIZE) {
+            commandBuffer[commandLength++] = readChar;
+        }
+        else {
+            receivingCommand = false;
+            droppedCommands++;
         }
     }
 
-    // If we made it this far, the read failed and we should return a -1 (will be ignored)
-    return "-1";
+    // The command isn't complete yet
+    return nullptr;
+}
+
+
+// Gets the error statistics of the bus
+String getSerialStats() {
+    return ("Serial: Overruns: " + String(overrunErrors) + F(" | Framing: ") + String(framingErrors) + F(" | Noise: ") + String(noiseErrors) +
+            F(" | Parity: ") + String(parityErrors) + F(" | Dropped commands: ") + String(droppedCommands) +
+            F(" | Dropped frames: ") + String(droppedBinaryFrames));
+}
+
+
+// Clears the error statistics of the bus
+void clearSerialStats() {
+    overrunErrors = 0;
+    framingErrors = 0;
+    noiseErrors = 0;
+    parityErrors = 0;
+    droppedCommands = 0;
+    droppedBinaryFrames = 0;
+}
+
+
+// Gets the total of the errors that were counted
+uint32_t getSerialErrorCount() {
+    return (overrunErrors + framingErrors + noiseErrors + parityErrors + droppedCommands + droppedBinaryFrames);
 }
 
 
 // Parse the buffer for commands
 void runSerialParser() {
 
-    // Save the value as the result is resource intensive to produce
-    String serialCommandBuffer = readSerialBuffer();
-
-    // Check that it is an actual command, then proceed
-    if (serialCommandBuffer != "-1") {
+    // Check if a full command has been received, then proceed
+    const char* command = readSerialCommand();
+    if (command != nullptr) {
 
         // Send the feedback from the serial command
-        sendSerialMessage(parseCommand(serialCommandBuffer) + "\n");
+        sendSerialMessage(parseCommand(command, strlen(command)) + "\n");
     }
 }
 
@@ -10,9 +10,45 @@
 #include "Arduino.h"
 #include "timers.h"
 
+// Priority of the transmit DMA interrupt (only reloads the channel, so it can wait behind the motor)
+#ifdef ENABLE_SERIAL_DMA
+    #define SERIAL_TX_DMA_IRQ_PRIO    10
+    #define SERIAL_TX_DMA_IRQ_SUBPRIO 0
+#endif
+
 void initSerial();
 void sendSerialMessage(String message);
-String readSerialBuffer();
+
+// Sends raw bytes to the host (queued behind any messages that are still being sent)
+void sendSerialData(const uint8_t* data, uint16_t length);
+
+// Waits until everything queued has been sent
+void flushSerial();
+
+// Gets the number of bytes that can be queued without waiting
+uint16_t getSerialTxSpace();
+
+// Gets the baud rate of the serial bus
+uint32_t getSerialBaud();
+
+// Sets the baud rate of the serial bus (after everything queued has been sent), returning false if it is out of range
+bool setSerialBaud(uint32_t baud);
+
+// Moves the received characters into the command being assembled, never waiting for more to arrive
+// Returns the command (without the start and end markers) once its end marker is received, otherwise nullptr
+// With the binary protocol, frames between zero delimiters are handled as they arrive and never returned
+// The command is held until the next call
+const char* readSerialCommand();
+
+// Gets the error statistics of the bus (USART overrun, framing, noise, and parity errors, and the commands and binary frames that were dropped)
+String getSerialStats();
+
+// Clears the error statistics of the bus
+void clearSerialStats();
+
+// Gets the total of the errors that were counted
+uint32_t getSerialErrorCount();
+
 void runSerialParser();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,147 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_STEP_CAPTURE
+
+// Import the header file
+#include "stepCapture.h"
+
+// Ring of TIM1's counter at each step, written by the DMA (DMA1 channel 1 is TIM2's channel 3 request)
+static volatile uint16_t captureBuffer[STEP_CAPTURE_BUFFER_SIZE];
+static uint16_t readIndex = 0;
+
+// Rate of TIM1's counter (Hz), and the time of the start of the current tick (counts of TIM1, unwrapped)
+static uint32_t captureTimerFreq = 1;
+static uint32_t tickStart = 0;
+static uint32_t lastPeriod = 0;
+
+// Time of the last step (counts of TIM1), the interval before it, and if a step has been seen since the reset
+static uint32_t lastStepTime = 0;
+static uint32_t lastInterval = 0;
+static bool lastStepValid = false;
+
+// Statistics (intervals in counts of TIM1, only the intervals within a move are timed)
+static uint32_t capturedSteps = 0;
+static uint32_t minInterval = UINT32_MAX;
+static uint32_t maxInterval = 0;
+static uint32_t maxIntervalChange = 0;
+
+
+// Sets up the capture and its DMA channel
+void initStepCapture(uint32_t timerFreq) {
+    captureTimerFreq = max(timerFreq, (uint32_t)1);
+
+    // Enable the clock for the DMA controller
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    // Copy TIM1's counter into the ring on every request, wrapping back to the start (16 bit, circular)
+    DMA1_Channel1 -> CCR = 0;
+    DMA1_Channel1 -> CPAR = (uint32_t)&(TIM1 -> CNT);
+    DMA1_Channel1 -> CMAR = (uint32_t)captureBuffer;
+    DMA1_Channel1 -> CNDTR = STEP_CAPTURE_BUFFER_SIZE;
+    DMA1_Channel1 -> CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0 | DMA_CCR_PL_0 | DMA_CCR_EN;
+
+    // Trigger TIM2's channel 3 from the step pin (TI1FP1, the same edge detector that the counter uses)
+    // The slave mode is the encoder mode, which doesn't use the trigger, so it only feeds the capture
+    TIM2 -> SMCR = (TIM2 -> SMCR & ~TIM_SMCR_TS) | (TIM_SMCR_TS_2 | TIM_SMCR_TS_0);
+    TIM2 -> CCMR2 = (TIM2 -> CCMR2 & ~TIM_CCMR2_CC3S) | TIM_CCMR2_CC3S;
+    TIM2 -> CCER |= TIM_CCER_CC3E;
+
+    // Request the DMA on every capture (no interrupt)
+    TIM2 -> DIER |= TIM_DIER_CC3DE;
+    resetStepCapture();
+}
+
+
+// Takes in the steps captured since the last tick
+void RAMFUNC updateStepCapture() {
+
+    // Move the start of the tick along by the last period (the update that ran this tick just wrapped the counter)
+    uint16_t now = TIM1 -> CNT;
+    uint32_t period = (TIM1 -> ARR + 1);
+    tickStart += lastPeriod;
+    lastPeriod = period;
+
+    // Read through the new captures (the DMA counts down from the end of the ring)
+    uint16_t writeIndex = (STEP_CAPTURE_BUFFER_SIZE - DMA1_Channel1 -> CNDTR) % STEP_CAPTURE_BUFFER_SIZE;
+    while (readIndex != writeIndex) {
+        uint16_t count = captureBuffer[readIndex];
+        readIndex = (readIndex + 1) % STEP_CAPTURE_BUFFER_SIZE;
+
+        // A count past the counter's value now is from before the update (the last tick)
+        uint32_t stepTime = tickStart + count;
+        if (count > now) {
+            stepTime -= period;
+        }
+
+        // Time the interval, unless the input was still for a while (that is the start of a new move)
+        if (lastStepValid) {
+            uint32_t interval = stepTime - lastStepTime;
+            if (interval < (captureTimerFreq / STEP_CAPTURE_MIN_RATE)) {
+                minInterval = min(minInterval, interval);
+                maxInterval = max(maxInterval, interval);
+                if (lastInterval != 0) {
+                    maxIntervalChange = max(maxIntervalChange, (uint32_t)abs((int32_t)(interval - lastInterval)));
+                }
+                lastInterval = interval;
+            }
+            else {
+                lastInterval = 0;
+            }
+        }
+        lastStepTime = stepTime;
+        lastStepValid = true;
+        capturedSteps++;
+    }
+
+    // The input stopped if there hasn't been a step for longer than the last interval (or the slowest timed rate)
+    uint32_t sinceLastStep = (tickStart + now) - lastStepTime;
+    if ((lastInterval != 0) && (sinceLastStep > (2 * lastInterval))) {
+        lastInterval = 0;
+    }
+}
+
+
+// Clears the history, the next step starts a new move
+void resetStepCapture() {
+
+    // Skip over anything left in the ring
+    readIndex = (STEP_CAPTURE_BUFFER_SIZE - DMA1_Channel1 -> CNDTR) % STEP_CAPTURE_BUFFER_SIZE;
+    tickStart = 0;
+    lastPeriod = 0;
+    lastStepValid = false;
+    lastInterval = 0;
+}
+
+
+// Gets the rate of the step input from the last interval (pulses/s)
+uint32_t getCapturedStepRate() {
+    uint32_t interval = lastInterval;
+    return ((interval != 0) ? (captureTimerFreq / interval) : 0);
+}
+
+
+// Converts counts of TIM1 to ns
+static uint32_t countsToNs(uint32_t counts) {
+    return (uint32_t)(((uint64_t)counts * 1000000000ULL) / captureTimerFreq);
+}
+
+
+// Gets a summary of the step timing
+String getStepCaptureStats() {
+    return ("Steps: " + String(capturedSteps) + F(" | Rate: ") + String(getCapturedStepRate()) + F(" steps/s | Interval: ") +
+            String(countsToNs(lastInterval)) + F(" ns (min: ") + String((minInterval == UINT32_MAX) ? 0 : countsToNs(minInterval)) +
+            F(", max: ") + String(countsToNs(maxInterval)) + F(") | Jitter: ") + String(countsToNs(maxIntervalChange)) + F(" ns"));
+}
+
+
+// Clears the statistics of the step timing
+void resetStepCaptureStats() {
+    capturedSteps = 0;
+    minInterval = UINT32_MAX;
+    maxInterval = 0;
+    maxIntervalChange = 0;
+}
+
+#endif // ! ENABLE_STEP_CAPTURE
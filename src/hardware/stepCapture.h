@@ -0,0 +1,37 @@
+#ifndef __STEP_CAPTURE_H__
+#define __STEP_CAPTURE_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the step capture is enabled
+#ifdef ENABLE_STEP_CAPTURE
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Timestamps of the step input, taken by the hardware
+// TIM2 already counts the step pin (TI1), so its channel 3 captures on the same edge (through the trigger input, TI1FP1)
+// Each capture has the DMA copy TIM1's counter (the correction timer, at the timer clock) into a ring, so a step takes no interrupt at all
+// The control loop turns the captured counts into times every tick, placing each one in the tick that it landed in
+
+// Sets up the capture and its DMA channel (TIM1 and TIM2 have to be running, timerFreq is the rate of TIM1's counter)
+void initStepCapture(uint32_t timerFreq);
+
+// Takes in the steps captured since the last tick (called every correction, while TIM1 is running)
+void updateStepCapture();
+
+// Clears the history, the next step starts a new move (the correction timer was paused)
+void resetStepCapture();
+
+// Gets the rate of the step input from the last interval (pulses/s), or 0 if the input has been still for longer than the interval
+uint32_t getCapturedStepRate();
+
+// Gets a summary of the step timing (steps, the last, shortest, and longest intervals, and the largest change between a pair of intervals)
+String getStepCaptureStats();
+
+// Clears the statistics of the step timing
+void resetStepCaptureStats();
+
+#endif // ! ENABLE_STEP_CAPTURE
+#endif // ! __STEP_CAPTURE_H__
@@ -1,20 +1,29 @@
 // Import the header file
 #include "timers.h"
+#include "vectorTable.h"
+#include "controlMode.h"
+#include "configCommit.h"
+#include "softLimits.h"
+#include "canGearing.h"
+#include "pvt.h"
+#include "probe.h"
 
 // Optimize for speed
 #pragma GCC optimize ("-Ofast")
 
 // Timer uses:
-// - TIM1 - Used to time correction calculations
+// - TIM1 - Used to time correction calculations (and the background encoder reads)
 // - TIM2 - Used to count steps (stores master record of steps)
 // - TIM3 - Used to generate PWM signal for motor
 // - TIM4 - Used to schedule steps for the motor (used by PID and direct stepping)
 
-// Create a new timer instance
-HardwareTimer *correctionTimer = new HardwareTimer(TIM1);
+// Create a new timer instance, constructed in place so that it stays off the heap
+alignas(HardwareTimer) static uint8_t correctionTimerStorage[sizeof(HardwareTimer)];
+HardwareTimer *correctionTimer = new (correctionTimerStorage) HardwareTimer(TIM1);
 
-// The frequency at which to update the correction timer
-uint32_t correctionUpdateFreq = round(STEP_UPDATE_FREQ * motor.getMicrostepping());
+// Accumulates the correction speed every loop, a correction step is taken each time it passes the loop rate (without PID)
+// Keeps the correction speed at STEP_UPDATE_FREQ (or CATCH_UP_SLEW_FREQ) full steps per second, no matter the microstepping
+uint32_t correctionStepAccumulator = 0;
 
 // If step correction is enabled (helps to prevent enabling the timer when it is already enabled)
 bool stepCorrection = false;
@@ -27,6 +36,19 @@ uint16_t outOfPosCount = 0;
 // interrupts before the uninterruptible function 2 that called the first function finishes.
 static uint8_t interruptBlockCount = 0;
 
+// The priority mask from before the first block, restored once all of the blocks are cleared
+static uint32_t savedBasePriority = 0;
+
+// The cycle count when the first block started (for the longest time that the interrupts are masked)
+#ifdef ENABLE_PROFILING
+static uint32_t blockStartCycles = 0;
+#endif
+
+// Step pin interrupt, taken from the SRAM vector table
+#if defined(ENABLE_MOTION_SAFE_FLASH) && !defined(ENABLE_HARDWARE_STEP_COUNTING)
+static void stepPinIRQHandler();
+#endif
+
 // Create a boolean to store if the StallFault pin has been enabled.
 // Pin is only setup after the first StallFault. This prevents programming interruptions
 #ifdef ENABLE_STALLFAULT
@@ -38,14 +60,21 @@ static uint8_t interruptBlockCount = 0;
 #ifdef ENABLE_PID
     // Create an instance of the PID class
     StepperPID pid = StepperPID();
+
+    // Leftover of the PID's output that hasn't added up to a whole microstep yet (steps/s * ticks, counter clockwise is positive)
+    // The correction moves the coils itself, so the step schedule timer is left to the moves
+    #ifdef ENABLE_CONCURRENT_CORRECTION
+        static int32_t pidStepAccumulator = 0;
+    #endif
 #endif
 
 
 // Setup everything related to step scheduling
 #if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
 
-    // Main timer for scheduling steps
-    HardwareTimer *stepScheduleTimer = new HardwareTimer(TIM4);
+    // Main timer for scheduling steps (constructed in place, like the correction's)
+    alignas(HardwareTimer) static uint8_t stepScheduleTimerStorage[sizeof(HardwareTimer)];
+    HardwareTimer *stepScheduleTimer = new (stepScheduleTimerStorage) HardwareTimer(TIM4);
 
     // Direction of movement for direct steps
     STEP_DIR scheduledStepDir = COUNTER_CLOCKWISE;
@@ -61,6 +90,50 @@ static uint8_t interruptBlockCount = 0;
     bool decrementRemainingSteps = false;
 #endif
 
+// Phase accumulator of the PID's correction steps, the velocity word is added every tick of the fixed rate timer and a step is taken on each carry
+#ifdef ENABLE_DDS_STEPPING
+    static uint32_t ddsPhase = 0;
+    static uint32_t ddsIncrement = 0;
+
+    // Velocity word of 1 step/s
+    #define DDS_INCREMENT_PER_HZ (uint32_t)(4294967296ULL / DDS_TICK_FREQ)
+#endif
+
+// Profile of the planned move that is being stepped out
+#ifdef ENABLE_MOTION_PLANNER
+    motionProfile scheduledProfile;
+
+    // If the scheduled steps are following the profile (false for constant rate moves)
+    bool scheduledProfileActive = false;
+#endif
+
+// Velocity (jog) mode
+// The velocity is signed (counter clockwise is positive) and moves toward the target by the acceleration every step
+#ifdef ENABLE_JOG
+    volatile bool jogActive = false;
+    int64_t jogVelocity = 0;        // Current rate (steps/s, Q16)
+    int64_t jogTargetVelocity = 0;  // Rate to ramp to and hold (steps/s, Q16)
+    int64_t jogAccelPerTick = 0;    // Change of the rate in a tick of the step schedule timer (steps/s, Q16)
+#endif
+
+// Queue of move segments
+// The parser is the only producer and the step schedule interrupt is the only consumer while the queue is running
+#ifdef ENABLE_STEP_QUEUE
+    RingBuffer<stepSegment, STEP_QUEUE_SIZE> stepQueue;
+
+    // If the step schedule interrupt is working through the queue (only cleared by the interrupt once the queue is empty)
+    volatile bool stepQueueRunning = false;
+#endif
+
+// Hysteresis of the correction
+// The filtered error is kept with CORRECTION_ERROR_FILTER bits of fraction
+#ifdef ENABLE_CORRECTION_HYSTERESIS
+    static uint16_t correctionEnterError = CORRECTION_ENTER_ERROR;
+    static uint16_t correctionExitError = CORRECTION_EXIT_ERROR;
+    static int32_t filteredStepError = 0;
+    static bool correctionActive = false;
+#endif
+
 // Tiny little function, just gets the time that the current program has been running
 uint32_t sec() {
     return (millis() / 1000);
@@ -71,10 +144,17 @@ void setupMotorTimers() {
 
     // Interupts are in order of importance as follows -
     // - 5 - hardware step counter overflow handling
+    // - 5 - direction pin switches at the PWM update event (if ENABLE_PWM_SYNC_OUTPUT)
     // - 6 - step pin change
+    // - 6.1 - encoder background read (if ENABLE_ENCODER_DMA)
     // - 7.0 - position correction (or PID interval update)
     // - 7.1 - scheduled steps (if ENABLE_DIRECT_STEPPING or ENABLE_PID)
 
+    // The step interpolation times the pulses with the cycle counter, as does the overrun detection with the corrections
+    #if defined(ENABLE_STEP_INTERPOLATION) || defined(ENABLE_OVERRUN_DETECTION)
+        initCycleCounter();
+    #endif
+
     // Check if StallFault is enabled
     #ifdef ENABLE_STALLFAULT
 
@@ -87,28 +167,55 @@ void setupMotorTimers() {
     // Attach the interupt to the step pin (subpriority is set in PlatformIO config file)
     // A normal step pin triggers on the rising edge. However, as explained here: https://github.com/CAP1Sup/Intellistep/pull/50#discussion_r663051004
     // the optocoupler inverts the signal. Therefore, the falling edge is the correct value.
-    attachInterrupt(STEP_PIN, stepMotor, FALLING); // input is pull-upped to VDD
+    // Not needed with hardware step counting, the correction follows TIM2's count instead
+    #ifndef ENABLE_HARDWARE_STEP_COUNTING
+        attachInterrupt(STEP_PIN, stepMotor, FALLING); // input is pull-upped to VDD
+
+        // Take the interrupt from SRAM, so that it keeps running while the flash is busy
+        #ifdef ENABLE_MOTION_SAFE_FLASH
+            setRAMVector(EXTI0_IRQn, stepPinIRQHandler);
+        #endif
+    #endif
 
     // Setup the timer for steps
     correctionTimer -> pause();
-    correctionTimer -> setInterruptPriority(7, 0);
+    correctionTimer -> setInterruptPriority(CORRECTION_IRQ_PRIO, 0);
     correctionTimer -> setMode(1, TIMER_OUTPUT_COMPARE); // Disables the output, since we only need the timed interrupt
 
-    // Set the update rate and the variable that stores it
-    correctionUpdateFreq = round(STEP_UPDATE_FREQ * motor.getMicrostepping());
-    correctionTimer -> setOverflow(correctionUpdateFreq, HERTZ_FORMAT);
+    // Set the update rate (fixed, it doesn't depend on the microstepping)
+    correctionTimer -> setOverflow(CONTROL_LOOP_FREQ, HERTZ_FORMAT);
+    #ifdef ENABLE_ENCODER_OBSERVER
+        motor.encoder.setObserverRate(CONTROL_LOOP_FREQ);
+    #endif
 
     // Finish setting up the correction timer
-    #ifndef CHECK_STEPPING_RATE
-        correctionTimer -> attachInterrupt(correctMotor);
+    correctionTimer -> attachInterrupt(correctMotor);
+
+    // Start the background encoder reads a little before each correction, so that the angle is ready when needed (with the triggered reads, channel 3 starts them)
+    #ifdef ENABLE_ENCODER_DMA
+        motor.encoder.beginAcquisition();
+        updateEncoderSampleTime();
+        correctionTimer -> attachInterrupt(1, sampleEncoder);
     #endif
     correctionTimer -> refresh();
 
+    // Timestamp the steps with the correction timer's counter
+    #ifdef ENABLE_STEP_CAPTURE
+        initStepCapture(correctionTimer -> getTimerClkFreq() / (TIM1 -> PSC + 1));
+    #endif
+
     // Setup step schedule timer if it is enabled
     #if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
         stepScheduleTimer -> pause();
-        stepScheduleTimer -> setInterruptPriority(7, 1);
+        stepScheduleTimer -> setInterruptPriority(STEP_SCHEDULE_IRQ_PRIO, 1);
         stepScheduleTimer -> setMode(1, TIMER_OUTPUT_COMPARE); // Disables the output, since we only need the timed interrupt
+
+        // Fix the prescaler, so that rate changes are only a write to the auto reload register
+        // The preload buffers the new period until the next update event, so a rate change never cuts a step period short
+        // Only overflows trigger the interrupt, so forcing an update (to load a period while paused) doesn't step the motor
+        stepScheduleTimer -> setPrescaleFactor(stepScheduleTimer -> getTimerClkFreq() / STEP_SCHEDULE_TICK_FREQ);
+        TIM4 -> CR1 |= (TIM_CR1_ARPE | TIM_CR1_URS);
+
         stepScheduleTimer -> attachInterrupt(stepScheduleHandler);
         stepScheduleTimer -> refresh();
         // Don't re-enable the motor, that will be done when the steps are scheduled
@@ -120,7 +227,9 @@ void setupMotorTimers() {
 void disableMotorTimers() {
 
     // Detach the step interrupt
-    detachInterrupt(STEP_PIN);
+    #ifndef ENABLE_HARDWARE_STEP_COUNTING
+        detachInterrupt(STEP_PIN);
+    #endif
 
     // Disable the correctional timer
     if (stepCorrection) {
@@ -128,10 +237,31 @@ void disableMotorTimers() {
         syncInstructions();
     }
 
+    // The velocity of the step input is stale once the corrections stop, so the coils shouldn't be led by it anymore
+    #ifdef ENABLE_STEP_FEED_FORWARD
+        motor.resetStepFeedForward();
+    #endif
+
+    // The timestamps can only be placed while the correction timer is running
+    #ifdef ENABLE_STEP_CAPTURE
+        resetStepCapture();
+    #endif
+
+    // The coils are left to whatever took over the motor, they shouldn't be held back anymore
+    #ifdef ENABLE_RESONANCE_DAMPING
+        motor.resetResonanceDamping();
+    #endif
+
     // Disable the stepping timer if it is enabled
     #if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
     disableStepScheduleTimer();
     #endif
+
+    // Drop any queued moves, the interrupt isn't running so it is safe to take over the queue
+    #ifdef ENABLE_STEP_QUEUE
+    stepQueue.clear();
+    stepQueueRunning = false;
+    #endif
 }
 
 
@@ -139,7 +269,20 @@ void disableMotorTimers() {
 void enableMotorTimers() {
 
     // Attach the step interrupt
-    attachInterrupt(STEP_PIN, stepMotor, FALLING); // input is pull-upped to VDD
+    #ifndef ENABLE_HARDWARE_STEP_COUNTING
+        attachInterrupt(STEP_PIN, stepMotor, FALLING); // input is pull-upped to VDD
+    #endif
+
+    // Start the feed forward over, the steps counted while paused weren't part of a move
+    #ifdef ENABLE_STEP_FEED_FORWARD
+        motor.resetStepFeedForward();
+    #endif
+    #ifdef ENABLE_STEP_CAPTURE
+        resetStepCapture();
+    #endif
+    #ifdef ENABLE_RESONANCE_DAMPING
+        motor.resetResonanceDamping();
+    #endif
 
     // Enable the correctional timer
     if (stepCorrection) {
@@ -150,12 +293,19 @@ void enableMotorTimers() {
 
 
 // Pauses the timers, essentially disabling them for the time being
+// Only raises the priority mask (BASEPRI) to CRITICAL_SECTION_IRQ_PRIO, so the step pin and TIM2's overflow are never delayed
+// This doesn't hold off step(), anything that it also writes needs PRIMASK instead
 void disableInterrupts() {
 
-    // Disable the interrupts if this is the first block
+    // Mask the interrupts if this is the first block
+    // BASEPRI_MAX only ever raises the mask, so this can't unmask anything if called from a more urgent interrupt
     if (interruptBlockCount == 0) {
-        __disable_irq();
+        savedBasePriority = __get_BASEPRI();
+        __set_BASEPRI_MAX(CRITICAL_SECTION_IRQ_PRIO << (8 - __NVIC_PRIO_BITS));
         syncInstructions();
+        #ifdef ENABLE_PROFILING
+            blockStartCycles = getCycleCount();
+        #endif
     }
 
    // Add one to the interrupt block counter
@@ -169,9 +319,13 @@ void enableInterrupts() {
     // Remove one of the blocks on the interrupts
     interruptBlockCount--;
 
-    // If all of the blocks are gone, then re-enable the interrupts
+    // If all of the blocks are gone, then restore the old mask
+    // The time is recorded first, so the masked interrupts can't land halfway through the update
     if (interruptBlockCount == 0) {
-        __enable_irq();
+        #ifdef ENABLE_PROFILING
+            addProfileCycles(PROFILE_CRITICAL_SECTION, getCycleCount() - blockStartCycles);
+        #endif
+        __set_BASEPRI(savedBasePriority);
         syncInstructions();
     }
 }
@@ -182,6 +336,13 @@ void enableStepCorrection() {
 
     // Enable the timer if it isn't already, then set the variable
     if (!stepCorrection) {
+
+        // The PID's state is from before the correction was disabled, start it over from a standstill
+        #if defined(ENABLE_CONTROL_MODES) && defined(ENABLE_PID)
+            if (getCorrectionMode() == CONTROL_PID) {
+                pid.transfer(0);
+            }
+        #endif
         correctionTimer -> resume();
         stepCorrection = true;
         syncInstructions();
@@ -203,63 +364,471 @@ void disableStepCorrection() {
         syncInstructions();
     }
 
-    // Disable the stepping timer if needed
-    #if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
+    // Disable the stepping timer if needed (a move keeps its timer when the correction runs alongside it)
+    #ifdef ENABLE_CONCURRENT_CORRECTION
+        #ifdef ENABLE_PID
+            stopPIDSteps();
+        #endif
+    #elif (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
     disableStepScheduleTimer();
     #endif
 }
 
 
+// If the step correction timer is enabled (closed loop mode)
+bool isStepCorrectionEnabled() {
+    return stepCorrection;
+}
+
+
 // Set the speed of the step correction timer
 void updateCorrectionTimer() {
 
-    // Check the previous value of the timer, only changing if it is different
-    if (correctionUpdateFreq != (uint32_t)round(STEP_UPDATE_FREQ * (uint32_t)motor.getMicrostepping())) {
+    // The loop rate is fixed, only the correction step timing needs restarted for the new microstepping
+    correctionStepAccumulator = 0;
+}
 
-        // Compute the new freq, then set it
-        correctionUpdateFreq = (uint32_t)round(STEP_UPDATE_FREQ * motor.getMicrostepping());
-        correctionTimer -> setOverflow(correctionUpdateFreq, HERTZ_FORMAT);
 
-        // Refresh the timer, then enable it if step correction is enabled
-        correctionTimer -> refresh();
-        if (stepCorrection) {
-            correctionTimer -> resume();
-        }
+// Just a simple stepping function. Interrupt functions can't be instance methods
+void RAMFUNC stepMotor() {
+    PROFILE_SCOPE(PROFILE_STEP);
+    PROBE_SCOPE(PROBE_STEP);
 
-        // Sync the instruction barrier
-        syncInstructions();
+    // Step the motor
+    motor.step();
+}
+
+
+// Step pin interrupt, straight from the SRAM vector table (the core's EXTI dispatch runs from flash)
+#if defined(ENABLE_MOTION_SAFE_FLASH) && !defined(ENABLE_HARDWARE_STEP_COUNTING)
+static_assert(STEP_PIN == PA_0, "The step pin's RAM handler is for EXTI line 0");
+static void RAMFUNC stepPinIRQHandler() {
+    if (EXTI -> PR & EXTI_PR_PR0) {
+        EXTI -> PR = EXTI_PR_PR0;
+        stepMotor();
     }
 }
+#endif
 
 
-// Just a simple stepping function. Interrupt functions can't be instance methods
-void stepMotor() {
+// Background encoder reads
+#ifdef ENABLE_ENCODER_DMA
+
+// The length of a tick of the correction timer (us, Q16), and the fewest ticks before the trigger that a read can still be set up for it
+#ifdef ENABLE_ENCODER_TRIGGERED_READS
+static uint32_t triggerTickTime = 0;
+static uint32_t triggerMinTicks = 1;
+#endif
+
+
+// Starts a background read of the encoder (called by the correction timer's compare channel)
+void sampleEncoder() {
 
-    #ifdef CHECK_STEPPING_RATE
-        GPIO_WRITE(LED_PIN, HIGH);
+    // Set the read up for channel 3's compare event to start, or start it right away if this interrupt ran too late for the trigger
+    #ifdef ENABLE_ENCODER_TRIGGERED_READS
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+
+        // Drop the trigger's request until the read is set up, so the last period's can't start it early
+        TIM1 -> DIER &= ~TIM_DIER_CC3DE;
+        uint32_t count = (TIM1 -> CNT);
+        if ((count + triggerMinTicks) < (TIM1 -> CCR3)) {
+            uint32_t triggerTime = micros() + ((((TIM1 -> CCR3) - count) * triggerTickTime) >> 16);
+            if (motor.encoder.armAcquisition(triggerTime)) {
+                TIM1 -> DIER |= TIM_DIER_CC3DE;
+            }
+        }
+        else {
+            motor.encoder.startAcquisition();
+        }
+        __set_PRIMASK(primask);
+    #else
+        motor.encoder.startAcquisition();
     #endif
+}
 
-    // Step the motor
-    motor.step();
 
-    #ifdef CHECK_STEPPING_RATE
-        GPIO_WRITE(LED_PIN, LOW);
+// Sets the compare channel of the correction timer to start the encoder read just before the correction
+void updateEncoderSampleTime() {
+
+    // Get the period of the correction timer
+    uint32_t period = correctionTimer -> getOverflow(MICROSEC_FORMAT);
+
+    // Start the read the lead time before the period ends (or right away if the period is too short)
+    uint32_t readTime = (period > ENCODER_DMA_LEAD_TIME ? period - ENCODER_DMA_LEAD_TIME : 0);
+    #ifdef ENABLE_ENCODER_TRIGGERED_READS
+
+        // Channel 3's compare starts the read (its output stays off), channel 1's interrupt sets it up a little before
+        correctionTimer -> setCaptureCompare(3, readTime, MICROSEC_COMPARE_FORMAT);
+        correctionTimer -> setCaptureCompare(1, (readTime > ENCODER_TRIGGER_ARM_TIME ? readTime - ENCODER_TRIGGER_ARM_TIME : 0), MICROSEC_COMPARE_FORMAT);
+
+        // Find the length of the timer's ticks, a read has to be set up at least a microsecond before its trigger
+        uint32_t tickFreq = correctionTimer -> getTimerClkFreq() / (TIM1 -> PSC + 1);
+        triggerTickTime = (uint32_t)(((uint64_t)1000000 << 16) / tickFreq);
+        triggerMinTicks = max(tickFreq / 1000000, (uint32_t)1);
+    #else
+        correctionTimer -> setCaptureCompare(1, readTime, MICROSEC_COMPARE_FORMAT);
     #endif
 }
+#endif // ! ENABLE_ENCODER_DMA
+
+
+// Stops the PID's correction steps (the step schedule timer, or the leftover of the output when the moves have the timer)
+#ifdef ENABLE_PID
+void RAMFUNC stopPIDSteps() {
+    #ifdef ENABLE_CONCURRENT_CORRECTION
+        pidStepAccumulator = 0;
+    #else
+        disableStepScheduleTimer();
+    #endif
+}
+#endif
+
+
+// Correction steps from the encoder (FOC and the encoder commutation correct through the commutation instead)
+#if !defined(ENABLE_FOC) && !defined(ENABLE_ENCODER_COMMUTATION)
+#if defined(ENABLE_PID) && !defined(ENABLE_CONCURRENT_CORRECTION)
+// Steps the motor at a rate with the step schedule timer, enabling it if it isn't already
+static void RAMFUNC runPIDSteps(uint32_t stepFreq) {
+    #ifdef ENABLE_DDS_STEPPING
+        // Only the velocity word changes, taking effect on the next tick (the timer keeps its fixed rate)
+        ddsIncrement = (min(stepFreq, DDS_TICK_FREQ - 1) * DDS_INCREMENT_PER_HZ);
+        if (!stepScheduleTimerEnabled) {
+            setStepScheduleRate(DDS_TICK_FREQ);
+            enableStepScheduleTimer();
+        }
+    #else
+        setStepScheduleRate(stepFreq);
+        enableStepScheduleTimer();
+    #endif
+}
+#endif
+
+
+#ifdef ENABLE_PID
+// PID correction, steps the motor back at the rate of the PID's output with the step schedule timer (returns the output)
+static int32_t RAMFUNC correctWithPID() {
+
+    // Run the PID calcalations (the autotune's relay takes over while it is running)
+    #ifdef ENABLE_AUTOTUNE
+        int32_t pidOutput = (isAutotuneRunning() ? computeAutotuneOutput() : pid.compute());
+    #else
+        int32_t pidOutput = pid.compute();
+    #endif
+    uint32_t stepFreq = abs(pidOutput); //(DEFAULT_PID_STEP_MAX - abs(pidOutput));
+
+    #ifdef ENABLE_CONCURRENT_CORRECTION
+        // Move the coils by the output's worth of microsteps for this tick, keeping the fraction for the next one
+        // Below the movement threshold the coils are left where they are, the motor stays on so that a move can keep running
+        if (stepFreq > DEFAULT_PID_DISABLE_THRESHOLD) {
+            pidStepAccumulator += pidOutput;
+            int32_t correctionSteps = (pidStepAccumulator / CONTROL_LOOP_FREQ);
+            pidStepAccumulator -= (correctionSteps * CONTROL_LOOP_FREQ);
+            if (correctionSteps != 0) {
+                motor.moveCoils(correctionSteps);
+                #ifdef ENABLE_MOVE_METRICS
+                    countMoveCorrections(abs(correctionSteps));
+                #endif
+            }
+        }
+        else {
+            pidStepAccumulator = 0;
+        }
+    #else
+    // Check if the value is 0 (meaning that the timer needs disabled)
+    if (stepFreq == 0) {
+
+        // The timer needs disabled
+        disableStepScheduleTimer();
+    }
+    else {
+        // Set the direction
+        #ifdef ENABLE_DDS_STEPPING
+            STEP_DIR lastStepDir = scheduledStepDir;
+        #endif
+        if (pidOutput > 0) {
+            scheduledStepDir = COUNTER_CLOCKWISE;
+        }
+        else {
+            scheduledStepDir = CLOCKWISE;
+        }
+
+        // The leftover phase was toward the last direction, start the first step the other way over
+        #ifdef ENABLE_DDS_STEPPING
+            if (scheduledStepDir != lastStepDir) {
+                ddsPhase = 0;
+            }
+        #endif
+
+        // Set that we don't want to decrement the counter
+        decrementRemainingSteps = false;
+
+        // Check if there's a movement threshold
+        #if (DEFAULT_PID_DISABLE_THRESHOLD > 0)
+
+            // Check to make sure that the movement threshold is exceeded, otherwise disable the motor
+            if (stepFreq > DEFAULT_PID_DISABLE_THRESHOLD) {
+
+                // Set the speed, enabling the timer if it isn't already
+                runPIDSteps(stepFreq);
+                #ifdef ENABLE_MOVE_METRICS
+                    countMoveCorrectionRate(stepFreq);
+                #endif
+
+                // Enable the motor
+                motor.setState(ENABLED);
+            }
+            else {
+                // No correction needed, pause the timer
+                disableStepScheduleTimer();
+                motor.setState(DISABLED);
+            }
+        #else
+            // Set the motor timer to call the stepping routine at specified time intervals
+            runPIDSteps(stepFreq);
+            #ifdef ENABLE_MOVE_METRICS
+                countMoveCorrectionRate(stepFreq);
+            #endif
+        #endif
+    }
+    #endif // ! ENABLE_CONCURRENT_CORRECTION
+
+    // Return the output for the trace
+    return pidOutput;
+}
+#endif // ! ENABLE_PID
+
+
+// Direction based correction, steps the motor back toward the desired position at a fixed rate
+#if !defined(ENABLE_PID) || defined(ENABLE_CONTROL_MODES)
+static void RAMFUNC correctWithSteps(int32_t stepDeviation) {
+    #ifdef ENABLE_CATCH_UP_CORRECTION
+        // Correction based on direction, moving back as many microsteps as the slew allows in a single tick
+        correctionStepAccumulator += CATCH_UP_SLEW_FREQ * motor.getMicrostepping();
+        uint32_t catchUpSteps = min(correctionStepAccumulator / CONTROL_LOOP_FREQ, (uint32_t)abs(stepDeviation));
+        if (catchUpSteps > 0) {
+            motor.moveCoils(stepDeviation > 0 ? -(int32_t)catchUpSteps : (int32_t)catchUpSteps);
+            #ifdef ENABLE_MOVE_METRICS
+                countMoveCorrections(catchUpSteps);
+            #endif
+        }
+
+        // Only the leftover fraction of a step is kept, the slew that wasn't needed isn't saved up for later
+        correctionStepAccumulator = (correctionStepAccumulator - (catchUpSteps * CONTROL_LOOP_FREQ)) % CONTROL_LOOP_FREQ;
+    #else
+        // Just "dumb" correction based on direction
+        // Only step when the accumulator passes the loop rate, keeping the correction speed the same for all microstepping
+        correctionStepAccumulator += STEP_UPDATE_FREQ * motor.getMicrostepping();
+        if (correctionStepAccumulator >= CONTROL_LOOP_FREQ) {
+            correctionStepAccumulator -= CONTROL_LOOP_FREQ;
+            #ifdef ENABLE_MOVE_METRICS
+                countMoveCorrections(1);
+            #endif
+            if (stepDeviation > 0) {
+
+                // Motor is at a position larger than the desired one
+                // Use the current angle to find the current step, then subtract 1
+                motor.step(CLOCKWISE, false, false);
+                //motor.driveCoils(round(getAbsoluteAngle() / (motor.getMicrostepAngle()) - (motor.getMicrostepping())));
+            }
+            else {
+                // Motor is at a position smaller than the desired one
+                // Use the current angle to find the current step, then add 1
+                motor.step(COUNTER_CLOCKWISE, false, false);
+                //motor.driveCoils(round(getAbsoluteAngle() / (motor.getMicrostepAngle()) + (motor.getMicrostepping())));
+            }
+        }
+    #endif // ! ENABLE_CATCH_UP_CORRECTION
+}
+#endif
+#endif // ! ENABLE_FOC && ! ENABLE_ENCODER_COMMUTATION
+
+
+#ifdef ENABLE_CORRECTION_HYSTERESIS
+// Sets the errors that start and stop the correction (microsteps)
+void setCorrectionHysteresis(uint16_t enterError, uint16_t exitError) {
+    disableInterrupts();
+    correctionEnterError = enterError;
+    correctionExitError = exitError;
+    enableInterrupts();
+}
+
+
+// Gets the error that starts the correction (microsteps)
+uint16_t getCorrectionEnterError() {
+    return correctionEnterError;
+}
+
+
+// Gets the error that the correction runs down to (microsteps)
+uint16_t getCorrectionExitError() {
+    return correctionExitError;
+}
+
+
+// Checks if the motor needs to be corrected, starting once the filtered error passes the enter error and stopping once the error is within the exit error
+static bool RAMFUNC correctionNeeded(int32_t stepDeviation) {
+
+    // Filter the error, the noise of the encoder averages out
+    filteredStepError += (stepDeviation - (filteredStepError >> CORRECTION_ERROR_FILTER));
+    uint32_t error = abs(stepDeviation);
+    if (correctionActive) {
+
+        // The filter is restarted from the settled error, otherwise its lag would start the correction again right away
+        if (error <= correctionExitError) {
+            correctionActive = false;
+            filteredStepError = (stepDeviation * (1 << CORRECTION_ERROR_FILTER));
+        }
+    }
+    else {
+        correctionActive = (error >= CORRECTION_IMMEDIATE_ERROR || (uint32_t)abs(filteredStepError >> CORRECTION_ERROR_FILTER) > correctionEnterError);
+    }
+    return correctionActive;
+}
+#endif // ! ENABLE_CORRECTION_HYSTERESIS
 
 
 // Need to declare a function to power the motor coils for the step interrupt
-void correctMotor() {
-    #ifdef CHECK_CORRECT_MOTOR_RATE
-        GPIO_WRITE(LED_PIN, HIGH);
+void RAMFUNC correctMotor() {
+    PROFILE_SCOPE(PROFILE_CORRECTION);
+    PROBE_SCOPE(PROBE_CORRECTION);
+
+    // Time the correction, to find if it runs past its period
+    #ifdef ENABLE_OVERRUN_DETECTION
+        uint32_t tickStartCycles = getCycleCount();
+    #endif
+
+    // The control loop is still running
+    #ifdef ENABLE_WATCHDOG
+        watchdogCheckIn(WATCHDOG_CONTROL_LOOP);
+    #endif
+
+    // Change the settings that were committed since the last tick, before anything reads them
+    #ifdef ENABLE_CONFIG_COMMIT
+        applyCommittedConfig();
+    #endif
+
+    // Mark the start of the correction, then keep what the trace needs as the correction runs
+    #ifdef ENABLE_TRACE
+        uint32_t traceStartCycles = getCycleCount();
+        int32_t traceError = 0;
+        int32_t traceOutput = 0;
+        bool traceEnabled = false;
+    #endif
+
+    // Start a new encoder tick, all reads during this correction will share a single sample
+    #ifdef ENABLE_ENCODER_TICK_CACHE
+        motor.encoder.beginTick();
+    #endif
+
+    // Advance the tracking observer (once per tick, using the tick's sample)
+    #ifdef ENABLE_ENCODER_OBSERVER
+        motor.encoder.updateObserver();
+    #endif
+
+    // Feed the replayed step stream in, like pulses of the step pin
+    #ifdef ENABLE_STEP_STREAM
+        replayStepStream();
+    #endif
+
+    // Move the coils to the steps counted by TIM2 since the last correction
+    #ifdef ENABLE_HARDWARE_STEP_COUNTING
+        motor.followHardStepCNT();
     #endif
 
-    // Check to see the state of the enable pin
-    if ((GPIO_READ(ENABLE_PIN) != motor.getEnableInversion()) && (motor.getState() != FORCED_ENABLED)) {
+    // Move the coils toward the last pulse of the step pin
+    #ifdef ENABLE_STEP_INTERPOLATION
+        motor.updateStepInterpolation();
+    #endif
+
+    // Move the follower's target along the master's rate
+    #ifdef ENABLE_CAN_GEARING
+        updateGearing();
+    #endif
+
+    // Move the desired position along the trajectory
+    #ifdef ENABLE_PVT_TRAJECTORY
+        updatePVT();
+    #endif
+
+    // Check the desired position against the soft limits, before the coils are corrected toward it
+    #ifdef ENABLE_SOFT_LIMITS
+        checkSoftLimits();
+    #endif
+
+    // Compare the step pin's pulses with TIM2's count
+    #ifdef ENABLE_STEP_GLITCH_STATS
+        motor.updateStepGlitchStats();
+    #endif
+
+    // Take in the timestamps of the steps since the last correction
+    #ifdef ENABLE_STEP_CAPTURE
+        updateStepCapture();
+    #endif
+
+    // Find the commanded velocity and acceleration from the step input, leading the coils by them
+    #ifdef ENABLE_STEP_FEED_FORWARD
+        motor.updateStepFeedForward();
+    #endif
+
+    // Hold the coils back against the mid-band ringing
+    #ifdef ENABLE_RESONANCE_DAMPING
+        motor.updateResonanceDamping();
+    #endif
+
+    // Heat the coils in the thermal model, lowering the current if they're getting too hot
+    #ifdef ENABLE_THERMAL_MODEL
+        motor.updateThermalModel();
+    #endif
+
+    // Raise the current to make up for the back-EMF at speed (thinned out while the loop is overloaded, the speed changes slowly)
+    #ifdef ENABLE_SPEED_CURRENT_BOOST
+        if (SLOW_UPDATE_DUE()) {
+            motor.updateCurrentBoost();
+        }
+    #endif
+
+    // Switch the PWM between the smooth and fast modes with the speed (thinned out like the current boost)
+    #ifdef ENABLE_ADAPTIVE_PWM
+        if (SLOW_UPDATE_DUE()) {
+            motor.updatePWMMode();
+        }
+    #endif
+
+    // Update the dynamic current setpoint (the step interrupt only reads it, so it never has to sample the encoder)
+    #ifdef ENABLE_DYNAMIC_CURRENT
+        motor.updateDynamicCurrent();
+    #endif
+
+    // Stop driving the motor if the encoder can't be read, the motor stays off until it is enabled again (M17)
+    if (motor.encoder.hasHealthFault()) {
+        motor.setState(ENCODER_FAULT, true);
+    }
+
+    // Check to see the state of the enable pin (or if the motor was stopped by a fault)
+    if ((motor.getState() == ENCODER_FAULT) || ((GPIO_READ(ENABLE_PIN) != motor.getEnableInversion()) && (motor.getState() != FORCED_ENABLED))) {
 
         // The enable pin is off, the motor should be disabled
         motor.setState(DISABLED);
 
+        // The error doesn't mean anything while the motor is off
+        #ifdef ENABLE_STALL_DETECTION
+            resetStallDetector();
+        #endif
+        #ifdef ENABLE_MOVE_METRICS
+            abortMoveMetrics();
+        #endif
+
+        // Start at the full current when the motor is enabled again
+        #ifdef ENABLE_IDLE_CURRENT
+            motor.resetIdleCurrent();
+        #endif
+
+        // Don't start pushing again on its own when the motor is enabled again
+        #ifdef ENABLE_TORQUE_MODE
+            motor.exitTorqueMode();
+        #endif
+
         // Only include if StallFault is enabled
         #ifdef ENABLE_STALLFAULT
 
@@ -273,97 +842,112 @@ void correctMotor() {
             GPIO_WRITE(LED_PIN, LOW);
         #endif
     }
+    #ifdef ENABLE_TORQUE_MODE
+    else if (motor.isTorqueModeActive()) {
+
+        // Hold the commanded torque instead of a position (the step error grows as it pushes, so the position loop and the stall checks are left out)
+        motor.setState(ENABLED);
+        motor.commutateTorque();
+
+        // The PID's correction steps aren't needed
+        #ifdef ENABLE_PID
+            stopPIDSteps();
+        #endif
+
+        // The step error isn't a following error while pushing
+        #ifdef ENABLE_MOVE_METRICS
+            abortMoveMetrics();
+        #endif
+    }
+    #endif
     else {
 
         // Enable the motor if it's not already (just energizes the coils to hold it in position)
         motor.setState(ENABLED);
 
+        // Commutate to the rotor, the current vector steers the motor back into position
+        #ifdef ENABLE_FOC
+            motor.commutateFOC();
+        #endif
+
         // Get the angular deviation
         int32_t stepDeviation = motor.getStepError();
 
-        // Check to make sure that the motor is in range (it hasn't skipped steps)
-        if (abs(stepDeviation) > 1) {
-
-            // Run PID stepping if enabled
-            #ifdef ENABLE_PID
-
-                // Run the PID calcalations
-                int32_t pidOutput = round(pid.compute());
-                uint32_t stepFreq = abs(pidOutput); //(DEFAULT_PID_STEP_MAX - abs(pidOutput));
-
-                // Check if the value is 0 (meaning that the timer needs disabled)
-                if (stepFreq == 0) {
+        // Check if the motor is starting to stall (runs every correction, so it can see the error grow)
+        #ifdef ENABLE_STALL_DETECTION
+            bool stallPredicted = updateStallDetector(stepDeviation);
+        #elif defined(ENABLE_STALLFAULT)
+            const bool stallPredicted = false;
+        #endif
+        #ifdef ENABLE_TRACE
+            traceError = stepDeviation;
+            traceEnabled = true;
+        #endif
 
-                    // The timer needs disabled
-                    disableStepScheduleTimer();
-                }
-                else {
-                    // Set the direction
-                    if (pidOutput > 0) {
-                        scheduledStepDir = COUNTER_CLOCKWISE;
-                    }
-                    else {
-                        scheduledStepDir = CLOCKWISE;
-                    }
+        // Collect the following error of the move, and how long it takes to settle after (left out once the overloaded loop sheds its work)
+        #ifdef ENABLE_MOVE_METRICS
+            if (INSTRUMENTATION_DUE()) {
+                updateMoveMetrics(stepDeviation);
+            }
+        #endif
 
-                    // Set that we don't want to decrement the counter
-                    decrementRemainingSteps = false;
+        // Lock the coils to the rotor again (every tick, so that they move back onto the desired position once it is within reach)
+        #ifdef ENABLE_ENCODER_COMMUTATION
+            motor.commutateEncoder(stepDeviation);
+        #endif
 
-                    // Check if there's a movement threshold
-                    #if (DEFAULT_PID_DISABLE_THRESHOLD > 0)
+        // Lower the current if the motor has been still for a while (any motion or error restores it)
+        #ifdef ENABLE_IDLE_CURRENT
+            motor.updateIdleCurrent(stepDeviation);
+        #endif
 
-                        // Check to make sure that the movement threshold is exceeded, otherwise disable the motor
-                        if (stepFreq > DEFAULT_PID_DISABLE_THRESHOLD) {
+        // Raise the current as the error grows, letting it decay back to the base once the error settles
+        #ifdef ENABLE_CURRENT_ON_DEMAND
+            motor.updateDemandCurrent(stepDeviation);
+        #endif
 
-                            // Set the speed
-                            stepScheduleTimer -> setOverflow(stepFreq, HERTZ_FORMAT);
+        // Check to make sure that the motor is in range (it hasn't skipped steps)
+        #ifdef ENABLE_CORRECTION_HYSTERESIS
+        if (correctionNeeded(stepDeviation)) {
+        #else
+        if (abs(stepDeviation) > 1) {
+        #endif
 
-                            // Enable the timer if it isn't already
-                            enableStepScheduleTimer();
+            // No correction steps are needed in the field oriented mode or with the encoder commutation, the commutation already handles it
+            #if defined(ENABLE_FOC) || defined(ENABLE_ENCODER_COMMUTATION)
 
-                            // Enable the motor
-                            motor.setState(ENABLED);
-                        }
-                        else {
-                            // No correction needed, pause the timer
-                            disableStepScheduleTimer();
-                            motor.setState(DISABLED);
-                        }
+            // Run the correction that the control mode picked
+            #elif defined(ENABLE_PID) && defined(ENABLE_CONTROL_MODES)
+                if (getCorrectionMode() == CONTROL_PID) {
+                    #ifdef ENABLE_TRACE
+                        traceOutput = correctWithPID();
                     #else
-                        // Set the motor timer to call the stepping routine at specified time intervals
-                        stepScheduleTimer -> setOverflow(stepFreq, HERTZ_FORMAT);
-
-                        // Enable the timer if it isn't already
-                        enableStepScheduleTimer();
+                        correctWithPID();
                     #endif
                 }
-
-            #else // ! ENABLE_PID
-                // Just "dumb" correction based on direction
-                // Set the stepper to move in the correct direction
-                if (/*motor.getStepPhase() != */ true) {
-                    if (stepDeviation > 0) {
-
-                        // Motor is at a position larger than the desired one
-                        // Use the current angle to find the current step, then subtract 1
-                        motor.step(CLOCKWISE, false, false);
-                        //motor.driveCoils(round(getAbsoluteAngle() / (motor.getMicrostepAngle()) - (motor.getMicrostepping())));
-                    }
-                    else {
-                        // Motor is at a position smaller than the desired one
-                        // Use the current angle to find the current step, then add 1
-                        motor.step(COUNTER_CLOCKWISE, false, false);
-                        //motor.driveCoils(round(getAbsoluteAngle() / (motor.getMicrostepAngle()) + (motor.getMicrostepping())));
-                    }
+                else {
+                    correctWithSteps(stepDeviation);
                 }
-            #endif // ! ENABLE_PID
+
+            // Run PID stepping if enabled
+            #elif defined(ENABLE_PID)
+                #ifdef ENABLE_TRACE
+                    traceOutput = correctWithPID();
+                #else
+                    correctWithPID();
+                #endif
+
+            // Step back toward the desired position
+            #else
+                correctWithSteps(stepDeviation);
+            #endif
 
 
             // Only use StallFault code if needed
             #ifdef ENABLE_STALLFAULT
 
-                // Check to see if the out of position faults have exceeded the maximum amounts
-                if (outOfPosCount > (STEP_FAULT_TIME * ((STEP_UPDATE_FREQ * motor.getMicrostepping()) - 1)) || abs(stepDeviation) > STEP_FAULT_STEP_COUNT) {
+                // Check to see if the out of position faults have exceeded the maximum amounts (or if a stall is on its way)
+                if (stallPredicted || outOfPosCount > (STEP_FAULT_TIME * (CONTROL_LOOP_FREQ - 1)) || abs(stepDeviation) > STEP_FAULT_STEP_COUNT) {
 
                     // Setup the StallFault pin if it isn't already
                     // We need to wait for a fault because otherwise the programmer will be unable to program the board
@@ -400,7 +984,7 @@ void correctMotor() {
 
             // Disable the PID correction timer if PID is enabled
             #ifdef ENABLE_PID
-                disableStepScheduleTimer();
+                stopPIDSteps();
             #endif
 
             // Only if StallFault is enabled
@@ -424,35 +1008,334 @@ void correctMotor() {
         }
 
     }
-    #ifdef CHECK_CORRECT_MOTOR_RATE
-        GPIO_WRITE(LED_PIN, LOW);
+
+    // Record the correction (before the tick ends, so the trace sees the same encoder sample)
+    #ifdef ENABLE_TRACE
+        if (INSTRUMENTATION_DUE()) {
+            recordTrace(traceError, traceOutput, traceEnabled, traceStartCycles);
+        }
+    #endif
+    #ifdef ENABLE_STEP_STREAM
+        recordStepStream(traceError, traceEnabled);
+    #endif
+
+    // The correction is done, so reads after it should take new samples
+    #ifdef ENABLE_ENCODER_TICK_CACHE
+        motor.encoder.endTick();
+    #endif
+
+    // Check the time that the correction took, shedding work if the loop has been overloaded
+    #ifdef ENABLE_OVERRUN_DETECTION
+        finishControlTick(tickStartCycles);
+    #endif
+}
+
+
+// Handing the step schedule timer back to the correction
+#if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
+// Stops the step schedule timer once a move is done, then gives the motor back to the correction if it was paused
+static void finishDirectMove() {
+    disableStepScheduleTimer();
+    #ifndef ENABLE_CONCURRENT_CORRECTION
+        if (stepCorrection) {
+            correctionTimer -> resume();
+            syncInstructions();
+        }
     #endif
 }
+#endif
 
 
 // Direct stepping
 #ifdef ENABLE_DIRECT_STEPPING
+// Hands the step schedule timer to a move
+// The correction is paused, since it needs the same timer for the PID's steps (unless it runs alongside the moves, tracking the position that they step out)
+static void startDirectMove() {
+    #ifndef ENABLE_CONCURRENT_CORRECTION
+        correctionTimer -> pause();
+        syncInstructions();
+    #endif
+}
+
+
 // Configure a specific number of steps to execute at a set rate (rate is in Hz)
 void scheduleSteps(int64_t count, int32_t rate, STEP_DIR stepDir) {
 
-    // Disable the correctional timer (needed to prevent both using the step timer at once)
-    correctionTimer -> pause();
-    syncInstructions();
+    // Hand the step schedule timer over to the move
+    startDirectMove();
+
+    // The move takes over from the jog
+    #ifdef ENABLE_JOG
+        jogActive = false;
+    #endif
 
     // Set the count and step direction
     remainingScheduledSteps = abs(count);
     decrementRemainingSteps = true;
     scheduledStepDir = stepDir;
 
+    // Constant rate move, the profile doesn't need to be followed
+    #ifdef ENABLE_MOTION_PLANNER
+        scheduledProfileActive = false;
+    #endif
+
     // Configure the speed of the timer, then re-enable it
-    stepScheduleTimer -> setOverflow(rate, HERTZ_FORMAT);
+    setStepScheduleRate(rate);
+    enableStepScheduleTimer();
+}
+
+
+#ifdef ENABLE_MOTION_PLANNER
+// Configure a specific number of steps to execute, ramping up to the rate and back down with the acceleration and jerk limits
+void schedulePlannedSteps(int64_t count, uint32_t rate, uint32_t accel, uint32_t jerk, STEP_DIR stepDir) {
+
+    // Hand the step schedule timer over to the move
+    startDirectMove();
+
+    // The move takes over from the jog
+    #ifdef ENABLE_JOG
+        jogActive = false;
+    #endif
+
+    // Set the count and step direction
+    remainingScheduledSteps = abs(count);
+    decrementRemainingSteps = true;
+    scheduledStepDir = stepDir;
+
+    // Build the profile, then start the timer at the first step's rate
+    setStepScheduleRate(startMotionProfile(scheduledProfile, rate, accel, jerk));
+    scheduledProfileActive = true;
     enableStepScheduleTimer();
 }
+#endif // ! ENABLE_MOTION_PLANNER
+
+
+#ifdef ENABLE_STEP_QUEUE
+// Loads a segment as the current move, without touching the timer's state
+// Called by the step schedule interrupt to chain moves, so the next step follows the last one without any dead time
+static void startStepSegment(const stepSegment &segment) {
+
+    // Set the count and step direction
+    remainingScheduledSteps = segment.count;
+    decrementRemainingSteps = true;
+    scheduledStepDir = segment.dir;
+
+    // Set the rate, following a profile if limits were given
+    #ifdef ENABLE_MOTION_PLANNER
+    if (segment.accel > 0) {
+        setStepScheduleRate(startMotionProfile(scheduledProfile, segment.rate, segment.accel, segment.jerk));
+        scheduledProfileActive = true;
+        return;
+    }
+    scheduledProfileActive = false;
+    #endif
+    setStepScheduleRate(segment.rate);
+}
+
+
+// Adds a move to the back of the queue, starting it right away if the queue is idle
+bool queueSteps(int64_t count, uint32_t rate, uint32_t accel, uint32_t jerk, STEP_DIR stepDir) {
+
+    // Nothing to move
+    if (count == 0) {
+        return true;
+    }
+
+    // Add the segment to the queue
+    stepSegment segment = { (uint32_t)abs(count), rate, accel, jerk, stepDir };
+    if (!stepQueue.push(segment)) {
+        return false;
+    }
+
+    // Start the queue if the interrupt isn't already working through it
+    // The interrupt only clears the running flag once it sees the queue empty, so it can't miss the segment that was just pushed
+    if (!stepQueueRunning && stepQueue.pop(segment)) {
+
+        // Hand the step schedule timer over to the move
+        startDirectMove();
+
+        // The move takes over from the jog
+        #ifdef ENABLE_JOG
+            jogActive = false;
+        #endif
+
+        // Start the move, then hand the queue over to the interrupt
+        startStepSegment(segment);
+        stepQueueRunning = true;
+        enableStepScheduleTimer();
+    }
+
+    // Segment was queued
+    return true;
+}
+
+
+// Number of moves waiting to be started
+uint16_t getQueuedSegmentCount() {
+    return stepQueue.count();
+}
+
+
+// If the step schedule interrupt is still working through queued moves
+bool isStepQueueRunning() {
+    return stepQueueRunning;
+}
+#endif // ! ENABLE_STEP_QUEUE
+
+
+// Returns the number of scheduled steps that haven't been taken yet
+int64_t getRemainingScheduledSteps() {
+    return remainingScheduledSteps;
+}
+
+
+// If any of the direct moves are running (scheduled steps, the step queue, or a jog)
+bool isDirectMoveRunning() {
+    #ifdef ENABLE_STEP_QUEUE
+        if (stepQueueRunning) {
+            return true;
+        }
+    #endif
+    #ifdef ENABLE_JOG
+        if (jogActive) {
+            return true;
+        }
+    #endif
+    return (remainingScheduledSteps > 0);
+}
+
+
+// Stops all of the direct moves right away, the correction holds the motor where they stopped
+// Called by the correction or the step schedule interrupt, which can't interrupt each other, so the moves can be taken over without masking
+void stopDirectMoves() {
+
+    // The step schedule timer is the PID's when no move is running
+    if (!isDirectMoveRunning()) {
+        return;
+    }
+
+    // Drop the moves, the queue is emptied from the consumer's side so the parser can't push into the middle of it
+    #ifdef ENABLE_JOG
+        jogActive = false;
+        jogVelocity = 0;
+    #endif
+    #ifdef ENABLE_STEP_QUEUE
+        stepSegment segment;
+        while (stepQueue.pop(segment)) {}
+        stepQueueRunning = false;
+    #endif
+    remainingScheduledSteps = 0;
+    decrementRemainingSteps = false;
+    #ifdef ENABLE_MOTION_PLANNER
+        scheduledProfileActive = false;
+    #endif
+
+    // Give the motor back to the correction
+    finishDirectMove();
+}
+
+
+// Velocity (jog) mode
+#ifdef ENABLE_JOG
+// Ramps to a rate (steps/s, counter clockwise is positive) with an acceleration (steps/s/s), holding it until it is changed
+void setJogVelocity(int32_t rate, uint32_t accel) {
+
+    // The step schedule interrupt reads the target and the acceleration together
+    disableInterrupts();
+    jogTargetVelocity = ((int64_t)rate << 16);
+    jogAccelPerTick = max((((int64_t)accel << 16) / STEP_SCHEDULE_TICK_FREQ), (int64_t)1);
+
+    // Start from the slowest rate if the motor isn't already jogging (the interrupt ramps it from there)
+    if (!jogActive && rate != 0) {
+
+        // Hand the step schedule timer over to the move
+        startDirectMove();
+
+        // Any move that was going is replaced
+        remainingScheduledSteps = 0;
+        decrementRemainingSteps = false;
+        #ifdef ENABLE_MOTION_PLANNER
+            scheduledProfileActive = false;
+        #endif
+
+        // Start the jog
+        jogVelocity = (rate > 0 ? ((int64_t)JOG_MIN_RATE << 16) : -((int64_t)JOG_MIN_RATE << 16));
+        jogActive = true;
+        setStepScheduleRate(JOG_MIN_RATE);
+        enableStepScheduleTimer();
+    }
+    enableInterrupts();
+}
+
+
+// Gets the rate that the motor is jogging at (steps/s, counter clockwise is positive)
+int32_t getJogVelocity() {
+    return (jogActive ? (int32_t)(jogVelocity >> 16) : 0);
+}
+
+
+// If the motor is jogging
+bool isJogging() {
+    return jogActive;
+}
+
+
+// Steps the jog, then moves the rate toward the target (called by the step schedule interrupt)
+static void stepJog() {
+
+    // The jog doesn't end, so it is stopped at the soft limits (the correction is paused while it runs)
+    #ifdef ENABLE_SOFT_LIMITS
+    if (!checkSoftLimitStep(jogVelocity > 0 ? COUNTER_CLOCKWISE : CLOCKWISE)) {
+        return;
+    }
+    #endif
+
+    // Step in the direction of the rate
+    motor.step(jogVelocity > 0 ? COUNTER_CLOCKWISE : CLOCKWISE);
+
+    // Move toward the target by the acceleration over the period of the step that was just taken
+    int64_t change = jogAccelPerTick * ((TIM4 -> ARR) + 1);
+    if (jogVelocity < jogTargetVelocity) {
+        jogVelocity = min(jogVelocity + change, jogTargetVelocity);
+    }
+    else {
+        jogVelocity = max(jogVelocity - change, jogTargetVelocity);
+    }
+
+    // The rate can't go slower than the slowest rate, that is where the jog stops or turns around
+    if (abs(jogVelocity) < ((int64_t)JOG_MIN_RATE << 16)) {
+        if (jogTargetVelocity == 0) {
+
+            // Stopped, give the motor back to the correction
+            jogActive = false;
+            jogVelocity = 0;
+            finishDirectMove();
+            return;
+        }
+
+        // Turn around (or start) at the slowest rate, toward the target
+        jogVelocity = (jogTargetVelocity > 0 ? ((int64_t)JOG_MIN_RATE << 16) : -((int64_t)JOG_MIN_RATE << 16));
+    }
+
+    // Set the rate of the next step
+    setStepScheduleRate((uint32_t)(abs(jogVelocity) >> 16));
+}
+#endif // ! ENABLE_JOG
 #endif
 
 #if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
 // Handles a step schedule event
 void stepScheduleHandler() {
+    PROFILE_SCOPE(PROFILE_STEP_SCHEDULE);
+    PROBE_SCOPE(PROBE_STEP_SCHEDULE);
+
+    // The jog steps forever, ramping with its own rate
+    #ifdef ENABLE_JOG
+    if (jogActive) {
+        stepJog();
+        return;
+    }
+    #endif
 
     // Check if we should be worrying about remaining steps
     if (decrementRemainingSteps) {
@@ -463,22 +1346,66 @@ void stepScheduleHandler() {
         // Increment the counter down (we completed a step)
         remainingScheduledSteps--;
 
+        // Move along the profile, setting the rate of the next step
+        // The auto reload register holds the period that was loaded by this update event
+        #ifdef ENABLE_MOTION_PLANNER
+        if (scheduledProfileActive && remainingScheduledSteps > 0) {
+            setStepScheduleRate(advanceMotionProfile(scheduledProfile, (TIM4 -> ARR) + 1, remainingScheduledSteps));
+        }
+        #endif
+
         // Disable the timer if there are no remaining steps
         if (remainingScheduledSteps <= 0) {
 
-            // Pause the step timer (will be re-enabled by the PID loop)
-            disableStepScheduleTimer();
+            // Chain straight into the next queued move if there is one
+            #ifdef ENABLE_STEP_QUEUE
+            if (stepQueueRunning) {
+                stepSegment nextSegment;
+                if (stepQueue.pop(nextSegment)) {
+                    startStepSegment(nextSegment);
+                    return;
+                }
 
-            // Resume the correctional timer if it is enabled
-            if (stepCorrection) {
-                correctionTimer -> resume();
-                syncInstructions();
+                // Queue is empty, the next move will have to restart it
+                stepQueueRunning = false;
             }
+            #endif
+
+            // Pause the step timer (will be re-enabled by the PID loop), then give the motor back to the correction
+            finishDirectMove();
         }
     }
     else {
-        // Just step the motor in the desired direction
-        motor.step(scheduledStepDir, false, false);
+        #ifdef ENABLE_DDS_STEPPING
+            // Add the velocity word to the phase, stepping on the carry
+            uint32_t lastPhase = ddsPhase;
+            ddsPhase += ddsIncrement;
+            if (ddsPhase < lastPhase) {
+                motor.step(scheduledStepDir, false, false);
+            }
+        #else
+            // Just step the motor in the desired direction
+            motor.step(scheduledStepDir, false, false);
+        #endif
+    }
+}
+
+
+// Sets the rate of the step schedule timer (in Hz)
+// The prescaler is fixed, so this is a single division and a write to the auto reload register (no prescaler search)
+// Rates below MIN_STEP_SCHEDULE_RATE don't fit in the register and run at it, so the commands reject them before they get here
+void setStepScheduleRate(uint32_t rate) {
+
+    // Find the period in timer ticks, limited to what fits in the 16 bit register
+    uint32_t period = (rate > 0 ? (STEP_SCHEDULE_TICK_FREQ / rate) : 0);
+    period = constrain(period, 1, (uint32_t)TIM_MAX_VALUE + 1);
+
+    // Write the new period (buffered until the next update event)
+    TIM4 -> ARR = (period - 1);
+
+    // Load the period right away if the timer is paused, there isn't an update event to do it
+    if (!stepScheduleTimerEnabled) {
+        TIM4 -> EGR = TIM_EGR_UG;
     }
 }
 
@@ -7,6 +7,32 @@
 #include "main.h"
 #include "led.h"
 #include "pid.h"
+#include "planner.h"
+#include "ringBuffer.h"
+#include "trace.h"
+#include "stepStream.h"
+#include "profiler.h"
+#include "autotune.h"
+#include "stallDetect.h"
+#include "moveMetrics.h"
+#include "loopOverrun.h"
+#include "watchdog.h"
+#include "stepCapture.h"
+
+// Interrupt preemption priorities (lower numbers are more urgent, the step pin is set by EXTI_IRQ_PRIO in the PlatformIO config)
+#define STEP_OVERFLOW_IRQ_PRIO  5
+#define PWM_UPDATE_IRQ_PRIO     5
+#define CORRECTION_IRQ_PRIO     7
+#define STEP_SCHEDULE_IRQ_PRIO  7
+
+// The inner commutation shares the correction's priority, so the two never interrupt each other's writes to the coils (and critical sections hold it off too)
+#define FAST_COMMUTATION_IRQ_PRIO CORRECTION_IRQ_PRIO
+
+// The most urgent priority that critical sections block. The correction, step schedule, and CAN interrupts share the encoder bus,
+// flash, and settings with the main loop, so only they are held off (the step pin, the encoder DMA, and TIM2's overflow keep running)
+// The step pin interrupt runs step(), which writes the step counts, the coil phase, the current scale, and the coils. Changes to those
+// aren't protected by disableInterrupts(), they mask every interrupt with PRIMASK instead (like latchCoilOutput() in motor.cpp)
+#define CRITICAL_SECTION_IRQ_PRIO CORRECTION_IRQ_PRIO
 
 // Variables
 // Expose the StepperPID instance to other files
@@ -29,10 +55,10 @@ void disableMotorTimers();
 // Enables the motor timers (used to reset the motor after the timers have been disabled)
 void enableMotorTimers();
 
-// Pauses the timers, temporarily disabling them
+// Blocks the interrupts at or below CRITICAL_SECTION_IRQ_PRIO (more urgent interrupts keep running)
 void disableInterrupts();
 
-// Re-enables interrupts, resuming them
+// Re-enables the blocked interrupts, resuming them
 void enableInterrupts();
 
 // Enables step correction
@@ -41,7 +67,10 @@ void enableStepCorrection();
 // Disables step correction
 void disableStepCorrection();
 
-// Updates the step correction frequency (called when microstepping is changed)
+// If step correction is enabled (closed loop mode)
+bool isStepCorrectionEnabled();
+
+// Updates the step correction timing (called when microstepping is changed)
 void updateCorrectionTimer();
 
 // Function that steps the motor
@@ -53,16 +82,93 @@ void stepMotorNoDesiredAngle();
 // Function to correct motor position if it is out of place
 void correctMotor();
 
+// Hysteresis of the correction
+#ifdef ENABLE_CORRECTION_HYSTERESIS
+// Sets the errors that start and stop the correction (microsteps, the exit has to be below the enter)
+void setCorrectionHysteresis(uint16_t enterError, uint16_t exitError);
+
+// Gets the error that starts the correction (microsteps)
+uint16_t getCorrectionEnterError();
+
+// Gets the error that the correction runs down to (microsteps)
+uint16_t getCorrectionExitError();
+#endif // ! ENABLE_CORRECTION_HYSTERESIS
+
+// Background encoder reads
+#ifdef ENABLE_ENCODER_DMA
+// Starts a background read of the encoder (called by the correction timer's compare channel)
+void sampleEncoder();
+
+// Sets the compare channel of the correction timer to start the encoder read just before the correction
+void updateEncoderSampleTime();
+#endif // ! ENABLE_ENCODER_DMA
+
 // Direct stepping
 #ifdef ENABLE_DIRECT_STEPPING
 // Schedule steps for the motor to execute (rate is in Hz)
 void scheduleSteps(int64_t count, int32_t rate, STEP_DIR stepDir);
+
+// Returns the number of scheduled steps that haven't been taken yet
+int64_t getRemainingScheduledSteps();
+
+// If any of the direct moves are running (scheduled steps, the step queue, or a jog), they pause the correction
+bool isDirectMoveRunning();
+
+// Stops all of the direct moves right away, the correction holds the motor where they stopped
+// Only safe to call from the correction or the step schedule interrupt
+void stopDirectMoves();
+
+// Schedule steps that follow a jerk limited profile (rate in Hz, accel in steps/s/s, jerk in steps/s/s/s)
+#ifdef ENABLE_MOTION_PLANNER
+void schedulePlannedSteps(int64_t count, uint32_t rate, uint32_t accel, uint32_t jerk, STEP_DIR stepDir);
+#endif
+
+// Velocity (jog) mode, the motor ramps to a rate and holds it until it is changed or stopped
+#ifdef ENABLE_JOG
+// Ramps to a rate (steps/s, counter clockwise is positive, 0 ramps to a stop) with an acceleration (steps/s/s)
+// Starting any other move stops the jog right away
+void setJogVelocity(int32_t rate, uint32_t accel);
+
+// Gets the rate that the motor is jogging at (steps/s, counter clockwise is positive)
+int32_t getJogVelocity();
+
+// If the motor is jogging
+bool isJogging();
+#endif
+
+// Queue of move segments, stepped out back to back
+#ifdef ENABLE_STEP_QUEUE
+// A single move (accel and jerk of 0 move at a constant rate)
+typedef struct {
+    uint32_t count;
+    uint32_t rate;
+    uint32_t accel;
+    uint32_t jerk;
+    STEP_DIR dir;
+} stepSegment;
+
+// Adds a move to the back of the queue, starting it right away if the queue is idle. Returns false if the queue was full
+bool queueSteps(int64_t count, uint32_t rate, uint32_t accel, uint32_t jerk, STEP_DIR stepDir);
+
+// Number of moves waiting to be started
+uint16_t getQueuedSegmentCount();
+
+// If the step schedule interrupt is still working through queued moves
+bool isStepQueueRunning();
+#endif // ! ENABLE_STEP_QUEUE
 #endif // ! ENABLE_DIRECT_STEPPING
 
 #if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
 // Step schedule handler (runs when the interrupt is triggered)
 void stepScheduleHandler();
 
+// Slowest rate that the step schedule timer can run at (in Hz), its period is 16 bits at the fixed tick rate
+#define MIN_STEP_SCHEDULE_RATE ((STEP_SCHEDULE_TICK_FREQ + 65535) / 65536)
+
+// Sets the rate of the step schedule timer (in Hz), a single register write
+// Rates below MIN_STEP_SCHEDULE_RATE are held at it, the commands check for them first
+void setStepScheduleRate(uint32_t rate);
+
 // Convenience function to handle enabling the step schedule timer
 void enableStepScheduleTimer();
 
@@ -70,6 +176,11 @@ void enableStepScheduleTimer();
 void disableStepScheduleTimer();
 #endif // ! ENABLE_DIRECT_STEPPING || ENABLE_PID
 
+// Stops the PID's correction steps (without touching a move's steps when the correction runs alongside the moves)
+#ifdef ENABLE_PID
+void stopPIDSteps();
+#endif
+
 // Makes sure that all cached calls respect the current config
 void syncInstructions();
 
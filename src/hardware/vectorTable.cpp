@@ -0,0 +1,40 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_MOTION_SAFE_FLASH
+
+// Import the header file
+#include "vectorTable.h"
+
+// Copy of the vector table (VTOR needs the table aligned to its size, rounded up to a power of two)
+static volatile uint32_t ramVectorTable[RAM_VECTOR_COUNT] __attribute__((aligned(256)));
+
+
+// Copies the vector table into SRAM, then switches over to it
+static void moveVectorTable() {
+
+    // Nothing can be taken halfway through the copy
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const uint32_t* flashVectorTable = (const uint32_t*)(SCB -> VTOR);
+    for (uint8_t index = 0; index < RAM_VECTOR_COUNT; index++) {
+        ramVectorTable[index] = flashVectorTable[index];
+    }
+    SCB -> VTOR = (uint32_t)ramVectorTable;
+    __DSB();
+    __ISB();
+    __set_PRIMASK(primask);
+}
+
+
+// Points an interrupt straight at a handler in the SRAM copy of the vector table
+void setRAMVector(IRQn_Type irq, void (*handler)()) {
+    if (SCB -> VTOR != (uint32_t)ramVectorTable) {
+        moveVectorTable();
+    }
+    ramVectorTable[16 + irq] = (uint32_t)handler;
+    __DSB();
+}
+
+#endif // ! ENABLE_MOTION_SAFE_FLASH
@@ -0,0 +1,21 @@
+#ifndef __VECTOR_TABLE_H__
+#define __VECTOR_TABLE_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the motion safe flash writes are enabled
+#ifdef ENABLE_MOTION_SAFE_FLASH
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Vectors of the STM32F103xB (the 16 of the core, then the 43 of the peripherals)
+#define RAM_VECTOR_COUNT (16 + 43)
+
+// Points an interrupt straight at a handler in the SRAM copy of the vector table (moved there on the first call)
+// The handler replaces the core's dispatch, so it has to check and clear the interrupt's flags itself
+void setRAMVector(IRQn_Type irq, void (*handler)());
+
+#endif // ! ENABLE_MOTION_SAFE_FLASH
+#endif // ! __VECTOR_TABLE_H__
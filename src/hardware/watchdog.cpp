@@ -0,0 +1,75 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_WATCHDOG
+
+// Import the header file
+#include "watchdog.h"
+
+// The check ins since the last feed
+volatile bool watchdogCheckIns[WATCHDOG_SOURCE_COUNT];
+
+// If the last reset was caused by the watchdog
+static bool watchdogReset = false;
+
+
+// Starts the watchdog
+void initWatchdog() {
+
+    // Save the cause of the last reset, then clear the flags for the next one
+    watchdogReset = (RCC -> CSR & RCC_CSR_IWDGRSTF);
+    RCC -> CSR |= RCC_CSR_RMVF;
+
+    // Pause the watchdog while the core is halted by a debugger
+    DBGMCU -> CR |= DBGMCU_CR_DBG_IWDG_STOP;
+
+    // Find the smallest prescaler (4 to 256) that fits the timeout in the 12 bit reload
+    uint32_t ticks = ((uint64_t)WATCHDOG_TIMEOUT * LSI_VALUE) / 1000;
+    uint32_t prescalerPower = 0;
+    while ((prescalerPower < 6) && ((ticks >> (prescalerPower + 2)) > 0xFFF)) {
+        prescalerPower++;
+    }
+    uint32_t reload = min((uint32_t)(ticks >> (prescalerPower + 2)), (uint32_t)0xFFF);
+
+    // Start the watchdog, then unlock and set its registers
+    IWDG -> KR = 0xCCCC;
+    IWDG -> KR = 0x5555;
+    IWDG -> PR = prescalerPower;
+    IWDG -> RLR = reload;
+
+    // Wait for the registers to be taken by the watchdog's clock domain, then load the counter
+    while (IWDG -> SR != 0);
+    IWDG -> KR = 0xAAAA;
+}
+
+
+// Feeds the watchdog if every part has checked in since the last feed
+void serviceWatchdog() {
+
+    // The control loop only has to check in while its timer is running (it is paused by the calibration and the scheduled moves)
+    if (!(TIM1 -> CR1 & TIM_CR1_CEN)) {
+        watchdogCheckIns[WATCHDOG_CONTROL_LOOP] = true;
+    }
+
+    // Wait for the parts that haven't checked in yet
+    for (uint8_t source = 0; source < WATCHDOG_SOURCE_COUNT; source++) {
+        if (!watchdogCheckIns[source]) {
+            return;
+        }
+    }
+
+    // Everything is running, feed the watchdog and start over
+    IWDG -> KR = 0xAAAA;
+    for (uint8_t source = 0; source < WATCHDOG_SOURCE_COUNT; source++) {
+        watchdogCheckIns[source] = false;
+    }
+}
+
+
+// Returns if the last reset was caused by the watchdog
+bool wasWatchdogReset() {
+    return watchdogReset;
+}
+
+#endif // ! ENABLE_WATCHDOG
@@ -0,0 +1,43 @@
+#ifndef __WATCHDOG_H__
+#define __WATCHDOG_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the watchdog is enabled
+#ifdef ENABLE_WATCHDOG
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Independent watchdog (IWDG, runs from the LSI, so it keeps running even if the main clock stops)
+// It is only fed once every part of the firmware that has to keep running has checked in since the last feed
+// A hung interrupt, a locked up task, or a stopped control loop then resets the board within WATCHDOG_TIMEOUT
+
+// The parts of the firmware that have to check in
+typedef enum {
+    WATCHDOG_CONTROL_LOOP,      // The correction timer's tick (only needed while the timer is running)
+    WATCHDOG_MAIN_LOOP,         // The scheduler's tasks (each of them checks in as it finishes)
+    WATCHDOG_SOURCE_COUNT
+} WATCHDOG_SOURCE;
+
+// If each of the parts has checked in since the last feed (each one has its own flag, so the interrupts never have to read-modify-write)
+extern volatile bool watchdogCheckIns[WATCHDOG_SOURCE_COUNT];
+
+// Marks that a part of the firmware is still running
+static inline void watchdogCheckIn(WATCHDOG_SOURCE source) {
+    watchdogCheckIns[source] = true;
+}
+
+// Starts the watchdog (it can't be stopped again until the next reset)
+void initWatchdog();
+
+// Feeds the watchdog if every part has checked in since the last feed
+// Called by the main loop, along with any loop that holds up the main loop for a while (ex. the autotune)
+void serviceWatchdog();
+
+// Returns if the last reset was caused by the watchdog (read when it was started)
+bool wasWatchdogReset();
+
+#endif // ! ENABLE_WATCHDOG
+#endif // ! __WATCHDOG_H__
@@ -0,0 +1,33 @@
+// Host stand-in for the parts of the Arduino core that the control logic uses
+// Only on the include path of the native simulation build, the firmware uses the real core
+#ifndef __SIM_ARDUINO_H__
+#define __SIM_ARDUINO_H__
+
+// Standard naming conventions
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <atomic>
+
+// Arduino's helpers (templates instead of macros, so they don't collide with the standard library)
+template <typename T, typename L, typename H>
+inline T constrain(T value, L low, H high) { return (value < (T)low) ? (T)low : ((value > (T)high) ? (T)high : value); }
+template <typename A, typename B>
+inline A min(A a, B b) { return (a < (A)b) ? a : (A)b; }
+template <typename A, typename B>
+inline A max(A a, B b) { return (a > (A)b) ? a : (A)b; }
+using std::abs;
+
+// Flash strings are just strings on the host
+#define F(string) (string)
+typedef std::string String;
+
+// Time since the simulation started (driven by the plant, not the wall clock)
+uint32_t micros();
+uint32_t millis();
+
+// Memory barrier used by the ring buffer (a compiler barrier is enough for a single thread)
+inline void __DMB() { std::atomic_signal_fence(std::memory_order_seq_cst); }
+
+#endif // ! __SIM_ARDUINO_H__
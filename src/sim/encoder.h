@@ -0,0 +1,11 @@
+// Host stand-in for the encoder header, only the count format is needed by the control logic
+// These have to match src/hardware/encoder.h
+#ifndef __SIM_ENCODER_H__
+#define __SIM_ENCODER_H__
+
+// Counts of the encoder (2^15 per revolution)
+#define ENCODER_COUNTS_POWER        15
+#define ENCODER_COUNTS_PER_REV      ((int32_t)1 << ENCODER_COUNTS_POWER)
+#define POW_2_15                    32768.0   // 2^15
+
+#endif // ! __SIM_ENCODER_H__
@@ -0,0 +1,459 @@
+// Host checks and timings of the firmware's small kernels
+// The moving average, the CRCs of the binary protocol and the encoder, the sine and coil drive tables, the ring buffer of the queues,
+// the fixed point PID, the words of the text commands, and the math of the step counters
+
+// Import the config and the kernels
+#include "config.h"
+#include "kernels.h"
+#include "MovingAverage.h"
+#include "crc.h"
+#include "fastSine.h"
+#include "coilTable.h"
+#include "ringBuffer.h"
+#include "commandWords.h"
+#include "stepMath.h"
+#include "pid.h"
+
+// Host only
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+// Checks that have failed
+static uint32_t failures = 0;
+
+// Calls made by each timing
+static const uint32_t TIMING_CALLS = 1000000;
+
+
+// Reports a check, counting it if it failed
+static void check(const char *name, bool passed) {
+    if (!passed) {
+        printf("  FAILED: %s\n", name);
+        failures++;
+    }
+}
+
+
+// Times a kernel, printing the time of each call
+template <typename F>
+static void timeKernel(const char *name, F kernel) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t call = 0; call < TIMING_CALLS; call++) {
+        kernel(call);
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("  %s: %.2f ns per call on the host\n", name, elapsed / TIMING_CALLS);
+}
+
+
+// Checks the moving average against a plain average of the last readings
+static void checkMovingAverage() {
+
+    // Integer readings use the shift once full, the check covers before and after it fills
+    MovingAverage<int32_t, 16> average;
+    int32_t readings[16] = {};
+    bool matched = true;
+    for (int32_t reading = 0; reading < 100; reading++) {
+        int32_t value = (reading * 7919) % 2048 - 1024;
+        average.add(value);
+        readings[reading % 16] = value;
+        int32_t count = min(reading + 1, 16);
+        int64_t total = 0;
+        for (int32_t index = 0; index < count; index++) {
+            total += readings[index];
+        }
+        matched &= (average.getDouble() == ((double)total / count));
+        matched &= (average.getLast() == value);
+    }
+    check("MovingAverage matches the plain average", matched);
+
+    // Clearing starts the average over
+    average.clear();
+    average.add(5);
+    check("MovingAverage clear()", (average.get() == 5));
+
+    // Timing
+    volatile int32_t sink = 0;
+    timeKernel("MovingAverage<int32_t, 16> add() + get()", [&](uint32_t call) {
+        average.add((int32_t)(call & 0x3FF));
+        sink = average.get();
+    });
+}
+
+
+// Checks the CRC16 against its check value, and the running CRC against the single call
+static void checkCRC() {
+
+    // Check value of CRC-16/CCITT-FALSE
+    const char *digits = "123456789";
+    check("crc16() check value", (crc16((const uint8_t*)digits, 9) == 0x29B1));
+
+    // Fed in pieces
+    uint16_t crc = crc16Update(0xFFFF, (const uint8_t*)digits, 4);
+    crc = crc16Update(crc, (const uint8_t*)&digits[4], 5);
+    check("crc16Update() in pieces", (crc == 0x29B1));
+
+    // Timing of a full frame of the binary protocol
+    uint8_t frame[256];
+    for (uint16_t index = 0; index < sizeof(frame); index++) {
+        frame[index] = (uint8_t)(index * 31);
+    }
+    volatile uint16_t sink = 0;
+    timeKernel("crc16() of a 256 byte frame", [&](uint32_t call) {
+        frame[0] = (uint8_t)call;
+        sink = crc16(frame, sizeof(frame));
+    });
+}
+
+
+// Bit by bit CRC8 of the encoder (the reference for the table)
+static uint8_t referenceCRC8(const uint8_t *data, uint16_t length) {
+    uint8_t crc = CRC8_SEED;
+    for (uint16_t index = 0; index < length; index++) {
+        crc ^= data[index];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ CRC8_POLYNOMIAL) : (uint8_t)(crc << 1);
+        }
+    }
+    return (uint8_t)~crc;
+}
+
+
+// Checks the encoder's CRC8 against its check value and the bit by bit version
+static void checkCRC8() {
+
+    // Check value of CRC-8/SAE-J1850
+    const char *digits = "123456789";
+    check("crc8() check value", (crc8((const uint8_t*)digits, 9) == 0x4B));
+
+    // Every length of a frame that changes with each byte (the encoder's reads are up to 10 bytes, with the command)
+    uint8_t frame[32];
+    bool matched = true;
+    for (uint16_t index = 0; index < sizeof(frame); index++) {
+        frame[index] = (uint8_t)((index * 73) ^ 0xA5);
+    }
+    for (uint16_t length = 0; length <= sizeof(frame); length++) {
+        matched &= (crc8(frame, length) == referenceCRC8(frame, length));
+    }
+    check("crc8() matches the bit by bit CRC", matched);
+
+    // Timing of a sample of the encoder (the command, then 4 words)
+    volatile uint8_t sink = 0;
+    timeKernel("crc8() of an encoder sample", [&](uint32_t call) {
+        frame[0] = (uint8_t)call;
+        sink = crc8(frame, 10);
+    });
+}
+
+
+// Checks the interpolated sine against sin() over a whole electrical cycle
+static void checkSine() {
+
+    // Each entry is rounded, and the interpolation between two entries bends less than a count from the curve
+    int32_t maxError = 0;
+    for (uint32_t phase = 0; phase < PHASE_PER_CYCLE; phase++) {
+        double exact = sin(2 * M_PI * phase / PHASE_PER_CYCLE) * SINE_MAX;
+        maxError = max(maxError, (int32_t)fabs(fastSinPhase((uint16_t)phase) - exact));
+    }
+    printf("  fastSinPhase() max error: %d of %d\n", maxError, SINE_MAX);
+    check("fastSinPhase() within 2 counts of sin()", (maxError <= 2));
+    check("fastCosPhase() is a quarter cycle ahead", (fastCosPhase(0) == SINE_MAX && fastCosPhase(PHASE_PER_CYCLE / 2) == -SINE_MAX));
+
+    // Timing
+    volatile int32_t sink = 0;
+    timeKernel("fastSinPhase() + fastCosPhase()", [&](uint32_t call) {
+        uint16_t phase = (uint16_t)(call * 97);
+        sink = fastSinPhase(phase) + fastCosPhase(phase);
+    });
+}
+
+
+// Checks the coil drive table against the sine and cosine of each coil over a whole electrical cycle
+static void checkCoilTable() {
+
+    // Build the table of a coil, like buildCoilTable() (the output value is the current here, there isn't a timer to convert it for)
+    const uint16_t peakCurrent = 2000;
+    uint16_t table[SINE_QUARTER_COUNT + 1];
+    // The shift cuts up to 1 mA, on top of the rounding of the sine table (half of its step)
+    const double entryTolerance = 1 + ((double)peakCurrent / SINE_MAX);
+    bool entriesMatched = true;
+    for (uint16_t index = 0; index <= SINE_QUARTER_COUNT; index++) {
+        table[index] = coilTableCurrent(index, peakCurrent);
+        double exact = peakCurrent * sin(2 * M_PI * (index << SINE_INTERP_POWER) / PHASE_PER_CYCLE);
+        entriesMatched &= (fabs(table[index] - exact) <= entryTolerance);
+        entriesMatched &= (coilTableShapedCurrent(index, peakCurrent, 0) == table[index]);
+    }
+    check("coilTableCurrent() within 1 mA of the sine at each entry", entriesMatched);
+
+    // Every phase drives both coils to the table entry below it, so the error is at most the change over an entry (plus the rounding)
+    double maxError = 0;
+    bool signsMatched = true;
+    for (uint32_t phase = 0; phase < PHASE_PER_CYCLE; phase++) {
+        for (uint8_t coil = 0; coil < 2; coil++) {
+            uint16_t coilPhase = (coil == 0 ? (uint16_t)phase : coilPhaseB((uint16_t)phase));
+            int32_t driven = table[coilTableIndex(coilPhase)] * (coilPhaseBackward(coilPhase) ? -1 : 1);
+            double angle = 2 * M_PI * phase / PHASE_PER_CYCLE;
+            double exact = peakCurrent * (coil == 0 ? sin(angle) : cos(angle));
+            maxError = max(maxError, fabs(driven - exact));
+            signsMatched &= (driven == 0 || ((driven > 0) == (exact > 0)));
+        }
+    }
+    double entryError = (peakCurrent * 2 * M_PI * (1 << SINE_INTERP_POWER) / PHASE_PER_CYCLE) + 1;
+    printf("  coil table max error: %.1f of %d mA\n", maxError, peakCurrent);
+    check("coil table drive within an entry of the sine and cosine", (maxError <= entryError));
+    check("coil table drives each half of the wave in its direction", signsMatched);
+
+    // The third harmonic of the waveform shaping, against the shaped wave (held at 0, like the firmware)
+    const float thirdHarmonic = 0.1f;
+    bool shapeMatched = true;
+    for (uint16_t index = 0; index <= SINE_QUARTER_COUNT; index++) {
+        double angle = 2 * M_PI * (index << SINE_INTERP_POWER) / PHASE_PER_CYCLE;
+        double exact = peakCurrent * max(sin(angle) + thirdHarmonic * sin(3 * angle), 0.0);
+        shapeMatched &= (fabs(coilTableShapedCurrent(index, peakCurrent, thirdHarmonic) - exact) <= 2);
+    }
+    check("coilTableShapedCurrent() within 2 mA of the shaped wave", shapeMatched);
+
+    // Timing of a lookup of both coils
+    volatile int32_t sink = 0;
+    timeKernel("coil table lookup of both coils", [&](uint32_t call) {
+        uint16_t phase = (uint16_t)(call * 97);
+        uint16_t phaseB = coilPhaseB(phase);
+        sink = table[coilTableIndex(phase)] + table[coilTableIndex(phaseB)] + coilPhaseBackward(phase) + coilPhaseBackward(phaseB);
+    });
+}
+
+
+// Checks the ring buffer's order, its full and empty states, and its wrap around
+static void checkRingBuffer() {
+    RingBuffer<uint32_t, 8> buffer;
+    bool ordered = true;
+    uint32_t nextIn = 0;
+    uint32_t nextOut = 0;
+
+    // Fill and drain it several times, so the indexes wrap around
+    for (uint8_t pass = 0; pass < 5; pass++) {
+        while (buffer.push(nextIn)) {
+            nextIn++;
+        }
+        ordered &= (buffer.isFull() && buffer.count() == 7 && buffer.space() == 0);
+        uint32_t item;
+        for (uint8_t index = 0; index < (pass + 3) && buffer.pop(item); index++) {
+            ordered &= (item == nextOut++);
+        }
+    }
+    uint32_t item;
+    while (buffer.pop(item)) {
+        ordered &= (item == nextOut++);
+    }
+    check("RingBuffer keeps its order through the wrap around", (ordered && buffer.isEmpty() && nextIn == nextOut));
+
+    // Timing
+    volatile uint32_t sink = 0;
+    timeKernel("RingBuffer push() + pop()", [&](uint32_t call) {
+        uint32_t popped = 0;
+        buffer.push(call);
+        buffer.pop(popped);
+        sink = popped;
+    });
+}
+
+
+#ifdef ENABLE_PID
+// Floating point version of the PID's math, the reference for the fixed point loop
+// The error is held still, so the rate of the measurement (and the D term) is 0
+typedef struct {
+    double iTerm = 0;
+    double output = 0;
+} referencePID;
+
+
+// Runs a loop of the reference PID with an error (degrees), returning the output (steps/s)
+static double computeReferencePID(referencePID &loop, double error, double p, double i, double maxI) {
+
+    // The period of the loop is truncated to Q16.16 in the firmware, the reference uses the same period so only the math is compared
+    const double elapsedTime = (double)((1000LL << PID_Q_POWER) / CONTROL_LOOP_FREQ) / PID_Q_ONE;
+    const double maxOutputChange = max(DEFAULT_PID_SLEW_RATE / CONTROL_LOOP_FREQ, 1);
+
+    // Integrate and clamp the I term, then limit the output and back-calculate the part that was cut off
+    loop.iTerm = constrain(loop.iTerm + (error * elapsedTime * i), -maxI * i, maxI * i);
+    double rawOutput = (p * error) + loop.iTerm;
+    double limitedOutput = constrain(rawOutput, (double)-DEFAULT_PID_STEP_MAX, (double)DEFAULT_PID_STEP_MAX);
+    loop.iTerm += (limitedOutput - rawOutput) * DEFAULT_PID_ANTI_WINDUP;
+
+    // Slew limit
+    loop.output = constrain(floor(limitedOutput), loop.output - maxOutputChange, loop.output + maxOutputChange);
+    return loop.output;
+}
+
+
+// Checks the fixed point PID against the floating point reference, through the I clamp, the output limit, and the anti-windup
+static void checkPID() {
+
+    // The gains are held at what fits in Q16.16
+    StepperPID loop;
+    loop.setP(40000);
+    bool saturated = (loop.getP() == 32767);
+    loop.setP(-1);
+    saturated &= (loop.getP() == 32767);
+    loop.setP(1.5);
+    saturated &= (loop.getP() == 1.5f);
+    check("PID gains saturate at the Q16.16 limit", saturated);
+    loop.setP(DEFAULT_P);
+
+    // Flatten the gain schedule, so the reference only needs the base gains
+    #ifdef ENABLE_GAIN_SCHEDULING
+    for (uint8_t index = 0; index < GAIN_SCHEDULE_POINTS; index++) {
+        loop.setSchedulePoint(index, { loop.getSchedulePoint(index).rpm, 100, 100, 100 });
+    }
+    #endif
+
+    // Hold each error (counts) for a while: inside the limits (the I term clamps), past the limits (the output saturates
+    // and winds the I term back), released (the I term shows if it wound up), and past the other limit
+    const int32_t errors[4] = { 50, 20000, 0, -20000 };
+    referencePID reference;
+    loop.reset();
+    motor.encoder.counts = 0;
+    motor.encoder.velocity = 0;
+    double maxDifference = 0;
+    for (uint8_t stage = 0; stage < 4; stage++) {
+        motor.setDesiredCounts(errors[stage]);
+        for (uint32_t period = 0; period < 3000; period++) {
+            double expected = computeReferencePID(reference, ((double)errors[stage] * PID_Q16_DEG_PER_COUNT) / PID_Q_ONE, loop.getP(), loop.getI(), loop.getMaxI());
+            maxDifference = max(maxDifference, fabs(loop.compute() - expected));
+        }
+    }
+    motor.setDesiredCounts(0);
+    printf("  PID max difference from the reference: %.0f steps/s\n", maxDifference);
+    check("PID matches the floating point reference", (maxDifference <= 1));
+}
+#endif // ! ENABLE_PID
+
+
+// Checks the words of a text command, against the C library's conversions
+#if defined(ENABLE_SERIAL) || defined(ENABLE_CAN)
+static void checkCommandWords() {
+
+    // The values, quoted text, and a value separated from its letter by a space
+    const char *text = "M306 P 1.5 I-2 M\"A message\" D";
+    parsedCommand command;
+    bool split = tokenizeCommand(text, strlen(text), command);
+    split &= (command.count == 5);
+    split &= (command.words[0].letter == 'M' && command.words[0].intValue == 306);
+    split &= (command.words[1].letter == 'P' && command.words[1].isNumber && command.words[1].fixedValue == (3 << (WORD_FIXED_Q_POWER - 1)));
+    split &= (command.words[2].letter == 'I' && command.words[2].isNumber && command.words[2].intValue == -2);
+    split &= (command.words[3].length == 9 && strncmp(command.words[3].text, "A message", 9) == 0 && !command.words[3].isNumber);
+    split &= (command.words[4].letter == 'D' && !command.words[4].isNumber);
+    check("tokenizeCommand() splits the words", split);
+
+    // A word without a number is given, but has no value
+    int32_t value = 7;
+    float floatValue = 7;
+    bool found = (findWord(command, 'D') != nullptr && !findWordInt(command, 'D', value) && value == 7);
+    found &= (!findWordInt(command, 'J', value) && getWordInt(command, 'J') == -1);
+    found &= (findWordFloat(command, 'P', floatValue) && floatValue == 1.5f);
+    found &= (findWordFixed(command, 'I', value) && value == -(2 << WORD_FIXED_Q_POWER));
+    check("findWord*() tell missing words and values apart", found);
+
+    // The most words that fit, then one more
+    const char *fullText = "G0 A1 B2 C3 D4 E5 F6 H7 I8 J9 K10 L11";
+    const char *overText = "G0 A1 B2 C3 D4 E5 F6 H7 I8 J9 K10 L11 N12";
+    check("tokenizeCommand() holds MAX_COMMAND_WORDS words", (tokenizeCommand(fullText, strlen(fullText), command) && command.count == MAX_COMMAND_WORDS));
+    check("tokenizeCommand() rejects a word past MAX_COMMAND_WORDS", !tokenizeCommand(overText, strlen(overText), command));
+
+    // Each number against strtod(), the integer is cut toward zero and both are held at the limits of an int32
+    const char *numbers[] = { "1.5", "-1", "-1.25", "0.0001", "2000000", "", "-", "abc", "3.", "-.5", "99999999999", "-2147483648", "+7", "1.99999999999", "32767.99999", "1.5x" };
+    bool converted = true;
+    for (const char *number : numbers) {
+        commandWord word = {};
+        word.text = number;
+        word.length = strlen(number);
+        parseWordNumber(word);
+        char *end;
+        double exact = strtod(number, &end);
+        bool isNumber = (end != number && *end == '\0' && strcmp(number, "-") != 0);
+        converted &= (word.isNumber == isNumber);
+        if (isNumber) {
+            converted &= (word.intValue == (int32_t)constrain(trunc(exact), (double)INT32_MIN, (double)INT32_MAX));
+            converted &= (abs((int64_t)word.fixedValue - (int64_t)constrain(round(exact * (1 << WORD_FIXED_Q_POWER)), (double)INT32_MIN, (double)INT32_MAX)) <= 1);
+            converted &= (fabs(wordToFloat(word) - (float)constrain(exact, (double)INT32_MIN, (double)INT32_MAX)) <= fabs(exact) * 1e-6);
+        }
+    }
+    check("parseWordNumber() matches strtod()", converted);
+
+    // Timing of a move command
+    const char *moveText = "G0 P3200 R1000 A20000 J2000000";
+    volatile int32_t sink = 0;
+    timeKernel("tokenizeCommand() of a G0", [&](uint32_t call) {
+        tokenizeCommand(moveText, strlen(moveText), command);
+        sink = command.words[1].intValue + (int32_t)call;
+    });
+}
+#endif // ! (ENABLE_SERIAL || ENABLE_CAN)
+
+
+// Checks the math of the step counters and phases, against plain 64 bit and floating point versions
+static void checkStepMath() {
+
+    // Rescaling the counts is cut toward zero, and a change that is undone gives the count back
+    const int32_t counts[] = { 0, 1, -1, 15, -15, 12345, -12345, 65535, 65536, -65536, -65537, 100000000, -100000000 };
+    bool rescaled = true;
+    for (int32_t count : counts) {
+        rescaled &= (rescaleStepCount(count, 16, 256) == (int32_t)trunc(count * 16.0 / 256.0));
+        rescaled &= (rescaleStepCount(count, 256, 16) == (int32_t)trunc(count * 256.0 / 16.0) || abs(count) > (INT32_MAX / 16));
+        rescaled &= (rescaleStepCount(rescaleStepCount(count, 64, 16), 16, 64) == count || abs(count) > (INT32_MAX / 4));
+    }
+    check("rescaleStepCount() cuts toward zero", rescaled);
+
+    // The hardware counter and its offset add back up to the count, on both sides of 0 and at the limits
+    const int32_t hardCounts[] = { 0, 1, -1, 65535, 65536, -65535, -65536, -65537, 123456789, -123456789, INT32_MAX, INT32_MIN };
+    bool split = true;
+    for (int32_t count : hardCounts) {
+        int32_t offset;
+        uint16_t counter = splitHardStepCount(count, offset);
+        split &= (((int64_t)offset + counter) == count && (offset % (1 << HARD_STEP_COUNTER_POWER)) == 0);
+    }
+    check("splitHardStepCount() adds back up to the count", split);
+
+    // Every microstepping moves a full electrical cycle in 4 full steps, and lands each count on its microstep
+    bool phased = true;
+    for (uint16_t divisor = MIN_MICROSTEP_DIVISOR; divisor <= MAX_MICROSTEP_DIVISOR; divisor <<= 1) {
+        phased &= (((uint64_t)microstepPhaseFor(divisor) * 4 * divisor) == ((uint64_t)PHASE_PER_CYCLE << MULTIPLIER_Q_POWER));
+        phased &= (multipliedStepPhaseFor(1 << MULTIPLIER_Q_POWER, divisor) == microstepPhaseFor(divisor));
+        phased &= (multipliedStepPhaseFor(3 << (MULTIPLIER_Q_POWER - 1), divisor) == ((microstepPhaseFor(divisor) * 3) >> 1));
+        for (int32_t steps = -9 * divisor; steps <= 9 * divisor; steps++) {
+            uint16_t phase = stepCountPhase(steps, divisor);
+            phased &= (phase == (uint16_t)(((int64_t)steps * PHASE_PER_FULL_STEP) / divisor));
+            phased &= ((phase & microstepPhaseMaskFor(divisor)) == phase);
+        }
+    }
+    check("step phases match every microstepping", phased);
+
+    // Timing of a change of the microstepping
+    volatile int32_t sink = 0;
+    timeKernel("rescaleStepCount() + step phases", [&](uint32_t call) {
+        uint16_t divisor = (uint16_t)(1 << (call & 7));
+        sink = rescaleStepCount((int32_t)call, divisor, 16) + microstepPhaseFor(divisor) + multipliedStepPhaseFor(call, divisor);
+    });
+}
+
+
+// Checks then times each kernel
+uint32_t runKernelChecks() {
+    printf("Kernels:\n");
+    checkMovingAverage();
+    checkCRC();
+    checkCRC8();
+    checkSine();
+    checkCoilTable();
+    checkRingBuffer();
+    #ifdef ENABLE_PID
+        checkPID();
+    #endif
+    #if defined(ENABLE_SERIAL) || defined(ENABLE_CAN)
+        checkCommandWords();
+    #endif
+    checkStepMath();
+    printf("Kernel checks: %s\n", (failures == 0 ? "all passed" : "FAILED"));
+    return failures;
+}
@@ -0,0 +1,9 @@
+// Host checks and timings of the firmware's small kernels (compiled unmodified, like the control logic)
+// Each kernel is checked against a plain reference first, then timed, so a faster version can be compared before it reaches a board
+#ifndef __SIM_KERNELS_H__
+#define __SIM_KERNELS_H__
+
+// Checks then times each kernel, returning the number of checks that failed
+uint32_t runKernelChecks();
+
+#endif // ! __SIM_KERNELS_H__
@@ -0,0 +1,13 @@
+// Host stand-in for main.h, replaces the motor with the simulated one
+// The control logic only sees the same calls that it makes on the real StepperMotor and Encoder
+#ifndef __SIM_MAIN_H__
+#define __SIM_MAIN_H__
+
+#include "Arduino.h"
+#include "config.h"
+#include "plant.h"
+
+// The simulated motor (the real firmware's global has the same name)
+extern SimulatedMotor motor;
+
+#endif // ! __SIM_MAIN_H__
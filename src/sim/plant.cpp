@@ -0,0 +1,119 @@
+// Import the header file
+#include "plant.h"
+
+// Random noise for the encoder
+#include <random>
+
+// Time of the simulation (us)
+uint64_t simulationTime = 0;
+
+// Arduino timing, driven by the simulation
+uint32_t micros() {
+    return (uint32_t)simulationTime;
+}
+uint32_t millis() {
+    return (uint32_t)(simulationTime / 1000);
+}
+
+// Encoder noise source (seeded, so runs are repeatable)
+static std::mt19937 noiseGenerator(1);
+
+// Radians per encoder count
+static const double RADIANS_PER_COUNT = (2.0 * M_PI / ENCODER_COUNTS_PER_REV);
+
+// Electrical cycles per revolution of a 1.8° motor (4 full steps per cycle)
+static const double POLE_PAIRS = 50.0;
+
+
+// Default plant
+plantParameters defaultPlantParameters() {
+    plantParameters parameters;
+    parameters.holdingTorque = 0.4;
+    parameters.inertia = 8.0e-6;
+    parameters.damping = 2.5e-3;
+    parameters.loadTorque = 0.0;
+    parameters.encoderNoise = 1.0;
+    parameters.microstepping = 16;
+    return parameters;
+}
+
+
+// The encoder's readings (the observer is replaced by the exact, quantized values)
+int32_t SimulatedEncoder::getAbsoluteCountsAvg() const {
+    return counts;
+}
+int32_t SimulatedEncoder::getObserverPosition() const {
+    return counts;
+}
+int32_t SimulatedEncoder::getObserverVelocity() const {
+    return velocity;
+}
+
+
+// Sets up the motor with the default plant
+SimulatedMotor::SimulatedMotor() {
+    begin(defaultPlantParameters());
+}
+
+
+// Sets up the plant, starting at rest at 0
+void SimulatedMotor::begin(const plantParameters &newParameters) {
+    parameters = newParameters;
+    rotorAngle = 0;
+    rotorVelocity = 0;
+    coilAngle = 0;
+    desiredCounts = 0;
+    encoder.counts = 0;
+    encoder.velocity = 0;
+}
+
+
+// Desired position, in counts
+int32_t SimulatedMotor::getDesiredCounts() const {
+    return desiredCounts;
+}
+void SimulatedMotor::setDesiredCounts(int32_t counts) {
+    desiredCounts = counts;
+}
+
+
+// Counts moved by a single microstep
+double SimulatedMotor::getCountsPerMicrostep() const {
+    return ((double)ENCODER_COUNTS_PER_REV / (200.0 * parameters.microstepping));
+}
+
+
+// Moves the coils by a number of microsteps
+void SimulatedMotor::moveCoils(double microsteps) {
+    coilAngle += (microsteps * getCountsPerMicrostep() * RADIANS_PER_COUNT);
+}
+
+
+// Advances the physics, then samples the encoder
+void SimulatedMotor::advance(double time) {
+
+    // Integrate in small steps (semi-implicit Euler is stable for the stiff sine spring at 1us)
+    const double subStep = 1.0e-6;
+    for (double elapsed = 0; elapsed < time; elapsed += subStep) {
+        double torque = parameters.holdingTorque * sin(POLE_PAIRS * (coilAngle - rotorAngle))
+                      - (parameters.damping * rotorVelocity)
+                      - ((rotorVelocity > 0) ? parameters.loadTorque : ((rotorVelocity < 0) ? -parameters.loadTorque : 0));
+        rotorVelocity += (torque / parameters.inertia) * subStep;
+        rotorAngle += rotorVelocity * subStep;
+    }
+    simulationTime += (uint64_t)(time * 1.0e6 + 0.5);
+
+    // Sample the encoder (quantized, with noise)
+    std::normal_distribution<double> noise(0.0, parameters.encoderNoise);
+    encoder.counts = (int32_t)floor(getRotorCounts() + (parameters.encoderNoise > 0 ? noise(noiseGenerator) : 0.0));
+    encoder.velocity = (int32_t)getRotorVelocity();
+}
+
+
+// Exact rotor position (counts) and velocity (counts/s)
+double SimulatedMotor::getRotorCounts() const {
+    return (rotorAngle / RADIANS_PER_COUNT);
+}
+double SimulatedMotor::getRotorVelocity() const {
+    return (rotorVelocity / RADIANS_PER_COUNT);
+}
@@ -0,0 +1,74 @@
+// Simulated motor and TLE5012 encoder
+// A hybrid stepper is modeled as a rotor pulled toward the coils' electrical angle (50 pole pairs) through a sine torque curve,
+// with inertia, viscous friction, and an optional load. The encoder quantizes the rotor to 15 bits, with optional noise
+#ifndef __PLANT_H__
+#define __PLANT_H__
+
+#include "Arduino.h"
+#include "encoder.h"
+
+// Physical parameters of the simulated motor (a typical 42mm, 1.8° stepper)
+typedef struct {
+    double holdingTorque;    // Nm at the rated current
+    double inertia;          // kg*m^2 (rotor plus load)
+    double damping;          // Nm/(rad/s)
+    double loadTorque;       // Nm, constant load opposing positive motion
+    double encoderNoise;     // Counts RMS added to each encoder reading
+    uint16_t microstepping;  // Microsteps per full step
+} plantParameters;
+
+// Default plant
+plantParameters defaultPlantParameters();
+
+// The parts of the encoder that the control logic reads
+class SimulatedEncoder {
+    public:
+        int32_t getAbsoluteCountsAvg() const;
+        int32_t getObserverPosition() const;
+        int32_t getObserverVelocity() const;
+
+        // Set by the plant after each sample
+        int32_t counts = 0;
+        int32_t velocity = 0;
+};
+
+// The simulated motor, with the same calls that the control logic makes on StepperMotor
+class SimulatedMotor {
+    public:
+        SimulatedMotor();
+
+        // Sets up the plant
+        void begin(const plantParameters &parameters);
+
+        // Desired position (what the step pin would have commanded), in counts
+        int32_t getDesiredCounts() const;
+        void setDesiredCounts(int32_t counts);
+
+        // Moves the coils by a number of microsteps (fractions are carried over, like the step schedule timer)
+        void moveCoils(double microsteps);
+
+        // Advances the physics by a time (s), then samples the encoder
+        void advance(double time);
+
+        // Exact rotor position (counts) and velocity (counts/s), for measuring the error without the quantization
+        double getRotorCounts() const;
+        double getRotorVelocity() const;
+
+        // Counts moved by a single microstep
+        double getCountsPerMicrostep() const;
+
+        // Encoder instance
+        SimulatedEncoder encoder;
+
+    private:
+        plantParameters parameters;
+        double rotorAngle = 0;     // rad
+        double rotorVelocity = 0;  // rad/s
+        double coilAngle = 0;      // rad (mechanical angle that the coils are holding)
+        int32_t desiredCounts = 0;
+};
+
+// Time of the simulation (us), read by micros()
+extern uint64_t simulationTime;
+
+#endif // ! __PLANT_H__
@@ -0,0 +1,212 @@
+// Host simulation of the control loop
+// Runs the firmware's StepperPID and motion planner (compiled unmodified) against the simulated motor and encoder,
+// then reports the loop's throughput, the step response, and the following error of a planned move
+// The small kernels are checked and timed first (see kernels.cpp), the run fails if any of their checks do
+// Optionally replays a recorded step stream: each line of the file is "<time in us> <steps>", the steps are added to the desired position at that time
+// Lines that aren't an event are skipped, so the dump of a capture (M321) can be replayed as it was logged
+
+// Import the config and the control logic
+#include "config.h"
+#include "main.h"
+#include "pid.h"
+#include "planner.h"
+#include "kernels.h"
+
+// Host only
+#include <chrono>
+#include <stdio.h>
+
+// The simulated motor
+SimulatedMotor motor;
+
+// The PID loop (initialized like the firmware)
+StepperPID pid;
+
+// Period of the control loop (s)
+static const double LOOP_PERIOD = (1.0 / CONTROL_LOOP_FREQ);
+
+// Error statistics of a run
+typedef struct {
+    double maxError = 0;   // Counts
+    double sumSquares = 0;
+    uint32_t samples = 0;
+} errorStats;
+
+
+// Runs one period of the control loop, returning the error (counts) between the desired and exact position
+static double runControlPeriod() {
+
+    // The PID output is a step rate, the step schedule timer spreads the steps over the period
+    int32_t rate = pid.compute();
+    motor.moveCoils((double)rate * LOOP_PERIOD);
+
+    // Move the physics forward to the next correction
+    motor.advance(LOOP_PERIOD);
+    return (motor.getDesiredCounts() - motor.getRotorCounts());
+}
+
+
+// Adds an error to a set of statistics
+static void addError(errorStats &stats, double error) {
+    stats.maxError = max(stats.maxError, fabs(error));
+    stats.sumSquares += (error * error);
+    stats.samples++;
+}
+
+
+// Prints a set of statistics
+static void printErrorStats(const char *name, const errorStats &stats) {
+    printf("%s: max %.1f counts (%.3f deg), RMS %.1f counts\n", name, stats.maxError, stats.maxError * 360.0 / ENCODER_COUNTS_PER_REV,
+           sqrt(stats.sumSquares / max(stats.samples, (uint32_t)1)));
+}
+
+
+// Resets the plant and the loop
+static void resetSimulation() {
+    motor.begin(defaultPlantParameters());
+    pid.reset();
+    simulationTime = 0;
+}
+
+
+// Measures how long a computation of the PID takes on the host (only useful for comparing changes)
+static void benchmarkThroughput() {
+    resetSimulation();
+    const uint32_t iterations = 1000000;
+    volatile int32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+        motor.encoder.counts = (int32_t)(iteration & 0xFF);
+        sink = sink + pid.compute();
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("PID compute: %.1f ns per call on the host\n", elapsed / iterations);
+}
+
+
+// Steps the desired position by a tenth of a turn, then measures the response
+static void stepResponse() {
+    resetSimulation();
+    const int32_t stepSize = (ENCODER_COUNTS_PER_REV / 10);
+    const double settleBand = 20;
+    motor.setDesiredCounts(stepSize);
+
+    // Run for half of a second
+    double peak = 0;
+    double settleTime = -1;
+    double riseTime = -1;
+    for (uint32_t period = 0; period < (CONTROL_LOOP_FREQ / 2); period++) {
+        double error = runControlPeriod();
+        double time = (period + 1) * LOOP_PERIOD;
+        peak = max(peak, motor.getRotorCounts());
+        if (riseTime < 0 && motor.getRotorCounts() >= 0.9 * stepSize) {
+            riseTime = time;
+        }
+        if (fabs(error) > settleBand) {
+            settleTime = -1;
+        }
+        else if (settleTime < 0) {
+            settleTime = time;
+        }
+    }
+    printf("Step response (%d counts): rise %.1f ms, overshoot %.1f%%, settled (+-%.0f counts) %s%.1f ms, final error %.1f counts\n",
+           stepSize, riseTime * 1000, 100.0 * (peak - stepSize) / stepSize, settleBand,
+           (settleTime < 0 ? "never, " : ""), max(settleTime, 0.0) * 1000, motor.getDesiredCounts() - motor.getRotorCounts());
+}
+
+
+// Follows a planned move of a turn, stepping the desired position like the step schedule timer does
+#ifdef ENABLE_MOTION_PLANNER
+static void plannedMove() {
+    resetSimulation();
+    const int64_t moveSteps = 200 * defaultPlantParameters().microstepping;
+    const double countsPerStep = motor.getCountsPerMicrostep();
+
+    // Start the profile, then take each step at its scheduled time
+    motionProfile profile;
+    uint32_t rate = startMotionProfile(profile, 20000, DEFAULT_PLANNER_ACCEL * 10, DEFAULT_PLANNER_JERK * 10);
+    int64_t remainingSteps = moveSteps;
+    double nextStepTime = 0;
+    double desired = 0;
+    errorStats stats;
+    for (uint32_t period = 0; period < CONTROL_LOOP_FREQ; period++) {
+
+        // Take all of the steps that are due before this correction (periods are whole timer ticks, like TIM4)
+        double time = period * LOOP_PERIOD;
+        while (remainingSteps > 0 && nextStepTime <= time) {
+            desired += countsPerStep;
+            remainingSteps--;
+            uint32_t ticks = max(STEP_SCHEDULE_TICK_FREQ / max(rate, (uint32_t)1), (uint32_t)1);
+            nextStepTime += (double)ticks / STEP_SCHEDULE_TICK_FREQ;
+            if (remainingSteps > 0) {
+                rate = advanceMotionProfile(profile, ticks, remainingSteps);
+            }
+        }
+        motor.setDesiredCounts((int32_t)desired);
+        addError(stats, runControlPeriod());
+    }
+    printf("Planned move (%lld microsteps, done at %.1f ms): ", (long long)moveSteps, nextStepTime * 1000);
+    printErrorStats("following error", stats);
+}
+#endif
+
+
+// Reads the next event of a step stream, skipping the lines that aren't one (returns false at the end of the file)
+static bool readStepEvent(FILE *recording, unsigned long long &eventTime, long long &eventSteps) {
+    char line[128];
+    while (fgets(line, sizeof(line), recording) != NULL) {
+        if (line[0] != '#' && sscanf(line, "%llu %lld", &eventTime, &eventSteps) == 2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Replays a recorded step stream, measuring the following error
+static void replaySteps(const char *path) {
+
+    // Open the recording
+    FILE *recording = fopen(path, "r");
+    if (recording == NULL) {
+        printf("Couldn't open %s\n", path);
+        return;
+    }
+    resetSimulation();
+
+    // Run the loop until the end of the recording
+    double countsPerStep = motor.getCountsPerMicrostep();
+    double desired = 0;
+    unsigned long long eventTime = 0;
+    long long eventSteps = 0;
+    bool eventPending = readStepEvent(recording, eventTime, eventSteps);
+    errorStats stats;
+    while (eventPending) {
+        while (eventPending && eventTime <= simulationTime) {
+            desired += (eventSteps * countsPerStep);
+            eventPending = readStepEvent(recording, eventTime, eventSteps);
+        }
+        motor.setDesiredCounts((int32_t)desired);
+        addError(stats, runControlPeriod());
+    }
+    fclose(recording);
+    printf("Replay of %s (%.1f ms): ", path, simulationTime / 1000.0);
+    printErrorStats("following error", stats);
+}
+
+
+// Runs all of the simulations
+int main(int argc, char **argv) {
+    uint32_t failures = runKernelChecks();
+    benchmarkThroughput();
+    stepResponse();
+    #ifdef ENABLE_MOTION_PLANNER
+        plannedMove();
+    #endif
+    for (int argIndex = 1; argIndex < argc; argIndex++) {
+        replaySteps(argv[argIndex]);
+    }
+
+    // A failed kernel check fails the run
+    return (failures > 0 ? 1 : 0);
+}
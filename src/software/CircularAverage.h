@@ -0,0 +1,152 @@
+/*
+ *  Wrap-aware moving average of angles
+ *  Averages angles that wrap around (ex. the encoder's 15 bit increments), so that readings on both sides of 0 average to 0 instead of half a turn
+ *  Created by Christian Piper (CAP1Sup)
+ */
+
+#pragma once
+
+// Standard naming conventions
+#include "stdint.h"
+
+// Fixed size storage of the readings
+#include <array>
+
+// For picking the type of the running total
+#include <type_traits>
+
+// The log2 helper
+#include "MovingAverage.h"
+
+
+// A class used to average angles of BITS bits (one turn is 2^BITS), over N readings
+// Each reading is unwrapped using the signed difference from the previous one, then the unwrapped values are averaged with integer math
+// The unwrapped values are pulled back toward 0 every so often, so they never overflow no matter how many turns are made
+template <uint16_t N, uint8_t BITS>
+class CircularAverage {
+  static_assert(N > 0, "CircularAverage needs at least one reading");
+  static_assert(BITS < 16, "CircularAverage angles must fit in 16 bits");
+
+  private:
+    // The size of a turn, and the distance the unwrapped values can drift before they are pulled back
+    static constexpr int32_t TURN = ((int32_t)1 << BITS);
+    static constexpr int32_t TURN_MASK = (TURN - 1);
+    static constexpr int32_t REBASE_LIMIT = (TURN << 4);
+
+    uint16_t readingsPosition = 0; // Current position in the array
+    uint16_t readingsNum = 0; // Number of readings currently being averaged
+    std::array<int32_t, N> readings = {}; // Array of unwrapped readings
+
+    // The last reading, unwrapped and as it was read
+    int32_t lastUnwrapped = 0;
+    uint16_t lastReading = 0;
+
+    // The unwrapped readings are all within REBASE_LIMIT of 0, so the total only needs 64 bits if there are a lot of readings
+    typedef typename std::conditional<((uint64_t)N * (REBASE_LIMIT * 2) < ((uint64_t)1 << 31)), int32_t, int64_t>::type total_t;
+    total_t runningTotal = 0;
+
+    // If a full average can be found with a shift instead of a division
+    static constexpr bool shiftAverage = ((N & (N - 1)) == 0);
+
+    // Moves all of the readings by whole turns, so that the newest one is back within a turn of 0
+    void rebase();
+
+  public:
+    void add(uint16_t newReading);
+    uint16_t get();
+    int32_t getUnwrapped();
+    void clear();
+};
+
+
+// Add an angle to the average
+template <uint16_t N, uint8_t BITS>
+void CircularAverage<N, BITS>::add(uint16_t newReading) {
+
+    // Unwrap the reading using the shortest signed distance from the last one (the first reading starts where it is)
+    if (readingsNum == 0) {
+        lastUnwrapped = (newReading & TURN_MASK);
+    }
+    else {
+        int32_t delta = ((int32_t)newReading - (int32_t)lastReading) & TURN_MASK;
+        if (delta >= (TURN / 2)) {
+            delta -= TURN;
+        }
+        lastUnwrapped += delta;
+    }
+    lastReading = newReading;
+
+    // Keep record of the number of readings being averaged, removing the oldest once full
+    if (readingsNum < N) {
+        readingsNum++;
+    }
+    else {
+        runningTotal -= readings[readingsPosition];
+    }
+
+    // Add the new reading
+    runningTotal += lastUnwrapped;
+    readings[readingsPosition] = lastUnwrapped;
+
+    // Move to the next position (stored newest first, like MovingAverage)
+    if (readingsPosition == 0) {
+        readingsPosition = N - 1;
+    }
+    else {
+        readingsPosition--;
+    }
+
+    // Pull the readings back toward 0 if they have drifted too far
+    if (lastUnwrapped >= REBASE_LIMIT || lastUnwrapped <= -REBASE_LIMIT) {
+        rebase();
+    }
+}
+
+
+// Moves all of the readings by whole turns
+template <uint16_t N, uint8_t BITS>
+void CircularAverage<N, BITS>::rebase() {
+
+    // Offset that brings the newest reading back within the first turn
+    int32_t offset = lastUnwrapped - (lastUnwrapped & TURN_MASK);
+
+    // Move everything by the offset (the averaged angle doesn't change, since it is whole turns)
+    for (uint16_t readingIndex = 0; readingIndex < N; readingIndex++) {
+        readings[readingIndex] -= offset;
+    }
+    runningTotal -= ((total_t)offset * readingsNum);
+    lastUnwrapped -= offset;
+}
+
+
+// Get the averaged angle (0 to 2^BITS - 1)
+template <uint16_t N, uint8_t BITS>
+uint16_t CircularAverage<N, BITS>::get() {
+    return (uint16_t)(getUnwrapped() & TURN_MASK);
+}
+
+
+// Get the average of the unwrapped readings (continues past a turn, only good for short term comparisons since it is rebased)
+template <uint16_t N, uint8_t BITS>
+int32_t CircularAverage<N, BITS>::getUnwrapped() {
+
+    // Nothing to average
+    if (readingsNum == 0) {
+        return 0;
+    }
+
+    // Once full, a power of 2 number of readings is just a shift
+    if (shiftAverage && readingsNum == N) {
+        return (int32_t)(runningTotal >> movingAverageLog2(N));
+    }
+    return (int32_t)(runningTotal / readingsNum);
+}
+
+
+// Clears all stored values
+template <uint16_t N, uint8_t BITS>
+void CircularAverage<N, BITS>::clear() {
+    readingsPosition = 0;
+    readingsNum = 0;
+    runningTotal = 0;
+}
@@ -10,26 +10,43 @@
 // Standard naming conventions
 #include "stdint.h"
 
+// Fixed size storage of the readings
+#include <array>
+
+// For picking the type of the running total
+#include <type_traits>
+
+
+// Finds the log2 of a power of 2 at compile time (used to turn divisions by the number of readings into shifts)
+constexpr uint8_t movingAverageLog2(uint32_t value) {
+    return ((value <= 1) ? 0 : (1 + movingAverageLog2(value >> 1)));
+}
+
 
 // A class used to store and calculate the values to be smoothed.
-template <typename T>
+// N is the number of readings to average. The storage is sized at compile time, so nothing is allocated on the heap
+template <typename T, uint16_t N>
 class MovingAverage {
+  static_assert(N > 0, "MovingAverage needs at least one reading");
+
   private:
-    uint16_t readingsFactor = 10; // The smoothing factor. In average mode, this is the number of readings to average.
     uint16_t readingsPosition = 0; // Current position in the array
     uint16_t readingsNum = 0; // Number of readings currently being averaged
-    T *readings; // Array of readings
-                 // readings[readingsFactor]
-                 // readings are stored in an array in an unusual sequence to win/remove one subtraction in code
-                 // X(0), X(readingsFactor-1), ..., X(2), X(1)
+    std::array<T, N> readings = {}; // Array of readings
+                                    // readings are stored in an array in an unusual sequence to win/remove one subtraction in code
+                                    // X(0), X(N-1), ..., X(2), X(1)
+
+    // Integer readings are totaled in an integer (no soft-float math when averaging positions), 32 bits if N of the largest readings fit, otherwise 64
+    // Everything else is totaled in a double, so that the running total doesn't drift
+    typedef typename std::conditional<std::is_integral<T>::value,
+        typename std::conditional<((sizeof(T) < 4) && (((uint64_t)N << (8 * sizeof(T))) <= ((uint64_t)1 << 31))), int32_t, int64_t>::type,
+        double>::type total_t;
+    total_t runningTotal = 0; // A cache of the total of the array, speeds up getting the average
 
-    // ! Dynamically decide which type to use for the total
-    double runningTotal = 0.0; // A cache of the total of the array, speeds up getting the average
+    // If a full average can be found with a shift instead of a division
+    static constexpr bool shiftAverage = (std::is_integral<T>::value && ((N & (N - 1)) == 0));
 
   public:
-    MovingAverage();
-    ~MovingAverage(); // Destructor to clean up when class instance killed
-    void begin(uint16_t smoothFactor = 10);
     void add(T newReading);
     T get();
     double getDouble();
@@ -38,42 +55,13 @@ class MovingAverage {
 };
 
 
-// Constructor
-template <typename T>
-MovingAverage<T>::MovingAverage () {}
-
-
-// Destructor
-template <typename T>
-MovingAverage<T>::~MovingAverage () { // Destructor
-    delete[] readings;
-}
-
-
-// Initialize the array for storing sensor values
-template <typename T>
-void MovingAverage<T>::begin (uint16_t smoothFactor) {
-
-    // Store the number of readings in the array
-    readingsFactor = smoothFactor;
-
-    // Create the actual array of the required size
-    readings = new T[readingsFactor];
-
-    // Initialise all the values in the array to zero
-    for (uint16_t thisReading = 0; thisReading < readingsFactor; thisReading++) {
-        readings[thisReading] = 0;
-    }
-}
-
-
 // Add a value to the array
-template <typename T>
-void MovingAverage<T>::add (T newReading) {
+template <typename T, uint16_t N>
+void MovingAverage<T, N>::add (T newReading) {
 
     // Keep record of the number of readings being averaged
     // This will count up to the array size then stay at that number
-    if(readingsNum < readingsFactor) {
+    if(readingsNum < N) {
         readingsNum++;
     }
     else {
@@ -91,7 +79,7 @@ void MovingAverage<T>::add (T newReading) {
     if (readingsPosition == 0) {
 
         // Set position to the end of the array
-        readingsPosition = readingsFactor - 1;
+        readingsPosition = N - 1;
     }
     else {
         // Decrement to previous array position
@@ -101,26 +89,41 @@ void MovingAverage<T>::add (T newReading) {
 
 
 // Get the smoothed result
-template <typename T>
-T MovingAverage<T>::get() {
-    return (runningTotal / readingsNum);
+template <typename T, uint16_t N>
+T MovingAverage<T, N>::get() {
+
+    // Nothing to average
+    if (readingsNum == 0) {
+        return 0;
+    }
+
+    // Once full, a power of 2 number of readings is just a shift
+    if (shiftAverage && readingsNum == N) {
+        return (T)((int64_t)runningTotal >> movingAverageLog2(N));
+    }
+    return (T)(runningTotal / readingsNum);
 }
 
 
 // Get the smoothed result as double type
-template <typename T>
-double MovingAverage<T>::getDouble() {
-    return runningTotal / readingsNum;
+template <typename T, uint16_t N>
+double MovingAverage<T, N>::getDouble() {
+
+    // Nothing to average
+    if (readingsNum == 0) {
+        return 0;
+    }
+    return (double)runningTotal / readingsNum;
 }
 
 
 // Gets the last result stored
-template <typename T>
-T MovingAverage<T>::getLast() {
+template <typename T, uint16_t N>
+T MovingAverage<T, N>::getLast() {
 
     // Just return the last reading
-    if (readingsPosition == 0) {
-        return readings[readingsFactor - 1];
+    if (readingsPosition == N - 1) {
+        return readings[0];
     }
     else {
         return readings[readingsPosition + 1];
@@ -129,11 +132,11 @@ T MovingAverage<T>::getLast() {
 
 
 // Clears all stored values
-template <typename T>
-void MovingAverage<T>::clear () {
+template <typename T, uint16_t N>
+void MovingAverage<T, N>::clear () {
 
     // Reset the counters
     readingsPosition = 0;
     readingsNum = 0;
-    runningTotal = 0.0;
-}
\ No newline at end of file
+    runningTotal = 0;
+}
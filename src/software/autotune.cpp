@@ -0,0 +1,188 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_AUTOTUNE
+
+// Import the header file
+#include "autotune.h"
+#include "timers.h"
+#include "flash.h"
+#include "fixedFormat.h"
+
+// Relay feedback (Astrom-Hagglund) autotune
+// The relay steps the motor at +rate while the rotor is behind the setpoint and -rate once it is ahead, with a little hysteresis.
+// The loop settles into a limit cycle at its ultimate period, and the size of the swing gives the ultimate gain.
+// The inertia and spring of the rotor, the friction, and the lag of the loop all show up in those two numbers,
+// so the gains are found from them with the Tyreus-Luyben rules (less overshoot than Ziegler-Nichols)
+
+// State of the experiment (shared with the correction interrupt)
+static volatile AUTOTUNE_STATE autotuneState = AUTOTUNE_IDLE;
+
+// Settings of the relay (counts, steps/s)
+static int32_t relayRate = 0;
+static int32_t relayHysteresis = 0;
+static int32_t maxRelayError = 0;
+
+// Measurements of the limit cycle
+static bool relayHigh = false;
+static bool risingSeen = false;
+static uint32_t autotuneTicks = 0;
+static uint32_t lastRiseTick = 0;
+static int32_t cycleMaxInput = 0;
+static int32_t cycleMinInput = 0;
+static uint8_t settledCycles = 0;
+static uint8_t measuredCycles = 0;
+static uint32_t periodTicksTotal = 0;
+static uint32_t amplitudeTotal = 0;
+
+
+// If the relay is driving the motor instead of the PID
+bool isAutotuneRunning() {
+    return (autotuneState == AUTOTUNE_RUNNING);
+}
+
+
+// Computes the relay's output, called by the correction in place of the PID
+int32_t RAMFUNC computeAutotuneOutput() {
+
+    // Stop the motor once the experiment is over
+    if (autotuneState != AUTOTUNE_RUNNING) {
+        return 0;
+    }
+
+    // Find the error, the setpoint doesn't move during the experiment
+    int32_t input = motor.encoder.getAbsoluteCountsAvg();
+    int32_t error = motor.getDesiredCounts() - input;
+    autotuneTicks++;
+
+    // Give up if the swing is far larger than expected (the motor is stalled, or the relay rate is too high)
+    if (abs(error) > maxRelayError) {
+        autotuneState = AUTOTUNE_FAILED;
+        return 0;
+    }
+
+    // Track the extremes of the current cycle
+    cycleMaxInput = max(cycleMaxInput, input);
+    cycleMinInput = min(cycleMinInput, input);
+
+    // Switch the relay once the error passes the hysteresis band
+    if (relayHigh) {
+        if (error < -relayHysteresis) {
+            relayHigh = false;
+        }
+    }
+    else if (error > relayHysteresis) {
+        relayHigh = true;
+
+        // Each rising switch ends a cycle, the first few are skipped while the oscillation settles
+        if (risingSeen) {
+            if (settledCycles < AUTOTUNE_SETTLE_CYCLES) {
+                settledCycles++;
+            }
+            else {
+                periodTicksTotal += (autotuneTicks - lastRiseTick);
+                amplitudeTotal += (uint32_t)(cycleMaxInput - cycleMinInput);
+                measuredCycles++;
+            }
+        }
+
+        // Start the next cycle
+        risingSeen = true;
+        lastRiseTick = autotuneTicks;
+        cycleMaxInput = input;
+        cycleMinInput = input;
+
+        // All of the cycles have been measured
+        if (measuredCycles >= AUTOTUNE_CYCLES) {
+            autotuneState = AUTOTUNE_DONE;
+            return 0;
+        }
+    }
+
+    // Drive the motor toward the side that the relay is on
+    return (relayHigh ? relayRate : -relayRate);
+}
+
+
+// Runs the relay experiment around the current position, then sets and saves the new PID gains
+String runAutotune(uint32_t rate) {
+
+    // The relay runs in the correction, so the closed loop mode has to be on
+    if (!isStepCorrectionEnabled()) {
+        return F("Autotune requires closed loop mode to be enabled");
+    }
+
+    // Set up the relay, the hysteresis is given in microsteps since the correction ignores errors of a single microstep
+    int32_t countsPerMicrostep = (ENCODER_COUNTS_PER_REV / motor.getMicrostepsPerRotation());
+    relayRate = constrain((rate > 0 ? rate : AUTOTUNE_RELAY_RATE), 1, DEFAULT_PID_STEP_MAX);
+    relayHysteresis = max(AUTOTUNE_HYSTERESIS * countsPerMicrostep, (int32_t)1);
+    maxRelayError = AUTOTUNE_MAX_ERROR * countsPerMicrostep;
+
+    // Clear the measurements
+    relayHigh = (motor.getDesiredCounts() >= motor.encoder.getAbsoluteCountsAvg());
+    risingSeen = false;
+    autotuneTicks = 0;
+    lastRiseTick = 0;
+    settledCycles = 0;
+    measuredCycles = 0;
+    periodTicksTotal = 0;
+    amplitudeTotal = 0;
+
+    // Hand the motor over to the relay, then wait for the experiment to finish
+    syncInstructions();
+    autotuneState = AUTOTUNE_RUNNING;
+    uint32_t startTime = millis();
+    while (autotuneState == AUTOTUNE_RUNNING) {
+        if ((millis() - startTime) > AUTOTUNE_TIMEOUT) {
+            autotuneState = AUTOTUNE_FAILED;
+        }
+        delay(1);
+
+        // The main loop is held up until the experiment finishes, so it has to keep the watchdog fed
+        #ifdef ENABLE_WATCHDOG
+            watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+            serviceWatchdog();
+        #endif
+    }
+
+    // Give the motor back to the PID, starting from a clean state
+    AUTOTUNE_STATE result = autotuneState;
+    disableInterrupts();
+    autotuneState = AUTOTUNE_IDLE;
+    pid.reset();
+    enableInterrupts();
+
+    // Report why the autotune failed
+    if (result != AUTOTUNE_DONE) {
+        if (measuredCycles == 0 && !risingSeen) {
+            return F("Autotune failed, the motor didn't oscillate (try a higher relay rate)");
+        }
+        return F("Autotune failed, the oscillation was too large or didn't settle (try a lower relay rate)");
+    }
+
+    // Average the cycles, the period in ms and the amplitude of the error in degrees
+    float ultimatePeriod = ((float)periodTicksTotal * 1000) / ((float)measuredCycles * CONTROL_LOOP_FREQ);
+    float amplitude = (((float)amplitudeTotal / (2 * measuredCycles)) * 360) / ENCODER_COUNTS_PER_REV;
+    float hysteresis = ((float)relayHysteresis * 360) / ENCODER_COUNTS_PER_REV;
+
+    // Ultimate gain from the describing function of a relay with hysteresis (steps/s per degree)
+    float effectiveAmplitude = sqrt(max((amplitude * amplitude) - (hysteresis * hysteresis), (amplitude * amplitude) / 100));
+    float ultimateGain = (4 * relayRate) / (PI * effectiveAmplitude);
+
+    // Tyreus-Luyben gains, converted to the PID's units (error in degrees, time in ms)
+    float pValue = ultimateGain / 2.2f;
+    float iValue = pValue / (2.2f * ultimatePeriod);
+    float dValue = pValue * (ultimatePeriod / 6.3f);
+
+    // Set the new gains, then save them
+    pid.setP(pValue);
+    pid.setI(iValue);
+    pid.setD(dValue);
+    saveParameters();
+
+    // Report the results
+    return ("Ku: " + floatString(ultimateGain) + " | Tu: " + floatString(ultimatePeriod) + "ms | P: " + floatString(pid.getP()) + " | I: " + floatString(pid.getI()) + " | D: " + floatString(pid.getD()));
+}
+
+#endif // ! ENABLE_AUTOTUNE
@@ -0,0 +1,36 @@
+#ifndef __AUTOTUNE_H__
+#define __AUTOTUNE_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the autotune is enabled
+#ifdef ENABLE_AUTOTUNE
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// States of the autotune
+typedef enum {
+    AUTOTUNE_IDLE,     // Not running, the PID drives the motor
+    AUTOTUNE_RUNNING,  // The relay drives the motor, measuring the oscillation
+    AUTOTUNE_DONE,     // All of the cycles were measured
+    AUTOTUNE_FAILED    // The oscillation grew too large, or it didn't finish in time
+} AUTOTUNE_STATE;
+
+// Runs the relay experiment around the current position, then sets and saves the new PID gains
+// Blocks until the experiment is done. Rate is the relay's output (steps/s), 0 uses AUTOTUNE_RELAY_RATE
+// Returns the gains that were found, or the reason that the autotune failed
+String runAutotune(uint32_t rate);
+
+// If the relay is driving the motor instead of the PID
+bool isAutotuneRunning();
+
+// Computes the relay's output (steps/s), called by the correction in place of the PID while the autotune is running
+int32_t computeAutotuneOutput();
+
+#endif // ! ENABLE_AUTOTUNE
+#endif // ! __AUTOTUNE_H__
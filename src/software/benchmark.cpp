@@ -0,0 +1,162 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_BENCHMARK
+
+// Import the header file
+#include "benchmark.h"
+#include "serial.h"
+#include "timers.h"
+
+// Bounds of the sections, from the linker script
+extern "C" uint32_t _etext, _sidata, _sdata, _edata, _ebss;
+
+
+// Sends the build profile and the size of the firmware, so that the cycles can be compared between the builds
+static void reportBuild() {
+
+    // The flash holds the code and constants, then the initial values of the data (including the functions run from RAM)
+    uint32_t dataSize = (uint32_t)&_edata - (uint32_t)&_sdata;
+    uint32_t flashSize = ((uint32_t)&_sidata - FLASH_BASE) + dataSize;
+    uint32_t ramSize = (uint32_t)&_ebss - (uint32_t)&_sdata;
+
+    #ifdef BUILD_PROFILE_RELEASE
+        sendSerialMessage(F("Build: release (LTO, -Os outside of the hot paths)\n"));
+    #else
+        sendSerialMessage(F("Build: default (-Ofast)\n"));
+    #endif
+    sendSerialMessage("Flash used: " + String(flashSize) + F(" bytes (code: ") + String((uint32_t)&_etext - FLASH_BASE) +
+                      F(" bytes) | RAM used: ") + String(ramSize) + F(" bytes\n"));
+}
+
+
+// Sends the statistics of a measured function
+static void reportCycleStats(const char *name, const cycleStats &stats) {
+    sendSerialMessage(String(name) + F(": min ") + String(stats.min) +
+                      F(", avg ") + String((uint32_t)(stats.total / stats.count)) +
+                      F(", max ") + String(stats.max) + F(" cycles\n"));
+}
+
+
+// Times a function call BENCHMARK_SAMPLES times
+// The counter read overhead is measured first and removed from each sample
+#define MEASURE_CYCLES(stats, call) {                        \
+    resetCycleStats(stats);                                  \
+    for (uint32_t sample = 0; sample < BENCHMARK_SAMPLES; sample++) { \
+        uint32_t startCycles = getCycleCount();              \
+        call;                                                \
+        uint32_t cycles = getCycleCount() - startCycles;     \
+        addCycleStats(stats, (cycles > overheadCycles ? cycles - overheadCycles : 0)); \
+    }                                                        \
+}
+
+
+// Runs a burst of scheduled steps, returning if the steps kept up with the rate
+static bool runStepBurst(uint32_t rate) {
+
+    // Time the burst from the start of the schedule until the last step is taken
+    uint32_t startTime = micros();
+    scheduleSteps(BENCHMARK_BURST_STEPS, rate, COUNTER_CLOCKWISE);
+    while (getRemainingScheduledSteps() > 0) {}
+    uint32_t elapsedTime = micros() - startTime;
+
+    // The burst is sustainable if it took about as long as it should have
+    uint32_t expectedTime = ((uint64_t)BENCHMARK_BURST_STEPS * 1000000) / rate;
+    return (elapsedTime <= (expectedTime + (expectedTime * BENCHMARK_RATE_TOLERANCE) / 100));
+}
+
+
+// Finds the following error during a burst of steps, with the latency compensation on or off
+// The error is always measured against where the rotor is predicted to be now, so that both runs are judged the same way
+#ifdef ENABLE_LATENCY_COMPENSATION
+static void measureFollowingError(bool compensated, uint32_t &meanError, uint32_t &peakError) {
+
+    // Set the compensation, then step the burst out
+    motor.encoder.setLatencyCompensation(compensated);
+    scheduleSteps(BENCHMARK_BURST_STEPS, BENCHMARK_FOLLOW_RATE, COUNTER_CLOCKWISE);
+
+    // Skip the first quarter of the burst, the motor is still getting up to speed
+    uint64_t totalError = 0;
+    uint32_t samples = 0;
+    peakError = 0;
+    while (getRemainingScheduledSteps() > 0) {
+        if (getRemainingScheduledSteps() < ((3 * BENCHMARK_BURST_STEPS) / 4)) {
+            uint32_t error = abs(motor.getDesiredCounts() - motor.encoder.getPredictedPosition());
+            totalError += error;
+            peakError = max(peakError, error);
+            samples++;
+        }
+    }
+    meanError = (samples > 0) ? (uint32_t)(totalError / samples) : 0;
+}
+#endif
+
+
+// Runs all of the benchmarks, then reports the results over serial (the motor will move)
+void runBenchmarks() {
+
+    // Start the cycle counter, then find the overhead of reading it
+    initCycleCounter();
+    uint32_t overheadCycles = 0;
+    {
+        uint32_t startCycles = getCycleCount();
+        overheadCycles = getCycleCount() - startCycles;
+    }
+
+    // Nothing else can run while the hot paths are measured
+    disableMotorTimers();
+
+    // Enable the motor, the coils have to be driven for the measurements to be representative
+    motor.setState(FORCED_ENABLED, true);
+
+    // Measure each of the hot paths
+    cycleStats stats;
+    sendSerialMessage(F("Benchmark (") + String(SystemCoreClock / 1000000) + F(" MHz, ") + String(BENCHMARK_SAMPLES) + F(" samples)\n"));
+    reportBuild();
+
+    MEASURE_CYCLES(stats, motor.step(COUNTER_CLOCKWISE));
+    reportCycleStats("motor.step()", stats);
+    uint32_t stepCycles = stats.max;
+
+    MEASURE_CYCLES(stats, motor.driveCoils(sample));
+    reportCycleStats("driveCoils()", stats);
+
+    MEASURE_CYCLES(stats, correctMotor());
+    reportCycleStats("correctMotor()", stats);
+
+    uint16_t registerData;
+    MEASURE_CYCLES(stats, motor.encoder.readRegister(REG_STAT, registerData));
+    reportCycleStats("readRegister()", stats);
+
+    // The fastest that the step interrupt could possibly run (ignores the interrupt entry and exit)
+    sendSerialMessage(F("Max step freq (step cycles): ") + String(SystemCoreClock / (stepCycles > 0 ? stepCycles : 1)) + F(" Hz\n"));
+
+    // Restart the timers, then inject step bursts at increasing rates until they can't keep up
+    enableMotorTimers();
+    uint32_t sustainedRate = 0;
+    for (uint32_t rate = BENCHMARK_MIN_RATE; rate <= BENCHMARK_MAX_RATE; rate *= 2) {
+        if (!runStepBurst(rate)) {
+            break;
+        }
+        sustainedRate = rate;
+    }
+    sendSerialMessage(F("Max step freq (sustained bursts): ") + String(sustainedRate) + F(" Hz\n"));
+
+    // Compare the following error without and with the latency compensation
+    #ifdef ENABLE_LATENCY_COMPENSATION
+        bool compensation = motor.encoder.getLatencyCompensation();
+        uint32_t meanError, peakError;
+        measureFollowingError(false, meanError, peakError);
+        sendSerialMessage(F("Following error at ") + String(BENCHMARK_FOLLOW_RATE) + F(" Hz: uncompensated: avg ") + String(meanError) + F(", max ") + String(peakError) + F(" counts"));
+        measureFollowingError(true, meanError, peakError);
+        sendSerialMessage(F(" | compensated: avg ") + String(meanError) + F(", max ") + String(peakError) + F(" counts (") +
+                          String(motor.encoder.getLatency()) + F(" us of latency)\n"));
+        motor.encoder.setLatencyCompensation(compensation);
+    #endif
+
+    // Return the motor to normal operation
+    motor.setState(DISABLED, true);
+}
+
+#endif // ! ENABLE_BENCHMARK
@@ -0,0 +1,23 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the benchmark is enabled
+#ifdef ENABLE_BENCHMARK
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Cycle counter and statistics
+#include "profiler.h"
+
+// Runs all of the benchmarks, then reports the results over serial (the motor will move)
+void runBenchmarks();
+
+#endif // ! ENABLE_BENCHMARK
+#endif // ! __BENCHMARK_H__
@@ -0,0 +1,367 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_BINARY_PROTOCOL
+
+// Import the header file
+#include "binaryProtocol.h"
+#include "serial.h"
+#include "timers.h"
+#include "parser.h"
+#include "parameters.h"
+#include "pvt.h"
+
+#ifdef ENABLE_TRACE
+#include "trace.h"
+#endif
+
+// Size of the header (opcode, sequence) and the CRC of a request
+#define BINARY_REQUEST_HEADER_SIZE  2
+#define BINARY_CRC_SIZE             2
+
+// Size of the header (opcode, sequence, status) of a response
+#define BINARY_RESPONSE_HEADER_SIZE 3
+
+// Most payload that a response can hold
+#define BINARY_MAX_RESPONSE_PAYLOAD (BINARY_MAX_FRAME_SIZE - BINARY_RESPONSE_HEADER_SIZE - BINARY_CRC_SIZE)
+
+// Request that was decoded, and the response being built (kept static so the frames aren't on the stack)
+static uint8_t requestFrame[BINARY_MAX_ENCODED_SIZE];
+static uint8_t responseFrame[BINARY_MAX_FRAME_SIZE];
+static uint8_t encodedFrame[BINARY_MAX_ENCODED_SIZE + 2];
+
+
+// COBS encodes length bytes of data into output, returning the encoded length
+uint16_t cobsEncode(const uint8_t* data, uint16_t length, uint8_t* output) {
+
+    // Each block starts with a code, the distance to the next zero (or 0xFF if the block ran 254 bytes without one)
+    uint16_t outIndex = 1;
+    uint16_t codeIndex = 0;
+    uint8_t code = 1;
+    for (uint16_t index = 0; index < length; index++) {
+
+        // A zero ends the block, writing its code in place of the zero
+        if (data[index] == 0) {
+            output[codeIndex] = code;
+            codeIndex = outIndex++;
+            code = 1;
+        }
+        else {
+            output[outIndex++] = data[index];
+            code++;
+
+            // A full block ends without a zero (only when there's more data, so that an extra block isn't added at the end)
+            if (code == 0xFF && (index + 1) < length) {
+                output[codeIndex] = code;
+                codeIndex = outIndex++;
+                code = 1;
+            }
+        }
+    }
+
+    // Finish the last block
+    output[codeIndex] = code;
+    return outIndex;
+}
+
+
+// COBS decodes length bytes into output, returning the decoded length (0 if the frame is corrupt)
+uint16_t cobsDecode(const uint8_t* data, uint16_t length, uint8_t* output) {
+
+    // Walk through the blocks
+    uint16_t index = 0;
+    uint16_t outIndex = 0;
+    while (index < length) {
+
+        // A block can't point past the end of the frame or hold a zero in it
+        uint8_t code = data[index++];
+        if (code == 0 || (index + code - 1) > length) {
+            return 0;
+        }
+
+        // Copy the block's data
+        for (uint8_t blockIndex = 1; blockIndex < code; blockIndex++) {
+            uint8_t value = data[index++];
+            if (value == 0) {
+                return 0;
+            }
+            output[outIndex++] = value;
+        }
+
+        // The block stood for a zero, unless it was full or it was the last one
+        if (code != 0xFF && index < length) {
+            output[outIndex++] = 0;
+        }
+    }
+
+    // Return the length that was decoded
+    return outIndex;
+}
+
+
+// Adds the CRC to the response, then encodes and sends it
+static void sendBinaryResponse(uint8_t opcode, uint8_t sequence, BINARY_STATUS status, uint16_t payloadLength) {
+
+    // Fill in the header (the payload was already written after it)
+    responseFrame[0] = (opcode | BINARY_RESPONSE_FLAG);
+    responseFrame[1] = sequence;
+    responseFrame[2] = status;
+
+    // Add the CRC, low byte first
+    uint16_t length = BINARY_RESPONSE_HEADER_SIZE + payloadLength;
+    uint16_t crc = crc16(responseFrame, length);
+    responseFrame[length++] = (crc & 0xFF);
+    responseFrame[length++] = (crc >> 8);
+
+    // Encode the frame between the delimiters, then queue it
+    encodedFrame[0] = 0;
+    uint16_t encodedLength = cobsEncode(responseFrame, length, &encodedFrame[1]) + 1;
+    encodedFrame[encodedLength++] = 0;
+    sendSerialData(encodedFrame, encodedLength);
+}
+
+
+// Copies a float out of a payload
+static float readFloat(const uint8_t* data) {
+    float value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+
+// Converts the result of a parameter access into the status of a response
+static BINARY_STATUS toBinaryStatus(PARAMETER_STATUS status) {
+    switch (status) {
+        case PARAMETER_OK:
+            return BINARY_STATUS_OK;
+        case PARAMETER_UNSUPPORTED:
+            return BINARY_STATUS_UNSUPPORTED;
+        case PARAMETER_BUSY:
+            return BINARY_STATUS_BUSY;
+        default:
+            return BINARY_STATUS_BAD_VALUE;
+    }
+}
+
+
+// Fills in the status of the motor
+static void getBinaryStatus(binaryStatus &status) {
+    status.state = motor.getState();
+    status.flags = getStatusFlags();
+    status.steps = motor.getSoftStepCNT();
+    status.counts = motor.encoder.getAbsoluteCountsAvg();
+    status.stepError = motor.getStepError();
+    status.rpm = motor.getEncoderRPM();
+    status.temperature = (int16_t)round(motor.encoder.getTemp() * 10);
+}
+
+
+// Copies records of a block into the response, returning the length of the payload
+static BINARY_STATUS readBinaryBlock(uint8_t block, uint16_t start, uint16_t count, uint16_t &payloadLength) {
+    switch (block) {
+        #ifdef ENABLE_TRACE
+        case BINARY_BLOCK_TRACE: {
+
+            // The samples can't be read while the trace is still recording
+            if (getTraceState() == TRACE_ARMED || getTraceState() == TRACE_TRIGGERED) {
+                return BINARY_STATUS_BUSY;
+            }
+
+            // Send the total first, so that the host knows how many reads it needs
+            uint16_t total = getTraceSampleCount();
+            memcpy(&responseFrame[BINARY_RESPONSE_HEADER_SIZE], &total, sizeof(total));
+            payloadLength = sizeof(total);
+
+            // Copy as many of the samples as fit in the frame
+            traceSample sample;
+            while (count > 0 && (payloadLength + sizeof(sample)) <= BINARY_MAX_RESPONSE_PAYLOAD && getTraceSample(start, sample)) {
+                memcpy(&responseFrame[BINARY_RESPONSE_HEADER_SIZE + payloadLength], &sample, sizeof(sample));
+                payloadLength += sizeof(sample);
+                start++;
+                count--;
+            }
+            return BINARY_STATUS_OK;
+        }
+        #endif // ! ENABLE_TRACE
+
+        default:
+            return BINARY_STATUS_UNSUPPORTED;
+    }
+}
+
+
+// Handles an encoded frame (without the delimiters), sending the response to the host
+bool handleBinaryFrame(const uint8_t* frame, uint16_t length) {
+
+    // Decode the frame, dropping it if it is corrupt or too short to hold the header and the CRC
+    length = cobsDecode(frame, length, requestFrame);
+    if (length < (BINARY_REQUEST_HEADER_SIZE + BINARY_CRC_SIZE) || length > BINARY_MAX_FRAME_SIZE) {
+        return false;
+    }
+
+    // Check the CRC
+    length -= BINARY_CRC_SIZE;
+    if (crc16(requestFrame, length) != (requestFrame[length] | (requestFrame[length + 1] << 8))) {
+        return false;
+    }
+
+    // Split out the header
+    uint8_t opcode = requestFrame[0];
+    uint8_t sequence = requestFrame[1];
+    const uint8_t* payload = &requestFrame[BINARY_REQUEST_HEADER_SIZE];
+    length -= BINARY_REQUEST_HEADER_SIZE;
+
+    // Run the request
+    BINARY_STATUS status = BINARY_STATUS_OK;
+    uint16_t payloadLength = 0;
+    switch (opcode) {
+
+        case BINARY_OP_GET_STATUS: {
+            binaryStatus motorStatus;
+            getBinaryStatus(motorStatus);
+            memcpy(&responseFrame[BINARY_RESPONSE_HEADER_SIZE], &motorStatus, sizeof(motorStatus));
+            payloadLength = sizeof(motorStatus);
+            break;
+        }
+
+        case BINARY_OP_MOVE: {
+            #ifdef ENABLE_DIRECT_STEPPING
+            if (length != sizeof(binaryMove)) {
+                status = BINARY_STATUS_BAD_LENGTH;
+                break;
+            }
+            binaryMove move;
+            memcpy(&move, payload, sizeof(move));
+            if (move.count == 0 || move.rate == 0) {
+                status = BINARY_STATUS_BAD_VALUE;
+                break;
+            }
+
+            // Only a planned build can ramp the move, filling in the jerk if it wasn't given
+            #ifdef ENABLE_MOTION_PLANNER
+                if (move.accel > 0 && move.jerk == 0) {
+                    move.jerk = DEFAULT_PLANNER_JERK;
+                }
+            #else
+                move.accel = 0;
+                move.jerk = 0;
+            #endif
+
+            // The move only fails if the queue is full (or the torque mode is running)
+            if (!startMove(move.count, move.rate, move.accel, move.jerk).equals(FEEDBACK_OK)) {
+                status = BINARY_STATUS_BUSY;
+            }
+            #else
+                status = BINARY_STATUS_UNSUPPORTED;
+            #endif // ! ENABLE_DIRECT_STEPPING
+            break;
+        }
+
+        case BINARY_OP_SET_PARAMETER: {
+            // One or more parameters, set as one transaction (the index of the one that failed is returned)
+            const uint8_t pairSize = (sizeof(uint8_t) + sizeof(float));
+            uint8_t count = (length / pairSize);
+            if (count == 0 || (length % pairSize) != 0) {
+                status = BINARY_STATUS_BAD_LENGTH;
+                break;
+            }
+            uint8_t ids[BINARY_MAX_FRAME_SIZE / pairSize];
+            float values[BINARY_MAX_FRAME_SIZE / pairSize];
+            for (uint8_t index = 0; index < count; index++) {
+                ids[index] = payload[index * pairSize];
+                values[index] = readFloat(&payload[(index * pairSize) + 1]);
+            }
+            uint8_t failedIndex = 0;
+            status = toBinaryStatus(setParameters(ids, values, count, failedIndex));
+            if (status != BINARY_STATUS_OK) {
+                responseFrame[BINARY_RESPONSE_HEADER_SIZE] = failedIndex;
+                payloadLength = sizeof(failedIndex);
+            }
+            break;
+        }
+
+        case BINARY_OP_GET_PARAMETER: {
+            // One or more parameters, their values are returned in the same order
+            if (length == 0 || (length * sizeof(float)) > BINARY_MAX_RESPONSE_PAYLOAD) {
+                status = BINARY_STATUS_BAD_LENGTH;
+                break;
+            }
+            for (uint16_t index = 0; index < length && status == BINARY_STATUS_OK; index++) {
+                float value = 0;
+                status = toBinaryStatus(getParameter(payload[index], value));
+                memcpy(&responseFrame[BINARY_RESPONSE_HEADER_SIZE + (index * sizeof(value))], &value, sizeof(value));
+            }
+            payloadLength = ((status == BINARY_STATUS_OK) ? (length * sizeof(float)) : 0);
+            break;
+        }
+
+        case BINARY_OP_GET_STATUS_BLOCK: {
+            statusBlock motorStatus;
+            getStatusBlock(motorStatus);
+            memcpy(&responseFrame[BINARY_RESPONSE_HEADER_SIZE], &motorStatus, sizeof(motorStatus));
+            payloadLength = sizeof(motorStatus);
+            break;
+        }
+
+        case BINARY_OP_PVT_POINTS: {
+            #ifdef ENABLE_PVT_TRAJECTORY
+            uint16_t count = (length / sizeof(binaryPVTPoint));
+            if (count == 0 || (length % sizeof(binaryPVTPoint)) != 0) {
+                status = BINARY_STATUS_BAD_LENGTH;
+                break;
+            }
+            if (count > getPVTFreeSlots()) {
+                status = BINARY_STATUS_BUSY;
+                break;
+            }
+
+            // Buffer the points in order, stopping at the first one that is refused
+            for (uint16_t index = 0; index < count; index++) {
+                binaryPVTPoint request;
+                memcpy(&request, &payload[index * sizeof(binaryPVTPoint)], sizeof(request));
+                pvtPoint point = { request.position, request.velocity, request.duration };
+                PVT_RESULT result = queuePVTPoint(point);
+                if (result != PVT_QUEUED) {
+                    status = ((result == PVT_BAD_POINT) ? BINARY_STATUS_BAD_VALUE : BINARY_STATUS_BUSY);
+                    break;
+                }
+            }
+
+            // Let the host know how much more it can send
+            uint16_t freeSlots = getPVTFreeSlots();
+            memcpy(&responseFrame[BINARY_RESPONSE_HEADER_SIZE], &freeSlots, sizeof(freeSlots));
+            payloadLength = sizeof(freeSlots);
+            #else
+                status = BINARY_STATUS_UNSUPPORTED;
+            #endif // ! ENABLE_PVT_TRAJECTORY
+            break;
+        }
+
+        case BINARY_OP_BULK_READ: {
+            if (length != (sizeof(uint8_t) + (2 * sizeof(uint16_t)))) {
+                status = BINARY_STATUS_BAD_LENGTH;
+                break;
+            }
+            uint16_t start = (payload[1] | (payload[2] << 8));
+            uint16_t count = (payload[3] | (payload[4] << 8));
+            status = readBinaryBlock(payload[0], start, count, payloadLength);
+            break;
+        }
+
+        default:
+            status = BINARY_STATUS_UNKNOWN_OPCODE;
+            break;
+    }
+
+    // A failed request doesn't have a payload
+    if (status != BINARY_STATUS_OK) {
+        payloadLength = 0;
+    }
+
+    // Send the response
+    sendBinaryResponse(opcode, sequence, status, payloadLength);
+    return true;
+}
+
+#endif // ! ENABLE_BINARY_PROTOCOL
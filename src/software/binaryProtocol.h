@@ -0,0 +1,101 @@
+#ifndef __BINARY_PROTOCOL_H__
+#define __BINARY_PROTOCOL_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the binary protocol is enabled
+#ifdef ENABLE_BINARY_PROTOCOL
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Compact status
+#include "statusBlock.h"
+
+// CRC of the frames
+#include "crc.h"
+
+// Compact binary protocol for hosts that need to move data quickly (the text commands are still accepted alongside it)
+// Each frame is COBS encoded so that it holds no zeros, then sent between two 0x00 delimiters (0x00 <frame> 0x00)
+// Once decoded, a request is [opcode][sequence][payload...][CRC16, low byte first]
+// The response is [opcode | BINARY_RESPONSE_FLAG][sequence][status][payload...][CRC16], framed in the same way
+// All of the values in the payloads are little endian, and frames with a bad CRC are dropped without a response
+
+// Opcodes of the requests
+typedef enum {
+    BINARY_OP_GET_STATUS    = 0x01, // No payload, responds with a binaryStatus
+    BINARY_OP_MOVE          = 0x02, // binaryMove payload, responds with no payload
+    BINARY_OP_SET_PARAMETER = 0x03, // [id u8 (PARAMETER_ID)][value f32] (one or more, set as one transaction), responds with no payload, or [index u8] of the one that failed
+    BINARY_OP_GET_PARAMETER = 0x04, // [id u8 (PARAMETER_ID)] (one or more), responds with [value f32] for each
+    BINARY_OP_BULK_READ     = 0x05, // [block u8][start u16][count u16], responds with [total u16][the records...]
+    BINARY_OP_GET_STATUS_BLOCK = 0x06, // No payload, responds with a statusBlock (integers only, for fast polling)
+    BINARY_OP_PVT_POINTS    = 0x07  // binaryPVTPoint payloads (one or more), responds with [free slots u16] (needs ENABLE_PVT_TRAJECTORY)
+} BINARY_OPCODE;
+
+// Set on the opcode of every response
+#define BINARY_RESPONSE_FLAG 0x80
+
+// Status of a response
+typedef enum {
+    BINARY_STATUS_OK,               // The request was completed
+    BINARY_STATUS_UNKNOWN_OPCODE,   // The opcode isn't recognized
+    BINARY_STATUS_BAD_LENGTH,       // The payload is the wrong size for the opcode
+    BINARY_STATUS_BAD_VALUE,        // An id or value in the payload is out of range
+    BINARY_STATUS_UNSUPPORTED,      // The request needs a feature that isn't in this build
+    BINARY_STATUS_BUSY              // The request can't be completed right now (ex. the step queue is full), try again later
+} BINARY_STATUS;
+
+// Blocks that can be read in bulk
+typedef enum {
+    BINARY_BLOCK_TRACE              // The samples of the trace, oldest first (traceSample records, needs ENABLE_TRACE)
+} BINARY_BLOCK;
+
+// Status of the motor (the payload of a GET_STATUS response)
+typedef struct __attribute__((packed)) {
+    uint8_t state;          // MOTOR_STATE
+    uint8_t flags;          // BINARY_STATUS_FLAG_*
+    int32_t steps;          // Commanded position (microsteps)
+    int32_t counts;         // Encoder position (counts)
+    int32_t stepError;      // Step error (microsteps)
+    float rpm;              // Speed measured by the encoder
+    int16_t temperature;    // Temperature of the encoder (tenths of a degree C)
+} binaryStatus;
+
+// Flags of the status
+#define BINARY_STATUS_FLAG_CORRECTING   STATUS_FLAG_CORRECTING // The closed loop correction is running
+#define BINARY_STATUS_FLAG_MOVING       STATUS_FLAG_MOVING // A direct stepping move is running
+
+// Payload of a MOVE request (counter clockwise is positive, an accel of 0 moves at a constant rate)
+typedef struct __attribute__((packed)) {
+    int32_t count;          // Steps to move
+    uint32_t rate;          // Cruise rate (steps/s)
+    uint32_t accel;         // Acceleration (steps/s/s)
+    uint32_t jerk;          // Jerk (steps/s/s/s)
+} binaryMove;
+
+// Payload of a PVT_POINTS request, several can be sent back to back (all of them are refused with BUSY if they don't all fit in the buffer)
+typedef struct __attribute__((packed)) {
+    int32_t position;       // Position to reach (microsteps)
+    int32_t velocity;       // Velocity at the position (microsteps/s)
+    uint16_t duration;      // Time to reach the point from the last one (ms, at least 1)
+} binaryPVTPoint;
+
+// Largest encoded frame that is received or sent (without the delimiters)
+#define BINARY_MAX_ENCODED_SIZE (BINARY_MAX_FRAME_SIZE + (BINARY_MAX_FRAME_SIZE / 254) + 1)
+
+// COBS encodes length bytes of data into output (which must hold BINARY_MAX_ENCODED_SIZE), returning the encoded length
+uint16_t cobsEncode(const uint8_t* data, uint16_t length, uint8_t* output);
+
+// COBS decodes length bytes into output (which must hold length bytes), returning the decoded length (0 if the frame is corrupt)
+uint16_t cobsDecode(const uint8_t* data, uint16_t length, uint8_t* output);
+
+// Handles an encoded frame (without the delimiters), sending the response to the host
+// Returns false if the frame was dropped (corrupt, the wrong size, or a bad CRC)
+bool handleBinaryFrame(const uint8_t* frame, uint16_t length);
+
+#endif // ! ENABLE_BINARY_PROTOCOL
+#endif // ! __BINARY_PROTOCOL_H__
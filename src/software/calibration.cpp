@@ -0,0 +1,491 @@
+// Import the header file
+#include "calibration.h"
+#include "flash.h"
+#include "timers.h"
+#include "fastSine.h"
+#include "fixedFormat.h"
+
+// The step that the calibration is on, and when its wait started (ms)
+static CALIBRATION_STATE state = CALIBRATION_IDLE;
+static uint32_t stateStartTime = 0;
+
+// If the motor timers were paused by the calibration, and if they should be resumed afterward
+static bool motorTaken = false;
+static bool restartTimers = true;
+
+// The full steps in a rotation, and the full step that the coils are holding
+static int32_t fullSteps = 0;
+static int32_t currentStep = 0;
+
+// Averaged increments of each full step (from the forward sweep, then averaged with the backward sweep)
+static uint16_t stepIncrements[CALIBRATION_MAX_FULL_STEPS];
+
+// The last reading of the forward sweep, and the unwrapped distance that the sweep has moved (increments)
+static uint16_t lastIncrements = 0;
+static int32_t forwardTravel = 0;
+
+// The step offset found by the last calibration (degrees)
+static float calibratedStepOffset = 0;
+
+// Waveform shaping, measured at the quarter steps between each full step of the sweeps
+#ifdef ENABLE_WAVEFORM_SHAPING
+
+    // Points of each full step (the fit below relies on there being 4)
+    #define WAVEFORM_SUBSTEPS 4
+
+    // The full steps that the sweep is moving between, the quarter step that the coils are holding (0 when on a full step), and the readings of the quarter steps (increments)
+    static int32_t fromStep = 0;
+    static int32_t targetStep = 0;
+    static uint8_t currentSubStep = 0;
+    static uint16_t subStepIncrements[WAVEFORM_SUBSTEPS - 1];
+
+    // Reading of the full step that the sweep is coming from (increments)
+    static uint16_t fromStepIncrements = 0;
+
+    // Sums of how far the rotor strayed from a straight line between the full steps, against each harmonic (increments), and the full steps summed
+    static float thirdHarmonicSum = 0;
+    static float coilBalanceSum = 0;
+    static int32_t shapedSteps = 0;
+#endif
+
+
+// Moves the coils to a full step, then restarts the wait so that the motor can settle
+static void moveToStep(int32_t step) {
+    currentStep = step;
+    motor.driveCoilsPhase((uint16_t)(step * PHASE_PER_FULL_STEP));
+    stateStartTime = millis();
+}
+
+
+// Waveform shaping
+#ifdef ENABLE_WAVEFORM_SHAPING
+// Moves the coils to a quarter step on the way to the target step, then restarts the wait
+static void moveToSubStep(uint8_t subStep) {
+    currentSubStep = subStep;
+    int32_t subStepPhase = ((targetStep - fromStep) * subStep * (int32_t)(PHASE_PER_FULL_STEP / WAVEFORM_SUBSTEPS));
+    motor.driveCoilsPhase((uint16_t)((fromStep * PHASE_PER_FULL_STEP) + subStepPhase));
+    stateStartTime = millis();
+}
+
+
+// Adds how far the rotor strayed at the quarter steps since the last full step to the sums, now that the full step on either side is read
+// With the coils driven by sin(x) + t * sin(3x) and the balance b, the field leads them by about t * sin(4x) + b * sin(2x) (x is the phase)
+// The quarter steps are the only points between the full steps where these don't cancel out, and the two are independent over the full steps
+static void addSubSteps(uint16_t increments) {
+
+    // The readings less a straight line between the full steps, with the points of a backward move put back in order of their phase
+    int32_t stepDelta = INCREMENT_DELTA(fromStepIncrements, increments);
+    float deviations[WAVEFORM_SUBSTEPS - 1];
+    for (uint8_t subStep = 1; subStep < WAVEFORM_SUBSTEPS; subStep++) {
+        uint8_t point = ((targetStep > fromStep) ? subStep : (WAVEFORM_SUBSTEPS - subStep));
+        deviations[point - 1] = INCREMENT_DELTA(fromStepIncrements, subStepIncrements[subStep - 1]) - ((float)(stepDelta * subStep) / WAVEFORM_SUBSTEPS);
+    }
+
+    // sin(4x) is 1, 0, and -1 at the quarter steps, sin(2x) is 0.707, 1, and 0.707 (flipped every other full step)
+    int32_t lowerStep = min(targetStep, fromStep);
+    thirdHarmonicSum += (deviations[0] - deviations[2]);
+    coilBalanceSum += (((lowerStep & 1) ? -1 : 1) * ((0.7071 * (deviations[0] + deviations[2])) + deviations[1]));
+    shapedSteps++;
+}
+
+
+// Moves on to the next full step of the sweep, through the quarter steps between them
+static void moveTowardStep(int32_t step, uint16_t increments) {
+    fromStep = currentStep;
+    targetStep = step;
+    fromStepIncrements = increments;
+    moveToSubStep(1);
+}
+
+
+// Measures a quarter step, then moves on to the next one (or to the full step after the last one)
+static void measureSubStep() {
+    subStepIncrements[currentSubStep - 1] = motor.measureIncrements();
+    if (currentSubStep < (WAVEFORM_SUBSTEPS - 1)) {
+        moveToSubStep(currentSubStep + 1);
+    }
+    else {
+        currentSubStep = 0;
+        moveToStep(targetStep);
+    }
+}
+
+
+// Refines the shape of the waveform by what was left over from the one that drove the sweeps (fractions of the sine)
+static void finishWaveformShape(int8_t direction) {
+    if (shapedSteps == 0) {
+        return;
+    }
+
+    // Each harmonic is squared to 2 over a full step, then the increments are converted into electrical radians along the phase
+    float cycleIncrements = (4.0 * ENCODER_COUNTS_PER_REV) / fullSteps;
+    float scale = (direction * TWO_PI) / (2 * shapedSteps * cycleIncrements);
+    motor.setWaveformShape(motor.getWaveformThirdHarmonic() - (thirdHarmonicSum * scale), motor.getWaveformBalance() - (coilBalanceSum * scale));
+}
+#endif
+
+
+// Gives the motor back, starting its position over from where the sweep left the shaft
+static void releaseMotor() {
+
+    // The startup position is from before the sweep, it needs to be taken again
+    motor.resetPosition();
+
+    // Hold the shaft where it is if the motor is enabled, otherwise let the coils go
+    if (motor.getState() == ENABLED || motor.getState() == FORCED_ENABLED) {
+        motor.driveCoilsCounts(motor.encoder.getCalibratedIncrements());
+    }
+    else {
+        motor.setCoilA(IDLE_MODE);
+        motor.setCoilB(IDLE_MODE);
+    }
+
+    // Let the motor run again
+    if (restartTimers) {
+        enableMotorTimers();
+    }
+    motorTaken = false;
+}
+
+
+// Finds the angle of the encoder at step 0 (within an electrical cycle), averaged over each of the full steps
+// Every full step moves a quarter of the cycle, so each reading less its ideal distance from step 0 lands on the same point of the cycle
+// The points are averaged as angles around the cycle, so the readings on either side of its wrap don't pull the average to the middle
+static float findStepOffset(int8_t direction) {
+
+    // Size of an electrical cycle (4 full steps) in increments
+    float cycleIncrements = (4.0 * ENCODER_COUNTS_PER_REV) / fullSteps;
+
+    // Sum up the points as vectors around the cycle
+    float sinSum = 0;
+    float cosSum = 0;
+    for (int32_t step = 0; step < fullSteps; step++) {
+
+        // Use the corrected reading, so that the offset matches the increments that the coils are driven from
+        #ifdef ENABLE_ENCODER_LINEARIZATION
+            float reading = motor.encoder.linearize(stepIncrements[step]);
+        #else
+            float reading = stepIncrements[step];
+        #endif
+
+        // Find the point of the cycle
+        float cycleAngle = (TWO_PI / cycleIncrements) * (reading - ((direction * step * (float)ENCODER_COUNTS_PER_REV) / fullSteps));
+        sinSum += sin(cycleAngle);
+        cosSum += cos(cycleAngle);
+    }
+
+    // Convert the average back into increments, then into degrees
+    float offsetIncrements = (atan2(sinSum, cosSum) / TWO_PI) * cycleIncrements;
+    if (offsetIncrements < 0) {
+        offsetIncrements += cycleIncrements;
+    }
+    return (offsetIncrements * (360.0 / POW_2_15));
+}
+
+
+// Finds how far the step offset drifts with temperature (increments per raw unit), from the offset and temperature of the last calibration
+// The last calibration has to be at least ENCODER_TEMP_COMP_MIN_DELTA away, otherwise the drift that was found before is kept
+#ifdef ENABLE_ENCODER_TEMP_COMP
+static float findTempSlope(float stepOffset, int16_t rawTemp) {
+    if (!isCalibrated()) {
+        return motor.encoder.getTempCompSlope();
+    }
+    int16_t tempDelta = rawTemp - (int16_t)readFlashU32(STEP_OFFSET_TEMP_INDEX);
+    if (abs(tempDelta) < (ENCODER_TEMP_COMP_MIN_DELTA * TEMP_DIV)) {
+        return motor.encoder.getTempCompSlope();
+    }
+
+    // Both offsets are within an electrical cycle, so the drift is the shortest way around it
+    float cycleDegrees = (4.0 * 360.0) / fullSteps;
+    float drift = stepOffset - readFlashFloat(STEP_OFFSET_INDEX);
+    drift -= cycleDegrees * round(drift / cycleDegrees);
+    return ((drift * (POW_2_15 / 360.0)) / tempDelta);
+}
+#endif
+
+
+// Computes the calibration from the sweeps, then saves and applies it
+static void finishCalibration() {
+
+    // The direction that the encoder moves when the motor steps forward
+    int8_t direction = (forwardTravel < 0 ? -1 : 1);
+
+    // Build the linearization table first, the offset is found from the corrected readings
+    #ifdef ENABLE_ENCODER_LINEARIZATION
+        int16_t linearizationTable[ENCODER_LINEAR_TABLE_SIZE];
+        motor.buildLinearizationTable(stepIncrements, fullSteps, linearizationTable);
+        motor.encoder.setLinearizationTable(linearizationTable);
+    #endif
+    calibratedStepOffset = findStepOffset(direction);
+
+    // The offset is measured at the temperature of the calibration, the drift comes from comparing it with the last one (before it is overwritten)
+    #ifdef ENABLE_ENCODER_TEMP_COMP
+        int16_t rawTemp = motor.encoder.getRawTempAvg();
+        float tempSlope = findTempSlope(calibratedStepOffset, rawTemp);
+        motor.encoder.setTempCompensation(rawTemp, tempSlope);
+    #endif
+    motor.encoder.setStepOffset(calibratedStepOffset);
+    #ifdef ENABLE_WAVEFORM_SHAPING
+        finishWaveformShape(direction);
+    #endif
+
+    // Only the calibration is saved, the rest of the parameters are kept (unless they were saved by a different version)
+    if (!checkVersionMatch()) {
+        eraseParameters();
+    }
+    #ifdef ENABLE_ENCODER_LINEARIZATION
+        writeLinearizationTable(linearizationTable);
+    #endif
+    writeFlash(STEP_OFFSET_INDEX, calibratedStepOffset);
+    #ifdef ENABLE_ENCODER_TEMP_COMP
+        writeFlash(STEP_OFFSET_TEMP_INDEX, (uint32_t)rawTemp);
+        writeFlash(STEP_OFFSET_SLOPE_INDEX, tempSlope);
+    #endif
+    #ifdef ENABLE_WAVEFORM_SHAPING
+        writeFlash(WAVEFORM_THIRD_INDEX, motor.getWaveformThirdHarmonic());
+        writeFlash(WAVEFORM_BALANCE_INDEX, motor.getWaveformBalance());
+    #endif
+    writeFlash(CALIBRATED_INDEX, true);
+
+    // All done, the motor can be used right away
+    releaseMotor();
+    state = CALIBRATION_DONE;
+}
+
+
+// Starts calibrating the encoder, run in the background by calibrationTask() (returns false if it is already running)
+bool startCalibration(bool resumeTimers) {
+
+    // Only a single calibration at a time
+    if (isCalibrating()) {
+        return false;
+    }
+
+    // Make sure that a rotation fits in the storage
+    fullSteps = round(360.0 / motor.getFullStepAngle());
+    if (fullSteps < 4 || fullSteps > CALIBRATION_MAX_FULL_STEPS) {
+        state = CALIBRATION_FAILED;
+        return false;
+    }
+
+    // Give the user time to take their hands away
+    restartTimers = resumeTimers;
+    state = CALIBRATION_WAITING;
+    stateStartTime = millis();
+    return true;
+}
+
+
+// Stops the calibration without saving anything
+void abortCalibration() {
+    if (motorTaken) {
+        releaseMotor();
+    }
+    state = CALIBRATION_IDLE;
+}
+
+
+// Returns if the calibration is running
+bool isCalibrating() {
+    return (state >= CALIBRATION_WAITING && state <= CALIBRATION_SWEEP_BACKWARD);
+}
+
+
+// Gets the step that the calibration is on
+CALIBRATION_STATE getCalibrationState() {
+    return state;
+}
+
+
+// Gets how far through the sweep the calibration is (0 to 100%)
+uint8_t getCalibrationProgress() {
+    switch (state) {
+        case CALIBRATION_SWEEP_FORWARD:
+            return ((currentStep * 50) / fullSteps);
+        case CALIBRATION_SWEEP_BACKWARD:
+            return (50 + (((fullSteps - currentStep) * 50) / fullSteps));
+        case CALIBRATION_DONE:
+            return 100;
+        default:
+            return 0;
+    }
+}
+
+
+// Gets a summary of the calibration (its step and progress, or the result once done)
+String getCalibrationStatus() {
+    switch (state) {
+        case CALIBRATION_WAITING:
+            return F("Waiting, do not move the motor shaft");
+        case CALIBRATION_SETTLING:
+            return F("Settling at step 0");
+        case CALIBRATION_SWEEP_FORWARD:
+        case CALIBRATION_SWEEP_BACKWARD:
+            return ("Sweeping (" + String(getCalibrationProgress()) + "%) | Step: " + String(currentStep) + "/" + String(fullSteps) +
+                    (state == CALIBRATION_SWEEP_FORWARD ? F(" forward") : F(" backward")));
+        case CALIBRATION_DONE:
+            #ifdef ENABLE_WAVEFORM_SHAPING
+                return ("Done | Step offset: " + floatString(calibratedStepOffset, 3) + F(" | Third harmonic: ") + floatString(motor.getWaveformThirdHarmonic() * 100, 2) +
+                        F("%, coil balance: ") + floatString(motor.getWaveformBalance() * 100, 2) + "%");
+            #else
+                return ("Done | Step offset: " + floatString(calibratedStepOffset, 3));
+            #endif
+        case CALIBRATION_FAILED:
+            return F("Failed, the motor didn't move a rotation (check the motor power and the full step angle)");
+        default:
+            return F("Idle");
+    }
+}
+
+
+// Returns the coils to a sine, along with the saved shape (the next calibration fits the waveform again from the sine)
+#ifdef ENABLE_WAVEFORM_SHAPING
+void clearWaveformShape() {
+    motor.setWaveformShape(0, 0);
+    if (isCalibrated()) {
+        writeFlash(WAVEFORM_THIRD_INDEX, (float)0);
+        writeFlash(WAVEFORM_BALANCE_INDEX, (float)0);
+    }
+}
+#endif
+
+
+// Moves the calibration along once its wait is over (a task of the main loop, does nothing unless calibrating)
+void calibrationTask() {
+
+    // Find how long the current step has to wait for
+    uint32_t waitTime;
+    switch (state) {
+        case CALIBRATION_WAITING:
+            waitTime = CALIBRATION_START_DELAY;
+            break;
+        case CALIBRATION_SETTLING:
+            waitTime = CALIBRATION_HOLD_TIME;
+            break;
+        case CALIBRATION_SWEEP_FORWARD:
+        case CALIBRATION_SWEEP_BACKWARD:
+            waitTime = CALIBRATION_SETTLE_TIME;
+            #ifdef ENABLE_WAVEFORM_SHAPING
+            if (currentSubStep != 0) {
+                waitTime = WAVEFORM_SUBSTEP_SETTLE_TIME;
+            }
+            #endif
+            break;
+        default:
+            // Not calibrating
+            return;
+    }
+    if ((millis() - stateStartTime) < waitTime) {
+        return;
+    }
+
+    // The wait is over, run the next part of the step
+    switch (state) {
+        case CALIBRATION_WAITING:
+
+            // Take over the motor (it needs to be left alone during calibration), then hold it at step 0
+            disableMotorTimers();
+            motorTaken = true;
+            moveToStep(0);
+            state = CALIBRATION_SETTLING;
+            break;
+
+        case CALIBRATION_SETTLING:
+
+            // Measure the start, then begin the forward sweep
+            stepIncrements[0] = motor.measureIncrements();
+            lastIncrements = stepIncrements[0];
+            forwardTravel = 0;
+            #ifdef ENABLE_WAVEFORM_SHAPING
+                thirdHarmonicSum = 0;
+                coilBalanceSum = 0;
+                shapedSteps = 0;
+                moveTowardStep(1, stepIncrements[0]);
+            #else
+                moveToStep(1);
+            #endif
+            state = CALIBRATION_SWEEP_FORWARD;
+            break;
+
+        case CALIBRATION_SWEEP_FORWARD: {
+
+            // The quarter steps on the way to the full step are only measured for the waveform
+            #ifdef ENABLE_WAVEFORM_SHAPING
+            if (currentSubStep != 0) {
+                measureSubStep();
+                break;
+            }
+            #endif
+
+            // Measure the step, keeping track of how far the sweep has moved
+            uint16_t increments = motor.measureIncrements();
+            forwardTravel += INCREMENT_DELTA(lastIncrements, increments);
+            lastIncrements = increments;
+            #ifdef ENABLE_WAVEFORM_SHAPING
+                addSubSteps(increments);
+            #endif
+
+            // Keep going until the sweep lands back on step 0
+            if (currentStep < fullSteps) {
+                stepIncrements[currentStep] = increments;
+                #ifdef ENABLE_WAVEFORM_SHAPING
+                    moveTowardStep(currentStep + 1, increments);
+                #else
+                    moveToStep(currentStep + 1);
+                #endif
+                break;
+            }
+
+            // The sweep should have moved a rotation (within an eighth), otherwise the motor wasn't following the coils
+            if (abs(abs(forwardTravel) - ENCODER_COUNTS_PER_REV) > (ENCODER_COUNTS_PER_REV / 8)) {
+                releaseMotor();
+                state = CALIBRATION_FAILED;
+                break;
+            }
+
+            // Back on step 0 a rotation later, average it with the start, then sweep back
+            stepIncrements[0] = (stepIncrements[0] + (INCREMENT_DELTA(stepIncrements[0], increments) / 2)) & DELETE_BIT_15;
+            #ifdef ENABLE_WAVEFORM_SHAPING
+                moveTowardStep(fullSteps - 1, increments);
+            #else
+                moveToStep(fullSteps - 1);
+            #endif
+            state = CALIBRATION_SWEEP_BACKWARD;
+            break;
+        }
+
+        case CALIBRATION_SWEEP_BACKWARD: {
+
+            // The quarter steps on the way to the full step are only measured for the waveform
+            #ifdef ENABLE_WAVEFORM_SHAPING
+            if (currentSubStep != 0) {
+                measureSubStep();
+                break;
+            }
+            #endif
+
+            // Average the step with its forward reading, evening out the lag of the rotor behind the coils
+            uint16_t increments = motor.measureIncrements();
+            #ifdef ENABLE_WAVEFORM_SHAPING
+                addSubSteps(increments);
+            #endif
+            stepIncrements[currentStep] = (stepIncrements[currentStep] + (INCREMENT_DELTA(stepIncrements[currentStep], increments) / 2)) & DELETE_BIT_15;
+
+            // Save the calibration once back at step 0
+            if (currentStep > 0) {
+                #ifdef ENABLE_WAVEFORM_SHAPING
+                    moveTowardStep(currentStep - 1, increments);
+                #else
+                    moveToStep(currentStep - 1);
+                #endif
+            }
+            else {
+                finishCalibration();
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef __CALIBRATION_H__
+#define __CALIBRATION_H__
+
+// Include main config
+#include "config.h"
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Most full steps in a rotation that can be measured (0.9° motors)
+#define CALIBRATION_MAX_FULL_STEPS 400
+
+// The steps of the calibration, in the order that they are run
+typedef enum {
+    CALIBRATION_IDLE,               // Not running, nothing has been calibrated since boot
+    CALIBRATION_WAITING,            // Waiting for the user to take their hands away (the coils aren't driven yet)
+    CALIBRATION_SETTLING,           // Holding step 0, letting the motor settle
+    CALIBRATION_SWEEP_FORWARD,      // Measuring each full step of a rotation, stepping forward
+    CALIBRATION_SWEEP_BACKWARD,     // Measuring each full step again on the way back
+    CALIBRATION_DONE,               // The calibration was saved and applied
+    CALIBRATION_FAILED              // The motor didn't move a rotation (no motor power, or the wrong full step angle)
+} CALIBRATION_STATE;
+
+// Starts calibrating the encoder, run in the background by calibrationTask() (returns false if it is already running)
+// The motor timers are paused until it finishes, then resumed if resumeTimers is set (clear it if they haven't been set up yet)
+bool startCalibration(bool resumeTimers = true);
+
+// Stops the calibration without saving anything
+void abortCalibration();
+
+// Returns if the calibration is running
+bool isCalibrating();
+
+// Gets the step that the calibration is on
+CALIBRATION_STATE getCalibrationState();
+
+// Gets how far through the sweep the calibration is (0 to 100%)
+uint8_t getCalibrationProgress();
+
+// Gets a summary of the calibration (its step and progress, or the result once done)
+String getCalibrationStatus();
+
+// Returns the coils to a sine, along with the saved shape (the next calibration fits the waveform again from the sine)
+#ifdef ENABLE_WAVEFORM_SHAPING
+void clearWaveformShape();
+#endif
+
+// Moves the calibration along once its wait is over (a task of the main loop, does nothing unless calibrating)
+void calibrationTask();
+
+#endif // ! __CALIBRATION_H__
@@ -0,0 +1,236 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_CAN_GEARING
+
+// Import the header file
+#include "canGearing.h"
+#include "canProtocol.h"
+#include "timers.h"
+
+// Settings of the gearing
+static volatile AXIS_CAN_ID gearMaster = NONE;
+static int32_t gearNumerator = 1;
+static int32_t gearDenominator = 1;
+static int32_t gearOffset = 0;
+static bool gearBroadcast = false;
+
+// The newest frame of the master (written by the main loop with the interrupts masked, taken by the correction)
+static canGearFrame newestFrame;
+static volatile bool frameReceived = false;
+
+// If the follower has lined up with the master (the first frame after engaging is only used as the starting point)
+static bool gearLocked = false;
+
+// Where both axes were when the follower lined up (the ratio is applied to the master's motion from there)
+static int32_t lockMasterPosition = 0;
+static int32_t lockFollowerPosition = 0;
+
+// Phase accumulator of the target (Q16 microsteps), moved by the increment every correction until it reaches the newest position
+static int64_t gearPhase = 0;
+static int64_t gearIncrement = 0;
+static int32_t gearTarget = 0;
+static uint32_t lastFrameTime = 0;
+static int32_t followedPosition = 0;
+
+// Corrections since the newest frame, and the statistics for the status
+static uint32_t ticksSinceFrame = 0;
+static volatile uint32_t gearFrames = 0;
+static volatile uint32_t gearTimeouts = 0;
+
+// Corrections between the frames, and before they have stopped
+#define GEAR_FRAME_TICKS   (CONTROL_LOOP_FREQ / CAN_GEAR_FRAME_FREQ)
+#define GEAR_TIMEOUT_TICKS (((uint32_t)CAN_GEAR_TIMEOUT * CONTROL_LOOP_FREQ) / 1000)
+static_assert(CAN_GEAR_FRAME_FREQ <= CONTROL_LOOP_FREQ, "CAN_GEAR_FRAME_FREQ can't be faster than CONTROL_LOOP_FREQ");
+static_assert(GEAR_TIMEOUT_TICKS > (2 * GEAR_FRAME_TICKS), "CAN_GEAR_TIMEOUT must be longer than two frames");
+
+
+// Sets the master to follow (NONE stops following, the motor holds where it is)
+bool setGearMaster(AXIS_CAN_ID master) {
+    if (master != NONE && master == getCANID()) {
+        return false;
+    }
+
+    // The correction lines up again with the first frame of the new master
+    disableInterrupts();
+    gearMaster = master;
+    gearLocked = false;
+    frameReceived = false;
+    enableInterrupts();
+
+    // Let the master's frames through the filters
+    updateCANFilters();
+    return true;
+}
+
+
+// Gets the master being followed (NONE if the board isn't following)
+AXIS_CAN_ID getGearMaster() {
+    return gearMaster;
+}
+
+
+// If the board is following a master
+bool isGearFollowing() {
+    return (gearMaster != NONE);
+}
+
+
+// Sets the gear ratio, returning false if the denominator is 0
+bool setGearRatio(int32_t numerator, int32_t denominator) {
+    if (denominator == 0) {
+        return false;
+    }
+
+    // The correction reads both together, the next frame moves the target to the new ratio
+    disableInterrupts();
+    gearNumerator = numerator;
+    gearDenominator = denominator;
+    enableInterrupts();
+    return true;
+}
+
+
+// Gets the numerator of the gear ratio
+int32_t getGearNumerator() {
+    return gearNumerator;
+}
+
+
+// Gets the denominator of the gear ratio
+int32_t getGearDenominator() {
+    return gearDenominator;
+}
+
+
+// Sets the offset of the follower from the geared position (microsteps), the next frame moves the target to it
+void setGearOffset(int32_t offset) {
+    gearOffset = offset;
+}
+
+
+// Gets the offset of the follower from the geared position (microsteps)
+int32_t getGearOffset() {
+    return gearOffset;
+}
+
+
+// Enables or disables the broadcast of the board's position
+void setGearBroadcast(bool broadcast) {
+    gearBroadcast = broadcast;
+}
+
+
+// If the board is broadcasting its position
+bool getGearBroadcast() {
+    return gearBroadcast;
+}
+
+
+// Takes in a position frame of the master
+void handleCANGearFrame(const canGearFrame &frame) {
+
+    // The correction takes the position and its time together
+    disableInterrupts();
+    newestFrame = frame;
+    frameReceived = true;
+    gearFrames++;
+    enableInterrupts();
+}
+
+
+// Moves the follower's target along the master's rate, then the motor to it (called every correction)
+void RAMFUNC updateGearing() {
+
+    // Nothing to follow
+    if (gearMaster == NONE) {
+        return;
+    }
+
+    // Set the target to the newest position of the master
+    if (ticksSinceFrame <= GEAR_TIMEOUT_TICKS) {
+        ticksSinceFrame++;
+    }
+    if (frameReceived) {
+        frameReceived = false;
+        if (!gearLocked) {
+
+            // Line up with the master where both axes are, the target starts on the motor
+            lockMasterPosition = newestFrame.position;
+            lockFollowerPosition = motor.getSoftStepCNT();
+            gearTarget = lockFollowerPosition;
+            gearPhase = ((int64_t)gearTarget << 16);
+            gearIncrement = 0;
+            followedPosition = gearTarget;
+            gearLocked = true;
+        }
+        else {
+            // Gear the master's motion since the follower lined up
+            gearTarget = lockFollowerPosition + gearOffset + (int32_t)(((int64_t)(newestFrame.position - lockMasterPosition) * gearNumerator) / gearDenominator);
+
+            // Reach the target by the next frame, at the rate that the master moved between its frames (a late frame after a timeout is caught up to in a frame)
+            uint32_t frameTicks = (uint32_t)(((uint64_t)(newestFrame.time - lastFrameTime) * CONTROL_LOOP_FREQ) / 1000000);
+            if (frameTicks == 0 || frameTicks > GEAR_TIMEOUT_TICKS) {
+                frameTicks = GEAR_FRAME_TICKS;
+            }
+            gearIncrement = ((((int64_t)gearTarget << 16) - gearPhase) / frameTicks);
+        }
+        lastFrameTime = newestFrame.time;
+        ticksSinceFrame = 0;
+    }
+
+    // Hold the motor until the master is heard from
+    if (!gearLocked) {
+        return;
+    }
+
+    // Hold where the target got to if the frames have stopped
+    if (ticksSinceFrame == GEAR_TIMEOUT_TICKS) {
+        gearIncrement = 0;
+        gearTimeouts++;
+    }
+
+    // Advance the accumulator, stopping on the target (it isn't extrapolated past the newest position)
+    if (gearIncrement != 0) {
+        gearPhase += gearIncrement;
+        int64_t targetPhase = ((int64_t)gearTarget << 16);
+        if ((gearIncrement > 0) ? (gearPhase >= targetPhase) : (gearPhase <= targetPhase)) {
+            gearPhase = targetPhase;
+            gearIncrement = 0;
+        }
+    }
+
+    // Move the motor by the whole microsteps that the target moved
+    int32_t position = (int32_t)(gearPhase >> 16);
+    if (position != followedPosition) {
+        motor.followMicrosteps(position - followedPosition);
+        followedPosition = position;
+    }
+}
+
+
+// Sends the board's position if it is broadcasting (a main loop task)
+void gearBroadcastTask() {
+    if (!gearBroadcast) {
+        return;
+    }
+
+    // Take the position and the time together, the followers work out the rate from the times
+    canGearFrame frame;
+    disableInterrupts();
+    frame.position = motor.getSoftStepCNT();
+    frame.time = micros();
+    enableInterrupts();
+
+    // Queue it, the followers catch up with the next one if the queue is full
+    txCANFrame(CAN_FRAME_ID(CAN_FUNCTION_GEAR, getCANID()), (const uint8_t*)&frame, sizeof(frame));
+}
+
+
+// Gets a summary of the following
+String getGearStatus() {
+    return ("Frames: " + String(gearFrames) + F(" | Timeouts: ") + String(gearTimeouts) + F(" | Lag: ") + String(gearLocked ? (gearTarget - followedPosition) : 0) + F(" microsteps"));
+}
+
+#endif // ! ENABLE_CAN_GEARING
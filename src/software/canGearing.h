@@ -0,0 +1,65 @@
+#ifndef __CAN_GEARING_H__
+#define __CAN_GEARING_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the electronic gearing is enabled
+#ifdef ENABLE_CAN_GEARING
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// CAN IDs
+#include "canMessaging.h"
+
+// Electronic gearing over CAN
+// A master broadcasts its position, and each follower tracks it through a ratio (numerator / denominator) plus an offset.
+// The ratio is applied to the master's motion since the follower engaged, so the follower starts from where it is and never jumps.
+// Each frame is stamped with the master's time, so the follower finds the master's rate from the time between the frames instead of when they arrived,
+// then its target is moved toward the newest position at that rate by a phase accumulator (Q16 microsteps) every correction.
+// That puts the follower a frame behind the master, but its motion is smooth and doesn't jitter with the bus or the main loop
+
+// Position of a master, sent at CAN_GEAR_FRAME_FREQ while it is broadcasting
+typedef struct __attribute__((packed)) {
+    int32_t position;       // Commanded position (microsteps)
+    uint32_t time;          // Time that the position was taken (us, the master's clock)
+} canGearFrame;
+
+// Sets the master to follow (NONE stops following, the motor holds where it is), returning false if it is the board's own ID
+bool setGearMaster(AXIS_CAN_ID master);
+AXIS_CAN_ID getGearMaster();
+
+// If the board is following a master
+bool isGearFollowing();
+
+// Sets the gear ratio (the follower moves numerator / denominator microsteps for each microstep of the master), returning false if the denominator is 0
+bool setGearRatio(int32_t numerator, int32_t denominator);
+int32_t getGearNumerator();
+int32_t getGearDenominator();
+
+// Sets the offset of the follower from the geared position (microsteps)
+void setGearOffset(int32_t offset);
+int32_t getGearOffset();
+
+// Enables or disables the broadcast of the board's position, so that other boards can follow it
+void setGearBroadcast(bool broadcast);
+bool getGearBroadcast();
+
+// Takes in a position frame of the master (called by the main loop as the frame is handled)
+void handleCANGearFrame(const canGearFrame &frame);
+
+// Moves the follower's target along the master's rate, then the motor to it (called every correction)
+void updateGearing();
+
+// Sends the board's position if it is broadcasting (a main loop task)
+void gearBroadcastTask();
+
+// Gets a summary of the following (frames received, their timeouts, and the lag of the motor behind the newest position)
+String getGearStatus();
+
+#endif // ! ENABLE_CAN_GEARING
+#endif // ! __CAN_GEARING_H__
@@ -0,0 +1,406 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_CAN_PDO
+
+// Import the header file
+#include "canProtocol.h"
+#include "parameters.h"
+#include "timers.h"
+#include "canGearing.h"
+#include "pvt.h"
+#include "crc.h"
+#include "flash.h"
+
+// Velocity feed-forward of the last target
+static int32_t targetVelocity = 0;
+
+// Synchronized targets
+#ifdef ENABLE_CAN_SYNC
+// The target waiting for the next SYNC (written by the main loop with the interrupts masked)
+static canTargetFrame heldTarget;
+static volatile bool targetHeld = false;
+
+// Phase lock of the control loop's timer, each SYNC has to land on a tick of the control loop
+static_assert((CONTROL_LOOP_FREQ % CAN_PDO_CYCLE_FREQ) == 0, "CONTROL_LOOP_FREQ must be a multiple of CAN_PDO_CYCLE_FREQ");
+static uint32_t nominalPeriod = 0;
+static int32_t phaseIntegral = 0;
+static volatile int32_t lastPhaseError = 0;
+static volatile int32_t periodTrim = 0;
+static volatile uint32_t syncCount = 0;
+#endif
+
+// The targets that were started by the receive interrupt since the main loop last replied
+#ifdef ENABLE_CAN_MOTION_FAST_PATH
+static volatile bool statusReplyPending = false;
+#endif
+
+// Batched parameters, the writes since the last commit
+#ifdef ENABLE_CAN_PARAM_BATCH
+static uint8_t batchWrites = 0;
+static uint8_t batchFailures = 0;
+static uint8_t batchFailedID = 0xFF;
+static uint16_t batchCRC = 0xFFFF;
+#endif
+
+
+// Sends the status of the motor
+static void sendCANStatus() {
+
+    // Fill in the status
+    canStatusFrame status;
+    status.steps = motor.getSoftStepCNT();
+    status.stepError = constrain(motor.getStepError(), INT16_MIN, INT16_MAX);
+    status.state = motor.getState();
+    status.flags = getStatusFlags();
+
+    // Queue it, the host will get the next one if the queue is full
+    txCANFrame(CAN_FRAME_ID(CAN_FUNCTION_STATUS, getCANID()), (const uint8_t*)&status, sizeof(status));
+}
+
+
+// Moves the motor to a target, reaching it by the next cycle (or at the feed-forward velocity, if that is faster)
+static void applyCANTarget(const canTargetFrame &target) {
+
+    // The targets are ignored while the torque mode holds the motor
+    #ifdef ENABLE_TORQUE_MODE
+    if (motor.isTorqueModeActive()) {
+        return;
+    }
+    #endif
+
+    // The follower's position comes from its master
+    #ifdef ENABLE_CAN_GEARING
+    if (isGearFollowing()) {
+        return;
+    }
+    #endif
+
+    // As does the trajectory's, until it finishes
+    #ifdef ENABLE_PVT_TRAJECTORY
+    if (isPVTActive()) {
+        return;
+    }
+    #endif
+
+    // Save the feed-forward
+    targetVelocity = target.velocity;
+
+    // Find the steps to the target, each one moves the multiplier's worth of microsteps
+    float multiplier = motor.getMicrostepMultiplier();
+    int32_t count = round((target.position - motor.getSoftStepCNT()) / multiplier);
+    if (count == 0) {
+        return;
+    }
+
+    // Step fast enough to arrive before the next target, replacing whatever is left of the last one
+    uint32_t rate = max((uint32_t)abs(count) * CAN_PDO_CYCLE_FREQ, (uint32_t)abs(round(target.velocity / multiplier)));
+    scheduleSteps(count, rate, (count > 0 ? COUNTER_CLOCKWISE : CLOCKWISE));
+}
+
+
+// Replies to a poll with the status of the motor
+static void sendCANPoll() {
+
+    // Squeeze the status into a frame
+    statusBlock status;
+    getStatusBlock(status);
+    canPollFrame poll;
+    poll.steps = status.steps;
+    poll.stepError = status.stepError;
+    poll.stateFlags = ((status.state & 0x0F) | (status.flags << 4));
+    poll.temperature = (int8_t)constrain(status.temperature / 10, INT8_MIN, INT8_MAX);
+
+    // Queue it, the host can poll again if the queue is full
+    txCANFrame(CAN_FRAME_ID(CAN_FUNCTION_POLL_RESPONSE, getCANID()), (const uint8_t*)&poll, sizeof(poll));
+}
+
+
+// Batched parameters
+#ifdef ENABLE_CAN_PARAM_BATCH
+// Adds a write to the batch
+static void addBatchWrite(const canParameterFrame &request, PARAMETER_STATUS status) {
+    if (status == PARAMETER_OK) {
+        batchWrites = min(batchWrites + 1, 255);
+        batchCRC = crc16Update(batchCRC, &request.id, sizeof(request.id));
+        batchCRC = crc16Update(batchCRC, (const uint8_t*)&request.value, sizeof(request.value));
+    }
+    else {
+        if (batchFailures == 0) {
+            batchFailedID = request.id;
+        }
+        batchFailures = min(batchFailures + 1, 255);
+    }
+}
+
+
+// Finds the CRC of every parameter that the build supports
+static uint16_t getConfigCRC() {
+    uint16_t crc = 0xFFFF;
+    for (uint8_t id = 0; id < PARAMETER_COUNT; id++) {
+        float value;
+        if (getParameter(id, value) == PARAMETER_OK) {
+            crc = crc16Update(crc, &id, sizeof(id));
+            crc = crc16Update(crc, (const uint8_t*)&value, sizeof(value));
+        }
+    }
+    return crc;
+}
+
+
+// Ends the batch, saving it if asked, then replies with what the board took
+static void commitCANParameters(uint8_t options) {
+
+    // A batch that was only partly taken isn't saved, the host has to fix it first
+    canParameterCommitFrame response;
+    response.command = CAN_PARAM_COMMIT_OK;
+    if (batchFailures > 0) {
+        response.command = CAN_PARAM_ABORT;
+    }
+    else if (options & CAN_PARAM_COMMIT_SAVE) {
+        saveParameters();
+    }
+
+    // Report the batch, then start the next one
+    response.writes = batchWrites;
+    response.failures = batchFailures;
+    response.failedID = batchFailedID;
+    response.batchCRC = batchCRC;
+    response.configCRC = getConfigCRC();
+    batchWrites = 0;
+    batchFailures = 0;
+    batchFailedID = 0xFF;
+    batchCRC = 0xFFFF;
+    txCANFrame(CAN_FRAME_ID(CAN_FUNCTION_PARAM_RESPONSE, getCANID()), (const uint8_t*)&response, sizeof(response));
+}
+#endif
+
+
+// Reads or writes a parameter, then sends the response (writes to a group or the broadcast aren't replied to when batching)
+static void handleCANParameter(const canParameterFrame &request, bool addressed) {
+
+    // Commits reply with the batch instead
+    #ifdef ENABLE_CAN_PARAM_BATCH
+    if (request.command == CAN_PARAM_COMMIT) {
+        commitCANParameters(request.id);
+        return;
+    }
+    #endif
+
+    // Run the access
+    canParameterFrame response = request;
+    PARAMETER_STATUS status;
+    if (request.command == CAN_PARAM_READ) {
+        float value = 0;
+        status = getParameter(request.id, value);
+        response.value = value;
+        response.command = CAN_PARAM_READ_OK;
+    }
+    else if (request.command == CAN_PARAM_WRITE) {
+        status = setParameter(request.id, request.value);
+        response.command = CAN_PARAM_WRITE_OK;
+
+        // The fleet only hears back from the writes at the commit
+        #ifdef ENABLE_CAN_PARAM_BATCH
+        addBatchWrite(request, status);
+        if (!addressed) {
+            return;
+        }
+        #endif
+    }
+    else {
+        status = PARAMETER_UNKNOWN;
+    }
+
+    // Report why the access failed
+    response.status = 0;
+    response.reserved = 0;
+    if (status != PARAMETER_OK) {
+        response.command = CAN_PARAM_ABORT;
+        response.status = status;
+    }
+    txCANFrame(CAN_FRAME_ID(CAN_FUNCTION_PARAM_RESPONSE, getCANID()), (const uint8_t*)&response, sizeof(response));
+}
+
+
+// Handles a frame of the binary protocol, returning false if it isn't one
+bool handleCANProtocolFrame(const canFrame &frame) {
+    switch (frame.id & CAN_FUNCTION_MASK) {
+
+        case CAN_FUNCTION_TARGET: {
+            if (frame.length == sizeof(canTargetFrame)) {
+                canTargetFrame target;
+                memcpy(&target, frame.data, sizeof(target));
+
+                // Hold the target for the next SYNC, or start it right away
+                #ifdef ENABLE_CAN_SYNC
+                    disableInterrupts();
+                    heldTarget = target;
+                    targetHeld = true;
+                    enableInterrupts();
+                #else
+                    applyCANTarget(target);
+                #endif
+                sendCANStatus();
+            }
+            return true;
+        }
+
+        #ifdef ENABLE_CAN_GEARING
+        case CAN_FUNCTION_GEAR: {
+            if (frame.length == sizeof(canGearFrame) && (frame.id & CAN_NODE_MASK) == getGearMaster()) {
+                canGearFrame gear;
+                memcpy(&gear, frame.data, sizeof(gear));
+                handleCANGearFrame(gear);
+            }
+            return true;
+        }
+        #endif
+
+        #ifdef ENABLE_PVT_TRAJECTORY
+        case CAN_FUNCTION_PVT: {
+            if (frame.length == sizeof(canPVTFrame)) {
+                canPVTFrame request;
+                memcpy(&request, frame.data, sizeof(request));
+                pvtPoint point = { request.position, (int32_t)request.velocity * PVT_CAN_VELOCITY_SCALE, request.duration };
+
+                // Buffer the point, then let the host know how much more it can send
+                canPVTResponseFrame response;
+                response.result = queuePVTPoint(point);
+                response.reserved = 0;
+                response.freeSlots = getPVTFreeSlots();
+                response.underruns = (uint16_t)getPVTUnderruns();
+                txCANFrame(CAN_FRAME_ID(CAN_FUNCTION_PVT_RESPONSE, getCANID()), (const uint8_t*)&response, sizeof(response));
+            }
+            return true;
+        }
+        #endif
+
+        case CAN_FUNCTION_POLL_REQUEST: {
+            sendCANPoll();
+            return true;
+        }
+
+        case CAN_FUNCTION_PARAM_REQUEST: {
+            if (frame.length == sizeof(canParameterFrame)) {
+                canParameterFrame request;
+                memcpy(&request, frame.data, sizeof(request));
+                handleCANParameter(request, ((frame.id & CAN_NODE_MASK) == getCANID()));
+            }
+            return true;
+        }
+
+        default:
+            // The rest are text frames
+            return false;
+    }
+}
+
+
+// Synchronized targets
+#ifdef ENABLE_CAN_SYNC
+// Starts the held target and trims the control loop's timer toward the SYNC
+void RAMFUNC handleCANSync() {
+    syncCount++;
+
+    // Start the target that was held for this SYNC
+    if (targetHeld) {
+        targetHeld = false;
+        applyCANTarget(heldTarget);
+    }
+
+    // The timer can only be followed while it is running (it is paused during scheduled moves)
+    if (!(TIM1 -> CR1 & TIM_CR1_CEN)) {
+        phaseIntegral = 0;
+        return;
+    }
+
+    // Take the period before it is trimmed for the first time
+    if (nominalPeriod == 0) {
+        nominalPeriod = (TIM1 -> ARR + 1);
+    }
+
+    // Find how far the last tick was from the SYNC (positive if the tick came first, so the timer is running fast)
+    int32_t phaseError = TIM1 -> CNT;
+    if (phaseError > (int32_t)(nominalPeriod / 2)) {
+        phaseError -= nominalPeriod;
+    }
+
+    // Spread the correction over the ticks until the next SYNC, with an integral to follow the difference between the clocks
+    const int32_t ticksPerSync = (CONTROL_LOOP_FREQ / CAN_PDO_CYCLE_FREQ);
+    const int32_t maxTrim = max((int32_t)((nominalPeriod * CAN_SYNC_MAX_TRIM) / 100), (int32_t)1);
+    phaseIntegral = constrain(phaseIntegral + phaseError, -maxTrim * ticksPerSync * 16, maxTrim * ticksPerSync * 16);
+    int32_t trim = constrain((phaseError / (2 * ticksPerSync)) + (phaseIntegral / (16 * ticksPerSync)), -maxTrim, maxTrim);
+
+    // Stretch or shrink the period (takes effect from the next tick)
+    TIM1 -> ARR = (nominalPeriod - 1) + trim;
+    lastPhaseError = phaseError;
+    periodTrim = trim;
+}
+
+
+// Gets a summary of the synchronization
+String getCANSyncStatus() {
+    return ("SYNCs: " + String(syncCount) + " | Phase error: " + String(lastPhaseError) + " ticks | Trim: " + String(periodTrim) + " ticks");
+}
+#endif // ! ENABLE_CAN_SYNC
+
+
+// Gets the velocity feed-forward of the last target (microsteps/s)
+int32_t getCANTargetVelocity() {
+    return targetVelocity;
+}
+
+
+// Motion fast path
+#ifdef ENABLE_CAN_MOTION_FAST_PATH
+// Handles a motion frame as it arrives, returning false if it has to wait for the main loop
+bool handleCANMotionFrame(const canFrame &frame) {
+    switch (frame.id & CAN_FUNCTION_MASK) {
+
+        case CAN_FUNCTION_TARGET: {
+            if (frame.length == sizeof(canTargetFrame)) {
+                canTargetFrame target;
+                memcpy(&target, frame.data, sizeof(target));
+
+                // The SYNCs arrive through this interrupt too, so the held target can't be started halfway through being written
+                #ifdef ENABLE_CAN_SYNC
+                    heldTarget = target;
+                    targetHeld = true;
+                #else
+                    applyCANTarget(target);
+                #endif
+                statusReplyPending = true;
+            }
+            return true;
+        }
+
+        #ifdef ENABLE_CAN_GEARING
+        case CAN_FUNCTION_GEAR: {
+            if (frame.length == sizeof(canGearFrame) && (frame.id & CAN_NODE_MASK) == getGearMaster()) {
+                canGearFrame gear;
+                memcpy(&gear, frame.data, sizeof(gear));
+                handleCANGearFrame(gear);
+            }
+            return true;
+        }
+        #endif
+
+        default:
+            // The trajectory's points are replied to with the room that is left, so they wait for the main loop
+            return false;
+    }
+}
+
+
+// Sends the replies that the receive interrupt left to the main loop
+void sendCANMotionReplies() {
+    if (statusReplyPending) {
+        statusReplyPending = false;
+        sendCANStatus();
+    }
+}
+#endif // ! ENABLE_CAN_MOTION_FAST_PATH
+
+#endif // ! ENABLE_CAN_PDO
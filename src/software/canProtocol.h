@@ -0,0 +1,152 @@
+#ifndef __CAN_PROTOCOL_H__
+#define __CAN_PROTOCOL_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the binary CAN protocol is enabled
+#ifdef ENABLE_CAN_PDO
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// CAN frames
+#include "canMessaging.h"
+
+// Compact status
+#include "statusBlock.h"
+
+// Binary CAN protocol, laid out like CANopen (the ID of a frame is its function code plus the ID of the board)
+// The text commands still use the bare ID of the board, so the two can be mixed on the same bus
+// All of the values are little endian
+#define CAN_FUNCTION_MASK           0x780
+#define CAN_NODE_MASK               0x07F
+#define CAN_FUNCTION_TEXT           0x000 // Text commands, split into 8 byte frames between "<" and ">"
+#define CAN_FUNCTION_SYNC           0x080 // Mainboard -> all boards, no data (starts the held targets, only with ENABLE_CAN_SYNC)
+#define CAN_FUNCTION_STATUS         0x180 // Board -> host, canStatusFrame (sent in reply to each target)
+#define CAN_FUNCTION_TARGET         0x200 // Host -> board, canTargetFrame (sent cyclically, at CAN_PDO_CYCLE_FREQ)
+#define CAN_FUNCTION_POLL_RESPONSE  0x280 // Board -> host, canPollFrame
+#define CAN_FUNCTION_POLL_REQUEST   0x300 // Host -> board, any data (ignored), to the board's ID or the broadcast
+#define CAN_FUNCTION_GEAR           0x380 // Master -> followers, canGearFrame (sent at CAN_GEAR_FRAME_FREQ while broadcasting, only with ENABLE_CAN_GEARING)
+#define CAN_FUNCTION_PVT            0x400 // Host -> board, canPVTFrame (a point of the trajectory, only with ENABLE_PVT_TRAJECTORY)
+#define CAN_FUNCTION_PVT_RESPONSE   0x480 // Board -> host, canPVTResponseFrame (sent in reply to each point)
+#define CAN_FUNCTION_PARAM_RESPONSE 0x580 // Board -> host, canParameterFrame
+#define CAN_FUNCTION_PARAM_REQUEST  0x600 // Host -> board, canParameterFrame
+
+// Builds the ID of a frame from its function and the ID of the board
+#define CAN_FRAME_ID(function, node) ((function) | ((node) & CAN_NODE_MASK))
+
+// Cyclic target of the motor
+typedef struct __attribute__((packed)) {
+    int32_t position;       // Target position (microsteps)
+    int32_t velocity;       // Velocity feed-forward (microsteps/s, 0 reaches the target by the next cycle)
+} canTargetFrame;
+
+// ID of the SYNC broadcast (the same for every board)
+#define CAN_SYNC_ID CAN_FUNCTION_SYNC
+
+// Status of the motor
+typedef struct __attribute__((packed)) {
+    int32_t steps;          // Commanded position (microsteps)
+    int16_t stepError;      // Step error (microsteps, held at the limits of an int16)
+    uint8_t state;          // MOTOR_STATE
+    uint8_t flags;          // CAN_STATUS_FLAG_*
+} canStatusFrame;
+
+// Flags of the status
+#define CAN_STATUS_FLAG_CORRECTING  STATUS_FLAG_CORRECTING // The closed loop correction is running
+#define CAN_STATUS_FLAG_MOVING      STATUS_FLAG_MOVING // The motor hasn't reached the last target yet
+#define CAN_STATUS_FLAG_OVERLOADED  STATUS_FLAG_OVERLOADED // The control loop is shedding work (ENABLE_OVERRUN_DETECTION)
+
+// Reply to a poll, the statusBlock squeezed into a single frame
+// The encoder's position (in microsteps) is steps - stepError, the counts are in the serial statusBlock
+typedef struct __attribute__((packed)) {
+    int32_t steps;          // Commanded position (microsteps)
+    int16_t stepError;      // Step error (microsteps, held at the limits of an int16)
+    uint8_t stateFlags;     // MOTOR_STATE in the low nibble, CAN_STATUS_FLAG_* in the high nibble
+    int8_t temperature;     // Temperature of the encoder (degrees C)
+} canPollFrame;
+
+// A point of the trajectory
+typedef struct __attribute__((packed)) {
+    int32_t position;       // Position to reach (microsteps)
+    int16_t velocity;       // Velocity at the position (PVT_CAN_VELOCITY_SCALE microsteps/s)
+    uint16_t duration;      // Time to reach the point from the last one (ms, at least 1)
+} canPVTFrame;
+
+// Reply to a point of the trajectory
+typedef struct __attribute__((packed)) {
+    uint8_t result;         // PVT_RESULT
+    uint8_t reserved;
+    uint16_t freeSlots;     // Points that can still be sent
+    uint16_t underruns;     // Underruns since boot (wraps around)
+} canPVTResponseFrame;
+
+// Access to a parameter (PARAMETER_ID)
+typedef struct __attribute__((packed)) {
+    uint8_t command;        // CAN_PARAM_* (the response's command, or an abort with the PARAMETER_STATUS in status)
+    uint8_t id;             // PARAMETER_ID
+    uint8_t status;         // PARAMETER_STATUS of an abort, otherwise 0
+    uint8_t reserved;
+    float value;            // Value to write, or the value that was read
+} canParameterFrame;
+
+// Commands of the parameter channel
+#define CAN_PARAM_READ          0x40 // Request the value of a parameter
+#define CAN_PARAM_WRITE         0x23 // Set the value of a parameter
+#define CAN_PARAM_READ_OK       0x43 // Response with the value
+#define CAN_PARAM_WRITE_OK      0x60 // Response once the value was set
+#define CAN_PARAM_ABORT         0x80 // Response if the access failed
+
+// Batched parameters
+#ifdef ENABLE_CAN_PARAM_BATCH
+// Writes to a group or the broadcast (0x600 + 0x7F) aren't replied to, each board adds the ones it took to its batch instead (as it does for writes to its own ID)
+// A commit (to the board, its group, or the broadcast) ends the batch, and every board that received it replies with a canParameterCommitFrame
+// The id of the commit holds its options (CAN_PARAM_COMMIT_*), the value is ignored
+#define CAN_PARAM_COMMIT        0x2C // Ends the batch of writes
+#define CAN_PARAM_COMMIT_OK     0x6C // Response to a commit (CAN_PARAM_ABORT if a write of the batch failed, or the save was refused)
+#define CAN_PARAM_COMMIT_SAVE   0x01 // Saves the parameters into flash (like M500), only if every write of the batch was taken
+
+// Reply to a commit
+// The batch CRC is a CRC16 (like crc16()) of [id][value, float] for each write that was taken, in the order that they arrived
+// The configuration CRC covers [id][value] of every parameter that the build supports, boards with the same configuration report the same one
+typedef struct __attribute__((packed)) {
+    uint8_t command;        // CAN_PARAM_COMMIT_OK or CAN_PARAM_ABORT
+    uint8_t writes;         // Writes that were taken since the last commit (held at 255)
+    uint8_t failures;       // Writes that were refused (held at 255)
+    uint8_t failedID;       // PARAMETER_ID of the first refused write (0xFF if there wasn't one)
+    uint16_t batchCRC;      // CRC16 of the writes that were taken
+    uint16_t configCRC;     // CRC16 of the whole configuration, after the batch
+} canParameterCommitFrame;
+#endif
+
+// Handles a frame of the binary protocol, returning false if it isn't one (it's a text frame)
+bool handleCANProtocolFrame(const canFrame &frame);
+
+// Gets the velocity feed-forward of the last target (microsteps/s)
+int32_t getCANTargetVelocity();
+
+// Motion fast path
+#ifdef ENABLE_CAN_MOTION_FAST_PATH
+// Handles a motion frame as it arrives (called by the motion frames' receive interrupt), returning false if it has to wait for the main loop
+// Only the targets and the gearing's positions are handled, nothing is sent from here (the transmit queue only has the main loop writing to it)
+bool handleCANMotionFrame(const canFrame &frame);
+
+// Sends the replies that the receive interrupt left to the main loop (the status of the last target, a single reply for any that arrived in between)
+void sendCANMotionReplies();
+#endif
+
+// Synchronized targets
+#ifdef ENABLE_CAN_SYNC
+// Starts the held target and trims the control loop's timer toward the SYNC (called by the CAN receive interrupt as the SYNC arrives)
+void handleCANSync();
+
+// Gets a summary of the synchronization (SYNCs received, the last phase error, and the trim)
+String getCANSyncStatus();
+#endif
+
+#endif // ! ENABLE_CAN_PDO
+#endif // ! __CAN_PROTOCOL_H__
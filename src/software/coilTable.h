@@ -0,0 +1,41 @@
+#ifndef __COIL_TABLE_H__
+#define __COIL_TABLE_H__
+
+// Include Arduino library
+#include "Arduino.h"
+
+// For the quarter sine table
+#include "fastSine.h"
+
+// The math of the coil drive table (ENABLE_COIL_LUT), without any of the hardware (so the host simulation checks it too)
+// The table holds the output of a coil at each entry of the quarter sine table, the sign comes from the half of the wave that the phase is in
+// Everything here is inlined, the step path runs from the SRAM and can't call into the flash
+
+// Current of a coil (mA) at an entry of the quarter sine table
+static inline uint16_t coilTableCurrent(uint16_t index, uint16_t peakCurrent) {
+    return ((uint32_t)peakCurrent * sineQuarterTable[index]) >> SINE_POWER; // i.e. / SINE_MAX
+}
+
+// Current of a coil (mA) at an entry of the quarter sine table, with a third harmonic (of the sine) added to the wave
+// The odd harmonics are mirrored the same way as the sine across each quarter, so the third still fits in the quarter table
+static inline uint32_t coilTableShapedCurrent(uint16_t index, uint16_t peakCurrent, float thirdHarmonic) {
+    int32_t shape = sineQuarterTable[index] + (int32_t)(thirdHarmonic * fastSinPhase(3 * (index << SINE_INTERP_POWER)));
+    return ((uint32_t)peakCurrent * (uint32_t)max(shape, (int32_t)0)) >> SINE_POWER; // i.e. / SINE_MAX
+}
+
+// Entry of the table for a phase
+static inline uint16_t coilTableIndex(uint16_t phase) {
+    return (sineQuarterPhase(phase) >> SINE_INTERP_POWER);
+}
+
+// If a coil is driven backward at a phase (the second half of the wave)
+static inline bool coilPhaseBackward(uint16_t phase) {
+    return (phase & (PHASE_PER_CYCLE / 2));
+}
+
+// Phase of coil B, which is a quarter cycle ahead of coil A
+static inline uint16_t coilPhaseB(uint16_t phase) {
+    return (phase + (PHASE_PER_CYCLE / 4));
+}
+
+#endif // ! __COIL_TABLE_H__
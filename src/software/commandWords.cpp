@@ -0,0 +1,193 @@
+// Import the config (needed for the ENABLE_SERIAL or ENABLE_CAN defines)
+#include "config.h"
+
+// Only include if the serial or CAN bus is enabled
+#if defined(ENABLE_SERIAL) || defined(ENABLE_CAN)
+
+// Import the header file
+#include "commandWords.h"
+
+
+// Splits a command into its words in a single pass (ex. "M306 P1.5 I2" is M306, P1.5, and I2)
+// A word is a letter followed by its value, which can be separated by a space ("P 1.5") or quoted ("M\"A message\"")
+// Returns false if there were more words than can be held
+bool tokenizeCommand(const char* buffer, uint16_t length, parsedCommand &command) {
+
+    // Start with no words
+    command.count = 0;
+    uint16_t index = 0;
+    while (index < length) {
+
+        // Every word must start with a letter, anything else before it is skipped (ex. a start marker)
+        if (!isalpha(buffer[index])) {
+            index++;
+            continue;
+        }
+
+        // Make sure that there is room for the word
+        if (command.count >= MAX_COMMAND_WORDS) {
+            return false;
+        }
+        commandWord &word = command.words[command.count++];
+        word.letter = toupper(buffer[index++]);
+
+        // The value can be separated from the letter by a space, as long as it doesn't look like another word
+        if ((index + 1) < length && buffer[index] == ' ' && (isdigit(buffer[index + 1]) || buffer[index + 1] == '-' ||
+                                                              buffer[index + 1] == '.' || buffer[index + 1] == '"')) {
+            index++;
+        }
+
+        // Find the end of the value (a quoted value can hold spaces)
+        uint16_t start = index;
+        if (index < length && buffer[index] == '"') {
+            start = ++index;
+            while (index < length && buffer[index] != '"') {
+                index++;
+            }
+            word.text = &buffer[start];
+            word.length = (index - start);
+            index++;
+        }
+        else {
+            while (index < length && !isspace(buffer[index])) {
+                index++;
+            }
+            word.text = &buffer[start];
+            word.length = (index - start);
+        }
+
+        // Convert the value once, any text that isn't a number is read as 0
+        parseWordNumber(word);
+    }
+
+    // All of the words fit
+    return true;
+}
+
+
+// Powers of ten for the fraction's digits of a word (only the first 9 are kept, more than a float holds)
+static const uint32_t wordPowersOfTen[10] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+
+// Converts the text of a word into its number, scanning the text in place with integer math (no copy, and no strtol() or strtof())
+void parseWordNumber(commandWord &word) {
+
+    // Read the sign
+    uint16_t index = 0;
+    bool negative = false;
+    if (index < word.length && (word.text[index] == '-' || word.text[index] == '+')) {
+        negative = (word.text[index++] == '-');
+    }
+    word.negative = negative;
+
+    // Read the whole part, held just past the limit of an int32 (so that the negative limit still fits)
+    uint32_t whole = 0;
+    uint16_t digits = 0;
+    while (index < word.length && isdigit(word.text[index])) {
+        whole = (uint32_t)min(((uint64_t)whole * 10) + (word.text[index++] - '0'), ((uint64_t)INT32_MAX + 1));
+        digits++;
+    }
+
+    // Read the fraction, dropping the digits past the first 9
+    uint32_t fraction = 0;
+    uint8_t fractionDigits = 0;
+    if (index < word.length && word.text[index] == '.') {
+        index++;
+        while (index < word.length && isdigit(word.text[index])) {
+            if (fractionDigits < 9) {
+                fraction = (fraction * 10) + (word.text[index] - '0');
+                fractionDigits++;
+            }
+            index++;
+            digits++;
+        }
+    }
+
+    // The value is only a number if it had digits, and nothing followed them
+    word.isNumber = (digits > 0 && index == word.length);
+
+    // The integer is cut toward zero, like strtol()
+    int64_t wholeValue = (negative ? -(int64_t)whole : (int64_t)whole);
+    word.intValue = (int32_t)constrain(wholeValue, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+
+    // The fixed point value is rounded to the nearest fraction of its format
+    int64_t fixedMagnitude = (((int64_t)whole << WORD_FIXED_Q_POWER) +
+                              ((((uint64_t)fraction << WORD_FIXED_Q_POWER) + (wordPowersOfTen[fractionDigits] / 2)) / wordPowersOfTen[fractionDigits]));
+    word.fixedValue = (int32_t)constrain((negative ? -fixedMagnitude : fixedMagnitude), (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+
+    // The fraction is kept as digits, wordToFloat() only makes it a float for the commands that need one
+    word.fraction = fraction;
+    word.fractionDigits = fractionDigits;
+}
+
+
+// Converts the value of a word into a float (only done when a float is needed, as it costs a soft float conversion and divide)
+float wordToFloat(const commandWord &word) {
+    float magnitude = ((float)abs((int64_t)word.intValue) + ((float)word.fraction / wordPowersOfTen[word.fractionDigits]));
+    return (word.negative ? -magnitude : magnitude);
+}
+
+
+// Finds the first word with a letter, starting from the word at startIndex (returns nullptr if there isn't one)
+const commandWord* findWord(const parsedCommand &command, char letter, uint8_t startIndex) {
+
+    // Check each of the words
+    letter = toupper(letter);
+    for (uint8_t index = startIndex; index < command.count; index++) {
+        if (command.words[index].letter == letter) {
+            return &command.words[index];
+        }
+    }
+
+    // No word has the letter
+    return nullptr;
+}
+
+
+// Gets the value of a word as an integer, or the missing value if the letter wasn't given
+int32_t getWordInt(const parsedCommand &command, char letter, int32_t missing) {
+    const commandWord* word = findWord(command, letter);
+    return (word != nullptr ? (word -> intValue) : missing);
+}
+
+
+// Gets the value of a word as a float, or the missing value if the letter wasn't given
+float getWordFloat(const parsedCommand &command, char letter, float missing) {
+    const commandWord* word = findWord(command, letter);
+    return (word != nullptr ? wordToFloat(*word) : missing);
+}
+
+
+// Finds the value of a word as an integer, returning if the letter was given with a number
+bool findWordInt(const parsedCommand &command, char letter, int32_t &value) {
+    const commandWord* word = findWord(command, letter);
+    if (word == nullptr || !(word -> isNumber)) {
+        return false;
+    }
+    value = (word -> intValue);
+    return true;
+}
+
+
+// Finds the value of a word as a float, returning if the letter was given with a number
+bool findWordFloat(const parsedCommand &command, char letter, float &value) {
+    const commandWord* word = findWord(command, letter);
+    if (word == nullptr || !(word -> isNumber)) {
+        return false;
+    }
+    value = wordToFloat(*word);
+    return true;
+}
+
+
+// Finds the value of a word as fixed point (Q16.16), returning if the letter was given with a number
+bool findWordFixed(const parsedCommand &command, char letter, int32_t &value) {
+    const commandWord* word = findWord(command, letter);
+    if (word == nullptr || !(word -> isNumber)) {
+        return false;
+    }
+    value = (word -> fixedValue);
+    return true;
+}
+
+#endif // (ENABLE_SERIAL || ENABLE_CAN)
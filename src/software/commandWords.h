@@ -0,0 +1,57 @@
+#ifndef __COMMAND_WORDS_H__
+#define __COMMAND_WORDS_H__
+
+// Include Arduino library
+#include "Arduino.h"
+
+// The words of a text command, split and converted without any of the hardware (so the host simulation checks them too)
+
+// Most words that a single command can have (ex. "G0 P3200 R1000 A20000 J2000000" is 5)
+#define MAX_COMMAND_WORDS 12
+
+// A single word of a command, a letter and its value (ex. "P1.5")
+// The text points into the command's buffer, so the word is only valid while the buffer is
+typedef struct {
+    char letter;        // Uppercase letter of the word
+    const char* text;   // Value, as it was written (not terminated, quotes removed)
+    uint16_t length;    // Length of the value's text
+    bool isNumber;      // If the whole value is a decimal number (ex. "-1.5", not "" or "A1")
+    bool negative;      // If the value had a minus sign
+    uint8_t fractionDigits; // Number of fraction digits that were kept (up to 9)
+    uint32_t fraction;  // Fraction digits as an integer (ex. 5 for "-1.5"), only turned into a float when it is asked for
+    int32_t intValue;   // Value as an integer, the fraction cut off (0 if it doesn't start with a number)
+    int32_t fixedValue; // Value as fixed point (Q16.16, held at the limits)
+} commandWord;
+
+// Fractional bits of a word's fixed point value
+#define WORD_FIXED_Q_POWER 16
+
+// A command split into its words
+typedef struct {
+    commandWord words[MAX_COMMAND_WORDS];
+    uint8_t count;
+} parsedCommand;
+
+// Splits a command into its words in a single pass, returning false if there were more words than can be held
+bool tokenizeCommand(const char* buffer, uint16_t length, parsedCommand &command);
+
+// Converts the text of a word into its number, scanning the text in place with integer math (no copy, and no strtol() or strtof())
+void parseWordNumber(commandWord &word);
+
+// Finds the first word with a letter, starting from the word at startIndex (returns nullptr if there isn't one)
+const commandWord* findWord(const parsedCommand &command, char letter, uint8_t startIndex = 0);
+
+// Converts the value of a word into a float (only done when a float is needed, as it costs a soft float conversion and divide)
+float wordToFloat(const commandWord &word);
+
+// Gets the value of a word as an integer or a float, or the missing value if the letter wasn't given
+int32_t getWordInt(const parsedCommand &command, char letter, int32_t missing = -1);
+float getWordFloat(const parsedCommand &command, char letter, float missing = -1);
+
+// Finds the value of a word as an integer, a float, or fixed point (Q16.16), returning if the letter was given with a number
+// Unlike the functions above, every value (including -1) can be told apart from a missing word. The value is left alone if it returns false
+bool findWordInt(const parsedCommand &command, char letter, int32_t &value);
+bool findWordFloat(const parsedCommand &command, char letter, float &value);
+bool findWordFixed(const parsedCommand &command, char letter, int32_t &value);
+
+#endif // ! __COMMAND_WORDS_H__
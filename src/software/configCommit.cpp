@@ -0,0 +1,108 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_CONFIG_COMMIT
+
+// Import the header file
+#include "configCommit.h"
+#include "timers.h"
+
+// The two blocks, the one being edited, and the one that is waiting for the correction (nullptr once it has been applied)
+static configBlock configBlocks[2];
+static uint8_t editIndex = 0;
+static configBlock* volatile committedConfig = nullptr;
+
+
+// Applies the settings of a block, only the settings that changed are set
+static void applyConfigBlock(const configBlock &block) {
+
+    // The step interrupt can't land halfway through the rescale of the counts and the phases (it isn't masked by disableInterrupts())
+    bool microsteppingChanged = (block.microstepping != motor.getMicrostepping());
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (block.fullStepAngle != motor.getFullStepAngle()) {
+        motor.setFullStepAngle(block.fullStepAngle);
+    }
+    if (microsteppingChanged) {
+        motor.setMicrostepping(block.microstepping);
+    }
+    if (block.multiplier != motor.getMicrostepMultiplier()) {
+        motor.setMicrostepMultiplier(block.multiplier);
+    }
+    if (block.reversed != motor.getReversed()) {
+        motor.setReversed(block.reversed);
+    }
+    __set_PRIMASK(primask);
+
+    // Start the correction steps over for the new microstepping
+    if (microsteppingChanged) {
+        updateCorrectionTimer();
+    }
+
+    // The gains are only read by the correction, which isn't running while they change
+    #ifdef ENABLE_PID
+        pid.setP(block.p);
+        pid.setI(block.i);
+        pid.setD(block.d);
+        pid.setMaxI(block.maxI);
+    #endif
+}
+
+
+// Gets a block to edit, filled with the current settings
+configBlock* editConfig() {
+
+    // Wait for the last commit to finish, so that the block is filled from its settings
+    if (committedConfig != nullptr) {
+        commitConfig();
+    }
+
+    // Fill the block that isn't being applied
+    configBlock* block = &configBlocks[editIndex];
+    block -> microstepping = motor.getMicrostepping();
+    block -> multiplier = motor.getMicrostepMultiplier();
+    block -> fullStepAngle = motor.getFullStepAngle();
+    block -> reversed = motor.getReversed();
+    #ifdef ENABLE_PID
+        block -> p = pid.getP();
+        block -> i = pid.getI();
+        block -> d = pid.getD();
+        block -> maxI = pid.getMaxI();
+    #endif
+    return block;
+}
+
+
+// Hands the edited block to the correction, then waits for it to be applied
+void commitConfig() {
+
+    // Hand the block over (a single write of the pointer), the next edit uses the other block
+    if (committedConfig == nullptr) {
+        committedConfig = &configBlocks[editIndex];
+        editIndex ^= 1;
+    }
+
+    // The correction takes it at the start of its next tick
+    uint32_t startTime = micros();
+    while ((committedConfig != nullptr) && ((micros() - startTime) < CONFIG_COMMIT_TIMEOUT));
+
+    // The correction isn't running (the motor timers are off, or a move paused it), apply it from here instead
+    if (committedConfig != nullptr) {
+        disableInterrupts();
+        applyCommittedConfig();
+        enableInterrupts();
+    }
+}
+
+
+// Applies the committed block, if there is one (runs from the SRAM, the check is made every tick)
+void RAMFUNC applyCommittedConfig() {
+    configBlock* block = committedConfig;
+    if (block != nullptr) {
+        applyConfigBlock(*block);
+        committedConfig = nullptr;
+    }
+}
+
+#endif // ! ENABLE_CONFIG_COMMIT
@@ -0,0 +1,43 @@
+#ifndef __CONFIG_COMMIT_H__
+#define __CONFIG_COMMIT_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the settings are committed at the control ticks
+#ifdef ENABLE_CONFIG_COMMIT
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Settings that are committed together
+// There are two blocks, the main loop fills one from the current settings and edits it, then hands it to the correction
+// by setting a pointer. The correction takes the pointer at the start of its next tick and applies the whole block before it runs,
+// then clears the pointer. The next edit uses the other block, so a block is never edited while it is being applied
+typedef struct {
+    uint16_t microstepping;     // Microstepping divisor
+    float multiplier;           // Microstep multiplier
+    float fullStepAngle;        // Angle of a full step (degrees)
+    bool reversed;              // Direction pin inversion
+    #ifdef ENABLE_PID
+    float p, i, d, maxI;        // PID gains and the windup limit
+    #endif
+} configBlock;
+
+// Longest that a commit waits for the correction to take it (us, 2 ticks), it is applied by the main loop after that (ex. while a move pauses the correction)
+#define CONFIG_COMMIT_TIMEOUT ((2 * 1000000) / CONTROL_LOOP_FREQ)
+
+// Gets a block to edit, filled with the current settings (main loop only)
+configBlock* editConfig();
+
+// Hands the edited block to the correction, then waits for it to be applied (the settings have all changed once this returns)
+void commitConfig();
+
+// Applies the committed block, if there is one (called at the start of every correction tick)
+void applyCommittedConfig();
+
+#endif // ! ENABLE_CONFIG_COMMIT
+#endif // ! __CONFIG_COMMIT_H__
@@ -0,0 +1,182 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_CONTROL_MODES
+
+// Import the header file
+#include "controlMode.h"
+#include "timers.h"
+#include "calibration.h"
+
+// Closed loop mode that the correction runs (the PID if it is in the build)
+#ifdef ENABLE_PID
+    static volatile CONTROL_MODE correctionMode = CONTROL_PID;
+#else
+    static volatile CONTROL_MODE correctionMode = CONTROL_CORRECTION;
+#endif
+
+
+// Gets if a mode is in this build
+bool isControlModeAvailable(CONTROL_MODE mode) {
+    switch (mode) {
+        case CONTROL_OPEN_LOOP:
+        case CONTROL_CORRECTION:
+            return true;
+        #ifdef ENABLE_PID
+        case CONTROL_PID:
+            return true;
+        #endif
+        #ifdef ENABLE_TORQUE_MODE
+        case CONTROL_TORQUE:
+            return true;
+        #endif
+        default:
+            return false;
+    }
+}
+
+
+// Gets the name of a mode
+String getControlModeName(CONTROL_MODE mode) {
+    switch (mode) {
+        case CONTROL_OPEN_LOOP:
+            return F("Open loop");
+        case CONTROL_CORRECTION:
+            return F("Correction");
+        case CONTROL_PID:
+            return F("PID");
+        case CONTROL_TORQUE:
+            return F("Torque");
+        default:
+            return F("Unknown");
+    }
+}
+
+
+// Gets the mode that the motor is running in
+CONTROL_MODE getControlMode() {
+    #ifdef ENABLE_TORQUE_MODE
+    if (motor.isTorqueModeActive()) {
+        return CONTROL_TORQUE;
+    }
+    #endif
+    if (!isStepCorrectionEnabled()) {
+        return CONTROL_OPEN_LOOP;
+    }
+    return correctionMode;
+}
+
+
+// Gets the closed loop mode that the correction runs
+CONTROL_MODE RAMFUNC getCorrectionMode() {
+    return correctionMode;
+}
+
+
+// Sets the closed loop mode without switching to it (only the closed loop modes can be loaded)
+void loadCorrectionMode(CONTROL_MODE mode) {
+    if (mode == CONTROL_CORRECTION || (mode == CONTROL_PID && isControlModeAvailable(CONTROL_PID))) {
+        correctionMode = mode;
+    }
+}
+
+
+// Finds the rate that the direction based correction is stepping at (steps/s, counter clockwise is positive), for the PID to start from
+#ifdef ENABLE_PID
+static int32_t getCorrectionRate() {
+
+    // The correction only steps once the motor is out of position
+    int32_t stepError = motor.getStepError();
+    if (abs(stepError) <= 1) {
+        return 0;
+    }
+
+    // A microstep at a time, at STEP_UPDATE_FREQ full steps per second
+    int32_t rate = (STEP_UPDATE_FREQ * motor.getMicrostepping());
+    return (stepError > 0 ? -rate : rate);
+}
+#endif
+
+
+// Switches the mode, handing the state of the last mode over to the next one
+bool setControlMode(CONTROL_MODE mode) {
+
+    // The mode has to be in the build
+    if (!isControlModeAvailable(mode)) {
+        return false;
+    }
+
+    // The calibration and the autotune drive the motor themselves, and the moves pause the correction, so the mode can't change under them
+    if (isCalibrating()) {
+        return false;
+    }
+    #ifdef ENABLE_AUTOTUNE
+    if (isAutotuneRunning()) {
+        return false;
+    }
+    #endif
+    #ifdef ENABLE_DIRECT_STEPPING
+    if (isDirectMoveRunning()) {
+        return false;
+    }
+    #endif
+
+    // Nothing to hand over if the mode is already running
+    CONTROL_MODE lastMode = getControlMode();
+    if (mode == lastMode) {
+        return true;
+    }
+
+    // Leave the torque mode first, taking up the step error so that the motor holds where it was pushed to
+    #ifdef ENABLE_TORQUE_MODE
+    if (lastMode == CONTROL_TORQUE) {
+        motor.exitTorqueMode();
+    }
+    #endif
+
+    switch (mode) {
+
+        // Stop the correction, the coils stay at their phase
+        case CONTROL_OPEN_LOOP:
+            disableStepCorrection();
+            break;
+
+        // The correction holds the torque, at the last target (M920)
+        #ifdef ENABLE_TORQUE_MODE
+        case CONTROL_TORQUE:
+            enableStepCorrection();
+            motor.setTorqueMode(motor.getTorqueTarget());
+            break;
+        #endif
+
+        // Closed loop modes
+        default:
+
+            // The correction can't run halfway through the handover
+            disableInterrupts();
+            #ifdef ENABLE_PID
+            if (mode == CONTROL_PID) {
+
+                // Start the PID from the rate of the last mode (enabling the correction from the open loop starts it from a standstill)
+                if (isStepCorrectionEnabled()) {
+                    pid.transfer(lastMode == CONTROL_CORRECTION ? getCorrectionRate() : 0);
+                }
+            }
+            else {
+                // Stop the PID's correction steps, the direction based correction takes over from the next tick
+                stopPIDSteps();
+            }
+            #endif
+            updateCorrectionTimer();
+            correctionMode = mode;
+            enableInterrupts();
+
+            // Start the correction if it was off
+            enableStepCorrection();
+            break;
+    }
+    return true;
+}
+
+#endif // ! ENABLE_CONTROL_MODES
@@ -0,0 +1,51 @@
+#ifndef __CONTROL_MODE_H__
+#define __CONTROL_MODE_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the control modes are enabled
+#ifdef ENABLE_CONTROL_MODES
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Control modes that can be switched between while the motor runs
+// The numbers are used by M922 and saved with M500, so new modes must be added at the end
+typedef enum {
+    CONTROL_OPEN_LOOP,      // No correction, the coils only follow the steps
+    CONTROL_CORRECTION,     // Direction based correction steps at a fixed rate
+    CONTROL_PID,            // PID correction steps (requires ENABLE_PID)
+    CONTROL_TORQUE,         // Torque mode (requires ENABLE_TORQUE_MODE)
+    CONTROL_MODE_COUNT
+} CONTROL_MODE;
+
+// Each switch hands the state of the last mode over to the next one, so the axis doesn't jerk:
+// - Into the PID, its I term is preloaded so that the output starts at the rate that the last mode was stepping at
+// - Into the correction, any PID correction steps are stopped and the correction starts over from the next tick
+// - Out of the torque mode, the step error is taken up so that the motor holds where it was pushed to
+// - Into the open loop, the coils are left at their phase, and the closed loop picks up from there when it is enabled again
+
+// Switches the mode, returning false if the mode isn't in this build or if a direct move is running
+bool setControlMode(CONTROL_MODE mode);
+
+// Gets the mode that the motor is running in (the open loop if the correction is disabled, or the torque mode if it is running)
+CONTROL_MODE getControlMode();
+
+// Gets the closed loop mode that the correction runs (CONTROL_CORRECTION or CONTROL_PID), read by the correction every tick
+CONTROL_MODE getCorrectionMode();
+
+// Sets the closed loop mode without switching to it (only used to load the mode saved in flash, before the timers are running)
+void loadCorrectionMode(CONTROL_MODE mode);
+
+// Gets if a mode is in this build
+bool isControlModeAvailable(CONTROL_MODE mode);
+
+// Gets the name of a mode
+String getControlModeName(CONTROL_MODE mode);
+
+#endif // ! ENABLE_CONTROL_MODES
+#endif // ! __CONTROL_MODE_H__
@@ -0,0 +1,38 @@
+// Import the header file
+#include "crc.h"
+
+// CRC16 lookup of each nibble (half the size of a byte table, with only twice the lookups)
+static const uint16_t crcNibbleTable[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+
+// CRC8 lookup table
+constexpr CRC8Table crc8Table;
+
+
+// Computes the CRC16 (CCITT, 0x1021 starting at 0xFFFF) of the data
+uint16_t crc16(const uint8_t* data, uint16_t length) {
+    return crc16Update(0xFFFF, data, length);
+}
+
+
+// Adds the data to a running CRC16
+uint16_t crc16Update(uint16_t crc, const uint8_t* data, uint16_t length) {
+    for (uint16_t index = 0; index < length; index++) {
+        crc = (crc << 4) ^ crcNibbleTable[(crc >> 12) ^ (data[index] >> 4)];
+        crc = (crc << 4) ^ crcNibbleTable[(crc >> 12) ^ (data[index] & 0x0F)];
+    }
+    return crc;
+}
+
+
+// Computes the finished CRC8 of the data
+uint8_t crc8(const uint8_t* data, uint16_t length) {
+    uint8_t crc = CRC8_SEED;
+    for (uint16_t index = 0; index < length; index++) {
+        crc = crc8Update(crc, data[index]);
+    }
+    return (uint8_t)~crc;
+}
@@ -0,0 +1,40 @@
+#ifndef __CRC_H__
+#define __CRC_H__
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Computes the CRC16 (CCITT, 0x1021 starting at 0xFFFF) of the data
+uint16_t crc16(const uint8_t* data, uint16_t length);
+
+// Adds the data to a running CRC16 (start from 0xFFFF, the same as crc16() when fed all at once)
+uint16_t crc16Update(uint16_t crc, const uint8_t* data, uint16_t length);
+
+// CRC8 of the encoder's safety word (SAE J1850, 0x1D starting at 0xFF, inverted at the end)
+#define CRC8_POLYNOMIAL 0x1D
+#define CRC8_SEED       0xFF
+
+// CRC8 lookup table, generated at compile time so that it is stored in flash
+struct CRC8Table {
+    uint8_t values[256];
+    constexpr CRC8Table() : values() {
+        for (uint16_t index = 0; index < 256; index++) {
+            uint8_t crc = index;
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ CRC8_POLYNOMIAL) : (uint8_t)(crc << 1);
+            }
+            values[index] = crc;
+        }
+    }
+};
+extern const CRC8Table crc8Table;
+
+// Adds a byte to a running CRC8 (start from CRC8_SEED, then invert the result to finish it)
+static inline uint8_t crc8Update(uint8_t crc, uint8_t data) {
+    return crc8Table.values[crc ^ data];
+}
+
+// Computes the finished CRC8 of the data
+uint8_t crc8(const uint8_t* data, uint16_t length);
+
+#endif // ! __CRC_H__
@@ -0,0 +1,247 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_DETENT_COMPENSATION
+
+// Import the header file
+#include "detentComp.h"
+#include "calibration.h"
+#include "flash.h"
+#include "timers.h"
+#include "fastSine.h"
+#include "fixedFormat.h"
+
+// The step that the learning pass is on, and when its wait started (ms)
+static DETENT_STATE state = DETENT_IDLE;
+static uint32_t stateStartTime = 0;
+
+// The points in a rotation, the point that the rotation starts on, and the point that the coils are holding (from the start)
+static int32_t sweepPoints = 0;
+static uint16_t startPoint = 0;
+static int32_t currentPoint = 0;
+
+// Sum of the rotor's deviation from the coils at each point of the cycle (phase)
+static int32_t deviationSums[DETENT_TABLE_SIZE];
+
+// The deviation that was left with the table before the pass, and the largest offset of the table after it (phase)
+static uint32_t peakResidual = 0;
+static uint32_t rmsResidual = 0;
+static uint32_t peakOffset = 0;
+
+
+// Moves the coils to a point of the sweep, then restarts the wait so that the motor can settle
+// The coils are driven through the table, so the deviation that is measured is what the table leaves
+static void moveToPoint(int32_t point) {
+    currentPoint = point;
+    motor.driveCoilsPhase((uint16_t)((startPoint + point) << DETENT_POINT_POWER));
+    stateStartTime = millis();
+}
+
+
+// Adds the rotor's deviation at the current point to its sum (returns false if the rotor isn't following the coils)
+static bool measurePoint() {
+    uint16_t point = ((startPoint + currentPoint) & (DETENT_TABLE_SIZE - 1));
+    int16_t deviation = (int16_t)(motor.measureRotorPhase() - (uint16_t)(point << DETENT_POINT_POWER));
+    deviationSums[point] += deviation;
+    return (abs(deviation) < (int32_t)PHASE_PER_FULL_STEP);
+}
+
+
+// Gives the motor back, holding the coils where the motor had them before the pass
+static void releaseMotor() {
+    if (motor.getState() == ENABLED || motor.getState() == FORCED_ENABLED) {
+        motor.driveCoilsPhase(motor.getCoilPhase() >> MULTIPLIER_Q_POWER);
+    }
+    else {
+        motor.setCoilA(IDLE_MODE);
+        motor.setCoilB(IDLE_MODE);
+    }
+    enableMotorTimers();
+}
+
+
+// Takes the deviation less its mean off of the table, then saves and applies it
+static void finishLearning() {
+
+    // Each point was measured once per electrical cycle in each direction
+    int32_t samples = (2 * sweepPoints) / DETENT_TABLE_SIZE;
+    int32_t deviations[DETENT_TABLE_SIZE];
+    int32_t deviationTotal = 0;
+    for (uint8_t point = 0; point < DETENT_TABLE_SIZE; point++) {
+        deviations[point] = (deviationSums[point] / samples);
+        deviationTotal += deviations[point];
+    }
+
+    // The mean is the error of the step offset, only the ripple around it is the detent torque
+    int32_t mean = (deviationTotal / DETENT_TABLE_SIZE);
+    uint64_t squaredTotal = 0;
+    peakResidual = 0;
+    peakOffset = 0;
+    for (uint8_t point = 0; point < DETENT_TABLE_SIZE; point++) {
+        int32_t residual = (deviations[point] - mean);
+        peakResidual = max(peakResidual, (uint32_t)abs(residual));
+        squaredTotal += ((int64_t)residual * residual);
+
+        // Drive the coils the other way by the ripple
+        int16_t offset = constrain(motor.getDetentOffset(point) - residual, -(int32_t)DETENT_LEARN_MAX_OFFSET, (int32_t)DETENT_LEARN_MAX_OFFSET);
+        motor.setDetentOffset(point, offset);
+        peakOffset = max(peakOffset, (uint32_t)abs(offset));
+    }
+    rmsResidual = (uint32_t)sqrt((float)squaredTotal / DETENT_TABLE_SIZE);
+
+    // Save the table on its own, the rest of the parameters are kept
+    for (uint8_t index = 0; index < (DETENT_TABLE_SIZE / 2); index++) {
+        uint32_t offsets = ((uint16_t)motor.getDetentOffset(2 * index) | ((uint32_t)(uint16_t)motor.getDetentOffset((2 * index) + 1) << 16));
+        writeFlash(DETENT_TABLE_START_INDEX + index, offsets);
+    }
+    writeFlash(DETENT_LEARNED_INDEX, true);
+
+    // All done, the motor can be used right away
+    releaseMotor();
+    state = DETENT_DONE;
+}
+
+
+// Starts the learning pass, run in the background by detentTask()
+bool startDetentLearning() {
+
+    // The deviation is measured from the calibrated step offset, and the coils can't be shared with the calibration or a move
+    if (isDetentLearning() || isCalibrating() || !isCalibrated()) {
+        return false;
+    }
+    #ifdef ENABLE_DIRECT_STEPPING
+    if (isDirectMoveRunning()) {
+        return false;
+    }
+    #endif
+
+    // A rotation of points, starting on the point that the rotor is closest to
+    int32_t fullSteps = round(360.0 / motor.getFullStepAngle());
+    sweepPoints = ((fullSteps / 4) * DETENT_TABLE_SIZE);
+    if (sweepPoints <= 0) {
+        return false;
+    }
+    memset(deviationSums, 0, sizeof(deviationSums));
+
+    // Take over the motor, then hold it at the first point
+    disableMotorTimers();
+    startPoint = ((motor.measureRotorPhase() + (1 << (DETENT_POINT_POWER - 1))) >> DETENT_POINT_POWER);
+    moveToPoint(0);
+    state = DETENT_SETTLING;
+    return true;
+}
+
+
+// Stops the learning pass without changing the table
+void abortDetentLearning() {
+    if (isDetentLearning()) {
+        releaseMotor();
+    }
+    state = DETENT_IDLE;
+}
+
+
+// Returns if the learning pass is running
+bool isDetentLearning() {
+    return (state >= DETENT_SETTLING && state <= DETENT_SWEEP_BACKWARD);
+}
+
+
+// Clears the table, along with the saved one
+void clearDetentTable() {
+    for (uint8_t point = 0; point < DETENT_TABLE_SIZE; point++) {
+        motor.setDetentOffset(point, 0);
+    }
+    writeFlash(DETENT_LEARNED_INDEX, false);
+    if (!isDetentLearning()) {
+        state = DETENT_IDLE;
+    }
+}
+
+
+// Gets a summary of the learning pass (its step and progress, or the result once done)
+String getDetentStatus() {
+    switch (state) {
+        case DETENT_SETTLING:
+            return F("Settling at the first point");
+        case DETENT_SWEEP_FORWARD:
+            return ("Sweeping (" + String((currentPoint * 50) / sweepPoints) + F("%) forward"));
+        case DETENT_SWEEP_BACKWARD:
+            return ("Sweeping (" + String(50 + (((sweepPoints - currentPoint) * 50) / sweepPoints)) + F("%) backward"));
+        case DETENT_DONE:
+            return ("Done | Ripple before: peak " + floatString((float)peakResidual * 100 / PHASE_PER_FULL_STEP, 2) + F("%, RMS ") +
+                    floatString((float)rmsResidual * 100 / PHASE_PER_FULL_STEP, 2) + F("% of a full step | Largest offset: ") +
+                    floatString((float)peakOffset * 100 / PHASE_PER_FULL_STEP, 2) + F("% of a full step"));
+        case DETENT_FAILED:
+            return F("Failed, the rotor didn't follow the coils (check the motor power and the calibration)");
+        default:
+            return F("Idle");
+    }
+}
+
+
+// Moves the learning pass along once its wait is over (a task of the main loop, does nothing unless learning)
+void detentTask() {
+
+    // Find how long the current step has to wait for
+    uint32_t waitTime;
+    switch (state) {
+        case DETENT_SETTLING:
+            waitTime = DETENT_LEARN_HOLD_TIME;
+            break;
+        case DETENT_SWEEP_FORWARD:
+        case DETENT_SWEEP_BACKWARD:
+            waitTime = DETENT_LEARN_POINT_TIME;
+            break;
+        default:
+            // Not learning
+            return;
+    }
+    if ((millis() - stateStartTime) < waitTime) {
+        return;
+    }
+
+    // The wait is over, run the next part of the step
+    switch (state) {
+        case DETENT_SETTLING:
+
+            // The first point is only measured on the way back, the forward sweep measures the rest of the rotation
+            moveToPoint(1);
+            state = DETENT_SWEEP_FORWARD;
+            break;
+
+        case DETENT_SWEEP_FORWARD:
+        case DETENT_SWEEP_BACKWARD:
+
+            // Measure the point, giving up if the rotor isn't following
+            if (!measurePoint()) {
+                releaseMotor();
+                state = DETENT_FAILED;
+                break;
+            }
+
+            // Sweep forward to a rotation, then back to the first point
+            if (state == DETENT_SWEEP_FORWARD) {
+                if (currentPoint < sweepPoints) {
+                    moveToPoint(currentPoint + 1);
+                }
+                else {
+                    moveToPoint(sweepPoints - 1);
+                    state = DETENT_SWEEP_BACKWARD;
+                }
+            }
+            else if (currentPoint > 0) {
+                moveToPoint(currentPoint - 1);
+            }
+            else {
+                finishLearning();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+#endif // ! ENABLE_DETENT_COMPENSATION
@@ -0,0 +1,51 @@
+#ifndef __DETENT_COMP_H__
+#define __DETENT_COMP_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the detent compensation is enabled
+#ifdef ENABLE_DETENT_COMPENSATION
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Learning of the detent (cogging) torque compensation table
+// The correction is paused while the coils are stepped through every point of a rotation forward, then back, at a slow constant speed
+// The detent torque pulls the rotor ahead of or behind the coils at each point, which is averaged over every electrical cycle of the rotation
+// (and both ways, so the friction cancels out). The average less its mean is taken off of the table that was driving the coils, and saved
+
+// The steps of the learning pass, in the order that they are run
+typedef enum {
+    DETENT_IDLE,            // Not running, nothing has been learned since boot
+    DETENT_SETTLING,        // Holding the first point, letting the motor settle
+    DETENT_SWEEP_FORWARD,   // Measuring each point of a rotation, stepping forward
+    DETENT_SWEEP_BACKWARD,  // Measuring each point again on the way back
+    DETENT_DONE,            // The table was refined, saved, and applied
+    DETENT_FAILED           // The rotor didn't follow the coils (no motor power, or not calibrated right)
+} DETENT_STATE;
+
+// Starts the learning pass, run in the background by detentTask()
+// Returns false if it can't start (already running, not calibrated, calibrating, or moving)
+bool startDetentLearning();
+
+// Stops the learning pass without changing the table
+void abortDetentLearning();
+
+// Returns if the learning pass is running
+bool isDetentLearning();
+
+// Clears the table, along with the saved one
+void clearDetentTable();
+
+// Gets a summary of the learning pass (its step and progress, or the result once done)
+String getDetentStatus();
+
+// Moves the learning pass along once its wait is over (a task of the main loop, does nothing unless learning)
+void detentTask();
+
+#endif // ! ENABLE_DETENT_COMPENSATION
+#endif // ! __DETENT_COMP_H__
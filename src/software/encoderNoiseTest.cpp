@@ -0,0 +1,146 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_ENCODER_NOISE_TEST
+
+// Import the header file
+#include "encoderNoiseTest.h"
+#include "timers.h"
+#include "calibration.h"
+#include "watchdog.h"
+#include "profiler.h"
+
+
+// Finds the distance of an angle from a reference, across the wrap of the turn (raw increments)
+static int32_t incrementsFrom(uint16_t increments, uint16_t reference) {
+    int32_t distance = ((int32_t)increments - reference);
+    if (distance >= (ENCODER_COUNTS_PER_REV / 2)) {
+        distance -= ENCODER_COUNTS_PER_REV;
+    }
+    else if (distance < -(ENCODER_COUNTS_PER_REV / 2)) {
+        distance += ENCODER_COUNTS_PER_REV;
+    }
+    return distance;
+}
+
+
+// Parks the motor and reads the samples, then gives the motor back
+String runEncoderNoiseTest(uint32_t samples) {
+
+    // The motor has to be still, and the encoder's bus can't be shared with another test
+    if (isCalibrating()) {
+        return F("Noise test can't run during the calibration");
+    }
+    #if (defined(ENABLE_DIRECT_STEPPING) || defined(ENABLE_PID))
+    if (getRemainingScheduledSteps() > 0) {
+        return F("Noise test can't run during a move");
+    }
+    #endif
+    samples = constrain((samples > 0 ? samples : ENCODER_NOISE_TEST_SAMPLES), (uint32_t)2, (uint32_t)ENCODER_NOISE_TEST_MAX_SAMPLES);
+
+    // Pause the correction, the coils hold the rotor where it is
+    disableMotorTimers();
+    initCycleCounter();
+    uint32_t settleStart = millis();
+    while ((millis() - settleStart) < ENCODER_NOISE_TEST_SETTLE_TIME) {
+        #ifdef ENABLE_WATCHDOG
+            watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+            serviceWatchdog();
+        #endif
+    }
+
+    // Statistics of the angles (from the first good one) and of the transactions
+    bool referenceFound = false;
+    uint16_t reference = 0;
+    int64_t total = 0;
+    int64_t totalSquares = 0;
+    int32_t lowest = INT32_MAX;
+    int32_t highest = INT32_MIN;
+    uint32_t goodReads = 0;
+    uint32_t crcErrors = 0;
+    uint32_t otherErrors = 0;
+    cycleStats readCycles;
+    resetCycleStats(readCycles);
+
+    // Noise of the average that the firmware uses, found from the averages of consecutive blocks of readings
+    int64_t blockTotal = 0;
+    uint32_t blockCount = 0;
+    int32_t lowestAverage = INT32_MAX;
+    int32_t highestAverage = INT32_MIN;
+
+    // Read at the control loop's rate, so the encoder's filters see the same timing as they do in use
+    const uint32_t period = (1000000 / CONTROL_LOOP_FREQ);
+    uint32_t nextRead = micros();
+    for (uint32_t sampleIndex = 0; sampleIndex < samples; sampleIndex++) {
+        while ((int32_t)(micros() - nextRead) < 0);
+        nextRead += period;
+
+        // Time the transaction itself
+        uint32_t startCycles = getCycleCount();
+        errorTypes error = motor.encoder.sample();
+        addCycleStats(readCycles, getCycleCount() - startCycles);
+
+        // Only good reads are published, so the newest sample is the one just taken
+        if (error != NO_ERROR) {
+            if (error == CRC_ERROR) {
+                crcErrors++;
+            }
+            else {
+                otherErrors++;
+            }
+            continue;
+        }
+        uint16_t increments = motor.encoder.getRecentSample(period).rawAngle;
+        if (!referenceFound) {
+            reference = increments;
+            referenceFound = true;
+        }
+        int32_t distance = incrementsFrom(increments, reference);
+        total += distance;
+        totalSquares += ((int64_t)distance * distance);
+        lowest = min(lowest, distance);
+        highest = max(highest, distance);
+        goodReads++;
+
+        // Close a block once it holds the filter's worth of readings
+        blockTotal += distance;
+        if (++blockCount == ANGLE_AVG_READINGS) {
+            int32_t average = (int32_t)(blockTotal / ANGLE_AVG_READINGS);
+            lowestAverage = min(lowestAverage, average);
+            highestAverage = max(highestAverage, average);
+            blockTotal = 0;
+            blockCount = 0;
+        }
+
+        // The main loop is held up until the test finishes, so it has to keep the watchdog fed
+        #ifdef ENABLE_WATCHDOG
+            watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+            serviceWatchdog();
+        #endif
+    }
+
+    // Give the motor back, the correction picks up from where the rotor is
+    enableMotorTimers();
+
+    // Nothing to report if none of the reads worked
+    uint32_t cyclesPerMicro = (SystemCoreClock / 1000000);
+    String timing = " | SPI: " + String((float)readCycles.min / cyclesPerMicro, 1) + "/" +
+                    String((float)readCycles.total / readCycles.count / cyclesPerMicro, 1) + "/" +
+                    String((float)readCycles.max / cyclesPerMicro, 1) + F(" us (min/avg/max)");
+    String errors = " | CRC errors: " + String(crcErrors) + F(" | Other errors: ") + String(otherErrors) + F(" | Error rate: ") +
+                    String(100.0f * (crcErrors + otherErrors) / samples, 3) + "%";
+    if (goodReads < 2) {
+        return ("Samples: " + String(samples) + F(" | No good reads") + errors + timing);
+    }
+
+    // Spread of the angles, in counts and degrees
+    float mean = ((float)total / goodReads);
+    float deviation = sqrt(max(((float)totalSquares / goodReads) - (mean * mean), 0.0f));
+    String averaged = (highestAverage >= lowestAverage ? String(highestAverage - lowestAverage) : String(F("-")));
+    return ("Samples: " + String(samples) + F(" | Noise: ") + String(deviation, 2) + F(" counts (") + String(deviation * 360 / ENCODER_COUNTS_PER_REV, 4) +
+            F(" deg) | Peak to peak: ") + String(highest - lowest) + F(" counts | Peak to peak of ") + String(ANGLE_AVG_READINGS) + F(" averaged: ") +
+            averaged + F(" counts") + errors + timing);
+}
+
+#endif // ! ENABLE_ENCODER_NOISE_TEST
@@ -0,0 +1,27 @@
+#ifndef __ENCODER_NOISE_TEST_H__
+#define __ENCODER_NOISE_TEST_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the noise test is enabled
+#ifdef ENABLE_ENCODER_NOISE_TEST
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Characterization of the encoder and its magnet
+// The correction is paused so the coils hold the rotor still, then raw samples are read at the control loop's rate
+// The spread of the angles is the noise that the filters (ANGLE_AVG_READINGS) and the PID have to live with, and the time of each SPI transaction
+// is what the control loop has to fit around, so the two show which filter lengths and loop rates a board can run
+
+// Parks the motor and reads the samples, then gives the motor back (blocks until the test is done)
+// Samples is the number of reads to take, 0 uses ENCODER_NOISE_TEST_SAMPLES
+// Returns the noise of the angle (standard deviation, peak to peak, and after ANGLE_AVG_READINGS), the errors of the reads, and the time of the SPI transactions
+String runEncoderNoiseTest(uint32_t samples);
+
+#endif // ! ENABLE_ENCODER_NOISE_TEST
+#endif // ! __ENCODER_NOISE_TEST_H__
@@ -24,6 +24,10 @@ analogInfo analogSetup(PinName pin, uint32_t freq, uint32_t startingValue) {
     // Get the channel for the pin, then set that in the analogInfo as well
     pinInfo.channel = STM_PIN_CHANNEL(pinmap_function(pin, PinMap_PWM));
 
+    // Save the compare register of the channel (CCR1 to CCR4 are next to each other)
+    pinInfo.instance = Instance;
+    pinInfo.CCR = &(Instance -> CCR1) + (pinInfo.channel - 1);
+
     // Return the analogInfo
     return pinInfo;
 }
@@ -38,4 +42,30 @@ void analogSet(analogInfo* pinInfo, uint32_t value) {
 
     // Only need to set the capture compare
     pinInfo->HTPointer->setCaptureCompare(pinInfo->channel, value, PWM_COMPARE_FORMAT);
+}
+
+
+// Sets the PWM frequency of the pin's timer again from its clock
+// The compare values aren't rescaled, the next write sets them for the new period
+void analogSetFreq(const analogInfo* pinInfo, uint32_t freq) {
+    pinInfo->HTPointer->setOverflow(freq, HERTZ_FORMAT);
+}
+
+
+// Finds the period (timer ticks) of a PWM frequency on the pin's timer, with its current prescaler
+uint32_t analogGetPeriod(const analogInfo* pinInfo, uint32_t freq) {
+    uint32_t period = pinInfo->HTPointer->getTimerClkFreq() / ((pinInfo->instance->PSC + 1) * freq);
+    return constrain(period, 1, 0x10000);
+}
+
+
+// Converts a value (0 to PWM_MAX_VALUE) to timer ticks for the compare register
+// Uses the same scaling as setCaptureCompare() does with PWM_COMPARE_FORMAT
+uint32_t analogToTicks(const analogInfo* pinInfo, uint32_t value) {
+
+    // Check to make sure that the value is between 0 and PWM_MAX_VALUE
+    value = constrain(value, 0, PWM_MAX_VALUE);
+
+    // Scale the value by the period of the timer
+    return ((value * (pinInfo->instance->ARR + 1)) >> PWM_COMPARE_FORMAT);
 }
\ No newline at end of file
@@ -15,10 +15,33 @@ class analogInfo {
         PinName pin;
         HardwareTimer *HTPointer;
         uint32_t channel;
+
+        // The timer and the compare register of the channel (used for direct writes)
+        TIM_TypeDef *instance;
+        __IO uint32_t *CCR;
 };
 
 // Functions
 analogInfo analogSetup(PinName pin, uint32_t freq, uint32_t startingValue);
 void analogSet(analogInfo* pinInfo, uint32_t value);
 
+// Sets the PWM frequency of the pin's timer again from its clock (needed after the system clock is changed)
+void analogSetFreq(const analogInfo* pinInfo, uint32_t freq);
+
+// Finds the period (timer ticks) of a PWM frequency on the pin's timer, with its current prescaler
+uint32_t analogGetPeriod(const analogInfo* pinInfo, uint32_t freq);
+
+// Converts a value (0 to PWM_MAX_VALUE) to timer ticks for the compare register
+uint32_t analogToTicks(const analogInfo* pinInfo, uint32_t value);
+
+// Writes timer ticks straight to the compare register (no checks or conversions, used in the step path)
+static inline void analogSetTicks(const analogInfo* pinInfo, uint32_t ticks) {
+    *(pinInfo->CCR) = ticks;
+}
+
+// Writes the period (timer ticks) of the pin's timer, taking effect at the next update event if the auto reload preload is on
+static inline void analogSetPeriod(const analogInfo* pinInfo, uint32_t period) {
+    pinInfo->instance->ARR = (period - 1);
+}
+
 #endif // ! __FAST_ANALOG_WRITE__
\ No newline at end of file
@@ -7,11 +7,49 @@
 // For all of the config options
 #include "config.h"
 
+// Electrical phase (a full electrical cycle, meaning 4 full steps, is 2^PHASE_POWER)
+#define PHASE_POWER          16
+#define PHASE_PER_CYCLE      ((uint32_t)1 << PHASE_POWER)
+#define PHASE_PER_FULL_STEP  (PHASE_PER_CYCLE / 4)
+
+// Bits of the phase that are interpolated between quarter table entries
+#define SINE_INTERP_POWER    (PHASE_POWER - 2 - SINE_QUARTER_POWER)
+#if SINE_QUARTER_POWER > (PHASE_POWER - 2)
+    #error SINE_QUARTER_POWER cannot have more resolution than the phase
+#endif
+
 // Public variables
-extern const int16_t sineTable[SINE_VAL_COUNT];
+// Quarter of a sine wave, with padding at the end for the interpolation
+extern const int16_t sineQuarterTable[SINE_QUARTER_COUNT + 2];
+
+// Returns the distance into the quarter wave of a phase (mirrored in the second and fourth quarters)
+static inline uint16_t sineQuarterPhase(uint16_t phase) {
+    uint16_t quarterPhase = phase & ((PHASE_PER_CYCLE / 4) - 1);
+    if (phase & (PHASE_PER_CYCLE / 4)) {
+        quarterPhase = (PHASE_PER_CYCLE / 4) - quarterPhase;
+    }
+    return quarterPhase;
+}
 
 // Main functions
-#define fastSin(angle) (sineTable[angle])
-#define fastCos(angle) (sineTable[(angle + (SINE_VAL_COUNT / 4)) & (SINE_VAL_COUNT - 1)])
+// Sine of an electrical phase, interpolated between the table entries (SINE_MAX == 1)
+static inline int16_t fastSinPhase(uint16_t phase) {
+
+    // Find the entry and how far past it the phase is
+    uint16_t quarterPhase = sineQuarterPhase(phase);
+    uint16_t index = quarterPhase >> SINE_INTERP_POWER;
+    int32_t fraction = quarterPhase & ((1 << SINE_INTERP_POWER) - 1);
+
+    // Interpolate to the next entry
+    int32_t value = sineQuarterTable[index] + (((sineQuarterTable[index + 1] - sineQuarterTable[index]) * fraction) >> SINE_INTERP_POWER);
+
+    // The second half of the wave is negative
+    return ((phase & (PHASE_PER_CYCLE / 2)) ? -value : value);
+}
+
+// Cosine of an electrical phase (the sine a quarter cycle ahead)
+static inline int16_t fastCosPhase(uint16_t phase) {
+    return fastSinPhase(phase + (PHASE_PER_CYCLE / 4));
+}
 
 #endif // !__FAST_SINE_H__
\ No newline at end of file
@@ -0,0 +1,293 @@
+/*
+ *  Low latency filters
+ *  Drop-in alternatives to MovingAverage (same add(), get(), getDouble(), getLast(), and clear() interface),
+ *  so that each of the encoder's signals can trade noise against lag in config.h
+ *  Created by Christian Piper (CAP1Sup)
+ */
+
+#pragma once
+
+// Standard naming conventions
+#include "stdint.h"
+
+// For picking the type of the filter state
+#include <type_traits>
+
+// Trig for the biquad's coefficients
+#include "math.h"
+
+
+// First order IIR (exponential) filter, y += (x - y) / 2^SHIFT
+// The coefficient is a shift, so integer readings are filtered without any multiplies or divides
+// Integer readings keep 8 extra fractional bits of state, so small changes aren't rounded away
+// Lag is about 2^SHIFT samples, but a step starts showing up on the very next sample (unlike a boxcar)
+template <typename T, uint8_t SHIFT>
+class IIRFilter {
+  private:
+    static constexpr uint8_t FRACTION_BITS = (std::is_integral<T>::value ? 8 : 0);
+
+    // Integer state is fixed point, 32 bits for small readings and 64 bits otherwise
+    typedef typename std::conditional<std::is_integral<T>::value,
+        typename std::conditional<(sizeof(T) < 4), int32_t, int64_t>::type,
+        T>::type state_t;
+    state_t state = 0;
+    T lastReading = 0;
+    bool primed = false;
+
+  public:
+    void add(T newReading);
+    T get();
+    double getDouble();
+    T getLast();
+    void clear();
+};
+
+
+// Add a value to the filter
+template <typename T, uint8_t SHIFT>
+void IIRFilter<T, SHIFT>::add(T newReading) {
+
+    // The first reading primes the filter (no ramp from 0)
+    state_t scaledReading = ((state_t)newReading * (1 << FRACTION_BITS));
+    if (!primed) {
+        state = scaledReading;
+        primed = true;
+    }
+    else {
+        state += (scaledReading - state) / (1 << SHIFT);
+    }
+    lastReading = newReading;
+}
+
+
+// Get the filtered result
+template <typename T, uint8_t SHIFT>
+T IIRFilter<T, SHIFT>::get() {
+    return (T)(state / (1 << FRACTION_BITS));
+}
+
+
+// Get the filtered result as double type (includes the fractional bits)
+template <typename T, uint8_t SHIFT>
+double IIRFilter<T, SHIFT>::getDouble() {
+    return ((double)state / (1 << FRACTION_BITS));
+}
+
+
+// Gets the last reading
+template <typename T, uint8_t SHIFT>
+T IIRFilter<T, SHIFT>::getLast() {
+    return lastReading;
+}
+
+
+// Clears the filter (the next reading primes it again)
+template <typename T, uint8_t SHIFT>
+void IIRFilter<T, SHIFT>::clear() {
+    state = 0;
+    primed = false;
+}
+
+
+// Median of the last 3 readings
+// Rejects single sample spikes (ex. a bad SPI read) while only adding a sample of lag
+template <typename T>
+class Median3Filter {
+  private:
+    T readings[3] = {0, 0, 0};
+    uint8_t readingsPosition = 0;
+    uint8_t readingsNum = 0;
+
+  public:
+    void add(T newReading);
+    T get();
+    double getDouble();
+    T getLast();
+    void clear();
+};
+
+
+// Add a value to the filter
+template <typename T>
+void Median3Filter<T>::add(T newReading) {
+
+    // The first reading fills the window, so the median is right from the start
+    if (readingsNum == 0) {
+        readings[0] = readings[1] = readings[2] = newReading;
+        readingsNum = 3;
+    }
+    readings[readingsPosition] = newReading;
+    readingsPosition = ((readingsPosition == 2) ? 0 : (readingsPosition + 1));
+}
+
+
+// Get the median of the last 3 readings
+template <typename T>
+T Median3Filter<T>::get() {
+    T a = readings[0];
+    T b = readings[1];
+    T c = readings[2];
+    if (a > b) {
+        T swap = a;
+        a = b;
+        b = swap;
+    }
+    // a <= b, the median is b clamped between a and c
+    return ((c < a) ? a : ((c > b) ? b : c));
+}
+
+
+// Get the median as double type
+template <typename T>
+double Median3Filter<T>::getDouble() {
+    return (double)get();
+}
+
+
+// Gets the last reading
+template <typename T>
+T Median3Filter<T>::getLast() {
+    return readings[(readingsPosition == 0) ? 2 : (readingsPosition - 1)];
+}
+
+
+// Clears the filter
+template <typename T>
+void Median3Filter<T>::clear() {
+    readingsNum = 0;
+    readingsPosition = 0;
+}
+
+
+// Math for the biquad, integer readings use Q14 coefficients and a 64 bit accumulator
+template <bool INTEGRAL>
+struct BiquadMath {
+    typedef int32_t coeff_t;
+    typedef int64_t accum_t;
+    static coeff_t toCoefficient(double value) { return (coeff_t)(value * (1 << 14) + (value >= 0 ? 0.5 : -0.5)); }
+    static accum_t scale(accum_t value) { return ((value + (1 << 13)) >> 14); }
+};
+template <>
+struct BiquadMath<false> {
+    typedef float coeff_t;
+    typedef float accum_t;
+    static coeff_t toCoefficient(double value) { return (coeff_t)value; }
+    static accum_t scale(accum_t value) { return value; }
+};
+
+
+// Second order (biquad) low pass filter, direct form I
+// Sharper than the IIR filter for the same lag. The cutoff is in thousandths of the sample rate (less than 500), so it can be picked in config.h
+// The coefficients are found once when the filter is built, or by setLowPass()
+template <typename T, uint16_t CUTOFF_PERMILLE>
+class BiquadFilter {
+  static_assert((CUTOFF_PERMILLE > 0) && (CUTOFF_PERMILLE < 500), "BiquadFilter cutoff must be between 0 and half of the sample rate");
+
+  private:
+    typedef BiquadMath<std::is_integral<T>::value> math;
+    typename math::coeff_t b0, b1, b2, a1, a2;
+
+    // Past inputs and outputs
+    T x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+    T lastReading = 0;
+    bool primed = false;
+
+  public:
+    BiquadFilter() { setLowPass(CUTOFF_PERMILLE, 1000); }
+    void setLowPass(float cutoffFreq, float sampleFreq, float q = 0.7071f);
+    void add(T newReading);
+    T get();
+    double getDouble();
+    T getLast();
+    void clear();
+};
+
+
+// Sets the filter up as a low pass (Butterworth with the default Q), only needs to be done once since it uses float math
+template <typename T, uint16_t CUTOFF_PERMILLE>
+void BiquadFilter<T, CUTOFF_PERMILLE>::setLowPass(float cutoffFreq, float sampleFreq, float q) {
+
+    // Standard bilinear transform coefficients
+    double omega = 2.0 * 3.14159265358979 * cutoffFreq / sampleFreq;
+    double alpha = sin(omega) / (2.0 * q);
+    double cosOmega = cos(omega);
+    double a0 = 1.0 + alpha;
+
+    // Normalize to a0
+    b0 = math::toCoefficient(((1.0 - cosOmega) / 2.0) / a0);
+    b1 = math::toCoefficient((1.0 - cosOmega) / a0);
+    b2 = b0;
+    a1 = math::toCoefficient((-2.0 * cosOmega) / a0);
+    a2 = math::toCoefficient((1.0 - alpha) / a0);
+}
+
+
+// Add a value to the filter
+template <typename T, uint16_t CUTOFF_PERMILLE>
+void BiquadFilter<T, CUTOFF_PERMILLE>::add(T newReading) {
+
+    // The first reading primes the history, so the filter starts settled
+    if (!primed) {
+        x1 = x2 = y1 = y2 = newReading;
+        primed = true;
+    }
+
+    // Find the next output
+    typename math::accum_t accum = ((typename math::accum_t)b0 * newReading) + ((typename math::accum_t)b1 * x1) + ((typename math::accum_t)b2 * x2)
+                                 - ((typename math::accum_t)a1 * y1) - ((typename math::accum_t)a2 * y2);
+
+    // Shift the history
+    x2 = x1;
+    x1 = newReading;
+    y2 = y1;
+    y1 = (T)math::scale(accum);
+    lastReading = newReading;
+}
+
+
+// Get the filtered result
+template <typename T, uint16_t CUTOFF_PERMILLE>
+T BiquadFilter<T, CUTOFF_PERMILLE>::get() {
+    return y1;
+}
+
+
+// Get the filtered result as double type
+template <typename T, uint16_t CUTOFF_PERMILLE>
+double BiquadFilter<T, CUTOFF_PERMILLE>::getDouble() {
+    return (double)y1;
+}
+
+
+// Gets the last reading
+template <typename T, uint16_t CUTOFF_PERMILLE>
+T BiquadFilter<T, CUTOFF_PERMILLE>::getLast() {
+    return lastReading;
+}
+
+
+// Clears the filter (the next reading primes it again)
+template <typename T, uint16_t CUTOFF_PERMILLE>
+void BiquadFilter<T, CUTOFF_PERMILLE>::clear() {
+    primed = false;
+}
+
+
+// Runs one filter into another (ex. Median3Filter into an IIRFilter rejects spikes and then smooths)
+template <typename T, typename FIRST, typename SECOND>
+class CascadedFilter {
+  private:
+    FIRST first;
+    SECOND second;
+
+  public:
+    void add(T newReading) { first.add(newReading); second.add(first.get()); }
+    T get() { return second.get(); }
+    double getDouble() { return second.getDouble(); }
+    T getLast() { return first.getLast(); }
+    void clear() { first.clear(); second.clear(); }
+
+    // Access to the stages (ex. to set up a biquad)
+    FIRST& getFirst() { return first; }
+    SECOND& getSecond() { return second; }
+};
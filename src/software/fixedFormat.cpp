@@ -0,0 +1,89 @@
+// Import the header file
+#include "fixedFormat.h"
+
+
+// Writes value / 10^decimals as a decimal number, right aligned to width characters
+uint8_t formatFixed(char* buffer, uint8_t size, int32_t value, uint8_t decimals, uint8_t width, uint8_t flags) {
+
+    // Nothing fits without room for the terminator
+    if (size == 0) {
+        return 0;
+    }
+
+    // Build the digits backwards, from the last decimal to the first whole digit (there is always one whole digit)
+    char digits[16];
+    uint8_t digitCount = 0;
+    uint32_t magnitude = (value < 0 ? (0 - (uint32_t)value) : (uint32_t)value);
+    decimals = min(decimals, (uint8_t)(sizeof(digits) - 2));
+    uint8_t minDigits = (decimals > 0 ? (decimals + 2) : 1);
+    do {
+        if (decimals > 0 && digitCount == decimals) {
+            digits[digitCount++] = '.';
+            continue;
+        }
+        digits[digitCount++] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while ((magnitude > 0 || digitCount < minDigits) && digitCount < sizeof(digits));
+
+    // Find the sign, then how much padding is needed to reach the width
+    char sign = 0;
+    if (value < 0) {
+        sign = '-';
+    }
+    else if (flags & FORMAT_SIGN_SPACE) {
+        sign = ' ';
+    }
+    uint8_t length = digitCount + (sign ? 1 : 0);
+    uint8_t padding = (width > length ? (width - length) : 0);
+
+    // Write out the padding, sign, and digits in order, stopping when the buffer is full
+    uint8_t written = 0;
+    uint8_t limit = (size - 1);
+    if (!(flags & FORMAT_ZERO_PAD)) {
+        while (padding > 0 && written < limit) {
+            buffer[written++] = ' ';
+            padding--;
+        }
+    }
+    if (sign && written < limit) {
+        buffer[written++] = sign;
+    }
+    while (padding > 0 && written < limit) {
+        buffer[written++] = '0';
+        padding--;
+    }
+    while (digitCount > 0 && written < limit) {
+        buffer[written++] = digits[--digitCount];
+    }
+
+    // Terminate the string
+    buffer[written] = '\0';
+    return written;
+}
+
+
+// Formats value / 10^decimals as a String
+String fixedString(int32_t value, uint8_t decimals) {
+    char buffer[16];
+    formatFixed(buffer, sizeof(buffer), value, decimals);
+    return String(buffer);
+}
+
+
+// Formats a float with the number of decimals
+String floatString(float value, uint8_t decimals) {
+
+    // Not a number, there is nothing to scale
+    if (value != value) {
+        return String(F("nan"));
+    }
+
+    // Scale the value up to the decimals, then round it to an integer
+    decimals = min(decimals, (uint8_t)9);
+    float scaled = value;
+    for (uint8_t decimal = 0; decimal < decimals; decimal++) {
+        scaled *= 10;
+    }
+    scaled = constrain(scaled, (float)INT32_MIN, (float)INT32_MAX);
+    return fixedString((int32_t)lroundf(scaled), decimals);
+}
@@ -0,0 +1,25 @@
+#ifndef __FIXED_FORMAT_H__
+#define __FIXED_FORMAT_H__
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Formatting of fixed point values with integer math only (there is no FPU, and printf's float support is large and slow)
+
+// Flags of the formatting
+#define FORMAT_NONE         0x00
+#define FORMAT_SIGN_SPACE   0x01 // Put a space in front of positive values, so that they line up with negative ones (like printf's "% ")
+#define FORMAT_ZERO_PAD     0x02 // Pad to the width with zeros after the sign, instead of spaces in front of it (like printf's "0")
+
+// Writes value / 10^decimals as a decimal number (ex. 12345 with 2 decimals is "123.45"), right aligned to width characters
+// The output is cut off to fit in size (including the terminator). Returns the number of characters written, without the terminator
+uint8_t formatFixed(char* buffer, uint8_t size, int32_t value, uint8_t decimals, uint8_t width = 0, uint8_t flags = FORMAT_NONE);
+
+// Formats value / 10^decimals as a String (for the text responses)
+String fixedString(int32_t value, uint8_t decimals);
+
+// Formats a float with the number of decimals (the same as String(float), without pulling in the float support of printf)
+// The value is rounded to the decimals, then held at the limits of an int32
+String floatString(float value, uint8_t decimals = 2);
+
+#endif // ! __FIXED_FORMAT_H__
@@ -0,0 +1,147 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_SENSORLESS_HOMING
+
+// Import the header file
+#include "homing.h"
+#include "timers.h"
+#include "calibration.h"
+#include "watchdog.h"
+
+// Time between the checks of the lead (the same as the correction period), and the checks that it has to stay past the limit
+#define HOMING_CHECK_PERIOD   (1000000 / CONTROL_LOOP_FREQ)
+#define HOMING_CONFIRM_CHECKS max((uint32_t)((HOMING_CONFIRM_TIME * CONTROL_LOOP_FREQ) / 1000000), (uint32_t)1)
+
+
+// Keeps the watchdog fed while the main loop is held up by the homing
+static void feedWatchdog() {
+    #ifdef ENABLE_WATCHDOG
+        watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+        serviceWatchdog();
+    #endif
+}
+
+
+// Gets the position of the rotor (microsteps, rounded to the nearest step)
+static int32_t getRotorSteps() {
+    int64_t scaledCounts = (int64_t)motor.encoder.getAbsoluteCountsAvg() * motor.getMicrostepsPerRotation();
+    return (int32_t)((scaledCounts + (ENCODER_COUNTS_PER_REV / 2)) >> ENCODER_COUNTS_POWER);
+}
+
+
+// Gets the lead of the coils over the rotor, less the error that was there at the start (microsteps)
+static int32_t getLead(int32_t startError) {
+    return abs((getRotorSteps() - motor.getSoftStepCNT()) - startError);
+}
+
+
+// Waits for the scheduled steps to finish, keeping the watchdog fed (returns false if they didn't finish in time)
+static bool waitForSteps(uint32_t timeout) {
+    uint32_t startTime = millis();
+    while (getRemainingScheduledSteps() > 0) {
+        if ((millis() - startTime) > timeout) {
+            disableStepScheduleTimer();
+            return false;
+        }
+        feedWatchdog();
+    }
+    return true;
+}
+
+
+// Homes the motor toward a direction at a rate, backing off by a number of steps afterward
+String runSensorlessHoming(STEP_DIR dir, uint32_t rate, uint32_t backoff) {
+
+    // The step schedule timer is shared with the moves and the calibration
+    if (isCalibrating()) {
+        return F("Homing can't run during the calibration");
+    }
+    #ifdef ENABLE_STEP_QUEUE
+    if (isStepQueueRunning()) {
+        return F("Homing can't run during a move");
+    }
+    #endif
+    if (getRemainingScheduledSteps() > 0) {
+        return F("Homing can't run during a move");
+    }
+
+    // The coils have to be driven for the rotor to push against the stop
+    if (motor.getState() != ENABLED && motor.getState() != FORCED_ENABLED) {
+        return F("Homing needs the motor to be enabled");
+    }
+    if (rate == 0) {
+        rate = HOMING_RATE;
+    }
+
+    // Take over the motor (the step pin and the correction), both come back once the motor has backed off
+    disableMotorTimers();
+
+    // The lead is measured from where the coils and the rotor start, so any error that was already there doesn't count
+    int32_t startSoftSteps = motor.getSoftStepCNT();
+    int32_t startError = getRotorSteps() - startSoftSteps;
+    int32_t leadLimit = (int32_t)(((int64_t)motor.getMicrostepping() * HOMING_STALL_LEAD) / 100);
+
+    // Move toward the stop, checking the lead every correction period until it stays past the limit
+    schedulePlannedSteps(HOMING_MAX_TRAVEL, rate, HOMING_ACCEL, DEFAULT_PLANNER_JERK, dir);
+    uint32_t startTime = millis();
+    uint32_t lastCheck = micros();
+    uint32_t confirmChecks = 0;
+    int32_t lead = 0;
+    while (confirmChecks < HOMING_CONFIRM_CHECKS) {
+
+        // Ran out of travel without finding the stop
+        if (getRemainingScheduledSteps() <= 0) {
+            enableMotorTimers();
+            return F("Stop not found within HOMING_MAX_TRAVEL");
+        }
+        feedWatchdog();
+
+        // Wait for the next check
+        if ((micros() - lastCheck) < HOMING_CHECK_PERIOD) {
+            continue;
+        }
+        lastCheck += HOMING_CHECK_PERIOD;
+
+        // The stop holds the rotor back while the coils keep moving, so the lead grows until the torque peaks
+        lead = getLead(startError);
+        confirmChecks = ((lead >= leadLimit) ? (confirmChecks + 1) : 0);
+    }
+
+    // Stop right away, the stop was found
+    disableStepScheduleTimer();
+    uint32_t seekTime = millis() - startTime;
+    int32_t travel = abs(motor.getSoftStepCNT() - startSoftSteps);
+
+    // Pull the coils back onto the rotor (without moving the desired position), then let the rotor settle against the stop
+    STEP_DIR backoffDir = (dir == COUNTER_CLOCKWISE ? CLOCKWISE : COUNTER_CLOCKWISE);
+    int32_t coilLead = getLead(startError);
+    for (int32_t step = 0; step < coilLead; step++) {
+        motor.step(backoffDir, false, false);
+    }
+    delay(HOMING_SETTLE_TIME);
+
+    // The stop is the new zero, for the encoder and both step counts
+    motor.resetPosition();
+
+    // Back off of the stop, so that the motor isn't left pushing on it
+    bool backedOff = true;
+    if (backoff > 0) {
+        schedulePlannedSteps(backoff, rate, HOMING_ACCEL, DEFAULT_PLANNER_JERK, backoffDir);
+        backedOff = waitForSteps(((backoff * 1000) / rate) + HOMING_BACKOFF_TIMEOUT);
+    }
+
+    // Give the motor back
+    enableMotorTimers();
+
+    // Report how far the stop was, and how hard the coils had to lead to find it
+    String report = "Homed | Travel: " + String(travel) + F(" steps | Time: ") + String(seekTime) + F(" ms | Lead: ") +
+                    String((lead * 100) / motor.getMicrostepping()) + F("% of a full step");
+    if (!backedOff) {
+        report += F(" | Back off didn't finish in time");
+    }
+    return report;
+}
+
+#endif // ! ENABLE_SENSORLESS_HOMING
@@ -0,0 +1,28 @@
+#ifndef __HOMING_H__
+#define __HOMING_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the sensorless homing is enabled
+#ifdef ENABLE_SENSORLESS_HOMING
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Sensorless homing against a hard stop
+// The motor moves toward the stop through the planner while the lead of the coils over the rotor is checked every correction period.
+// Once the rotor is held by the stop, the lead grows with every step until it reaches the torque peak (a full step),
+// so the stop is found as soon as the lead passes HOMING_STALL_LEAD for HOMING_CONFIRM_TIME.
+// The coils are pulled back onto the rotor, the position is zeroed there, then the motor backs off of the stop
+
+// Homes the motor toward a direction at a rate (steps/s), backing off by a number of steps afterward
+// Blocks until the motor has backed off. A rate of 0 uses HOMING_RATE
+// Returns the travel to the stop, or the reason that the stop wasn't found
+String runSensorlessHoming(STEP_DIR dir, uint32_t rate, uint32_t backoff);
+
+#endif // ! ENABLE_SENSORLESS_HOMING
+#endif // ! __HOMING_H__
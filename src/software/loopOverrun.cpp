@@ -0,0 +1,147 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_OVERRUN_DETECTION
+
+// Import the header file
+#include "loopOverrun.h"
+#include "profiler.h"
+#include "timers.h"
+
+// Fixed point format of the load (fraction of the loop's period, Q16)
+#define LOAD_Q_POWER       16
+#define LOAD_FULL          ((uint32_t)1 << LOAD_Q_POWER)
+
+// The load is filtered by 1/2^power every correction
+#define LOAD_FILTER_POWER  6
+
+// Loads that the level changes past (Q16), and the corrections that the load has to stay past them for
+#define DEGRADE_LOAD       ((OVERRUN_DEGRADE_LOAD * LOAD_FULL) / 100)
+#define RECOVER_LOAD       ((OVERRUN_RECOVER_LOAD * LOAD_FULL) / 100)
+#define HOLD_TICKS         ((OVERRUN_HOLD_TIME * CONTROL_LOOP_FREQ) / 1000)
+
+// The level of the work that is shed, with the filtered load and the corrections that it has stayed past the next level's threshold
+static volatile OVERLOAD_LEVEL overloadLevel = OVERLOAD_NONE;
+static uint32_t filteredLoad = 0;
+static uint32_t levelTicks = 0;
+
+// Position in the thinned out updates (they run when it is 0)
+static uint16_t decimationCount = 0;
+
+// Statistics (written by the correction)
+static uint32_t overruns = 0;
+static uint32_t maxCycles = 0;
+static uint32_t peakLoad = 0;
+static uint32_t shedEvents = 0;
+
+
+// Times the correction that started at the cycle count, then moves the level along with the load
+void RAMFUNC finishControlTick(uint32_t startCycles) {
+
+    // The next tick is already due if the timer updated again while this one ran (the time taken by the more urgent interrupts counts too)
+    uint32_t cycles = getCycleCount() - startCycles;
+    if (TIM1 -> SR & TIM_SR_UIF) {
+        overruns++;
+    }
+    maxCycles = max(maxCycles, cycles);
+
+    // Filter the load, held at 4 periods (and 16 bits) so that it fits the fixed point
+    uint32_t periodCycles = (SystemCoreClock / CONTROL_LOOP_FREQ);
+    cycles = min(cycles, min(4 * periodCycles, (uint32_t)0xFFFF));
+    int32_t load = (int32_t)((cycles << LOAD_Q_POWER) / periodCycles);
+    filteredLoad += ((load - (int32_t)filteredLoad) >> LOAD_FILTER_POWER);
+    peakLoad = max(peakLoad, filteredLoad);
+
+    // Shed the next level of work once the load has stayed high, bringing it back once the load has stayed low
+    OVERLOAD_LEVEL level = overloadLevel;
+    if (filteredLoad >= DEGRADE_LOAD && level < OVERLOAD_SHED) {
+        if (++levelTicks >= HOLD_TICKS) {
+            levelTicks = 0;
+            level = (OVERLOAD_LEVEL)(level + 1);
+            shedEvents++;
+
+            // The move being collected will have a gap in it
+            #ifdef ENABLE_MOVE_METRICS
+            if (level == OVERLOAD_SHED) {
+                abortMoveMetrics();
+            }
+            #endif
+        }
+    }
+    else if (filteredLoad < RECOVER_LOAD && level > OVERLOAD_NONE) {
+        if (++levelTicks >= HOLD_TICKS) {
+            levelTicks = 0;
+            level = (OVERLOAD_LEVEL)(level - 1);
+        }
+    }
+    else {
+        levelTicks = 0;
+    }
+    overloadLevel = level;
+
+    // Move through the thinned out updates
+    if (++decimationCount >= OVERRUN_DECIMATION) {
+        decimationCount = 0;
+    }
+}
+
+
+// Gets the level of the work that is shed
+OVERLOAD_LEVEL RAMFUNC getOverloadLevel() {
+    return overloadLevel;
+}
+
+
+// Returns if the slow updates should run in this correction
+bool RAMFUNC isSlowUpdateTick() {
+    return (overloadLevel == OVERLOAD_NONE || decimationCount == 0);
+}
+
+
+// Gets a report of the load
+String getOverrunReport() {
+
+    // Copy the statistics out of the correction's hands
+    disableInterrupts();
+    OVERLOAD_LEVEL level = overloadLevel;
+    uint32_t load = filteredLoad;
+    uint32_t peak = peakLoad;
+    uint32_t worstCycles = maxCycles;
+    uint32_t overrunCount = overruns;
+    uint32_t shedCount = shedEvents;
+    enableInterrupts();
+
+    // Name the level
+    String report = F("Level: ");
+    switch (level) {
+        case OVERLOAD_THINNED:
+            report += F("thinned");
+            break;
+        case OVERLOAD_SHED:
+            report += F("shed");
+            break;
+        default:
+            report += F("none");
+            break;
+    }
+
+    // The loads are in % of the loop's period
+    uint32_t periodCycles = (SystemCoreClock / CONTROL_LOOP_FREQ);
+    return (report + F(" | Load: ") + String((load * 100) >> LOAD_Q_POWER) + F("% (peak ") + String((peak * 100) >> LOAD_Q_POWER) +
+            F("%) | Longest correction: ") + String(worstCycles) + F(" cycles (") + String((worstCycles * 100) / periodCycles) +
+            F("% of the period) | Overruns: ") + String(overrunCount) + F(" | Times shed: ") + String(shedCount));
+}
+
+
+// Clears the statistics
+void clearOverrunStats() {
+    disableInterrupts();
+    overruns = 0;
+    maxCycles = 0;
+    peakLoad = filteredLoad;
+    shedEvents = 0;
+    enableInterrupts();
+}
+
+#endif // ! ENABLE_OVERRUN_DETECTION
@@ -0,0 +1,50 @@
+#ifndef __LOOP_OVERRUN_H__
+#define __LOOP_OVERRUN_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the overrun detection is enabled
+#ifdef ENABLE_OVERRUN_DETECTION
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Overrun detection of the control loop
+// Each correction is timed with the cycle counter, and counted as an overrun if TIM1 already updated again by the time that it finished
+// The runtime is filtered into a load (of the loop's period). While it stays high, the work that isn't needed to hold the position is shed in steps
+
+// Levels of the work that is shed, in the order that they are reached
+typedef enum {
+    OVERLOAD_NONE,      // Everything runs
+    OVERLOAD_THINNED,   // The display isn't refreshed, and the slow current and PWM updates only run every OVERRUN_DECIMATION corrections
+    OVERLOAD_SHED       // The trace and the move metrics are also left out
+} OVERLOAD_LEVEL;
+
+// Times the correction that started at the cycle count, then moves the level along with the load (called at the end of every correction)
+void finishControlTick(uint32_t startCycles);
+
+// Gets the level of the work that is shed
+OVERLOAD_LEVEL getOverloadLevel();
+
+// Returns if the slow updates should run in this correction (always, unless the work is being thinned out)
+bool isSlowUpdateTick();
+
+// Gets a report of the load (the level, the load and its peak, the longest correction, the overruns, and the times that the work was shed)
+String getOverrunReport();
+
+// Clears the statistics (the level and the load are kept, they follow the loop)
+void clearOverrunStats();
+
+// Checks for the corrections (the slow updates, and the instrumentation that is left out once the work is shed)
+#define SLOW_UPDATE_DUE()      isSlowUpdateTick()
+#define INSTRUMENTATION_DUE()  (getOverloadLevel() < OVERLOAD_SHED)
+
+#else
+#define SLOW_UPDATE_DUE()      true
+#define INSTRUMENTATION_DUE()  true
+#endif // ! ENABLE_OVERRUN_DETECTION
+#endif // ! __LOOP_OVERRUN_H__
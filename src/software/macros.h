@@ -51,5 +51,9 @@
 #define GPIO_WRITE_REGISTER_SET          4
 #define GPIO_WRITE_HAL_FUNCTION          5
 
+// Table for OLED transports
+#define OLED_TRANSPORT_BITBANG  0
+#define OLED_TRANSPORT_SPI2_DMA 1
+
 
 #endif // ! __MACROS_H__
\ No newline at end of file
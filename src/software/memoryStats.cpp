@@ -0,0 +1,82 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_MEMORY_STATS
+
+// Import the header file
+#include "memoryStats.h"
+
+// Heap statistics (mallinfo()) and the end of the heap (sbrk())
+#include <malloc.h>
+#include <unistd.h>
+
+// Bounds of the RAM from the linker script
+extern "C" uint32_t _sdata;
+extern "C" uint32_t _estack;
+extern "C" uint32_t _end;
+
+// Lowest word that was painted
+static uint32_t* paintStart = nullptr;
+
+
+// Finds the end of the heap, rounded up to a whole word
+static uint32_t* getHeapEnd() {
+    return (uint32_t*)(((uint32_t)sbrk(0) + 3) & ~(uint32_t)3);
+}
+
+
+// Paints the free RAM between the heap and the stack
+void paintStack() {
+
+    // An interrupt would push its frame into the RAM being painted
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // Leave a margin below the stack pointer for the frame of this function
+    uint32_t* word = getHeapEnd();
+    uint32_t* stackEnd = (uint32_t*)((__get_MSP() - STACK_PAINT_MARGIN) & ~(uint32_t)3);
+    paintStart = word;
+    while (word < stackEnd) {
+        *word++ = STACK_PAINT_PATTERN;
+    }
+
+    // Restore the interrupts as they were
+    __set_PRIMASK(primask);
+}
+
+
+// Finds the use of the RAM
+void getMemoryStats(memoryStats &stats) {
+
+    // The static variables and the heap are fixed by where they end
+    uint32_t* heapEnd = getHeapEnd();
+    struct mallinfo heap = mallinfo();
+    stats.total = ((uint32_t)&_estack - (uint32_t)&_sdata);
+    stats.staticBytes = ((uint32_t)&_end - (uint32_t)&_sdata);
+    stats.heapBytes = ((uint32_t)heapEnd - (uint32_t)&_end);
+    stats.heapInUse = heap.uordblks;
+    stats.stackNow = ((uint32_t)&_estack - __get_MSP());
+
+    // The heap may have grown over the bottom of the painted RAM, the stack ends at the first word that isn't painted above it
+    uint32_t* word = max(paintStart, heapEnd);
+    uint32_t* stackEnd = (uint32_t*)__get_MSP();
+    uint32_t* firstWord = word;
+    while (word < stackEnd && *word == STACK_PAINT_PATTERN) {
+        word++;
+    }
+    stats.neverUsed = ((uint32_t)word - (uint32_t)firstWord);
+    stats.stackMax = max(((uint32_t)&_estack - (uint32_t)word), stats.stackNow);
+}
+
+
+// Gets a summary of the use of the RAM
+String getMemoryReport() {
+    memoryStats stats;
+    getMemoryStats(stats);
+    return ("RAM: " + String(stats.total) + F(" | Static: ") + String(stats.staticBytes) + F(" | Heap: ") + String(stats.heapBytes) +
+            F(" (") + String(stats.heapInUse) + F(" in use) | Stack: ") + String(stats.stackNow) + F(" (max ") + String(stats.stackMax) +
+            F(") | Never used: ") + String(stats.neverUsed) + F(" bytes"));
+}
+
+#endif // ! ENABLE_MEMORY_STATS
@@ -0,0 +1,37 @@
+#ifndef __MEMORY_STATS_H__
+#define __MEMORY_STATS_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the memory statistics are enabled
+#ifdef ENABLE_MEMORY_STATS
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Use of the RAM
+// The static variables (.data and .bss) come first, then the heap grows up from their end and the stack grows down from the end of the RAM
+// The interrupts run on the same stack as the main loop, so the deepest point of the stack includes the deepest nesting of the interrupts so far
+// The free RAM between the heap and the stack is painted at boot, the painted words that are still intact were never reached by either
+typedef struct {
+    uint32_t total;         // RAM of the chip (bytes)
+    uint32_t staticBytes;   // .data and .bss, including the functions run from RAM
+    uint32_t heapBytes;     // Heap taken from the system so far (the heap never gives RAM back)
+    uint32_t heapInUse;     // Heap that is allocated right now
+    uint32_t stackNow;      // Depth of the stack where it was read
+    uint32_t stackMax;      // Deepest that the stack has been since boot
+    uint32_t neverUsed;     // Painted RAM that is still intact (the margin between the heap and the stack)
+} memoryStats;
+
+// Paints the free RAM between the heap and the stack (called first thing in setup(), with the interrupts masked while it runs)
+void paintStack();
+
+// Finds the use of the RAM (scans the painted RAM, so it takes a few hundred µs)
+void getMemoryStats(memoryStats &stats);
+
+// Gets a summary of the use of the RAM
+String getMemoryReport();
+
+#endif // ! ENABLE_MEMORY_STATS
+#endif // ! __MEMORY_STATS_H__
@@ -0,0 +1,187 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_MOVE_METRICS
+
+// Import the header file
+#include "moveMetrics.h"
+#include "timers.h"
+
+// Times of the move detection (in corrections)
+#define MOVE_END_TICKS     ((MOVE_METRICS_END_TIME * CONTROL_LOOP_FREQ) / 1000)
+#define MOVE_HOLD_TICKS    ((MOVE_METRICS_SETTLE_HOLD * CONTROL_LOOP_FREQ) / 1000)
+#define MOVE_LIMIT_TICKS   ((MOVE_METRICS_SETTLE_LIMIT * CONTROL_LOOP_FREQ) / 1000)
+
+// Fixed point format of the lead (full steps, Q20.12), a full step of lead is 90 electrical degrees
+#define MOVE_LEAD_Q_POWER  12
+
+// Largest error that is squared (microsteps), so the square fits in 32 bits
+#define MOVE_ERROR_LIMIT   0xFFFF
+
+// Phases of a move
+typedef enum {
+    MOVE_IDLE,      // Waiting for the first step
+    MOVE_RUNNING,   // Stepping, the error is being collected
+    MOVE_SETTLING   // The steps stopped, waiting for the error to settle
+} MOVE_PHASE;
+
+// The move being collected, and the corrections since its last step and since the error last left the settle band
+static moveMetrics currentMove;
+static MOVE_PHASE movePhase = MOVE_IDLE;
+static int32_t lastStepCount = 0;
+static uint32_t quietTicks = 0;
+static uint32_t settledTicks = 0;
+
+// Leftover of the corrective step rate (steps/s accumulated every correction)
+static uint32_t correctionRateAccumulator = 0;
+
+// The last finished move, along with the totals of the moves since they were cleared (written by the correction)
+static moveMetrics lastMove;
+static bool lastMoveValid = false;
+static uint32_t moveCount = 0;
+static uint32_t unsettledMoves = 0;
+static uint32_t worstPeakError = 0;
+static uint32_t worstSettleTicks = 0;
+
+
+// Finishes the move that is being collected, saving it as the last move
+static void finishMove(uint32_t settleTicks) {
+    currentMove.settleTicks = settleTicks;
+    lastMove = currentMove;
+    lastMoveValid = true;
+    moveCount++;
+    worstPeakError = max(worstPeakError, currentMove.peakError);
+    if (settleTicks == UINT32_MAX) {
+        unsettledMoves++;
+    }
+    else {
+        worstSettleTicks = max(worstSettleTicks, settleTicks);
+    }
+    movePhase = MOVE_IDLE;
+}
+
+
+// Updates the metrics with the step error of this correction
+void RAMFUNC updateMoveMetrics(int32_t stepError) {
+
+    // A change of the commanded position is a step (the first one starts a move, one while settling starts the next move)
+    int32_t stepCount = motor.getHardStepCNT();
+    bool stepped = (stepCount != lastStepCount);
+    lastStepCount = stepCount;
+    uint32_t error = (uint32_t)min(abs(stepError), (int32_t)MOVE_ERROR_LIMIT);
+
+    // The move before is cut off by the new one, it never got to settle
+    if (stepped && movePhase == MOVE_SETTLING) {
+        finishMove(UINT32_MAX);
+    }
+    if (stepped && movePhase == MOVE_IDLE) {
+        currentMove = { 0, 0, 0, 0, 0, 0, 0, (uint16_t)motor.getMicrostepping() };
+        movePhase = MOVE_RUNNING;
+        quietTicks = 0;
+    }
+
+    // Collect the following error of the move
+    if (movePhase == MOVE_RUNNING) {
+        if (stepped) {
+            currentMove.ticks += (quietTicks + 1);
+            quietTicks = 0;
+        }
+        else if (++quietTicks >= MOVE_END_TICKS) {
+
+            // The steps stopped, the error still has to settle (counted from the last step)
+            movePhase = MOVE_SETTLING;
+            settledTicks = 0;
+        }
+        currentMove.samples++;
+        currentMove.squaredError += (error * error);
+        currentMove.peakError = max(currentMove.peakError, error);
+        currentMove.maxLead = max(currentMove.maxLead, (error << MOVE_LEAD_Q_POWER) / currentMove.microstepping);
+    }
+
+    // Wait for the error to stay within the band for the hold time
+    else if (movePhase == MOVE_SETTLING) {
+        quietTicks++;
+        settledTicks = ((error <= MOVE_METRICS_SETTLE_STEPS) ? (settledTicks + 1) : 0);
+        if (settledTicks >= MOVE_HOLD_TICKS) {
+            finishMove(quietTicks - settledTicks);
+        }
+        else if (quietTicks >= MOVE_LIMIT_TICKS) {
+            finishMove(UINT32_MAX);
+        }
+    }
+}
+
+
+// Drops the move that is being collected
+void abortMoveMetrics() {
+    movePhase = MOVE_IDLE;
+    lastStepCount = motor.getHardStepCNT();
+    correctionRateAccumulator = 0;
+}
+
+
+// Counts whole corrective steps
+void RAMFUNC countMoveCorrections(uint32_t steps) {
+    if (movePhase != MOVE_IDLE) {
+        currentMove.corrections += steps;
+    }
+}
+
+
+// Counts the corrective steps of a rate over a correction (steps/s), keeping the fraction for the next one
+void RAMFUNC countMoveCorrectionRate(uint32_t stepFreq) {
+    correctionRateAccumulator += stepFreq;
+    uint32_t steps = correctionRateAccumulator / CONTROL_LOOP_FREQ;
+    correctionRateAccumulator -= (steps * CONTROL_LOOP_FREQ);
+    countMoveCorrections(steps);
+}
+
+
+// Returns the metrics of the last move, and the totals of the moves since the metrics were cleared
+String getMoveMetricsReport() {
+
+    // Copy the metrics out of the correction's hands
+    disableInterrupts();
+    moveMetrics move = lastMove;
+    bool moveValid = lastMoveValid;
+    uint32_t moves = moveCount;
+    uint32_t unsettled = unsettledMoves;
+    uint32_t worstPeak = worstPeakError;
+    uint32_t worstSettle = worstSettleTicks;
+    enableInterrupts();
+
+    // Nothing to report on until a move has finished
+    String report = F("Moves: ") + String(moves) + F(" (") + String(unsettled) + F(" unsettled) | Worst peak error: ") + String(worstPeak) +
+                    F(" steps | Worst settle: ") + String((worstSettle * 1000) / CONTROL_LOOP_FREQ) + F(" ms");
+    if (!moveValid) {
+        return report;
+    }
+
+    // The RMS error is found here instead of in the correction (not time critical)
+    float rmsError = sqrt((float)move.squaredError / max(move.samples, (uint32_t)1));
+    report += F(" | Last move: ") + String((move.ticks * 1000) / CONTROL_LOOP_FREQ) + F(" ms, RMS error: ") + String(rmsError, 2) +
+              F(" steps, peak error: ") + String(move.peakError) + F(" steps, corrections: ") + String(move.corrections) +
+              F(" steps, max lead: ") + String(((float)move.maxLead * 90) / (1 << MOVE_LEAD_Q_POWER), 1) + F(" deg, settle: ");
+    if (move.settleTicks == UINT32_MAX) {
+        report += F("unsettled");
+    }
+    else {
+        report += String((move.settleTicks * 1000) / CONTROL_LOOP_FREQ) + F(" ms");
+    }
+    return (report + F(" (1/") + String(move.microstepping) + F(" steps)"));
+}
+
+
+// Clears the last move and the totals
+void clearMoveMetrics() {
+    disableInterrupts();
+    lastMoveValid = false;
+    moveCount = 0;
+    unsettledMoves = 0;
+    worstPeakError = 0;
+    worstSettleTicks = 0;
+    enableInterrupts();
+}
+
+#endif // ! ENABLE_MOVE_METRICS
@@ -0,0 +1,45 @@
+#ifndef __MOVE_METRICS_H__
+#define __MOVE_METRICS_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the move metrics are enabled
+#ifdef ENABLE_MOVE_METRICS
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Motion quality of a move, collected by the correction with integer math
+typedef struct {
+    uint32_t ticks;             // Corrections from the first step to the last
+    uint32_t samples;           // Corrections that the following error was collected over (until the steps stopped)
+    uint64_t squaredError;      // Sum of the squared following error (microsteps^2)
+    uint32_t peakError;         // Largest following error (microsteps)
+    uint32_t corrections;       // Corrective steps issued (microsteps)
+    uint32_t maxLead;           // Largest lead of the coils over the rotor (full steps, Q20.12)
+    uint32_t settleTicks;       // Corrections from the last step until the error settled (UINT32_MAX if it didn't)
+    uint16_t microstepping;     // Microstepping of the move (for converting the errors)
+} moveMetrics;
+
+// Updates the metrics with the step error of this correction (called every correction that holds a position)
+void updateMoveMetrics(int32_t stepError);
+
+// Drops the move that is being collected (ex. when the motor is disabled)
+void abortMoveMetrics();
+
+// Counts corrective steps, whole steps or the steps of a rate over a correction (steps/s, from the step schedule timer)
+void countMoveCorrections(uint32_t steps);
+void countMoveCorrectionRate(uint32_t stepFreq);
+
+// Returns the metrics of the last move, and the moves since the metrics were cleared (with the worst peak error and settling time of them)
+String getMoveMetricsReport();
+
+// Clears the last move and the totals
+void clearMoveMetrics();
+
+#endif // ! ENABLE_MOVE_METRICS
+#endif // ! __MOVE_METRICS_H__
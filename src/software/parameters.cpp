@@ -0,0 +1,496 @@
+// Import the header file
+#include "parameters.h"
+#include "timers.h"
+#include "flash.h"
+#include "configCommit.h"
+#include "softLimits.h"
+#include "cfloat"
+
+// If a batch of parameters is being set (the settings that go together are held until it ends)
+static bool batching = false;
+
+// The block edited by the batch (nullptr until one of its parameters needs it)
+#ifdef ENABLE_CONFIG_COMMIT
+static configBlock* batchConfig = nullptr;
+#endif
+
+// The soft limits set by the batch, applied together at its end (each one may only be valid with the other's new value)
+#ifdef ENABLE_SOFT_LIMITS
+static bool softLimitsStaged = false;
+static int32_t stagedLimitMin = 0;
+static int32_t stagedLimitMax = 0;
+#endif
+
+
+// Gets a block to edit, the batch's block while one is being set
+#ifdef ENABLE_CONFIG_COMMIT
+static configBlock* editParameterConfig() {
+    if (!batching) {
+        return editConfig();
+    }
+    if (batchConfig == nullptr) {
+        batchConfig = editConfig();
+    }
+    return batchConfig;
+}
+
+
+// Commits the block, unless the batch will at its end
+static void commitParameterConfig() {
+    if (!batching) {
+        commitConfig();
+    }
+}
+#endif // ! ENABLE_CONFIG_COMMIT
+
+
+// Getters and setters of the registry
+// The values have already been checked against the range and the type of their entry
+#ifdef ENABLE_PID
+static float getP() { return pid.getP(); }
+static float getI() { return pid.getI(); }
+static float getD() { return pid.getD(); }
+static float getMaxI() { return pid.getMaxI(); }
+
+static PARAMETER_STATUS setP(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> p = value;
+        commitParameterConfig();
+    #else
+        pid.setP(value);
+    #endif
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setI(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> i = value;
+        commitParameterConfig();
+    #else
+        pid.setI(value);
+    #endif
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setD(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> d = value;
+        commitParameterConfig();
+    #else
+        pid.setD(value);
+    #endif
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setMaxI(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> maxI = value;
+        commitParameterConfig();
+    #else
+        pid.setMaxI(value);
+    #endif
+    return PARAMETER_OK;
+}
+#endif // ! ENABLE_PID
+
+static float getMicrostepping() { return motor.getMicrostepping(); }
+static float getMultiplier() { return motor.getMicrostepMultiplier(); }
+static float getFullStepAngle() { return motor.getFullStepAngle(); }
+static float getReversed() { return motor.getReversed(); }
+static float getEnableInversion() { return motor.getEnableInversion(); }
+static float getStepFilter() { return motor.getStepFilter(); }
+
+#ifndef ENABLE_FIXED_MOTOR_CONFIG
+static PARAMETER_STATUS setMicrostepping(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> microstepping = (uint16_t)value;
+        commitParameterConfig();
+    #else
+        motor.setMicrostepping((uint16_t)value);
+        updateCorrectionTimer();
+    #endif
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setMultiplier(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> multiplier = value;
+        commitParameterConfig();
+    #else
+        motor.setMicrostepMultiplier(value);
+    #endif
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setFullStepAngle(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> fullStepAngle = value;
+        commitParameterConfig();
+    #else
+        motor.setFullStepAngle(value);
+    #endif
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setReversed(float value) {
+    #ifdef ENABLE_CONFIG_COMMIT
+        editParameterConfig() -> reversed = (value == 1);
+        commitParameterConfig();
+    #else
+        motor.setReversed(value == 1);
+    #endif
+    return PARAMETER_OK;
+}
+#endif // ! ENABLE_FIXED_MOTOR_CONFIG
+
+static PARAMETER_STATUS setEnableInversion(float value) {
+    motor.setEnableInversion(value == 1);
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setStepFilter(float value) {
+    return (motor.setStepFilter(value) ? PARAMETER_OK : PARAMETER_BAD_VALUE);
+}
+
+#ifndef ENABLE_DYNAMIC_CURRENT
+static float getRMSCurrent() { return motor.getRMSCurrent(); }
+
+static PARAMETER_STATUS setRMSCurrent(float value) {
+    motor.setRMSCurrent((uint16_t)value);
+    return PARAMETER_OK;
+}
+#endif // ! ENABLE_DYNAMIC_CURRENT
+
+#ifdef ENABLE_TORQUE_MODE
+static float getTorqueMode() { return motor.isTorqueModeActive(); }
+static float getTorqueTarget() { return motor.getTorqueTarget(); }
+static float getTorqueSpeedLimit() { return motor.getTorqueSpeedLimit(); }
+
+static PARAMETER_STATUS setTorqueMode(float value) {
+    if (value == 0) {
+        motor.exitTorqueMode();
+    }
+    else if (!motor.setTorqueMode(motor.getTorqueTarget())) {
+        return PARAMETER_BUSY;
+    }
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setTorqueTarget(float value) {
+    return (motor.setTorqueMode((int16_t)value) ? PARAMETER_OK : PARAMETER_BUSY);
+}
+
+static PARAMETER_STATUS setTorqueSpeedLimit(float value) {
+    motor.setTorqueSpeedLimit((uint16_t)value);
+    return PARAMETER_OK;
+}
+#endif // ! ENABLE_TORQUE_MODE
+
+#ifdef ENABLE_SOFT_LIMITS
+static float getSoftLimitsParameter() { return getSoftLimitsEnabled(); }
+static float getSoftLimitMinParameter() { return getSoftLimitMin(); }
+static float getSoftLimitMaxParameter() { return getSoftLimitMax(); }
+static float getMaxVelocityParameter() { return getMaxVelocity(); }
+static float getMaxAccelParameter() { return getMaxAccel(); }
+
+// The exact values for the flash, the limits and rates can be past what a float holds
+static int32_t getSoftLimitMinInteger() { return getSoftLimitMin(); }
+static int32_t getSoftLimitMaxInteger() { return getSoftLimitMax(); }
+static int32_t getMaxVelocityInteger() { return getMaxVelocity(); }
+static int32_t getMaxAccelInteger() { return getMaxAccel(); }
+
+static PARAMETER_STATUS setSoftLimitsParameter(float value) {
+    setSoftLimitsEnabled(value == 1);
+    return PARAMETER_OK;
+}
+
+// Sets one of the limits, keeping the other (a batch holds both until it ends)
+static PARAMETER_STATUS setSoftLimit(bool highest, int32_t limit) {
+    if (!softLimitsStaged) {
+        stagedLimitMin = getSoftLimitMin();
+        stagedLimitMax = getSoftLimitMax();
+    }
+    (highest ? stagedLimitMax : stagedLimitMin) = limit;
+    softLimitsStaged = batching;
+    if (batching || setSoftLimits(stagedLimitMin, stagedLimitMax)) {
+        return PARAMETER_OK;
+    }
+    return PARAMETER_BAD_VALUE;
+}
+
+static PARAMETER_STATUS setSoftLimitMinInteger(int32_t value) {
+    return setSoftLimit(false, value);
+}
+
+static PARAMETER_STATUS setSoftLimitMaxInteger(int32_t value) {
+    return setSoftLimit(true, value);
+}
+
+static PARAMETER_STATUS setMaxVelocityInteger(int32_t value) {
+    setMaxVelocity((uint32_t)value);
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setMaxAccelInteger(int32_t value) {
+    setMaxAccel((uint32_t)value);
+    return PARAMETER_OK;
+}
+
+static PARAMETER_STATUS setSoftLimitMinParameter(float value) { return setSoftLimitMinInteger((int32_t)value); }
+static PARAMETER_STATUS setSoftLimitMaxParameter(float value) { return setSoftLimitMaxInteger((int32_t)value); }
+static PARAMETER_STATUS setMaxVelocityParameter(float value) { return setMaxVelocityInteger((int32_t)value); }
+static PARAMETER_STATUS setMaxAccelParameter(float value) { return setMaxAccelInteger((int32_t)value); }
+#endif // ! ENABLE_SOFT_LIMITS
+
+
+// An entry for a parameter that isn't in the build
+#define PARAMETER_NOT_IN_BUILD { PARAMETER_FLOAT, 0, 0, PARAMETER_NOT_SAVED, nullptr, nullptr, nullptr, nullptr }
+
+// The registry, one entry for each PARAMETER_ID (in order)
+static const parameterInfo parameterTable[] = {
+
+    // PID (the windup limit isn't saved)
+    #ifdef ENABLE_PID
+    { PARAMETER_FLOAT, 0, FLT_MAX, P_TERM_INDEX,        getP,    setP },
+    { PARAMETER_FLOAT, 0, FLT_MAX, I_TERM_INDEX,        getI,    setI },
+    { PARAMETER_FLOAT, 0, FLT_MAX, D_TERM_INDEX,        getD,    setD },
+    { PARAMETER_FLOAT, 0, FLT_MAX, PARAMETER_NOT_SAVED, getMaxI, setMaxI },
+    #else
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    #endif
+
+    // Stepping (only read when it was fixed when compiling)
+    #ifndef ENABLE_FIXED_MOTOR_CONFIG
+    { PARAMETER_INT,   1, MAX_MICROSTEP_DIVISOR, MICROSTEPPING_INDEX,        getMicrostepping, setMicrostepping },
+    { PARAMETER_FLOAT, 0, FLT_MAX,               MICROSTEP_MULTIPLIER_INDEX, getMultiplier,    setMultiplier },
+    #else
+    { PARAMETER_INT,   1, MAX_MICROSTEP_DIVISOR, PARAMETER_NOT_SAVED,        getMicrostepping, nullptr },
+    { PARAMETER_FLOAT, 0, FLT_MAX,               PARAMETER_NOT_SAVED,        getMultiplier,    nullptr },
+    #endif
+
+    // The RMS current is saved to the slots of the dynamic current by saveParameters()
+    #ifndef ENABLE_DYNAMIC_CURRENT
+    { PARAMETER_INT,   0, MAX_RMS_BOARD_CURRENT, PARAMETER_NOT_SAVED,        getRMSCurrent,    setRMSCurrent },
+    #else
+    PARAMETER_NOT_IN_BUILD,
+    #endif
+
+    #ifndef ENABLE_FIXED_MOTOR_CONFIG
+    { PARAMETER_FLOAT, 0.9, 1.8,                 FULL_STEP_ANGLE_INDEX,      getFullStepAngle, setFullStepAngle },
+    { PARAMETER_BOOL,  0, 1,                     MOTOR_REVERSED_INDEX,       getReversed,      setReversed },
+    #else
+    { PARAMETER_FLOAT, 0.9, 1.8,                 PARAMETER_NOT_SAVED,        getFullStepAngle, nullptr },
+    { PARAMETER_BOOL,  0, 1,                     PARAMETER_NOT_SAVED,        getReversed,      nullptr },
+    #endif
+    { PARAMETER_BOOL,  0, 1,                     ENABLE_INVERSION_INDEX,     getEnableInversion, setEnableInversion },
+    { PARAMETER_INT,   0, 15,                    STEP_FILTER_INDEX,          getStepFilter,    setStepFilter },
+
+    // Torque mode (never saved, it starts the mode)
+    #ifdef ENABLE_TORQUE_MODE
+    { PARAMETER_BOOL,  0, 1,                                         PARAMETER_NOT_SAVED, getTorqueMode,       setTorqueMode },
+    { PARAMETER_INT,   -(float)MAX_PEAK_BOARD_CURRENT, MAX_PEAK_BOARD_CURRENT, PARAMETER_NOT_SAVED, getTorqueTarget, setTorqueTarget },
+    { PARAMETER_INT,   1, UINT16_MAX,                                PARAMETER_NOT_SAVED, getTorqueSpeedLimit, setTorqueSpeedLimit },
+    #else
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    #endif
+
+    // Soft limits
+    #ifdef ENABLE_SOFT_LIMITS
+    { PARAMETER_BOOL,  0, 1,                                           SOFT_LIMITS_ENABLED_INDEX, getSoftLimitsParameter,   setSoftLimitsParameter },
+    { PARAMETER_INT,   -PARAMETER_INT32_LIMIT, PARAMETER_INT32_LIMIT,  SOFT_LIMIT_MIN_INDEX,      getSoftLimitMinParameter, setSoftLimitMinParameter, getSoftLimitMinInteger, setSoftLimitMinInteger },
+    { PARAMETER_INT,   -PARAMETER_INT32_LIMIT, PARAMETER_INT32_LIMIT,  SOFT_LIMIT_MAX_INDEX,      getSoftLimitMaxParameter, setSoftLimitMaxParameter, getSoftLimitMaxInteger, setSoftLimitMaxInteger },
+    { PARAMETER_INT,   0, PARAMETER_INT32_LIMIT,                       MAX_VELOCITY_INDEX,        getMaxVelocityParameter,  setMaxVelocityParameter,  getMaxVelocityInteger,  setMaxVelocityInteger },
+    { PARAMETER_INT,   0, PARAMETER_INT32_LIMIT,                       MAX_ACCEL_INDEX,           getMaxAccelParameter,     setMaxAccelParameter,     getMaxAccelInteger,     setMaxAccelInteger },
+    #else
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    PARAMETER_NOT_IN_BUILD,
+    #endif
+};
+static_assert((sizeof(parameterTable) / sizeof(parameterTable[0])) == PARAMETER_COUNT, "The registry needs an entry for every PARAMETER_ID");
+
+
+// Gets the entry of a parameter
+const parameterInfo* getParameterInfo(uint8_t id) {
+    return ((id < PARAMETER_COUNT) ? &parameterTable[id] : nullptr);
+}
+
+
+// Checks if a value can be set to a parameter
+static PARAMETER_STATUS checkParameter(uint8_t id, float value) {
+    const parameterInfo* info = getParameterInfo(id);
+    if (info == nullptr) {
+        return PARAMETER_UNKNOWN;
+    }
+    if (info -> set == nullptr) {
+        return PARAMETER_UNSUPPORTED;
+    }
+
+    // The range check fails for NaN as well
+    if (!(value >= info -> min && value <= info -> max)) {
+        return PARAMETER_BAD_VALUE;
+    }
+    if (info -> type != PARAMETER_FLOAT && value != (float)(int32_t)value) {
+        return PARAMETER_BAD_VALUE;
+    }
+    return PARAMETER_OK;
+}
+
+
+// Starts holding the settings that are applied together
+static void beginParameterBatch() {
+    batching = true;
+}
+
+
+// Applies the settings that the batch held, returning if they were all taken
+static bool endParameterBatch() {
+    batching = false;
+    bool taken = true;
+    #ifdef ENABLE_CONFIG_COMMIT
+        if (batchConfig != nullptr) {
+            commitConfig();
+            batchConfig = nullptr;
+        }
+    #endif
+    #ifdef ENABLE_SOFT_LIMITS
+        if (softLimitsStaged) {
+            softLimitsStaged = false;
+            taken = setSoftLimits(stagedLimitMin, stagedLimitMax);
+        }
+    #endif
+    return taken;
+}
+
+
+// Sets a parameter from its value
+PARAMETER_STATUS setParameter(uint8_t id, float value) {
+    PARAMETER_STATUS status = checkParameter(id, value);
+    if (status != PARAMETER_OK) {
+        return status;
+    }
+    return parameterTable[id].set(value);
+}
+
+
+// Sets several parameters as one transaction
+PARAMETER_STATUS setParameters(const uint8_t ids[], const float values[], uint8_t count, uint8_t &failedIndex) {
+
+    // Nothing is set unless every value can be
+    for (uint8_t index = 0; index < count; index++) {
+        PARAMETER_STATUS status = checkParameter(ids[index], values[index]);
+        if (status != PARAMETER_OK) {
+            failedIndex = index;
+            return status;
+        }
+    }
+
+    // Set them in order, only a setter that refuses (ex. busy) can stop the batch partway
+    PARAMETER_STATUS status = PARAMETER_OK;
+    beginParameterBatch();
+    for (uint8_t index = 0; index < count && status == PARAMETER_OK; index++) {
+        status = parameterTable[ids[index]].set(values[index]);
+        failedIndex = index;
+    }
+
+    // The limits can only be checked against each other once both are in
+    if (!endParameterBatch() && status == PARAMETER_OK) {
+        status = PARAMETER_BAD_VALUE;
+        for (uint8_t index = 0; index < count; index++) {
+            if (ids[index] == PARAMETER_SOFT_LIMIT_MIN || ids[index] == PARAMETER_SOFT_LIMIT_MAX) {
+                failedIndex = index;
+            }
+        }
+    }
+    return status;
+}
+
+
+// Gets the value of a parameter
+PARAMETER_STATUS getParameter(uint8_t id, float &value) {
+    const parameterInfo* info = getParameterInfo(id);
+    if (info == nullptr) {
+        return PARAMETER_UNKNOWN;
+    }
+    if (info -> get == nullptr) {
+        return PARAMETER_UNSUPPORTED;
+    }
+    value = info -> get();
+    return PARAMETER_OK;
+}
+
+
+// Writes the value of every parameter with a flash index to flash
+// The integers are saved as the bits of an int32_t, so the unsigned ones keep the layout that they had when they were saved one by one
+void saveRegisteredParameters() {
+    for (uint8_t id = 0; id < PARAMETER_COUNT; id++) {
+        const parameterInfo &info = parameterTable[id];
+        if (info.flashIndex == PARAMETER_NOT_SAVED || info.get == nullptr) {
+            continue;
+        }
+
+        // The integers with an exact getter skip the float, it would round them
+        if (info.getInt != nullptr) {
+            writeFlash(info.flashIndex, (uint32_t)info.getInt());
+            continue;
+        }
+        float value = info.get();
+        switch (info.type) {
+            case PARAMETER_FLOAT:
+                writeFlash(info.flashIndex, value);
+                break;
+            case PARAMETER_INT:
+                writeFlash(info.flashIndex, (uint32_t)(int32_t)value);
+                break;
+            case PARAMETER_BOOL:
+                writeFlash(info.flashIndex, (value == 1));
+                break;
+        }
+    }
+}
+
+
+// Sets every parameter with a flash index from flash as one batch
+void loadRegisteredParameters() {
+    beginParameterBatch();
+    for (uint8_t id = 0; id < PARAMETER_COUNT; id++) {
+        const parameterInfo &info = parameterTable[id];
+        if (info.flashIndex == PARAMETER_NOT_SAVED || info.set == nullptr) {
+            continue;
+        }
+
+        // The integers with an exact setter are checked against the range without the float (a slot that was never written is past it)
+        if (info.setInt != nullptr) {
+            int32_t intValue = (int32_t)readFlashU32(info.flashIndex);
+            if (intValue >= (int64_t)info.min && intValue <= (int64_t)info.max) {
+                info.setInt(intValue);
+            }
+            continue;
+        }
+        float value;
+        switch (info.type) {
+            case PARAMETER_FLOAT:
+                value = readFlashFloat(info.flashIndex);
+                break;
+            case PARAMETER_INT:
+                value = (int32_t)readFlashU32(info.flashIndex);
+                break;
+            default:
+                value = readFlashBool(info.flashIndex);
+                break;
+        }
+
+        // A value that doesn't pass the checks (ex. a slot that was never written) leaves the default
+        if (checkParameter(id, value) == PARAMETER_OK) {
+            info.set(value);
+        }
+    }
+    endParameterBatch();
+}
@@ -0,0 +1,94 @@
+#ifndef __PARAMETERS_H__
+#define __PARAMETERS_H__
+
+// Include main config
+#include "config.h"
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Parameters that can be set and read by number (by the binary protocols, all values are floats)
+// The numbers are part of the protocols, so new parameters must be added at the end
+typedef enum {
+    PARAMETER_P,                    // Proportional gain
+    PARAMETER_I,                    // Integral gain
+    PARAMETER_D,                    // Derivative gain
+    PARAMETER_MAX_I,                // Integral windup limit
+    PARAMETER_MICROSTEPPING,        // Microstepping divisor
+    PARAMETER_MULTIPLIER,           // Microstep multiplier
+    PARAMETER_RMS_CURRENT,          // RMS current (mA, not available with dynamic current)
+    PARAMETER_FULL_STEP_ANGLE,      // Angle of a full step (degrees)
+    PARAMETER_REVERSED,             // Direction pin inversion (0 or 1)
+    PARAMETER_ENABLE_INVERSION,     // Enable pin inversion (0 or 1)
+    PARAMETER_STEP_FILTER,          // Digital filter of the step input (0 to 15)
+    PARAMETER_TORQUE_MODE,          // Torque mode (0 leaves it, 1 starts it at the torque target)
+    PARAMETER_TORQUE_TARGET,        // Coil current of the torque mode (mA, signed, starts the mode)
+    PARAMETER_TORQUE_SPEED_LIMIT,   // Speed that the torque mode's torque is cut back past (RPM)
+    PARAMETER_SOFT_LIMITS,          // Soft limits (0 or 1, disabling them clears a fault)
+    PARAMETER_SOFT_LIMIT_MIN,       // Lowest desired position (microsteps)
+    PARAMETER_SOFT_LIMIT_MAX,       // Highest desired position (microsteps)
+    PARAMETER_MAX_VELOCITY,         // Max velocity (microsteps/s, 0 doesn't limit it)
+    PARAMETER_MAX_ACCEL,            // Max acceleration of the moves (microsteps/s/s, 0 doesn't limit it)
+    PARAMETER_COUNT
+} PARAMETER_ID;
+
+// Result of setting or reading a parameter
+typedef enum {
+    PARAMETER_OK,                   // The parameter was set or read
+    PARAMETER_UNKNOWN,              // There isn't a parameter with the id
+    PARAMETER_BAD_VALUE,            // The value is out of range for the parameter
+    PARAMETER_UNSUPPORTED,          // The parameter needs a feature that isn't in this build
+    PARAMETER_BUSY                  // The parameter can't be set right now (ex. a move is running), try again later
+} PARAMETER_STATUS;
+
+// Type of the value of a parameter (every value is passed as a float, the integers and bools have to be whole)
+typedef enum {
+    PARAMETER_FLOAT,
+    PARAMETER_INT,                  // Stored as an int32_t
+    PARAMETER_BOOL                  // 0 or 1
+} PARAMETER_TYPE;
+
+// Flash index of the parameters that aren't saved with their id (or aren't saved at all)
+#define PARAMETER_NOT_SAVED 0xFFFF
+
+// Largest float that still fits in an int32_t (INT32_MAX rounds up past it)
+#define PARAMETER_INT32_LIMIT 2147483520.0f
+
+// An entry of the registry, there is one for every id (in order), so an id is looked up with an index
+// The features that aren't in the build leave their entries without a getter or setter
+// The integers that can be past what a float holds exactly (2^24) also have an integer getter and setter, used to save and load them
+typedef struct {
+    PARAMETER_TYPE type;
+    float min;                                  // Lowest value that can be set
+    float max;                                  // Highest value that can be set
+    uint16_t flashIndex;                        // FLASH_PARAM_INDEXES key that the value is saved to, PARAMETER_NOT_SAVED if it is saved on its own (or not at all)
+    float (*get)();                             // Reads the value (nullptr if it isn't in the build)
+    PARAMETER_STATUS (*set)(float value);       // Sets a value that passed the checks (nullptr if it can't be set in the build)
+    int32_t (*getInt)();                        // Reads the exact value of an integer (nullptr if the float is exact)
+    PARAMETER_STATUS (*setInt)(int32_t value);  // Sets the exact value of an integer (nullptr if the float is exact)
+} parameterInfo;
+
+// Gets the entry of a parameter, nullptr if there isn't a parameter with the id
+const parameterInfo* getParameterInfo(uint8_t id);
+
+// Sets a parameter from its value (the parameters aren't saved until saveParameters() is called)
+PARAMETER_STATUS setParameter(uint8_t id, float value);
+
+// Sets several parameters as one transaction. Every value is checked before any of them is set, and the settings that are committed
+// together (with ENABLE_CONFIG_COMMIT) and the two soft limits are applied once at the end, so the motor never sees half of the batch
+// Failed index is set to the index (in the arrays) of the parameter that failed, if one did
+PARAMETER_STATUS setParameters(const uint8_t ids[], const float values[], uint8_t count, uint8_t &failedIndex);
+
+// Gets the value of a parameter
+PARAMETER_STATUS getParameter(uint8_t id, float &value);
+
+// Writes the value of every parameter with a flash index to flash (used by saveParameters())
+void saveRegisteredParameters();
+
+// Sets every parameter with a flash index from flash as one batch, skipping the values that don't pass the checks (used by loadParameters())
+void loadRegisteredParameters();
+
+#endif // ! __PARAMETERS_H__
@@ -5,532 +5,1854 @@
 #if defined(ENABLE_SERIAL) || defined(ENABLE_CAN)
 
 #include "parser.h"
+#include "serial.h"
+#include "fixedFormat.h"
+#include "calibration.h"
+#include "clock.h"
+#include "watchdog.h"
+#include "stepCapture.h"
+#include "stepRateTest.h"
+#include "homing.h"
+#include "controlMode.h"
+#include "softLimits.h"
+#include "canGearing.h"
+#include "pvt.h"
+#include "memoryStats.h"
+#include "encoderNoiseTest.h"
+#include "moveMetrics.h"
+#include "stepStream.h"
+#include "detentComp.h"
+#include "loopOverrun.h"
+#include "parameters.h"
+
+#ifdef ENABLE_CAN_PDO
+#include "canProtocol.h"
+#endif
+
+// Number of commands that couldn't be run (unrecognized, too many words, or no command word)
+static uint32_t rejectedCommands = 0;
+
+// Command handlers
+// Each one gets the words of the command, and returns the feedback for the host
+
+// Gets the feedback for the result of setting parameters of the registry
+static String parameterStatusFeedback(PARAMETER_STATUS status) {
+    switch (status) {
+        case PARAMETER_OK:
+            return FEEDBACK_OK;
+        case PARAMETER_UNSUPPORTED:
+            return FEEDBACK_FIXED_SETTING;
+        case PARAMETER_BUSY:
+            return FEEDBACK_TORQUE_MODE;
+        default:
+            return FEEDBACK_BAD_VALUE;
+    }
+}
+
+
+// Sets a parameter of the registry, returning the feedback for the result
+static String setParameterFeedback(PARAMETER_ID id, float value) {
+    return parameterStatusFeedback(setParameter(id, value));
+}
+
+
+#ifdef ENABLE_JOG
+// Converts a speed (RPM) to the rate of the steps (steps/s), each step moves the multiplier's worth of microsteps
+static int32_t rpmToStepRate(float rpm) {
+    return (int32_t)((rpm * motor.getMicrostepsPerRotation()) / (60.0f * motor.getMicrostepMultiplier()));
+}
+
+
+// Jogs toward a direction (counter clockwise is positive), ramping to the speed (S, RPM) with the acceleration (A, RPM/s)
+// If the speed isn't given, the speed of the jog is returned
+static String jog(const parsedCommand &command, int8_t direction) {
+    float speed;
+    float accel = getWordFloat(command, 'A', DEFAULT_JOG_ACCEL);
+    if (!findWordFloat(command, 'S', speed)) {
+        return ("RPM: " + String((getJogVelocity() * 60.0f * motor.getMicrostepMultiplier()) / motor.getMicrostepsPerRotation()));
+    }
+    if (speed < 0 || accel <= 0) {
+        return FEEDBACK_BAD_VALUE;
+    }
+
+    // The follower's position comes from its master
+    #ifdef ENABLE_CAN_GEARING
+    if (isGearFollowing()) {
+        return FEEDBACK_GEARING;
+    }
+    #endif
+
+    // The trajectory moves the motor until it finishes
+    #ifdef ENABLE_PVT_TRAJECTORY
+    if (isPVTActive()) {
+        return FEEDBACK_PVT_ACTIVE;
+    }
+    #endif
+
+    // The jog can't start while the soft limits are faulted, its rate and acceleration are cut to the max
+    #ifdef ENABLE_SOFT_LIMITS
+    if (getSoftLimitFault() != SOFT_LIMIT_OK) {
+        return FEEDBACK_SOFT_LIMIT_FAULT;
+    }
+    int32_t rate = (int32_t)limitStepRate(rpmToStepRate(speed));
+    uint32_t stepAccel = limitStepAccel(rpmToStepRate(accel));
+    #else
+    int32_t rate = rpmToStepRate(speed);
+    uint32_t stepAccel = rpmToStepRate(accel);
+    #endif
+
+    // The jog never runs slower than its start rate, so slower speeds (other than stopping) are rejected instead of being sped up
+    if (rate > 0 && rate < JOG_MIN_RATE) {
+        return FEEDBACK_BAD_VALUE;
+    }
+    setJogVelocity(direction * rate, stepAccel);
+    return FEEDBACK_OK;
+}
+
+
+// M3 (ex M3 S120 A600 or M3) - Jogs clockwise, ramping to the speed (S, RPM) with the acceleration (A, RPM/s), then holds the speed until it is changed or stopped. If no speed is provided, then the speed of the jog will be returned
+static String handleM3(const parsedCommand &command) {
+    return jog(command, -1);
+}
+
+
+// M4 (ex M4 S120 A600 or M4) - Jogs counter clockwise, the same as M3
+static String handleM4(const parsedCommand &command) {
+    return jog(command, 1);
+}
+
+
+// M5 (ex M5 A600 or M5) - Ramps the jog to a stop with the acceleration (A, RPM/s), then the correction takes the motor back
+static String handleM5(const parsedCommand &command) {
+    float accel = getWordFloat(command, 'A', DEFAULT_JOG_ACCEL);
+    if (accel <= 0) {
+        return FEEDBACK_BAD_VALUE;
+    }
+    setJogVelocity(0, rpmToStepRate(accel));
+    return FEEDBACK_OK;
+}
+#endif
+
+
+// M17 (ex M17) - Enables the motor (overrides enable pin). Also restarts the motor after an encoder fault (too many missed reads or errors)
+static String handleM17(const parsedCommand &command) {
+    motor.setState(FORCED_ENABLED, true);
+    return FEEDBACK_OK;
+}
+
+
+// M18 / M84 (ex M18 or M84) - Disables the motor (overrides enable pin)
+static String handleM18(const parsedCommand &command) {
+    motor.setState(FORCED_DISABLED);
+    return FEEDBACK_OK;
+}
+
+
+// M93 (ex M93 V1.8 or M93) - Sets the angle of a full step. This value should be 1.8° or 0.9°. This value should be 1.8° or 0.9°. If no value is provided, then the current value will be returned.
+static String handleM93(const parsedCommand &command) {
+    const commandWord* angle = findWord(command, 'V');
+    if (angle != nullptr) {
+
+        // Set the value if it is valid (and wasn't fixed when compiling), -1 is a value like any other
+        return setParameterFeedback(PARAMETER_FULL_STEP_ANGLE, wordToFloat(*angle));
+    }
+    else {
+        // No value exists, get and return the current value
+        return floatString(motor.getFullStepAngle());
+    }
+}
+
+
+// M115 (ex M115) - Prints out firmware information, along with the clocks that the peripherals are running at.
+static String handleM115(const parsedCommand &command) {
+    return (FIRMWARE_FEATURE_PRINT + getClockStatus() + '\n' + getCommandList());
+}
+
+
+// M122 (ex M122 or M122 R1) - Reports the runtime statistics of the main loop's tasks (runs, average and max runtime, and late runs), and the share of the time that the core slept if `ENABLE_IDLE_SLEEP` is enabled. R1 clears the statistics afterward
+static String handleM122(const parsedCommand &command) {
+    String stats = getTaskStats();
+    if (getWordInt(command, 'R') == 1) {
+        resetTaskStats();
+    }
+    return stats;
+}
+
+
+// M124 (ex M124 or M124 R1) - Reports the error statistics of the links (CAN error counters, state, bus-off and error passive events, protocol errors, drops, and FIFO overruns, the USART's line errors, the encoder's errors, and the commands that were rejected). R1 clears the statistics afterward
+static String handleM124(const parsedCommand &command) {
+    String stats;
+    #ifdef ENABLE_CAN
+        stats += getCANStats() + '\n';
+    #endif
+    #ifdef ENABLE_CAN_SYNC
+        stats += getCANSyncStatus() + '\n';
+    #endif
+    #ifdef ENABLE_SERIAL
+        stats += getSerialStats() + '\n';
+    #endif
+    stats += motor.encoder.getHealthStats() + '\n';
+    stats += "Parser: Rejected: " + String(rejectedCommands);
+
+    // Clear the statistics if requested
+    if (getWordInt(command, 'R') == 1) {
+        #ifdef ENABLE_CAN
+            clearCANStats();
+        #endif
+        #ifdef ENABLE_SERIAL
+            clearSerialStats();
+        #endif
+        motor.encoder.clearHealthStats();
+        rejectedCommands = 0;
+    }
+    return stats;
+}
+
+
+#ifdef ENABLE_PROFILING
+// M123 (ex M123 or M123 R1) - Reports the cycle statistics of the interrupts and encoder reads (runs, min, average, and max cycles, and CPU load), along with the longest time that the interrupts were masked, and the encoder's SPI clock with the time of a read. R1 clears the statistics afterward
+static String handleM123(const parsedCommand &command) {
+    String stats = getProfileStats();
+    if (getWordInt(command, 'R') == 1) {
+        resetProfileStats();
+    }
+    return stats;
+}
+#endif
+
+
+// M125 (ex M125 or M125 B1) - Reads every register of the encoder in a few checked bursts, then reports them as "name: value" in hex. B1 sends the MAX_NUM_REG registers as raw binary instead (16 bit, little endian, in the order of the register map), preceded by the error of the snapshot
+static String handleM125(const parsedCommand &command) {
+    errorTypes error = motor.encoder.readRegisterMap();
+    #ifdef ENABLE_SERIAL
+    if (getWordInt(command, 'B') == 1) {
+        uint8_t registers[(MAX_NUM_REG * 2) + 1] = { (uint8_t)error };
+        for (uint8_t index = 0; index < MAX_NUM_REG; index++) {
+            uint16_t value = motor.encoder.getMappedRegister(index);
+            registers[(index * 2) + 1] = (uint8_t)value;
+            registers[(index * 2) + 2] = (uint8_t)(value >> 8);
+        }
+        sendSerialData(registers, sizeof(registers));
+        return FEEDBACK_OK;
+    }
+    #endif
+
+    // A line for each of the registers
+    String report = "Error: " + String(error) + '\n';
+    for (uint8_t index = 0; index < MAX_NUM_REG; index++) {
+        report += String(motor.encoder.getRegisterName(index)) + F(": 0x") + String(motor.encoder.getMappedRegister(index), HEX) + '\n';
+    }
+    report.trim();
+    return report;
+}
+
+
+#ifdef ENABLE_MEMORY_STATS
+// M126 (ex M126) - Reports the use of the RAM, the static variables, the heap (taken and in use), the stack (now and the deepest since boot), and the RAM that was never used
+static String handleM126(const parsedCommand &command) {
+    return getMemoryReport();
+}
+#endif
+
+
+#ifdef ENABLE_CAN
+// M116 (ex M116 S1) - Simple forward command that will forward a message across the CAN bus. Can be used for pinging or allowing a Serial to connect to the CAN network
+static String handleM116(const parsedCommand &command) {
+
+    // The message is the second M word (the first is the command number)
+    txCANString(getWordInt(command, 'S'), getWordText(findWord(command, 'M', 1)));
+    return FEEDBACK_OK;
+}
+#endif
+
+
+#ifdef ENABLE_SOFT_LIMITS
+// M211 (ex M211 S1 L-3200 H3200 V20000 A200000, M211 C1, or M211) - Sets or gets the soft limits. S turns them on (1) or off (0), L and H are the lowest and highest positions (microsteps), V is the max velocity (microsteps/s), and A is the max acceleration of the moves (microsteps/s/s, 0 doesn't limit either). C1 clears a fault. If no values are provided, then the current values and the fault will be returned
+static String handleM211(const parsedCommand &command) {
+    int32_t enabled, lowest, highest, velocity, accel, clear;
+    bool hasEnabled = findWordInt(command, 'S', enabled);
+    bool hasLow = findWordInt(command, 'L', lowest);
+    bool hasHigh = findWordInt(command, 'H', highest);
+    bool hasVelocity = findWordInt(command, 'V', velocity);
+    bool hasAccel = findWordInt(command, 'A', accel);
+    bool hasClear = findWordInt(command, 'C', clear);
+
+    // No values, just return the limits and the fault
+    if (!hasEnabled && !hasLow && !hasHigh && !hasVelocity && !hasAccel && !hasClear) {
+        String fault;
+        switch (getSoftLimitFault()) {
+            case SOFT_LIMIT_MIN_FAULT:
+                fault = F("past the lowest position");
+                break;
+            case SOFT_LIMIT_MAX_FAULT:
+                fault = F("past the highest position");
+                break;
+            case SOFT_LIMIT_VELOCITY_FAULT:
+                fault = F("over the max velocity");
+                break;
+            default:
+                fault = F("none");
+                break;
+        }
+        return ("S: " + String(getSoftLimitsEnabled()) + F(" | L: ") + String(getSoftLimitMin()) + F(" | H: ") + String(getSoftLimitMax()) +
+                F(" | V: ") + String(getMaxVelocity()) + F(" | A: ") + String(getMaxAccel()) + F(" | Fault: ") + fault);
+    }
+
+    // Check all of the values before any of them are set
+    if (!hasLow) {
+        lowest = getSoftLimitMin();
+    }
+    if (!hasHigh) {
+        highest = getSoftLimitMax();
+    }
+    if ((hasEnabled && (enabled < 0 || enabled > 1)) || lowest >= highest || (hasVelocity && velocity < 0) || (hasAccel && accel < 0) ||
+        (hasClear && (clear < 0 || clear > 1))) {
+        return FEEDBACK_BAD_VALUE;
+    }
+
+    // Set the values that were given
+    setSoftLimits(lowest, highest);
+    if (hasVelocity) {
+        setMaxVelocity(velocity);
+    }
+    if (hasAccel) {
+        setMaxAccel(accel);
+    }
+    if (hasEnabled) {
+        setSoftLimitsEnabled(enabled == 1);
+    }
+    if (hasClear && clear == 1) {
+        clearSoftLimitFault();
+    }
+    return FEEDBACK_OK;
+}
+#endif
+
+
+#ifdef ENABLE_PID
+// M306 (ex M306 P1 I1 D1 or M306) - Sets or gets the PID values for the motor. If no values are provided, then the current values will be returned.
+static String handleM306(const parsedCommand &command) {
+
+    // Collect the values that were given
+    const char letters[4] = { 'P', 'I', 'D', 'W' };
+    const uint8_t allIDs[4] = { PARAMETER_P, PARAMETER_I, PARAMETER_D, PARAMETER_MAX_I };
+    uint8_t ids[4];
+    float values[4];
+    uint8_t count = 0;
+    for (uint8_t index = 0; index < 4; index++) {
+        const commandWord* word = findWord(command, letters[index]);
+        if (word != nullptr) {
+            ids[count] = allIDs[index];
+            values[count] = wordToFloat(*word);
+            count++;
+        }
+    }
+    if (count > 0) {
+
+        // There is at least one value, therefore set all of them (one batch, so the correction never runs with half of them)
+        uint8_t failedIndex;
+        return parameterStatusFeedback(setParameters(ids, values, count, failedIndex));
+    }
+    else {
+        // No values are included, get and return the current values
+        return ("P: " + floatString(pid.getP()) + " | I: " + floatString(pid.getI()) + " | D: " + floatString(pid.getD()) + " | W: " + floatString(pid.getMaxI()));
+    }
+}
+#endif
+
+
+#ifdef ENABLE_GAIN_SCHEDULING
+// M311 (ex M311 N1 V60 P120 I100 D80 or M311 N1) - Sets or gets a point (N) of the PID gain schedule. V is the speed (RPM), P, I, and D are the gains at that speed (% of the M306 gains). If no values are provided, then the point will be returned.
+static String handleM311(const parsedCommand &command) {
+    int32_t index = getWordInt(command, 'N');
+    if (index < 0 || index >= GAIN_SCHEDULE_POINTS) {
+        return FEEDBACK_NO_VALUE;
+    }
+
+    // Start from the current point, then replace any values that were given
+    gainSchedulePoint point = pid.getSchedulePoint(index);
+    const char letters[4] = { 'V', 'P', 'I', 'D' };
+    uint16_t* fields[4] = { &point.rpm, &point.pScale, &point.iScale, &point.dScale };
+    bool given = false;
+    for (uint8_t field = 0; field < 4; field++) {
+        int32_t value;
+        if (findWordInt(command, letters[field], value)) {
+            if (value < 0) {
+                return FEEDBACK_BAD_VALUE;
+            }
+            *fields[field] = min(value, (int32_t)UINT16_MAX);
+            given = true;
+        }
+    }
+    if (given) {
+
+        // The correction reads the schedule, so it can't run halfway through the update
+        disableInterrupts();
+        pid.setSchedulePoint(index, point);
+        enableInterrupts();
+        return FEEDBACK_OK;
+    }
+    else {
+        // No values are included, return the point
+        return ("V: " + String(point.rpm) + " | P: " + String(point.pScale) + " | I: " + String(point.iScale) + " | D: " + String(point.dScale));
+    }
+}
+#endif
+
+
+#ifdef ENABLE_AUTOTUNE
+// M307 (ex M307 or M307 R2000) - Runs an autotune sequence for the PID loop, then saves the gains. R is the relay's step rate (steps/s)
+static String handleM307(const parsedCommand &command) {
+    int32_t rate = getWordInt(command, 'R');
+    return runAutotune(rate > 0 ? rate : 0);
+}
+#else
+// M307 (ex M307) - Starts the calibration of the encoder in the background (same as M313 S1)
+static String handleM307(const parsedCommand &command) {
+    return (startCalibration() ? FEEDBACK_OK : getCalibrationStatus());
+}
+#endif
+
+
+#ifdef ENABLE_SERIAL
+// M308 (ex M308) - Runs the manual PID tuning interface. Serial is filled with encoder angles
+static String handleM308(const parsedCommand &command) {
+
+    // Print a notice to the user that the PID tuning is starting
+    sendSerialMessage(F("Notice: The manual PID tuning is now starting. To exit, send any serial data.\n"));
+
+    // Wait for the user to read it
+    delay(1000);
+
+    // Clear the serial buffer
+    while (Serial.available() > 0) {
+        Serial.read();
+    }
+
+    // Loop forever, until a new value is sent
+    while (!(Serial.available() > 0)) {
+        sendSerialMessage(floatString(motor.encoder.getAbsoluteAngleAvg()) + "\n");
+
+        // The main loop is held up until the user exits, so this has to keep the watchdog fed
+        #ifdef ENABLE_WATCHDOG
+            watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+            serviceWatchdog();
+        #endif
+    }
+
+    // When all done, the exit is acknowledged
+    return FEEDBACK_OK;
+}
+#endif
+
+
+#ifdef ENABLE_TRACE
+// M309 (ex M309 S1 E50 P200 D1, M309 S0, or M309) - Arms (S1) or stops (S0) the trace of the control loop. Triggers once the step error reaches E (0 triggers right away), then records P more samples, one every D corrections. If no values are provided, then the state of the trace will be returned.
+static String handleM309(const parsedCommand &command) {
+    int16_t setValue = getWordInt(command, 'S');
+    if (setValue == 1) {
+
+        // Read the trigger settings, using the defaults for any that are missing
+        int32_t errorThreshold = getWordInt(command, 'E');
+        int32_t postSamples = getWordInt(command, 'P');
+        int32_t divider = getWordInt(command, 'D');
+        armTrace((errorThreshold < 0 ? DEFAULT_TRACE_ERROR_THRESHOLD : errorThreshold),
+                 (postSamples < 0 ? DEFAULT_TRACE_POST_SAMPLES : postSamples),
+                 (divider < 1 ? 1 : divider));
+        return FEEDBACK_OK;
+    }
+    else if (setValue == 0) {
+        stopTrace();
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, return the state of the trace
+        return getTraceStatus();
+    }
+}
+
+
+// M310 (ex M310 or M310 B1) - Dumps the trace over serial, oldest sample first. Each line is "time,steps,counts,error,output,cycles,flags". B1 sends the samples as raw binary instead
+static String handleM310(const parsedCommand &command) {
+    dumpTrace(getWordInt(command, 'B') == 1);
+    return FEEDBACK_OK;
+}
+#endif
+
+
+#ifdef ENABLE_TELEMETRY
+// M312 (ex M312 F100, M312 F500 B1, M312 F0, or M312) - Streams the position, step error, speed, temperature, and link errors at F Hz (0 stops the stream). Each line is "T,sequence,time,steps,counts,error,rpm,temperature,tec,rec,linkErrors" (time is in us). B1 sends packed telemetryRecord structs instead. If no values are provided, then the state of the stream will be returned.
+static String handleM312(const parsedCommand &command) {
+    int32_t rate;
+    if (findWordInt(command, 'F', rate)) {
+
+        // Start the stream, as long as the rate can be kept up
+        if (rate < 0) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        if (!startTelemetry(rate, (getWordInt(command, 'B') == 1))) {
+            return ("Rate must be " + String(TELEMETRY_MAX_RATE) + "Hz or less");
+        }
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, return the state of the stream
+        return getTelemetryStatus();
+    }
+}
+#endif
+
+
+// M313 (ex M313 S1, M313 S0, or M313) - Starts (S1) or aborts (S0) the calibration of the encoder. It runs in the background, sweeping each full step of a rotation forward and back, then saves and applies the result without a reboot. If no values are provided, then the progress of the calibration will be returned.
+static String handleM313(const parsedCommand &command) {
+    int16_t setValue = getWordInt(command, 'S');
+    if (setValue == 1) {
+
+        // Start the calibration, reporting why if it can't be
+        return (startCalibration() ? FEEDBACK_OK : getCalibrationStatus());
+    }
+    else if (setValue == 0) {
+        abortCalibration();
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, return the progress of the calibration
+        return getCalibrationStatus();
+    }
+}
+
+
+#ifdef ENABLE_STEP_CAPTURE
+// M314 (ex M314 or M314 R1) - Reports the timing of the step input, measured by the hardware (steps, rate, the last, shortest, and longest intervals, and the largest change between a pair of intervals). R1 clears the statistics afterward
+static String handleM314(const parsedCommand &command) {
+    String stats = getStepCaptureStats();
+    if (getWordInt(command, 'R') == 1) {
+        resetStepCaptureStats();
+    }
+    return stats;
+}
+#endif
+
+
+#ifdef ENABLE_STEP_RATE_TEST
+// M315 (ex M315 or M315 R200000) - Runs the self-test of the highest step rate, stepping bursts back and forth at rising rates up to R (steps/s) until the board can't keep up. Returns the highest rate that passed, and the limit of the step input's filter
+static String handleM315(const parsedCommand &command) {
+    int32_t rate = getWordInt(command, 'R');
+    return runStepRateTest(rate > 0 ? rate : 0);
+}
+#endif
+
+
+#ifdef ENABLE_ENCODER_NOISE_TEST
+// M318 (ex M318 or M318 N20000) - Runs the characterization of the encoder, pausing the correction and reading N raw samples at the control loop's rate. Returns the noise of the angle (standard deviation and peak to peak, alone and averaged like the firmware does), the CRC and other errors of the reads, and the min, average, and max time of the SPI transactions
+static String handleM318(const parsedCommand &command) {
+    int32_t samples = getWordInt(command, 'N');
+    return runEncoderNoiseTest(samples > 0 ? samples : 0);
+}
+#endif
+
+
+#ifdef ENABLE_MOVE_METRICS
+// M319 (ex M319 or M319 R1) - Reports the motion quality of the last move (duration, RMS and peak following error, corrective steps, largest lead angle, and settling time) with the totals since they were cleared. R1 clears the metrics afterward
+static String handleM319(const parsedCommand &command) {
+    String report = getMoveMetricsReport();
+    if (getWordInt(command, 'R') == 1) {
+        clearMoveMetrics();
+    }
+    return report;
+}
+#endif
+
+
+#ifdef ENABLE_STEP_STREAM
+// M320 (ex M320 S1 E50 D1, M320 S2, M320 S0, or M320) - Captures the step input (S1), replays the held stream (S2), or stops (S0). The capture records until the buffer is full, or with E, stops a quarter of the buffer after the step error reaches E. Each entry covers D corrections. If no values are provided, then the state of the stream will be returned with the following error of the last replay
+static String handleM320(const parsedCommand &command) {
+    int16_t setValue = getWordInt(command, 'S');
+    if (setValue == 1) {
+        int32_t errorThreshold = getWordInt(command, 'E');
+        int32_t divider = getWordInt(command, 'D');
+        startStepCapture((errorThreshold < 0 ? 0 : errorThreshold), (divider < 1 ? DEFAULT_STEP_STREAM_DIVIDER : divider));
+        return FEEDBACK_OK;
+    }
+    else if (setValue == 2) {
+        return (startStepReplay() ? FEEDBACK_OK : F("No step stream to replay, capture (M320 S1) or load (M321) one first"));
+    }
+    else if (setValue == 0) {
+        stopStepStream();
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, return the state of the stream
+        return getStepStreamStatus();
+    }
+}
+
+
+// M321 (ex M321, M321 C1 D1, or M321 T1200 S3) - Dumps the held step stream over serial as "<time in us> <steps>" lines. C1 clears the stream for loading (an entry every D corrections), then each T S adds S steps at T us
+static String handleM321(const parsedCommand &command) {
+    if (getWordInt(command, 'C') == 1) {
+        int32_t divider = getWordInt(command, 'D');
+        clearStepStream(divider < 1 ? DEFAULT_STEP_STREAM_DIVIDER : divider);
+        return FEEDBACK_OK;
+    }
+    int32_t time;
+    if (findWordInt(command, 'T', time)) {
+        int32_t steps;
+        if (!findWordInt(command, 'S', steps)) {
+            return FEEDBACK_NO_VALUE;
+        }
+        if (time < 0) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        return (loadStepStream(time, steps) ? FEEDBACK_OK : F("Step stream full, cleared (M321 C1), or the time is before the last one"));
+    }
+    dumpStepStream();
+    return FEEDBACK_OK;
+}
+#endif
+
+
+#ifdef ENABLE_DETENT_COMPENSATION
+// M322 (ex M322 S1, M322 S0, M322 C1, or M322) - Starts (S1) or aborts (S0) the learning pass of the detent torque table. It runs in the background, stepping the coils slowly through a rotation each way, then refines, saves, and applies the table. C1 clears the table. If no values are provided, then the progress of the pass (or the ripple that it found) will be returned
+static String handleM322(const parsedCommand &command) {
+    if (getWordInt(command, 'C') == 1) {
+        clearDetentTable();
+        return FEEDBACK_OK;
+    }
+    int16_t setValue = getWordInt(command, 'S');
+    if (setValue == 1) {
+        return (startDetentLearning() ? FEEDBACK_OK : F("Can't learn the detent torque now, calibrate first (M313) and wait for any move to finish"));
+    }
+    else if (setValue == 0) {
+        abortDetentLearning();
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, return the progress of the pass
+        return getDetentStatus();
+    }
+}
+#endif
+
+
+#ifdef ENABLE_WAVEFORM_SHAPING
+// M323 (ex M323 C1 or M323) - Gets the shape of the coil waveform that the calibration fit (the third harmonic and the balance of coil A over coil B, percent of the sine). C1 returns the coils to a sine. If no values are provided, then the current shape will be returned
+static String handleM323(const parsedCommand &command) {
+    if (getWordInt(command, 'C') == 1) {
+        clearWaveformShape();
+        return FEEDBACK_OK;
+    }
+    return (F("Third harmonic: ") + floatString(motor.getWaveformThirdHarmonic() * 100, 2) + F("%, coil balance: ") + floatString(motor.getWaveformBalance() * 100, 2) + "%");
+}
+#endif
+
+
+#ifdef ENABLE_OVERRUN_DETECTION
+// M324 (ex M324 or M324 R1) - Reports the load of the control loop (the level of work being shed, the filtered and peak runtime of the corrections, the longest one, the overruns, and the times that the work was shed). R1 clears the statistics afterward
+static String handleM324(const parsedCommand &command) {
+    String report = getOverrunReport();
+    if (getWordInt(command, 'R') == 1) {
+        clearOverrunStats();
+    }
+    return report;
+}
+#endif
+
+
+#ifdef ENABLE_CORRECTION_HYSTERESIS
+// M325 (ex M325 E3 X1 or M325) - Sets or gets the hysteresis of the correction (E, the filtered error that starts it, and X, the error that it runs down to, microsteps). If no values are provided, then the current values will be returned
+static String handleM325(const parsedCommand &command) {
+    int32_t enterError = getCorrectionEnterError();
+    int32_t exitError = getCorrectionExitError();
+    bool hasEnter = findWordInt(command, 'E', enterError);
+    bool hasExit = findWordInt(command, 'X', exitError);
+    if (hasEnter || hasExit) {
+
+        // A value that isn't given is kept
+        if (exitError < 0 || enterError <= exitError || enterError > CORRECTION_IMMEDIATE_ERROR) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        setCorrectionHysteresis(enterError, exitError);
+        return FEEDBACK_OK;
+    }
+    return (F("Enter: ") + String(getCorrectionEnterError()) + F(" | Exit: ") + String(getCorrectionExitError()));
+}
+#endif
+
+
+#ifdef ENABLE_RESONANCE_DAMPING
+// M316 (ex M316 T200 or M316) - Sets or gets the gain of the mid-band resonance damping (T, us, 0 turns it off). The coils are held back by the phase moved at the ringing velocity in this time. If no value is provided, then the current value will be returned.
+static String handleM316(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'T', setValue)) {
+        if (setValue < 0 || setValue > UINT16_MAX) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        motor.setResonanceDamping(setValue);
+        return FEEDBACK_OK;
+    }
+    return String(motor.getResonanceDamping());
+}
+#endif
+
+
+#ifdef ENABLE_LATENCY_COMPENSATION
+// M317 (ex M317 S1 or M317) - Turns the latency compensation of the position feedback on (S1) or off (S0). If no value is provided, then the state will be returned with the delay being compensated for.
+static String handleM317(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'S', setValue)) {
+        if (setValue < 0 || setValue > 1) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        motor.encoder.setLatencyCompensation(setValue == 1);
+        return FEEDBACK_OK;
+    }
+    uint16_t sensorDelay = motor.encoder.getSensorDelay();
+    return ("S: " + String(motor.encoder.getLatencyCompensation()) + F(" | Latency: ") + String(motor.encoder.getLatency()) + F(" us | Encoder: ") +
+            String(sensorDelay / 10) + '.' + String(sensorDelay % 10) + F(" us"));
+}
+#endif
+
+
+// M350 (ex M350 V16 or M350) - Sets the microstepping divisor for the motor. This value can be 1, 2, 4, 8, 16, or 32. Sets or gets the microstepping divisor for the motor. This value can be 1, 2, 4, 8, 16, or 32. If no value is provided, then the current microstepping divisor will be returned.
+static String handleM350(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'V', setValue)) {
+
+        // Set the value if it is valid (and wasn't fixed when compiling)
+        return setParameterFeedback(PARAMETER_MICROSTEPPING, setValue);
+    }
+    else {
+        // No value exists, get and return the current value
+        return String(motor.getMicrostepping());
+    }
+}
+
+
+// M352 (ex M352 S1 or M352) - Sets or gets the direction pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
+static String handleM352(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'S', setValue)) {
+
+        // Set the value if it is valid (0 or 1, and wasn't fixed when compiling)
+        return setParameterFeedback(PARAMETER_REVERSED, setValue);
+    }
+    else {
+        // No value exists, get and return the current value
+        return String(motor.getReversed());
+    }
+}
+
+
+// M353 (ex M353 S1 or M353) - Sets or gets the enable pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
+static String handleM353(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'S', setValue)) {
+
+        // Set the value if it is valid (0 or 1, and wasn't fixed when compiling)
+        return setParameterFeedback(PARAMETER_ENABLE_INVERSION, setValue);
+    }
+    else {
+        // No value exists, get and return the current value
+        return String(motor.getEnableInversion());
+    }
+}
+
+
+// M354 (ex M354 S1 or M354) - Sets or gets if the motor dip switches were installed incorrectly (reversed) (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
+static String handleM354(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'S', setValue)) {
+
+        // Set the value if it is valid
+        if (setValue < 0 || setValue > 1) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        setDipInverted(setValue == 1);
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, get and return the current value
+        return String(getDipInverted());
+    }
+}
+
+
+// M355 (ex M355 V1.34 or M355) - Sets or gets the microstep multiplier for the board. Allows to use multiple motors connected to the same mainboard pin, yet have different rates. If no value is provided, then the current value will be returned.
+static String handleM355(const parsedCommand &command) {
+    float setValue;
+    if (findWordFloat(command, 'V', setValue)) {
+
+        // Set the value if it is valid (and wasn't fixed when compiling)
+        return setParameterFeedback(PARAMETER_MULTIPLIER, setValue);
+    }
+    else {
+        // No value exists, get and return the current value
+        return floatString(motor.getMicrostepMultiplier());
+    }
+}
+
+
+// M356
+static String handleM356(const parsedCommand &command) {
+
+    // Only build in functionality if specified
+    #ifdef ENABLE_CAN
+        // M356 (ex M356 V1 or M356 VX2 or M356) - Sets or gets the CAN ID of the board. Can be set using the axis character or actual ID. If no value is provided, then the current value will be returned.
+
+        // Check the value of the axis
+        const commandWord* axisWord = findWord(command, 'V');
+        if (axisWord == nullptr || (axisWord -> length) == 0) {
+
+            // Value is invalid, therefore one doesn't exist. Just return the current value
+            return String(getCANID());
+        }
+
+        // Check if the value is an axis name (a letter, then an optional number from 1 to 5)
+        const char* axisNames = "XYZE";
+        const char* axisName = strchr(axisNames, toupper(axisWord -> text[0]));
+        if (axisName != nullptr) {
+
+            // The IDs of each axis are consecutive, with 5 per axis
+            int32_t axisNumber = ((axisWord -> length) > 1 ? atoi(axisWord -> text + 1) : 1);
+            if (axisNumber < 1 || axisNumber > 5) {
+                return FEEDBACK_NO_VALUE;
+            }
+            setCANID((AXIS_CAN_ID)(X + ((axisName - axisNames) * 5) + (axisNumber - 1)));
+
+            // Return operation successful
+            return FEEDBACK_OK;
+        }
+        else {
+            // Value is a number, set the CAN ID
+            setCANID(AXIS_CAN_ID(axisWord -> intValue));
+
+            // Return that the operation is complete
+            return FEEDBACK_OK;
+        }
+
+    #else
+        // Return that the feature is not enabled
+        return FEEDBACK_CAN_NOT_ENABLED;
+    #endif
+}
+
+
+// M357 (ex M357 S1 or M357) - Sets or gets if the board boots without the splash screens (0 is normal, 1 is fast boot). The motor is ready right away and the display starts in the background. Save with M500 for it to take effect on the next boot.
+static String handleM357(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'S', setValue)) {
+
+        // Set the value if it is valid
+        if (setValue < 0 || setValue > 1) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        setFastBoot(setValue == 1);
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, get and return the current value
+        return String(getFastBoot());
+    }
+}
+
+
+// M358 (ex M358 S7, M358 R1, or M358) - Sets or gets the digital filter of the step input (S, 0 to 15, higher rejects more noise but lowers the highest step rate). With `ENABLE_STEP_GLITCH_STATS`, the glitches and the fastest clean rate are returned with it, and R1 clears them afterward
+static String handleM358(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'S', setValue)) {
+
+        // Set the filter if it is valid
+        return setParameterFeedback(PARAMETER_STEP_FILTER, setValue);
+    }
+
+    // No value exists, return the current filter (and the statistics)
+    #ifdef ENABLE_STEP_GLITCH_STATS
+        String stats = "Filter: " + String(motor.getStepFilter()) + F(" | ") + motor.getStepGlitchStats();
+        if (getWordInt(command, 'R') == 1) {
+            motor.resetStepGlitchStats();
+        }
+        return stats;
+    #else
+        return String(motor.getStepFilter());
+    #endif
+}
+
+
+// M500 (ex M500) - Saves the currently loaded parameters into flash
+static String handleM500(const parsedCommand &command) {
+    saveParameters();
+    return FEEDBACK_OK;
+}
 
-// Parses an entire string for any commands
-String parseCommand(String buffer) {
-
-    // Gcode Table
-    //  - M17 (ex M17) - Enables the motor (overrides enable pin)
-    //  - M18 / M84 (ex M18 or M84) - Disables the motor (overrides enable pin)
-    //  - M93 (ex M93 V1.8 or M93) - Sets the angle of a full step. This value should be 1.8° or 0.9°. If no value is provided, then the current value will be returned.
-    //  - M115 (ex M115) - Prints out firmware information, consisting of the version and any enabled features.
-    //  - M116 (ex M116 S1 M"A message") - Simple forward command that will forward a message across the CAN bus. Can be used for pinging or allowing a Serial to connect to the CAN network
-    //  - M306 (ex M306 P1 I1 D1 W10 or M306) - Sets or gets the PID values for the motor. W term is the maximum value of the I windup. If no values are provided, then the current values will be returned.
-    //  - M307 (ex M307) - Runs an autotune sequence for the PID loop
-    //  - M308 (ex M308) - Runs the manual PID tuning interface. Serial is filled with encoder angles
-    //  - M350 (ex M350 V16 or M350) - Sets or gets the microstepping divisor for the motor. This value can be 1, 2, 4, 8, 16, or 32. If no value is provided, then the current microstepping divisor will be returned.
-    //  - M352 (ex M352 S1 or M352) - Sets or gets the direction pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
-    //  - M353 (ex M353 S1 or M353) - Sets or gets the enable pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
-    //  - M354 (ex M354 S1 or M354) - Sets or gets if the motor dip switches were installed incorrectly (reversed) (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
-    //  - M355 (ex M355 V1.34 or M355) - Sets or gets the microstep multiplier for the board. Allows to use multiple motors connected to the same mainboard pin, yet have different rates. If no value is provided, then the current value will be returned.
-    //  - M356 (ex M356 V1 or M356 VX2 or M356) - Sets or gets the CAN ID of the board. Can be set using the axis character or actual ID. If no value is provided, then the current value will be returned.
-    //  - M500 (ex M500) - Saves the currently loaded parameters into flash
-    //  - M501 (ex M501) - Loads all saved parameters from flash
-    //  - M502 (ex M502) - Wipes all parameters from flash, then reboots the system
-    //  - M907 (ex M907 R750, M907 I500) - Sets or gets the RMS(R) or Peak(P) current in mA. If dynamic current is enabled, then the accel(A), idle(I), and/or max(M) can be set or retrieved. If no value is set, then the current RMS current (no dynamic current) or the accel, idle, and max terms (dynamic current) will be returned.
-
-    // ! Check to see if the string contains another set of gcode, if so call the function recursively
-
-    // Check to see if the letter is an M (for mcodes)
-    if (parseValue(buffer, 'M') != "-1") {
-
-        // Switch statement the command number
-        switch (parseValue(buffer, 'M').toInt()) {
-
-            case 17:
-                // M17 (ex M17) - Enables the motor (overrides enable pin)
-                motor.setState(FORCED_ENABLED, true);
-                return FEEDBACK_OK;
-
-            case 18:
-                // M18 / M84 (ex M18 or M84) - Disables the motor (overrides enable pin)
-                motor.setState(FORCED_DISABLED);
-                return FEEDBACK_OK;
-
-            case 84:
-                // M18 / M84 (ex M18 or M84) - Disables the motor (overrides enable pin)
-                motor.setState(FORCED_DISABLED);
-                return FEEDBACK_OK;
-
-            case 93: {
-                // M93 (ex M93 V1.8 or M93) - Sets the angle of a full step. This value should be 1.8° or 0.9°. This value should be 1.8° or 0.9°. If no value is provided, then the current value will be returned.
-                float setValue = parseValue(buffer, 'V').toFloat();
-                if (setValue != -1) {
-
-                    // Value is valid, set and return ok
-                    motor.setFullStepAngle(setValue);
-                    return FEEDBACK_OK;
-                }
-                else {
-                    // No value exists, get and return the current value
-                    return String(motor.getFullStepAngle());
-                }
-            }
 
-            case 115:
-                // M115 (ex M115) - Prints out firmware information.
-                return FIRMWARE_FEATURE_PRINT;
-
-            #ifdef ENABLE_CAN
-            case 116:
-                // M116 (ex M116 S1) - Simple forward command that will forward a message across the CAN bus. Can be used for pinging or allowing a Serial to connect to the CAN network
-                // The buffer.substring prevents the first M from being read
-                txCANString(parseValue(buffer, 'S').toInt(), parseString(buffer.substring(1), 'M'));
-            #endif
-
-            #ifdef ENABLE_PID
-            case 306: {
-                // M306 (ex M306 P1 I1 D1 or M306) - Sets or gets the PID values for the motor. If no values are provided, then the current values will be returned.
-                float pValue =    parseValue(buffer, 'P').toFloat();
-                float iValue =    parseValue(buffer, 'I').toFloat();
-                float dValue =    parseValue(buffer, 'D').toFloat();
-                float maxIValue = parseValue(buffer, 'W').toFloat();
-                if (!((pValue == -1) && (iValue == -1) && (dValue == -1))) {
-
-                    // There is at least one valid value, therefore set all of the values
-                    if (pValue != -1) {
-                        pid.setP(pValue);
-                    }
-                    if (iValue != -1) {
-                        pid.setI(iValue);
-                    }
-                    if (dValue != -1) {
-                        pid.setD(dValue);
-                    }
-                    if (maxIValue != -1) {
-                        pid.setMaxI(maxIValue);
-                    }
-
-                    return FEEDBACK_OK;
-                }
-                else {
-                    // No values are included, get and return the current values
-                    return ("P: " + String(pid.getP()) + " | I: " + String(pid.getI()) + " | D: " + String(pid.getD()) + " | W: " + String(pid.getMaxI()));
-                }
-            }
-            #endif
-
-            case 307:
-                // M307 (ex M307) - Runs a automatic calibration sequence for the PID loop and encoder
-                motor.calibrate();
-                return FEEDBACK_OK;
-
-            case 308:
-                // M308 (ex M308) - Runs the manual PID tuning interface. Serial is filled with encoder angles
-
-                // Print a notice to the user that the PID tuning is starting
-                Serial.println("Notice: The manual PID tuning is now starting. To exit, send any serial data.");
-
-                // Wait for the user to read it
-                delay(1000);
-
-                // Clear the serial buffer
-                while (Serial.available() > 0) {
-                    Serial.read();
-                }
-
-                // Loop forever, until a new value is sent
-                while (!(Serial.available() > 0)) {
-                    Serial.println(motor.encoder.getAbsoluteAngleAvg());
-                }
-
-                // When all done, the exit is acknowledged
-                return FEEDBACK_OK;
-
-            case 350: {
-                // M350 (ex M350 V16 or M350) - Sets the microstepping divisor for the motor. This value can be 1, 2, 4, 8, 16, or 32. Sets or gets the microstepping divisor for the motor. This value can be 1, 2, 4, 8, 16, or 32. If no value is provided, then the current microstepping divisor will be returned.
-                int16_t setValue = parseValue(buffer, 'V').toInt();
-                if (setValue != -1) {
-
-                    // Value is valid, set and return ok
-                    motor.setMicrostepping(setValue);
-                    updateCorrectionTimer();
-                    return FEEDBACK_OK;
-                }
-                else {
-                    // No value exists, get and return the current value
-                    return String(motor.getMicrostepping());
-                }
-            }
+// M501 (ex M501) - Loads all saved parameters from flash
+static String handleM501(const parsedCommand &command) {
+    return loadParameters();
+}
 
-            case 352: {
-                // M352 (ex M352 S1 or M352) - Sets or gets the direction pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
-                int16_t setValue = parseValue(buffer, 'S').toInt();
-                if (setValue == 0 || setValue == 1) {
-
-                    // Value is valid, set and return ok
-                    motor.setReversed(setValue == 1);
-                    return FEEDBACK_OK;
-                }
-                else {
-                    // No value exists, get and return the current value
-                    return String(motor.getReversed());
-                }
-            }
 
-            case 353: {
-                // M353 (ex M353 S1 or M353) - Sets or gets the enable pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
-                int16_t setValue = parseValue(buffer, 'S').toInt();
-                if (setValue == 0 || setValue == 1) {
-
-                    // Value is valid, set and return ok
-                    motor.setEnableInversion(setValue == 1);
-                    return FEEDBACK_OK;
-                }
-                else {
-                    // No value exists, get and return the current value
-                    return String(motor.getEnableInversion());
-                }
-            }
+// M502 (ex M502) - Wipes all parameters from flash, then reboots the system
+static String handleM502(const parsedCommand &command) {
+    wipeParameters();
 
-            case 354: {
-                // M354 (ex M354 S1 or M354) - Sets or gets if the motor dip switches were installed incorrectly (reversed) (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
-                int16_t setValue = parseValue(buffer, 'S').toInt();
-                if (setValue == 0 || setValue == 1) {
-
-                    // Value is valid, set and return ok
-                    setDipInverted(setValue == 1);
-                    return FEEDBACK_OK;
-                }
-                else {
-                    // No value exists, get and return the current value
-                    return String(getDipInverted());
-                }
-            }
+    // Never reached, wipeParameters reboots the processor
+    return FEEDBACK_OK;
+}
 
-            case 355: {
-                // M355 (ex M355 V1.34 or M355) - Sets or gets the microstep multiplier for the board. Allows to use multiple motors connected to the same mainboard pin, yet have different rates. If no value is provided, then the current value will be returned.
-                float setValue = parseValue(buffer, 'V').toFloat();
-                if (setValue != -1) {
-
-                    // Value is valid, set and return ok
-                    motor.setMicrostepMultiplier(setValue);
-                    return FEEDBACK_OK;
-                }
-                else {
-                    // No value exists, get and return the current value
-                    return String(motor.getMicrostepMultiplier());
-                }
-            }
 
-            case 356: {
-
-                // Only build in functionality if specified
-                #ifdef ENABLE_CAN
-                    // M356 (ex M356 V1 or M356 VX2 or M356) - Sets or gets the CAN ID of the board. Can be set using the axis character or actual ID. If no value is provided, then the current value will be returned.
-
-                    // Check the value of the axis
-                    String axisValue = parseValue(buffer, 'V');
-
-                    // Check if the value is not a number (0 is returned if the value cannot be converted)
-                    if (axisValue.toInt() == 0) {
-
-                        // Compare the values of the received value with the expected ones
-                        if (axisValue == "X" || axisValue == "X1") {
-                            setCANID(X);
-                        }
-                        else if (axisValue == "X2") {
-                            setCANID(X2);
-                        }
-                        else if (axisValue == "X3") {
-                            setCANID(X3);
-                        }
-                        else if (axisValue == "X4") {
-                            setCANID(X4);
-                        }
-                        else if (axisValue == "X5") {
-                            setCANID(X5);
-                        }
-                        else if (axisValue == "Y" || axisValue == "Y1") {
-                            setCANID(Y);
-                        }
-                        else if (axisValue == "Y2") {
-                            setCANID(Y2);
-                        }
-                        else if (axisValue == "Y3") {
-                            setCANID(Y3);
-                        }
-                        else if (axisValue == "Y4") {
-                            setCANID(Y4);
-                        }
-                        else if (axisValue == "Y5") {
-                            setCANID(Y5);
-                        }
-                        else if (axisValue == "Z" || axisValue == "Z1") {
-                            setCANID(Z);
-                        }
-                        else if (axisValue == "Z2") {
-                            setCANID(Z2);
-                        }
-                        else if (axisValue == "Z3") {
-                            setCANID(Z3);
-                        }
-                        else if (axisValue == "Z4") {
-                            setCANID(Z4);
-                        }
-                        else if (axisValue == "Z5") {
-                            setCANID(Z5);
-                        }
-                        else if (axisValue == "E" || axisValue == "E1") {
-                            setCANID(E);
-                        }
-                        else if (axisValue == "E2") {
-                            setCANID(E2);
-                        }
-                        else if (axisValue == "E3") {
-                            setCANID(E3);
-                        }
-                        else if (axisValue == "E4") {
-                            setCANID(E4);
-                        }
-                        else if (axisValue == "E5") {
-                            setCANID(E5);
-                        }
-                        else {
-                            return FEEDBACK_NO_VALUE;
-                        }
-
-                        // Return operation successful
-                        return FEEDBACK_OK;
-                    }
-                    else {
-                        // Value is a number, check if it isn't -1 (meaning that a value wasn't specified)
-                        if (axisValue.toInt() != -1) {
-
-                            // Set the CAN ID
-                            setCANID(AXIS_CAN_ID(parseValue(buffer, 'V').toInt()));
-
-                            // Return that the operation is complete
-                            return FEEDBACK_OK;
-                        }
-                        else {
-                            // Value is invalid, therefore one doesn't exist. Just return the current value
-                            return String(getCANID());
-                        }
-                    }
-
-                #else
-                    // Return that the feature is not enabled
-                    return FEEDBACK_CAN_NOT_ENABLED;
-                #endif
-            }
+#ifdef ENABLE_SERIAL
+// M575 (ex M575 B1000000 or M575) - Sets or gets the baud rate of the serial bus. An ok is sent at the old rate, then the new rate is reported at the new one. Save with M500 to keep it
+static String handleM575(const parsedCommand &command) {
+    int32_t baud;
+    if (findWordInt(command, 'B', baud)) {
+
+        // Check that the rate is valid before replying, then switch once the reply is out
+        if (baud < MIN_SERIAL_BAUD || baud > MAX_SERIAL_BAUD) {
+            return ("Baud rate must be between " + String(MIN_SERIAL_BAUD) + " and " + String(MAX_SERIAL_BAUD));
+        }
+        sendSerialMessage(String(FEEDBACK_OK) + "\n");
+        setSerialBaud(baud);
+        return ("Baud: " + String(getSerialBaud()));
+    }
+    else {
+        // No value exists, get and return the current value
+        return String(getSerialBaud());
+    }
+}
+#endif
+
+
+#ifdef ENABLE_IDLE_CURRENT
+// M906 (ex M906 S30 D1000 or M906) - Sets or gets the holding current (S, percent of the running current) and the time without motion before it is applied (D, ms)
+static String handleM906(const parsedCommand &command) {
+    int32_t percent, delay;
+    bool hasPercent = findWordInt(command, 'S', percent);
+    bool hasDelay = findWordInt(command, 'D', delay);
+
+    // Check to make sure that at least one is given
+    if (hasPercent || hasDelay) {
+
+        // Check the values before setting either of them
+        if ((hasPercent && (percent < 1 || percent > 100)) || (hasDelay && delay < 0)) {
+            return FEEDBACK_BAD_VALUE;
+        }
+
+        // Set the values that were given
+        if (hasPercent) {
+            motor.setIdleCurrentPercent(percent);
+        }
+        if (hasDelay) {
+            motor.setIdleCurrentDelay(delay);
+        }
+        return FEEDBACK_OK;
+    }
+    else {
+        // No values, therefore just return the current values
+        return ("S: " + String(motor.getIdleCurrentPercent()) + " | D: " + String(motor.getIdleCurrentDelay()));
+    }
+}
+#endif
+
+
+#ifdef ENABLE_CURRENT_ON_DEMAND
+// M916 (ex M916 S40 E5 G20 or M916) - Sets or gets the current on demand. S is the base current, E is the current added per microstep of error, and G is the current added per microstep that the error grew by since the last correction (all % of the set current)
+static String handleM916(const parsedCommand &command) {
+    int32_t base, errorGain, growthGain;
+    bool hasBase = findWordInt(command, 'S', base);
+    bool hasErrorGain = findWordInt(command, 'E', errorGain);
+    bool hasGrowthGain = findWordInt(command, 'G', growthGain);
+
+    // Check to make sure that at least one is given
+    if (hasBase || hasErrorGain || hasGrowthGain) {
 
-            case 500:
-                // M500 (ex M500) - Saves the currently loaded parameters into flash
-                saveParameters();
-                return FEEDBACK_OK;
+        // Check the values before setting any of them
+        if ((hasBase && (base < 1 || base > 100)) || (hasErrorGain && errorGain < 0) || (hasGrowthGain && growthGain < 0)) {
+            return FEEDBACK_BAD_VALUE;
+        }
+
+        // Set the values that were given
+        if (hasBase) {
+            motor.setDemandBaseCurrent(base);
+        }
+        if (hasErrorGain) {
+            motor.setDemandErrorGain(min(errorGain, (int32_t)UINT16_MAX));
+        }
+        if (hasGrowthGain) {
+            motor.setDemandGrowthGain(min(growthGain, (int32_t)UINT16_MAX));
+        }
+        return FEEDBACK_OK;
+    }
+    else {
+        // No values, therefore just return the current values
+        return ("S: " + String(motor.getDemandBaseCurrent()) + " | E: " + String(motor.getDemandErrorGain()) + " | G: " + String(motor.getDemandGrowthGain()) + " | Current: " + String(motor.getDemandCurrent()));
+    }
+}
+#endif
+
+
+// M907
+static String handleM907(const parsedCommand &command) {
+
+    // Sets or gets the RMS(R) or Peak(P) current in mA. If dynamic current is enabled, then the accel(A), idle(I), and/or max(M) can be set or retrieved. If no value is set, then the current RMS current (no dynamic current) or the accel, idle, and max terms (dynamic current) will be returned.
+    #ifdef ENABLE_DYNAMIC_CURRENT
+        // Read the set values, keeping the ones that aren't given
+        int32_t accelCurrent, idleCurrent, maxCurrent;
+        bool hasAccel = findWordInt(command, 'A', accelCurrent);
+        bool hasIdle = findWordInt(command, 'I', idleCurrent);
+        bool hasMax = findWordInt(command, 'M', maxCurrent);
 
-            case 501: {
-                // M501 (ex M501) - Loads all saved parameters from flash
-                return loadParameters();
+        // Check to make sure that at least one is given
+        if (hasAccel || hasIdle || hasMax) {
+
+            // Check the values before setting any of them
+            if ((hasAccel && (accelCurrent < 0 || accelCurrent > UINT16_MAX)) || (hasIdle && (idleCurrent < 0 || idleCurrent > UINT16_MAX)) ||
+                (hasMax && (maxCurrent < 0 || maxCurrent > UINT16_MAX))) {
+                return FEEDBACK_BAD_VALUE;
             }
 
-            case 502:
-                // M502 (ex M502) - Wipes all parameters from flash, then reboots the system
-                wipeParameters();
-                // No return here because wipeParameters reboots processor
-
-            case 907: {
-                // Sets or gets the RMS(R) or Peak(P) current in mA. If dynamic current is enabled, then the accel(A), idle(I), and/or max(M) can be set or retrieved. If no value is set, then the current RMS current (no dynamic current) or the accel, idle, and max terms (dynamic current) will be returned.
-                #ifdef ENABLE_DYNAMIC_CURRENT
-                    // Read the set values
-                    uint16_t accelCurrent = parseValue(buffer, 'A').toInt();
-                    uint16_t idleCurrent = parseValue(buffer, 'I').toInt();
-                    uint16_t maxCurrent = parseValue(buffer, 'M').toInt();
-
-                    // Check to make sure that at least one isn't -1 (there is at least one that is valid)
-                    if (!((accelCurrent == -1) && (idleCurrent == -1) && (maxCurrent == -1))) {
-
-                        // Set the values
-                        motor.setDynamicAccelCurrent(accelCurrent);
-                        motor.setDynamicIdleCurrent(idleCurrent);
-                        motor.setDynamicMaxCurrent(maxCurrent);
-                    }
-                    else {
-                        // No valid values, therefore just return the current values
-                        return ("A:" + String(motor.getDynamicAccelCurrent()) + " I: " + String(motor.getDynamicIdleCurrent()) + " M: " + String(motor.getDynamicMaxCurrent()) + "\n");
-                    }
-
-                #else
-                    // Read the set values (one of them should be -1 (no value exists))
-                    uint16_t rmsCurrent = parseValue(buffer, 'R').toInt();
-                    uint16_t peakCurrent = parseValue(buffer, 'P').toInt();
-
-                    // Check if RMS current is valid
-                    if (rmsCurrent != -1) {
-                        motor.setRMSCurrent(rmsCurrent);
-                        return FEEDBACK_OK;
-                    }
-                    else if (peakCurrent != -1) {
-                        motor.setPeakCurrent(peakCurrent);
-                        return FEEDBACK_OK;
-                    }
-                    else {
-                        // No value set. Just return the RMS current
-                        return String(motor.getRMSCurrent());
-                    }
-                #endif
+            // Set the values
+            if (hasAccel) {
+                motor.setDynamicAccelCurrent(accelCurrent);
+            }
+            if (hasIdle) {
+                motor.setDynamicIdleCurrent(idleCurrent);
             }
-            case 1000: {
-                // Just for testing
-                Serial.println("Testing parseString");
-                return parseString(buffer, 'S');
+            if (hasMax) {
+                motor.setDynamicMaxCurrent(maxCurrent);
             }
+            return FEEDBACK_OK;
+        }
+        else {
+            // No valid values, therefore just return the current values
+            return ("A:" + String(motor.getDynamicAccelCurrent()) + " I: " + String(motor.getDynamicIdleCurrent()) + " M: " + String(motor.getDynamicMaxCurrent()) + "\n");
+        }
+
+    #else
+        // Read the set values (only one of them should be given)
+        int32_t rmsCurrent, peakCurrent;
 
-            default: {
-                // Command isn't recognized, therefore throw an error
-                return FEEDBACK_CMD_NOT_AVAILABLE;
+        // Set the RMS current if it is given, otherwise the peak current
+        if (findWordInt(command, 'R', rmsCurrent)) {
+            if (rmsCurrent < 0 || rmsCurrent > UINT16_MAX) {
+                return FEEDBACK_BAD_VALUE;
+            }
+            motor.setRMSCurrent(rmsCurrent);
+            return FEEDBACK_OK;
+        }
+        else if (findWordInt(command, 'P', peakCurrent)) {
+            if (peakCurrent < 0 || peakCurrent > UINT16_MAX) {
+                return FEEDBACK_BAD_VALUE;
             }
+            motor.setPeakCurrent(peakCurrent);
+            return FEEDBACK_OK;
+        }
+        else {
+            // No value set. Just return the RMS current
+            return String(motor.getRMSCurrent());
+        }
+    #endif
+}
+
+
+#ifdef ENABLE_STALL_DETECTION
+// M914 (ex M914 S60 or M914) - Sets or gets the sensitivity of the stall detection (0 to 100, higher trips sooner). The number of stalls detected since boot is returned with the sensitivity.
+static String handleM914(const parsedCommand &command) {
+    int32_t setValue;
+    if (findWordInt(command, 'S', setValue)) {
+
+        // Set the value if it is valid
+        if (setValue < 0 || setValue > 100) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        setStallSensitivity(setValue);
+        return FEEDBACK_OK;
+    }
+    else {
+        // No value exists, get and return the current value
+        return ("S: " + String(getStallSensitivity()) + " | Stalls: " + String(getStallCount()));
+    }
+}
+#endif
+
+
+#ifdef ENABLE_SPEED_CURRENT_BOOST
+// M918 (ex M918 N2 V600 S130 or M918 N2) - Sets or gets a point (N) of the current boost table. V is the speed (RPM), S is the current at that speed (% of the set current). If no values are provided, then the point will be returned with the boost being applied.
+static String handleM918(const parsedCommand &command) {
+    int32_t index = getWordInt(command, 'N');
+    if (index < 0 || index >= CURRENT_BOOST_POINTS) {
+        return FEEDBACK_NO_VALUE;
+    }
+
+    // Start from the current point, then replace any values that were given
+    currentBoostPoint point = motor.getCurrentBoostPoint(index);
+    int32_t speedValue, boostValue;
+    bool hasSpeed = findWordInt(command, 'V', speedValue);
+    bool hasBoost = findWordInt(command, 'S', boostValue);
+    if (hasSpeed || hasBoost) {
+        if ((hasSpeed && speedValue < 0) || (hasBoost && boostValue < 0)) {
+            return FEEDBACK_BAD_VALUE;
+        }
+        if (hasSpeed) {
+            point.rpm = min(speedValue, (int32_t)UINT16_MAX);
         }
+        if (hasBoost) {
+            point.percent = min(boostValue, (int32_t)UINT16_MAX);
+        }
+
+        // The correction reads the table, so it can't run halfway through the update
+        disableInterrupts();
+        motor.setCurrentBoostPoint(index, point);
+        enableInterrupts();
+        return FEEDBACK_OK;
+    }
+    else {
+        // No values are included, return the point
+        return ("V: " + String(point.rpm) + " | S: " + String(point.percent) + " | Boost: " + String(motor.getCurrentBoost()));
+    }
+}
+#endif
+
+
+#ifdef ENABLE_THERMAL_MODEL
+// M919 (ex M919) - Gets the estimated temperature of the coils, the temperature of the encoder, and the current that the thermal model is allowing (% of the set current)
+static String handleM919(const parsedCommand &command) {
+    return motor.getThermalStatus();
+}
+#endif
+
+
+#ifdef ENABLE_TORQUE_MODE
+// M920 (ex M920 S300 V120 or M920) - Holds a torque instead of a position. S is the coil current (mA, positive pushes counter clockwise), and V is the speed that the torque is cut back past (RPM). If no values are provided, then the current values and the speed will be returned
+static String handleM920(const parsedCommand &command) {
+    const commandWord* current = findWord(command, 'S');
+    int32_t speedLimit;
+    bool hasSpeedLimit = findWordInt(command, 'V', speedLimit);
+
+    // No values, just return the current values
+    if (current == nullptr && !hasSpeedLimit) {
+        return ("S: " + String(motor.getTorqueTarget()) + F(" | V: ") + String(motor.getTorqueSpeedLimit()) +
+                F(" | Current: ") + String(motor.getTorqueCurrent()) + F(" | RPM: ") + String((motor.encoder.getObserverVelocity() * 60) / ENCODER_COUNTS_PER_REV) +
+                (motor.isTorqueModeActive() ? F(" | Active") : F(" | Off")));
+    }
+
+    // Check the values before setting either of them
+    if ((current != nullptr && abs(current -> intValue) > MAX_PEAK_BOARD_CURRENT) || (hasSpeedLimit && (speedLimit <= 0 || speedLimit > UINT16_MAX))) {
+        return FEEDBACK_BAD_VALUE;
+    }
+    if (current != nullptr && isCalibrating()) {
+        return FEEDBACK_CALIBRATING;
+    }
+
+    // Set the limit first, so the torque starts under it
+    if (hasSpeedLimit) {
+        motor.setTorqueSpeedLimit(speedLimit);
+    }
+    if (current != nullptr && !motor.setTorqueMode(current -> intValue)) {
+        return F("Torque mode can't start during a move");
+    }
+    return FEEDBACK_OK;
+}
+
+
+// M921 (ex M921) - Leaves the torque mode, the motor holds where it was pushed to
+static String handleM921(const parsedCommand &command) {
+    motor.exitTorqueMode();
+    return FEEDBACK_OK;
+}
+#endif
+
+
+#ifdef ENABLE_CONTROL_MODES
+// M922 (ex M922 S2 or M922) - Switches the control mode (S), 0 is the open loop, 1 is the direction based correction, 2 is the PID, and 3 is the torque mode. If no mode is provided, then the running mode and the closed loop mode will be returned
+static String handleM922(const parsedCommand &command) {
+    int32_t mode;
+
+    // No mode, just return the modes
+    if (!findWordInt(command, 'S', mode)) {
+        CONTROL_MODE runningMode = getControlMode();
+        return ("S: " + String(runningMode) + F(" (") + getControlModeName(runningMode) + F(") | Closed loop: ") + getControlModeName(getCorrectionMode()));
     }
 
-    // Gcodes support
+    // Check that the mode exists, then switch to it
+    if (mode < 0 || mode >= CONTROL_MODE_COUNT || !isControlModeAvailable((CONTROL_MODE)mode)) {
+        return FEEDBACK_BAD_VALUE;
+    }
+    if (!setControlMode((CONTROL_MODE)mode)) {
+        return F("Control mode can't change during a move, the calibration, or the autotune");
+    }
+    return FEEDBACK_OK;
+}
+#endif
+
+
+#ifdef ENABLE_CAN_GEARING
+// M923 (ex M923 S2 N-1 D1 O0, M923 B1, M923 S-1, or M923) - Sets or gets the electronic gearing. S is the CAN ID of the master to follow (-1 stops following), N and D are the gear ratio (the follower moves N / D microsteps for each microstep of the master), and O is the offset (microsteps). B1 broadcasts the board's position for followers. If no values are provided, then the current values and the state of the following will be returned
+static String handleM923(const parsedCommand &command) {
+    const commandWord* master = findWord(command, 'S');
+    const commandWord* numerator = findWord(command, 'N');
+    const commandWord* denominator = findWord(command, 'D');
+    const commandWord* offset = findWord(command, 'O');
+    int32_t broadcast;
+    bool hasBroadcast = findWordInt(command, 'B', broadcast);
+
+    // No values, just return the gearing
+    if (master == nullptr && numerator == nullptr && denominator == nullptr && offset == nullptr && !hasBroadcast) {
+        return ("S: " + String(getGearMaster()) + F(" | N: ") + String(getGearNumerator()) + F(" | D: ") + String(getGearDenominator()) +
+                F(" | O: ") + String(getGearOffset()) + F(" | B: ") + String(getGearBroadcast()) + F(" | ") + getGearStatus());
+    }
+
+    // Check all of the values before any of them are set
+    int32_t newNumerator = (numerator != nullptr ? (numerator -> intValue) : getGearNumerator());
+    int32_t newDenominator = (denominator != nullptr ? (denominator -> intValue) : getGearDenominator());
+    if (newDenominator == 0 || (hasBroadcast && (broadcast < 0 || broadcast > 1))) {
+        return FEEDBACK_BAD_VALUE;
+    }
+    if (master != nullptr && ((master -> intValue) < NONE || (master -> intValue) > E7 || (master -> intValue) == getCANID())) {
+        return FEEDBACK_BAD_VALUE;
+    }
+
+    // The follower can't be moved by anything else
+    bool moving = false;
     #ifdef ENABLE_DIRECT_STEPPING
-    // Check to see if a gcode exists
-    else if (parseValue(buffer, 'G') != "-1") {
-
-        // Switch statement the command number
-        switch (parseValue(buffer, 'G').toInt()) {
-
-            case 6: {
-                // G6 (ex G6 D0 R1000 S1000) - Direct stepping, commands the motor to move a specified number of steps in the specified direction. D is direction (0 for CCW, 1 for CW), R is rate (in Hz), and S is the count of steps to move
-                // Pull the values from the command
-                bool reverse = parseValue(buffer, 'D').equals("1");
-                int32_t rate = parseValue(buffer, 'R').toInt();
-                int64_t count = parseValue(buffer, 'S').toInt();
-
-                // Sanitize the inputs
-                if (rate <= 0) {
-                    rate = DEFAULT_STEPPING_RATE;
-                }
-                if (count <= 0) {
-                    return FEEDBACK_NO_VALUE;
-                }
-
-                // Call the steps to be scheduled
-                if (!reverse) {
-                    scheduleSteps(count, rate, COUNTER_CLOCKWISE);
-                }
-                else {
-                    scheduleSteps(count, rate, CLOCKWISE);
-                }
-
-                // All good, we can exit
-                return FEEDBACK_OK;
-            }
+        moving = isDirectMoveRunning();
+    #endif
+    #ifdef ENABLE_PVT_TRAJECTORY
+        moving = (moving || isPVTActive());
+    #endif
+    if (master != nullptr && (master -> intValue) != NONE && moving) {
+        return F("Can't start following during a move");
+    }
 
-            default: {
-                // Command isn't recognized, therefore throw an error
-                return FEEDBACK_CMD_NOT_AVAILABLE;
-            }
+    // Set the values that were given, the ratio and the offset first so the follower starts with them
+    setGearRatio(newNumerator, newDenominator);
+    if (offset != nullptr) {
+        setGearOffset(offset -> intValue);
+    }
+    if (hasBroadcast) {
+        setGearBroadcast(broadcast == 1);
+    }
+    if (master != nullptr) {
+        setGearMaster((AXIS_CAN_ID)(master -> intValue));
+    }
+    return FEEDBACK_OK;
+}
+#endif
+
+
+// M1000 (ex M1000 S"A message") - Just for testing, echoes the text of the S word
+static String handleM1000(const parsedCommand &command) {
+    return getWordText(findWord(command, 'S'));
+}
+
+
+#ifdef ENABLE_DIRECT_STEPPING
+#ifdef ENABLE_MOTION_PLANNER
+// G0 (ex G0 P3200 R1000 A20000 J2000000) - Absolute move, moves the motor to a position (P, in microsteps) along a jerk limited profile. R is the cruise rate (in Hz), A is the acceleration (in steps/s/s), and J is the jerk (in steps/s/s/s)
+static String handleG0(const parsedCommand &command) {
+
+    // Pull the values from the command
+    int32_t target;
+    bool hasTarget = findWordInt(command, 'P', target);
+    int32_t rate = getWordInt(command, 'R');
+    int32_t accel = getWordInt(command, 'A');
+    int32_t jerk = getWordInt(command, 'J');
+
+    // Sanitize the inputs
+    if (!hasTarget) {
+        return FEEDBACK_NO_VALUE;
+    }
+    if (rate <= 0) {
+        rate = DEFAULT_STEPPING_RATE;
+    }
+    if (accel <= 0) {
+        accel = DEFAULT_PLANNER_ACCEL;
+    }
+    if (jerk <= 0) {
+        jerk = DEFAULT_PLANNER_JERK;
+    }
+
+    // Find the number of steps needed to get to the target from where the last move ends (each step moves the multiplier's worth of microsteps)
+    int64_t count = round((target - getMoveEndPosition()) / motor.getMicrostepMultiplier());
+
+    // Already there, nothing to do
+    if (count == 0) {
+        return FEEDBACK_OK;
+    }
+
+    // Start the move (counter clockwise is positive)
+    return startMove(count, rate, accel, jerk);
+}
+#endif // ! ENABLE_MOTION_PLANNER
+
+
+#ifdef ENABLE_SENSORLESS_HOMING
+// G28 (ex G28 D1 R2000 B800 or G28) - Homes the motor against a hard stop without an endstop. D is direction (0 for CCW, 1 for CW), R is the rate (in Hz), and B is the distance to back off afterward (in steps). Blocks until the motor has backed off
+static String handleG28(const parsedCommand &command) {
+    int32_t rate = getWordInt(command, 'R');
+    int32_t backoff = getWordInt(command, 'B');
+    return runSensorlessHoming((getWordInt(command, 'D') == 1 ? CLOCKWISE : COUNTER_CLOCKWISE), (rate > 0 ? rate : 0), (backoff >= 0 ? backoff : HOMING_BACKOFF));
+}
+#endif
+
+
+// G6 (ex G6 D0 R1000 S1000 or G6 D0 R1000 S1000 A20000 J2000000) - Direct stepping, commands the motor to move a specified number of steps in the specified direction. D is direction (0 for CCW, 1 for CW), R is rate (in Hz), and S is the count of steps to move. If the motion planner is enabled, A (acceleration, in steps/s/s) and/or J (jerk, in steps/s/s/s) ramp the move in and out along an S-curve
+static String handleG6(const parsedCommand &command) {
+
+    // Pull the values from the command
+    bool reverse = (getWordInt(command, 'D') == 1);
+    int32_t rate = getWordInt(command, 'R');
+    int32_t count;
+    int32_t accel = 0;
+    int32_t jerk = 0;
+
+    // Sanitize the inputs
+    if (rate <= 0) {
+        rate = DEFAULT_STEPPING_RATE;
+    }
+    if (!findWordInt(command, 'S', count)) {
+        return FEEDBACK_NO_VALUE;
+    }
+    if (count <= 0) {
+        return FEEDBACK_BAD_VALUE;
+    }
+
+    // Plan the move if an acceleration or jerk was given
+    #ifdef ENABLE_MOTION_PLANNER
+    accel = getWordInt(command, 'A');
+    jerk = getWordInt(command, 'J');
+    if (accel > 0 || jerk > 0) {
+
+        // Fill in the limit that wasn't specified
+        if (accel <= 0) {
+            accel = DEFAULT_PLANNER_ACCEL;
+        }
+        if (jerk <= 0) {
+            jerk = DEFAULT_PLANNER_JERK;
         }
+    }
+    else {
+        // Constant rate move
+        accel = 0;
+        jerk = 0;
+    }
+    #endif // ! ENABLE_MOTION_PLANNER
+
+    // Start the move (counter clockwise is positive)
+    return startMove((!reverse ? count : -count), rate, accel, jerk);
+}
+#endif // ! ENABLE_DIRECT_STEPPING
+
+
+#ifdef ENABLE_PVT_TRAJECTORY
+// G5 (ex G5 P3200 V6400 T500) - Adds a point to the trajectory buffer. P is the position (in microsteps), V is the velocity at the position (in microsteps/s), and T is the time to reach it from the last point (in ms). The trajectory starts once PVT_PREFILL_POINTS are buffered, or right away with a point that ends at rest
+static String handleG5(const parsedCommand &command) {
+
+    // Pull the values from the command
+    const commandWord* position = findWord(command, 'P');
+    const commandWord* velocity = findWord(command, 'V');
+    int32_t duration;
+
+    // Sanitize the inputs
+    if (position == nullptr || !findWordInt(command, 'T', duration)) {
+        return FEEDBACK_NO_VALUE;
+    }
+    if (duration < 1 || duration > UINT16_MAX) {
+        return FEEDBACK_BAD_VALUE;
+    }
 
+    // Buffer the point
+    pvtPoint point = { position -> intValue, (velocity != nullptr ? (velocity -> intValue) : 0), (uint16_t)duration };
+    switch (queuePVTPoint(point)) {
+        case PVT_QUEUED:
+            return FEEDBACK_OK;
+        case PVT_FULL:
+            return F("Trajectory buffer full, try again once a segment finishes");
+        case PVT_BUSY:
+            return F("Motor is busy with another move");
+        default:
+            return FEEDBACK_BAD_VALUE;
     }
+}
 
+
+// M924 (ex M924 C1 or M924) - Clears the trajectory buffer (C1), the motor stops at the end of the running segment. If no values are provided, then the state of the trajectory, the buffered points, the free slots, and the underruns will be returned
+static String handleM924(const parsedCommand &command) {
+    int32_t clear;
+    if (!findWordInt(command, 'C', clear)) {
+        return ("Active: " + String(isPVTActive()) + F(" | Points: ") + String(getPVTBufferedPoints()) + F(" | Free: ") + String(getPVTFreeSlots()) +
+                F(" | Underruns: ") + String(getPVTUnderruns()));
+    }
+    if (clear != 1) {
+        return FEEDBACK_BAD_VALUE;
+    }
+    clearPVT();
+    return FEEDBACK_OK;
+}
+#endif
+
+
+// Gcode Table
+//  - M3 (ex M3 S120 A600 or M3) - Jogs clockwise, ramping to the speed (S, RPM) with the acceleration (A, RPM/s), then holds the speed until it is changed or stopped. If no speed is provided, then the speed of the jog will be returned. Requires `ENABLE_JOG`
+//  - M4 (ex M4 S120 A600 or M4) - Jogs counter clockwise, the same as M3. Requires `ENABLE_JOG`
+//  - M5 (ex M5 A600 or M5) - Ramps the jog to a stop with the acceleration (A, RPM/s). Requires `ENABLE_JOG`
+//  - M17 (ex M17) - Enables the motor (overrides enable pin)
+//  - M18 / M84 (ex M18 or M84) - Disables the motor (overrides enable pin)
+//  - M93 (ex M93 V1.8 or M93) - Sets the angle of a full step. This value should be 1.8° or 0.9°. If no value is provided, then the current value will be returned.
+//  - M115 (ex M115) - Prints out firmware information, consisting of the version and any enabled features.
+//  - M122 (ex M122 or M122 R1) - Reports the runtime statistics of the main loop's tasks (runs, average and max runtime, and late runs). R1 clears the statistics afterward
+//  - M123 (ex M123 or M123 R1) - Reports the cycle statistics of the interrupts and encoder reads (runs, min, average, and max cycles, and CPU load), along with the longest time that the interrupts were masked, and the encoder's SPI clock with the time of a read. R1 clears the statistics afterward. Requires `ENABLE_PROFILING`
+//  - M124 (ex M124 or M124 R1) - Reports the error statistics of the links (CAN error counters, state, bus-off and error passive events, protocol errors, drops, and FIFO overruns, the USART's line errors, the encoder's errors, and the commands that were rejected). R1 clears the statistics afterward
+//  - M125 (ex M125 or M125 B1) - Reads every register of the encoder in a few checked bursts, then reports them as "name: value" in hex. B1 sends them as raw binary instead (the error, then each register as 16 bit little endian)
+//  - M126 (ex M126) - Reports the use of the RAM, the static variables, the heap (taken and in use), the stack (now and the deepest since boot, including the nested interrupts), and the RAM that was never used. Requires `ENABLE_MEMORY_STATS`
+//  - M116 (ex M116 S1 M"A message") - Simple forward command that will forward a message across the CAN bus. Can be used for pinging or allowing a Serial to connect to the CAN network
+//  - M211 (ex M211 S1 L-3200 H3200 V20000 A200000, M211 C1, or M211) - Sets or gets the soft limits. S turns them on (1) or off (0), L and H are the lowest and highest positions (microsteps), V is the max velocity (microsteps/s), and A is the max acceleration of the moves (microsteps/s/s, 0 doesn't limit either). Going past a position limit or the max velocity stops the moves and ignores the step input until the fault is cleared with C1. If no values are provided, then the current values and the fault will be returned. Requires `ENABLE_SOFT_LIMITS`
+//  - M306 (ex M306 P1 I1 D1 W10 or M306) - Sets or gets the PID values for the motor. W term is the maximum value of the I windup. If no values are provided, then the current values will be returned.
+//  - M311 (ex M311 N1 V60 P120 I100 D80 or M311 N1) - Sets or gets a point (N) of the PID gain schedule. V is the speed (RPM), P, I, and D are the gains at that speed (% of the M306 gains). If no values are provided, then the point will be returned. Requires `ENABLE_GAIN_SCHEDULING`
+//  - M307 (ex M307 or M307 R2000) - Runs an autotune sequence for the PID loop, then saves the gains. R is the relay's step rate (steps/s). Without `ENABLE_AUTOTUNE`, the encoder is calibrated instead (like M313 S1)
+//  - M308 (ex M308) - Runs the manual PID tuning interface. Serial is filled with encoder angles
+//  - M309 (ex M309 S1 E50 P200 D1, M309 S0, or M309) - Arms (S1) or stops (S0) the trace of the control loop. Triggers once the step error reaches E (0 triggers right away), then records P more samples, one every D corrections. If no values are provided, then the state of the trace will be returned. Requires `ENABLE_TRACE`
+//  - M310 (ex M310 or M310 B1) - Dumps the trace over serial, oldest sample first. Each line is "time,steps,counts,error,output,cycles,flags". B1 sends the samples as raw binary instead. Requires `ENABLE_TRACE`
+//  - M313 (ex M313 S1, M313 S0, or M313) - Starts (S1) or aborts (S0) the calibration of the encoder. It runs in the background, sweeping each full step of a rotation forward and back, then saves and applies the result without a reboot (the position starts over at 0). Motion commands are refused until it finishes. If no values are provided, then the progress of the calibration will be returned.
+//  - M314 (ex M314 or M314 R1) - Reports the timing of the step input, measured by the hardware (steps, rate, the last, shortest, and longest intervals, and the largest change between a pair of intervals). R1 clears the statistics afterward. Requires `ENABLE_STEP_CAPTURE`
+//  - M315 (ex M315 or M315 R200000) - Runs the self-test of the highest step rate, stepping bursts back and forth at rising rates up to R (steps/s) until the board can't keep up. Returns the highest rate that passed in steps and full steps, why the next rate failed, and the limit of the step input's filter. Requires `ENABLE_STEP_RATE_TEST`
+//  - M316 (ex M316 T200 or M316) - Sets or gets the gain of the mid-band resonance damping (us, 0 turns it off). If no value is provided, then the current value will be returned. Requires `ENABLE_RESONANCE_DAMPING`
+//  - M317 (ex M317 S1 or M317) - Turns the latency compensation of the position feedback on (S1) or off (S0). If no value is provided, then the state will be returned with the delay being compensated for. Requires `ENABLE_LATENCY_COMPENSATION`
+//  - M318 (ex M318 or M318 N20000) - Runs the characterization of the encoder, pausing the correction and reading N raw samples (`ENCODER_NOISE_TEST_SAMPLES` if not given) at the control loop's rate. Returns the noise of the angle (standard deviation and peak to peak, alone and averaged over `ANGLE_AVG_READINGS`), the CRC and other errors of the reads, and the min, average, and max time of the SPI transactions. Requires `ENABLE_ENCODER_NOISE_TEST`
+//  - M319 (ex M319 or M319 R1) - Reports the motion quality of the last move: its duration, RMS and peak following error, corrective steps, largest lead angle, and settling time, with the number of moves, the unsettled ones, and the worst peak error and settling time since the metrics were cleared. R1 clears the metrics afterward. Requires `ENABLE_MOVE_METRICS`
+//  - M320 (ex M320 S1 E50 D1, M320 S2, M320 S0, or M320) - Captures the step input (S1), replays the held stream back into the step input (S2), or stops either (S0). The capture records until the buffer is full, or with E, keeps recording and stops a quarter of the buffer after the step error reaches E. Each entry covers D corrections (`DEFAULT_STEP_STREAM_DIVIDER` if not given). If no values are provided, then the state of the stream will be returned with the following error of the last replay. Requires `ENABLE_STEP_STREAM`
+//  - M321 (ex M321, M321 C1 D1, or M321 T1200 S3) - Dumps the held step stream over serial as "<time in us> <steps>" lines (the file that the native simulation replays). C1 clears the stream for loading one (an entry every D corrections), then each T S adds S steps at T us, in order of time. Requires `ENABLE_STEP_STREAM`
+//  - M322 (ex M322 S1, M322 S0, M322 C1, or M322) - Starts (S1) or aborts (S0) the learning pass of the detent torque table. It runs in the background, stepping the coils slowly through a rotation forward and back with the correction paused, then refines the table by the ripple of the rotor around the coils, and saves and applies it. Motion commands are refused until it finishes. C1 clears the table. If no values are provided, then the progress of the pass (or the ripple that it found) will be returned. Requires `ENABLE_DETENT_COMPENSATION`
+//  - M323 (ex M323 C1 or M323) - Gets the shape of the coil waveform that the calibration fit, the third harmonic and the balance of coil A over coil B (percent of the sine). C1 returns the coils to a sine, the next calibration fits it again from there. If no values are provided, then the current shape will be returned. Requires `ENABLE_WAVEFORM_SHAPING`
+//  - M324 (ex M324 or M324 R1) - Reports the load of the control loop: the level of work being shed, the filtered and peak runtime of the corrections (percent of the loop's period), the longest correction, the overruns, and the times that the work was shed. R1 clears the statistics afterward. Requires `ENABLE_OVERRUN_DETECTION`
+//  - M325 (ex M325 E3 X1 or M325) - Sets or gets the hysteresis of the correction, E is the filtered error that starts the correction and X is the error that it runs down to (microsteps). The exit has to be below the enter, which can't be above `CORRECTION_IMMEDIATE_ERROR`. If no values are provided, then the current values will be returned. Requires `ENABLE_CORRECTION_HYSTERESIS`
+//  - M350 (ex M350 V16 or M350) - Sets or gets the microstepping divisor for the motor. This value can be 1, 2, 4, 8, 16, or 32. If no value is provided, then the current microstepping divisor will be returned.
+//  - M352 (ex M352 S1 or M352) - Sets or gets the direction pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
+//  - M353 (ex M353 S1 or M353) - Sets or gets the enable pin inversion for the motor (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
+//  - M354 (ex M354 S1 or M354) - Sets or gets if the motor dip switches were installed incorrectly (reversed) (0 is standard, 1 is inverted). If no value is provided, then the current value will be returned.
+//  - M355 (ex M355 V1.34 or M355) - Sets or gets the microstep multiplier for the board. Allows to use multiple motors connected to the same mainboard pin, yet have different rates. If no value is provided, then the current value will be returned.
+//  - M356 (ex M356 V1 or M356 VX2 or M356) - Sets or gets the CAN ID of the board. Can be set using the axis character or actual ID. If no value is provided, then the current value will be returned.
+//  - M358 (ex M358 S7, M358 R1, or M358) - Sets or gets the digital filter of the step input (0 to 15). The glitches and the fastest clean rate are returned with it with `ENABLE_STEP_GLITCH_STATS`, and R1 clears them afterward
+//  - M500 (ex M500) - Saves the currently loaded parameters into flash
+//  - M501 (ex M501) - Loads all saved parameters from flash
+//  - M502 (ex M502) - Wipes all parameters from flash, then reboots the system
+//  - M575 (ex M575 B1000000 or M575) - Sets or gets the baud rate of the serial bus (up to 2 Mbaud). An ok is sent at the old rate, then the new rate is reported at the new one. Save with M500 to keep it. Requires `ENABLE_SERIAL`
+//  - M906 (ex M906 S30 D1000 or M906) - Sets or gets the holding current (S, percent of the running current) and the time without motion before it is applied (D, ms). Requires `ENABLE_IDLE_CURRENT`
+//  - M907 (ex M907 R750, M907 I500) - Sets or gets the RMS(R) or Peak(P) current in mA. If dynamic current is enabled, then the accel(A), idle(I), and/or max(M) can be set or retrieved. If no value is set, then the current RMS current (no dynamic current) or the accel, idle, and max terms (dynamic current) will be returned.
+//  - M914 (ex M914 S60 or M914) - Sets or gets the sensitivity of the stall detection (0 to 100, higher trips sooner). The number of stalls detected since boot is returned with the sensitivity. Requires `ENABLE_STALL_DETECTION`
+//  - M916 (ex M916 S40 E5 G20 or M916) - Sets or gets the current on demand. S is the base current, E is the current added per microstep of error, and G is the current added per microstep that the error grew by since the last correction (all % of the set current). The current being applied is returned with the values. Requires `ENABLE_CURRENT_ON_DEMAND`
+//  - M918 (ex M918 N2 V600 S130 or M918 N2) - Sets or gets a point (N) of the current boost table. V is the speed (RPM), S is the current at that speed (% of the set current). If no values are provided, then the point will be returned with the boost being applied. Requires `ENABLE_SPEED_CURRENT_BOOST`
+//  - M919 (ex M919) - Gets the estimated temperature of the coils, the temperature of the encoder, and the current that the thermal model is allowing (% of the set current). Requires `ENABLE_THERMAL_MODEL`
+//  - M920 (ex M920 S300 V120 or M920) - Holds a torque instead of a position. S is the coil current (mA, positive pushes counter clockwise), and V is the speed that the torque is cut back past (RPM). The step input is counted but doesn't move the motor, and the moves are refused until the mode is left. If no values are provided, then the current values and the speed will be returned. Requires `ENABLE_TORQUE_MODE`
+//  - M921 (ex M921) - Leaves the torque mode, the motor holds where it was pushed to. Requires `ENABLE_TORQUE_MODE`
+//  - M922 (ex M922 S2 or M922) - Switches the control mode (S), 0 is the open loop, 1 is the direction based correction, 2 is the PID, and 3 is the torque mode. The state of the last mode is handed over, so the motor doesn't jerk. If no mode is provided, then the running mode and the closed loop mode will be returned. Requires `ENABLE_CONTROL_MODES`
+//  - M923 (ex M923 S2 N-1 D1 O0, M923 B1, M923 S-1, or M923) - Sets or gets the electronic gearing. S is the CAN ID of the master to follow (-1 stops following), N and D are the gear ratio (the follower moves N / D microsteps for each microstep of the master), and O is the offset (microsteps). B1 broadcasts the board's position for followers. Moves are refused while following. If no values are provided, then the current values and the state of the following will be returned. Requires `ENABLE_CAN_GEARING`
+//  - M924 (ex M924 C1 or M924) - Clears the trajectory buffer (C1), the motor stops at the end of the running segment. If no values are provided, then the state of the trajectory, the buffered points, the free slots, and the underruns will be returned. Requires `ENABLE_PVT_TRAJECTORY`
+
+// Command table, sorted by code so that it can be binary searched (checked when compiling)
+// Features add their commands by adding rows, inside of the same #ifdef as their handler
+static constexpr commandEntry commandTable[] = {
+    #if defined(ENABLE_DIRECT_STEPPING) && defined(ENABLE_MOTION_PLANNER)
+    { COMMAND_CODE('G', 0), handleG0, COMMAND_FLAG_MOTION },
+    #endif
+    #ifdef ENABLE_PVT_TRAJECTORY
+    { COMMAND_CODE('G', 5), handleG5, COMMAND_FLAG_MOTION },
+    #endif
+    #ifdef ENABLE_DIRECT_STEPPING
+    { COMMAND_CODE('G', 6), handleG6, COMMAND_FLAG_MOTION },
+    #ifdef ENABLE_SENSORLESS_HOMING
+    { COMMAND_CODE('G', 28), handleG28, COMMAND_FLAG_MOTION | COMMAND_FLAG_BLOCKING },
+    #endif
+    #endif
+    #ifdef ENABLE_JOG
+    { COMMAND_CODE('M', 3), handleM3, COMMAND_FLAG_MOTION },
+    { COMMAND_CODE('M', 4), handleM4, COMMAND_FLAG_MOTION },
+    { COMMAND_CODE('M', 5), handleM5, COMMAND_FLAG_MOTION },
+    #endif
+    { COMMAND_CODE('M', 17), handleM17, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 18), handleM18, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 84), handleM18, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 93), handleM93, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 115), handleM115, COMMAND_FLAG_NONE },
+    #ifdef ENABLE_CAN
+    { COMMAND_CODE('M', 116), handleM116, COMMAND_FLAG_NONE },
+    #endif
+    { COMMAND_CODE('M', 122), handleM122, COMMAND_FLAG_NONE },
+    #ifdef ENABLE_PROFILING
+    { COMMAND_CODE('M', 123), handleM123, COMMAND_FLAG_NONE },
+    #endif
+    { COMMAND_CODE('M', 124), handleM124, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 125), handleM125, COMMAND_FLAG_NONE },
+    #ifdef ENABLE_MEMORY_STATS
+    { COMMAND_CODE('M', 126), handleM126, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_SOFT_LIMITS
+    { COMMAND_CODE('M', 211), handleM211, COMMAND_FLAG_SAVED },
+    #endif
+    #ifdef ENABLE_PID
+    { COMMAND_CODE('M', 306), handleM306, COMMAND_FLAG_SAVED },
+    #endif
+    { COMMAND_CODE('M', 307), handleM307, COMMAND_FLAG_BLOCKING },
+    #ifdef ENABLE_SERIAL
+    { COMMAND_CODE('M', 308), handleM308, COMMAND_FLAG_BLOCKING },
+    #endif
+    #ifdef ENABLE_TRACE
+    { COMMAND_CODE('M', 309), handleM309, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 310), handleM310, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_GAIN_SCHEDULING
+    { COMMAND_CODE('M', 311), handleM311, COMMAND_FLAG_SAVED },
+    #endif
+    #ifdef ENABLE_TELEMETRY
+    { COMMAND_CODE('M', 312), handleM312, COMMAND_FLAG_NONE },
+    #endif
+    { COMMAND_CODE('M', 313), handleM313, COMMAND_FLAG_NONE },
+    #ifdef ENABLE_STEP_CAPTURE
+    { COMMAND_CODE('M', 314), handleM314, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_STEP_RATE_TEST
+    { COMMAND_CODE('M', 315), handleM315, COMMAND_FLAG_MOTION | COMMAND_FLAG_BLOCKING },
+    #endif
+    #ifdef ENABLE_RESONANCE_DAMPING
+    { COMMAND_CODE('M', 316), handleM316, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_LATENCY_COMPENSATION
+    { COMMAND_CODE('M', 317), handleM317, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_ENCODER_NOISE_TEST
+    { COMMAND_CODE('M', 318), handleM318, COMMAND_FLAG_BLOCKING },
+    #endif
+    #ifdef ENABLE_MOVE_METRICS
+    { COMMAND_CODE('M', 319), handleM319, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_STEP_STREAM
+    { COMMAND_CODE('M', 320), handleM320, COMMAND_FLAG_MOTION },
+    { COMMAND_CODE('M', 321), handleM321, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_DETENT_COMPENSATION
+    { COMMAND_CODE('M', 322), handleM322, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_WAVEFORM_SHAPING
+    { COMMAND_CODE('M', 323), handleM323, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_OVERRUN_DETECTION
+    { COMMAND_CODE('M', 324), handleM324, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_CORRECTION_HYSTERESIS
+    { COMMAND_CODE('M', 325), handleM325, COMMAND_FLAG_NONE },
+    #endif
+    { COMMAND_CODE('M', 350), handleM350, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 352), handleM352, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 353), handleM353, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 354), handleM354, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 355), handleM355, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 356), handleM356, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 357), handleM357, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 358), handleM358, COMMAND_FLAG_SAVED },
+    { COMMAND_CODE('M', 500), handleM500, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 501), handleM501, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 502), handleM502, COMMAND_FLAG_BLOCKING },
+    #ifdef ENABLE_SERIAL
+    { COMMAND_CODE('M', 575), handleM575, COMMAND_FLAG_SAVED },
+    #endif
+    #ifdef ENABLE_IDLE_CURRENT
+    { COMMAND_CODE('M', 906), handleM906, COMMAND_FLAG_NONE },
+    #endif
+    { COMMAND_CODE('M', 907), handleM907, COMMAND_FLAG_SAVED },
+    #ifdef ENABLE_STALL_DETECTION
+    { COMMAND_CODE('M', 914), handleM914, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_CURRENT_ON_DEMAND
+    { COMMAND_CODE('M', 916), handleM916, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_SPEED_CURRENT_BOOST
+    { COMMAND_CODE('M', 918), handleM918, COMMAND_FLAG_SAVED },
+    #endif
+    #ifdef ENABLE_THERMAL_MODEL
+    { COMMAND_CODE('M', 919), handleM919, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_TORQUE_MODE
+    { COMMAND_CODE('M', 920), handleM920, COMMAND_FLAG_NONE },
+    { COMMAND_CODE('M', 921), handleM921, COMMAND_FLAG_NONE },
+    #endif
+    #ifdef ENABLE_CONTROL_MODES
+    { COMMAND_CODE('M', 922), handleM922, COMMAND_FLAG_SAVED },
+    #endif
+    #ifdef ENABLE_CAN_GEARING
+    { COMMAND_CODE('M', 923), handleM923, COMMAND_FLAG_SAVED },
     #endif
+    #ifdef ENABLE_PVT_TRAJECTORY
+    { COMMAND_CODE('M', 924), handleM924, COMMAND_FLAG_NONE },
+    #endif
+    { COMMAND_CODE('M', 1000), handleM1000, COMMAND_FLAG_NONE },
+};
+
+// Number of commands in the table
+static constexpr uint16_t COMMAND_COUNT = (sizeof(commandTable) / sizeof(commandEntry));
+
+// Checks that each row of the table comes after the one before it
+static constexpr bool isCommandTableSorted(uint16_t index = 1) {
+    return ((index >= COMMAND_COUNT) || ((commandTable[index - 1].code < commandTable[index].code) && isCommandTableSorted(index + 1)));
+}
+static_assert(isCommandTableSorted(), "The command table must be sorted by code, with no duplicates");
+
+
+// Finds the entry of a command in the table (returns nullptr if there isn't one)
+const commandEntry* findCommand(uint32_t code) {
+
+    // Binary search the table
+    uint16_t low = 0;
+    uint16_t high = COMMAND_COUNT;
+    while (low < high) {
+        uint16_t middle = ((low + high) >> 1);
+        if (commandTable[middle].code < code) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    // The search stops at the first code that isn't smaller, check that it's the one we want
+    if (low < COMMAND_COUNT && commandTable[low].code == code) {
+        return &commandTable[low];
+    }
+    return nullptr;
+}
 
-    // Nothing here, nothing to do
-    return FEEDBACK_NO_CMD_SPECIFIED;
+
+// Lists all of the commands that this build supports (ex. "Commands: G0 G6 M17 ...")
+String getCommandList() {
+    String list = F("Commands:");
+    for (uint16_t index = 0; index < COMMAND_COUNT; index++) {
+        list += ' ';
+        list += (char)(commandTable[index].code >> 16);
+        list += String(commandTable[index].code & 0xFFFF);
+    }
+    list += '\n';
+    return list;
 }
 
 
-// Returns the substring of the value after the letter parameter
-String parseValue(String buffer, char letter) {
+// Parses an entire string for any commands
+// Runs a single command, returning its feedback
+static String runCommand(const char* buffer, uint16_t length) {
+
+    // Split the command into its words in a single pass (the handlers only read the words, nothing is copied or allocated)
+    parsedCommand command;
+    if (!tokenizeCommand(buffer, length, command)) {
+        rejectedCommands++;
+        return FEEDBACK_TOO_MANY_WORDS;
+    }
+
+    // Find the command's code, mcodes come first
+    const commandWord* codeWord = findWord(command, 'M');
+    if (codeWord == nullptr) {
+        codeWord = findWord(command, 'G');
+    }
+    if (codeWord == nullptr) {
 
-    // Convert the buffer to all uppercase (easier to read)
-    buffer.toUpperCase();
+        // Nothing here, nothing to do
+        rejectedCommands++;
+        return FEEDBACK_NO_CMD_SPECIFIED;
+    }
+
+    // Look up the command, then run it
+    const commandEntry* entry = findCommand(COMMAND_CODE(codeWord -> letter, codeWord -> intValue));
+    if (entry == nullptr) {
+
+        // Command isn't recognized, therefore throw an error
+        rejectedCommands++;
+        return FEEDBACK_CMD_NOT_AVAILABLE;
+    }
 
-    // Search the input string for the specified letter
-    int16_t charIndex = buffer.indexOf(toupper(letter));
+    // The motor is being swept by the calibration, it can't be moved or tuned until it is done
+    if (isCalibrating() && (entry -> flags & (COMMAND_FLAG_MOTION | COMMAND_FLAG_BLOCKING))) {
+        return FEEDBACK_CALIBRATING;
+    }
 
-    // If the index came back with a value, we can begin the process of extracting the raw value
-    if (charIndex != -1) {
+    // The coils are being swept by the learning pass of the detent table
+    #ifdef ENABLE_DETENT_COMPENSATION
+    if (isDetentLearning() && (entry -> flags & (COMMAND_FLAG_MOTION | COMMAND_FLAG_BLOCKING))) {
+        return F("Learning the detent torque, try again once it finishes (M322)");
+    }
+    #endif
 
-        // Get the next index of a space
-        int16_t nextSpaceIndex = buffer.substring(charIndex).indexOf(' ');
+    // The moves pause the correction, which is holding the torque
+    #ifdef ENABLE_TORQUE_MODE
+    if (motor.isTorqueModeActive() && (entry -> flags & (COMMAND_FLAG_MOTION | COMMAND_FLAG_BLOCKING))) {
+        return FEEDBACK_TORQUE_MODE;
+    }
+    #endif
+    return (entry -> handler)(command);
+}
 
-        // Check to see if there is a space between the letter and value
-        if (nextSpaceIndex == 1) {
 
-            // We need to find out if there is another space after this parameter
-            int16_t endSpaceIndex = buffer.substring(charIndex + nextSpaceIndex + 1).indexOf(' ');
+// Parse a string for commands, returning the feedback on the commands
+// Several commands can be sent at once, separated by COMMAND_SEPARATOR or new lines (ex. "M306 P1;M350 V16;M500")
+// They are run in order, and their feedback is returned together, one line per command
+String parseCommand(const char* buffer, uint16_t length) {
 
-            // Check to see if there is an ending space
-            if (endSpaceIndex != -1) {
+    // Walk through the commands, a separator inside of quotes is part of a value (ex. M116 M"a;b")
+    String feedback;
+    uint8_t commandCount = 0;
+    uint16_t start = 0;
+    bool quoted = false;
+    for (uint16_t index = 0; index <= length; index++) {
 
-                // Return only the substring between the ending space and the space after the letter
-                return buffer.substring(charIndex + nextSpaceIndex + 1, charIndex + nextSpaceIndex + endSpaceIndex + 2);
+        // Keep looking until the end of the command
+        if (index < length) {
+            if (buffer[index] == '"') {
+                quoted = !quoted;
             }
-            else {
-                // That's the end of the string, we can start at the space and just include the rest
-                return buffer.substring(charIndex + nextSpaceIndex + 1);
+            if (quoted || (buffer[index] != COMMAND_SEPARATOR && buffer[index] != '\n' && buffer[index] != '\r')) {
+                continue;
             }
         }
-        else if (nextSpaceIndex != -1) {
-            // The next space index is after the value, so just include up to it
-            return buffer.substring(charIndex + 1, charIndex + nextSpaceIndex);
+
+        // Skip empty commands (ex. a trailing separator or a blank line)
+        uint16_t commandLength = (index - start);
+        bool empty = true;
+        for (uint16_t charIndex = start; charIndex < index; charIndex++) {
+            if (!isspace(buffer[charIndex])) {
+                empty = false;
+                break;
+            }
         }
-        else {
-            // There is no more spaces in the string, therefore just return the rest of the string
-            return buffer.substring(charIndex + 1);
+
+        // Run the command, adding its feedback on its own line
+        if (!empty) {
+            if (commandCount > 0) {
+                feedback += '\n';
+            }
+            feedback += runCommand(&buffer[start], commandLength);
+            commandCount++;
         }
+        start = (index + 1);
     }
-    else {
-        // Index is invalid, V doesn't exist. Print an output message, then return a null
-        // ! Serial.println(FEEDBACK_NO_VALUE);
-        return "-1";
+
+    // Nothing was sent, nothing to do
+    if (commandCount == 0) {
+        return FEEDBACK_NO_CMD_SPECIFIED;
     }
+    return feedback;
+}
+
+
+// Gets the number of commands that couldn't be run
+uint32_t getRejectedCommandCount() {
+    return rejectedCommands;
 }
 
 
-// Returns the substring of the string after the letter parameter
-String parseString(String buffer, char letter) {
+// Direct stepping moves
+#ifdef ENABLE_DIRECT_STEPPING
 
-    // Create a variable to store the found charIndex
-    int16_t charIndex = -1;
+// Position (in microsteps) that the last queued move will finish at
+#ifdef ENABLE_STEP_QUEUE
+int32_t queuedMoveEndPosition = 0;
+#endif
 
-    // Search the input string for the specified letter in both upper and lower case
-    int16_t uppercaseIndex = buffer.indexOf(toupper(letter));
-    int16_t lowercaseIndex = buffer.indexOf(tolower(letter));
 
-    // Check if one of the cases exists
-    if (!(uppercaseIndex == -1 || uppercaseIndex == 65535)) {
+// Returns the position (in microsteps) that absolute moves are measured from
+// With the queue, this is where the last queued move ends, otherwise it's the current position
+int32_t getMoveEndPosition() {
+    #ifdef ENABLE_STEP_QUEUE
+    if (isStepQueueRunning()) {
+        return queuedMoveEndPosition;
+    }
+    #endif
+    return motor.getSoftStepCNT();
+}
+
+
+// Starts or queues a move of count steps (counter clockwise is positive), returning the feedback on the move
+// An accel of 0 moves at a constant rate
+String startMove(int64_t count, uint32_t rate, uint32_t accel, uint32_t jerk) {
+
+    // The moves pause the correction, which is holding the torque
+    #ifdef ENABLE_TORQUE_MODE
+    if (motor.isTorqueModeActive()) {
+        return FEEDBACK_TORQUE_MODE;
+    }
+    #endif
+
+    // Find where the move will finish
+    #if defined(ENABLE_STEP_QUEUE) || defined(ENABLE_SOFT_LIMITS)
+        int32_t endPosition = getMoveEndPosition() + (int32_t)round(count * motor.getMicrostepMultiplier());
+    #endif
 
-        // Uppercase index is valid, save it as the charIndex
-        charIndex = uppercaseIndex;
+    // The follower's position comes from its master
+    #ifdef ENABLE_CAN_GEARING
+    if (isGearFollowing()) {
+        return FEEDBACK_GEARING;
     }
-    else if (!(lowercaseIndex == -1 || lowercaseIndex == 65535)) {
+    #endif
 
-        // Lowercase index is valid, save it as the charIndex
+    // The trajectory moves the motor until it finishes
+    #ifdef ENABLE_PVT_TRAJECTORY
+    if (isPVTActive()) {
+        return FEEDBACK_PVT_ACTIVE;
     }
-    // else {
-    //    Leave the charIndex as -1, signifying that it doesn't exist
-    //}
+    #endif
 
-    // If the index came back with a value, we can begin the process of extracting the raw value
-    if (charIndex != -1) {
+    // Moves can't start while the soft limits are faulted, or end past them (the rate and acceleration are cut to the max)
+    #ifdef ENABLE_SOFT_LIMITS
+    if (getSoftLimitFault() != SOFT_LIMIT_OK) {
+        return FEEDBACK_SOFT_LIMIT_FAULT;
+    }
+    if (!limitMove(endPosition, rate, accel, jerk)) {
+        return FEEDBACK_SOFT_LIMIT;
+    }
+    #endif
 
-        // Time to check to see where the double quotations are
-        int16_t startQuotationIndex = buffer.substring(charIndex + 1).indexOf('"');
-        int16_t endQuotationIndex = buffer.substring(charIndex + startQuotationIndex + 2).indexOf('"');
+    // The step schedule timer can't go slower than its slowest rate, so slower moves are rejected instead of being sped up
+    if (rate < MIN_STEP_SCHEDULE_RATE) {
+        return FEEDBACK_BAD_VALUE;
+    }
 
-        // Make sure that there are quotations on each side
-        if (startQuotationIndex != -1 && endQuotationIndex != -1) {
+    // Pick the direction of the move
+    STEP_DIR stepDir = (count > 0 ? COUNTER_CLOCKWISE : CLOCKWISE);
 
-            // Return the string between them
-            return buffer.substring(charIndex + startQuotationIndex + 2, charIndex + startQuotationIndex + endQuotationIndex + 2);
+    // Queue the move, keeping track of where it will finish
+    #ifdef ENABLE_STEP_QUEUE
+        if (!queueSteps(count, rate, accel, jerk, stepDir)) {
+            return FEEDBACK_QUEUE_FULL;
         }
-        else {
-            // Throw an error, we can't find both the quotation marks
-            Serial.println(FEEDBACK_INVALID_STRING);
-            return "-1";
+        queuedMoveEndPosition = endPosition;
+
+    #else // ! ENABLE_STEP_QUEUE
+        // Replace the current move
+        #ifdef ENABLE_MOTION_PLANNER
+        if (accel > 0) {
+            schedulePlannedSteps(count, rate, accel, jerk, stepDir);
+            return FEEDBACK_OK;
         }
+        #endif
+        scheduleSteps(count, rate, stepDir);
+    #endif // ! ENABLE_STEP_QUEUE
+
+    // All good, we can exit
+    return FEEDBACK_OK;
+}
+#endif // ! ENABLE_DIRECT_STEPPING
+
+
+// Copies the text of a word into a string (only for values that are passed on as text, like messages)
+String getWordText(const commandWord* word) {
+
+    // A missing word has no text
+    String text;
+    if (word == nullptr) {
+        return text;
     }
-    else {
-        // Index is invalid, letter doesn't exist. Print an output message, then return a null
-        Serial.println(FEEDBACK_NO_VALUE);
-        return "-1";
+
+    // Copy the characters over
+    text.reserve(word -> length);
+    for (uint16_t index = 0; index < (word -> length); index++) {
+        text += (word -> text[index]);
     }
+    return text;
 }
 
 #endif // (ENABLE_SERIAL || ENABLE_CAN)
\ No newline at end of file
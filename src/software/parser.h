@@ -5,22 +5,72 @@
 #include "main.h"
 #include "flash.h"
 #include "config.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "profiler.h"
+#include "commandWords.h"
 
 // Defines for strings that are used repeatedly
 #define FEEDBACK_NO_VALUE          F("No value specified! Make sure to specify a value with a letter before it")
+#define FEEDBACK_BAD_VALUE         F("Value out of range")
 #define FEEDBACK_OK                F("ok")
 #define FEEDBACK_CAN_NOT_ENABLED   F("CAN functionality not enabled")
 #define FEEDBACK_INVALID_STRING    F("Invalid string. Make sure that the string had double quotations on each side")
 #define FEEDBACK_NO_CMD_SPECIFIED  F("No command specified")
 #define FEEDBACK_CMD_NOT_AVAILABLE F("Command number not recognized")
+#define FEEDBACK_QUEUE_FULL        F("Step queue full, try again once a move finishes")
+#define FEEDBACK_TOO_MANY_WORDS    F("Too many words in the command")
+#define FEEDBACK_CALIBRATING       F("Calibrating, try again once the calibration finishes (M313)")
+#define FEEDBACK_FIXED_SETTING     F("Setting fixed when compiling (ENABLE_FIXED_MOTOR_CONFIG)")
+#define FEEDBACK_TORQUE_MODE       F("In torque mode, leave it first (M921)")
+#define FEEDBACK_SOFT_LIMIT        F("Move would end past the soft limits")
+#define FEEDBACK_SOFT_LIMIT_FAULT  F("Soft limits faulted, clear the fault first (M211 C1)")
+#define FEEDBACK_GEARING           F("Following a master, stop following first (M923 S-1)")
+#define FEEDBACK_PVT_ACTIVE        F("Trajectory running, wait for it to finish or clear it (M924 C1)")
 
-// Parse a string for commands, returning the feedback on the command
-String parseCommand(String buffer);
+// Code of a command, the letter and the number packed together so that G and M codes sort apart (ex. M306)
+#define COMMAND_CODE(letter, number) ((((uint32_t)(letter)) << 16) | ((uint16_t)(number)))
 
-// Parse a string for a value after a letter
-String parseValue(String buffer, char letter);
+// Properties of a command, listed with the command table
+#define COMMAND_FLAG_NONE     0x00
+#define COMMAND_FLAG_MOTION   0x01 // Moves the motor
+#define COMMAND_FLAG_BLOCKING 0x02 // Runs for a long time before replying (ex. tuning or a reboot)
+#define COMMAND_FLAG_SAVED    0x04 // Changes a setting that is saved with M500
 
-// Parses a string for a string after a letter
-String parseString(String buffer, char letter);
+// Handler of a command, returning the feedback for the host
+typedef String (*commandHandler)(const parsedCommand &command);
+
+// A row of the command table
+typedef struct {
+    uint32_t code;           // COMMAND_CODE() of the command
+    commandHandler handler;  // Function that runs the command
+    uint8_t flags;           // COMMAND_FLAG_*
+} commandEntry;
+
+// Finds the entry of a command in the table (returns nullptr if there isn't one)
+const commandEntry* findCommand(uint32_t code);
+
+// Lists all of the commands that this build supports
+String getCommandList();
+
+// Parse a string for commands, returning the feedback on the commands
+// Several commands can be separated by COMMAND_SEPARATOR or new lines, they are run in order and their feedback is returned one line each
+String parseCommand(const char* buffer, uint16_t length);
+
+// Gets the number of commands that couldn't be run (unrecognized, too many words, or no command word)
+uint32_t getRejectedCommandCount();
+
+// Direct stepping moves
+#ifdef ENABLE_DIRECT_STEPPING
+// Returns the position (in microsteps) that absolute moves are measured from
+int32_t getMoveEndPosition();
+
+// Starts or queues a move of count steps (counter clockwise is positive), returning the feedback on the move
+String startMove(int64_t count, uint32_t rate, uint32_t accel, uint32_t jerk);
+#endif
+
+// Copies the text of a word into a string (empty if the word is missing)
+String getWordText(const commandWord* word);
 
 #endif
\ No newline at end of file
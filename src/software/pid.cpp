@@ -5,130 +5,288 @@
 #ifdef ENABLE_PID
 
 // Main constructor
-StepperPID::StepperPID() {
-    // Nothing to here
+template <uint32_t LOOP_FREQ>
+StepperPIDLoop<LOOP_FREQ>::StepperPIDLoop() {
+
+    // Load the default gain schedule
+    #ifdef ENABLE_GAIN_SCHEDULING
+        const uint16_t defaultSpeeds[GAIN_SCHEDULE_POINTS] = DEFAULT_GAIN_SCHEDULE_RPM;
+        const uint16_t defaultPScales[GAIN_SCHEDULE_POINTS] = DEFAULT_GAIN_SCHEDULE_P;
+        const uint16_t defaultIScales[GAIN_SCHEDULE_POINTS] = DEFAULT_GAIN_SCHEDULE_I;
+        const uint16_t defaultDScales[GAIN_SCHEDULE_POINTS] = DEFAULT_GAIN_SCHEDULE_D;
+        for (uint8_t index = 0; index < GAIN_SCHEDULE_POINTS; index++) {
+            setSchedulePoint(index, { defaultSpeeds[index], defaultPScales[index], defaultIScales[index], defaultDScales[index] });
+        }
+    #endif
 }
 
 
 // Returns the Proportional value of the PID loop
-float StepperPID::getP() const {
-    return (this -> kP);
+template <uint32_t LOOP_FREQ>
+float StepperPIDLoop<LOOP_FREQ>::getP() const {
+    return Q16_TO_FLOAT(this -> kP);
 }
 
 
 // Returns the Integral value fo the PID loop
-float StepperPID::getI() const {
-    return (this -> kI);
+template <uint32_t LOOP_FREQ>
+float StepperPIDLoop<LOOP_FREQ>::getI() const {
+    return Q16_TO_FLOAT(this -> kI);
 }
 
 
 // Returns the Derivative value for the PID loop
-float StepperPID::getD() const {
-    return (this -> kD);
+template <uint32_t LOOP_FREQ>
+float StepperPIDLoop<LOOP_FREQ>::getD() const {
+    return Q16_TO_FLOAT(this -> kD);
 }
 
 
 // Returns the maximum value of the I term of the PID loop
-float StepperPID::getMaxI() const {
-    return (this -> maxI);
+template <uint32_t LOOP_FREQ>
+float StepperPIDLoop<LOOP_FREQ>::getMaxI() const {
+    return Q16_TO_FLOAT(this -> maxI);
 }
 
 
 // Sets the Proportional term of the PID loop
-void StepperPID::setP(float newP) {
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::setP(float newP) {
 
-    // Update the term if the new value isn't negative
+    // Update the term if the new value isn't negative (limited to what fits in Q16.16)
     if (newP >= 0) {
-        kP = newP;
+        kP = FLOAT_TO_Q16(constrain(newP, 0.0f, 32767.0f));
     }
 }
 
 
 // Sets the Integral term of the PID loop
-void StepperPID::setI(float newI) {
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::setI(float newI) {
 
-    // Update the term if the new value isn't negative
+    // Update the term if the new value isn't negative (limited to what fits in Q16.16)
     if (newI >= 0) {
-        kI = newI;
+        kI = FLOAT_TO_Q16(constrain(newI, 0.0f, 32767.0f));
     }
 }
 
 
 // Sets the Derivative of the PID loop
-void StepperPID::setD(float newD) {
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::setD(float newD) {
 
-    // Update the term if the new value isn't negative
+    // Update the term if the new value isn't negative (limited to what fits in Q16.16)
     if (newD >= 0) {
-        kD = newD;
+        kD = FLOAT_TO_Q16(constrain(newD, 0.0f, 32767.0f));
     }
 }
 
 
 // Sets the maximum value of the I term of the PID loop
-void StepperPID::setMaxI(float newMaxI) {
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::setMaxI(float newMaxI) {
 
-    // Update the term if the new value isn't negative
+    // Update the term if the new value isn't negative (limited to what fits in Q16.16)
     if (newMaxI >= 0) {
-        maxI = newMaxI;
+        maxI = FLOAT_TO_Q16(constrain(newMaxI, 0.0f, 32767.0f));
     }
 }
 
 // Get the desired position
-float StepperPID::getDesiredPosition() {
-    return (this -> setpoint);
+template <uint32_t LOOP_FREQ>
+float StepperPIDLoop<LOOP_FREQ>::getDesiredPosition() {
+    return Q16_TO_FLOAT((int64_t)(this -> setpoint) * PID_Q16_DEG_PER_COUNT);
 }
 
 
 // Set the desired position
-void StepperPID::setDesiredPosition(float angle) {
-    this -> setpoint = angle;
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::setDesiredPosition(float angle) {
+    this -> setpoint = round(angle * (ENCODER_COUNTS_PER_REV / 360.0f));
 }
 
 
 // Set the output limits of the loop
-void StepperPID::setOutputLimits(float newMin, float newMax) {
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::setOutputLimits(float newMin, float newMax) {
     this -> min = newMin;
     this -> max = newMax;
 }
 
 
-// Update the PID loop, returning the output
-float StepperPID::compute() {
+// Clears the I term, the derivative history, and the slew limit
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::reset() {
+    this -> iTerm = 0;
+    this -> output = 0;
+    this -> lastInputValid = false;
+}
+
+
+// Reads the error (Q16.16 degrees) and the rate of the measurement (Q16.16 deg/ms), saving the input for the next loop
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::measure(int32_t &error, int32_t &rateError) {
+
+    // Update the input and the setpoint (in counts, so there isn't any float math)
+    #ifdef ENABLE_LATENCY_COMPENSATION
+        this -> input = motor.encoder.getCompensatedCountsAvg();
+    #else
+        this -> input = motor.encoder.getAbsoluteCountsAvg();
+    #endif
+    this -> setpoint = motor.getDesiredCounts();
+
+    // Calculate the error (Q16.16 degrees)
+    error = ((this -> setpoint) - (this -> input)) * PID_Q16_DEG_PER_COUNT;
+
+    // Calculate the rate of the measurement (derivative on measurement, so setpoint jumps don't kick the output), in deg/ms
+    #ifdef ENABLE_ENCODER_OBSERVER
+        // Use the observer's velocity (counts/s to deg/ms)
+        rateError = -(int32_t)(((int64_t)motor.encoder.getObserverVelocity() * PID_Q16_DEG_PER_COUNT) / 1000);
+    #else
+        // Difference of the input over the loop period
+        if (!(this -> lastInputValid)) {
+            this -> lastInput = this -> input;
+            this -> lastInputValid = true;
+        }
+        rateError = -(int32_t)((((int64_t)((this -> input) - (this -> lastInput)) * PID_Q16_DEG_PER_COUNT) << PID_Q_POWER) / elapsedTime);
+    #endif
+    this -> lastInput = this -> input;
+}
+
+
+// Finds the gains, scaled for the speed of the motor (the rate of the measurement) if there is a schedule
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::findGains(int32_t rateError, int32_t &p, int32_t &i, int32_t &d) const {
+    #ifdef ENABLE_GAIN_SCHEDULING
+        int32_t scales[3];
+        interpolateSchedule(abs(rateError), scales);
+        p = (int32_t)(((int64_t)(this -> kP) * scales[0]) >> PID_Q_POWER);
+        i = (int32_t)(((int64_t)(this -> kI) * scales[1]) >> PID_Q_POWER);
+        d = (int32_t)(((int64_t)(this -> kD) * scales[2]) >> PID_Q_POWER);
+    #else
+        p = (this -> kP);
+        i = (this -> kI);
+        d = (this -> kD);
+    #endif
+}
 
-    // Update the input
-    this -> input = motor.encoder.getAbsoluteAngleAvgFloat();
 
-    // Update the setpoint
-    this -> setpoint = motor.getDesiredAngle();
+// Starts the loop at an output without a bump, the I term is set to make up the difference between the output and the other terms
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::transfer(int32_t startOutput) {
 
-    // Compute the PID
-    // Update the current time
-    this -> currentTime = millis();
+    // Read the loop the same way as compute()
+    int32_t error, rateError;
+    measure(error, rateError);
+    int32_t p, i, d;
+    findGains(rateError, p, i, d);
 
-    // Calculate the elapsed time
-    this -> elapsedTime = (float)((this -> currentTime) - (this -> previousTime));
+    // Start the slew limit from the output, then fit the I term under it (within the windup limit)
+    this -> output = constrain(startOutput, (this -> min), (this -> max));
+    int64_t pdTerms = (((int64_t)p * error) >> PID_Q_POWER) + (((int64_t)d * rateError) >> PID_Q_POWER);
+    int64_t maxITerm = ((int64_t)(this -> maxI) * i) >> PID_Q_POWER;
+    this -> iTerm = constrain(((int64_t)(this -> output) << PID_Q_POWER) - pdTerms, -maxITerm, maxITerm);
+}
+
+
+// Update the PID loop, returning the output
+template <uint32_t LOOP_FREQ>
+int32_t StepperPIDLoop<LOOP_FREQ>::compute() {
 
-    // Calculate the error
-    this -> error = (setpoint - input);
+    // Read the error and the rate of the measurement
+    int32_t error, rateError;
+    measure(error, rateError);
 
-    // Calculate the cumulative error (used with I term)
-    this -> cumulativeError += ((this -> error) * (this -> elapsedTime));
+    // Find the gains for the speed
+    int32_t p, i, d;
+    findGains(rateError, p, i, d);
 
-    // Clamp the cumulative error, preventing I term windup
-    this -> cumulativeError = constrain(cumulativeError, -maxI, maxI);
+    // Integrate the error (kept in the output's units), then clamp it, preventing I term windup
+    this -> iTerm += ((((int64_t)error * elapsedTime) >> PID_Q_POWER) * i) >> PID_Q_POWER;
+    int64_t maxITerm = ((int64_t)(this -> maxI) * i) >> PID_Q_POWER;
+    this -> iTerm = constrain(this -> iTerm, -maxITerm, maxITerm);
 
-    // Calculate the rate error
-    this -> rateError = ((this -> error) - (this -> lastError)) / elapsedTime;
+    // Calculate the output with the errors and the coefficients (Q16.16 steps/s)
+    int64_t rawOutput = (((int64_t)p * error) >> PID_Q_POWER) + (this -> iTerm) + (((int64_t)d * rateError) >> PID_Q_POWER);
 
-    // Calculate the output with the errors and the coefficients
-    this -> output = ((this -> kP) * (this -> error)) + ((this -> kI) * (this -> cumulativeError)) + ((this -> kD) * (this -> rateError));
+    // Limit the output, then back-calculate the I term by the amount that was cut off (anti-windup)
+    int64_t limitedOutput = constrain(rawOutput, ((int64_t)(this -> min) << PID_Q_POWER), ((int64_t)(this -> max) << PID_Q_POWER));
+    this -> iTerm += ((limitedOutput - rawOutput) * antiWindupGain) >> PID_Q_POWER;
 
-    // Update the last computation parameters
-    this -> lastError = this -> error;
-    this -> previousTime = this -> currentTime;
+    // Limit how quickly the output can change (slew limit), then save it for the next loop
+    int32_t newOutput = (int32_t)(limitedOutput >> PID_Q_POWER);
+    this -> output = constrain(newOutput, (this -> output) - maxOutputChange, (this -> output) + maxOutputChange);
 
     // Return the output of the PID loop
-    return constrain(this -> output, -DEFAULT_PID_STEP_MAX, DEFAULT_PID_STEP_MAX);
+    return (this -> output);
+}
+
+
+#ifdef ENABLE_GAIN_SCHEDULING
+// Sets a point of the gain schedule
+template <uint32_t LOOP_FREQ>
+bool StepperPIDLoop<LOOP_FREQ>::setSchedulePoint(uint8_t index, gainSchedulePoint point) {
+
+    // Make sure the point exists
+    if (index >= GAIN_SCHEDULE_POINTS) {
+        return false;
+    }
+    this -> schedule[index] = point;
+
+    // Convert the speed to the units of the measurement (RPM is 6 deg/s, which is 0.006 deg/ms), and the scales to Q16.16
+    this -> scheduleSpeeds[index] = (int32_t)(((int64_t)point.rpm * 6 * PID_Q_ONE) / 1000);
+    this -> scheduleScales[index][0] = (int32_t)(((int64_t)point.pScale * PID_Q_ONE) / 100);
+    this -> scheduleScales[index][1] = (int32_t)(((int64_t)point.iScale * PID_Q_ONE) / 100);
+    this -> scheduleScales[index][2] = (int32_t)(((int64_t)point.dScale * PID_Q_ONE) / 100);
+
+    // Update the reciprocals of the gaps on each side of the point (a gap that isn't increasing is skipped by the interpolation)
+    // (The class's min and max are the output limits, so the gaps are bounded by hand)
+    uint8_t lastGap = ((index < (GAIN_SCHEDULE_POINTS - 1)) ? index : (GAIN_SCHEDULE_POINTS - 2));
+    for (uint8_t gap = (index > 0 ? index - 1 : 0); gap <= lastGap; gap++) {
+        int32_t gapSize = (this -> scheduleSpeeds[gap + 1]) - (this -> scheduleSpeeds[gap]);
+        this -> scheduleInverseGaps[gap] = (gapSize > 0 ? (uint32_t)(((uint64_t)1 << 32) / ((uint64_t)gapSize + 1)) : 0);
+    }
+    return true;
+}
+
+
+// Gets a point of the gain schedule
+template <uint32_t LOOP_FREQ>
+gainSchedulePoint StepperPIDLoop<LOOP_FREQ>::getSchedulePoint(uint8_t index) const {
+    return this -> schedule[(index < GAIN_SCHEDULE_POINTS) ? index : (GAIN_SCHEDULE_POINTS - 1)];
+}
+
+
+// Finds the scales of the gains at a speed, interpolating between the points on either side
+template <uint32_t LOOP_FREQ>
+void StepperPIDLoop<LOOP_FREQ>::interpolateSchedule(int32_t speed, int32_t (&scales)[3]) const {
+
+    // Find the gap that the speed is in (clamped to the first and last points)
+    uint8_t gap = 0;
+    while ((gap < (GAIN_SCHEDULE_POINTS - 1)) && (speed >= (this -> scheduleSpeeds[gap + 1]))) {
+        gap++;
+    }
+
+    // Past either end of the schedule, or in a gap that isn't increasing
+    if ((gap == (GAIN_SCHEDULE_POINTS - 1)) || (speed <= (this -> scheduleSpeeds[gap])) || ((this -> scheduleInverseGaps[gap]) == 0)) {
+        for (uint8_t term = 0; term < 3; term++) {
+            scales[term] = (this -> scheduleScales[gap][term]);
+        }
+        return;
+    }
+
+    // Fraction of the way across the gap (Q16.16), then blend the scales of the points on each side
+    int32_t fraction = (int32_t)(((uint64_t)(speed - (this -> scheduleSpeeds[gap])) * (this -> scheduleInverseGaps[gap])) >> (32 - PID_Q_POWER));
+    for (uint8_t term = 0; term < 3; term++) {
+        int32_t start = (this -> scheduleScales[gap][term]);
+        int32_t end = (this -> scheduleScales[gap + 1][term]);
+        scales[term] = start + (int32_t)(((int64_t)(end - start) * fraction) >> PID_Q_POWER);
+    }
 }
+#endif // ! ENABLE_GAIN_SCHEDULING
+
+
+// Build the loop for the rate of the control loop
+template class StepperPIDLoop<CONTROL_LOOP_FREQ>;
 
 #endif
\ No newline at end of file
@@ -16,15 +16,40 @@
 // Main (for stepper motor class)
 #include "main.h"
 
+// Fixed point format of the PID (Q16.16)
+#define PID_Q_POWER 16
+#define PID_Q_ONE   ((int32_t)1 << PID_Q_POWER)
+
+// Conversions between floats and Q16.16
+#define FLOAT_TO_Q16(x) ((int32_t)((x) * PID_Q_ONE))
+#define Q16_TO_FLOAT(x) ((float)(x) / PID_Q_ONE)
+
+// Degrees (Q16.16) per encoder count (360 * 2^16 / 2^15 is exactly 720)
+#define PID_Q16_DEG_PER_COUNT ((int32_t)((360LL << PID_Q_POWER) / ENCODER_COUNTS_PER_REV))
+
+// A point of the gain schedule, the gains at a speed as percentages of the base gains (set by M306)
+// Packed into two flash parameters (speed and P, then I and D)
+#ifdef ENABLE_GAIN_SCHEDULING
+typedef struct {
+    uint16_t rpm;
+    uint16_t pScale;
+    uint16_t iScale;
+    uint16_t dScale;
+} gainSchedulePoint;
+#endif
+
 // Main class for controlling the motor
 // NOTE: This should be used for time increments between stepping
-class StepperPID {
+// All of the math is done in Q16.16 fixed point. The sample rate is a template parameter (the rate of the control loop),
+// so the elapsed time is a constant instead of being read from a clock
+template <uint32_t LOOP_FREQ>
+class StepperPIDLoop {
 
     // Public info (all of the functions to be used throughout the board)
     public:
 
         // Main constructor
-        StepperPID();
+        StepperPIDLoop();
 
         // Get functions for P, I, and D
         float getP() const;
@@ -48,40 +73,81 @@ class StepperPID {
         // Sets the min and max outputs of the PID loop
         void setOutputLimits(float min, float max);
 
-        // Runs the PID calculations and returns the output
-        float compute();
+        // Clears the I term, the derivative history, and the slew limit (so the next compute starts fresh)
+        void reset();
+
+        // Runs the PID calculations and returns the output (steps/s)
+        int32_t compute();
+
+        // Starts the loop from an output (steps/s) without a bump, the I term makes up the difference to the other terms (used when switching to the PID)
+        void transfer(int32_t startOutput);
+
+        // Gain schedule by speed, the gains are interpolated between the points every compute
+        // The points must be in order of increasing speed. Above the last point, the last point's gains are used
+        #ifdef ENABLE_GAIN_SCHEDULING
+        // Sets a point of the schedule (speed in RPM, scales in percent of the base gains), returning false if the index is invalid
+        bool setSchedulePoint(uint8_t index, gainSchedulePoint point);
+
+        // Gets a point of the schedule
+        gainSchedulePoint getSchedulePoint(uint8_t index) const;
+        #endif
 
     // Private info (usually just variables)
     private:
 
-        // Main variables for storing input, output, and setpoint
-        float input = 0, output = 0, setpoint = 0;
+        // Time between computations (ms, Q16.16), the gains are tuned in ms
+        static const int32_t elapsedTime = (int32_t)((1000LL << PID_Q_POWER) / LOOP_FREQ);
+
+        // Main variables for storing the input and setpoint (counts), and the output (steps/s)
+        int32_t input = 0, setpoint = 0, output = 0;
 
-        // P, I, and D terms for loop
+        // P, I, and D terms for loop (Q16.16)
         // Term is multiplied by degrees of error to find stepping rate back
-        float kP = DEFAULT_P;
-        float kI = DEFAULT_I;
-        float kD = DEFAULT_D;
+        int32_t kP = FLOAT_TO_Q16(DEFAULT_P);
+        int32_t kI = FLOAT_TO_Q16(DEFAULT_I);
+        int32_t kD = FLOAT_TO_Q16(DEFAULT_D);
 
-        // I windup clamping
-        float maxI = DEFAULT_MAX_I;
+        // I windup clamping (degrees * ms, Q16.16)
+        int32_t maxI = FLOAT_TO_Q16(DEFAULT_MAX_I);
 
-        // Min and max caps
-        float min = 0;
-        float max = 0;
+        // Min and max caps (steps/s)
+        int32_t min = -DEFAULT_PID_STEP_MAX;
+        int32_t max = DEFAULT_PID_STEP_MAX;
 
-        // Time storage
-        uint32_t currentTime;
-        uint32_t previousTime = 0;
-        float elapsedTime;
+        // Most that the output can change by in a loop (steps/s)
+        static const int32_t maxOutputChange = ((DEFAULT_PID_SLEW_RATE / LOOP_FREQ) > 0 ? (DEFAULT_PID_SLEW_RATE / LOOP_FREQ) : 1);
+
+        // Anti-windup back-calculation gain (Q16.16)
+        static const int32_t antiWindupGain = FLOAT_TO_Q16(DEFAULT_PID_ANTI_WINDUP);
+
+        // The gain schedule, along with its speeds (Q16.16 deg/ms), the reciprocals of the gaps between them (Q0.32),
+        // and the scales of P, I, and D at each point (Q16.16), so that the interpolation doesn't need any divisions
+        #ifdef ENABLE_GAIN_SCHEDULING
+        gainSchedulePoint schedule[GAIN_SCHEDULE_POINTS];
+        int32_t scheduleSpeeds[GAIN_SCHEDULE_POINTS] = {};
+        uint32_t scheduleInverseGaps[GAIN_SCHEDULE_POINTS] = {};
+        int32_t scheduleScales[GAIN_SCHEDULE_POINTS][3] = {};
+
+        // Finds the scales of the gains at a speed (Q16.16 deg/ms)
+        void interpolateSchedule(int32_t speed, int32_t (&scales)[3]) const;
+        #endif
+
+        // Reads the error (Q16.16 degrees) and the rate of the measurement (Q16.16 deg/ms)
+        void measure(int32_t &error, int32_t &rateError);
+
+        // Finds the gains (Q16.16), scaled by the gain schedule at the rate of the measurement
+        void findGains(int32_t rateError, int32_t &p, int32_t &i, int32_t &d) const;
 
         // Intermediate calculation variables
-        float error;
-        float lastError = 0;
-        float cumulativeError;
-        float rateError;
+        // The I term is kept in the output's units (steps/s, Q16.16) so it can be back-calculated without a division
+        int64_t iTerm = 0;
+        int32_t lastInput = 0;
+        bool lastInputValid = false;
 };
 
+// The PID used by the board, running at the rate of the control loop
+typedef StepperPIDLoop<CONTROL_LOOP_FREQ> StepperPID;
+
 #endif // ! ENABLE_PID
 
 #endif // ! __PID_H__
\ No newline at end of file
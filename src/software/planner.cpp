@@ -0,0 +1,96 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_MOTION_PLANNER
+
+// Import the header file
+#include "planner.h"
+
+
+// Starts a profile for a move, returning the rate of the first step (Hz)
+uint32_t startMotionProfile(motionProfile &profile, uint32_t rate, uint32_t accel, uint32_t jerk) {
+
+    // Make sure that the limits are usable (a move can't be slower than the start rate)
+    rate = max(rate, (uint32_t)PLANNER_MIN_RATE);
+    accel = max(accel, (uint32_t)1);
+    jerk = max(jerk, (uint32_t)1);
+
+    // Save the limits
+    profile.maxVelocity = ((int64_t)rate << PLANNER_Q_POWER);
+    profile.maxAccel = ((int64_t)accel << PLANNER_Q_POWER);
+    profile.jerk = ((int64_t)jerk << PLANNER_Q_POWER);
+    profile.minVelocity = ((int64_t)PLANNER_MIN_RATE << PLANNER_Q_POWER);
+    profile.accelTime = (uint32_t)(((uint64_t)accel << PLANNER_Q_POWER) / jerk);
+    profile.invAccel = ((uint64_t)1 << 32) / accel;
+    profile.invJerk = ((uint64_t)1 << 32) / jerk;
+
+    // Start from rest
+    profile.velocity = profile.minVelocity;
+    profile.accel = 0;
+    profile.decelerating = false;
+
+    // The first step is at the start rate
+    return PLANNER_MIN_RATE;
+}
+
+
+// Finds the distance that a profile needs to stop (in steps), from a velocity with no acceleration
+// Uses the S-curve distance v * (v / A + A / J) / 2, which is never less than the true distance
+static int64_t stoppingDistance(const motionProfile &profile, int64_t velocity) {
+
+    // Time to shed the velocity at the limited acceleration (v / A, s, Q16)
+    int64_t decelTime = ((velocity >> PLANNER_Q_POWER) * profile.invAccel) >> PLANNER_Q_POWER;
+
+    // Distance covered (steps)
+    return (((velocity >> PLANNER_Q_POWER) * (decelTime + profile.accelTime)) >> (PLANNER_Q_POWER + 1)) + 1;
+}
+
+
+// Moves the profile forward by a step that took period ticks, returning the rate of the next step (Hz)
+uint32_t advanceMotionProfile(motionProfile &profile, uint32_t period, int64_t remainingSteps) {
+
+    // Velocity that will still be gained (or lost) while the acceleration is ramped back to 0 (a^2 / 2J, Q16)
+    int64_t accel = abs(profile.accel >> PLANNER_Q_POWER);
+    int64_t rampTime = (accel * profile.invJerk) >> PLANNER_Q_POWER;
+    int64_t rampVelocity = (accel * rampTime) >> 1;
+
+    // Start slowing down once the remaining steps are down to the stopping distance
+    if (!profile.decelerating) {
+        int64_t peakVelocity = profile.velocity + (profile.accel > 0 ? rampVelocity : 0);
+        if (remainingSteps <= stoppingDistance(profile, peakVelocity)) {
+            profile.decelerating = true;
+        }
+    }
+
+    // Pick the direction of the jerk
+    int64_t jerk;
+    if (!profile.decelerating) {
+
+        // Speeding up, bring the acceleration back to 0 just as the cruise rate is reached
+        jerk = ((profile.velocity + rampVelocity) < profile.maxVelocity ? profile.jerk : -profile.jerk);
+    }
+    else {
+        // Slowing down, bring the acceleration back to 0 just as the start rate is reached
+        jerk = ((profile.velocity - rampVelocity) > profile.minVelocity ? -profile.jerk : profile.jerk);
+    }
+
+    // Integrate the jerk over the step's period, keeping the acceleration within its limit
+    // The divisions are by a constant, so they're just multiplies
+    profile.accel += (jerk * period) / STEP_SCHEDULE_TICK_FREQ;
+    profile.accel = constrain(profile.accel, -profile.maxAccel, profile.maxAccel);
+
+    // Stop accelerating once the acceleration has ramped past 0 (prevents hunting around the cruise or start rate)
+    if ((!profile.decelerating && (jerk < 0) && (profile.accel < 0)) || (profile.decelerating && (jerk > 0) && (profile.accel > 0))) {
+        profile.accel = 0;
+    }
+
+    // Integrate the acceleration, keeping the rate between the start and cruise rates
+    profile.velocity += (profile.accel * period) / STEP_SCHEDULE_TICK_FREQ;
+    profile.velocity = constrain(profile.velocity, profile.minVelocity, profile.maxVelocity);
+
+    // Return the rate for the next step
+    return (uint32_t)(profile.velocity >> PLANNER_Q_POWER);
+}
+
+#endif // ! ENABLE_MOTION_PLANNER
\ No newline at end of file
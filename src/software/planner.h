@@ -0,0 +1,40 @@
+#ifndef __PLANNER_H__
+#define __PLANNER_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the motion planner is enabled
+#ifdef ENABLE_MOTION_PLANNER
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Fixed point format of the planner's velocity and acceleration (Q16)
+#define PLANNER_Q_POWER 16
+
+// Jerk limited (S-curve) motion profile, stepped forward once per step
+// The velocity (steps/s), acceleration (steps/s/s), and jerk (steps/s/s/s) are integrated in Q16 fixed point
+// using the period of the step that was just taken, so there isn't any float math in the interrupt
+typedef struct {
+    int64_t velocity;      // Current rate (Q16)
+    int64_t accel;         // Current acceleration (Q16)
+    int64_t maxVelocity;   // Cruise rate (Q16)
+    int64_t maxAccel;      // Acceleration limit (Q16)
+    int64_t jerk;          // Jerk limit (Q16)
+    int64_t minVelocity;   // Rate that the move starts and ends at (Q16)
+    uint32_t accelTime;    // Time to ramp the acceleration from 0 to the limit (maxAccel / jerk, Q16 seconds)
+    uint64_t invAccel;     // 1 / maxAccel (Q32), so the interrupt doesn't have to divide
+    uint64_t invJerk;      // 1 / jerk (Q32)
+    bool decelerating;     // If the move has started slowing down for the end
+} motionProfile;
+
+// Starts a profile for a move, returning the rate of the first step (Hz)
+// Only runs once per move, so it does the divisions that the per step path avoids
+uint32_t startMotionProfile(motionProfile &profile, uint32_t rate, uint32_t accel, uint32_t jerk);
+
+// Moves the profile forward by a step that took period ticks (of STEP_SCHEDULE_TICK_FREQ), returning the rate of the next step (Hz)
+uint32_t advanceMotionProfile(motionProfile &profile, uint32_t period, int64_t remainingSteps);
+
+#endif // ! ENABLE_MOTION_PLANNER
+#endif // ! __PLANNER_H__
\ No newline at end of file
@@ -0,0 +1,37 @@
+// Import the header file
+#include "probe.h"
+
+// Only build if specified
+#ifdef ENABLE_PROBES
+
+// Checks that none of the points in the mask share a pin with something that drives it
+static constexpr bool probePinsFree(uint8_t point = 0) {
+    return ((point >= PROBE_POINT_COUNT) ||
+            ((!(PROBE_MASK & PROBE_BIT(point)) ||
+             (
+             #ifdef ENABLE_BLINK
+                (probePins[point] != LED_PIN) &&
+             #endif
+             #ifdef ENABLE_OLED
+                (probePins[point] != OLED_RST_PIN) &&
+             #endif
+                (probePins[point] != NC))) && probePinsFree(point + 1)));
+}
+#ifndef PROBE_USE_ITM
+static_assert(probePinsFree(), "A probe pin is NC, or shared with something that drives it (the LED with ENABLE_BLINK, PA_8 with ENABLE_OLED)");
+#endif
+
+
+// Sets the pins of the points in PROBE_MASK to outputs
+void initProbes() {
+    #ifndef PROBE_USE_ITM
+    for (uint8_t point = 0; point < PROBE_POINT_COUNT; point++) {
+        if (PROBE_MASK & PROBE_BIT(point)) {
+            pinMode(pinNametoDigitalPin(probePins[point]), OUTPUT);
+            GPIO_WRITE(probePins[point], LOW);
+        }
+    }
+    #endif
+}
+
+#endif // ! ENABLE_PROBES
@@ -0,0 +1,65 @@
+#ifndef __PROBE_H__
+#define __PROBE_H__
+
+// Include main config
+#include "config.h"
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Timing probes, a pin (or an ITM channel) is held high while a hot path runs so that it can be measured with a scope or a logic analyzer
+// Only the points in PROBE_MASK are built in, the rest (and every point without ENABLE_PROBES) cost nothing
+#ifdef ENABLE_PROBES
+
+// Points that can be probed (the bits of PROBE_MASK, and the order of PROBE_PINS)
+typedef enum {
+    PROBE_STEP,               // stepMotor() (step pin interrupt)
+    PROBE_CORRECTION,         // correctMotor() (correction timer)
+    PROBE_STEP_SCHEDULE,      // stepScheduleHandler() (step schedule timer)
+    PROBE_ENCODER_READ,       // Encoder::sample() (blocking SPI burst read)
+    PROBE_CAN_RX,             // The CAN receive interrupts
+    PROBE_POINT_COUNT
+} PROBE_POINT;
+
+// Bit of a point in PROBE_MASK
+#define PROBE_BIT(point) (1UL << (point))
+
+// Pins of the points, fixed when compiling so that each write is a single store
+static constexpr PinName probePins[PROBE_POINT_COUNT] = PROBE_PINS;
+
+// Sets the pins of the points in PROBE_MASK to outputs, driven low (the ITM channels are enabled by the debugger instead)
+void initProbes();
+
+// Drives the output of a point (folded away if the point isn't in PROBE_MASK)
+static inline void probeWrite(PROBE_POINT point, bool high) {
+    if (!(PROBE_MASK & PROBE_BIT(point))) {
+        return;
+    }
+
+    // Each point has its own stimulus port, only written if the debugger is listening to it
+    #ifdef PROBE_USE_ITM
+        if ((ITM -> TCR & ITM_TCR_ITMENA_Msk) && (ITM -> TER & PROBE_BIT(point))) {
+            ITM -> PORT[point].u8 = high;
+        }
+    #else
+        GPIO_WRITE(probePins[point], high);
+    #endif
+}
+
+// Holds the output of a point high from its creation until the end of the scope it is in (covers every return)
+class probeScope {
+    public:
+        probeScope(PROBE_POINT point) : point(point) { probeWrite(point, HIGH); }
+        ~probeScope() { probeWrite(point, LOW); }
+
+    private:
+        PROBE_POINT point;
+};
+
+// Probes the rest of the function
+#define PROBE_SCOPE(point) probeScope scopeProbe(point)
+
+#else
+#define PROBE_SCOPE(point)
+#endif // ! ENABLE_PROBES
+#endif // ! __PROBE_H__
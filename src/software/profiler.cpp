@@ -0,0 +1,109 @@
+// Import the header file
+#include "profiler.h"
+#include "clock.h"
+#include "encoder.h"
+
+// Enables the DWT cycle counter
+void initCycleCounter() {
+
+    // Enable the trace block, then start the counter if it isn't running yet
+    CoreDebug -> DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    if (!(DWT -> CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        DWT -> CYCCNT = 0;
+        DWT -> CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+}
+
+
+// Clears a set of cycle statistics
+void resetCycleStats(cycleStats &stats) {
+    stats.min = UINT32_MAX;
+    stats.max = 0;
+    stats.total = 0;
+    stats.count = 0;
+}
+
+
+// Only build the interrupt profiling if specified
+#ifdef ENABLE_PROFILING
+
+// Statistics of each point, and the time that they were last cleared (for the CPU load)
+static cycleStats profileStats[PROFILE_POINT_COUNT];
+static uint32_t profileResetTime = 0;
+
+// Names of the points for the report (in the order of PROFILE_POINT)
+static const char* const profileNames[PROFILE_POINT_COUNT] = {
+    "Step",
+    "Correction",
+    "Step schedule",
+    "Step overflow",
+    "CAN RX",
+    "Encoder read",
+    "Encoder DMA",
+    "Critical section"
+};
+
+
+// Starts the cycle counter and clears the statistics
+void initProfiling() {
+    initCycleCounter();
+    resetProfileStats();
+}
+
+
+// Adds a measurement to a point
+void RAMFUNC addProfileCycles(PROFILE_POINT point, uint32_t cycles) {
+    addCycleStats(profileStats[point], cycles);
+}
+
+
+// Gets a report of the statistics of all of the points
+String getProfileStats() {
+
+    // Time since the statistics were cleared, in cycles (for the share of the CPU that each point used)
+    uint64_t elapsedCycles = (uint64_t)(millis() - profileResetTime) * (SystemCoreClock / 1000);
+
+    // Build a line for each of the points
+    String report;
+    for (uint8_t point = 0; point < PROFILE_POINT_COUNT; point++) {
+
+        // Copy the statistics out with all interrupts masked, so a measurement can't land halfway through
+        __disable_irq();
+        cycleStats stats = profileStats[point];
+        __enable_irq();
+
+        // Format the line (the statistics are all 0 if the point never ran)
+        uint32_t averageCycles = (stats.count > 0 ? (uint32_t)(stats.total / stats.count) : 0);
+        uint32_t loadPermille = (elapsedCycles > 0 ? (uint32_t)((stats.total * 1000) / elapsedCycles) : 0);
+        report += String(profileNames[point]) + F(": ") + String(stats.count) + F(" runs | Min: ") + String(stats.count > 0 ? stats.min : 0) +
+                  F(" | Avg: ") + String(averageCycles) + F(" | Max: ") + String(stats.max) + F(" cycles | Load: ") +
+                  String(loadPermille / 10) + "." + String(loadPermille % 10) + F("%\n");
+    }
+
+    // The encoder's SPI clock, with the average time of a blocking read against the time that its bytes take on the bus
+    __disable_irq();
+    cycleStats readStats = profileStats[PROFILE_ENCODER_READ];
+    __enable_irq();
+    uint32_t spiFreq = getEncoderSPIFreq();
+    uint32_t readTime = (readStats.count > 0 ? (uint32_t)((readStats.total / readStats.count) / (SystemCoreClock / 1000000)) : 0);
+    uint32_t busTime = (((2 + ENCODER_SAMPLE_BYTES) * 8 * 1000000UL) / spiFreq);
+    report += "Encoder SPI: " + String(spiFreq / 1000) + F(" kHz (max ") + String(ENCODER_SPI_MAX_FREQ / 1000) + F(" kHz) | Read: ") +
+              String(readTime) + F(" us (") + String(busTime) + F(" us on the bus)");
+
+    // Return the report, without the last new line (the parser adds one)
+    report.trim();
+    return report;
+}
+
+
+// Clears the statistics of all of the points
+void resetProfileStats() {
+    __disable_irq();
+    for (uint8_t point = 0; point < PROFILE_POINT_COUNT; point++) {
+        resetCycleStats(profileStats[point]);
+    }
+    profileResetTime = millis();
+    __enable_irq();
+}
+
+#endif // ! ENABLE_PROFILING
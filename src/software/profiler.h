@@ -0,0 +1,88 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+// Include main config
+#include "config.h"
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Cycle statistics of a measured function
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t count;
+} cycleStats;
+
+// Enables the DWT cycle counter (left running if it already is, so other measurements aren't disturbed)
+void initCycleCounter();
+
+// Reads the DWT cycle counter
+static inline uint32_t getCycleCount() {
+    return (DWT -> CYCCNT);
+}
+
+// Clears a set of cycle statistics
+void resetCycleStats(cycleStats &stats);
+
+// Adds a measurement to a set of cycle statistics
+static inline void addCycleStats(cycleStats &stats, uint32_t cycles) {
+    if (cycles < stats.min) {
+        stats.min = cycles;
+    }
+    if (cycles > stats.max) {
+        stats.max = cycles;
+    }
+    stats.total += cycles;
+    stats.count++;
+}
+
+
+// Always on profiling of the interrupts
+#ifdef ENABLE_PROFILING
+
+// Measured points, each is only updated by a single interrupt (or with the interrupts masked)
+// The cycles of an interrupt include any more urgent interrupts that preempted it
+typedef enum {
+    PROFILE_STEP,             // stepMotor() (step pin interrupt)
+    PROFILE_CORRECTION,       // correctMotor() (correction timer)
+    PROFILE_STEP_SCHEDULE,    // stepScheduleHandler() (step schedule timer)
+    PROFILE_STEP_OVERFLOW,    // overflowHandler() (TIM2 overflow)
+    PROFILE_CAN_RX,           // rxCANFrame() (CAN receive interrupt)
+    PROFILE_ENCODER_READ,     // Encoder::sample() (blocking SPI burst read)
+    PROFILE_ENCODER_DMA,      // Encoder::acquisitionHandler() (background read DMA interrupt)
+    PROFILE_CRITICAL_SECTION, // Time masked by disableInterrupts() (outermost block only)
+    PROFILE_POINT_COUNT
+} PROFILE_POINT;
+
+// Starts the cycle counter and clears the statistics
+void initProfiling();
+
+// Adds a measurement to a point (only call from the point's own interrupt, or with the interrupts masked)
+void addProfileCycles(PROFILE_POINT point, uint32_t cycles);
+
+// Gets a report of the statistics of all of the points (count, min, avg, max cycles, and CPU load)
+String getProfileStats();
+
+// Clears the statistics of all of the points
+void resetProfileStats();
+
+// Measures the cycles from its creation until the end of the scope it is in (covers every return)
+class profileScope {
+    public:
+        profileScope(PROFILE_POINT point) : point(point), startCycles(getCycleCount()) {}
+        ~profileScope() { addProfileCycles(point, getCycleCount() - startCycles); }
+
+    private:
+        PROFILE_POINT point;
+        uint32_t startCycles;
+};
+
+// Profiles the rest of the function
+#define PROFILE_SCOPE(point) profileScope scopeProfiler(point)
+
+#else
+#define PROFILE_SCOPE(point)
+#endif // ! ENABLE_PROFILING
+#endif // ! __PROFILER_H__
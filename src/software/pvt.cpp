@@ -0,0 +1,208 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_PVT_TRAJECTORY
+
+// Import the header file
+#include "pvt.h"
+#include "ringBuffer.h"
+#include "timers.h"
+#include "canGearing.h"
+
+// The points waiting to be run (the host pushes, the correction pops)
+static RingBuffer<pvtPoint, PVT_BUFFER_SIZE> pvtBuffer;
+
+// Set by the host once the trajectory can start, and by the host to drop the points (both are taken by the correction)
+static volatile bool startRequested = false;
+static volatile bool clearRequested = false;
+
+// If the correction is running a segment
+static volatile bool pvtRunning = false;
+
+// The running segment, from the start position along the cubic (Q8 microsteps) as s goes from 0 to 1
+static int32_t segmentStart = 0;
+static int32_t segmentEnd = 0;
+static int32_t segmentEndVelocity = 0;
+static int64_t coefficient1 = 0;
+static int64_t coefficient2 = 0;
+static int64_t coefficient3 = 0;
+
+// Progress through the segment (s in Q30, so that its increment keeps its precision over long segments)
+static uint32_t segmentProgress = 0;
+static uint32_t progressPerTick = 0;
+static uint32_t segmentTicks = 0;
+static uint32_t segmentTick = 0;
+
+// The desired position that the trajectory has moved the motor to (whole microsteps)
+static int32_t followedPosition = 0;
+
+// Underruns since boot
+static volatile uint32_t pvtUnderruns = 0;
+
+// One in the Q30 progress
+#define PVT_PROGRESS_ONE ((uint32_t)1 << 30)
+
+
+// Adds a point to the back of the buffer, starting the trajectory once enough points are buffered
+PVT_RESULT queuePVTPoint(const pvtPoint &point) {
+    // The velocity can't cover more than 2^30 microsteps over the segment, keeping the cubic's terms inside of 64 bits
+    if (point.duration == 0 || abs((int64_t)point.velocity * point.duration) > (((int64_t)1 << 30) * 1000)) {
+        return PVT_BAD_POINT;
+    }
+
+    // Only the trajectory can move the motor while it runs
+    #ifdef ENABLE_DIRECT_STEPPING
+    if (isDirectMoveRunning()) {
+        return PVT_BUSY;
+    }
+    #endif
+    #ifdef ENABLE_CAN_GEARING
+    if (isGearFollowing()) {
+        return PVT_BUSY;
+    }
+    #endif
+    #ifdef ENABLE_TORQUE_MODE
+    if (motor.isTorqueModeActive()) {
+        return PVT_BUSY;
+    }
+    #endif
+
+    // Add the point, the correction only takes it once the trajectory starts
+    if (!pvtBuffer.push(point)) {
+        return PVT_FULL;
+    }
+
+    // Start once there is enough of a lead over the correction, or once the trajectory comes to rest (it can't run dry)
+    if (pvtBuffer.count() >= PVT_PREFILL_POINTS || point.velocity == 0) {
+        startRequested = true;
+    }
+    return PVT_QUEUED;
+}
+
+
+// Drops the buffered points, the motor stops at the end of the segment that is running
+void clearPVT() {
+    clearRequested = true;
+}
+
+
+// Stops the trajectory right away where the motor is, dropping the buffered points (called by the correction)
+void RAMFUNC stopPVT() {
+    pvtRunning = false;
+    clearRequested = true;
+}
+
+
+// If a trajectory is running or waiting to start
+bool isPVTActive() {
+    return (pvtRunning || !pvtBuffer.isEmpty());
+}
+
+
+// Gets the points that are buffered
+uint16_t getPVTBufferedPoints() {
+    return pvtBuffer.count();
+}
+
+
+// Gets the slots of the buffer that are free
+uint16_t getPVTFreeSlots() {
+    return pvtBuffer.space();
+}
+
+
+// Gets the underruns since boot
+uint32_t getPVTUnderruns() {
+    return pvtUnderruns;
+}
+
+
+// Works out the cubic from the end of the last segment to a point
+// p(s) = p0 + m0 s + (3d - 2m0 - m1) s^2 + (m0 + m1 - 2d) s^3, where d is the distance and m0 and m1 are the velocities times the duration
+static void startPVTSegment(int32_t startVelocity, const pvtPoint &point) {
+
+    // Length of the segment in ticks of the correction
+    segmentTicks = max((uint32_t)(((uint32_t)point.duration * CONTROL_LOOP_FREQ) / 1000), (uint32_t)1);
+    segmentTick = 0;
+    segmentProgress = 0;
+    progressPerTick = (PVT_PROGRESS_ONE / segmentTicks);
+
+    // Scale the velocities to the segment (Q8 microsteps moved over the whole segment at that velocity)
+    int64_t distance = ((int64_t)(point.position - segmentEnd) << 8);
+    int64_t startSlope = (((int64_t)startVelocity * segmentTicks) << 8) / CONTROL_LOOP_FREQ;
+    int64_t endSlope = (((int64_t)point.velocity * segmentTicks) << 8) / CONTROL_LOOP_FREQ;
+    coefficient1 = startSlope;
+    coefficient2 = (3 * distance) - (2 * startSlope) - endSlope;
+    coefficient3 = startSlope + endSlope - (2 * distance);
+
+    // The segment starts where the last one ended
+    segmentStart = segmentEnd;
+    segmentEnd = point.position;
+    segmentEndVelocity = point.velocity;
+}
+
+
+// Moves the desired position along the running segment (called every correction)
+void RAMFUNC updatePVT() {
+
+    // Drop the points, the running segment still finishes
+    if (clearRequested) {
+        pvtPoint point;
+        while (pvtBuffer.pop(point)) {}
+        startRequested = false;
+        clearRequested = false;
+    }
+
+    // Start the trajectory from where the motor is, at rest
+    if (!pvtRunning) {
+        pvtPoint point;
+        if (!startRequested || !pvtBuffer.pop(point)) {
+            return;
+        }
+        segmentEnd = motor.getSoftStepCNT();
+        followedPosition = segmentEnd;
+        startPVTSegment(0, point);
+        pvtRunning = true;
+    }
+
+    // Move along the segment, landing on its end exactly
+    int32_t position;
+    segmentTick++;
+    if (segmentTick >= segmentTicks) {
+        position = segmentEnd;
+    }
+    else {
+        // Evaluate the cubic with Horner's rule (s in Q16)
+        segmentProgress += progressPerTick;
+        int64_t s = (segmentProgress >> 14);
+        int64_t offset = ((coefficient3 * s) >> 16) + coefficient2;
+        offset = ((offset * s) >> 16) + coefficient1;
+        offset = ((offset * s) >> 16);
+        position = segmentStart + (int32_t)(offset >> 8);
+    }
+
+    // Move the motor by the whole microsteps that the position crossed
+    if (position != followedPosition) {
+        motor.followMicrosteps(position - followedPosition);
+        followedPosition = position;
+    }
+
+    // Start the next segment from the end of this one
+    if (segmentTick >= segmentTicks) {
+        pvtPoint point;
+        if (pvtBuffer.pop(point)) {
+            startPVTSegment(segmentEndVelocity, point);
+        }
+        else {
+            // Out of points, the motor stops at the last one (an underrun if it was supposed to keep moving)
+            if (segmentEndVelocity != 0) {
+                pvtUnderruns++;
+            }
+            startRequested = false;
+            pvtRunning = false;
+        }
+    }
+}
+
+#endif // ! ENABLE_PVT_TRAJECTORY
@@ -0,0 +1,59 @@
+#ifndef __PVT_H__
+#define __PVT_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the trajectory buffer is enabled
+#ifdef ENABLE_PVT_TRAJECTORY
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Trajectory buffer of position-velocity-time points
+// The host (the parser or the binary protocols) is the only producer and the correction is the only consumer, so the buffer is lock free.
+// Each segment runs from the last point (or where the motor was, at rest) to the next one over its duration, along the cubic Hermite curve
+// that matches both of the positions and both of the velocities. The curve is worked out once per segment, then evaluated every tick
+// with Horner's rule in fixed point (Q8 microsteps), so only the whole microsteps that the position crosses are handed to the motor.
+// If the buffer runs dry while the motor is moving, it stops at the last point and the underrun is counted
+
+// A point of the trajectory
+typedef struct {
+    int32_t position;       // Position to reach (microsteps)
+    int32_t velocity;       // Velocity at the position (microsteps/s)
+    uint16_t duration;      // Time to reach the point from the last one (ms, at least 1)
+} pvtPoint;
+
+// Result of buffering a point
+typedef enum {
+    PVT_QUEUED,             // The point was added to the buffer
+    PVT_FULL,               // The buffer is full, try again once a segment finishes
+    PVT_BAD_POINT,          // The duration is 0, or the velocity is far too fast for it
+    PVT_BUSY                // Something else is moving the motor (a move, the jog, the gearing, or the torque mode)
+} PVT_RESULT;
+
+// Adds a point to the back of the buffer, starting the trajectory once enough points are buffered
+PVT_RESULT queuePVTPoint(const pvtPoint &point);
+
+// Drops the buffered points, the motor stops at the end of the segment that is running
+void clearPVT();
+
+// Stops the trajectory right away where the motor is, dropping the buffered points (called by the correction, ex. at a soft limit)
+void stopPVT();
+
+// If a trajectory is running or waiting to start (the other moves are refused until it finishes)
+bool isPVTActive();
+
+// Gets the points that are buffered, the slots that are free, and the underruns since boot
+uint16_t getPVTBufferedPoints();
+uint16_t getPVTFreeSlots();
+uint32_t getPVTUnderruns();
+
+// Moves the desired position along the running segment (called every correction)
+void updatePVT();
+
+#endif // ! ENABLE_PVT_TRAJECTORY
+#endif // ! __PVT_H__
@@ -0,0 +1,137 @@
+/*
+ *  Single producer, single consumer ring buffer
+ *  One side (ex. the parser) pushes and the other (ex. an interrupt) pops, so no locking is needed
+ *  Created by Christian Piper (CAP1Sup)
+ */
+
+#pragma once
+
+// Standard naming conventions
+#include "stdint.h"
+
+// Barrier intrinsics
+#include "Arduino.h"
+
+
+// A fixed size queue that is safe to share between one writer and one reader
+// SIZE must be a power of 2 (the indexes are masked instead of wrapped with a modulo)
+// One slot is always left empty so that a full buffer can be told apart from an empty one
+template <typename T, uint16_t SIZE>
+class RingBuffer {
+  static_assert((SIZE >= 2) && ((SIZE & (SIZE - 1)) == 0), "RingBuffer size must be a power of 2");
+
+  private:
+    T items[SIZE];
+
+    // Only the producer writes the head, only the consumer writes the tail
+    volatile uint16_t head = 0;
+    volatile uint16_t tail = 0;
+
+  public:
+    // Adds an item to the back of the buffer, returning false if there wasn't space
+    bool push(const T &item);
+
+    // Removes the item at the front of the buffer, returning false if the buffer was empty
+    bool pop(T &item);
+
+    // Peeks at the item at the front of the buffer without removing it
+    bool peek(T &item) const;
+
+    // Number of items waiting in the buffer
+    uint16_t count() const;
+
+    // Number of items that can still be pushed
+    uint16_t space() const;
+
+    // Simple checks of the buffer's state
+    bool isEmpty() const;
+    bool isFull() const;
+
+    // Drops everything in the buffer (only safe to call from the consumer)
+    void clear();
+};
+
+
+// Adds an item to the back of the buffer
+template <typename T, uint16_t SIZE>
+bool RingBuffer<T, SIZE>::push(const T &item) {
+
+    // Check that there's room for the item
+    uint16_t nextHead = ((head + 1) & (SIZE - 1));
+    if (nextHead == tail) {
+        return false;
+    }
+
+    // Store the item, making sure it is written before the consumer can see the new head
+    items[head] = item;
+    __DMB();
+    head = nextHead;
+    return true;
+}
+
+
+// Removes the item at the front of the buffer
+template <typename T, uint16_t SIZE>
+bool RingBuffer<T, SIZE>::pop(T &item) {
+
+    // Nothing to pop
+    if (tail == head) {
+        return false;
+    }
+
+    // Read the item, making sure it has been copied out before the producer can reuse the slot
+    item = items[tail];
+    __DMB();
+    tail = ((tail + 1) & (SIZE - 1));
+    return true;
+}
+
+
+// Peeks at the item at the front of the buffer
+template <typename T, uint16_t SIZE>
+bool RingBuffer<T, SIZE>::peek(T &item) const {
+
+    // Nothing to look at
+    if (tail == head) {
+        return false;
+    }
+
+    // Copy the item out
+    item = items[tail];
+    return true;
+}
+
+
+// Number of items waiting in the buffer
+template <typename T, uint16_t SIZE>
+uint16_t RingBuffer<T, SIZE>::count() const {
+    return ((head - tail) & (SIZE - 1));
+}
+
+
+// Number of items that can still be pushed
+template <typename T, uint16_t SIZE>
+uint16_t RingBuffer<T, SIZE>::space() const {
+    return ((SIZE - 1) - count());
+}
+
+
+// Checks if the buffer is empty
+template <typename T, uint16_t SIZE>
+bool RingBuffer<T, SIZE>::isEmpty() const {
+    return (head == tail);
+}
+
+
+// Checks if the buffer is full
+template <typename T, uint16_t SIZE>
+bool RingBuffer<T, SIZE>::isFull() const {
+    return (((head + 1) & (SIZE - 1)) == tail);
+}
+
+
+// Drops everything in the buffer
+template <typename T, uint16_t SIZE>
+void RingBuffer<T, SIZE>::clear() {
+    tail = head;
+}
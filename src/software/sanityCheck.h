@@ -56,9 +56,9 @@
 #endif
 
 
-// Check to make sure that the SINE_MAX and SINE_VAL_COUNT is valid
-#if IS_POWER_2(SINE_VAL_COUNT) != 0
-    #error SINE_VAL_COUNT must be a power of 2 to use in fastSin() and fastCos() defines!!!
+// Check to make sure that the SINE_MAX and SINE_QUARTER_COUNT is valid
+#if IS_POWER_2(SINE_QUARTER_COUNT) != 0
+    #error SINE_QUARTER_COUNT must be a power of 2 to use in fastSinPhase() and fastCosPhase()!!!
 #endif
 #if IS_POWER_2(SINE_MAX) != 0
     #error SINE_MAX must be a power of 2 to fast division to SINE_MAX, i.e { y = x / SINE_MAX } is equal to  { y = x >> SINE_POWER }
@@ -114,8 +114,401 @@
 
 
 // Check for defines that have conflicts
-#if (defined(ENABLE_BLINK) + defined(CHECK_STEPPING_RATE) + defined(CHECK_CORRECT_MOTOR_RATE) + defined(CHECK_ENCODER_SPEED) > 1)
-    #error Only one of the following is allowed at a time: ENABLE_BLINK, CHECK_STEPPING_RATE, CHECK_CORRECT_MOTOR_RATE, or CHECK_ENCODER_SPEED
+
+// The IWDG's 12 bit reload can only count up to 26 s (40 kHz LSI with the largest prescaler)
+#if defined(ENABLE_WATCHDOG) && ((WATCHDOG_TIMEOUT < 1) || (WATCHDOG_TIMEOUT > 26000))
+    #error WATCHDOG_TIMEOUT must be between 1 and 26000 ms
+#endif
+
+// There has to be at least a single read of the encoder
+#if (ENCODER_READ_ATTEMPTS < 1)
+    #error ENCODER_READ_ATTEMPTS must be at least 1
+#endif
+
+// The health check of the encoder needs some room for the odd error
+#if (ENCODER_MAX_MISSED_READS < 1) || (ENCODER_MAX_ERROR_RATE < 1)
+    #error ENCODER_MAX_MISSED_READS and ENCODER_MAX_ERROR_RATE must be at least 1
+#endif
+
+// Only the clock setups in cube.cpp can be picked
+#if defined(SYSCLK_SRC_HSE_16)
+    #if SYSCLK_FREQ != 72
+        #error "Unsupported oscillator speed"
+    #endif
+#elif defined(SYSCLK_SRC_HSE_8)
+    #if (SYSCLK_FREQ != 72) && (SYSCLK_FREQ != 128)
+        #error "Unsupported oscillator speed"
+    #endif
+#elif defined(SYSCLK_SRC_HSI)
+    #if SYSCLK_FREQ != 64
+        #error "Unsupported oscillator speed"
+    #endif
+#else
+    #error "Unsupported oscillator source"
+#endif
+
+// The scan counts the debounce in a byte
+#ifdef ENABLE_BUTTON_SCANNER
+    #if ((BUTTON_DEBOUNCE_TIME < 1) || (BUTTON_DEBOUNCE_TIME > 255))
+        #error BUTTON_DEBOUNCE_TIME must be between 1 and 255 ms
+    #endif
+#endif
+
+// The list of the streamed screen is counted in a byte
+#ifdef ENABLE_OLED_PAGE_STREAMING
+    #if ((OLED_STREAM_ITEMS < 1) || (OLED_STREAM_ITEMS > 255))
+        #error OLED_STREAM_ITEMS must be between 1 and 255
+    #endif
+#endif
+
+// The inner commutation moves the samples forward with the observer's velocity, and takes over TIM3's update interrupt
+#ifdef ENABLE_FAST_COMMUTATION
+    #ifndef ENABLE_ENCODER_OBSERVER
+        #error ENABLE_FAST_COMMUTATION requires ENABLE_ENCODER_OBSERVER
+    #endif
+    #ifdef ENABLE_PWM_SYNC_OUTPUT
+        #error "ENABLE_FAST_COMMUTATION cannot be used with ENABLE_PWM_SYNC_OUTPUT (both use TIM3's update interrupt)"
+    #endif
+#endif
+
+// The temperature for the offset compensation comes from the background poll
+#if defined(ENABLE_ENCODER_TEMP_COMP) && !defined(ENABLE_ENCODER_POLLING)
+    #error ENABLE_ENCODER_TEMP_COMP requires ENABLE_ENCODER_POLLING
+#endif
+
+// The coil drive table is computed for a fixed current, so it can't be used when the current changes with every step
+#if defined(ENABLE_COIL_LUT) && defined(ENABLE_DYNAMIC_CURRENT)
+    #error ENABLE_COIL_LUT cannot be used with ENABLE_DYNAMIC_CURRENT
+#endif
+
+// The waveform is shaped in the coil drive table, which the field oriented control doesn't drive from
+#if defined(ENABLE_WAVEFORM_SHAPING) && (!defined(ENABLE_COIL_LUT) || defined(ENABLE_FOC))
+    #error "ENABLE_WAVEFORM_SHAPING requires ENABLE_COIL_LUT, and can't be used with ENABLE_FOC"
+#endif
+
+// The step path runs through the flash operations, so all of it has to be in SRAM (the coil drive table keeps it off of the flash's sine table)
+#if defined(ENABLE_MOTION_SAFE_FLASH) && !(defined(ENABLE_RAM_FUNCTIONS) && defined(ENABLE_COIL_LUT))
+    #error ENABLE_MOTION_SAFE_FLASH requires ENABLE_RAM_FUNCTIONS and ENABLE_COIL_LUT
+#endif
+#if defined(ENABLE_MOTION_SAFE_FLASH) && defined(ENABLE_STEPPING_VELOCITY)
+    #error ENABLE_MOTION_SAFE_FLASH cannot be used with ENABLE_STEPPING_VELOCITY (micros() runs from flash)
+#endif
+
+// The field oriented mode uses the observer for its velocity feedback, and drives its own current
+#if defined(ENABLE_FOC) && !defined(ENABLE_ENCODER_OBSERVER)
+    #error ENABLE_FOC requires ENABLE_ENCODER_OBSERVER
+#endif
+
+// The encoder commutation replaces the correction of the PID and the commutation of the field oriented mode
+#if defined(ENABLE_ENCODER_COMMUTATION) && (defined(ENABLE_PID) || defined(ENABLE_FOC))
+    #error ENABLE_ENCODER_COMMUTATION cannot be used with ENABLE_PID or ENABLE_FOC
+#endif
+
+// The catch up correction can't move more than a full step in a tick, any more would pass the peak of the torque
+#ifdef ENABLE_CATCH_UP_CORRECTION
+    #if defined(ENABLE_PID) || defined(ENABLE_FOC) || defined(ENABLE_ENCODER_COMMUTATION)
+        #error ENABLE_CATCH_UP_CORRECTION replaces the direction based correction, it cannot be used with ENABLE_PID, ENABLE_FOC, or ENABLE_ENCODER_COMMUTATION
+    #endif
+    static_assert((CATCH_UP_SLEW_FREQ >= 1) && (CATCH_UP_SLEW_FREQ <= CONTROL_LOOP_FREQ), "CATCH_UP_SLEW_FREQ must be between 1 and CONTROL_LOOP_FREQ");
+#endif
+
+// The commutation already steers the rotor back, there aren't any correction steps to hold off
+#ifdef ENABLE_CORRECTION_HYSTERESIS
+    #if defined(ENABLE_FOC) || defined(ENABLE_ENCODER_COMMUTATION)
+        #error ENABLE_CORRECTION_HYSTERESIS holds off the correction steps, it cannot be used with ENABLE_FOC or ENABLE_ENCODER_COMMUTATION
+    #endif
+    static_assert((CORRECTION_EXIT_ERROR < CORRECTION_ENTER_ERROR) && (CORRECTION_ENTER_ERROR <= CORRECTION_IMMEDIATE_ERROR),
+                  "CORRECTION_EXIT_ERROR must be below CORRECTION_ENTER_ERROR, which can't be above CORRECTION_IMMEDIATE_ERROR");
+#endif
+
+// The lead of the feed forward is added to the step phase, which the field oriented mode doesn't use
+// The supply monitor has 8 thresholds
+#if defined(ENABLE_POWER_LOSS_SAVE) && ((POWER_LOSS_PVD_LEVEL < 0) || (POWER_LOSS_PVD_LEVEL > 7))
+    #error POWER_LOSS_PVD_LEVEL must be between 0 and 7
+#endif
+
+// The thermal model starts from the encoder's temperature, and can't see the current of FOC
+#if defined(ENABLE_THERMAL_MODEL) && (!defined(ENABLE_OVERTEMP_PROTECTION) || defined(ENABLE_FOC))
+    #error "ENABLE_THERMAL_MODEL requires ENABLE_OVERTEMP_PROTECTION, and can't be used with ENABLE_FOC"
+#endif
+#ifdef ENABLE_THERMAL_MODEL
+    static_assert(((CONTROL_LOOP_FREQ % THERMAL_UPDATE_FREQ) == 0), "THERMAL_UPDATE_FREQ must divide CONTROL_LOOP_FREQ");
+    static_assert((THERMAL_DERATE_BAND > 0) && (THERMAL_MIN_CURRENT > 0) && (THERMAL_MIN_CURRENT <= 100), "THERMAL_DERATE_BAND must be positive, and THERMAL_MIN_CURRENT from 1 to 100");
+#endif
+
+// The control modes switch the correction steps, the field oriented mode and the encoder commutation don't take any
+#if defined(ENABLE_CONTROL_MODES) && (defined(ENABLE_FOC) || defined(ENABLE_ENCODER_COMMUTATION))
+    #error "ENABLE_CONTROL_MODES can't be used with ENABLE_FOC or ENABLE_ENCODER_COMMUTATION"
+#endif
+
+// The torque mode's speed limit uses the observer's velocity, and FOC already commutates from the rotor
+#if defined(ENABLE_TORQUE_MODE) && (!defined(ENABLE_ENCODER_OBSERVER) || defined(ENABLE_FOC))
+    #error "ENABLE_TORQUE_MODE requires ENABLE_ENCODER_OBSERVER, and can't be used with ENABLE_FOC"
+#endif
+#ifdef ENABLE_TORQUE_MODE
+    static_assert((DEFAULT_TORQUE_SPEED_LIMIT > 0) && (TORQUE_SPEED_LIMIT_BAND > 0) && (TORQUE_SPEED_LIMIT_BAND <= 1000), "DEFAULT_TORQUE_SPEED_LIMIT must be positive, and TORQUE_SPEED_LIMIT_BAND from 1 to 1000 RPM");
+#endif
+
+// The latency compensation moves the position by the observer's velocity
+#if defined(ENABLE_LATENCY_COMPENSATION) && !defined(ENABLE_ENCODER_OBSERVER)
+    #error ENABLE_LATENCY_COMPENSATION requires ENABLE_ENCODER_OBSERVER
+#endif
+
+// The current boost is found from the observer's speed
+#if defined(ENABLE_SPEED_CURRENT_BOOST) && !defined(ENABLE_ENCODER_OBSERVER)
+    #error ENABLE_SPEED_CURRENT_BOOST requires ENABLE_ENCODER_OBSERVER
+#endif
+#if defined(ENABLE_SPEED_CURRENT_BOOST) && ((CURRENT_BOOST_POINTS < 2) || (CURRENT_BOOST_POINTS > 6))
+    #error CURRENT_BOOST_POINTS must be between 2 and 6
+#endif
+
+// The load has to fall below where it sheds the work to bring it back, or the levels would flip back and forth
+#if defined(ENABLE_OVERRUN_DETECTION) && (OVERRUN_RECOVER_LOAD >= OVERRUN_DEGRADE_LOAD)
+    #error OVERRUN_RECOVER_LOAD must be lower than OVERRUN_DEGRADE_LOAD
+#endif
+#if defined(ENABLE_OVERRUN_DETECTION) && (OVERRUN_DECIMATION < 2)
+    #error OVERRUN_DECIMATION must be at least 2
+#endif
+
+// The detent table offsets the coils' phase, which the field oriented control doesn't drive from
+#if defined(ENABLE_DETENT_COMPENSATION) && defined(ENABLE_FOC)
+    #error ENABLE_DETENT_COMPENSATION cannot be used with ENABLE_FOC
+#endif
+#if defined(ENABLE_DETENT_COMPENSATION) && ((DETENT_TABLE_POWER < 2) || (DETENT_TABLE_POWER > 7))
+    #error DETENT_TABLE_POWER must be between 2 and 7
+#endif
+
+// The adaptive PWM writes the compare registers in timer ticks, and switches from the observer's velocity
+#if defined(ENABLE_ADAPTIVE_PWM) && (!defined(ENABLE_DIRECT_COIL_OUTPUT) || !defined(ENABLE_ENCODER_OBSERVER))
+    #error ENABLE_ADAPTIVE_PWM requires ENABLE_DIRECT_COIL_OUTPUT and ENABLE_ENCODER_OBSERVER
+#endif
+#if defined(ENABLE_ADAPTIVE_PWM) && defined(ENABLE_COIL_LUT)
+    #error ENABLE_ADAPTIVE_PWM cannot be used with ENABLE_COIL_LUT (the table is in the ticks of a single period)
+#endif
+#ifdef ENABLE_ADAPTIVE_PWM
+    static_assert((PWM_SMOOTH_FREQ < MOTOR_PWM_FREQ) && (PWM_SWITCH_HYSTERESIS < PWM_SWITCH_SPEED),
+                  "PWM_SMOOTH_FREQ must be below MOTOR_PWM_FREQ, and PWM_SWITCH_HYSTERESIS must be below PWM_SWITCH_SPEED");
+#endif
+
+// The damping is found from the observer's velocity, and it holds back the phase of the coils (commutated from the encoder in FOC)
+#if defined(ENABLE_RESONANCE_DAMPING) && !defined(ENABLE_ENCODER_OBSERVER)
+    #error ENABLE_RESONANCE_DAMPING requires ENABLE_ENCODER_OBSERVER
+#endif
+#if defined(ENABLE_RESONANCE_DAMPING) && defined(ENABLE_FOC)
+    #error ENABLE_RESONANCE_DAMPING cannot be used with ENABLE_FOC
+#endif
+#if defined(ENABLE_RESONANCE_DAMPING) && ((RESONANCE_FAST_POWER >= RESONANCE_SLOW_POWER) || (RESONANCE_FAST_POWER < 1))
+    #error RESONANCE_FAST_POWER must be at least 1, and less than RESONANCE_SLOW_POWER
+#endif
+
+#if defined(ENABLE_STEP_FEED_FORWARD) && defined(ENABLE_FOC)
+    #error ENABLE_STEP_FEED_FORWARD cannot be used with ENABLE_FOC
+#endif
+
+// TIM2's input filter is 4 bits
+#if (DEFAULT_STEP_FILTER < 0) || (DEFAULT_STEP_FILTER > 15)
+    #error DEFAULT_STEP_FILTER must be between 0 and 15
+#endif
+
+// The statistics of the step input compare the step pin's interrupt with TIM2
+#if defined(ENABLE_STEP_GLITCH_STATS) && defined(ENABLE_HARDWARE_STEP_COUNTING)
+    #error "ENABLE_STEP_GLITCH_STATS needs the step pin's interrupt, it cannot be used with ENABLE_HARDWARE_STEP_COUNTING"
+#endif
+
+// The benchmark reports over serial and injects its bursts with the step schedule timer
+#if defined(ENABLE_BENCHMARK) && (!defined(ENABLE_SERIAL) || !defined(ENABLE_DIRECT_STEPPING))
+    #error ENABLE_BENCHMARK requires ENABLE_SERIAL and ENABLE_DIRECT_STEPPING
+#endif
+
+// The gain schedule is saved after the other parameters, which can only fill 32 slots of the flash page
+#if defined(ENABLE_GAIN_SCHEDULING) && ((GAIN_SCHEDULE_POINTS < 2) || (GAIN_SCHEDULE_POINTS > 6))
+    #error GAIN_SCHEDULE_POINTS must be between 2 and 6
+#endif
+
+// The autotune's relay replaces the PID's output, which the field oriented mode doesn't use
+// The step rate test steps the motor with the step schedule timer
+#if defined(ENABLE_STEP_RATE_TEST) && !defined(ENABLE_DIRECT_STEPPING)
+    #error ENABLE_STEP_RATE_TEST requires ENABLE_DIRECT_STEPPING
+#endif
+// The DDS steps the PID's output with the step schedule timer, which the PID doesn't use when it runs alongside the moves
+#if defined(ENABLE_DDS_STEPPING) && defined(ENABLE_CONCURRENT_CORRECTION)
+    #error "ENABLE_DDS_STEPPING can't be used with ENABLE_CONCURRENT_CORRECTION"
+#endif
+#ifdef ENABLE_DDS_STEPPING
+    static_assert((STEP_SCHEDULE_TICK_FREQ % DDS_TICK_FREQ) == 0, "DDS_TICK_FREQ must divide STEP_SCHEDULE_TICK_FREQ");
+    static_assert(DDS_TICK_FREQ >= DEFAULT_PID_STEP_MAX, "DDS_TICK_FREQ must be at least DEFAULT_PID_STEP_MAX");
+#endif
+// The step interpolation moves the coils from the step interrupt's pulses, which the hardware counting, FOC, and the encoder commutation don't use
+#if defined(ENABLE_STEP_INTERPOLATION) && (defined(ENABLE_HARDWARE_STEP_COUNTING) || defined(ENABLE_FOC) || defined(ENABLE_ENCODER_COMMUTATION))
+    #error "ENABLE_STEP_INTERPOLATION can't be used with ENABLE_HARDWARE_STEP_COUNTING, ENABLE_FOC, or ENABLE_ENCODER_COMMUTATION"
+#endif
+// The synchronous outputs latch the direct writes of the coils
+#if defined(ENABLE_PWM_SYNC_OUTPUT) && !defined(ENABLE_DIRECT_COIL_OUTPUT)
+    #error ENABLE_PWM_SYNC_OUTPUT requires ENABLE_DIRECT_COIL_OUTPUT
+#endif
+// The correction runs alongside the moves of the step schedule timer
+#if defined(ENABLE_CONCURRENT_CORRECTION) && !defined(ENABLE_DIRECT_STEPPING)
+    #error ENABLE_CONCURRENT_CORRECTION requires ENABLE_DIRECT_STEPPING
+#endif
+// The jog steps from the step schedule timer
+#if defined(ENABLE_JOG) && !defined(ENABLE_DIRECT_STEPPING)
+    #error ENABLE_JOG requires ENABLE_DIRECT_STEPPING
+#endif
+#ifdef ENABLE_JOG
+    static_assert((JOG_MIN_RATE > 0) && ((STEP_SCHEDULE_TICK_FREQ / JOG_MIN_RATE) <= 65536), "JOG_MIN_RATE is slower than the step schedule timer can go");
+#endif
+
+// The homing moves through the planner, and watches the coils lead the rotor (the field oriented mode commutates to the rotor instead)
+#if defined(ENABLE_SENSORLESS_HOMING) && (!defined(ENABLE_DIRECT_STEPPING) || !defined(ENABLE_MOTION_PLANNER) || defined(ENABLE_FOC))
+    #error "ENABLE_SENSORLESS_HOMING requires ENABLE_DIRECT_STEPPING and ENABLE_MOTION_PLANNER, and can't be used with ENABLE_FOC"
+#endif
+#if defined(ENABLE_SENSORLESS_HOMING) && ((HOMING_STALL_LEAD < 1) || (HOMING_STALL_LEAD > 150))
+    #error HOMING_STALL_LEAD must be between 1 and 150
+#endif
+
+#ifdef ENABLE_STEP_RATE_TEST
+    static_assert((STEP_RATE_TEST_START_RATE > 0) && (STEP_RATE_TEST_START_RATE <= STEP_RATE_TEST_MAX_RATE) && (STEP_RATE_TEST_MAX_RATE <= STEP_SCHEDULE_TICK_FREQ),
+                  "STEP_RATE_TEST_START_RATE and STEP_RATE_TEST_MAX_RATE must be within 1 and STEP_SCHEDULE_TICK_FREQ");
+    static_assert((STEP_SCHEDULE_TICK_FREQ / STEP_RATE_TEST_START_RATE) <= 65536, "STEP_RATE_TEST_START_RATE is slower than the step schedule timer can go");
+#endif
+
+#if defined(ENABLE_AUTOTUNE) && defined(ENABLE_FOC)
+    #error ENABLE_AUTOTUNE cannot be used with ENABLE_FOC
+#endif
+
+// The field oriented mode sets the current from the error, and doesn't drive the coils through the step phase
+#if defined(ENABLE_IDLE_CURRENT) && defined(ENABLE_FOC)
+    #error ENABLE_IDLE_CURRENT cannot be used with ENABLE_FOC
+#endif
+
+// The field oriented mode already sets the current from the error
+#if defined(ENABLE_CURRENT_ON_DEMAND) && defined(ENABLE_FOC)
+    #error ENABLE_CURRENT_ON_DEMAND cannot be used with ENABLE_FOC
+#endif
+
+// The base current is a fraction of the set current
+#if defined(ENABLE_CURRENT_ON_DEMAND) && ((DEMAND_BASE_CURRENT < 1) || (DEMAND_BASE_CURRENT > 100))
+    #error DEMAND_BASE_CURRENT must be between 1 and 100
+#endif
+
+// The holding current is a fraction of the running current
+#if defined(ENABLE_IDLE_CURRENT) && ((IDLE_CURRENT_PERCENT < 1) || (IDLE_CURRENT_PERCENT > 100))
+    #error IDLE_CURRENT_PERCENT must be between 1 and 100
+#endif
+
+// The transmit arena is indexed with a mask
+#ifdef ENABLE_SERIAL_DMA
+    #ifndef ENABLE_SERIAL
+        #error ENABLE_SERIAL_DMA requires ENABLE_SERIAL
+    #endif
+    #if ((SERIAL_TX_ARENA_SIZE < 2) || ((SERIAL_TX_ARENA_SIZE & (SERIAL_TX_ARENA_SIZE - 1)) != 0))
+        #error SERIAL_TX_ARENA_SIZE must be a power of 2
+    #endif
+#endif
+
+// The CAN queues are indexed with a mask
+#ifdef ENABLE_CAN
+    #if ((CAN_RX_QUEUE_SIZE < 2) || ((CAN_RX_QUEUE_SIZE & (CAN_RX_QUEUE_SIZE - 1)) != 0))
+        #error CAN_RX_QUEUE_SIZE must be a power of 2
+    #endif
+    #if ((CAN_TX_QUEUE_SIZE < 2) || ((CAN_TX_QUEUE_SIZE & (CAN_TX_QUEUE_SIZE - 1)) != 0))
+        #error CAN_TX_QUEUE_SIZE must be a power of 2
+    #endif
+    #if (CAN_ASSEMBLY_SLOTS < 1)
+        #error CAN_ASSEMBLY_SLOTS must be at least 1
+    #endif
+#endif
+
+// The binary CAN protocol moves the motor with the step schedule
+#ifdef ENABLE_CAN_PDO
+    #ifndef ENABLE_CAN
+        #error ENABLE_CAN_PDO requires ENABLE_CAN
+    #endif
+    #ifndef ENABLE_DIRECT_STEPPING
+        #error ENABLE_CAN_PDO requires ENABLE_DIRECT_STEPPING
+    #endif
+#endif
+
+// The SYNCs latch the targets of the binary CAN protocol
+#ifdef ENABLE_CAN_SYNC
+    #ifndef ENABLE_CAN_PDO
+        #error ENABLE_CAN_SYNC requires ENABLE_CAN_PDO
+    #endif
+    #if ((CAN_SYNC_MAX_TRIM < 1) || (CAN_SYNC_MAX_TRIM > 10))
+        #error CAN_SYNC_MAX_TRIM must be between 1 and 10
+    #endif
+#endif
+
+// Binary frames are received and sent over serial
+#ifdef ENABLE_BINARY_PROTOCOL
+    #ifndef ENABLE_SERIAL
+        #error ENABLE_BINARY_PROTOCOL requires ENABLE_SERIAL
+    #endif
+    #if (BINARY_MAX_FRAME_SIZE < 32)
+        #error BINARY_MAX_FRAME_SIZE must be at least 32 bytes
+    #endif
+#endif
+
+// The trace is dumped over serial, and its ring is indexed with a mask
+#ifdef ENABLE_TRACE
+    #ifndef ENABLE_SERIAL
+        #error ENABLE_TRACE requires ENABLE_SERIAL
+    #endif
+    #if ((TRACE_BUFFER_SIZE < 2) || ((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) != 0))
+        #error TRACE_BUFFER_SIZE must be a power of 2
+    #endif
+#endif
+
+// The step stream is kept in the trace's buffer
+#ifdef ENABLE_STEP_STREAM
+    #ifndef ENABLE_TRACE
+        #error ENABLE_STEP_STREAM requires ENABLE_TRACE
+    #endif
+    #if (DEFAULT_STEP_STREAM_DIVIDER < 1)
+        #error DEFAULT_STEP_STREAM_DIVIDER must be at least 1
+    #endif
+#endif
+
+// The telemetry is streamed over serial
+#ifdef ENABLE_TELEMETRY
+    #ifndef ENABLE_SERIAL
+        #error ENABLE_TELEMETRY requires ENABLE_SERIAL
+    #endif
+    #if ((TELEMETRY_MAX_RATE < 1) || (TELEMETRY_MAX_RATE > 10000))
+        #error TELEMETRY_MAX_RATE must be between 1 and 10000 Hz
+    #endif
+#endif
+
+// The motion frames that the receive interrupt decodes are the binary protocol's
+#if defined(ENABLE_CAN_MOTION_FAST_PATH) && !defined(ENABLE_CAN_PDO)
+    #error ENABLE_CAN_MOTION_FAST_PATH requires ENABLE_CAN_PDO
+#endif
+
+// The gearing's frames are part of the binary protocol
+#if defined(ENABLE_CAN_GEARING) && !defined(ENABLE_CAN_PDO)
+    #error ENABLE_CAN_GEARING requires ENABLE_CAN_PDO
+#endif
+
+// The batches are sent over the binary CAN protocol's parameter channel
+#if defined(ENABLE_CAN_PARAM_BATCH) && !defined(ENABLE_CAN_PDO)
+    #error ENABLE_CAN_PARAM_BATCH requires ENABLE_CAN_PDO
+#endif
+
+// The soft limits need a range to hold the desired position in
+#ifdef ENABLE_SOFT_LIMITS
+    #if (DEFAULT_SOFT_LIMIT_MIN >= DEFAULT_SOFT_LIMIT_MAX)
+        #error DEFAULT_SOFT_LIMIT_MIN must be below DEFAULT_SOFT_LIMIT_MAX
+    #endif
+    #if ((SOFT_LIMIT_VELOCITY_WINDOW < 1) || (SOFT_LIMIT_VELOCITY_WINDOW > 255))
+        #error SOFT_LIMIT_VELOCITY_WINDOW must be between 1 and 255 corrections
+    #endif
+#endif
+
+// The IIF position path needs a spare timer with its encoder inputs wired to the TLE5012's IFA/IFB lines
+// All four timers are in use (TIM1 correction, TIM2 step counting, TIM3 coil PWM, TIM4 step scheduling) and
+// their channel 1/2 pins are taken (PA8/PA9 OLED reset/USART1 TX, PA0/PA1 step/dir, PA6/PA7 SPI1, PB6/PB7 coil A direction)
+#ifdef ENABLE_ENCODER_IIF
+    #error ENABLE_ENCODER_IIF is not supported on this board, there is no free timer with its encoder inputs connected to the encoder
 #endif
 
 #if defined(CHECK_MCO_OUTPUT) && defined(CHECK_GPIO_OUTPUT_SWITCHING)
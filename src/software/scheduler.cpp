@@ -0,0 +1,149 @@
+// Import the header file
+#include "scheduler.h"
+#include "watchdog.h"
+
+// The table of tasks
+static schedulerTask tasks[MAX_SCHEDULER_TASKS];
+static uint8_t taskCount = 0;
+
+// Time spent sleeping between the tasks (us), and when it started being counted (ms, lasts longer than micros() before wrapping)
+#ifdef ENABLE_IDLE_SLEEP
+static uint64_t idleTime = 0;
+static uint32_t idleStartTime = 0;
+#endif
+
+
+// Adds a task to the scheduler, running it at frequency (Hz)
+bool addTask(const char *name, void (*function)(), uint32_t frequency) {
+
+    // Check that there is room for the task, and that it has a usable rate
+    if (taskCount >= MAX_SCHEDULER_TASKS || frequency == 0) {
+        return false;
+    }
+
+    // Fill in the task, first release is right away
+    schedulerTask &task = tasks[taskCount];
+    task.name = name;
+    task.function = function;
+    task.period = (1000000 / frequency);
+    task.release = micros();
+    taskCount++;
+
+    // Start with clean statistics
+    task.runs = 0;
+    task.lateRuns = 0;
+    task.lastTime = 0;
+    task.maxTime = 0;
+    task.totalTime = 0;
+    return true;
+}
+
+
+// Runs the task that is the most overdue, if one is due
+// Picks the released task with the earliest deadline, so a slow task can't starve a fast one for more than its own runtime
+void runScheduler() {
+
+    // Find the task with the earliest deadline
+    // The comparisons are on differences, so they work through the 71 minute wrap of micros()
+    uint32_t now = micros();
+    schedulerTask *nextTask = NULL;
+    int32_t earliestSlack = 0;
+    for (uint8_t taskIndex = 0; taskIndex < taskCount; taskIndex++) {
+
+        // Only released tasks can run, the one with the least time left until its deadline goes first
+        int32_t sinceRelease = (int32_t)(now - tasks[taskIndex].release);
+        if (sinceRelease >= 0) {
+            int32_t slack = (int32_t)tasks[taskIndex].period - sinceRelease;
+            if (nextTask == NULL || slack < earliestSlack) {
+                nextTask = &tasks[taskIndex];
+                earliestSlack = slack;
+            }
+        }
+    }
+
+    // Nothing to do
+    if (nextTask == NULL) {
+
+        // Sleep until the next interrupt, the handlers run right away and the SysTick brings the core back for the next release
+        #ifdef ENABLE_IDLE_SLEEP
+            __WFI();
+            idleTime += (micros() - now);
+        #endif
+        return;
+    }
+
+    // Move the release forward by a period (keeps the runs in phase)
+    // If the deadline has already passed, the releases that were missed are dropped instead of being run back to back
+    nextTask -> release += nextTask -> period;
+    if ((int32_t)(now - nextTask -> release) >= 0) {
+        nextTask -> lateRuns++;
+        nextTask -> release = now + nextTask -> period;
+    }
+
+    // Run the task, measuring how long it takes
+    nextTask -> function();
+    uint32_t runtime = (micros() - now);
+
+    // The task finished, so the main loop isn't stuck
+    #ifdef ENABLE_WATCHDOG
+        watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+    #endif
+
+    // Update the statistics
+    nextTask -> runs++;
+    nextTask -> lastTime = runtime;
+    nextTask -> totalTime += runtime;
+    if (runtime > nextTask -> maxTime) {
+        nextTask -> maxTime = runtime;
+    }
+}
+
+
+// Returns a string of the runtime statistics of each task
+String getTaskStats() {
+
+    // Build a line for each task
+    String stats;
+    for (uint8_t taskIndex = 0; taskIndex < taskCount; taskIndex++) {
+        const schedulerTask &task = tasks[taskIndex];
+        stats += task.name;
+        stats += F(": runs ");
+        stats += task.runs;
+        stats += F(", avg ");
+        stats += (uint32_t)(task.runs > 0 ? (task.totalTime / task.runs) : 0);
+        stats += F("us, max ");
+        stats += task.maxTime;
+        stats += F("us, period ");
+        stats += task.period;
+        stats += F("us, late ");
+        stats += task.lateRuns;
+        stats += "\n";
+    }
+
+    // Share of the time that the core was asleep
+    #ifdef ENABLE_IDLE_SLEEP
+        uint32_t elapsedTime = (millis() - idleStartTime);
+        stats += F("Idle: ");
+        stats += (uint32_t)(elapsedTime > 0 ? (idleTime / (elapsedTime * 10)) : 0);
+        stats += F("% asleep\n");
+    #endif
+    return stats;
+}
+
+
+// Clears the runtime statistics of all of the tasks
+void resetTaskStats() {
+    for (uint8_t taskIndex = 0; taskIndex < taskCount; taskIndex++) {
+        tasks[taskIndex].runs = 0;
+        tasks[taskIndex].lateRuns = 0;
+        tasks[taskIndex].lastTime = 0;
+        tasks[taskIndex].maxTime = 0;
+        tasks[taskIndex].totalTime = 0;
+    }
+
+    // Start counting the sleep again
+    #ifdef ENABLE_IDLE_SLEEP
+        idleTime = 0;
+        idleStartTime = millis();
+    #endif
+}
@@ -0,0 +1,41 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+// Include main config
+#include "config.h"
+
+// Include Arduino library
+#include "Arduino.h"
+
+// The most tasks that can be added to the scheduler
+#define MAX_SCHEDULER_TASKS 10
+
+// A periodic task of the main loop
+// Each run is released once per period, and should finish before the next release (its deadline)
+typedef struct {
+    const char *name;         // Name for the statistics
+    void (*function)();       // Function to run
+    uint32_t period;          // Time between releases (us)
+    uint32_t release;         // Time of the next release (us)
+
+    // Runtime statistics
+    uint32_t runs;            // Number of times the task has run
+    uint32_t lateRuns;        // Number of runs that started after their deadline (at least one release was dropped)
+    uint32_t lastTime;        // Runtime of the last run (us)
+    uint32_t maxTime;         // Longest runtime (us)
+    uint64_t totalTime;       // Total runtime (us), for the average
+} schedulerTask;
+
+// Adds a task to the scheduler, running it at frequency (Hz). Returns false if the scheduler is full
+bool addTask(const char *name, void (*function)(), uint32_t frequency);
+
+// Runs the task that is the most overdue, if one is due. Called continuously by the main loop
+void runScheduler();
+
+// Returns a string of the runtime statistics of each task (runs, average and max runtime, and late runs)
+String getTaskStats();
+
+// Clears the runtime statistics of all of the tasks
+void resetTaskStats();
+
+#endif // ! __SCHEDULER_H__
@@ -0,0 +1,241 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_SOFT_LIMITS
+
+// Import the header file
+#include "softLimits.h"
+#include "timers.h"
+#include "pvt.h"
+
+// Settings of the limits
+static bool softLimitsEnabled = DEFAULT_SOFT_LIMITS_ENABLED;
+static int32_t softLimitMin = DEFAULT_SOFT_LIMIT_MIN;
+static int32_t softLimitMax = DEFAULT_SOFT_LIMIT_MAX;
+static uint32_t maxVelocity = DEFAULT_MAX_VELOCITY;
+static uint32_t maxAccel = DEFAULT_MAX_ACCEL;
+
+// The fault that is latched (only set by the interrupts, only cleared by the commands)
+static volatile SOFT_LIMIT_FAULT softLimitFault = SOFT_LIMIT_OK;
+
+// Desired position at the last correction, so that a limit only faults while the position moves further past it
+static int32_t lastPosition = 0;
+
+// Window of the velocity check, the position and the time that the window started at
+static int32_t windowPosition = 0;
+static uint32_t windowStartTime = 0;
+static uint8_t windowTicks = 0;
+
+
+// Latches a fault, stopping the moves and ignoring the step input (only the first fault is kept)
+static void RAMFUNC tripSoftLimit(SOFT_LIMIT_FAULT fault) {
+    if (softLimitFault != SOFT_LIMIT_OK) {
+        return;
+    }
+    softLimitFault = fault;
+    motor.setStepInputBlocked(true);
+    #ifdef ENABLE_DIRECT_STEPPING
+        stopDirectMoves();
+    #endif
+    #ifdef ENABLE_PVT_TRAJECTORY
+        stopPVT();
+    #endif
+}
+
+
+// Starts the checks over from where the motor is
+static void resetSoftLimitChecks() {
+    lastPosition = motor.getSoftStepCNT();
+    windowPosition = lastPosition;
+    windowStartTime = micros();
+    windowTicks = 0;
+}
+
+
+// Enables or disables the limits (disabling them clears any fault)
+void setSoftLimitsEnabled(bool enabled) {
+    disableInterrupts();
+    softLimitsEnabled = enabled;
+    enableInterrupts();
+    if (!enabled) {
+        clearSoftLimitFault();
+    }
+}
+
+
+// If the limits are checked
+bool getSoftLimitsEnabled() {
+    return softLimitsEnabled;
+}
+
+
+// Sets the lowest and highest desired positions (microsteps), returning false if the lowest isn't below the highest
+bool setSoftLimits(int32_t lowest, int32_t highest) {
+    if (lowest >= highest) {
+        return false;
+    }
+
+    // The correction reads both limits together
+    disableInterrupts();
+    softLimitMin = lowest;
+    softLimitMax = highest;
+    enableInterrupts();
+    return true;
+}
+
+
+// Gets the lowest desired position (microsteps)
+int32_t getSoftLimitMin() {
+    return softLimitMin;
+}
+
+
+// Gets the highest desired position (microsteps)
+int32_t getSoftLimitMax() {
+    return softLimitMax;
+}
+
+
+// Sets the max velocity (microsteps/s), 0 doesn't limit it
+void setMaxVelocity(uint32_t velocity) {
+    maxVelocity = velocity;
+}
+
+
+// Gets the max velocity (microsteps/s)
+uint32_t getMaxVelocity() {
+    return maxVelocity;
+}
+
+
+// Sets the max acceleration (microsteps/s/s), 0 doesn't limit it
+void setMaxAccel(uint32_t accel) {
+    maxAccel = accel;
+}
+
+
+// Gets the max acceleration (microsteps/s/s)
+uint32_t getMaxAccel() {
+    return maxAccel;
+}
+
+
+// Gets the fault that is latched
+SOFT_LIMIT_FAULT getSoftLimitFault() {
+    return softLimitFault;
+}
+
+
+// Clears the fault, the step input is followed again from where the motor is
+void clearSoftLimitFault() {
+    disableInterrupts();
+    resetSoftLimitChecks();
+    softLimitFault = SOFT_LIMIT_OK;
+    motor.setStepInputBlocked(false);
+    enableInterrupts();
+}
+
+
+// Checks the desired position and its velocity against the limits (called every correction)
+void RAMFUNC checkSoftLimits() {
+
+    // Nothing to check if the limits are off, or already faulted
+    if (!softLimitsEnabled || softLimitFault != SOFT_LIMIT_OK) {
+        resetSoftLimitChecks();
+        return;
+    }
+
+    // Past a limit and still moving away from it (a position that was moved past a limit while it was set can still come back)
+    int32_t position = motor.getSoftStepCNT();
+    if (position > softLimitMax && position > lastPosition) {
+        tripSoftLimit(SOFT_LIMIT_MAX_FAULT);
+    }
+    else if (position < softLimitMin && position < lastPosition) {
+        tripSoftLimit(SOFT_LIMIT_MIN_FAULT);
+    }
+    lastPosition = position;
+
+    // Measure the velocity over the window, the time is measured since the correction is paused during the moves
+    // An acceleration can't be told apart from the noise of the step input in a window, so only the moves are held to it
+    if (++windowTicks < SOFT_LIMIT_VELOCITY_WINDOW) {
+        return;
+    }
+    uint32_t now = micros();
+    uint32_t elapsed = max(now - windowStartTime, (uint32_t)1);
+    uint64_t velocity = ((uint64_t)abs(position - windowPosition) * 1000000) / elapsed;
+    if (maxVelocity > 0 && velocity > (((uint64_t)maxVelocity * (100 + SOFT_LIMIT_VELOCITY_MARGIN)) / 100)) {
+        tripSoftLimit(SOFT_LIMIT_VELOCITY_FAULT);
+    }
+    windowPosition = position;
+    windowStartTime = now;
+    windowTicks = 0;
+}
+
+
+// Limits of the moves
+#ifdef ENABLE_DIRECT_STEPPING
+// Cuts a rate (steps/s) to the max velocity
+uint32_t limitStepRate(uint32_t rate) {
+    if (!softLimitsEnabled || maxVelocity == 0) {
+        return rate;
+    }
+    uint32_t maxRate = max((uint32_t)(maxVelocity / motor.getMicrostepMultiplier()), (uint32_t)1);
+    return min(rate, maxRate);
+}
+
+
+// Cuts an acceleration (steps/s/s) to the max acceleration, one of 0 (no ramp) is given the max
+uint32_t limitStepAccel(uint32_t accel) {
+    if (!softLimitsEnabled || maxAccel == 0) {
+        return accel;
+    }
+    uint32_t maxStepAccel = max((uint32_t)(maxAccel / motor.getMicrostepMultiplier()), (uint32_t)1);
+    return ((accel == 0) ? maxStepAccel : min(accel, maxStepAccel));
+}
+
+
+// Checks a move that ends at a position (microsteps), cutting its rate, acceleration, and jerk to the limits
+bool limitMove(int32_t endPosition, uint32_t &rate, uint32_t &accel, uint32_t &jerk) {
+    if (!softLimitsEnabled) {
+        return true;
+    }
+
+    // The move has to end inside the limits
+    if (endPosition < softLimitMin || endPosition > softLimitMax) {
+        return false;
+    }
+
+    // Cut the rate and acceleration to the max
+    rate = limitStepRate(rate);
+    #ifdef ENABLE_MOTION_PLANNER
+        accel = limitStepAccel(accel);
+
+        // A move that was going to start at its rate now ramps up to it, so it needs a jerk limit too
+        if (accel > 0 && jerk == 0) {
+            jerk = DEFAULT_PLANNER_JERK;
+        }
+    #endif
+    return true;
+}
+
+
+// Checks the next step of a direction before it is taken, faulting the limits if it would go past one (called by the step schedule interrupt)
+bool RAMFUNC checkSoftLimitStep(STEP_DIR dir) {
+    if (!softLimitsEnabled) {
+        return true;
+    }
+    int32_t position = motor.getSoftStepCNT();
+    if (dir == COUNTER_CLOCKWISE && position >= softLimitMax) {
+        tripSoftLimit(SOFT_LIMIT_MAX_FAULT);
+        return false;
+    }
+    if (dir == CLOCKWISE && position <= softLimitMin) {
+        tripSoftLimit(SOFT_LIMIT_MIN_FAULT);
+        return false;
+    }
+    return true;
+}
+#endif // ! ENABLE_DIRECT_STEPPING
+
+#endif // ! ENABLE_SOFT_LIMITS
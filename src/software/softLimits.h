@@ -0,0 +1,66 @@
+#ifndef __SOFT_LIMITS_H__
+#define __SOFT_LIMITS_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the soft limits are enabled
+#ifdef ENABLE_SOFT_LIMITS
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Soft limits of the position, velocity, and acceleration
+// The moves are checked by the planner when they're started, so they never reach a limit. The step input can't be checked ahead of time,
+// so the correction checks the desired position every tick and the velocity over a window of ticks instead.
+// A fault is latched until it is cleared, the moves are stopped and the step input is ignored so that the motor holds where it stopped
+
+// Faults of the soft limits
+typedef enum {
+    SOFT_LIMIT_OK,             // Inside the limits
+    SOFT_LIMIT_MIN_FAULT,      // The desired position went below the lowest limit
+    SOFT_LIMIT_MAX_FAULT,      // The desired position went past the highest limit
+    SOFT_LIMIT_VELOCITY_FAULT  // The desired position moved faster than the max velocity
+} SOFT_LIMIT_FAULT;
+
+// Enables or disables the limits (disabling them clears any fault)
+void setSoftLimitsEnabled(bool enabled);
+bool getSoftLimitsEnabled();
+
+// Sets the lowest and highest desired positions (microsteps), returning false if the lowest isn't below the highest
+bool setSoftLimits(int32_t lowest, int32_t highest);
+int32_t getSoftLimitMin();
+int32_t getSoftLimitMax();
+
+// Sets the max velocity (microsteps/s) and acceleration (microsteps/s/s), 0 doesn't limit them
+void setMaxVelocity(uint32_t velocity);
+uint32_t getMaxVelocity();
+void setMaxAccel(uint32_t accel);
+uint32_t getMaxAccel();
+
+// Gets the fault that is latched, or clears it (the step input is followed again from where the motor is)
+SOFT_LIMIT_FAULT getSoftLimitFault();
+void clearSoftLimitFault();
+
+// Checks the desired position and its velocity against the limits (called every correction)
+void checkSoftLimits();
+
+// Limits of the moves
+#ifdef ENABLE_DIRECT_STEPPING
+// Checks a move that ends at a position (microsteps), cutting its rate (steps/s), acceleration (steps/s/s), and jerk to the limits
+// Returns false if the move would end past a limit
+bool limitMove(int32_t endPosition, uint32_t &rate, uint32_t &accel, uint32_t &jerk);
+
+// Cuts a rate (steps/s) and an acceleration (steps/s/s) to the limits, for the jog
+uint32_t limitStepRate(uint32_t rate);
+uint32_t limitStepAccel(uint32_t accel);
+
+// Checks the next step of a direction before it is taken, faulting the limits if it would go past one (called by the step schedule interrupt)
+bool checkSoftLimitStep(STEP_DIR dir);
+#endif
+
+#endif // ! ENABLE_SOFT_LIMITS
+#endif // ! __SOFT_LIMITS_H__
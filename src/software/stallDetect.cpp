@@ -0,0 +1,102 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_STALL_DETECTION
+
+// Import the header file
+#include "stallDetect.h"
+#include "filters.h"
+
+// Optimize for speed, the detector runs in the correction interrupt
+#pragma GCC optimize ("-Ofast")
+
+// Anticipatory stall detection
+// The lead of the coils over the rotor is projected ahead by its growth rate. A stall is declared once the projection
+// passes the lead limit for the confirm time, which is well before the rotor has slipped far enough to trip the step count limit
+
+// Time until the predicted lead, and the time it needs to stay over the limit (in corrections)
+#define STALL_PREDICTION_TICKS  ((STALL_PREDICTION_TIME * CONTROL_LOOP_FREQ) / 1000000)
+#define STALL_CONFIRM_TICKS     (((STALL_CONFIRM_TIME * CONTROL_LOOP_FREQ) / 1000000) > 0 ? ((STALL_CONFIRM_TIME * CONTROL_LOOP_FREQ) / 1000000) : 1)
+
+// Growth rate of the lead (full steps per correction, Q20.12)
+static IIRFilter<int32_t, STALL_RATE_FILTER_SHIFT> leadRate;
+static int32_t lastLead = 0;
+
+// Sensitivity, and the lead limit that it sets (full steps, Q20.12)
+static uint8_t stallSensitivity = DEFAULT_STALL_SENSITIVITY;
+static int32_t leadLimit = (((150 - DEFAULT_STALL_SENSITIVITY) << STALL_LEAD_Q_POWER) / 100);
+
+// State of the detector
+static uint16_t pendingTicks = 0;
+static bool stalled = false;
+static uint32_t stallCount = 0;
+
+
+// Runs the detector on the step error of this correction
+bool RAMFUNC updateStallDetector(int32_t stepError) {
+
+    // Find the lead in full steps (the same for every microstepping), then how quickly it is growing
+    // The error is capped so the shift can't overflow (it is far past the limit by then anyway), keeping the division 32 bit
+    uint32_t cappedError = (uint32_t)min(abs(stepError), (int32_t)(1 << (31 - STALL_LEAD_Q_POWER)) - 1);
+    int32_t lead = (int32_t)((cappedError << STALL_LEAD_Q_POWER) / motor.getMicrostepping());
+    leadRate.add(lead - lastLead);
+    lastLead = lead;
+
+    // Project the lead ahead (only growth counts, a shrinking lead is the loop recovering)
+    int32_t growth = leadRate.get();
+    int32_t predictedLead = lead + (growth > 0 ? growth * STALL_PREDICTION_TICKS : 0);
+
+    // The projection has to stay past the limit for the confirm time, so a single bad reading can't trip the fault
+    if (predictedLead >= leadLimit) {
+        if (pendingTicks < STALL_CONFIRM_TICKS) {
+            pendingTicks++;
+        }
+        else if (!stalled) {
+            stalled = true;
+            stallCount++;
+        }
+    }
+    else {
+        pendingTicks = 0;
+
+        // Only clear the stall once the rotor has caught back up (hysteresis)
+        if (lead < (leadLimit / 2)) {
+            stalled = false;
+        }
+    }
+
+    // Return if the motor is stalling
+    return stalled;
+}
+
+
+// Clears the detector's history
+void resetStallDetector() {
+    leadRate.clear();
+    lastLead = 0;
+    pendingTicks = 0;
+    stalled = false;
+}
+
+
+// Sets the sensitivity of the detector (0 to 100, higher trips sooner)
+// 0 allows 1.5 full steps of lead, 50 allows 1 full step (the torque peak), and 100 allows half of a full step
+void setStallSensitivity(uint8_t sensitivity) {
+    stallSensitivity = min(sensitivity, (uint8_t)100);
+    leadLimit = (int32_t)((((int32_t)150 - stallSensitivity) << STALL_LEAD_Q_POWER) / 100);
+}
+
+
+// Gets the sensitivity of the detector
+uint8_t getStallSensitivity() {
+    return stallSensitivity;
+}
+
+
+// Gets the number of stalls that have been detected since boot
+uint32_t getStallCount() {
+    return stallCount;
+}
+
+#endif // ! ENABLE_STALL_DETECTION
@@ -0,0 +1,37 @@
+#ifndef __STALL_DETECT_H__
+#define __STALL_DETECT_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the stall detection is enabled
+#ifdef ENABLE_STALL_DETECTION
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Fixed point format of the lead of the coils over the rotor (full steps, Q20.12)
+// A full step of lead is 90 electrical degrees, where the motor's torque peaks. Any more and the rotor slips a pole
+#define STALL_LEAD_Q_POWER 12
+
+// Runs the detector on the step error of this correction (called every correction)
+// Returns true while a stall is predicted
+bool updateStallDetector(int32_t stepError);
+
+// Clears the detector's history (ex. when the motor is disabled)
+void resetStallDetector();
+
+// Sets the sensitivity of the detector (0 to 100, higher trips sooner)
+void setStallSensitivity(uint8_t sensitivity);
+
+// Gets the sensitivity of the detector
+uint8_t getStallSensitivity();
+
+// Gets the number of stalls that have been detected since boot
+uint32_t getStallCount();
+
+#endif // ! ENABLE_STALL_DETECTION
+#endif // ! __STALL_DETECT_H__
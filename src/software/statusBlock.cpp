@@ -0,0 +1,39 @@
+// Import the header file
+#include "statusBlock.h"
+#include "timers.h"
+
+
+// Gets the STATUS_FLAG_* of the motor
+uint8_t getStatusFlags() {
+    uint8_t flags = 0;
+    if (isStepCorrectionEnabled()) {
+        flags |= STATUS_FLAG_CORRECTING;
+    }
+    #ifdef ENABLE_DIRECT_STEPPING
+    if (getRemainingScheduledSteps() != 0) {
+        flags |= STATUS_FLAG_MOVING;
+    }
+    #ifdef ENABLE_STEP_QUEUE
+    if (isStepQueueRunning()) {
+        flags |= STATUS_FLAG_MOVING;
+    }
+    #endif
+    #endif // ! ENABLE_DIRECT_STEPPING
+    #ifdef ENABLE_OVERRUN_DETECTION
+    if (getOverloadLevel() != OVERLOAD_NONE) {
+        flags |= STATUS_FLAG_OVERLOADED;
+    }
+    #endif
+    return flags;
+}
+
+
+// Fills in the compact status of the motor
+void getStatusBlock(statusBlock &status) {
+    status.steps = motor.getSoftStepCNT();
+    status.counts = motor.encoder.getAbsoluteCountsAvg();
+    status.stepError = constrain(motor.getStepError(), INT16_MIN, INT16_MAX);
+    status.state = motor.getState();
+    status.flags = getStatusFlags();
+    status.temperature = motor.encoder.getTempTenths();
+}
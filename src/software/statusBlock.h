@@ -0,0 +1,35 @@
+#ifndef __STATUS_BLOCK_H__
+#define __STATUS_BLOCK_H__
+
+// Include main config
+#include "config.h"
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Compact status of the motor for hosts that poll it at a high rate (the binary protocols send it as raw bytes, little endian)
+// It is filled with integer math only, so reading it never formats or converts a float
+typedef struct __attribute__((packed)) {
+    int32_t steps;          // Commanded position (microsteps)
+    int32_t counts;         // Encoder position (counts)
+    int16_t stepError;      // Step error (microsteps, held at the limits of an int16)
+    uint8_t state;          // MOTOR_STATE
+    uint8_t flags;          // STATUS_FLAG_*
+    int16_t temperature;    // Temperature of the encoder (tenths of a degree C, from the newest sample)
+} statusBlock;
+
+// Flags of the status (shared by all of the binary protocols)
+#define STATUS_FLAG_CORRECTING  0x01 // The closed loop correction is running
+#define STATUS_FLAG_MOVING      0x02 // A direct stepping move is running
+#define STATUS_FLAG_OVERLOADED  0x04 // The control loop is overloaded, and is shedding work (ENABLE_OVERRUN_DETECTION)
+
+// Gets the STATUS_FLAG_* of the motor
+uint8_t getStatusFlags();
+
+// Fills in the compact status of the motor
+void getStatusBlock(statusBlock &status);
+
+#endif // ! __STATUS_BLOCK_H__
@@ -0,0 +1,57 @@
+#ifndef __STEP_MATH_H__
+#define __STEP_MATH_H__
+
+// Include Arduino library
+#include "Arduino.h"
+
+// For the electrical phase
+#include "fastSine.h"
+
+// The math of the step counters and the step phases, without any of the hardware (so the host simulation checks it too)
+// Everything here is inlined (the step path runs from the SRAM and can't call into the flash), and folds when the settings are fixed
+
+// Fixed point format of the microstep multiplier and the step phase accumulator (Q16)
+#define MULTIPLIER_Q_POWER 16
+
+// Bits of the hardware step counter (TIM2), the rest of the count is kept as an offset
+#define HARD_STEP_COUNTER_POWER 16
+
+// Rescales a step count to a new microstepping, cut toward zero
+static constexpr int32_t rescaleStepCount(int32_t count, uint16_t newDivisor, uint16_t oldDivisor) {
+    return (int32_t)(((int64_t)count * newDivisor) / oldDivisor);
+}
+
+// Splits a step count into the value of the 16 bit hardware counter and the offset of its overflows
+// The mask floors, so negative counts are split correctly too (the offset is always a multiple of the counter's period)
+static inline uint16_t splitHardStepCount(int32_t count, int32_t &offset) {
+    uint16_t counter = (uint16_t)(count & ((1 << HARD_STEP_COUNTER_POWER) - 1));
+    offset = (count - counter);
+    return counter;
+}
+
+// Phase moved by a single microstep (Q16, so that the multiplier's fraction survives)
+static constexpr uint32_t microstepPhaseFor(uint16_t divisor) {
+    return ((uint32_t)PHASE_PER_FULL_STEP << MULTIPLIER_Q_POWER) / divisor;
+}
+
+// Phase moved by a step of the step pin, a multiplier's worth (Q16) of microsteps
+static constexpr uint32_t multipliedStepPhaseFor(uint32_t multiplier, uint16_t divisor) {
+    return (uint32_t)(((uint64_t)multiplier * PHASE_PER_FULL_STEP) / divisor);
+}
+
+// Mask that drops the phase within a microstep (the divisor is a power of two)
+static constexpr uint16_t microstepPhaseMaskFor(uint16_t divisor) {
+    return (uint16_t)~((PHASE_PER_FULL_STEP / divisor) - 1);
+}
+
+// Electrical phase of a microstep count, wrapped into a cycle (4 full steps)
+static constexpr uint16_t stepCountPhase(int32_t steps, uint16_t divisor) {
+    int32_t cycleMicrosteps = 4 * divisor;
+    int32_t cycleSteps = steps % cycleMicrosteps;
+    if (cycleSteps < 0) {
+        cycleSteps += cycleMicrosteps;
+    }
+    return (uint16_t)((cycleSteps * PHASE_PER_FULL_STEP) / divisor);
+}
+
+#endif // ! __STEP_MATH_H__
@@ -0,0 +1,197 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_STEP_RATE_TEST
+
+// Import the header file
+#include "stepRateTest.h"
+#include "timers.h"
+#include "clock.h"
+#include "calibration.h"
+#include "watchdog.h"
+
+// Sampling of TIM2's input filter (ETF), the divider of the timer clock and the samples that have to agree for each setting
+static const uint8_t filterDividers[16] = { 1, 1, 1, 1, 2, 2, 4, 4, 8, 8, 16, 16, 16, 32, 32, 32 };
+static const uint8_t filterSamples[16]  = { 1, 2, 4, 8, 6, 8, 6, 8, 6, 8, 5,  6,  8,  5,  6,  8  };
+
+// Result of a burst back and forth
+typedef enum {
+    BURST_OK,            // Every count agreed
+    BURST_TIMEOUT,       // The steps didn't finish in time
+    BURST_MISSED_STEPS,  // TIM2 counted more pulses than the interrupt stepped
+    BURST_PHASE_DRIFT    // The steps or the coils didn't land back where they started
+} BURST_RESULT;
+
+// Counts of TIM2 that aren't steps (the forced update that loads each burst's period), found by the first burst
+static int32_t extraCounts = 0;
+
+// The counts of the last burst, for the report
+static int32_t lastHardCounts = 0;
+static int32_t lastSteps = 0;
+
+
+// Highest rate that TIM2's input filter passes (steps/s), a pulse has to be high and low for all of the filter's samples
+static uint32_t getFilterLimit() {
+    uint8_t filter = motor.getStepFilter();
+    return (getAPB1TimerFreq() / (2 * (uint32_t)filterDividers[filter] * filterSamples[filter]));
+}
+
+
+// Waits for the scheduled steps to finish, keeping the watchdog fed (returns false if they didn't finish in time)
+static bool waitForSteps(uint32_t timeout) {
+    uint32_t startTime = millis();
+    while (getRemainingScheduledSteps() > 0) {
+        if ((millis() - startTime) > timeout) {
+            disableStepScheduleTimer();
+            return false;
+        }
+
+        // The main loop is held up until the test finishes, so it has to keep the watchdog fed
+        #ifdef ENABLE_WATCHDOG
+            watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+            serviceWatchdog();
+        #endif
+    }
+    return true;
+}
+
+
+// Steps one way at a rate, checking that TIM2 counted each of the steps (and nothing more)
+static BURST_RESULT runHalfBurst(uint32_t steps, uint32_t rate, STEP_DIR dir, uint32_t timeout) {
+
+    // TIM2 counts down for the steps back
+    if (dir == CLOCKWISE) {
+        TIM2 -> CR1 |= TIM_CR1_DIR;
+    }
+    else {
+        TIM2 -> CR1 &= ~TIM_CR1_DIR;
+    }
+
+    // Step the burst out
+    int32_t startHardCNT = motor.getHardStepCNT();
+    scheduleSteps(steps, rate, dir);
+    bool finished = waitForSteps(timeout);
+
+    // Every update of TIM4 should have been a step
+    lastHardCounts = abs(motor.getHardStepCNT() - startHardCNT) - extraCounts;
+    lastSteps = steps - getRemainingScheduledSteps();
+    if (!finished) {
+        return BURST_TIMEOUT;
+    }
+    return ((lastHardCounts == lastSteps) ? BURST_OK : BURST_MISSED_STEPS);
+}
+
+
+// Steps forward then back at a rate, checking the counts of each half and that the motor landed where it started
+static BURST_RESULT runBurst(uint32_t steps, uint32_t rate) {
+
+    // Where the motor starts
+    int32_t startSoftCNT = motor.getSoftStepCNT();
+    uint32_t startPhase = motor.getCoilPhase();
+
+    // Each half has to be counted correctly
+    uint32_t timeout = ((2 * steps * 1000) / rate) + STEP_RATE_TEST_TIMEOUT;
+    BURST_RESULT result = runHalfBurst(steps, rate, COUNTER_CLOCKWISE, timeout);
+    if (result == BURST_OK) {
+        result = runHalfBurst(steps, rate, CLOCKWISE, timeout);
+    }
+
+    // The same steps back should undo the steps forward exactly (the multiplier's fraction included)
+    if ((result == BURST_OK) && ((motor.getSoftStepCNT() != startSoftCNT) || (motor.getCoilPhase() != startPhase))) {
+        result = BURST_PHASE_DRIFT;
+    }
+    return result;
+}
+
+
+// Runs bursts of steps at rising rates until one of them fails, then puts the motor back where it was
+String runStepRateTest(uint32_t maxRate) {
+
+    // The step schedule timer is shared with the moves and the calibration
+    if (isCalibrating()) {
+        return F("Step rate test can't run during the calibration");
+    }
+    #ifdef ENABLE_STEP_QUEUE
+    if (isStepQueueRunning()) {
+        return F("Step rate test can't run during a move");
+    }
+    #endif
+    if (getRemainingScheduledSteps() > 0) {
+        return F("Step rate test can't run during a move");
+    }
+
+    // Take over the motor (the step pin, the correction, and the step schedule timer), keeping the closed loop mode to restore after
+    bool restoreCorrection = isStepCorrectionEnabled();
+    disableMotorTimers();
+    disableStepCorrection();
+    int32_t startHardCNT = motor.getHardStepCNT();
+
+    // Count TIM4's update events (TRGO) on TIM2 instead of the step pin (external clock mode 1 from ITR3)
+    uint32_t savedSMCR = TIM2 -> SMCR;
+    uint32_t savedCR1 = TIM2 -> CR1;
+    uint32_t savedTIM4CR2 = TIM4 -> CR2;
+    TIM4 -> CR2 = (TIM4 -> CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_1;
+    TIM2 -> SMCR = (TIM2 -> SMCR & ~(TIM_SMCR_SMS | TIM_SMCR_TS)) | (TIM_SMCR_SMS | TIM_SMCR_TS_1 | TIM_SMCR_TS_0);
+
+    // Find the counts that aren't steps with a burst that any board keeps up with
+    uint32_t period = (STEP_SCHEDULE_TICK_FREQ / STEP_RATE_TEST_START_RATE);
+    extraCounts = 0;
+    runBurst(STEP_RATE_TEST_MIN_BURST, STEP_SCHEDULE_TICK_FREQ / period);
+    extraCounts = max(lastHardCounts - lastSteps, (int32_t)0);
+
+    // Shorten the period by an eighth each time, until a burst fails or the fastest rate is reached
+    uint32_t minPeriod = max(STEP_SCHEDULE_TICK_FREQ / (maxRate > 0 ? maxRate : STEP_RATE_TEST_MAX_RATE), (uint32_t)1);
+    uint32_t passedRate = 0;
+    uint32_t failedRate = 0;
+    BURST_RESULT result = BURST_OK;
+    while (true) {
+        uint32_t rate = (STEP_SCHEDULE_TICK_FREQ / period);
+        uint32_t steps = max((rate * STEP_RATE_TEST_BURST_TIME) / 1000, (uint32_t)STEP_RATE_TEST_MIN_BURST);
+        result = runBurst(steps, rate);
+        if (result != BURST_OK) {
+            failedRate = rate;
+            break;
+        }
+        passedRate = rate;
+
+        // Move on to the next rate
+        if (period <= minPeriod) {
+            break;
+        }
+        period = max(period - max(period / 8, (uint32_t)1), minPeriod);
+    }
+
+    // Count the step pin again, starting from where TIM2 was before the test
+    TIM2 -> SMCR = savedSMCR;
+    TIM2 -> CR1 = savedCR1;
+    TIM4 -> CR2 = savedTIM4CR2;
+    motor.setHardStepCNT(startHardCNT);
+
+    // Give the motor back, the correction puts the rotor back after any slip
+    if (restoreCorrection) {
+        enableStepCorrection();
+    }
+    enableMotorTimers();
+
+    // Report the highest rate, in steps and full steps
+    String report = "Max rate: " + String(passedRate) + F(" steps/s (") + String((uint32_t)(passedRate * motor.getMicrostepMultiplier()) / motor.getMicrostepping()) +
+                    F(" full steps/s at 1/") + String(motor.getMicrostepping()) + F(") | ");
+    switch (result) {
+        case BURST_TIMEOUT:
+            report += "Failed at " + String(failedRate) + F(" steps/s, the steps didn't finish in time");
+            break;
+        case BURST_MISSED_STEPS:
+            report += "Failed at " + String(failedRate) + F(" steps/s, ") + String(lastHardCounts) + F(" pulses but ") + String(lastSteps) + F(" steps");
+            break;
+        case BURST_PHASE_DRIFT:
+            report += "Failed at " + String(failedRate) + F(" steps/s, the coils didn't land back where they started");
+            break;
+        default:
+            report += F("Reached the highest rate of the test");
+            break;
+    }
+    return (report + F(" | Input filter limit: ") + String(getFilterLimit()) + F(" steps/s"));
+}
+
+#endif // ! ENABLE_STEP_RATE_TEST
@@ -0,0 +1,27 @@
+#ifndef __STEP_RATE_TEST_H__
+#define __STEP_RATE_TEST_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the step rate test is enabled
+#ifdef ENABLE_STEP_RATE_TEST
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Self-test of the highest step rate that the board keeps up with
+// The step schedule timer (TIM4) generates the pulses, stepping the motor from its interrupt like the step pin does,
+// while TIM2 counts TIM4's update events in hardware (ITR3) in place of the step pin.
+// A rate passes if the counts of TIM2, the steps taken by the interrupt, and the phase of the coils all agree after a burst back and forth
+
+// Runs bursts of steps at rising rates until one of them fails, then puts the motor back where it was
+// Blocks until the test is done. Max rate is the highest rate to try (steps/s), 0 uses STEP_RATE_TEST_MAX_RATE
+// Returns the highest rate that passed (and the limit of TIM2's input filter), or the reason that the test couldn't run
+String runStepRateTest(uint32_t maxRate);
+
+#endif // ! ENABLE_STEP_RATE_TEST
+#endif // ! __STEP_RATE_TEST_H__
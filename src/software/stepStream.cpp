@@ -0,0 +1,315 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_STEP_STREAM
+
+// Import the header file
+#include "stepStream.h"
+#include "trace.h"
+#include "serial.h"
+#include "watchdog.h"
+
+// Entries that fit in the trace's buffer (a byte each)
+#define STREAM_LENGTH     (uint32_t)(TRACE_BUFFER_SIZE * sizeof(traceSample))
+
+// Most steps that an entry holds, the rest are carried into the next one
+#define STREAM_ENTRY_MAX  127
+
+// The entries, borrowed from the trace. The head is where the next entry will be written
+static int8_t *streamBuffer = NULL;
+static uint32_t streamHead = 0;
+static uint32_t streamCount = 0;
+
+// State and settings of the capture (the state is shared with the correction interrupt)
+static volatile STREAM_STATE streamState = STREAM_IDLE;
+static uint32_t streamErrorThreshold = 0;
+static uint32_t streamRemainingEntries = 0;
+static uint16_t streamDivider = 1;
+static uint16_t streamDividerCount = 0;
+
+// TIM2's count at the last correction, and the steps that haven't been written to an entry yet
+static int32_t lastStreamSteps = 0;
+static int32_t streamCarry = 0;
+
+// Entries that were full, with the extra steps carried into the next one
+static uint32_t clippedEntries = 0;
+
+// Position of the replay, the entry being spread over its corrections and the correction that it's on
+static uint32_t replayIndex = 0;
+static int32_t replayEntry = 0;
+static uint16_t replayTick = 0;
+
+// Following error of the replay (microsteps)
+static uint32_t replayMaxError = 0;
+static uint64_t replaySquaredError = 0;
+static uint32_t replaySamples = 0;
+
+// Entry of the last time that was loaded
+static uint32_t loadIndex = 0;
+
+
+// Gets an entry of the stream, with 0 being the oldest
+static int8_t RAMFUNC getStreamEntry(uint32_t entryNum) {
+    return streamBuffer[(streamHead + STREAM_LENGTH - streamCount + entryNum) % STREAM_LENGTH];
+}
+
+
+// Takes the buffer from the trace and empties it, with an entry every divider corrections
+static void resetStream(uint16_t divider) {
+    streamState = STREAM_IDLE;
+    syncInstructions();
+    streamBuffer = borrowTraceBuffer();
+    streamHead = 0;
+    streamCount = 0;
+    streamDivider = (divider > 0 ? divider : 1);
+    streamDividerCount = 0;
+    streamCarry = 0;
+    clippedEntries = 0;
+    replaySamples = 0;
+}
+
+
+// Starts capturing, with an entry every divider corrections
+void startStepCapture(uint32_t errorThreshold, uint16_t divider) {
+    resetStream(divider);
+    streamErrorThreshold = errorThreshold;
+    lastStreamSteps = motor.getHardStepCNT();
+
+    // Start recording
+    syncInstructions();
+    streamState = STREAM_CAPTURING;
+}
+
+
+// Replays the held stream from its start
+bool startStepReplay() {
+
+    // A capture that is still running is stopped where it is
+    stopStepStream();
+    if (streamState != STREAM_HELD || streamCount == 0) {
+        return false;
+    }
+
+    // Start from the first entry, with fresh statistics
+    replayIndex = 0;
+    replayTick = 0;
+    replayMaxError = 0;
+    replaySquaredError = 0;
+    replaySamples = 0;
+    syncInstructions();
+    streamState = STREAM_REPLAYING;
+    return true;
+}
+
+
+// Stops the capture or the replay, keeping the stream
+void stopStepStream() {
+    if (streamState != STREAM_IDLE) {
+        streamState = STREAM_HELD;
+        syncInstructions();
+    }
+}
+
+
+// Drops the stream, giving the buffer back to the trace
+void dropStepStream() {
+    streamState = STREAM_IDLE;
+    syncInstructions();
+    streamCount = 0;
+}
+
+
+// Gets the state of the stream
+STREAM_STATE getStepStreamState() {
+    return streamState;
+}
+
+
+// Feeds the next entry of the replay into the step input (called at the start of every correction)
+void RAMFUNC replayStepStream() {
+    if (streamState != STREAM_REPLAYING) {
+        return;
+    }
+
+    // Move on to the next entry, holding the stream again once it runs out
+    if (replayTick == 0) {
+        if (replayIndex >= streamCount) {
+            streamState = STREAM_HELD;
+            return;
+        }
+        replayEntry = getStreamEntry(replayIndex);
+    }
+
+    // Spread the entry's steps evenly over the corrections that it covers
+    int32_t pulses = (((replayEntry * (replayTick + 1)) / streamDivider) - ((replayEntry * replayTick) / streamDivider));
+    if (++replayTick >= streamDivider) {
+        replayTick = 0;
+        replayIndex++;
+    }
+    if (pulses != 0) {
+        motor.replayStepPulses(pulses);
+    }
+}
+
+
+// Records the steps of the correction, and the error of the replay (called at the end of every correction)
+void RAMFUNC recordStepStream(int32_t error, bool enabled) {
+
+    // Collect the following error while replaying
+    STREAM_STATE state = streamState;
+    if (state == STREAM_REPLAYING) {
+        if (enabled) {
+            uint32_t absError = abs(error);
+            replayMaxError = max(replayMaxError, absError);
+            replaySquaredError += ((uint64_t)absError * absError);
+            replaySamples++;
+        }
+        return;
+    }
+
+    // Only record while capturing
+    if (state != STREAM_CAPTURING && state != STREAM_TRIGGERED) {
+        return;
+    }
+
+    // Add up the steps since the last correction
+    int32_t steps = motor.getHardStepCNT();
+    streamCarry += (steps - lastStreamSteps);
+    lastStreamSteps = steps;
+
+    // Check the trigger every correction, keeping a quarter of the buffer after it
+    if (state == STREAM_CAPTURING && streamErrorThreshold > 0 && enabled && (uint32_t)abs(error) >= streamErrorThreshold) {
+        streamRemainingEntries = (STREAM_LENGTH / 4);
+        state = STREAM_TRIGGERED;
+        streamState = STREAM_TRIGGERED;
+    }
+
+    // Write an entry once the corrections that it covers are done
+    if (++streamDividerCount < streamDivider) {
+        return;
+    }
+    streamDividerCount = 0;
+    int32_t entry = constrain(streamCarry, -STREAM_ENTRY_MAX, STREAM_ENTRY_MAX);
+    if (entry != streamCarry) {
+        clippedEntries++;
+    }
+    streamCarry -= entry;
+    streamBuffer[streamHead] = (int8_t)entry;
+
+    // Move along the ring, overwriting the oldest entry once it is full
+    streamHead = ((streamHead + 1 < STREAM_LENGTH) ? (streamHead + 1) : 0);
+    if (streamCount < STREAM_LENGTH) {
+        streamCount++;
+    }
+
+    // Hold the stream once the buffer fills (without a trigger), or once the entries after the trigger are in
+    if (state == STREAM_CAPTURING) {
+        if (streamErrorThreshold == 0 && streamCount == STREAM_LENGTH) {
+            streamState = STREAM_HELD;
+        }
+    }
+    else if (--streamRemainingEntries == 0) {
+        streamState = STREAM_HELD;
+    }
+}
+
+
+// Gets a summary of the stream, with the following error of the last replay
+String getStepStreamStatus() {
+
+    // Name the state
+    String status;
+    switch (streamState) {
+        case STREAM_IDLE:
+            status = F("Idle");
+            break;
+        case STREAM_CAPTURING:
+            status = F("Capturing");
+            break;
+        case STREAM_TRIGGERED:
+            status = F("Triggered");
+            break;
+        case STREAM_HELD:
+            status = F("Held");
+            break;
+        default:
+            status = F("Replaying ") + String(replayIndex) + "/" + String(streamCount);
+            break;
+    }
+
+    // Add the settings and the fill of the buffer
+    status += F(" | Entries: ") + String(streamCount) + "/" + String(STREAM_LENGTH) + F(" (") +
+              String((uint32_t)(((uint64_t)streamCount * streamDivider * 1000) / CONTROL_LOOP_FREQ)) + F(" ms) | D: ") + String(streamDivider) +
+              F(" | E: ") + String(streamErrorThreshold) + F(" | Clipped: ") + String(clippedEntries);
+
+    // The following error of the replay (found here instead of in the correction, not time critical)
+    if (replaySamples > 0) {
+        status += F(" | Replay error: max ") + String(replayMaxError) + F(" steps, RMS ") + String(sqrt((float)replaySquaredError / replaySamples), 2) + F(" steps");
+    }
+    return status;
+}
+
+
+// Sends the held stream over serial as "<time in us> <steps>" lines
+void dumpStepStream() {
+
+    // The buffer can't be changed while it is being sent
+    stopStepStream();
+
+    // The header is a comment for the simulation, giving the number of entries and the time that each covers
+    sendSerialMessage(F("# Step stream: ") + String(streamCount) + F(" entries, ") + String(streamDivider) + F(" corrections each, ") + String(CONTROL_LOOP_FREQ) + F(" Hz\n"));
+    for (uint32_t entryNum = 0; entryNum < streamCount; entryNum++) {
+        int8_t entry = getStreamEntry(entryNum);
+        if (entry != 0) {
+            sendSerialMessage(String((uint32_t)(((uint64_t)entryNum * streamDivider * 1000000) / CONTROL_LOOP_FREQ)) + " " + String(entry) + "\n");
+        }
+
+        // The main loop is held up until the stream is sent, so it has to keep the watchdog fed
+        #ifdef ENABLE_WATCHDOG
+            watchdogCheckIn(WATCHDOG_MAIN_LOOP);
+            serviceWatchdog();
+        #endif
+    }
+}
+
+
+// Clears the stream for loading, with an entry every divider corrections
+void clearStepStream(uint16_t divider) {
+    resetStream(divider);
+    streamErrorThreshold = 0;
+    loadIndex = 0;
+    syncInstructions();
+    streamState = STREAM_HELD;
+}
+
+
+// Adds steps to the loaded stream at a time (us)
+bool loadStepStream(uint32_t time, int32_t steps) {
+
+    // Only a held stream can be added to, and only in order
+    uint32_t entryNum = (uint32_t)(((uint64_t)time * CONTROL_LOOP_FREQ) / (1000000ULL * streamDivider));
+    if (streamState != STREAM_HELD || entryNum < loadIndex) {
+        return false;
+    }
+    loadIndex = entryNum;
+
+    // Add the steps, carrying what doesn't fit in an entry into the ones after it (empty entries are added up to it)
+    // The loaded stream starts at the start of the buffer, so the entries are indexed directly
+    while (steps != 0) {
+        while (streamCount <= entryNum) {
+            if (streamCount >= STREAM_LENGTH) {
+                return false;
+            }
+            streamBuffer[streamCount++] = 0;
+        }
+        int32_t total = streamBuffer[entryNum] + steps;
+        int32_t entry = constrain(total, -STREAM_ENTRY_MAX, STREAM_ENTRY_MAX);
+        streamBuffer[entryNum++] = (int8_t)entry;
+        steps = (total - entry);
+    }
+    streamHead = ((streamCount < STREAM_LENGTH) ? streamCount : 0);
+    return true;
+}
+
+#endif // ! ENABLE_STEP_STREAM
@@ -0,0 +1,65 @@
+#ifndef __STEP_STREAM_H__
+#define __STEP_STREAM_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the step stream is enabled
+#ifdef ENABLE_STEP_STREAM
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Capture and replay of the step input
+// Each entry is the change of TIM2's count over DEFAULT_STEP_STREAM_DIVIDER corrections, as a signed byte kept in the trace's buffer
+// Steps past what a byte holds are carried into the next entry, so the position of the stream is always exact (only the timing is smeared)
+// The replay injects each entry back into TIM2's count and the coils, spread over the corrections that it covers
+
+// States of the stream
+typedef enum {
+    STREAM_IDLE,       // Nothing held, the buffer belongs to the trace
+    STREAM_CAPTURING,  // Recording the step input
+    STREAM_TRIGGERED,  // Triggered, recording the entries after the trigger
+    STREAM_HELD,       // A stream is held, ready to be dumped or replayed
+    STREAM_REPLAYING   // Feeding the held stream back into the step input
+} STREAM_STATE;
+
+// Starts capturing, with an entry every divider corrections
+// A threshold of 0 records until the buffer is full, otherwise the buffer is a ring that stops a quarter of it after the step error reaches the threshold
+void startStepCapture(uint32_t errorThreshold, uint16_t divider);
+
+// Replays the held stream from its start (returns false if there isn't one)
+bool startStepReplay();
+
+// Stops the capture or the replay, keeping the stream
+void stopStepStream();
+
+// Drops the stream, giving the buffer back to the trace
+void dropStepStream();
+
+// Gets the state of the stream
+STREAM_STATE getStepStreamState();
+
+// Feeds the next entry of the replay into the step input (called at the start of every correction)
+void replayStepStream();
+
+// Records the steps of the correction, and the error of the replay (called at the end of every correction)
+void recordStepStream(int32_t error, bool enabled);
+
+// Gets a summary of the stream, with the following error of the last replay
+String getStepStreamStatus();
+
+// Sends the held stream over serial as "<time in us> <steps>" lines (entries without steps are left out)
+void dumpStepStream();
+
+// Clears the stream for loading, with an entry every divider corrections
+void clearStepStream(uint16_t divider);
+
+// Adds steps to the loaded stream at a time (us), which can't be before the last time added (returns false if it doesn't fit)
+bool loadStepStream(uint32_t time, int32_t steps);
+
+#endif // ! ENABLE_STEP_STREAM
+#endif // ! __STEP_STREAM_H__
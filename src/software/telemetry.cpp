@@ -0,0 +1,133 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_TELEMETRY
+
+// Import the header file
+#include "telemetry.h"
+#include "serial.h"
+#include "parser.h"
+
+#ifdef ENABLE_CAN
+#include "canMessaging.h"
+#endif
+
+// Settings of the stream (a period of 0 means that it is stopped)
+static uint32_t telemetryPeriod = 0;
+static uint32_t nextRecordTime = 0;
+static bool telemetryBinary = false;
+
+// Statistics of the stream
+static uint16_t telemetrySequence = 0;
+static uint32_t sentRecords = 0;
+static uint32_t droppedRecords = 0;
+
+
+// Starts streaming records at rate (Hz, 0 stops the stream), as CSV lines or binary records
+bool startTelemetry(uint16_t rate, bool binary) {
+
+    // Make sure that the task can keep up
+    if (rate > TELEMETRY_MAX_RATE) {
+        return false;
+    }
+    if (rate == 0) {
+        stopTelemetry();
+        return true;
+    }
+
+    // Start from a clean set of statistics, with the first record right away
+    telemetryBinary = binary;
+    telemetrySequence = 0;
+    sentRecords = 0;
+    droppedRecords = 0;
+    nextRecordTime = micros();
+    telemetryPeriod = (1000000 / rate);
+    return true;
+}
+
+
+// Stops the stream
+void stopTelemetry() {
+    telemetryPeriod = 0;
+}
+
+
+// Gets a summary of the stream (rate, format, and records sent and dropped)
+String getTelemetryStatus() {
+    if (telemetryPeriod == 0) {
+        return F("Stopped");
+    }
+    return ("Rate: " + String(1000000 / telemetryPeriod) + "Hz | " + (telemetryBinary ? F("Binary") : F("CSV")) +
+            " | Sent: " + String(sentRecords) + " | Dropped: " + String(droppedRecords));
+}
+
+
+// Sends a record once it is due
+void telemetryTask() {
+
+    // Nothing to do if the stream is stopped or the next record isn't due yet
+    uint32_t now = micros();
+    if (telemetryPeriod == 0 || (int32_t)(now - nextRecordTime) < 0) {
+        return;
+    }
+
+    // Move to the next record, skipping the ones that were missed instead of sending them back to back
+    nextRecordTime += telemetryPeriod;
+    if ((int32_t)(now - nextRecordTime) >= 0) {
+        nextRecordTime = now + telemetryPeriod;
+    }
+
+    // Take the record
+    telemetryRecord record;
+    record.sync = TELEMETRY_SYNC;
+    record.sequence = telemetrySequence++;
+    record.time = now;
+    record.steps = motor.getSoftStepCNT();
+    record.counts = motor.encoder.getAbsoluteCountsAvg();
+    record.stepError = motor.getStepError();
+    record.rpm = motor.getEncoderRPM();
+    record.temperature = (int16_t)round(motor.encoder.getTemp() * 10);
+    uint32_t linkErrors = getSerialErrorCount() + getRejectedCommandCount();
+    #ifdef ENABLE_CAN
+        record.canTxErrors = getCANTxErrorCounter();
+        record.canRxErrors = getCANRxErrorCounter();
+        linkErrors += getCANErrorCount();
+    #else
+        record.canTxErrors = 0;
+        record.canRxErrors = 0;
+    #endif
+    record.linkErrors = (uint16_t)linkErrors;
+
+    // Format the record
+    const uint8_t* data;
+    uint16_t length;
+    char line[96];
+    if (telemetryBinary) {
+        data = (const uint8_t*)&record;
+        length = sizeof(record);
+    }
+    else {
+        // "T,sequence,time,steps,counts,error,rpm,temperature,tec,rec,linkErrors", the rpm and temperature with fixed decimals
+        int32_t rpmHundredths = (int32_t)round(record.rpm * 100);
+        uint32_t rpmFraction = (uint32_t)abs(rpmHundredths % 100);
+        uint16_t temperatureFraction = (uint16_t)abs(record.temperature % 10);
+        int written = snprintf(line, sizeof(line), "T,%u,%lu,%ld,%ld,%ld,%s%ld.%02lu,%s%d.%u,%u,%u,%u\n",
+                               record.sequence, (unsigned long)record.time, (long)record.steps, (long)record.counts,
+                               (long)record.stepError, (rpmHundredths < 0 ? "-" : ""), (long)abs(rpmHundredths / 100), (unsigned long)rpmFraction,
+                               (record.temperature < 0 ? "-" : ""), abs(record.temperature / 10), temperatureFraction,
+                               record.canTxErrors, record.canRxErrors, record.linkErrors);
+        data = (const uint8_t*)line;
+        length = (uint16_t)min(written, (int)(sizeof(line) - 1));
+    }
+
+    // Drop the record if it would have to wait for the bus (keeps the main loop from blocking when the rate is too high for the baud)
+    if (getSerialTxSpace() < length) {
+        droppedRecords++;
+        return;
+    }
+    sendSerialData(data, length);
+    sentRecords++;
+}
+
+#endif // ! ENABLE_TELEMETRY
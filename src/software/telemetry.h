@@ -0,0 +1,48 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the telemetry is enabled
+#ifdef ENABLE_TELEMETRY
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Marks the start of each binary record, so that the host can find the records in the stream
+#define TELEMETRY_SYNC 0x5AA5
+
+// One record of the stream (fixed size, sent little endian as raw bytes in binary mode)
+typedef struct __attribute__((packed)) {
+    uint16_t sync;          // TELEMETRY_SYNC
+    uint16_t sequence;      // Counts up with each record that is taken (a gap means that records were dropped)
+    uint32_t time;          // Time that the record was taken (us)
+    int32_t steps;          // Commanded position (microsteps)
+    int32_t counts;         // Encoder position (counts)
+    int32_t stepError;      // Step error (microsteps)
+    float rpm;              // Speed measured by the encoder
+    int16_t temperature;    // Temperature of the encoder (tenths of a degree C)
+    uint8_t canTxErrors;    // Transmit error counter of the CAN controller (TEC, 0 without CAN)
+    uint8_t canRxErrors;    // Receive error counter of the CAN controller (REC, 0 without CAN)
+    uint16_t linkErrors;    // Errors counted on the links and commands rejected, wrapping (see M124 for the breakdown)
+} telemetryRecord;
+
+// Starts streaming records at rate (Hz, 0 stops the stream), as CSV lines or binary records
+// Returns false if the rate is higher than TELEMETRY_MAX_RATE
+bool startTelemetry(uint16_t rate, bool binary);
+
+// Stops the stream
+void stopTelemetry();
+
+// Gets a summary of the stream (rate, format, and records sent and dropped)
+String getTelemetryStatus();
+
+// Sends a record once it is due, called by the main loop's telemetry task
+void telemetryTask();
+
+#endif // ! ENABLE_TELEMETRY
+#endif // ! __TELEMETRY_H__
@@ -0,0 +1,204 @@
+// Import the config
+#include "config.h"
+
+// Only build if specified
+#ifdef ENABLE_TRACE
+
+// Import the header file
+#include "trace.h"
+#include "serial.h"
+#include "stepStream.h"
+
+// Optimize for speed, the samples are recorded in the correction interrupt
+#pragma GCC optimize ("-Ofast")
+
+// The ring of samples, the head is where the next sample will be written
+static traceSample traceBuffer[TRACE_BUFFER_SIZE];
+static uint16_t traceHead = 0;
+static uint16_t traceCount = 0;
+
+// State and trigger settings (the state is shared with the correction interrupt)
+static volatile TRACE_STATE traceState = TRACE_IDLE;
+static uint32_t traceErrorThreshold = 0;
+static uint16_t tracePostSamples = 0;
+static uint16_t traceRemainingSamples = 0;
+static uint16_t traceDivider = 1;
+static uint16_t traceDividerCount = 0;
+
+
+// Starts recording, triggering once the step error reaches the threshold
+void armTrace(uint32_t errorThreshold, uint16_t postSamples, uint16_t divider) {
+
+    // Stop the interrupt from recording while the settings change
+    traceState = TRACE_IDLE;
+    syncInstructions();
+
+    // The buffer is taken back from the step stream
+    #ifdef ENABLE_STEP_STREAM
+        dropStepStream();
+    #endif
+
+    // Enable the DWT cycle counter for the timestamps
+    initCycleCounter();
+
+    // Clear the buffer and set up the trigger
+    // A sample of the buffer is always kept from before the trigger
+    traceHead = 0;
+    traceCount = 0;
+    traceErrorThreshold = errorThreshold;
+    tracePostSamples = constrain(postSamples, 0, TRACE_BUFFER_SIZE - 1);
+    traceDivider = (divider > 0 ? divider : 1);
+    traceDividerCount = 0;
+
+    // Start recording
+    syncInstructions();
+    traceState = TRACE_ARMED;
+}
+
+
+// Stops recording, keeping the samples that were taken
+void stopTrace() {
+    if (traceState != TRACE_IDLE) {
+        traceState = TRACE_DONE;
+        syncInstructions();
+    }
+}
+
+
+// Gets the state of the trace
+TRACE_STATE getTraceState() {
+    return traceState;
+}
+
+
+// Number of samples held in the buffer
+uint16_t getTraceSampleCount() {
+    return traceCount;
+}
+
+
+// Records a sample of the correction (called at the end of every correction)
+void RAMFUNC recordTrace(int32_t error, int32_t output, bool enabled, uint32_t startCycles) {
+
+    // Only record while armed or triggered
+    TRACE_STATE state = traceState;
+    if (state != TRACE_ARMED && state != TRACE_TRIGGERED) {
+        return;
+    }
+
+    // Skip the corrections between samples
+    if (++traceDividerCount < traceDivider) {
+        return;
+    }
+    traceDividerCount = 0;
+
+    // Fill in the sample
+    traceSample &sample = traceBuffer[traceHead];
+    sample.time = startCycles;
+    sample.steps = motor.getHardStepCNT();
+    sample.counts = motor.encoder.getAbsoluteCountsAvg();
+    sample.error = error;
+    sample.output = output;
+    sample.cycles = (uint16_t)min((getCycleCount() - startCycles), (uint32_t)UINT16_MAX);
+    sample.flags = (enabled ? TRACE_FLAG_ENABLED : 0);
+
+    // Move along the ring, overwriting the oldest sample once it is full
+    traceHead = ((traceHead + 1) & (TRACE_BUFFER_SIZE - 1));
+    if (traceCount < TRACE_BUFFER_SIZE) {
+        traceCount++;
+    }
+
+    // Check the trigger, holding the buffer right away if no samples are wanted after it
+    if (state == TRACE_ARMED) {
+        if (enabled && (uint32_t)abs(error) >= traceErrorThreshold) {
+            sample.flags |= TRACE_FLAG_TRIGGER;
+            traceRemainingSamples = tracePostSamples;
+            traceState = (tracePostSamples == 0 ? TRACE_DONE : TRACE_TRIGGERED);
+        }
+    }
+
+    // Count down the samples after the trigger, then hold the buffer
+    else if (--traceRemainingSamples == 0) {
+        traceState = TRACE_DONE;
+    }
+}
+
+
+// Gets a summary of the state of the trace
+String getTraceStatus() {
+
+    // Name the state
+    String status;
+    switch (traceState) {
+        case TRACE_IDLE:
+            status = F("Idle");
+            break;
+        case TRACE_ARMED:
+            status = F("Armed");
+            break;
+        case TRACE_TRIGGERED:
+            status = F("Triggered");
+            break;
+        default:
+            status = F("Done");
+            break;
+    }
+
+    // Add the settings and the fill of the buffer
+    return (status + F(" | Samples: ") + String(traceCount) + "/" + String(TRACE_BUFFER_SIZE) +
+            F(" | E: ") + String(traceErrorThreshold) + F(" | P: ") + String(tracePostSamples) + F(" | D: ") + String(traceDivider));
+}
+
+
+// Sends the recorded samples over serial, oldest first
+void dumpTrace(bool binary) {
+
+    // The buffer can't be changed while it is being sent
+    stopTrace();
+
+    // The header gives the number and size of the samples, and the clock for converting the timestamps
+    sendSerialMessage(F("Trace: ") + String(traceCount) + F(" samples, ") + String(sizeof(traceSample)) + F(" bytes each, ") + String(SystemCoreClock) + F(" Hz\n"));
+
+    // Oldest sample is right after the head once the ring has wrapped
+    uint16_t index = ((traceHead - traceCount) & (TRACE_BUFFER_SIZE - 1));
+    for (uint16_t sampleNum = 0; sampleNum < traceCount; sampleNum++) {
+        const traceSample &sample = traceBuffer[index];
+        if (binary) {
+            sendSerialData((const uint8_t*)&sample, sizeof(traceSample));
+        }
+        else {
+            sendSerialMessage(String(sample.time) + "," + String(sample.steps) + "," + String(sample.counts) + "," +
+                              String(sample.error) + "," + String(sample.output) + "," + String(sample.cycles) + "," + String(sample.flags) + "\n");
+        }
+        index = ((index + 1) & (TRACE_BUFFER_SIZE - 1));
+    }
+}
+
+
+
+// Copies out a recorded sample, with 0 being the oldest
+bool getTraceSample(uint16_t sampleNum, traceSample &sample) {
+
+    // The ring moves while the trace is recording
+    if (traceState == TRACE_ARMED || traceState == TRACE_TRIGGERED || sampleNum >= traceCount) {
+        return false;
+    }
+
+    // Oldest sample is right after the head once the ring has wrapped
+    sample = traceBuffer[(traceHead - traceCount + sampleNum) & (TRACE_BUFFER_SIZE - 1)];
+    return true;
+}
+
+
+// Hands the memory of the buffer to the step stream, dropping the samples that were in it
+#ifdef ENABLE_STEP_STREAM
+int8_t* borrowTraceBuffer() {
+    traceState = TRACE_IDLE;
+    syncInstructions();
+    traceHead = 0;
+    traceCount = 0;
+    return (int8_t*)traceBuffer;
+}
+#endif
+
+#endif // ! ENABLE_TRACE
@@ -0,0 +1,73 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// Include main config
+#include "config.h"
+
+// Only build this file if the trace is enabled
+#ifdef ENABLE_TRACE
+
+// Include Arduino library
+#include "Arduino.h"
+
+// Main (for stepper motor class)
+#include "main.h"
+
+// Cycle counter for the timestamps
+#include "profiler.h"
+
+// Flags stored with each sample
+#define TRACE_FLAG_TRIGGER  0x01 // The sample that met the trigger condition
+#define TRACE_FLAG_ENABLED  0x02 // The motor was enabled (the error and output are only valid if set)
+
+// One sample of the control loop, recorded every correction (fixed size, so it can be dumped as raw binary)
+typedef struct {
+    uint32_t time;    // CPU cycles (DWT) at the start of the correction
+    int32_t steps;    // Commanded position (microsteps)
+    int32_t counts;   // Encoder position (counts)
+    int32_t error;    // Step error (microsteps)
+    int32_t output;   // PID output (microsteps/s)
+    uint16_t cycles;  // CPU cycles that the correction took
+    uint16_t flags;   // TRACE_FLAG_*
+} traceSample;
+
+// States of the trace
+typedef enum {
+    TRACE_IDLE,       // Not recording
+    TRACE_ARMED,      // Recording into the ring, waiting for the trigger
+    TRACE_TRIGGERED,  // Triggered, recording the samples after the trigger
+    TRACE_DONE        // Finished, the buffer is held until it is dumped or re-armed
+} TRACE_STATE;
+
+// Starts recording, triggering once the step error reaches the threshold (0 triggers right away)
+// postSamples is the number of samples to keep after the trigger (the rest of the buffer holds the lead up), divider records every nth correction
+void armTrace(uint32_t errorThreshold, uint16_t postSamples, uint16_t divider);
+
+// Stops recording, keeping the samples that were taken
+void stopTrace();
+
+// Gets the state of the trace
+TRACE_STATE getTraceState();
+
+// Number of samples held in the buffer
+uint16_t getTraceSampleCount();
+
+// Records a sample of the correction that started at startCycles (called at the end of every correction)
+void recordTrace(int32_t error, int32_t output, bool enabled, uint32_t startCycles);
+
+// Gets a summary of the state of the trace
+String getTraceStatus();
+
+// Sends the recorded samples over serial, oldest first (as text or raw traceSample structs)
+void dumpTrace(bool binary);
+
+// Copies out a recorded sample, with 0 being the oldest (returns false if there isn't one, or if the trace is still recording)
+bool getTraceSample(uint16_t sampleNum, traceSample &sample);
+
+// Hands the memory of the buffer to the step stream, dropping the samples that were in it (arming the trace takes it back)
+#ifdef ENABLE_STEP_STREAM
+int8_t* borrowTraceBuffer();
+#endif
+
+#endif // ! ENABLE_TRACE
+#endif // ! __TRACE_H__
@@ -27,37 +27,174 @@
     // Button settings
     //#define INVERTED_DIPS // Enable if your dips are inverted ("on" print is facing away from motor connector)
     #define BUTTON_REPEAT_INTERVAL 250 // Millis
+
+    // Scans the buttons from the 1 ms SysTick instead of the UI task, debouncing them there and queueing each click (and each repeat while held)
+    // The clicks don't depend on how often the main loop gets to the UI task, and the task doesn't wait out the debounce
+    //#define ENABLE_BUTTON_SCANNER
+    #ifdef ENABLE_BUTTON_SCANNER
+        #define BUTTON_DEBOUNCE_TIME     10 // ms, the time that a button has to hold its new state for
+        #define BUTTON_EVENT_QUEUE_SIZE  8  // Clicks, must be a power of 2
+        #define BUTTON_EVENT_MAX_AGE     500 // ms, clicks that wait longer than this for the UI task are dropped (ex. while calibrating)
+    #endif
     #define MENU_RETURN_LEVEL MOTOR_DATA // The level to return to after configuring a setting
     #define WARNING_MICROSTEP MAX_MICROSTEP_DIVISOR // The largest microstep to warn on (the denominator of the fraction)
 
     // Warning thresholds
     #define WARNING_RMS_CURRENT 1000 // The RMS current at which to display a warning confirmation (mA)
     //#define WARNING_PEAK_CURRENT 1000 // The peak current at which to display a warning confirmation (mA)
+
+    // How the bytes get to the panel
+    // OLED_TRANSPORT_BITBANG toggles the pins through their port registers, which works with any pins (SCLK and SDIN must share a port)
+    // OLED_TRANSPORT_SPI2_DMA sends the pages with SPI2 and DMA1 channel 5 in the background, but needs SCLK on PB_13 and SDIN on PB_15
+    // The BTT S42B V2 routes the clock to PB_15 and the data to PB_14, so it has to bit-bang
+    #define OLED_TRANSPORT OLED_TRANSPORT_BITBANG
+
+    // Keeps a list of what was drawn instead of a 1 KB buffer of the screen, composing each page into a 128 byte line as it is sent
+    // Saves about 600 bytes of RAM for the cost of composing the whole screen on each write (only the pages that changed are sent)
+    //#define ENABLE_OLED_PAGE_STREAMING
+    #ifdef ENABLE_OLED_PAGE_STREAMING
+        #define OLED_STREAM_ITEMS 80 // Characters and boxes on the screen at once (4 bytes each), the oldest is dropped past this
+    #endif
 #endif
 
 // Averages (number of readings in average)
+// The storage is sized at compile time. Integer averages of a power of 2 readings are found with a shift instead of a division
 #define RPM_AVG_READINGS     (uint16_t)10
 #define SPEED_AVG_READINGS   (uint16_t)100
 #define ACCEL_AVG_READINGS   (uint16_t)10
-#define ANGLE_AVG_READINGS   (uint16_t)15
+#define ANGLE_AVG_READINGS   (uint16_t)16
 #define TEMP_AVG_READINGS    (uint16_t)200
 
+// Filters of the encoder's signals
+// Any of the filters in filters.h can be swapped in for the boxcar averages, trading noise against lag. For example:
+//   IIRFilter<int32_t, 2>                                                  (first order, lag of about 4 samples)
+//   CascadedFilter<int32_t, Median3Filter<int32_t>, IIRFilter<int32_t, 2>> (spike rejection, then smoothing)
+//   BiquadFilter<int16_t, 50>                                              (second order low pass at 5% of the sample rate)
+#define RPM_FILTER       MovingAverage<float, RPM_AVG_READINGS>
+#define RAW_SPEED_FILTER MovingAverage<int16_t, SPEED_AVG_READINGS>
+#define ACCEL_FILTER     MovingAverage<float, ACCEL_AVG_READINGS>
+#define ABS_COUNT_FILTER MovingAverage<int32_t, ANGLE_AVG_READINGS>
+#define RAW_TEMP_FILTER  MovingAverage<int16_t, TEMP_AVG_READINGS>
+
 // If encoder estimation should be used
 #define ENCODER_SPEED_ESTIMATION
 #ifdef ENCODER_SPEED_ESTIMATION
     #define SPD_EST_MIN_INTERVAL 500 // The minimum sampling interval (us). Increase to get more steady readings at the cost of latency
 #endif
 
+// Settings written to the encoder at boot, each of them is read back to check it (the fields that didn't stick are reported by M124)
+// ENCODER_PROFILE_LOW_LATENCY - the fastest update (21.3 us) with the prediction on, no autocalibration, spike filter, or hysteresis. Best for high loop rates
+// ENCODER_PROFILE_LOW_NOISE - a slower update (85.3 us) with autocalibration, the spike filter, and a little hysteresis. Best for slow and precise positioning
+// ENCODER_PROFILE_CHIP_DEFAULT - leaves the encoder's settings as they are
+#define ENCODER_PROFILE ENCODER_PROFILE_CHIP_DEFAULT
+
+// Reads of the encoder that are tried before giving up (the last good sample is used, and the motor is stopped with an ENCODER_FAULT)
+// Keeps a hung encoder or a noisy cable from holding up the control loop
+#define ENCODER_READ_ATTEMPTS 3
+
+// Health check of the encoder, the motor is stopped with an ENCODER_FAULT once either limit is passed
+// Failed reads are stood in for by a prediction from the last good sample (moved along by the observer's velocity, if there is one)
+#define ENCODER_MAX_MISSED_READS 10  // Failed reads in a row (1 ms of the control loop)
+#define ENCODER_MAX_ERROR_RATE   100 // Errors (bad CRCs and status bits) in a second
+
+// Multi-turn tracking, the turns are counted from the change in angle of each sample (correct as long as the shaft moves less than half a turn between samples)
+// The encoder's revolution counter (AREV) is compared with the tracked turns every so often, catching any turns that were missed while the samples were sparse
+#define ENCODER_REV_CHECK_INTERVAL 1000 // New samples between the checks against the revolution counter
+
+// Background encoder reads (the angle is read by DMA slightly before every correction, instead of blocking on the SPI bus)
+#define ENABLE_ENCODER_DMA
+#ifdef ENABLE_ENCODER_DMA
+    #define ENCODER_DMA_LEAD_TIME      50 // The time before each correction that the angle read is started (us)
+    #define ENCODER_DMA_SAMPLE_TIMEOUT 1000 // The maximum age of a background sample before falling back to a blocking read (us)
+
+    // Start the background read with the correction timer's compare event (TIM1 channel 3, through DMA1 channel 6) instead of its interrupt
+    // The read is set up a little before the trigger, so other interrupts and critical sections can't move its start around
+    // Each sample is timestamped at the trigger (when the encoder is read) instead of when the transfer finishes, so its delay to the correction is constant
+    //#define ENABLE_ENCODER_TRIGGERED_READS
+    #ifdef ENABLE_ENCODER_TRIGGERED_READS
+        #define ENCODER_TRIGGER_ARM_TIME 10 // The time before the trigger that the read is set up (us)
+    #endif
+
+    // Background polling of the slow values (temperature, STAT, and ACSTAT are round-robined after the background samples)
+    #define ENABLE_ENCODER_POLLING
+    #ifdef ENABLE_ENCODER_POLLING
+        #define ENCODER_POLL_INTERVAL 64 // The number of background samples between each slow value update
+
+        // Temperature compensation of the step offset, moved along with the polled temperature
+        // A calibration at least ENCODER_TEMP_COMP_MIN_DELTA from the temperature of the last one finds how far the offset drifts with temperature
+        //#define ENABLE_ENCODER_TEMP_COMP
+        #ifdef ENABLE_ENCODER_TEMP_COMP
+            #define ENCODER_TEMP_COMP_MIN_DELTA 15 // °C between the two calibrations
+        #endif
+    #endif
+#endif
+
+// Per-tick encoder cache (every read in a single correction shares the same sample, and the angle average only advances once)
+#define ENABLE_ENCODER_TICK_CACHE
+
+// Encoder linearization (calibration records the encoder at every full step, the resulting table corrects the angle)
+#define ENABLE_ENCODER_LINEARIZATION
+
+// Calibration (run in the background, sweeps each full step of a rotation forward and back)
+#define CALIBRATION_START_DELAY  3000 // Time for the user to take their hands away before the coils are driven (ms)
+#define CALIBRATION_HOLD_TIME    3000 // Time to let the motor settle at step 0 before the sweep (ms)
+#define CALIBRATION_SETTLE_TIME  25   // Time to let the motor settle at each full step (ms)
+
+// Tracking observer (an alpha-beta-gamma filter updated every correction, estimates the speed and acceleration without any extra encoder reads)
+#define ENABLE_ENCODER_OBSERVER
+#ifdef ENABLE_ENCODER_OBSERVER
+    #define OBSERVER_ALPHA 0.5    // Position gain
+    #define OBSERVER_BETA  0.1716 // Velocity gain
+    #define OBSERVER_GAMMA 0.0294 // Acceleration gain (with the others, gives a critically damped response)
+#endif
+
+// Latency compensation of the position feedback, the observer's position is moved forward by the age of the reading (set with M317)
+// The age is the time since the sample was taken, plus the delay inside the encoder (found from its update rate, FIR_MD), plus the lag of the angle average for the PID
+//#define ENABLE_LATENCY_COMPENSATION
+#ifdef ENABLE_LATENCY_COMPENSATION
+    #define LATENCY_SENSOR_PREDICTION   // Turns on the encoder's prediction (PREDICT in MOD_2), the angle is extrapolated by an update inside of the encoder
+    #define LATENCY_EXTRA_DELAY 0       // Delay that isn't measured (us), ex. the drive's response
+#endif
+
+// IIF (A/B incremental) position from the encoder, counted by a timer in encoder mode
+// Not possible on the BTT S42B V2 (see sanityCheck.h), left here for boards that route the IFA/IFB lines to a free timer
+//#define ENABLE_ENCODER_IIF
+
 // Serial configuration settings
 #define ENABLE_SERIAL
 #ifdef ENABLE_SERIAL
     #define SERIAL_BAUD 115200
+
+    // Longest command that can be received (characters between the start and end markers), longer ones are dropped
+    // The received bytes are buffered by the USART interrupt (SERIAL_RX_BUFFER_SIZE in platformio.ini), then assembled here
+    #define SERIAL_COMMAND_BUFFER_SIZE 128
+
+    // Background transmission (responses are copied into an arena, then sent by DMA while the main loop moves on)
+    // A response only waits if the arena is full, and then only until enough of it has been sent
+    #define ENABLE_SERIAL_DMA
+    #ifdef ENABLE_SERIAL_DMA
+        #define SERIAL_TX_ARENA_SIZE 1024 // Bytes, must be a power of 2
+    #endif
+
+    // Limits of the baud rate that can be set (saved with the parameters, USART1 can reach 4.5 Mbaud at 72 MHz)
+    #define MIN_SERIAL_BAUD 1200
+    #define MAX_SERIAL_BAUD 2000000
+
+    // Compact binary protocol (COBS framed, CRC checked requests for moves, parameters, status, and bulk reads)
+    // Binary frames are sent between zero bytes, so they can be mixed with the text commands on the same bus
+    //#define ENABLE_BINARY_PROTOCOL
+    #ifdef ENABLE_BINARY_PROTOCOL
+        #define BINARY_MAX_FRAME_SIZE 256 // Bytes of a decoded frame, including the header and the CRC
+    #endif
 #endif
 
 // Parser settings
 #define STRING_START_MARKER '<'
 #define STRING_END_MARKER '>'
 
+// Separates the commands of a batch (ex. "<M306 P1;M350 V16;M500>"), new lines also work
+#define COMMAND_SEPARATOR ';'
+
 // CAN settings
 #define ENABLE_CAN
 #ifdef ENABLE_CAN
@@ -68,13 +205,187 @@
     // E:17, E1:18...
     #define DEFAULT_CAN_ID X
 
-    // ! Maybe higher later? (Up to 1MHz for fast transmissions)
-    #define CAN_BITRATE BR125K
+    // Bitrate of the bus (in bit/s, up to 1000000 for fast transmissions)
+    // The bit timing is found from the clock of APB1 at boot, so it stays the same for any of the clock setups
+    #define CAN_BITRATE 125000
+    #define CAN_BITRATE_TOLERANCE 5 // Tenths of a %, the furthest that the actual bitrate can be from CAN_BITRATE (checked at boot)
+
+    // Frames are moved out of the hardware FIFO by the receive interrupt into a queue, then assembled into commands by the main loop
+    #define CAN_RX_QUEUE_SIZE        32  // Frames, must be a power of 2
+    #define CAN_COMMAND_BUFFER_SIZE  128 // Longest command that can be received (characters between the start and end markers)
+    #define CAN_ASSEMBLY_SLOTS       3   // Commands that can be assembled at once (one for each ID that the board listens to: its own, its group, and the broadcast)
+
+    // Frames to send wait in a queue, the transmit interrupt refills the three hardware mailboxes as they empty
+    #define CAN_TX_QUEUE_SIZE        32  // Frames, must be a power of 2
+    #define CAN_TX_TIMEOUT           50  // ms, the longest a message waits for room in the queue before the rest of it is dropped
+
+    // Binary protocol (cyclic targets, status replies, and parameter access in single frames, see canProtocol.h)
+    // Meant for a mainboard driving several axes at once, so a CAN_BITRATE of 500000 or 1000000 is recommended
+    //#define ENABLE_CAN_PDO
+    #ifdef ENABLE_CAN_PDO
+        #define CAN_PDO_CYCLE_FREQ 1000 // Hz, the rate that the targets are sent at (each target is reached by the next one)
+
+        // Synchronized targets, the targets are held until the mainboard broadcasts a SYNC frame, then all of the boards start them at once
+        // The control loop's timer is also trimmed to line its ticks up with the SYNCs (sent at CAN_PDO_CYCLE_FREQ)
+        //#define ENABLE_CAN_SYNC
+        #ifdef ENABLE_CAN_SYNC
+            #define CAN_SYNC_MAX_TRIM 2 // %, the most that the control loop's period is stretched or shrunk to follow the SYNCs
+        #endif
+
+        // Motion fast path, the targets and the gearing's positions are decoded right in the motion frames' receive interrupt instead of waiting for the main loop
+        // A target then starts (or is held for the SYNC) as soon as it is off of the bus, the status reply is still sent by the main loop
+        //#define ENABLE_CAN_MOTION_FAST_PATH
+
+        // Electronic gearing (M923), a follower tracks the position of a master axis over CAN through a rational gear ratio (ex. X2 following X)
+        // The master sends its position at CAN_GEAR_FRAME_FREQ, stamped with the time that it was taken. The follower's target is moved
+        // toward each position at the rate between the frames every correction (a phase accumulator), so the axes stay locked without any STEP wiring
+        //#define ENABLE_CAN_GEARING
+        #ifdef ENABLE_CAN_GEARING
+            #define CAN_GEAR_FRAME_FREQ 500 // Hz, the rate that the master sends its position at
+            #define CAN_GEAR_TIMEOUT    20  // ms, the follower holds its position if the frames stop for this long
+        #endif
+
+        // Batched parameters, writes sent to a group or the broadcast are applied without a reply (so a fleet is set up in one pass)
+        // A commit then ends the batch, each board saving it if asked and replying with the count and CRC of the writes it took and a CRC of its whole configuration
+        //#define ENABLE_CAN_PARAM_BATCH
+    #endif
 #endif
 
 // Motor characteristics
 #define STEP_ANGLE (float)1.8 // ! Check to see for .9 deg motors as well
-#define STEP_UPDATE_FREQ (uint32_t)78 // in Hz, to step the motor back to the correct position. Multiplied by the microstepping for actual update freq
+#define STEP_UPDATE_FREQ (uint32_t)78 // in full steps per second, the speed that the motor is stepped back to the correct position at (without PID)
+
+// Catch up correction (without PID)
+// Instead of a single microstep per pass of the accumulator, the coils are moved up to the whole error in a single tick
+// The moves are limited by the slew below, a large error is recovered from in milliseconds instead of seconds
+//#define ENABLE_CATCH_UP_CORRECTION
+#ifdef ENABLE_CATCH_UP_CORRECTION
+    #define CATCH_UP_SLEW_FREQ (uint32_t)2500 // in full steps per second, the fastest that the coils are moved back (STEP_UPDATE_FREQ isn't used)
+#endif
+
+// Hysteresis of the correction (M325), the correction starts once the filtered error passes the enter error and runs until the error is back within the exit error
+// Without it, the encoder's noise at high microstepping keeps crossing the single step threshold, dithering the motor back and forth at standstill
+// The filter only averages the error to start the correction, a skipped step (past the immediate error) starts it right away
+//#define ENABLE_CORRECTION_HYSTERESIS
+#ifdef ENABLE_CORRECTION_HYSTERESIS
+    #define CORRECTION_ENTER_ERROR      3  // microsteps, the filtered error that starts the correction
+    #define CORRECTION_EXIT_ERROR       1  // microsteps, the error that the correction runs down to
+    #define CORRECTION_IMMEDIATE_ERROR  16 // microsteps, the error that starts the correction without waiting for the filter
+    #define CORRECTION_ERROR_FILTER     3  // The error is filtered by 1/2^this every correction (3 is a time constant of 8 corrections)
+#endif
+
+// Control modes that are switched between while the motor runs (M922, saved with M500), so a single build can serve every axis
+// The open loop, the direction based correction, the PID (with ENABLE_PID), and the torque mode (with ENABLE_TORQUE_MODE) are all built in together
+// Each switch hands the state of the last mode over to the next (the PID's I term is preloaded, the torque mode's error is taken up), so the axis doesn't jerk
+// The DIP switch still turns the closed loop on and off, running the closed loop mode that was picked last
+//#define ENABLE_CONTROL_MODES
+
+// The rate of the control loop (correction timer), in Hz
+// Fixed so that the loop dynamics, the gains, and the CPU load don't change with the microstepping
+#define CONTROL_LOOP_FREQ (uint32_t)10000
+
+// Overrun detection of the control loop (reported by M324), each correction is timed and counted as an overrun if the next tick was already due when it finished
+// While the load stays high, first the display refreshes are skipped and the slow current and PWM updates are thinned out, then the trace and the move metrics are left out
+// The work comes back once the load has stayed low. The rate of the loop and the correction itself are never changed (the gains are tuned for them)
+//#define ENABLE_OVERRUN_DETECTION
+#ifdef ENABLE_OVERRUN_DETECTION
+    #define OVERRUN_DEGRADE_LOAD  85  // % of the loop's period, the filtered runtime has to stay above it to shed the next level of work
+    #define OVERRUN_RECOVER_LOAD  60  // % of the loop's period, the filtered runtime has to stay below it to bring a level of work back
+    #define OVERRUN_HOLD_TIME     100 // ms that the load has to stay past either before the level changes
+    #define OVERRUN_DECIMATION    10  // The thinned out updates run once every this many corrections
+#endif
+
+// The rates of the main loop's tasks (in Hz), run by the cooperative scheduler
+#define COMMAND_TASK_FREQ     1000 // Serial command parsing
+#define UI_TASK_FREQ          10   // Buttons
+#define DISPLAY_FRAME_RATE    10   // Cap on the motor data refreshes of the display (frames per second)
+#define DIP_TASK_FREQ         20   // Dip switches
+#define CAN_TASK_FREQ         1000 // CAN command assembly and parsing
+#define CALIBRATION_TASK_FREQ 200  // Calibration sweep (idle unless calibrating)
+
+// Sleeps the core (WFI) whenever no task is due, instead of spinning in the scheduler
+// Every wake source is an interrupt (the step pin, the timers, CAN, the USART, and the 1 ms SysTick), so the interrupts are as fast as before
+// The SysTick wakes the core at least once a ms, so the tasks start at most a ms late
+#define ENABLE_IDLE_SLEEP
+
+// Independent watchdog, resets the board if the control loop or the main loop's tasks stop running
+// It is only fed once both have checked in, so a hung interrupt or task can't keep it alive
+#define ENABLE_WATCHDOG
+#ifdef ENABLE_WATCHDOG
+    #define WATCHDOG_TIMEOUT 250 // ms, the longest that the firmware can go without checking in (longer than a flash page erase)
+#endif
+
+// Position retention across power loss, the supply monitor (PVD) saves the position to flash as the supply drops
+// At boot, the position is picked back up from the save and the angle of the encoder, so the machine doesn't have to home again
+// Only a clean power loss is kept, a reset starts from zero like before. The shaft can't be turned more than half of a turn while off
+//#define ENABLE_POWER_LOSS_SAVE
+#ifdef ENABLE_POWER_LOSS_SAVE
+    #define POWER_LOSS_PVD_LEVEL 7 // Threshold of the supply monitor (0 is 2.2V up to 7 at 2.9V, in steps of 0.1V)
+#endif
+
+// Oldest encoder sample that the display will reuse instead of reading the encoder again (in us)
+#define DISPLAY_SAMPLE_MAX_AGE 1000
+
+// Time that the dip switches have to be still before a change is applied (in ms)
+#define DIP_DEBOUNCE_TIME 50
+#define TEMPERATURE_TASK_FREQ 1    // Overtemp check
+
+// Digital filter of TIM2's step input (0 to 15, saved with M500), a pulse has to hold for longer with each setting
+// 0 is off, 7 takes 8 samples at the timer clock / 4 (about 0.44 us at 72 MHz), and 15 takes 8 samples at / 32
+// Higher settings reject more noise on long step cables, but lower the highest step rate that gets through
+#define DEFAULT_STEP_FILTER 7
+
+// Statistics of the step input (not used with hardware only step counting)
+// The pulses seen by the step pin's interrupt (which isn't filtered) are compared with TIM2's count every STEP_GLITCH_WINDOW
+// Any difference is a glitch that the filter rejected (or a pulse that only one of them caught), reported by M358 along with the fastest clean rate
+//#define ENABLE_STEP_GLITCH_STATS
+#ifdef ENABLE_STEP_GLITCH_STATS
+    #define STEP_GLITCH_WINDOW 10 // ms
+#endif
+
+// Hardware only step counting
+// The step pin interrupt is removed, TIM2 still counts every pulse and the coils are moved to the counted steps on every correction
+// The input step rate is then only limited by TIM2's input filter, but the coils are only updated at the correction rate
+//#define ENABLE_HARDWARE_STEP_COUNTING
+
+// Interpolation of the step input
+// Each pulse of the step pin is spread over the interval since the last pulse, the coils are moved toward it on a 1/256 microstep grid every correction
+// Coarse microstepping from the DIPs (1/8 or 1/16) then runs like 1/256, at the same step rate from the host (the position lags by up to one pulse)
+//#define ENABLE_STEP_INTERPOLATION
+#ifdef ENABLE_STEP_INTERPOLATION
+    #define STEP_INTERP_MAX_INTERVAL 20000 // us, pulses further apart are taken right away (the first pulse from a standstill, or very slow moves)
+#endif
+
+// Feed forward of the step input
+// Every correction, the commanded velocity and acceleration are found from TIM2's count (averaged over the last few corrections)
+// The coils are led ahead by the distance moved in STEP_FF_LEAD_TIME, making up for the lag of the rotor so the error stays near zero at a constant feed rate
+// With dynamic current, the commanded acceleration raises the current before the rotor starts to fall behind
+//#define ENABLE_STEP_FEED_FORWARD
+
+// Timestamps of the step input (TIM2's channel 3 captures each step, and the DMA copies the correction timer's counter into a ring)
+// The interval between the steps is measured to the timer clock without any interrupts, for the feed forward and M314
+// Uses DMA1 channel 1
+//#define ENABLE_STEP_CAPTURE
+#ifdef ENABLE_STEP_CAPTURE
+    #define STEP_CAPTURE_BUFFER_SIZE 64 // Steps that can be captured in a single correction
+    #define STEP_CAPTURE_MIN_RATE    10 // steps/s, longer gaps between the steps are the start of a new move (they're not timed)
+#endif
+// Damping of the mid-band resonance (around 1 to 3 rps, where an open loop stepper rings)
+// The observer's velocity is band-passed (two IIRs, the slow one removes the commanded velocity and the fast one removes the noise)
+// The coils are then held back by the phase moved at the oscillating velocity in RESONANCE_DAMPING_TIME, a torque that opposes the ringing
+//#define ENABLE_RESONANCE_DAMPING
+#ifdef ENABLE_RESONANCE_DAMPING
+    #define RESONANCE_SLOW_POWER    6    // The slow filter moves by 1/2^power every correction (about 25 Hz at 10 kHz)
+    #define RESONANCE_FAST_POWER    2    // The fast filter moves by 1/2^power every correction (about 450 Hz at 10 kHz)
+    #define RESONANCE_DAMPING_TIME  200  // us, the gain of the damping (0 turns it off, set with M316)
+    #define RESONANCE_MIN_SPEED     0.5  // rps, the damping is only applied within this band of speeds
+    #define RESONANCE_MAX_SPEED     6    // rps
+#endif
+#ifdef ENABLE_STEP_FEED_FORWARD
+    #define STEP_FF_TAPS_POWER          4   // The velocity is averaged over 2^power corrections
+    #define STEP_FF_ACCEL_FILTER_POWER  4   // The acceleration is filtered by 1/2^power every correction
+    #define STEP_FF_LEAD_TIME           150 // us, the lag of the rotor that is made up for
+#endif
 
 // Board characteristics
 // ! Do not modify unless you know what you are doing!
@@ -104,9 +415,81 @@
         #define OVERTEMP_INTERVAL            30 // The minimum interval between current reductions (s)
         #define OVERTEMP_SHUTDOWN_TEMP       80 // The temp at which to completely shut down the motor, protecting it against burning up
         #define OVERTEMP_SHUTDOWN_CLEAR_TEMP 70 // Motor can begin movement again once this temp is reached
+
+        // Thermal model of the coils (I²t), the current is lowered smoothly to keep the coils under a temperature instead of in steps (reported by M919)
+        // The coils are modeled as heating above the encoder's temperature with a single time constant, from the square of the current they're driven with
+        // Replaces the steps of OVERTEMP_INCREMENT, the shutdown is kept as a backstop
+        //#define ENABLE_THERMAL_MODEL
+        #ifdef ENABLE_THERMAL_MODEL
+            #define THERMAL_RATED_CURRENT   1000 // Peak current that the rise was measured at (mA)
+            #define THERMAL_RATED_RISE      40   // Rise of the coils above the encoder at the rated current, once settled (C)
+            #define THERMAL_TIME_CONSTANT   120  // Time for the rise to get 63% of the way to where it settles (s)
+            #define THERMAL_LIMIT_TEMP      90   // Highest temperature of the coils (C)
+            #define THERMAL_DERATE_BAND     10   // The current starts to be lowered this far below the limit (C)
+            #define THERMAL_MIN_CURRENT     30   // Current at the limit (% of the set current)
+            #define THERMAL_UPDATE_FREQ     100  // Updates of the model (Hz), the current is summed every correction in between
+        #endif
+    #endif
+
+    // Coil drive table (maps each sine index straight to the coil states and PWM values, rebuilt when the current changes)
+    #define ENABLE_COIL_LUT
+    #ifdef ENABLE_COIL_LUT
+
+        // Waveform shaping (the calibration also stops at the quarter steps between each full step, fitting a third harmonic and a balance of the coils to how far the rotor strays)
+        // Both are built into the table (the coils get a table each), evening out the spacing of the microsteps at no extra cost to the step path (reported by M323)
+        //#define ENABLE_WAVEFORM_SHAPING
+        #ifdef ENABLE_WAVEFORM_SHAPING
+            #define WAVEFORM_SUBSTEP_SETTLE_TIME  10   // Time to let the motor settle at each quarter step (ms)
+            #define WAVEFORM_MAX_SHAPE            0.15 // Largest third harmonic and coil balance (of the sine)
+        #endif
     #endif
 #endif
 
+// Idle current reduction (ramps the coils down to a holding current once the motor has sat still for a while)
+// The next step, or an error larger than the limit, restores the full current right away
+// ! Not used with field oriented control, it already scales the current with the error
+#define ENABLE_IDLE_CURRENT
+#ifdef ENABLE_IDLE_CURRENT
+    #define IDLE_CURRENT_DELAY      500 // Time without any commanded motion before the current is lowered (ms)
+    #define IDLE_CURRENT_PERCENT    50  // Holding current, as a percent of the running current
+    #define IDLE_CURRENT_RAMP_TIME  200 // Time taken to ramp from the running current to the holding current (ms)
+    #define IDLE_CURRENT_MAX_ERROR  2   // Largest step error that still counts as idle (microsteps)
+#endif
+
+// Current on demand (a torque reserve from the error), the motor runs at a low base current that is raised every correction
+// in proportion to the step error and how fast it is growing, then decays back to the base once the error settles (set with M916)
+// The current never goes over the set current, so the set current is the reserve that a sudden load can pull from
+//#define ENABLE_CURRENT_ON_DEMAND
+#ifdef ENABLE_CURRENT_ON_DEMAND
+    #define DEMAND_BASE_CURRENT     40  // Current without any error (% of the set current)
+    #define DEMAND_ERROR_DEADBAND   2   // Error that is left to the base current, so the noise of the encoder doesn't raise it (microsteps)
+    #define DEMAND_ERROR_GAIN       5   // Current added for each microstep of error past the deadband (% of the set current)
+    #define DEMAND_GROWTH_GAIN      20  // Current added for each microstep that the error grew by since the last correction (% of the set current)
+    #define DEMAND_DECAY_TIME       100 // Time taken to decay from the set current to the base current (ms)
+#endif
+
+// Current boost at speed (the back-EMF of the motor eats into the coil current as it speeds up, so the torque falls off)
+// The current is raised by a table of speeds and boosts (interpolated between the points, from the observer's speed), set with M918 and saved with M500
+// The boosted current never goes over MAX_PEAK_BOARD_CURRENT. Points must be in order of increasing speed
+//#define ENABLE_SPEED_CURRENT_BOOST
+#ifdef ENABLE_SPEED_CURRENT_BOOST
+    #define CURRENT_BOOST_POINTS        4                         // Points in the table (2 to 6, each takes a flash parameter)
+    #define DEFAULT_CURRENT_BOOST_RPM   { 0,   300, 600, 1200 }   // Speed of each point (RPM)
+    #define DEFAULT_CURRENT_BOOST       { 100, 100, 100, 100 }    // Current at each point (% of the set current)
+#endif
+
+// Detent (cogging) torque compensation, the coils are driven ahead or behind by a table of phase offsets over an electrical cycle (interpolated)
+// The table is learned with M322: the coils are stepped slowly through a rotation each way with the correction paused, and the rotor's
+// deviation from the coils is averaged at each point of the cycle. Each pass refines the table that is already applied, and saves it
+// ! Not used with field oriented control, it commutates from the encoder instead
+//#define ENABLE_DETENT_COMPENSATION
+#ifdef ENABLE_DETENT_COMPENSATION
+    #define DETENT_TABLE_POWER       5   // 2^5 = 32 points per electrical cycle (8 per full step, every 2 take a flash parameter)
+    #define DETENT_LEARN_HOLD_TIME   500 // Time to let the motor settle before each sweep (ms)
+    #define DETENT_LEARN_POINT_TIME  5   // Time at each point of the sweep (ms), sets the slow speed of the pass
+    #define DETENT_LEARN_MAX_OFFSET  (PHASE_PER_FULL_STEP / 4) // Largest offset of the table (phase, a quarter of a full step)
+#endif
+
 // PID settings
 // ! At this time, this feature is still under development
 #define ENABLE_PID
@@ -120,34 +503,185 @@
     // I windup protection
     #define DEFAULT_MAX_I 10
 
-    // Minimum sample time (in ms)
-    //#define PID_MIN_SAMPLE_TIME 10
-
     // Default min and max for step timing (per second)
     #define DEFAULT_PID_STEP_MAX 50000
 
+    // The most that the output can change by in a second (steps/s/s), limits the acceleration of the correction
+    #define DEFAULT_PID_SLEW_RATE 2000000
+
+    // Anti-windup back-calculation gain (the fraction of the saturated output that is taken out of the I term every loop)
+    #define DEFAULT_PID_ANTI_WINDUP 0.5
+
     // PID output that the motor should disable at (set to 0 to never disable motor)
     #define DEFAULT_PID_DISABLE_THRESHOLD 0 //1000
+
+    // Steps of the PID's output from a phase accumulator (DDS) instead of reprogramming the step schedule timer's period every correction
+    // The timer runs at a fixed rate, adding the velocity word to the phase every tick and stepping on each carry
+    // The rate is exact at low speeds and changes on the next tick, with steps placed on the tick (up to 1/DDS_TICK_FREQ of jitter)
+    //#define ENABLE_DDS_STEPPING
+    #ifdef ENABLE_DDS_STEPPING
+        #define DDS_TICK_FREQ (uint32_t)50000 // Hz, the fastest rate that can be stepped (must divide STEP_SCHEDULE_TICK_FREQ)
+    #endif
+
+    // Gain schedule by speed (M311), the gains are interpolated between points as percentages of the base gains (M306)
+    // Stiff holding at rest and stable tracking at speed, without a compromise tune. Points must be in order of increasing speed
+    #define ENABLE_GAIN_SCHEDULING
+    #ifdef ENABLE_GAIN_SCHEDULING
+        #define GAIN_SCHEDULE_POINTS       4                         // Points in the schedule (2 to 6, each takes 2 flash parameters)
+        #define DEFAULT_GAIN_SCHEDULE_RPM  { 0,   60,  300, 1200 }   // Speed of each point (RPM)
+        #define DEFAULT_GAIN_SCHEDULE_P    { 100, 100, 100, 100 }    // P at each point (% of the base gain)
+        #define DEFAULT_GAIN_SCHEDULE_I    { 100, 100, 100, 100 }    // I at each point (% of the base gain)
+        #define DEFAULT_GAIN_SCHEDULE_D    { 100, 100, 100, 100 }    // D at each point (% of the base gain)
+    #endif
+
+    // Relay feedback autotune of the PID gains (M307)
+    // The relay makes the motor oscillate around its position, the gains are found from the period and size of the swing
+    #define ENABLE_AUTOTUNE
+    #ifdef ENABLE_AUTOTUNE
+        #define AUTOTUNE_RELAY_RATE     2000 // steps/s, the rate that the relay steps the motor at
+        #define AUTOTUNE_HYSTERESIS     2    // microsteps, the error that the relay switches at (keeps the encoder noise from chattering it)
+        #define AUTOTUNE_MAX_ERROR      64   // microsteps, the experiment is stopped if the error grows past this
+        #define AUTOTUNE_SETTLE_CYCLES  2    // Cycles skipped while the oscillation settles
+        #define AUTOTUNE_CYCLES         5    // Cycles averaged for the result
+        #define AUTOTUNE_TIMEOUT        5000 // ms, the longest that the experiment can run
+    #endif
 #endif
 
+// The tick rate of the step schedule timer (TIM4) used by PID and direct stepping (in Hz)
+// The period is 16 bits, so the slowest rate is STEP_SCHEDULE_TICK_FREQ / 65536 (about 16Hz at 1MHz), slower moves are rejected
+#define STEP_SCHEDULE_TICK_FREQ (uint32_t)1000000
+
 // Direct step functionality (used to command motor to move over Serial/CAN)
 #define ENABLE_DIRECT_STEPPING
 #ifdef ENABLE_DIRECT_STEPPING
 
     // The default stepping rate (in Hz) to move in the event that no parameter is specified
     #define DEFAULT_STEPPING_RATE 1000
+
+    // Motion planner (jerk limited S-curve profiles for G6 and G0 moves)
+    // The step rate is integrated in fixed point in the step schedule interrupt, ramping up to the move's rate and back down
+    #define ENABLE_MOTION_PLANNER
+    #ifdef ENABLE_MOTION_PLANNER
+        #define DEFAULT_PLANNER_ACCEL  20000    // steps/s/s, used if no acceleration is specified
+        #define DEFAULT_PLANNER_JERK   2000000  // steps/s/s/s, used if no jerk is specified
+        #define PLANNER_MIN_RATE       100      // Hz, the rate that moves start and finish at
+    #endif
+
+    // Step queue (G6 and G0 moves are queued as segments, then stepped out back to back by the step schedule interrupt)
+    // Allows the host to send a chain of moves without waiting for each one to finish
+    #define ENABLE_STEP_QUEUE
+    #ifdef ENABLE_STEP_QUEUE
+        #define STEP_QUEUE_SIZE 16 // Must be a power of 2, one slot is always kept free
+    #endif
+
+    // Closed loop correction alongside the moves
+    // The correction keeps running while G6, G0, and the jog step out their moves, tracking the position that they step out like it does for the step pin
+    // The PID moves the coils itself every tick instead of stepping them with the step schedule timer, so the moves keep the timer to themselves
+    //#define ENABLE_CONCURRENT_CORRECTION
+
+    // Self-test of the highest step rate (M315)
+    // The step schedule timer generates bursts of steps back and forth at rising rates, while TIM2 counts its pulses in place of the step pin
+    // The shaft moves a little during the test (run it unloaded), the correction puts it back afterward
+    //#define ENABLE_STEP_RATE_TEST
+    #ifdef ENABLE_STEP_RATE_TEST
+        #define STEP_RATE_TEST_START_RATE 1000   // steps/s, the first rate (also used to find the counts that aren't steps)
+        #define STEP_RATE_TEST_MAX_RATE   500000 // steps/s, the highest rate to try if none is given
+        #define STEP_RATE_TEST_BURST_TIME 20     // ms, the length of each half of a burst
+        #define STEP_RATE_TEST_MIN_BURST  32     // Fewest steps in each half of a burst
+        #define STEP_RATE_TEST_TIMEOUT    50     // ms, the time that a burst can run over before it fails
+    #endif
+
+    // Characterization of the encoder's noise and timing (M318)
+    // The correction is paused so the coils hold the rotor, then raw samples are read at the control loop's rate
+    // Reports the noise of the angle, the errors of the reads, and the time of the SPI transactions (run it unloaded, without vibration)
+    //#define ENABLE_ENCODER_NOISE_TEST
+    #ifdef ENABLE_ENCODER_NOISE_TEST
+        #define ENCODER_NOISE_TEST_SAMPLES     5000   // Reads to take if none is given
+        #define ENCODER_NOISE_TEST_MAX_SAMPLES 100000 // Most reads that can be asked for (10 s at 10 kHz)
+        #define ENCODER_NOISE_TEST_SETTLE_TIME 200    // ms, the time that the rotor is given to settle after the correction is paused
+    #endif
+
+    // Velocity (jog) mode, the motor ramps to a speed and holds it until it is changed or stopped (M3, M4, and M5)
+    // For conveyors and spindles, the host doesn't have to stream any steps. Any other move stops the jog right away
+    //#define ENABLE_JOG
+    #ifdef ENABLE_JOG
+        #define DEFAULT_JOG_ACCEL  600  // RPM/s, used if no acceleration is specified
+        #define JOG_MIN_RATE       100  // steps/s, the rate that the jog starts, stops, and turns around at
+    #endif
+
+    // Sensorless homing against a hard stop (G28), saves the wiring of an endstop
+    // The motor moves toward the stop through the planner, checking the lead of the coils over the rotor every correction period
+    // The stop is found once the lead passes the limit, then the position is zeroed there and the motor backs off
+    //#define ENABLE_SENSORLESS_HOMING
+    #ifdef ENABLE_SENSORLESS_HOMING
+        #define HOMING_RATE             2000   // steps/s, the rate to move toward the stop if none is given
+        #define HOMING_ACCEL            20000  // steps/s/s, the acceleration up to the homing rate
+        #define HOMING_MAX_TRAVEL       51200  // steps, the farthest to move looking for the stop
+        #define HOMING_STALL_LEAD       75     // Lead of the coils over the rotor that counts as the stop (% of a full step, 100 is the torque peak)
+        #define HOMING_CONFIRM_TIME     1000   // us, how long the lead has to stay past the limit
+        #define HOMING_SETTLE_TIME      20     // ms, the time for the rotor to settle against the stop before it is zeroed
+        #define HOMING_BACKOFF          800    // steps, the distance to back off of the stop if none is given
+        #define HOMING_BACKOFF_TIMEOUT  500    // ms, the time that the back off can run over before it is given up on
+    #endif
+#endif
+
+// Soft limits of the position, velocity, and acceleration (M211, saved with M500)
+// The moves are checked when they're started (ones that end past a limit are refused, and their rate and acceleration are cut to the max),
+// then the desired position is checked every correction. Going past a position limit or the max velocity faults the limits,
+// which stops the moves and ignores the step input until the fault is cleared (M211 C1), the motor holds where it stopped
+//#define ENABLE_SOFT_LIMITS
+#ifdef ENABLE_SOFT_LIMITS
+    #define DEFAULT_SOFT_LIMITS_ENABLED  false     // If the limits are checked before they're set up
+    #define DEFAULT_SOFT_LIMIT_MIN       -1000000  // microsteps, the lowest desired position
+    #define DEFAULT_SOFT_LIMIT_MAX       1000000   // microsteps, the highest desired position
+    #define DEFAULT_MAX_VELOCITY         0         // microsteps/s, 0 doesn't limit the velocity
+    #define DEFAULT_MAX_ACCEL            0         // microsteps/s/s, 0 doesn't limit the acceleration (only the moves are limited)
+    #define SOFT_LIMIT_VELOCITY_WINDOW   32        // Corrections that the velocity is measured over
+    #define SOFT_LIMIT_VELOCITY_MARGIN   10        // % over the max velocity that the step input can go before it faults
+#endif
+
+// Trajectory buffer of position-velocity-time points (G5, M924, and the binary protocols)
+// The host streams points into a buffer instead of steps, then the correction moves the desired position along a cubic Hermite segment
+// between each point and the next (in fixed point, every tick), so the motion is smooth and set by the drive instead of the host's timing
+//#define ENABLE_PVT_TRAJECTORY
+#ifdef ENABLE_PVT_TRAJECTORY
+    #define PVT_BUFFER_SIZE          64  // Points, must be a power of 2 (one slot is always kept free)
+    #define PVT_PREFILL_POINTS       4   // Points that are buffered before a trajectory starts (a point that ends at rest starts it right away)
+    #define PVT_CAN_VELOCITY_SCALE   16  // microsteps/s of each count of the velocity in the CAN frames (they only have room for an int16)
 #endif
 
 // Motor settings
 // The number of microsteps to move per step pulse
 // Doesn't affect correctional movements
-#define MICROSTEP_MULTIPLIER    (uint32_t)1
+// Can be fractional (ex 1.34), the leftover fraction of a microstep is carried to the next step pulse
+#define MICROSTEP_MULTIPLIER    (float)1.0
 
 // The min/max microstepping divisors
 // Microstepping divisors are the numbers underneath the fraction of the microstepping
 // For example, 1/16th microstepping would have a divisor of 16
 #define MIN_MICROSTEP_DIVISOR   (uint8_t)1
-#define MAX_MICROSTEP_DIVISOR   (uint8_t)32
+#define MAX_MICROSTEP_DIVISOR   (uint16_t)256
+
+// Fixes the step settings when compiling, so that the step math is done with constants instead of loading and dividing by the settings
+// The dips, menu, and commands can no longer change the microstepping, full step angle, reversal, or multiplier
+// Enabled by the BTT_S42B_V2_fixed environment, the settings can be passed with -D (ex. -D FIXED_MICROSTEPPING=32)
+//#define ENABLE_FIXED_MOTOR_CONFIG
+#ifdef ENABLE_FIXED_MOTOR_CONFIG
+    #ifndef FIXED_MICROSTEPPING
+        #define FIXED_MICROSTEPPING 16 // Microstepping divisor (a power of 2)
+    #endif
+    #ifndef FIXED_FULL_STEPS
+        #define FIXED_FULL_STEPS (uint16_t)(360.0 / STEP_ANGLE + 0.5) // Full steps in a rotation (200 or 400)
+    #endif
+    #ifndef FIXED_REVERSED
+        #define FIXED_REVERSED false // If the motor direction is inverted
+    #endif
+#endif
+
+// Settings are changed at the start of a control tick (the microstepping, multiplier, full step angle, reversal, and PID gains)
+// The commands edit a staged copy of the settings, which is handed to the correction by a pointer and applied at the start of its next tick,
+// so the correction never sees half of a change (ex. the new microstepping with the old phase per step), and the commands never have to mask it
+//#define ENABLE_CONFIG_COMMIT
 
 #define MOTOR_PWM_FREQ          (uint32_t)124000 // in Hz
 // https://deepbluembedded.com/wp-content/uploads/2020/06/STM32-PWM-Resolution-Example-STM32-Timer-PWM-Mode-Output-Compare-768x291.jpg
@@ -160,6 +694,94 @@
 
 #define IDLE_MODE               COAST // The mode to set the motor to when it's disabled
 
+// Adaptive PWM (the frequency of the PWM and the decay of the coils follow the speed of the motor)
+// Below the switch speed, the PWM runs at PWM_SMOOTH_FREQ and the compare values are found at the full resolution of the timer, so the current is smooth
+// Above it, the PWM runs at MOTOR_PWM_FREQ and a coil coasts (fast decay) instead of braking as its current crosses zero, so the current falls faster against the back-EMF
+// The period and compare values are buffered by TIM3, so the new ones take effect together at its next update event
+//#define ENABLE_ADAPTIVE_PWM
+#ifdef ENABLE_ADAPTIVE_PWM
+    #define PWM_SMOOTH_FREQ        (uint32_t)31000 // in Hz
+    #define PWM_SWITCH_SPEED       2.0             // rps, the speed that the PWM switches at
+    #define PWM_SWITCH_HYSTERESIS  0.25            // rps, either side of the switch speed (keeps it from chattering)
+#endif
+
+// Direct coil outputs (writes the TIM3 compare registers and sets the direction pins with a single BSRR write, instead of going through the HAL)
+#define ENABLE_DIRECT_COIL_OUTPUT
+
+// Coil outputs synchronous to the PWM period
+// The compare registers are preloaded, so the currents change at TIM3's update event instead of part way through a period
+// A coil that changes direction is off for the rest of its period, then TIM3's update interrupt switches its pins at the event and loads its current
+//#define ENABLE_PWM_SYNC_OUTPUT
+
+// Run the hot interrupt paths (step, coil drive, overflow, and correction) from SRAM
+// Avoids the flash wait states and prefetch misses, giving a lower and more consistent interrupt latency
+// The functions are copied to RAM by the startup code with the rest of .data (uses the .RamFunc section of the linker script)
+#define ENABLE_RAM_FUNCTIONS
+#ifdef ENABLE_RAM_FUNCTIONS
+    #define RAMFUNC __attribute__((section(".RamFunc"), noinline))
+#else
+    #define RAMFUNC
+#endif
+
+// Keep the step pin and TIM2's overflow interrupts running while the flash is written (ex. saving the parameters while moving)
+// A flash program or erase stalls every fetch from the flash, so the vector table is moved to SRAM and both interrupts go straight to their RAM functions
+// The flash writes only mask the less urgent interrupts with BASEPRI (like every critical section), so these two keep running through them
+// Needs ENABLE_RAM_FUNCTIONS and ENABLE_COIL_LUT, nothing on the step path can touch the flash (so it is left out with dynamic current)
+#ifdef ENABLE_COIL_LUT
+    #define ENABLE_MOTION_SAFE_FLASH
+#endif
+
+// Encoder commutation
+// The coils are driven from the rotor's angle (through the calibration) instead of being stepped back one microstep at a time
+// They are placed at the desired position, but never more than a full step (the most torque) from the rotor, so a skipped step is caught in a single tick
+// Requires a calibration with the current firmware, and replaces the direction based correction (not used with PID or FOC)
+//#define ENABLE_ENCODER_COMMUTATION
+
+// Field oriented (lead angle) commutation
+// Instead of commutating to the commanded step, the current vector is driven a quarter of an electrical cycle ahead of or behind the rotor
+// The current is set by a PD controller on the position error, so the motor only pulls the current it needs
+// Requires a calibration with the current firmware (the step offset is saved within an electrical cycle)
+//#define ENABLE_FOC
+#ifdef ENABLE_FOC
+    #define FOC_P_GAIN       20.0  // mA per count of position error (2^15 counts per revolution)
+    #define FOC_D_GAIN       0.02  // mA per count/s of velocity
+    #define FOC_MIN_CURRENT  100   // mA, the current that is always applied to hold the motor
+
+    // Cascaded controller (replaces the PD controller)
+    // An outer position P loop sets the velocity, an inner velocity PI loop (using the observer) sets the current
+    // The velocity and acceleration of the step stream are fed forward, so the loops only have to correct the error
+    //#define ENABLE_CASCADED_CONTROL
+    #ifdef ENABLE_CASCADED_CONTROL
+        #define CASCADE_POSITION_GAIN      100.0   // counts/s of velocity per count of position error
+        #define CASCADE_VELOCITY_P         0.05    // mA per count/s of velocity error
+        #define CASCADE_VELOCITY_I         5.0     // mA per count/s of velocity error per second
+        #define CASCADE_ACCEL_FEED         0.0001  // mA per count/s/s of commanded acceleration
+        #define CASCADE_MAX_VELOCITY       500000  // counts/s, the most velocity that the position loop can ask for
+        #define CASCADE_FEED_FILTER_POWER  4       // The commanded velocity is filtered by 1/2^power every loop
+    #endif
+
+    // Inner commutation loop, run from every Nth update event of TIM3 (the coils' PWM) between the corrections
+    // The correction still sets the current from the position error, but the current vector follows the rotor at the PWM's rate,
+    // moved forward from the latest encoder sample with the observer's velocity (the encoder isn't read, so the loop stays short)
+    // Needs ENABLE_ENCODER_OBSERVER, and takes over TIM3's update interrupt (can't be used with ENABLE_PWM_SYNC_OUTPUT)
+    //#define ENABLE_FAST_COMMUTATION
+    #ifdef ENABLE_FAST_COMMUTATION
+        #define FAST_COMMUTATION_FREQ     (uint32_t)30000 // Hz, the updates of TIM3 per commutation are picked to get as close as they can below it
+        #define FAST_COMMUTATION_HOLD     2               // Corrections that the current vector is held for, the loop stops if the correction stops setting it
+        #define FAST_COMMUTATION_MAX_AGE  500             // us, the furthest that a sample is moved forward (an older one is held where it is)
+    #endif
+#endif
+
+// Torque mode (set with M920), the position loop is left out and the current vector is held a quarter of an electrical cycle
+// ahead of or behind the rotor at a commanded current, so the motor pushes with a set torque instead of holding a position
+// The torque is cut back past a speed limit (and turned into a brake further past it), so an unloaded motor can't run away
+// The step input is still counted in the mode, but doesn't move the coils. Leaving the mode holds the motor where it is
+//#define ENABLE_TORQUE_MODE
+#ifdef ENABLE_TORQUE_MODE
+    #define DEFAULT_TORQUE_SPEED_LIMIT  120 // Speed that the torque starts being cut back at (RPM)
+    #define TORQUE_SPEED_LIMIT_BAND     30  // Speed past the limit that the torque is cut to nothing over, the same again past that is a full brake (RPM)
+#endif
+
 // Stallfault
 //#define ENABLE_STALLFAULT
 #ifdef ENABLE_STALLFAULT
@@ -169,15 +791,41 @@
     // StallFault connection (to mainboard)
     // Pulls high on a stepper misalignment after the set period or angular deviation
     #define STALLFAULT_PIN PA_13 //output(GPIOA_BASE_BASE, 13)
+
+    // Anticipatory stall detection, asserts the StallFault pin within a few ms of the rotor starting to slip
+    // The lead of the coils over the rotor is projected ahead by how quickly it is growing, then checked against a lead limit set by the sensitivity (M914)
+    #define ENABLE_STALL_DETECTION
+    #ifdef ENABLE_STALL_DETECTION
+        #define DEFAULT_STALL_SENSITIVITY  50   // 0 to 100, higher trips sooner (50 trips at a full step of lead, the torque peak)
+        #define STALL_PREDICTION_TIME      2000 // us, how far ahead the lead is projected
+        #define STALL_CONFIRM_TIME         1000 // us, how long the projection has to stay past the limit
+        #define STALL_RATE_FILTER_SHIFT    4    // Smoothing of the lead's growth rate (2^n corrections)
+    #endif
+#endif
+
+// Motion quality metrics of each move (M319), for spotting an axis that is wearing (ex. a belt or bearing) before it loses steps
+// A move starts with the first step and ends once the steps stop for MOVE_METRICS_END_TIME. The following error (RMS and peak), the corrective steps,
+// and the largest lead of the rotor are collected during it, then the time that the error takes to settle once it ends
+//#define ENABLE_MOVE_METRICS
+#ifdef ENABLE_MOVE_METRICS
+    #define MOVE_METRICS_END_TIME      20   // ms without a step that ends a move
+    #define MOVE_METRICS_SETTLE_STEPS  1    // microsteps, the error that counts as settled
+    #define MOVE_METRICS_SETTLE_HOLD   5    // ms that the error has to stay settled for
+    #define MOVE_METRICS_SETTLE_LIMIT  1000 // ms, a move that hasn't settled by then is counted as unsettled
 #endif
 
 // The System Clock frequency of the CPU (in MHz)
 // This can be set to 72 and 128 with SYSCLK_SRC_HSE_8 (external oscillator)
 // Can be set to 72 with SYSCLK_SRC_HSE_16 (external oscillator)
 // Can be set to 64 with SYSCLK_SRC_HSI (internal oscillator)
+// The SPI prescaler of the encoder, the CAN bit timing, and the PWM are found from the bus clocks, then checked at boot (M115 shows them)
+// If the oscillator or the PLL doesn't start, the board falls back to 64 MHz from the internal oscillator
 #define SYSCLK_FREQ 128
 #define SYSCLK_SRC_HSE_8
 
+// The fastest SPI clock that the encoder can be read at (in Hz, the TLE5012B is rated up to 8 MHz)
+#define ENCODER_SPI_MAX_FREQ 8000000
+
 // The compare format and maximum value for PWM (lower values = higher max freq)
 #define PWM_COMPARE_FORMAT RESOLUTION_9B_COMPARE_FORMAT
 #define PWM_MAX_VALUE (POWER_2(PWM_COMPARE_FORMAT) - 1)
@@ -285,7 +933,8 @@
 
 // --------------  Internal defines  --------------
 // Under the hood motor setup
-#define SINE_VAL_COUNT (128)
+#define SINE_QUARTER_POWER (8)
+#define SINE_QUARTER_COUNT (1 << SINE_QUARTER_POWER) // Entries in a quarter of the sine wave (256 gives full resolution up to 1/256 microstepping)
 //#define SINE_MAX ((int16_t)(10000))
 #define SINE_MAX (16384) // 2^SINE_POWER == 2^14 == 16384
 
@@ -352,11 +1001,70 @@
 //#define ENABLE_STEPPING_VELOCITY
 //#define IGNORE_FLASH_VERSION
 
-// LED related debugging
-#ifdef ENABLE_LED
-    //#define CHECK_STEPPING_RATE
-    //#define CHECK_CORRECT_MOTOR_RATE
-    //#define CHECK_ENCODER_SPEED
+// Benchmark of the hot paths (normally set by the BTT_S42B_V2_benchmark environment)
+// Measures the cycles of the step, correction, coil, and register read functions with the DWT counter,
+// then finds the fastest sustainable step rate with bursts from the step schedule timer. Results are sent over serial
+//#define ENABLE_BENCHMARK
+#ifdef ENABLE_BENCHMARK
+    #define BENCHMARK_SAMPLES         1000    // Calls to time for each function
+    #define BENCHMARK_BURST_STEPS     10000   // Steps in each burst
+    #define BENCHMARK_MIN_RATE        1000    // Hz, the rate of the first burst (doubled for each burst after)
+    #define BENCHMARK_MAX_RATE        1024000 // Hz, the max rate to try
+    #define BENCHMARK_RATE_TOLERANCE  2       // %, how much longer than expected a burst can take to be sustainable
+    #define BENCHMARK_FOLLOW_RATE     20000   // Hz, the rate of the bursts that the following error is measured in (ENABLE_LATENCY_COMPENSATION)
+#endif
+
+// Always on cycle statistics of the interrupts, encoder reads, and critical sections (reported by M123)
+// Each measured call costs two reads of the DWT cycle counter and a statistics update
+#define ENABLE_PROFILING
+
+// Use of the RAM (reported by M126), the static variables, the heap, and the deepest that the stack has been (including the nested interrupts)
+// The free RAM is painted at boot, so finding the stack's deepest point only has to look for the first word that was overwritten
+//#define ENABLE_MEMORY_STATS
+#ifdef ENABLE_MEMORY_STATS
+    #define STACK_PAINT_PATTERN 0xC5C5C5C5 // Painted into each free word
+    #define STACK_PAINT_MARGIN  64         // Bytes below the stack pointer that are left alone while painting
+#endif
+
+// Trace of the control loop, for catching fast transients while tuning (M309 arms it, M310 dumps it over serial)
+// Each correction records the commanded steps, encoder counts, step error, PID output, and cycles taken into a RAM ring
+// Each sample is 24 bytes, so the buffer takes TRACE_BUFFER_SIZE * 24 bytes of RAM
+//#define ENABLE_TRACE
+#ifdef ENABLE_TRACE
+    #define TRACE_BUFFER_SIZE              256 // Samples, must be a power of 2
+    #define DEFAULT_TRACE_ERROR_THRESHOLD  0   // Microsteps, the step error that triggers the trace (0 triggers right away)
+    #define DEFAULT_TRACE_POST_SAMPLES     192 // Samples to keep after the trigger, the rest of the buffer holds the lead up
+#endif
+
+// Capture of the step input for reproducing a workload (M320 starts the capture or the replay, M321 dumps or loads the stream)
+// Each correction's change of TIM2's count is kept as a byte in the trace's buffer (TRACE_BUFFER_SIZE * 24 corrections, 0.6 s at 10 kHz)
+// The replay feeds the stream back into TIM2's count and the coils at each correction, like the step pin would (leave the step input idle)
+// The dump is the "<time in us> <steps>" file that the native simulation replays
+//#define ENABLE_STEP_STREAM
+#ifdef ENABLE_STEP_STREAM
+    #define DEFAULT_STEP_STREAM_DIVIDER  1 // Corrections summed into each entry of the stream (longer captures, coarser timing)
+#endif
+
+// Live stream of the motor's position, error, speed, and temperature over serial (M312 starts and stops it)
+// Records are taken by a main loop task, and dropped instead of waiting if the bus can't keep up
+//#define ENABLE_TELEMETRY
+#ifdef ENABLE_TELEMETRY
+    #define TELEMETRY_MAX_RATE 1000 // Hz, the fastest that records can be streamed (the task runs at this rate)
+#endif
+
+// Timing probes, the pin of each probed point is high while it runs (see src/software/probe.h for the points)
+// Only the points in the mask are built in. The pins need to be free (the LED without ENABLE_BLINK, PA_8 without ENABLE_OLED)
+//#define ENABLE_PROBES
+#ifdef ENABLE_PROBES
+    #define PROBE_MASK (PROBE_BIT(PROBE_CORRECTION)) // Points to probe, ex. (PROBE_BIT(PROBE_STEP) | PROBE_BIT(PROBE_CORRECTION))
+    #define PROBE_PINS { LED_PIN,  /* PROBE_STEP */ \
+                         LED_PIN,  /* PROBE_CORRECTION */ \
+                         LED_PIN,  /* PROBE_STEP_SCHEDULE */ \
+                         LED_PIN,  /* PROBE_ENCODER_READ */ \
+                         LED_PIN } /* PROBE_CAN_RX */
+
+    // Writes each point to its ITM stimulus port (the point's number) instead of a pin, for tracing over SWO with a debugger
+    //#define PROBE_USE_ITM
 #endif
 
 // Clock debugging (uses OLED pin)
@@ -34,7 +34,7 @@ void PA_8_GPIO_Init(void)
 
 
 // Configures the system clock to 72MHz using a 16MHz external oscillator
-void SystemClock_Config_HSE_16M_SYSCLK_72M(void) {
+bool SystemClock_Config_HSE_16M_SYSCLK_72M(void) {
 
   // Create init structures
   RCC_OscInitTypeDef RCC_OscInitStruct = {0};
@@ -52,7 +52,8 @@ void SystemClock_Config_HSE_16M_SYSCLK_72M(void) {
   RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL9;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
-    //Error_Handler();
+    // The oscillator or the PLL didn't start, the clock is left as it was
+    return false;
   }
   /** Initializes the CPU, AHB and APB buses clocks
   */
@@ -65,7 +66,7 @@ void SystemClock_Config_HSE_16M_SYSCLK_72M(void) {
 
   if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
   {
-    //Error_Handler();
+    return false;
   }
   #ifdef CHECK_MCO_OUTPUT
     HAL_RCC_MCOConfig(RCC_MCO, RCC_MCO1SOURCE_HSE, RCC_MCODIV_1);
@@ -73,11 +74,12 @@ void SystemClock_Config_HSE_16M_SYSCLK_72M(void) {
 
   // Update the frequency variable
   SystemCoreClockUpdate();
+  return true;
 }
 
 
 // Configures the system clock to 72MHz using an 8MHz external oscillator
-void SystemClock_Config_HSE_8M_SYSCLK_72M(void) {
+bool SystemClock_Config_HSE_8M_SYSCLK_72M(void) {
 
   // Create init structures
   RCC_OscInitTypeDef RCC_OscInitStruct = {0};
@@ -95,7 +97,8 @@ void SystemClock_Config_HSE_8M_SYSCLK_72M(void) {
   RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL9;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
-    //Error_Handler();
+    // The oscillator or the PLL didn't start, the clock is left as it was
+    return false;
   }
   /** Initializes the CPU, AHB and APB buses clocks
   */
@@ -108,7 +111,7 @@ void SystemClock_Config_HSE_8M_SYSCLK_72M(void) {
 
   if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
   {
-    //Error_Handler();
+    return false;
   }
 
   #ifdef CHECK_MCO_OUTPUT
@@ -117,11 +120,12 @@ void SystemClock_Config_HSE_8M_SYSCLK_72M(void) {
 
   // Update the frequency variable
   SystemCoreClockUpdate();
+  return true;
 }
 
 
 // Configures the system clock to 128MHz using an 8MHz external oscillator
-void SystemClock_Config_HSE_8M_SYSCLK_128M(void) {
+bool SystemClock_Config_HSE_8M_SYSCLK_128M(void) {
 
   // Create init structures
   RCC_OscInitTypeDef RCC_OscInitStruct = {0};
@@ -139,7 +143,8 @@ void SystemClock_Config_HSE_8M_SYSCLK_128M(void) {
   RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL16;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
-    //Error_Handler();
+    // The oscillator or the PLL didn't start, the clock is left as it was
+    return false;
   }
   /** Initializes the CPU, AHB and APB buses clocks
   */
@@ -152,7 +157,7 @@ void SystemClock_Config_HSE_8M_SYSCLK_128M(void) {
 
   if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
   {
-    //Error_Handler();
+    return false;
   }
 
   #ifdef CHECK_MCO_OUTPUT
@@ -161,11 +166,12 @@ void SystemClock_Config_HSE_8M_SYSCLK_128M(void) {
 
   // Update the frequency variable
   SystemCoreClockUpdate();
+  return true;
 }
 
 
-// Configures the system clock to 72MHz using an 8MHz internal oscillator
-void SystemClock_Config_HSI_8M_SYSCLK_64M(void) {
+// Configures the system clock to 64MHz using an 8MHz internal oscillator
+bool SystemClock_Config_HSI_8M_SYSCLK_64M(void) {
 
   // Create init structures
   RCC_OscInitTypeDef RCC_OscInitStruct = {0};
@@ -182,7 +188,8 @@ void SystemClock_Config_HSI_8M_SYSCLK_64M(void) {
   RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL16;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
-    //Error_Handler();
+    // The oscillator or the PLL didn't start, the clock is left as it was
+    return false;
   }
   /** Initializes the CPU, AHB and APB buses clocks
   */
@@ -195,7 +202,7 @@ void SystemClock_Config_HSI_8M_SYSCLK_64M(void) {
 
   if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
   {
-    //Error_Handler();
+    return false;
   }
 
   #ifdef CHECK_MCO_OUTPUT
@@ -204,4 +211,5 @@ void SystemClock_Config_HSI_8M_SYSCLK_64M(void) {
 
   // Update the frequency variable
   SystemCoreClockUpdate();
+  return true;
 }
@@ -3,9 +3,11 @@
 
 void MCO_GPIO_Init(void);
 void PA_8_GPIO_Init(void);
-void SystemClock_Config_HSE_16M_SYSCLK_72M(void);
-void SystemClock_Config_HSE_8M_SYSCLK_72M(void);
-void SystemClock_Config_HSE_8M_SYSCLK_128M(void);
-void SystemClock_Config_HSI_8M_SYSCLK_64M(void);
+
+// Each of the clock setups returns false if its oscillator or PLL didn't start
+bool SystemClock_Config_HSE_16M_SYSCLK_72M(void);
+bool SystemClock_Config_HSE_8M_SYSCLK_72M(void);
+bool SystemClock_Config_HSE_8M_SYSCLK_128M(void);
+bool SystemClock_Config_HSI_8M_SYSCLK_64M(void);
 
 #endif
@@ -8,13 +8,52 @@
 #include "oled.h"
 #include "led.h"
 #include "cube.h"
+#include "clock.h"
+#include "watchdog.h"
+#include "benchmark.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#include "calibration.h"
+#include "detentComp.h"
+#include "powerLoss.h"
+#include "canGearing.h"
+#include "memoryStats.h"
+#include "probe.h"
+#include "loopOverrun.h"
 
 // Create a new motor instance
 StepperMotor motor = StepperMotor();
 
+// Fast boot (skips the splash screens, the display is started by its task once the motor is running)
+static bool fastBoot = false;
+
+// If the display and buttons have been started
+#ifdef ENABLE_OLED
+static bool uiStarted = false;
+#endif
+
+// Adds a task of the main loop, lighting the LED and reporting it if the scheduler is full (the task would never run otherwise)
+static void addMainTask(const char *name, void (*function)(), uint32_t frequency) {
+    if (!addTask(name, function, frequency)) {
+        #ifdef ENABLE_LED
+            GPIO_WRITE(LED_PIN, HIGH);
+        #endif
+        #ifdef ENABLE_SERIAL
+            sendSerialMessage(F("Error: The scheduler is full, the \"") + String(name) + F("\" task wasn't added (raise MAX_SCHEDULER_TASKS)\n"));
+        #endif
+    }
+}
+
+
 // Run the setup
 void setup() {
 
+    // Paint the free RAM before anything can use it, so the stack's deepest point can be found later
+    #ifdef ENABLE_MEMORY_STATS
+        paintStack();
+    #endif
+
     // Reset of all peripherals, Initializes the Flash interface and the Systick.
     HAL_Init();
 
@@ -22,67 +61,45 @@ void setup() {
     SystemInit();
 
     // Configure the system clock
-    #if defined(SYSCLK_SRC_HSE_16)
-        #if SYSCLK_FREQ == 72
-            SystemClock_Config_HSE_16M_SYSCLK_72M();
-        #else
-            #error "Unsupported oscillator speed"
-        #endif
-    #elif defined(SYSCLK_SRC_HSE_8)
-        #if SYSCLK_FREQ == 72
-            SystemClock_Config_HSE_8M_SYSCLK_72M();
-        #elif SYSCLK_FREQ == 128
-            SystemClock_Config_HSE_8M_SYSCLK_128M();
-        #else
-            #error "Unsupported oscillator speed"
-        #endif
-    #elif defined(SYSCLK_SRC_HSI)
-        #if SYSCLK_FREQ == 64
-            SystemClock_Config_HSI_8M_SYSCLK_64M();
-        #else
-            #error "Unsupported oscillator speed"
-        #endif
-    #else
-	    #error "Unsupported oscillator source"
-    #endif
+    initClock();
+
+    // The encoder's bus and the coils' PWM were started by the constructors (before the clock was set), so their dividers need found again
+    motor.encoder.updateSPIClock();
+    motor.updatePWMFreq();
 
     #ifdef CHECK_MCO_OUTPUT
         MCO_GPIO_Init();
     #endif
 
+    // Start the cycle counter for the interrupt statistics
+    #ifdef ENABLE_PROFILING
+        initProfiling();
+    #endif
+
     // Initialize the LED
     #ifdef ENABLE_LED
         initLED();
     #endif
 
+    // Set up the pins of the timing probes
+    #ifdef ENABLE_PROBES
+        initProbes();
+    #endif
+
     // Zero the encoder
     motor.encoder.zero();
-    #ifdef CHECK_ENCODER_SPEED
-        while(true) {
-            GPIO_WRITE(LED_PIN, HIGH);
-            motor.encoder.getRawAngleAvg();
-            GPIO_WRITE(LED_PIN, LOW);
-            delayMicroseconds(1);
-        }
-    #endif
 
     // Setup the motor for use
     motor.setState(DISABLED, true);
     //motor.setMicrostepping(16);
     //motor.setDesiredAngle(100);
 
+    // Check if the splash screens should be skipped (only once the board is calibrated, the calibration needs the display)
+    fastBoot = (readFlashBool(FAST_BOOT_INDEX) && isCalibrated());
+
     // Only run if the OLED is enabled
     #ifdef ENABLE_OLED
 
-        // Initialize the OLED
-        initOLED();
-
-        // Show the bootscreen
-        showBootscreen();
-
-        // Wait for 3 seconds so everything can boot and user can read the LCD
-        delay(3000);
-
         // Set the inversion (if specified)
         #ifdef INVERTED_DIPS
             setDipInverted(true);
@@ -90,10 +107,25 @@ void setup() {
             setDipInverted(false);
         #endif
 
-        // Initialize the buttons (for menu)
-        initButtons();
+        // Fast boot starts the display later, from its task
+        if (!fastBoot) {
+
+            // Initialize the OLED and the buttons (for menu)
+            initOLED();
+            initButtons();
+            uiStarted = true;
+
+            // Show the bootscreen
+            showBootscreen();
+
+            // Wait for 3 seconds so everything can boot and user can read the LCD
+            delay(3000);
+        }
     #endif
 
+    // Initialize the dip switches (applied by the first check of the dips)
+    initDips();
+
     // Initialize the serial bus
     #ifdef ENABLE_SERIAL
         initSerial();
@@ -105,6 +137,13 @@ void setup() {
         initCAN();
     #endif
 
+    // Warn if a peripheral isn't running within its limits for the clock setup
+    #ifdef ENABLE_SERIAL
+        if (!checkClocks()) {
+            sendSerialMessage(getClockStatus() + '\n');
+        }
+    #endif
+
     #ifdef CHECK_GPIO_OUTPUT_SWITCHING
         PA_8_GPIO_Init();
         while(true) {
@@ -136,6 +175,11 @@ void setup() {
     //clearOLED();
     //writeOLEDString(0, 0, "Close Loop Mode");
 
+    // A position saved at a power loss only matches the calibration that was there when it was saved
+    #ifdef ENABLE_POWER_LOSS_SAVE
+        bool restorePosition = isCalibrated();
+    #endif
+
     // Check if the board is calibrated. Need to force calibration if the board isn't calibrated
     if (!isCalibrated()) {
 
@@ -158,38 +202,50 @@ void setup() {
             writeOLEDString(0, LINE_HEIGHT * 3, F("Requires power"), true);
         #endif
 
-        // Continuously check to see if the select key is clicked (depth index would increase when clicked)
-        while(true) {
+        // Wait for the select key to be clicked (depth index would increase when clicked), then calibrate in place
+        // Once the calibration is saved, the board carries on booting with it
+        #ifdef ENABLE_OLED
+            uint32_t lastFrameTime = 0;
+        #endif
+        while (!isCalibrated()) {
 
+            // Only if the OLED is needed
             #ifdef ENABLE_OLED
+
                 // Check to see if any of the buttons are pressed
                 checkButtons(false, true);
-            #endif
-
-            // ! Only for testing
-            //blink();
 
-            // Only if the OLED is needed
-            #ifdef ENABLE_OLED
-
-                // Check to see if the menu button has been clicked
+                // Start the calibration once the menu button has been clicked (the timers haven't been set up yet)
                 if (getMenuDepth() > 0) {
-
-                    // Calibrate the motor (board reboots afterward)
-                    motor.calibrate();
+                    exitCurrentMenu();
+                    startCalibration(false);
                 }
 
+                // Show the progress (or the failure, the select key tries again)
+                if (getCalibrationState() != CALIBRATION_IDLE && (millis() - lastFrameTime) >= (1000 / DISPLAY_FRAME_RATE)) {
+                    lastFrameTime = millis();
+                    displayCalibration();
+                }
             #else
-                // Just jump to calibrating the motor (board reboots afterward)
-                motor.calibrate();
+                // Just jump to calibrating the motor (the timers haven't been set up yet)
+                if (!isCalibrating()) {
+                    startCalibration(false);
+                }
             #endif
+
+            // Move the calibration along
+            calibrationTask();
         }
     }
-    else {
-        // There is a calibration, load it and move on to the loop
 
-        #ifdef ENABLE_OLED
+    // There is a calibration, load it and move on to the loop
+    #ifdef ENABLE_OLED
 
+        // Fast boot goes straight to the motor, the display is started by its task
+        if (fastBoot) {
+            loadParameters();
+        }
+        else {
             // Let the user know that the calibration was successfully loaded
             clearOLED();
             writeOLEDString(0, 0,               F("Calibration"), false);
@@ -214,46 +270,165 @@ void setup() {
 
             // Write out the first data to the screen (makes sure that the first write isn't interrupted)
             displayMotorData();
-        #else
-            // Nothing special, just try to load the flash data
-            loadParameters();
+        }
+    #else
+        // Nothing special, just try to load the flash data
+        loadParameters();
+    #endif
+
+    // Pick the position back up from before the power was lost (the step counts are in the microstepping that was just loaded)
+    #ifdef ENABLE_POWER_LOSS_SAVE
+        initPowerLossSave(restorePosition);
+    #endif
+
+    // Setup the motor timers and interrupts
+    setupMotorTimers();
+
+    // Measure the hot paths, then report them over serial
+    #ifdef ENABLE_BENCHMARK
+        runBenchmarks();
+    #endif
+
+    // Add the main loop's tasks to the scheduler
+    addMainTask("Dips", checkDips, DIP_TASK_FREQ);
+    #ifdef ENABLE_SERIAL
+        addMainTask("Commands", commandTask, COMMAND_TASK_FREQ);
+    #endif
+    #ifdef ENABLE_CAN
+        addMainTask("CAN", checkCANCmd, CAN_TASK_FREQ);
+        #ifdef ENABLE_CAN_GEARING
+            addMainTask("Gearing", gearBroadcastTask, CAN_GEAR_FRAME_FREQ);
         #endif
+    #endif
+    #ifdef ENABLE_OLED
+        addMainTask("UI", uiTask, UI_TASK_FREQ);
+        addMainTask("Display", displayTask, DISPLAY_FRAME_RATE);
+    #endif
+    #ifdef ENABLE_OVERTEMP_PROTECTION
+        addMainTask("Temperature", temperatureTask, TEMPERATURE_TASK_FREQ);
+    #endif
+    #ifdef ENABLE_TELEMETRY
+        addMainTask("Telemetry", telemetryTask, TELEMETRY_MAX_RATE);
+    #endif
+    addMainTask("Calibration", calibrationTask, CALIBRATION_TASK_FREQ);
+    #ifdef ENABLE_DETENT_COMPENSATION
+        addMainTask("Detent learning", detentTask, CALIBRATION_TASK_FREQ);
+    #endif
 
-        // Setup the motor timers and interrupts
-        setupMotorTimers();
-    }
+    // Start the watchdog last, everything that has to check in is running now
+    #ifdef ENABLE_WATCHDOG
+        initWatchdog();
+        #ifdef ENABLE_SERIAL
+            if (wasWatchdogReset()) {
+                sendSerialMessage(F("Warning: The last reset was caused by the watchdog\n"));
+            }
+        #endif
+    #endif
+
+    // Let the host know that the machine doesn't need to home again
+    #if defined(ENABLE_POWER_LOSS_SAVE) && defined(ENABLE_SERIAL)
+        if (wasPositionRestored()) {
+            sendSerialMessage(F("Position restored from before the power was lost\n"));
+        }
+    #endif
 }
 
 
 // Main loop
 void loop() {
 
-    // Check the dip switches
-    checkDips();
+    // Run whichever task is due
+    runScheduler();
 
-    // Check to see if serial data is available to read
-    #ifdef ENABLE_SERIAL
-        runSerialParser();
+    // Feed the watchdog once the control loop and the tasks have all checked in
+    #ifdef ENABLE_WATCHDOG
+        serviceWatchdog();
     #endif
 
-    #ifdef ENABLE_OLED
-        // Check the buttons
+    // ! Only for testing
+    #ifdef ENABLE_BLINK
+        blink();
+    #endif
+}
+
+
+// Checks to see if serial data is available to read
+#ifdef ENABLE_SERIAL
+void commandTask() {
+    runSerialParser();
+}
+#endif
+
+
+// Checks the buttons (they update the display when clicked)
+#ifdef ENABLE_OLED
+void uiTask() {
+
+    // Start the display and buttons if they were skipped by a fast boot
+    if (!uiStarted) {
+        initOLED();
+        initButtons();
+        uiStarted = true;
+        return;
+    }
+
+    // The buttons are ignored while calibrating, the progress is shown until it is done
+    if (!isCalibrating()) {
         checkButtons(true);
+    }
+}
+
+
+// Refreshes the motor data on the display, at DISPLAY_FRAME_RATE at most
+void displayTask() {
+
+    // The display waits while the control loop is overloaded
+    #ifdef ENABLE_OVERRUN_DETECTION
+    if (getOverloadLevel() != OVERLOAD_NONE) {
+        return;
+    }
+    #endif
 
-        // Only update the display if the motor data is being displayed, buttons update the display when clicked
-        if (getMenuDepth() == MOTOR_DATA) {
+    // Only update the display if the motor data is being displayed, the menus are redrawn by the buttons
+    // The calibration takes the place of the motor data while it is running
+    if (uiStarted && getMenuDepth() == MOTOR_DATA) {
+        if (isCalibrating()) {
+            displayCalibration();
+        }
+        else {
             displayMotorData();
         }
-    #endif
+    }
+}
+#endif
 
-    // We need a little delay to allow the motor time to process if it needs it
-    #ifdef ENABLE_BLINK
-        // ! Only for testing
-        blink();
-    #else
-        delay(50);
+
+// Gets if the board boots without the splash screens
+bool getFastBoot() {
+    return fastBoot;
+}
+
+
+// Sets if the board boots without the splash screens (takes effect on the next boot once saved)
+void setFastBoot(bool enabled) {
+    fastBoot = enabled;
+}
+
+
+// Checks the encoder's temperature against the overtemp limit
+#ifdef ENABLE_OVERTEMP_PROTECTION
+void temperatureTask() {
+
+    // The limits are in the raw units of the encoder, so there isn't any float math
+    int16_t rawTemp = motor.encoder.getRawTempAvg();
+    motor.encoder.checkOvertemp(rawTemp);
+
+    // The coils heat up from the temperature of the encoder
+    #ifdef ENABLE_THERMAL_MODEL
+        motor.setThermalAmbient(motor.encoder.rawTempToTenths(rawTemp));
     #endif
 }
+#endif
 
 
 // ! Only here for testing
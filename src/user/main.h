@@ -11,6 +11,22 @@ extern StepperMotor motor;
 void setup();
 void loop();
 
+// Tasks of the main loop (run by the scheduler)
+#ifdef ENABLE_SERIAL
+void commandTask();
+#endif
+#ifdef ENABLE_OLED
+void uiTask();
+void displayTask();
+#endif
+#ifdef ENABLE_OVERTEMP_PROTECTION
+void temperatureTask();
+#endif
+
+// Fast boot (skips the splash screens and starts the display in the background, the motor is ready right away)
+bool getFastBoot();
+void setFastBoot(bool enabled);
+
 void blink();
 
 #endif